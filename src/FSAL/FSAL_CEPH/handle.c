@@ -163,7 +163,7 @@ static fsal_status_t fsal_readdir(struct fsal_obj_handle *dir_pub,
 				continue;
 			}
 
-			if (!cb(de.d_name, dir_state, de.d_off))
+			if (!cb(de.d_name, NULL, dir_state, de.d_off))
 				goto closedir;
 
 		} else if (rc == 0) {
@@ -199,7 +199,8 @@ static fsal_status_t fsal_readdir(struct fsal_obj_handle *dir_pub,
 
 static fsal_status_t fsal_create(struct fsal_obj_handle *dir_pub,
 				 const char *name, struct attrlist *attrib,
-				 struct fsal_obj_handle **obj_pub)
+				 struct fsal_obj_handle **obj_pub,
+				 struct fsal_postop_attrs *postop)
 {
 	/* Generic status return */
 	int rc = 0;
@@ -252,7 +253,8 @@ static fsal_status_t fsal_create(struct fsal_obj_handle *dir_pub,
 
 static fsal_status_t fsal_mkdir(struct fsal_obj_handle *dir_pub,
 				const char *name, struct attrlist *attrib,
-				struct fsal_obj_handle **obj_pub)
+				struct fsal_obj_handle **obj_pub,
+				struct fsal_postop_attrs *postop)
 {
 	/* Generic status return */
 	int rc = 0;
@@ -307,7 +309,8 @@ static fsal_status_t fsal_mkdir(struct fsal_obj_handle *dir_pub,
 static fsal_status_t fsal_symlink(struct fsal_obj_handle *dir_pub,
 				  const char *name, const char *link_path,
 				  struct attrlist *attrib,
-				  struct fsal_obj_handle **obj_pub)
+				  struct fsal_obj_handle **obj_pub,
+				  struct fsal_postop_attrs *postop)
 {
 	/* Generic status return */
 	int rc = 0;
@@ -534,7 +537,8 @@ static fsal_status_t setattrs(struct fsal_obj_handle *handle_pub,
 
 static fsal_status_t fsal_link(struct fsal_obj_handle *handle_pub,
 			       struct fsal_obj_handle *destdir_pub,
-			       const char *name)
+			       const char *name,
+			       struct fsal_postop_attrs *postop)
 {
 	/* Generic status return */
 	int rc = 0;
@@ -576,7 +580,8 @@ static fsal_status_t fsal_rename(struct fsal_obj_handle *obj_hdl,
 				 struct fsal_obj_handle *olddir_pub,
 				 const char *old_name,
 				 struct fsal_obj_handle *newdir_pub,
-				 const char *new_name)
+				 const char *new_name,
+				 struct fsal_postop_attrs *postop)
 {
 	/* Generic status return */
 	int rc = 0;
@@ -612,7 +617,8 @@ static fsal_status_t fsal_rename(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t fsal_unlink(struct fsal_obj_handle *dir_pub,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	/* Generic status return */
 	int rc = 0;
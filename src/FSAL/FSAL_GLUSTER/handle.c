@@ -185,7 +185,8 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 			    || (strcmp(de.d_name, "..") == 0)) {
 				continue;
 			}
-			if (!cb(de.d_name, dir_state, glfs_telldir(glfd)))
+			if (!cb(de.d_name, NULL, dir_state,
+				glfs_telldir(glfd)))
 				goto out;
 		} else if (rc == 0 && pde == NULL) {
 			*eof = true;
@@ -212,7 +213,8 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 			    const char *name, struct attrlist *attrib,
-			    struct fsal_obj_handle **handle)
+			    struct fsal_obj_handle **handle,
+			    struct fsal_postop_attrs *postop)
 {
 	int rc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -298,7 +300,8 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 			     const char *name, struct attrlist *attrib,
-			     struct fsal_obj_handle **handle)
+			     struct fsal_obj_handle **handle,
+			     struct fsal_postop_attrs *postop)
 {
 	int rc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -384,7 +387,8 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 			      const char *name, object_file_type_t nodetype,
 			      fsal_dev_t *dev, struct attrlist *attrib,
-			      struct fsal_obj_handle **handle)
+			      struct fsal_obj_handle **handle,
+			      struct fsal_postop_attrs *postop)
 {
 	int rc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -497,7 +501,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name, const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	int rc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -840,7 +845,8 @@ out:
 
 static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
 	int rc = 0, credrc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -899,7 +905,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	int rc = 0, credrc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -956,7 +963,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	int rc = 0, credrc = 0;
 	fsal_status_t status = { ERR_FSAL_NO_ERROR, 0 };
@@ -299,7 +299,8 @@ static inline int get_stat_by_handle_at(struct fsal_filesystem *fs,
 
 static fsal_status_t lustre_create(struct fsal_obj_handle *dir_hdl,
 				   const char *name, struct attrlist *attrib,
-				   struct fsal_obj_handle **handle)
+				   struct fsal_obj_handle **handle,
+				   struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *myself, *hdl;
 	char newpath[MAXPATHLEN];
@@ -373,7 +374,8 @@ static fsal_status_t lustre_create(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t lustre_makedir(struct fsal_obj_handle *dir_hdl,
 				    const char *name, struct attrlist *attrib,
-				    struct fsal_obj_handle **handle)
+				    struct fsal_obj_handle **handle,
+				    struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *myself, *hdl;
 	char dirpath[MAXPATHLEN];
@@ -451,7 +453,8 @@ static fsal_status_t lustre_makenode(struct fsal_obj_handle *dir_hdl,
 				     object_file_type_t nodetype,	/* IN */
 				     fsal_dev_t *dev,	/* IN */
 				     struct attrlist *attrib,
-				     struct fsal_obj_handle **handle)
+				     struct fsal_obj_handle **handle,
+				     struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *myself, *hdl;
 	char dirpath[MAXPATHLEN];
@@ -561,7 +564,8 @@ static fsal_status_t lustre_makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t lustre_makesymlink(struct fsal_obj_handle *dir_hdl,
 					const char *name, const char *link_path,
 					struct attrlist *attrib,
-					struct fsal_obj_handle **handle)
+					struct fsal_obj_handle **handle,
+					struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *myself, *hdl;
 	char dirpath[MAXPATHLEN];
@@ -710,7 +714,8 @@ static fsal_status_t lustre_readsymlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t lustre_linkfile(struct fsal_obj_handle *obj_hdl,
 				     struct fsal_obj_handle *destdir_hdl,
-				     const char *name)
+				     const char *name,
+				     struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *myself, *destdir;
 	char srcpath[MAXPATHLEN];
@@ -834,6 +839,7 @@ static fsal_status_t lustre_read_dirents(struct fsal_obj_handle *dir_hdl,
 
 			/* callback to cache inode */
 			if (!cb(dentry->d_name,
+				NULL,
 				dir_state,
 				(fsal_cookie_t) dentry->d_off))
 					goto done;
@@ -855,7 +861,8 @@ static fsal_status_t lustre_renamefile(struct fsal_obj_handle *obj_hdl,
 				       struct fsal_obj_handle *olddir_hdl,
 				       const char *old_name,
 				       struct fsal_obj_handle *newdir_hdl,
-				       const char *new_name)
+				       const char *new_name,
+				       struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *olddir, *newdir;
 	char olddirpath[MAXPATHLEN];
@@ -1126,7 +1133,8 @@ static fsal_status_t lustre_setattrs(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t lustre_file_unlink(struct fsal_obj_handle *dir_hdl,
-					const char *name)
+					const char *name,
+					struct fsal_postop_attrs *postop)
 {
 	struct lustre_fsal_obj_handle *myself;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
@@ -43,6 +43,7 @@
 #include "nfs_proto_functions.h"
 #include "nfs_proto_tools.h"
 #include "export_mgr.h"
+#include "fsal_up.h"
 
 #define FSAL_PROXY_NFS_V4 4
 
@@ -59,6 +60,24 @@ static pthread_mutex_t listlock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t sockless = PTHREAD_COND_INITIALIZER;
 static pthread_cond_t need_context = PTHREAD_COND_INITIALIZER;
 
+/* Backend delegations, see pxy_deleg_get */
+static bool pxy_deleg_enabled;
+static uint32_t pxy_deleg_file_cache;
+static uint64_t pxy_deleg_cache_size;
+static uint64_t pxy_deleg_cached;
+static unsigned int pxy_cb_prognum;
+static int pxy_cb_sock = -1;
+static in_port_t pxy_cb_port;
+static pthread_t pxy_cb_thread;
+
+/*
+ * Delegations granted by the backend.  A delegation is put on or
+ * taken off this list, and attached to or detached from its handle,
+ * with both this mutex and the handle's deleg_lock held.
+ */
+static struct glist_head pxy_delegs = GLIST_HEAD_INIT(pxy_delegs);
+static pthread_mutex_t pxy_deleg_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Protects the "free_contexts" list and the "need_context" condition.
  */
@@ -115,6 +134,43 @@ struct pxy_handle_blob {
 	uint8_t bytes[0];
 };
 
+/*
+ * Cached data is kept in blocks of this size, each valid or not.
+ */
+#define PXY_DELEG_BLOCK 4096
+
+/* Seconds before asking again for a delegation that was refused or
+ * recalled, so a shared file does not bounce between clients.
+ */
+#define PXY_DELEG_RETRY 10
+
+/*
+ * A delegation the backend granted on a file.  While it is held the
+ * attributes and data kept here are authoritative.
+ */
+struct pxy_deleg {
+	struct glist_head list;		/*< On pxy_delegs, or being returned */
+	struct pxy_obj_handle *ph;	/*< NULL once detached */
+	open_delegation_type4 type;
+	stateid4 stateid;
+	struct attrlist attrs;
+	char *data;			/*< Start of the file */
+	uint8_t *valid;			/*< A bit per PXY_DELEG_BLOCK of data */
+	size_t cached;			/*< Bytes data can hold */
+	const struct fsal_up_vector *up_ops;
+	struct fsal_module *fsal;
+	struct pxy_handle_blob *key;	/*< Copy of the handle blob */
+};
+
+/*
+ * NFSv4.0 can only OPEN by name, so a file that may be delegated
+ * remembers the directory and name it was found by.
+ */
+struct pxy_open_name {
+	nfs_fh4 parent;
+	char name[];
+};
+
 struct pxy_obj_handle {
 	struct fsal_obj_handle obj;
 	nfs_fh4 fh4;
@@ -122,6 +178,11 @@ struct pxy_obj_handle {
 	nfs23_map_handle_t h23;
 #endif
 	fsal_openflags_t openflags;
+	pthread_mutex_t deleg_lock;	/*< Protects what follows */
+	struct pxy_deleg *deleg;
+	uint32_t deleg_gen;		/*< Bumped when deleg changes */
+	time_t deleg_retry;
+	struct pxy_open_name *oname;
 	struct pxy_handle_blob blob;
 };
 
@@ -250,13 +311,30 @@ static struct bitmap4 pxy_bitmap_getattr = {
 	.bitmap4_len = 2
 };
 
-/* Until readdir callback can take more information do not ask for more then
- * just type */
+/* What pxy_bitmap_getattr asks for, and the handle, so that the entries
+ * of a directory read need not be looked up one by one.  RDATTR_ERROR
+ * keeps an entry whose attributes cannot be had from failing the whole
+ * READDIR. */
 static struct bitmap4 pxy_bitmap_readdir = {
-	.map[0] = PXY_ATTR_BIT(FATTR4_TYPE),
-	.bitmap4_len = 1
+	.map[0] =
+	    (PXY_ATTR_BIT(FATTR4_TYPE) | PXY_ATTR_BIT(FATTR4_CHANGE) |
+	     PXY_ATTR_BIT(FATTR4_SIZE) | PXY_ATTR_BIT(FATTR4_FSID) |
+	     PXY_ATTR_BIT(FATTR4_RDATTR_ERROR) |
+	     PXY_ATTR_BIT(FATTR4_FILEHANDLE) | PXY_ATTR_BIT(FATTR4_FILEID)),
+	.map[1] =
+	    (PXY_ATTR_BIT2(FATTR4_MODE) | PXY_ATTR_BIT2(FATTR4_NUMLINKS) |
+	     PXY_ATTR_BIT2(FATTR4_OWNER) | PXY_ATTR_BIT2(FATTR4_OWNER_GROUP) |
+	     PXY_ATTR_BIT2(FATTR4_SPACE_USED) |
+	     PXY_ATTR_BIT2(FATTR4_TIME_ACCESS) |
+	     PXY_ATTR_BIT2(FATTR4_TIME_METADATA) |
+	     PXY_ATTR_BIT2(FATTR4_TIME_MODIFY) | PXY_ATTR_BIT2(FATTR4_RAWDEV)),
+	.bitmap4_len = 2
 };
 
+/* Room left in the receive buffer for the RPC and COMPOUND headers and
+ * the PUTFH result around a READDIR reply */
+#define PXY_READDIR_SLACK 512
+
 static struct bitmap4 pxy_bitmap_fsinfo = {
 	.map[0] =
 	    (PXY_ATTR_BIT(FATTR4_FILES_AVAIL) | PXY_ATTR_BIT(FATTR4_FILES_FREE)
@@ -827,6 +905,7 @@ static int pxy_setclientid(clientid4 *resultclientid, uint32_t *lease_time)
 	struct sockaddr_in sin;
 	socklen_t slen = sizeof(sin);
 	char addrbuf[sizeof("255.255.255.255")];
+	char uaddr[sizeof("255.255.255.255.255.255")];
 
 	LogEvent(COMPONENT_FSAL,
 		 "Negotiating a new ClientId with the remote server");
@@ -846,9 +925,19 @@ static int pxy_setclientid(clientid4 *resultclientid, uint32_t *lease_time)
 		snprintf(nfsclientid.verifier, NFS4_VERIFIER_SIZE, "%08x",
 			 (int)ServerBootTime.tv_sec);
 
-	cbproxy.cb_program = 0;
+	/* The backend calls back on the address it sees us coming from,
+	 * at the port of the callback service.
+	 */
 	cbproxy.cb_location.r_netid = "tcp";
-	cbproxy.cb_location.r_addr = "127.0.0.1";
+	if (pxy_cb_sock >= 0) {
+		snprintf(uaddr, sizeof(uaddr), "%s.%u.%u", addrbuf,
+			 ntohs(pxy_cb_port) >> 8, ntohs(pxy_cb_port) & 0xff);
+		cbproxy.cb_program = pxy_cb_prognum;
+		cbproxy.cb_location.r_addr = uaddr;
+	} else {
+		cbproxy.cb_program = 0;
+		cbproxy.cb_location.r_addr = "127.0.0.1";
+	}
 
 	sok = &res[0].nfs_resop4_u.opsetclientid.SETCLIENTID4res_u.resok4;
 	arg[0].argop = NFS4_OP_SETCLIENTID;
@@ -888,6 +977,602 @@ static int pxy_setclientid(clientid4 *resultclientid, uint32_t *lease_time)
 	return 0;
 }
 
+/**
+ * @brief Forget the cached data of a delegated file
+ *
+ * Called with the handle's deleg_lock held, if it has one.
+ */
+
+static void pxy_deleg_drop_data(struct pxy_deleg *d)
+{
+	if (d->data == NULL)
+		return;
+	gsh_free(d->data);
+	gsh_free(d->valid);
+	d->data = NULL;
+	d->valid = NULL;
+	atomic_sub_uint64_t(&pxy_deleg_cached, d->cached);
+	d->cached = 0;
+}
+
+/**
+ * @brief Free a delegation detached from its handle
+ *
+ * @param[in] d Delegation
+ */
+
+static void pxy_deleg_free(struct pxy_deleg *d)
+{
+	pxy_deleg_drop_data(d);
+	gsh_free(d->key);
+	gsh_free(d);
+}
+
+/**
+ * @brief Take a delegation off the list and away from its handle
+ *
+ * Called with pxy_deleg_mutex held.  Later uses of the handle go to
+ * the backend again.
+ *
+ * @param[in] d Delegation
+ */
+
+static void pxy_deleg_detach(struct pxy_deleg *d)
+{
+	struct pxy_obj_handle *ph = d->ph;
+
+	glist_del(&d->list);
+
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	ph->deleg = NULL;
+	ph->deleg_gen++;
+	ph->deleg_retry = time(NULL) + PXY_DELEG_RETRY;
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+
+	d->ph = NULL;
+}
+
+/**
+ * @brief Send DELEGRETURN
+ *
+ * @param[in] fh4 File
+ * @param[in] sid Delegation stateid
+ */
+
+static void pxy_do_delegreturn(const nfs_fh4 *fh4, stateid4 *sid)
+{
+	int rc;
+	int opcnt = 0;
+#define FSAL_DELEGRETURN_NB_OP_ALLOC 2
+	nfs_argop4 argoparray[FSAL_DELEGRETURN_NB_OP_ALLOC];
+	nfs_resop4 resoparray[FSAL_DELEGRETURN_NB_OP_ALLOC];
+
+	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, *fh4);
+	COMPOUNDV4_ARG_ADD_OP_DELEGRETURN(opcnt, argoparray, sid);
+
+	rc = pxy_compoundv4_execute(__func__, NULL, opcnt, argoparray,
+				    resoparray);
+	if (rc != NFS4_OK)
+		LogDebug(COMPONENT_FSAL, "DELEGRETURN failed with %d", rc);
+}
+
+/**
+ * @brief Give a detached delegation back to the backend
+ *
+ * @param[in] d Delegation, not freed
+ */
+
+static void pxy_delegreturn(struct pxy_deleg *d)
+{
+	nfs_fh4 fh4 = {
+		.nfs_fh4_len = d->key->len - sizeof(*d->key),
+		.nfs_fh4_val = (char *)d->key->bytes
+	};
+
+	pxy_do_delegreturn(&fh4, &d->stateid);
+}
+
+/**
+ * @brief Tell the cache a delegated object may have changed
+ *
+ * @param[in] d Detached delegation
+ */
+
+static void pxy_deleg_invalidate(struct pxy_deleg *d)
+{
+	struct gsh_buffdesc key = {
+		.addr = d->key,
+		.len = d->key->len
+	};
+	cache_inode_status_t rc;
+
+	rc = d->up_ops->invalidate(d->fsal, &key,
+				   CACHE_INODE_INVALIDATE_ATTRS |
+				   CACHE_INODE_INVALIDATE_CONTENT);
+	if (rc != CACHE_INODE_SUCCESS && rc != CACHE_INODE_NOT_FOUND)
+		LogDebug(COMPONENT_FSAL, "Invalidate after recall: %s",
+			 cache_inode_err_str(rc));
+}
+
+/**
+ * @brief Return the delegation a handle holds, if any
+ *
+ * @param[in] ph Handle
+ */
+
+static void pxy_deleg_give_up(struct pxy_obj_handle *ph)
+{
+	struct pxy_deleg *d;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_mutex);
+	d = ph->deleg;
+	if (d != NULL)
+		pxy_deleg_detach(d);
+	PTHREAD_MUTEX_unlock(&pxy_deleg_mutex);
+
+	if (d != NULL) {
+		pxy_delegreturn(d);
+		pxy_deleg_free(d);
+	}
+}
+
+/**
+ * @brief Drop every delegation after the client id changed
+ *
+ * Delegations belong to the client id they were granted to, so with
+ * a new one they are gone on the backend and need not be returned.
+ */
+
+static void pxy_deleg_forget_all(void)
+{
+	struct glist_head gone;
+	struct glist_head *c, *n;
+
+	glist_init(&gone);
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_mutex);
+	glist_for_each_safe(c, n, &pxy_delegs) {
+		struct pxy_deleg *d = container_of(c, struct pxy_deleg, list);
+
+		pxy_deleg_detach(d);
+		glist_add_tail(&gone, &d->list);
+	}
+	PTHREAD_MUTEX_unlock(&pxy_deleg_mutex);
+
+	glist_for_each_safe(c, n, &gone) {
+		struct pxy_deleg *d = container_of(c, struct pxy_deleg, list);
+
+		glist_del(c);
+		pxy_deleg_invalidate(d);
+		pxy_deleg_free(d);
+	}
+}
+
+/**
+ * @brief Find a granted delegation
+ *
+ * Called with pxy_deleg_mutex held.
+ *
+ * @param[in] sid Its stateid, or NULL
+ * @param[in] fh  Handle of the file, or NULL
+ *
+ * @return The delegation or NULL.
+ */
+
+static struct pxy_deleg *pxy_deleg_find(const stateid4 *sid,
+					const nfs_fh4 *fh)
+{
+	struct glist_head *c;
+
+	glist_for_each(c, &pxy_delegs) {
+		struct pxy_deleg *d = container_of(c, struct pxy_deleg, list);
+
+		if (sid && memcmp(d->stateid.other, sid->other,
+				  sizeof(sid->other)))
+			continue;
+		if (fh && (fh->nfs_fh4_len != d->ph->fh4.nfs_fh4_len ||
+			   memcmp(fh->nfs_fh4_val, d->ph->fh4.nfs_fh4_val,
+				  fh->nfs_fh4_len)))
+			continue;
+		return d;
+	}
+	return NULL;
+}
+
+/**
+ * @brief CB_RECALL: take the delegation away from its handle
+ *
+ * The delegation is returned once the reply has been sent.
+ *
+ * @param[in]  arg     Arguments
+ * @param[out] returns Delegations to return
+ *
+ * @return Status of the operation.
+ */
+
+static nfsstat4 pxy_cb_recall(CB_RECALL4args *arg, struct glist_head *returns)
+{
+	struct pxy_deleg *d;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_mutex);
+	d = pxy_deleg_find(&arg->stateid, NULL);
+	if (d != NULL) {
+		pxy_deleg_detach(d);
+		glist_add_tail(returns, &d->list);
+	}
+	PTHREAD_MUTEX_unlock(&pxy_deleg_mutex);
+
+	LogDebug(COMPONENT_FSAL, "CB_RECALL of %s delegation",
+		 d ? "a granted" : "an unknown");
+
+	return d ? NFS4_OK : NFS4ERR_BAD_STATEID;
+}
+
+/**
+ * @brief CB_GETATTR: size and change of a file delegated for write
+ *
+ * @param[in]  arg Arguments
+ * @param[out] res Result, attributes to be freed by the caller
+ *
+ * @return Status of the operation.
+ */
+
+static nfsstat4 pxy_cb_getattr(CB_GETATTR4args *arg, CB_GETATTR4res *res)
+{
+	struct pxy_deleg *d;
+	struct xdr_attrs_args args;
+	struct attrlist attrs;
+	struct bitmap4 bits = arg->attr_request;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_mutex);
+	d = pxy_deleg_find(NULL, &arg->fh);
+	if (d != NULL && d->type == OPEN_DELEGATE_WRITE) {
+		PTHREAD_MUTEX_lock(&d->ph->deleg_lock);
+		attrs = d->attrs;
+		PTHREAD_MUTEX_unlock(&d->ph->deleg_lock);
+	} else {
+		d = NULL;
+	}
+	PTHREAD_MUTEX_unlock(&pxy_deleg_mutex);
+
+	if (d == NULL)
+		return NFS4ERR_BADHANDLE;
+
+	/* Only these may be asked for (RFC 3530, 10.4.3) */
+	bits.map[0] &= (1U << FATTR4_CHANGE) | (1U << FATTR4_SIZE);
+	bits.map[1] = 0;
+	bits.map[2] = 0;
+
+	memset(&args, 0, sizeof(args));
+	args.attrs = &attrs;
+	if (nfs4_FSALattr_To_Fattr(&args, &bits,
+				   &res->CB_GETATTR4res_u.resok4.
+				   obj_attributes) != 0)
+		return NFS4ERR_SERVERFAULT;
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Execute a CB_COMPOUND
+ *
+ * @param[in]  args    Arguments
+ * @param[out] res     Result, to be freed with pxy_cb_compound_free
+ * @param[out] returns Delegations recalled
+ */
+
+static void pxy_cb_compound(CB_COMPOUND4args *args, CB_COMPOUND4res *res,
+			    struct glist_head *returns)
+{
+	u_int i;
+
+	res->status = NFS4_OK;
+	res->tag = args->tag;
+	res->resarray.resarray_len = 0;
+	res->resarray.resarray_val =
+	    gsh_calloc(args->argarray.argarray_len, sizeof(nfs_cb_resop4));
+	if (res->resarray.resarray_val == NULL) {
+		res->status = NFS4ERR_RESOURCE;
+		return;
+	}
+
+	if (args->minorversion != 0) {
+		res->status = NFS4ERR_MINOR_VERS_MISMATCH;
+		return;
+	}
+
+	for (i = 0; i < args->argarray.argarray_len; i++) {
+		nfs_cb_argop4 *op = &args->argarray.argarray_val[i];
+		nfs_cb_resop4 *rop = &res->resarray.resarray_val[i];
+
+		rop->resop = op->argop;
+		switch (op->argop) {
+		case NFS4_OP_CB_RECALL:
+			res->status =
+			    pxy_cb_recall(&op->nfs_cb_argop4_u.opcbrecall,
+					  returns);
+			rop->nfs_cb_resop4_u.opcbrecall.status = res->status;
+			break;
+
+		case NFS4_OP_CB_GETATTR:
+			res->status =
+			    pxy_cb_getattr(&op->nfs_cb_argop4_u.opcbgetattr,
+					   &rop->nfs_cb_resop4_u.opcbgetattr);
+			rop->nfs_cb_resop4_u.opcbgetattr.status = res->status;
+			break;
+
+		default:
+			rop->resop = NFS4_OP_CB_ILLEGAL;
+			res->status = NFS4ERR_OP_ILLEGAL;
+			rop->nfs_cb_resop4_u.opcbillegal.status = res->status;
+			break;
+		}
+		res->resarray.resarray_len++;
+		if (res->status != NFS4_OK)
+			break;
+	}
+}
+
+static void pxy_cb_compound_free(CB_COMPOUND4res *res)
+{
+	u_int i;
+
+	for (i = 0; i < res->resarray.resarray_len; i++) {
+		nfs_cb_resop4 *rop = &res->resarray.resarray_val[i];
+
+		if (rop->resop == NFS4_OP_CB_GETATTR &&
+		    rop->nfs_cb_resop4_u.opcbgetattr.status == NFS4_OK)
+			nfs4_Fattr_Free(&rop->nfs_cb_resop4_u.opcbgetattr.
+					CB_GETATTR4res_u.resok4.obj_attributes);
+	}
+	gsh_free(res->resarray.resarray_val);
+}
+
+#define PXY_CB_BUFSZ 8192
+
+/**
+ * @brief Read one RPC record from the callback connection
+ *
+ * @param[in]  sock Connection
+ * @param[out] buf  PXY_CB_BUFSZ bytes
+ *
+ * @return Length of the record, or -1 if the connection must go.
+ */
+
+static int pxy_cb_read_record(int sock, char *buf)
+{
+	uint32_t recmark;
+	int len = 0;
+
+	do {
+		uint32_t frag;
+		int cnt = 0;
+
+		while (cnt < sizeof(recmark)) {
+			int bc = read(sock, (char *)&recmark + cnt,
+				      sizeof(recmark) - cnt);
+			if (bc <= 0)
+				return -1;
+			cnt += bc;
+		}
+		recmark = ntohl(recmark);
+		frag = recmark & ~(1U << 31);
+
+		if (frag > PXY_CB_BUFSZ - len) {
+			LogCrit(COMPONENT_FSAL,
+				"Callback record of more than %d bytes",
+				PXY_CB_BUFSZ);
+			return -1;
+		}
+
+		while (frag > 0) {
+			int bc = read(sock, buf + len, frag);
+			if (bc <= 0)
+				return -1;
+			len += bc;
+			frag -= bc;
+		}
+	} while (!(recmark & (1U << 31)));
+
+	return len;
+}
+
+/**
+ * @brief Answer one call on the callback connection
+ *
+ * Only one connection is served at a time, see pxy_cb_listen.
+ *
+ * @param[in] sock Connection
+ *
+ * @return 0, or -1 if the connection must go.
+ */
+
+static int pxy_cb_serve(int sock)
+{
+	char *buf = gsh_malloc(2 * PXY_CB_BUFSZ);
+	char *out = buf + PXY_CB_BUFSZ;
+	char cred_area[2 * MAX_AUTH_BYTES];
+	struct rpc_msg call, reply;
+	CB_COMPOUND4args args;
+	CB_COMPOUND4res res;
+	struct glist_head returns;
+	struct glist_head *c, *n;
+	bool decoded = false;
+	int len, rc = -1;
+	XDR x;
+
+	if (buf == NULL)
+		return -1;
+
+	glist_init(&returns);
+
+	len = pxy_cb_read_record(sock, buf);
+	if (len < 0)
+		goto out;
+
+	memset(&call, 0, sizeof(call));
+	call.rm_call.cb_cred.oa_base = cred_area;
+	call.rm_call.cb_verf.oa_base = cred_area + MAX_AUTH_BYTES;
+	memset(&x, 0, sizeof(x));
+	xdrmem_create(&x, buf, len, XDR_DECODE);
+	if (!xdr_callmsg(&x, &call) || call.rm_direction != CALL) {
+		LogDebug(COMPONENT_FSAL, "Not a call on callback connection");
+		rc = 0;
+		goto out;
+	}
+
+	memset(&reply, 0, sizeof(reply));
+	reply.rm_xid = call.rm_xid;
+	reply.rm_direction = REPLY;
+	reply.rm_reply.rp_stat = MSG_ACCEPTED;
+	reply.acpted_rply.ar_verf.oa_flavor = AUTH_NONE;
+	reply.acpted_rply.ar_stat = SUCCESS;
+	reply.acpted_rply.ar_results.proc = (xdrproc_t) xdr_void;
+	reply.acpted_rply.ar_results.where = NULL;
+
+	if (call.rm_call.cb_prog != pxy_cb_prognum) {
+		reply.acpted_rply.ar_stat = PROG_UNAVAIL;
+	} else if (call.rm_call.cb_vers != 1) {
+		reply.acpted_rply.ar_stat = PROG_MISMATCH;
+		reply.acpted_rply.ar_vers.low = 1;
+		reply.acpted_rply.ar_vers.high = 1;
+	} else if (call.rm_call.cb_proc == CB_COMPOUND) {
+		memset(&args, 0, sizeof(args));
+		if (xdr_CB_COMPOUND4args(&x, &args)) {
+			decoded = true;
+			pxy_cb_compound(&args, &res, &returns);
+			reply.acpted_rply.ar_results.proc =
+			    (xdrproc_t) xdr_CB_COMPOUND4res;
+			reply.acpted_rply.ar_results.where = (caddr_t) &res;
+		} else {
+			reply.acpted_rply.ar_stat = GARBAGE_ARGS;
+		}
+	} else if (call.rm_call.cb_proc != CB_NULL) {
+		reply.acpted_rply.ar_stat = PROC_UNAVAIL;
+	}
+
+	memset(&x, 0, sizeof(x));
+	xdrmem_create(&x, out + 4, PXY_CB_BUFSZ - 4, XDR_ENCODE);
+	if (xdr_replymsg(&x, &reply)) {
+		u_int pos = xdr_getpos(&x);
+		u_int recmark = htonl(pos | (1U << 31));
+		char *p = out;
+
+		memcpy(out, &recmark, sizeof(recmark));
+		pos += sizeof(recmark);
+		while (pos > 0) {
+			int wc = write(sock, p, pos);
+			if (wc <= 0)
+				break;
+			p += wc;
+			pos -= wc;
+		}
+		rc = pos ? -1 : 0;
+	} else {
+		LogCrit(COMPONENT_FSAL, "Cannot encode callback reply");
+	}
+
+	if (decoded) {
+		pxy_cb_compound_free(&res);
+		xdr_free((xdrproc_t) xdr_CB_COMPOUND4args, &args);
+	}
+
+ out:
+	gsh_free(buf);
+
+	/* The backend waits for these before letting the conflicting
+	 * access through, so return first and invalidate after.
+	 */
+	glist_for_each_safe(c, n, &returns) {
+		struct pxy_deleg *d = container_of(c, struct pxy_deleg, list);
+
+		glist_del(c);
+		pxy_delegreturn(d);
+		pxy_deleg_invalidate(d);
+		pxy_deleg_free(d);
+	}
+	return rc;
+}
+
+/*
+ * The callback service.  The backend keeps one connection to it, so
+ * connections are served one at a time, by this thread.  Another one
+ * waits in the listen queue until the one being served is closed: if
+ * the backend drops its connection without closing it, as when it
+ * reboots, its calls on a new one go unanswered meanwhile, and it
+ * revokes the delegations it cannot recall.
+ */
+static void *pxy_cb_listen(void *arg)
+{
+	for (;;) {
+		int sock = accept(pxy_cb_sock, NULL, NULL);
+
+		if (sock < 0) {
+			if (errno != EINTR) {
+				LogCrit(COMPONENT_FSAL,
+					"Callback accept failed - %d", errno);
+				sleep(1);
+			}
+			continue;
+		}
+
+		LogDebug(COMPONENT_FSAL, "Backend connected for callbacks");
+		while (pxy_cb_serve(sock) == 0)
+			;
+		close(sock);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Start the callback service
+ *
+ * @param[in] info Remote server parameters
+ *
+ * @return 0 or an errno.
+ */
+
+static int pxy_cb_init(const struct pxy_client_params *info)
+{
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	int one = 1;
+	int rc;
+
+	pxy_cb_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (pxy_cb_sock < 0)
+		return errno;
+
+	(void) setsockopt(pxy_cb_sock, SOL_SOCKET, SO_REUSEADDR, &one,
+			  sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	sin.sin_port = info->cb_port;
+
+	if (bind(pxy_cb_sock, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(pxy_cb_sock, 4) < 0 ||
+	    getsockname(pxy_cb_sock, (struct sockaddr *)&sin, &slen) < 0) {
+		rc = errno;
+		goto err;
+	}
+	pxy_cb_port = sin.sin_port;
+
+	rc = pthread_create(&pxy_cb_thread, NULL, pxy_cb_listen, NULL);
+	if (rc)
+		goto err;
+
+	LogEvent(COMPONENT_FSAL, "Callback service %u listening on port %u",
+		 pxy_cb_prognum, ntohs(pxy_cb_port));
+	return 0;
+
+ err:
+	close(pxy_cb_sock);
+	pxy_cb_sock = -1;
+	return rc;
+}
+
 static void *pxy_clientid_renewer(void *Arg)
 {
 	int rc;
@@ -923,6 +1608,7 @@ static void *pxy_clientid_renewer(void *Arg)
 			PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
 			pxy_clientid = newcid;
 			PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+			pxy_deleg_forget_all();
 		}
 	}
 	return NULL;
@@ -990,6 +1676,22 @@ int pxy_init_rpc(const struct pxy_fsal_module *pm)
 		return rc;
 	}
 
+	/* The callback service must be up before the client id that
+	 * names it is set.
+	 */
+	if (pm->special.enable_delegations) {
+		pxy_cb_prognum = pm->special.cb_prognum;
+		pxy_deleg_file_cache = pm->special.deleg_file_cache;
+		pxy_deleg_cache_size = pm->special.deleg_cache_size;
+		rc = pxy_cb_init(&pm->special);
+		if (rc)
+			LogCrit(COMPONENT_FSAL,
+				"Cannot start the callback service, "
+				"no delegations - %s", strerror(rc));
+		else
+			pxy_deleg_enabled = true;
+	}
+
 	rc = pthread_create(&pxy_renewer_thread, NULL, pxy_clientid_renewer,
 			    NULL);
 	if (rc) {
@@ -1001,6 +1703,37 @@ int pxy_init_rpc(const struct pxy_fsal_module *pm)
 	return rc;
 }
 
+/**
+ * @brief Remember how to OPEN a file that may be delegated
+ *
+ * @param[in] ph     File
+ * @param[in] parent Directory it was found in
+ * @param[in] name   Name it was found by
+ */
+
+static void pxy_set_open_name(struct pxy_obj_handle *ph,
+			      const nfs_fh4 *parent, const char *name)
+{
+	size_t len = strlen(name) + 1;
+	struct pxy_open_name *on;
+
+	if (!pxy_deleg_enabled || ph->obj.type != REGULAR_FILE)
+		return;
+
+	on = gsh_malloc(sizeof(*on) + len + parent->nfs_fh4_len);
+	if (on == NULL)
+		return;
+
+	memcpy(on->name, name, len);
+	on->parent.nfs_fh4_len = parent->nfs_fh4_len;
+	on->parent.nfs_fh4_val = on->name + len;
+	memcpy(on->parent.nfs_fh4_val, parent->nfs_fh4_val,
+	       parent->nfs_fh4_len);
+
+	gsh_free(ph->oname);
+	ph->oname = on;
+}
+
 static fsal_status_t pxy_make_object(struct fsal_export *export,
 				     fattr4 *obj_attributes,
 				     const nfs_fh4 *fh,
@@ -1043,6 +1776,8 @@ static fsal_status_t pxy_lookup_impl(struct fsal_obj_handle *parent,
 	nfs_resop4 resoparray[FSAL_LOOKUP_NB_OP_ALLOC];
 	char fattr_blob[FATTR_BLOB_SZ];
 	char padfilehandle[NFS4_FHSIZE];
+	struct pxy_obj_handle *pxy_obj = NULL;
+	fsal_status_t st;
 
 	if (!handle)
 		return fsalstat(ERR_FSAL_INVAL, 0);
@@ -1050,8 +1785,7 @@ static fsal_status_t pxy_lookup_impl(struct fsal_obj_handle *parent,
 	if (!parent) {
 		COMPOUNDV4_ARG_ADD_OP_PUTROOTFH(opcnt, argoparray);
 	} else {
-		struct pxy_obj_handle *pxy_obj =
-		    container_of(parent, struct pxy_obj_handle, obj);
+		pxy_obj = container_of(parent, struct pxy_obj_handle, obj);
 		switch (parent->type) {
 		case DIRECTORY:
 			break;
@@ -1092,8 +1826,14 @@ static fsal_status_t pxy_lookup_impl(struct fsal_obj_handle *parent,
 	if (rc != NFS4_OK)
 		return nfsstat4_to_fsal(rc);
 
-	return pxy_make_object(export, &atok->obj_attributes, &fhok->object,
-			       handle);
+	st = pxy_make_object(export, &atok->obj_attributes, &fhok->object,
+			     handle);
+	if (!FSAL_IS_ERROR(st) && pxy_obj && path && strcmp(path, "..") &&
+	    strcmp(path, "."))
+		pxy_set_open_name(container_of(*handle, struct pxy_obj_handle,
+					       obj),
+				  &pxy_obj->fh4, path);
+	return st;
 }
 
 static fsal_status_t pxy_lookup(struct fsal_obj_handle *parent,
@@ -1172,7 +1912,8 @@ static uint64_t fcnt;
 
 static fsal_status_t pxy_create(struct fsal_obj_handle *dir_hdl,
 				const char *name, struct attrlist *attrib,
-				struct fsal_obj_handle **handle)
+				struct fsal_obj_handle **handle,
+				struct fsal_postop_attrs *postop)
 {
 	int rc;
 	int opcnt = 0;
@@ -1247,13 +1988,16 @@ static fsal_status_t pxy_create(struct fsal_obj_handle *dir_hdl,
 			     &fhok->object, handle);
 	if (FSAL_IS_ERROR(st))
 		return st;
+	pxy_set_open_name(container_of(*handle, struct pxy_obj_handle, obj),
+			  &ph->fh4, name);
 	*attrib = (*handle)->attributes;
 	return st;
 }
 
 static fsal_status_t pxy_mkdir(struct fsal_obj_handle *dir_hdl,
 			       const char *name, struct attrlist *attrib,
-			       struct fsal_obj_handle **handle)
+			       struct fsal_obj_handle **handle,
+			       struct fsal_postop_attrs *postop)
 {
 	int rc;
 	int opcnt = 0;
@@ -1312,7 +2056,8 @@ static fsal_status_t pxy_mkdir(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t pxy_mknod(struct fsal_obj_handle *dir_hdl,
 			       const char *name, object_file_type_t nodetype,
 			       fsal_dev_t *dev, struct attrlist *attrib,
-			       struct fsal_obj_handle **handle)
+			       struct fsal_obj_handle **handle,
+			       struct fsal_postop_attrs *postop)
 {
 	int rc;
 	int opcnt = 0;
@@ -1397,7 +2142,8 @@ static fsal_status_t pxy_mknod(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t pxy_symlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name, const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	int rc;
 	int opcnt = 0;
@@ -1502,7 +2248,8 @@ static fsal_status_t pxy_readlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t pxy_link(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
 	int rc;
 	struct pxy_obj_handle *tgt;
@@ -1553,14 +2300,26 @@ static fsal_status_t pxy_do_readdir(struct pxy_obj_handle *ph,
 	nfs_argop4 argoparray[FSAL_READDIR_NB_OP_ALLOC];
 	nfs_resop4 resoparray[FSAL_READDIR_NB_OP_ALLOC];
 	READDIR4resok *rdok;
+	READDIR4args *rdargs;
+	struct pxy_fsal_module *pm =
+	    container_of(ph->obj.export->fsal, struct pxy_fsal_module, module);
 	fsal_status_t st = { ERR_FSAL_NO_ERROR, 0 };
 
 	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, ph->fh4);
 	rdok = &resoparray[opcnt].nfs_resop4_u.opreaddir.READDIR4res_u.resok4;
 	rdok->reply.entries = NULL;
+	rdargs = &argoparray[opcnt].nfs_argop4_u.opreaddir;
 	COMPOUNDV4_ARG_ADD_OP_READDIR(opcnt, argoparray, *cookie,
 				      pxy_bitmap_readdir);
 
+	/* Entries come with their handles and attributes now, take as
+	 * many as the receive buffer holds. */
+	if (pm->special.srv_recvsize > rdargs->maxcount + PXY_READDIR_SLACK) {
+		rdargs->maxcount =
+		    pm->special.srv_recvsize - PXY_READDIR_SLACK;
+		rdargs->dircount = rdargs->maxcount;
+	}
+
 	rc = pxy_nfsv4_call(ph->obj.export, op_ctx->creds, opcnt, argoparray,
 			    resoparray);
 	if (rc != NFS4_OK)
@@ -1571,19 +2330,33 @@ static fsal_status_t pxy_do_readdir(struct pxy_obj_handle *ph,
 	for (e4 = rdok->reply.entries; e4; e4 = e4->nextentry) {
 		struct attrlist attr;
 		char name[MAXNAMLEN + 1];
+		char padfilehandle[NFS4_FHSIZE];
+		nfs_fh4 fh = {
+			.nfs_fh4_len = 0,
+			.nfs_fh4_val = padfilehandle
+		};
+		struct pxy_obj_handle *eh = NULL;
 
 		/* UTF8 name does not include trailing 0 */
-		if (e4->name.utf8string_len > sizeof(name) - 1)
-			return fsalstat(ERR_FSAL_SERVERFAULT, E2BIG);
+		if (e4->name.utf8string_len > sizeof(name) - 1) {
+			st = fsalstat(ERR_FSAL_SERVERFAULT, E2BIG);
+			break;
+		}
 		memcpy(name, e4->name.utf8string_val, e4->name.utf8string_len);
 		name[e4->name.utf8string_len] = '\0';
 
-		if (nfs4_Fattr_To_FSAL_attr(&attr, &e4->attrs, NULL))
-			return fsalstat(ERR_FSAL_FAULT, 0);
+		/* Without a handle and a type, as when the server could
+		 * only give rdattr_error, the caller looks the name up. */
+		if (nfs4_Fattr_To_FSAL_attr_fh(&attr, &e4->attrs, &fh) ==
+		    NFS4_OK && fh.nfs_fh4_len != 0 &&
+		    FSAL_TEST_MASK(attr.mask, ATTR_TYPE))
+			eh = pxy_alloc_handle(ph->obj.export, &fh, &attr);
+		if (eh)
+			pxy_set_open_name(eh, &ph->fh4, name);
 
 		*cookie = e4->cookie;
 
-		if (!cb(name, cbarg, e4->cookie))
+		if (!cb(name, eh ? &eh->obj : NULL, cbarg, e4->cookie))
 			break;
 	}
 	xdr_free((xdrproc_t) xdr_readdirres, resoparray);
@@ -1618,7 +2391,8 @@ static fsal_status_t pxy_rename(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	int rc;
 	int opcnt = 0;
@@ -1678,6 +2452,15 @@ static fsal_status_t pxy_getattrs(struct fsal_obj_handle *obj_hdl)
 	struct attrlist obj_attr;
 
 	ph = container_of(obj_hdl, struct pxy_obj_handle, obj);
+
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	if (ph->deleg != NULL) {
+		obj_hdl->attributes = ph->deleg->attrs;
+		PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+
 	st = pxy_getattrs_impl(op_ctx->creds, op_ctx->fsal_export,
 			       &ph->fh4, &obj_attr);
 	if (!FSAL_IS_ERROR(st))
@@ -1741,6 +2524,19 @@ static fsal_status_t pxy_setattrs(struct fsal_obj_handle *obj_hdl,
 		obj_hdl->attributes = attrs_after;
 	}
 
+	/* Without the new attributes the delegated copy is wrong */
+	if (rc != NFS4_OK) {
+		pxy_deleg_give_up(ph);
+	} else {
+		PTHREAD_MUTEX_lock(&ph->deleg_lock);
+		if (ph->deleg != NULL) {
+			ph->deleg->attrs = attrs_after;
+			if (FSAL_TEST_MASK(attrs->mask, ATTR_SIZE))
+				pxy_deleg_drop_data(ph->deleg);
+		}
+		PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+	}
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -1751,7 +2547,8 @@ static bool pxy_handle_is(struct fsal_obj_handle *obj_hdl,
 }
 
 static fsal_status_t pxy_unlink(struct fsal_obj_handle *dir_hdl,
-				const char *name)
+				const char *name,
+				struct fsal_postop_attrs *postop)
 {
 	int opcnt = 0;
 	int rc;
@@ -1833,16 +2630,323 @@ static void pxy_hdl_release(struct fsal_obj_handle *obj_hdl)
 	struct pxy_obj_handle *ph =
 	    container_of(obj_hdl, struct pxy_obj_handle, obj);
 
+	pxy_deleg_give_up(ph);
+	gsh_free(ph->oname);
+	PTHREAD_MUTEX_destroy(&ph->deleg_lock);
+
 	fsal_obj_handle_fini(obj_hdl);
 
 	gsh_free(ph);
 }
 
+/**
+ * @brief Ask the backend for a delegation on a file being opened
+ *
+ * The file is opened by the name it was found by, the delegation
+ * the backend grants is kept, and the open is closed again: a
+ * delegation outlives the open it came with.  Nothing changes if no
+ * delegation is granted or the name now leads to another file.
+ *
+ * @param[in] ph        File
+ * @param[in] openflags How it is being opened
+ */
+
+static void pxy_deleg_get(struct pxy_obj_handle *ph,
+			  fsal_openflags_t openflags)
+{
+	int rc;
+	int opcnt = 0;
+	char padfilehandle[NFS4_FHSIZE];
+	char fattr_blob[FATTR_BLOB_SZ];
+#define FSAL_DELEG_NB_OP_ALLOC 4
+	nfs_argop4 argoparray[FSAL_DELEG_NB_OP_ALLOC];
+	nfs_resop4 resoparray[FSAL_DELEG_NB_OP_ALLOC];
+	char owner_val[128];
+	unsigned int owner_len = 0;
+	seqid4 open_owner_seqid = 0;
+	uint32_t access = OPEN4_SHARE_ACCESS_READ;
+	GETFH4resok *fhok;
+	GETATTR4resok *atok;
+	OPEN4resok *opok;
+	open_delegation4 *dg;
+	struct pxy_deleg *d = NULL;
+	struct pxy_export *exp;
+	fsal_status_t st;
+	clientid4 cid;
+
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	if (ph->deleg != NULL || ph->oname == NULL ||
+	    ph->deleg_retry > time(NULL)) {
+		PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+		return;
+	}
+	ph->deleg_retry = time(NULL) + PXY_DELEG_RETRY;
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+
+	if (openflags & FSAL_O_WRITE)
+		access = OPEN4_SHARE_ACCESS_BOTH;
+
+	snprintf(owner_val, sizeof(owner_val), "GANESHA/PROXY: pid=%u %" PRIu64,
+		 getpid(), atomic_inc_uint64_t(&fcnt));
+	owner_len = strnlen(owner_val, sizeof(owner_val));
+
+	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, ph->oname->parent);
+
+	opok = &resoparray[opcnt].nfs_resop4_u.opopen.OPEN4res_u.resok4;
+	opok->attrset = empty_bitmap;
+	pxy_get_clientid(&cid);
+	COMPOUNDV4_ARG_ADD_OP_OPEN_NOCREATE(opcnt, argoparray,
+					    ph->oname->name, access, cid,
+					    owner_val, owner_len,
+					    open_owner_seqid);
+
+	fhok = &resoparray[opcnt].nfs_resop4_u.opgetfh.GETFH4res_u.resok4;
+	fhok->object.nfs_fh4_val = padfilehandle;
+	fhok->object.nfs_fh4_len = sizeof(padfilehandle);
+	COMPOUNDV4_ARG_ADD_OP_GETFH(opcnt, argoparray);
+
+	atok = pxy_fill_getattr_reply(resoparray + opcnt, fattr_blob,
+				      sizeof(fattr_blob));
+	COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, argoparray, pxy_bitmap_getattr);
+
+	rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
+			    opcnt, argoparray, resoparray);
+	if (rc != NFS4_OK) {
+		LogDebug(COMPONENT_FSAL, "OPEN for a delegation failed: %d",
+			 rc);
+		return;
+	}
+
+	if (opok->rflags & OPEN4_RESULT_CONFIRM) {
+		st = pxy_open_confirm(op_ctx->creds, &fhok->object,
+				      ++open_owner_seqid, &opok->stateid,
+				      op_ctx->fsal_export);
+		if (FSAL_IS_ERROR(st))
+			return;
+	}
+
+	dg = &opok->delegation;
+	if (dg->delegation_type == OPEN_DELEGATE_READ ||
+	    dg->delegation_type == OPEN_DELEGATE_WRITE)
+		d = gsh_calloc(1, sizeof(*d));
+
+	if (d != NULL) {
+		d->type = dg->delegation_type;
+		d->stateid = d->type == OPEN_DELEGATE_READ ?
+		    dg->open_delegation4_u.read.stateid :
+		    dg->open_delegation4_u.write.stateid;
+		d->key = gsh_malloc(ph->blob.len);
+		if (d->key != NULL)
+			memcpy(d->key, &ph->blob, ph->blob.len);
+
+		/* Renamed over, the name is not this file any more */
+		if (d->key == NULL ||
+		    fhok->object.nfs_fh4_len != ph->fh4.nfs_fh4_len ||
+		    memcmp(fhok->object.nfs_fh4_val, ph->fh4.nfs_fh4_val,
+			   ph->fh4.nfs_fh4_len) ||
+		    nfs4_Fattr_To_FSAL_attr(&d->attrs, &atok->obj_attributes,
+					    NULL) != NFS4_OK) {
+			pxy_do_delegreturn(&fhok->object, &d->stateid);
+			pxy_deleg_free(d);
+			d = NULL;
+		}
+	}
+
+	(void) pxy_do_close(op_ctx->creds, &fhok->object, ++open_owner_seqid,
+			    &opok->stateid, op_ctx->fsal_export);
+
+	if (d == NULL)
+		return;
+
+	exp = container_of(ph->obj.export, struct pxy_export, exp);
+	d->up_ops = exp->exp.up_ops;
+	d->fsal = exp->exp.fsal;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_mutex);
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	if (ph->deleg == NULL) {
+		d->ph = ph;
+		ph->deleg = d;
+		ph->deleg_gen++;
+		glist_add_tail(&pxy_delegs, &d->list);
+	}
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+	PTHREAD_MUTEX_unlock(&pxy_deleg_mutex);
+
+	if (d->ph == NULL) {
+		/* Another open got one first */
+		pxy_delegreturn(d);
+		pxy_deleg_free(d);
+		return;
+	}
+
+	LogDebug(COMPONENT_FSAL, "Got a %s delegation on %s",
+		 d->type == OPEN_DELEGATE_READ ? "read" : "write",
+		 ph->oname->name);
+}
+
+/**
+ * @brief Serve a read from a delegated file's cache
+ *
+ * Called with the handle's deleg_lock held.
+ *
+ * @return true if the read was served.
+ */
+
+static bool pxy_deleg_read(struct pxy_deleg *d, uint64_t offset,
+			   size_t size, void *buffer, size_t *read_amount,
+			   bool *end_of_file)
+{
+	uint64_t filesize = d->attrs.filesize;
+	uint64_t end = offset + size;
+	uint64_t b;
+
+	/* The size is authoritative while delegated */
+	if (offset >= filesize) {
+		*read_amount = 0;
+		*end_of_file = true;
+		return true;
+	}
+
+	if (end > filesize)
+		end = filesize;
+	if (d->data == NULL || end > d->cached)
+		return false;
+
+	for (b = offset / PXY_DELEG_BLOCK; b <= (end - 1) / PXY_DELEG_BLOCK;
+	     b++)
+		if (!(d->valid[b / 8] & (1 << (b % 8))))
+			return false;
+
+	memcpy(buffer, d->data + offset, end - offset);
+	*read_amount = end - offset;
+	*end_of_file = (end == filesize);
+	return true;
+}
+
+/**
+ * @brief Make room for the data of a delegated file
+ *
+ * Called with the handle's deleg_lock held.
+ *
+ * @return true if data may be cached.
+ */
+
+static bool pxy_deleg_alloc(struct pxy_deleg *d)
+{
+	size_t cached;
+
+	if (d->data != NULL)
+		return true;
+
+	cached = (d->attrs.filesize + PXY_DELEG_BLOCK - 1) &
+	    ~((uint64_t) PXY_DELEG_BLOCK - 1);
+	if (cached > pxy_deleg_file_cache)
+		cached = pxy_deleg_file_cache & ~(PXY_DELEG_BLOCK - 1);
+	if (cached == 0)
+		return false;
+
+	if (atomic_add_uint64_t(&pxy_deleg_cached, cached) >
+	    pxy_deleg_cache_size) {
+		atomic_sub_uint64_t(&pxy_deleg_cached, cached);
+		return false;
+	}
+
+	d->data = gsh_malloc(cached);
+	d->valid = gsh_calloc(1, cached / PXY_DELEG_BLOCK / 8 + 1);
+	if (d->data == NULL || d->valid == NULL) {
+		gsh_free(d->data);
+		gsh_free(d->valid);
+		d->data = NULL;
+		atomic_sub_uint64_t(&pxy_deleg_cached, cached);
+		return false;
+	}
+	d->cached = cached;
+	return true;
+}
+
+/**
+ * @brief Keep what was read from a delegated file
+ *
+ * Called with the handle's deleg_lock held.
+ *
+ * @param[in] d      Delegation
+ * @param[in] offset Where the data was read, block aligned
+ * @param[in] data   Data read
+ * @param[in] len    Bytes read
+ */
+
+static void pxy_deleg_fill(struct pxy_deleg *d, uint64_t offset,
+			   const char *data, size_t len)
+{
+	uint64_t end = offset + len;
+	uint64_t b;
+
+	if (!pxy_deleg_alloc(d))
+		return;
+
+	for (b = offset; b < end && b < d->cached; b += PXY_DELEG_BLOCK) {
+		size_t n = PXY_DELEG_BLOCK;
+
+		/* A short block is complete only at the end of file,
+		 * where what lies beyond reads as zeroes if it grows.
+		 */
+		if (b + n > end) {
+			if (end < d->attrs.filesize)
+				break;
+			n = end - b;
+			memset(d->data + b + n, 0, PXY_DELEG_BLOCK - n);
+		}
+		memcpy(d->data + b, data + (b - offset), n);
+		d->valid[b / PXY_DELEG_BLOCK / 8] |=
+		    1 << (b / PXY_DELEG_BLOCK % 8);
+	}
+}
+
+/**
+ * @brief Bring a delegated file's cache up to date after a write
+ *
+ * Called with the handle's deleg_lock held.
+ *
+ * @param[in] d      Delegation
+ * @param[in] offset Where the data was written
+ * @param[in] data   Data written
+ * @param[in] len    Bytes written
+ */
+
+static void pxy_deleg_wrote(struct pxy_deleg *d, uint64_t offset,
+			    const char *data, size_t len)
+{
+	uint64_t end = offset + len;
+	uint64_t b;
+
+	if (d->data == NULL)
+		return;
+
+	for (b = offset & ~((uint64_t) PXY_DELEG_BLOCK - 1);
+	     b < end && b < d->cached; b += PXY_DELEG_BLOCK) {
+		uint64_t from = b > offset ? b : offset;
+		uint64_t to = b + PXY_DELEG_BLOCK < end ?
+		    b + PXY_DELEG_BLOCK : end;
+		uint8_t *v = &d->valid[b / PXY_DELEG_BLOCK / 8];
+		uint8_t bit = 1 << (b / PXY_DELEG_BLOCK % 8);
+
+		/* A block not cached yet is complete if written whole */
+		if (!(*v & bit)) {
+			if (to - from < PXY_DELEG_BLOCK)
+				continue;
+			*v |= bit;
+		}
+		memcpy(d->data + from, data + (from - offset), to - from);
+	}
+}
+
 /*
  * Without name the 'open' for NFSv4 makes no sense - we could
  * send a getattr to the backend server but it's not going to
  * do anything useful anyway, so just save the openflags to record
- * the fact that file has been 'opened' and be done.
+ * the fact that file has been 'opened' and be done.  A file found
+ * by name is opened on the backend only to get a delegation.
  */
 static fsal_status_t pxy_open(struct fsal_obj_handle *obj_hdl,
 			      fsal_openflags_t openflags)
@@ -1856,6 +2960,8 @@ static fsal_status_t pxy_open(struct fsal_obj_handle *obj_hdl,
 	if ((ph->openflags != FSAL_O_CLOSED) && (ph->openflags != openflags))
 		return fsalstat(ERR_FSAL_FILE_OPEN, EBADF);
 	ph->openflags = openflags;
+	if (pxy_deleg_enabled && obj_hdl->type == REGULAR_FILE)
+		pxy_deleg_get(ph, openflags);
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -1879,6 +2985,14 @@ static fsal_status_t pxy_read(struct fsal_obj_handle *obj_hdl,
 	nfs_argop4 argoparray[FSAL_READ_NB_OP_ALLOC];
 	nfs_resop4 resoparray[FSAL_READ_NB_OP_ALLOC];
 	READ4resok *rok;
+	stateid4 sid;
+	uint32_t gen;
+	uint64_t rd_offset = offset;
+	size_t rd_size;
+	char *rd_buf = buffer;
+	size_t skip;
+	nfs_argop4 *rdop;
+	bool delegated = false;
 
 	if (!buffer_size) {
 		*read_amount = 0;
@@ -1895,20 +3009,87 @@ static fsal_status_t pxy_read(struct fsal_obj_handle *obj_hdl,
 	mr = op_ctx->fsal_export->exp_ops.fs_maxread(op_ctx->fsal_export);
 	if (buffer_size > mr)
 		buffer_size = mr;
+	rd_size = buffer_size;
+
+	memset(&sid, 0, sizeof(sid));
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	gen = ph->deleg_gen;
+	if (ph->deleg != NULL) {
+		if (pxy_deleg_read(ph->deleg, offset, buffer_size, buffer,
+				   read_amount, end_of_file)) {
+			PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+			return fsalstat(ERR_FSAL_NO_ERROR, 0);
+		}
+		sid = ph->deleg->stateid;
+		delegated = true;
+
+		/* Read whole blocks, to be kept */
+		if (offset < pxy_deleg_file_cache) {
+			rd_offset = offset & ~((uint64_t) PXY_DELEG_BLOCK - 1);
+			rd_size = (offset + buffer_size - rd_offset +
+				   PXY_DELEG_BLOCK - 1) &
+			    ~((size_t) PXY_DELEG_BLOCK - 1);
+			if (rd_size > mr)
+				rd_size = mr & ~(PXY_DELEG_BLOCK - 1);
+			if (rd_size < offset + buffer_size - rd_offset) {
+				rd_offset = offset;
+				rd_size = buffer_size;
+			}
+		}
+	}
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+
+	if (rd_size != buffer_size) {
+		rd_buf = gsh_malloc(rd_size);
+		if (rd_buf == NULL)
+			return fsalstat(ERR_FSAL_NOMEM, ENOMEM);
+	}
 
 	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, ph->fh4);
 	rok = &resoparray[opcnt].nfs_resop4_u.opread.READ4res_u.resok4;
-	rok->data.data_val = buffer;
-	rok->data.data_len = buffer_size;
-	COMPOUNDV4_ARG_ADD_OP_READ(opcnt, argoparray, offset, buffer_size);
+	rok->data.data_val = rd_buf;
+	rok->data.data_len = rd_size;
+	rdop = argoparray + opcnt;
+	COMPOUNDV4_ARG_ADD_OP_READ(opcnt, argoparray, rd_offset, rd_size,
+				   &sid);
 
 	rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
 			    opcnt, argoparray, resoparray);
-	if (rc != NFS4_OK)
+
+	/* The delegation went back while the call was on its way */
+	if (rc == NFS4ERR_BAD_STATEID && delegated) {
+		memset(&rdop->nfs_argop4_u.opread.stateid, 0,
+		       sizeof(stateid4));
+		rok->data.data_len = rd_size;
+		rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
+				    opcnt, argoparray, resoparray);
+	}
+	if (rc != NFS4_OK) {
+		if (rd_buf != buffer)
+			gsh_free(rd_buf);
 		return nfsstat4_to_fsal(rc);
+	}
+
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	if (ph->deleg != NULL && ph->deleg_gen == gen &&
+	    rd_offset % PXY_DELEG_BLOCK == 0)
+		pxy_deleg_fill(ph->deleg, rd_offset, rd_buf,
+			       rok->data.data_len);
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
 
 	*end_of_file = rok->eof;
 	*read_amount = rok->data.data_len;
+
+	if (rd_buf != buffer) {
+		skip = offset - rd_offset;
+		*read_amount = *read_amount > skip ? *read_amount - skip : 0;
+		if (*read_amount > buffer_size) {
+			*read_amount = buffer_size;
+			*end_of_file = false;
+		}
+		memcpy(buffer, rd_buf + skip, *read_amount);
+		gsh_free(rd_buf);
+	}
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -1919,11 +3100,19 @@ static fsal_status_t pxy_write(struct fsal_obj_handle *obj_hdl,
 	int mw;
 	int rc;
 	int opcnt = 0;
-#define FSAL_WRITE_NB_OP_ALLOC 2
+#define FSAL_WRITE_NB_OP_ALLOC 3
 	nfs_argop4 argoparray[FSAL_WRITE_NB_OP_ALLOC];
 	nfs_resop4 resoparray[FSAL_WRITE_NB_OP_ALLOC];
 	WRITE4resok *wok;
+	GETATTR4resok *atok = NULL;
+	char fattr_blob[FATTR_BLOB_SZ];
+	struct attrlist attrs_after;
 	struct pxy_obj_handle *ph;
+	stateid4 sid;
+	uint32_t gen;
+	bool stale;
+	nfs_argop4 *wrop;
+	bool delegated = false;
 
 	if (!size) {
 		*write_amount = 0;
@@ -1942,18 +3131,66 @@ static fsal_status_t pxy_write(struct fsal_obj_handle *obj_hdl,
 	if (size > mw)
 		size = mw;
 
+	/* Writes go through to the backend even when delegated, only a
+	 * write delegation's stateid allows writing.
+	 */
+	memset(&sid, 0, sizeof(sid));
+	PTHREAD_MUTEX_lock(&ph->deleg_lock);
+	gen = ph->deleg_gen;
+	if (ph->deleg != NULL && ph->deleg->type == OPEN_DELEGATE_WRITE) {
+		sid = ph->deleg->stateid;
+		delegated = true;
+	}
+	PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+
 	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, ph->fh4);
 	wok = &resoparray[opcnt].nfs_resop4_u.opwrite.WRITE4res_u.resok4;
-	COMPOUNDV4_ARG_ADD_OP_WRITE(opcnt, argoparray, offset, buffer, size);
+	wrop = argoparray + opcnt;
+	COMPOUNDV4_ARG_ADD_OP_WRITE(opcnt, argoparray, offset, buffer, size,
+				    &sid);
+
+	/* Keep the delegated attributes exact */
+	if (pxy_deleg_enabled && obj_hdl->type == REGULAR_FILE) {
+		atok = pxy_fill_getattr_reply(resoparray + opcnt, fattr_blob,
+					      sizeof(fattr_blob));
+		COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, argoparray,
+					      pxy_bitmap_getattr);
+	}
 
 	rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
 			    opcnt, argoparray, resoparray);
+
+	/* The delegation went back while the call was on its way */
+	if (rc == NFS4ERR_BAD_STATEID && delegated) {
+		memset(&wrop->nfs_argop4_u.opwrite.stateid, 0,
+		       sizeof(stateid4));
+		rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
+				    opcnt, argoparray, resoparray);
+	}
 	if (rc != NFS4_OK)
 		return nfsstat4_to_fsal(rc);
 
 	*write_amount = wok->count;
 	*fsal_stable = false;
 
+	if (atok != NULL) {
+		memset(&attrs_after, 0, sizeof(attrs_after));
+		rc = nfs4_Fattr_To_FSAL_attr(&attrs_after,
+					     &atok->obj_attributes, NULL);
+		PTHREAD_MUTEX_lock(&ph->deleg_lock);
+		/* A delegation got while writing may predate the write */
+		stale = ph->deleg != NULL &&
+		    (ph->deleg_gen != gen || rc != NFS4_OK);
+		if (ph->deleg != NULL && !stale) {
+			ph->deleg->attrs = attrs_after;
+			pxy_deleg_wrote(ph->deleg, offset, buffer,
+					*write_amount);
+		}
+		PTHREAD_MUTEX_unlock(&ph->deleg_lock);
+		if (stale)
+			pxy_deleg_give_up(ph);
+	}
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -2066,6 +3303,11 @@ static struct pxy_obj_handle *pxy_alloc_handle(struct fsal_export *exp,
 			return NULL;
 		}
 #endif
+		PTHREAD_MUTEX_init(&n->deleg_lock, NULL);
+		n->deleg = NULL;
+		n->deleg_gen = 0;
+		n->deleg_retry = 0;
+		n->oname = NULL;
 		fsal_obj_handle_init(&n->obj, exp, attr->type);
 		pxy_handle_ops_init(&n->obj.obj_ops);
 	}
@@ -91,6 +91,16 @@ static struct config_item proxy_remote_params[] = {
 		       pxy_client_params, use_privileged_client_port),
 	CONF_ITEM_UI32("RPC_Client_Timeout", 1, 60*4, 60,
 		       pxy_client_params, srv_timeout),
+	CONF_ITEM_BOOL("Enable_Delegations", false,
+		       pxy_client_params, enable_delegations),
+	CONF_ITEM_INET_PORT("Callback_Port", 0, UINT16_MAX, 0,
+			    pxy_client_params, cb_port),
+	CONF_ITEM_UI32("Callback_Service", 1, UINT32_MAX, 0x40000000,
+		       pxy_client_params, cb_prognum),
+	CONF_ITEM_UI32("Delegation_File_Cache", 0, FSAL_MAXIOSIZE, 1048576,
+		       pxy_client_params, deleg_file_cache),
+	CONF_ITEM_UI64("Delegation_Cache_Size", 0, UINT64_MAX, 67108864,
+		       pxy_client_params, deleg_cache_size),
 #ifdef _USE_GSSRPC
 	CONF_ITEM_STR("Remote_PrincipalName", 0, MAXNAMLEN, NULL,
 		      pxy_client_params, remote_principal),
@@ -20,6 +20,13 @@ struct pxy_client_params {
 	unsigned int sec_type;
 	bool active_krb5;
 
+	/* backend delegations and the callback service */
+	bool enable_delegations;
+	unsigned short cb_port;
+	unsigned int cb_prognum;
+	uint32_t deleg_file_cache;
+	uint64_t deleg_cache_size;
+
 	/* initialization info for handle mapping */
 	int enable_handle_mapping;
 
@@ -43,6 +50,8 @@ void pxy_handle_ops_init(struct fsal_obj_ops *ops);
 
 int pxy_init_rpc(const struct pxy_fsal_module *);
 
+void pxy_get_clientid(clientid4 *ret);
+
 fsal_status_t pxy_list_ext_attrs(struct fsal_obj_handle *obj_hdl,
 				 const struct req_op_context *opctx,
 				 unsigned int cookie,
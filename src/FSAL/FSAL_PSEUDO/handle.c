@@ -394,7 +394,8 @@ out:
 static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 			    const char *name,
 			    struct attrlist *attrib,
-			    struct fsal_obj_handle **handle)
+			    struct fsal_obj_handle **handle,
+			    struct fsal_postop_attrs *postop)
 {
 	/* PSEUDOFS doesn't support non-directory inodes */
 	LogCrit(COMPONENT_FSAL,
@@ -405,7 +406,8 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 			     const char *name,
 			     struct attrlist *attrib,
-			     struct fsal_obj_handle **handle)
+			     struct fsal_obj_handle **handle,
+			     struct fsal_postop_attrs *postop)
 {
 	struct pseudo_fsal_obj_handle *myself, *hdl;
 	mode_t unix_mode;
@@ -454,7 +456,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 			      object_file_type_t nodetype,
 			      fsal_dev_t *dev,
 			      struct attrlist *attrib,
-			      struct fsal_obj_handle **handle)
+			      struct fsal_obj_handle **handle,
+			      struct fsal_postop_attrs *postop)
 {
 	/* PSEUDOFS doesn't support non-directory inodes */
 	LogCrit(COMPONENT_FSAL,
@@ -472,7 +475,8 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name,
 				 const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	/* PSEUDOFS doesn't support non-directory inodes */
 	LogCrit(COMPONENT_FSAL,
@@ -492,7 +496,8 @@ static fsal_status_t readsymlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
 	/* PSEUDOFS doesn't support non-directory inodes */
 	LogCrit(COMPONENT_FSAL,
@@ -553,7 +558,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 		if (hdl->index < seekloc)
 			continue;
 
-		if (!cb(hdl->name, dir_state, hdl->index)) {
+		if (!cb(hdl->name, NULL, dir_state, hdl->index)) {
 			*eof = false;
 			break;
 		}
@@ -570,7 +575,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	/* PSEUDOFS doesn't support non-directory inodes */
 	LogCrit(COMPONENT_FSAL,
@@ -625,7 +631,8 @@ static fsal_status_t setattrs(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	struct pseudo_fsal_obj_handle *myself, *hdl;
 	fsal_errors_t error = ERR_FSAL_NOENT;
@@ -189,7 +189,8 @@ static fsal_status_t pt_lookup(struct fsal_obj_handle *parent,
 
 static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 			    const char *name, struct attrlist *attrib,
-			    struct fsal_obj_handle **handle)
+			    struct fsal_obj_handle **handle,
+			    struct fsal_postop_attrs *postop)
 {
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 	int retval = 0;
@@ -231,7 +232,8 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 			     const char *name, struct attrlist *attrib,
-			     struct fsal_obj_handle **handle)
+			     struct fsal_obj_handle **handle,
+			     struct fsal_postop_attrs *postop)
 {
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 	int retval = 0;
@@ -274,7 +276,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 			      object_file_type_t nodetype,	/* IN */
 			      fsal_dev_t *dev,	/* IN */
 			      struct attrlist *attrib,
-			      struct fsal_obj_handle **handle)
+			      struct fsal_obj_handle **handle,
+			      struct fsal_postop_attrs *postop)
 {
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 	int retval = 0;
@@ -327,7 +330,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name, const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -341,7 +345,8 @@ static fsal_status_t readsymlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -464,6 +469,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 		/* callback to cache inode */
 		if (!cb(fsi_dname,
+			NULL,
 			dir_state,
 			entry_cookie->data.cookie)) {
 				FSI_TRACE(FSI_DEBUG, "callback failed\n");
@@ -481,7 +487,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	fsal_status_t status;
 
@@ -591,7 +598,8 @@ errout:
  */
 
 static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	fsal_status_t status;
 
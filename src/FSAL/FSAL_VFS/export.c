@@ -55,8 +55,6 @@
 /* helpers to/from other VFS objects
  */
 
-struct fsal_staticfsinfo_t *vfs_staticinfo(struct fsal_module *hdl);
-
 int vfs_get_root_fd(struct fsal_export *exp_hdl)
 {
 	struct vfs_fsal_export *myself;
@@ -76,10 +74,15 @@ static void release(struct fsal_export *exp_hdl)
 
 	myself = EXPORT_VFS_FROM_FSAL(exp_hdl);
 
+	vfs_intent_log_fini(myself);
+
 	vfs_sub_fini(myself);
 
 	vfs_unexport_filesystems(myself);
 
+	if (myself->intent_log_path != NULL)
+		gsh_free(myself->intent_log_path);
+
 	fsal_detach_export(exp_hdl->fsal, &exp_hdl->exports);
 	free_export_ops(exp_hdl);
 
@@ -404,6 +407,7 @@ void vfs_export_ops_init(struct export_ops *ops)
 
 void free_vfs_filesystem(struct vfs_filesystem *vfs_fs)
 {
+	vfs_sub_fini_filesystem(vfs_fs);
 	if (vfs_fs->root_fd >= 0)
 		close(vfs_fs->root_fd);
 	gsh_free(vfs_fs);
@@ -453,6 +457,9 @@ int vfs_claim_filesystem(struct fsal_filesystem *fs, struct fsal_export *exp)
 
 	glist_init(&vfs_fs->exports);
 	vfs_fs->root_fd = -1;
+	vfs_fs->notify_fd = -1;
+	vfs_fs->notify_pipe[0] = -1;
+	vfs_fs->notify_pipe[1] = -1;
 
 	vfs_fs->fs = fs;
 
@@ -640,6 +647,16 @@ fsal_status_t vfs_create_export(struct fsal_module *fsal_hdl,
 		goto errout;
 	}
 
+	/* Replay before anyone can see the export */
+	if (myself->intent_log_path != NULL) {
+		retval = vfs_intent_log_init(myself);
+		if (retval != 0) {
+			vfs_sub_fini(myself);
+			fsal_error = posix2fsal_error(retval);
+			goto errout;
+		}
+	}
+
 	op_ctx->fsal_export = &myself->export;
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 
@@ -647,6 +664,8 @@ fsal_status_t vfs_create_export(struct fsal_module *fsal_hdl,
 
 	vfs_unexport_filesystems(myself);
 
+	if (myself->intent_log_path != NULL)
+		gsh_free(myself->intent_log_path);
 	free_export_ops(&myself->export);
 	gsh_free(myself);	/* elvis has left the building */
 	return fsalstat(fsal_error, retval);
@@ -33,14 +33,193 @@
 #include "config.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include "fsal.h"
+#include "fsal_up.h"
 #include "FSAL/access_check.h"
 #include "fsal_convert.h"
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "FSAL/fsal_commonlib.h"
+#include "fridgethr.h"
+#include "delayed_exec.h"
 #include "vfs_methods.h"
 
+#ifdef O_DIRECT
+
+/**
+ * @brief Whether the export wants data read and written with O_DIRECT
+ */
+
+static inline bool vfs_want_direct(void)
+{
+	struct vfs_fsal_export *exp =
+	    container_of(op_ctx->fsal_export, struct vfs_fsal_export, export);
+
+	return exp->direct_io;
+}
+
+/**
+ * @brief Learn the alignment O_DIRECT needs on a file system
+ *
+ * @param[in] vfs_fs File system
+ * @param[in] fd     A descriptor open with O_DIRECT on it
+ */
+
+static void vfs_dio_align(struct vfs_filesystem *vfs_fs, int fd)
+{
+#ifdef STATX_DIOALIGN
+	struct statx stx;
+#endif
+
+	if (vfs_fs->dio_offset_align != 0)
+		return;
+
+#ifdef STATX_DIOALIGN
+	if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+	    (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align != 0) {
+		vfs_fs->dio_mem_align = stx.stx_dio_mem_align;
+		vfs_fs->dio_offset_align = stx.stx_dio_offset_align;
+		return;
+	}
+#endif
+
+	/* Safe for every block device in use */
+	vfs_fs->dio_mem_align = 4096;
+	vfs_fs->dio_offset_align = 4096;
+}
+
+/**
+ * @brief Open the buffered descriptor of a file open with O_DIRECT
+ *
+ * Used for the parts of an I/O that are not aligned.  Linux writes
+ * back and drops cached pages a direct transfer overlaps, so the two
+ * descriptors, and local processes doing buffered I/O, see the same
+ * data.  It is opened along with the direct one, as the server: by
+ * the time of the I/O the client's credentials are in effect, and
+ * they cannot open by handle.
+ *
+ * @param[in]  myself      File handle
+ * @param[in]  openflags   FSAL open flags of the direct descriptor
+ * @param[out] fsal_error  Status on failure
+ *
+ * @return The descriptor, or a negative errno.
+ */
+
+static int vfs_open_buffered(struct vfs_fsal_obj_handle *myself,
+			     fsal_openflags_t openflags,
+			     fsal_errors_t *fsal_error)
+{
+	int posix_flags = 0;
+
+	fsal2posix_openflags(openflags, &posix_flags);
+	return vfs_fsal_open(myself, posix_flags, fsal_error);
+}
+
+#endif				/* O_DIRECT */
+
+/**
+ * @brief Forget a file was open with O_DIRECT
+ *
+ * @param[in] myself File handle, being closed
+ */
+
+static void vfs_close_direct(struct vfs_fsal_obj_handle *myself)
+{
+	if (myself->u.file.buffered_fd >= 0) {
+		close(myself->u.file.buffered_fd);
+		myself->u.file.buffered_fd = -1;
+	}
+	myself->u.file.direct = false;
+}
+
+/**
+ * @brief Read or write a file open with O_DIRECT
+ *
+ * The aligned middle of the range is transferred directly, through a
+ * bounce buffer if the caller's buffer is not aligned well enough for
+ * it; an unaligned head or tail goes through the buffered descriptor.
+ *
+ * @param[in] myself File handle, opened with O_DIRECT
+ * @param[in] write  Write rather than read
+ * @param[in] buffer Data
+ * @param[in] size   Length
+ * @param[in] offset File offset
+ *
+ * @return Bytes transferred, short only at end of file or on an error
+ *         after some data, or -1 with errno set.
+ */
+
+static ssize_t vfs_dio_rw(struct vfs_fsal_obj_handle *myself, bool write,
+			  char *buffer, size_t size, uint64_t offset)
+{
+	struct vfs_filesystem *vfs_fs = myself->obj_handle.fs->private;
+	uint64_t align = vfs_fs->dio_offset_align;
+	size_t head, mid, tail;
+	size_t done = 0;
+	char *bounce = NULL;
+	ssize_t n;
+	int fd;
+
+	head = (align - offset % align) % align;
+	if (head > size)
+		head = size;
+	mid = (size - head) & ~(align - 1);
+	tail = size - head - mid;
+
+	if (head != 0) {
+		fd = myself->u.file.buffered_fd;
+		n = write ? pwrite(fd, buffer, head, offset)
+			  : pread(fd, buffer, head, offset);
+		if (n < 0 || (size_t)n < head)
+			return n;
+		done = n;
+	}
+
+	if (mid != 0) {
+		char *p = buffer + done;
+
+		if ((uintptr_t)p % vfs_fs->dio_mem_align != 0) {
+			bounce = gsh_malloc_aligned(vfs_fs->dio_mem_align,
+						    mid);
+			if (bounce == NULL) {
+				errno = ENOMEM;
+				return done != 0 ? done : -1;
+			}
+			if (write)
+				memcpy(bounce, p, mid);
+		}
+		n = write
+		    ? pwrite(myself->u.file.fd, bounce ? bounce : p, mid,
+			     offset + done)
+		    : pread(myself->u.file.fd, bounce ? bounce : p, mid,
+			    offset + done);
+		if (bounce != NULL) {
+			if (!write && n > 0)
+				memcpy(p, bounce, n);
+			gsh_free(bounce);
+		}
+		if (n < 0)
+			return done != 0 ? done : -1;
+		done += n;
+		if ((size_t)n < mid)
+			return done;
+	}
+
+	if (tail != 0) {
+		fd = myself->u.file.buffered_fd;
+		n = write ? pwrite(fd, buffer + done, tail, offset + done)
+			  : pread(fd, buffer + done, tail, offset + done);
+		if (n < 0)
+			return done != 0 ? done : -1;
+		done += n;
+	}
+
+	return done;
+}
+
 /** vfs_open
  * called with appropriate locks taken at the cache inode level
  */
@@ -71,7 +250,31 @@ fsal_status_t vfs_open(struct fsal_obj_handle *obj_hdl,
 	fsal2posix_openflags(openflags, &posix_flags);
 	LogFullDebug(COMPONENT_FSAL, "open_by_handle_at flags from %x to %x",
 		     openflags, posix_flags);
-	fd = vfs_fsal_open(myself, posix_flags, &fsal_error);
+#ifdef O_DIRECT
+	if (vfs_want_direct()) {
+		fd = vfs_fsal_open(myself, posix_flags | O_DIRECT, &fsal_error);
+		if (fd >= 0) {
+			int bfd = vfs_open_buffered(myself, openflags,
+						    &fsal_error);
+
+			if (bfd < 0) {
+				close(fd);
+				fd = bfd;
+			} else {
+				myself->u.file.buffered_fd = bfd;
+				myself->u.file.direct = true;
+				vfs_dio_align(obj_hdl->fs->private, fd);
+			}
+		} else if (fd == -EINVAL) {
+			LogDebug(COMPONENT_FSAL,
+				 "%s does not support O_DIRECT, using buffered I/O",
+				 obj_hdl->fs->path);
+			fsal_error = ERR_FSAL_NO_ERROR;
+			fd = vfs_fsal_open(myself, posix_flags, &fsal_error);
+		}
+	} else
+#endif
+		fd = vfs_fsal_open(myself, posix_flags, &fsal_error);
 	if (fd < 0) {
 		retval = -fd;
 	} else {
@@ -81,6 +284,45 @@ fsal_status_t vfs_open(struct fsal_obj_handle *obj_hdl,
 	return fsalstat(fsal_error, retval);
 }
 
+/**
+ * @brief Switch a file create_open left open to O_DIRECT
+ *
+ * The create itself is not done with O_DIRECT, since a file system
+ * that does not support it would only say so once the file exists.
+ *
+ * @param[in] myself File handle, just created and opened
+ */
+
+void vfs_direct_created(struct vfs_fsal_obj_handle *myself)
+{
+#ifdef O_DIRECT
+	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
+	int flags, bfd;
+
+	if (!vfs_want_direct())
+		return;
+
+	flags = fcntl(myself->u.file.fd, F_GETFL);
+	if (flags < 0)
+		return;
+
+	/* Left buffered if either step fails */
+	bfd = vfs_open_buffered(myself, myself->u.file.openflags,
+				&fsal_error);
+	if (bfd < 0)
+		return;
+
+	if (fcntl(myself->u.file.fd, F_SETFL, flags | O_DIRECT) != 0) {
+		close(bfd);
+		return;
+	}
+
+	myself->u.file.buffered_fd = bfd;
+	myself->u.file.direct = true;
+	vfs_dio_align(myself->obj_handle.fs->private, myself->u.file.fd);
+#endif
+}
+
 /* vfs_status
  * Let the caller peek into the file's open/close state.
  */
@@ -122,7 +364,12 @@ fsal_status_t vfs_read(struct fsal_obj_handle *obj_hdl,
 	assert(myself->u.file.fd >= 0
 	       && myself->u.file.openflags != FSAL_O_CLOSED);
 
-	nb_read = pread(myself->u.file.fd, buffer, buffer_size, offset);
+	if (myself->u.file.direct)
+		nb_read = vfs_dio_rw(myself, false, buffer, buffer_size,
+				     offset);
+	else
+		nb_read = pread(myself->u.file.fd, buffer, buffer_size,
+				offset);
 
 	if (offset == -1 || nb_read == -1) {
 		retval = errno;
@@ -170,7 +417,12 @@ fsal_status_t vfs_write(struct fsal_obj_handle *obj_hdl,
 	       && myself->u.file.openflags != FSAL_O_CLOSED);
 
 	fsal_set_credentials(op_ctx->creds);
-	nb_written = pwrite(myself->u.file.fd, buffer, buffer_size, offset);
+	if (myself->u.file.direct)
+		nb_written = vfs_dio_rw(myself, true, buffer, buffer_size,
+					offset);
+	else
+		nb_written = pwrite(myself->u.file.fd, buffer, buffer_size,
+				    offset);
 
 	if (offset == -1 || nb_written == -1) {
 		retval = errno;
@@ -182,10 +434,23 @@ fsal_status_t vfs_write(struct fsal_obj_handle *obj_hdl,
 
 	/* attempt stability */
 	if (fsal_stable != NULL && *fsal_stable) {
+		struct vfs_intent_log *log =
+		    EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->intent_log;
+
+		if (log != NULL &&
+		    vfs_intent_log_write(log, myself, buffer, nb_written,
+					 offset) == 0)
+			goto out;
+
 		retval = fsync(myself->u.file.fd);
 		if (retval == -1) {
 			retval = errno;
 			fsal_error = posix2fsal_error(retval);
+		} else if (log != NULL) {
+			/* Don't let replay undo later unlogged writes */
+			retval = vfs_intent_log_retire(log, myself,
+						       myself->u.file.fd);
+			fsal_error = posix2fsal_error(retval);
 		}
 		*fsal_stable = true;
 	}
@@ -203,6 +468,8 @@ fsal_status_t vfs_write(struct fsal_obj_handle *obj_hdl,
 fsal_status_t vfs_commit(struct fsal_obj_handle *obj_hdl,	/* sync */
 			 off_t offset, size_t len)
 {
+	struct vfs_intent_log *log =
+	    EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->intent_log;
 	struct vfs_fsal_obj_handle *myself;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 	int retval = 0;
@@ -225,10 +492,676 @@ fsal_status_t vfs_commit(struct fsal_obj_handle *obj_hdl,	/* sync */
 	if (retval == -1) {
 		retval = errno;
 		fsal_error = posix2fsal_error(retval);
+	} else if (log != NULL) {
+		/* What the log holds for the file is on disk now, and
+		 * replaying it could undo unstable writes just committed */
+		retval = vfs_intent_log_retire(log, myself, myself->u.file.fd);
+		fsal_error = posix2fsal_error(retval);
+	}
+	return fsalstat(fsal_error, retval);
+}
+
+#ifdef F_OFD_SETLK
+
+/**
+ * @brief A range a lock owner holds locked, [start, end)
+ */
+
+struct vfs_ofd_range {
+	uint64_t start;
+	uint64_t end;		/*< UINT64_MAX for to the end of the file */
+};
+
+/**
+ * @brief Open file description held on behalf of one lock owner
+ *
+ * OFD locks are owned by the open file description rather than by
+ * the process, so giving each NFS lock owner its own description lets
+ * the kernel arbitrate between owners (and with local processes)
+ * exactly as it would between independent openers.
+ *
+ * A description is only kept while its owner holds a lock on the file
+ * or waits for one, so the ranges it holds are tracked here, and it is
+ * closed once an unlock leaves none.  Owners are told apart by SAL's
+ * owner id as well as their address, which a later owner may reuse.
+ */
+
+struct vfs_ofd_owner {
+	struct glist_head list;	/*< On u.file.ofd_owners */
+	void *owner;		/*< SAL lock owner */
+	uint64_t owner_id;	/*< SAL's id for it, never reused */
+	int fd;			/*< Its private open file description */
+	unsigned int waiters;	/*< Blocked locks waiting on fd */
+	unsigned int nranges;	/*< Ranges held */
+	unsigned int maxranges;	/*< Room in ranges */
+	struct vfs_ofd_range *ranges;
+};
+
+/**
+ * @brief A blocked lock waiting to be granted
+ *
+ * Everything the grant upcall needs is copied in, since the object
+ * handle may be released once the waiter is off the list.
+ */
+
+struct vfs_ofd_waiter {
+	struct glist_head list;	/*< On u.file.ofd_waiters */
+	void *owner;		/*< SAL lock owner */
+	struct vfs_ofd_owner *ofd;	/*< Only valid while listed */
+	struct flock flock;	/*< Requested range */
+	int error;		/*< How the last try failed */
+	fsal_lock_param_t lock;	/*< Requested lock, as SAL knows it */
+	struct fsal_module *fsal;
+	const struct fsal_up_vector *up_ops;
+	vfs_file_handle_t fh;	/*< Copy of the handle, for the upcall key */
+};
+
+/*
+ * Files with blocked locks.  A file is put on or taken off this list
+ * with its ofd_mutex held, then this mutex, which is held for nothing
+ * else.  vfs_ofd_retry, which walks the list, only tries the files'
+ * mutexes.
+ */
+static struct glist_head vfs_ofd_blocked = GLIST_HEAD_INIT(vfs_ofd_blocked);
+static pthread_mutex_t vfs_ofd_blocked_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool vfs_ofd_retry_armed;
+static nsecs_elapsed_t vfs_ofd_retry_ns;
+
+/**
+ * @brief End of the range a lock covers
+ */
+
+static inline uint64_t vfs_ofd_end(const struct flock *flock)
+{
+	uint64_t start = flock->l_start;
+	uint64_t len = flock->l_len;
+
+	/* A length of 0 locks to the end of the file, however far */
+	if (len == 0 || len > UINT64_MAX - start)
+		return UINT64_MAX;
+	return start + len;
+}
+
+/**
+ * @brief Make room to record one more range
+ *
+ * Called before every lock and unlock, so that recording the result,
+ * which may split a range, cannot fail once the kernel has done it.
+ */
+
+static bool vfs_ofd_reserve(struct vfs_ofd_owner *ofd)
+{
+	struct vfs_ofd_range *ranges;
+	unsigned int max;
+
+	if (ofd->nranges < ofd->maxranges)
+		return true;
+
+	max = ofd->maxranges == 0 ? 4 : ofd->maxranges * 2;
+	ranges = gsh_realloc(ofd->ranges, max * sizeof(*ranges));
+	if (ranges == NULL)
+		return false;
+
+	ofd->ranges = ranges;
+	ofd->maxranges = max;
+	return true;
+}
+
+/**
+ * @brief Record a range as locked, merging the ranges it touches
+ */
+
+static void vfs_ofd_cover(struct vfs_ofd_owner *ofd,
+			  const struct flock *flock)
+{
+	uint64_t start = flock->l_start;
+	uint64_t end = vfs_ofd_end(flock);
+	struct vfs_ofd_range *r;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ofd->nranges; i++) {
+		r = &ofd->ranges[i];
+		if (r->start > end || r->end < start) {
+			ofd->ranges[n++] = *r;
+			continue;
+		}
+		if (r->start < start)
+			start = r->start;
+		if (r->end > end)
+			end = r->end;
+	}
+	ofd->ranges[n].start = start;
+	ofd->ranges[n].end = end;
+	ofd->nranges = n + 1;
+}
+
+/**
+ * @brief Record a range as unlocked, splitting a range it falls within
+ */
+
+static void vfs_ofd_uncover(struct vfs_ofd_owner *ofd,
+			    const struct flock *flock)
+{
+	uint64_t start = flock->l_start;
+	uint64_t end = vfs_ofd_end(flock);
+	struct vfs_ofd_range *r;
+	unsigned int i = 0;
+
+	while (i < ofd->nranges) {
+		r = &ofd->ranges[i];
+		if (r->end <= start || r->start >= end) {
+			i++;
+		} else if (r->start < start && r->end > end) {
+			/* Only one range can hold the whole unlock */
+			ofd->ranges[ofd->nranges].start = end;
+			ofd->ranges[ofd->nranges].end = r->end;
+			ofd->nranges++;
+			r->end = start;
+			i++;
+		} else if (r->start < start) {
+			r->end = start;
+			i++;
+		} else if (r->end > end) {
+			r->start = end;
+			i++;
+		} else {
+			*r = ofd->ranges[--ofd->nranges];
+		}
+	}
+}
+
+/**
+ * @brief Close a lock owner's description
+ *
+ * Must be called with ofd_mutex held.
+ */
+
+static void vfs_ofd_free(struct vfs_ofd_owner *ofd)
+{
+	glist_del(&ofd->list);
+	close(ofd->fd);
+	atomic_dec_size_t(&open_fd_count);
+	gsh_free(ofd->ranges);
+	gsh_free(ofd);
+}
+
+/**
+ * @brief Close a description once its owner holds and waits for nothing
+ *
+ * Closing it then drops nothing, and the owner may be freed.
+ *
+ * Must be called with ofd_mutex held.
+ */
+
+static void vfs_ofd_put(struct vfs_ofd_owner *ofd)
+{
+	if (ofd->nranges == 0 && ofd->waiters == 0)
+		vfs_ofd_free(ofd);
+}
+
+/**
+ * @brief Find or open the description for a lock owner
+ *
+ * The description is opened read-write whenever the file allows it,
+ * whatever the file itself was opened for, so that the owner can take
+ * both read and write locks.
+ *
+ * Must be called with ofd_mutex held.
+ *
+ * @param[in]  myself     File handle, opened
+ * @param[in]  owner      SAL lock owner
+ * @param[in]  owner_id   SAL's id for it
+ * @param[in]  create     Open a description if there is none yet
+ * @param[out] fsal_error Error on failure
+ *
+ * @return The description, or NULL if there is none.
+ */
+
+static struct vfs_ofd_owner *vfs_ofd_get(struct vfs_fsal_obj_handle *myself,
+					 void *owner, uint64_t owner_id,
+					 bool create,
+					 fsal_errors_t *fsal_error)
+{
+	struct glist_head *glist;
+	struct vfs_ofd_owner *ofd;
+	int fd;
+
+	glist_for_each(glist, &myself->u.file.ofd_owners) {
+		ofd = glist_entry(glist, struct vfs_ofd_owner, list);
+		if (ofd->owner == owner && ofd->owner_id == owner_id)
+			return ofd;
+	}
+
+	if (!create)
+		return NULL;
+
+	fd = vfs_fsal_open(myself, O_RDWR, fsal_error);
+	if (fd < 0 && (*fsal_error == ERR_FSAL_ACCESS ||
+		       *fsal_error == ERR_FSAL_ROFS ||
+		       *fsal_error == ERR_FSAL_PERM))
+		/* Only read locks can be had then */
+		fd = vfs_fsal_open(myself, O_RDONLY, fsal_error);
+	if (fd < 0)
+		return NULL;
+
+	ofd = gsh_calloc(1, sizeof(struct vfs_ofd_owner));
+	if (ofd == NULL) {
+		close(fd);
+		*fsal_error = ERR_FSAL_NOMEM;
+		return NULL;
+	}
+	ofd->owner = owner;
+	ofd->owner_id = owner_id;
+	ofd->fd = fd;
+	glist_add_tail(&myself->u.file.ofd_owners, &ofd->list);
+	atomic_inc_size_t(&open_fd_count);
+
+	return ofd;
+}
+
+/**
+ * @brief Tell SAL how a blocked lock ended
+ *
+ * @param[in] waiter Waiter, off its list, freed here
+ * @param[in] error  0 if the lock was granted
+ */
+
+static void vfs_ofd_upcall(struct vfs_ofd_waiter *waiter, int error)
+{
+	struct gsh_buffdesc key;
+	int retval;
+
+	key.addr = waiter->fh.handle_data;
+	key.len = waiter->fh.handle_len;
+
+	if (error == 0) {
+		retval = up_async_lock_grant(general_fridge, waiter->up_ops,
+					     waiter->fsal, &key, waiter->owner,
+					     &waiter->lock, NULL, NULL);
+	} else {
+		/* Let SAL retry rather than leave the lock blocked forever */
+		LogDebug(COMPONENT_FSAL,
+			 "Blocked lock retry failed with %s(%d)",
+			 strerror(error), error);
+		retval = up_async_lock_avail(general_fridge, waiter->up_ops,
+					     waiter->fsal, &key, waiter->owner,
+					     &waiter->lock, NULL, NULL);
+	}
+	if (retval != 0)
+		LogMajor(COMPONENT_FSAL,
+			 "Unable to queue lock upcall, error %d", retval);
+
+	gsh_free(waiter);
+}
+
+/**
+ * @brief Take a waiter off its file
+ *
+ * Must be called with ofd_mutex held.  The owner's description is
+ * closed if nothing else keeps it.
+ */
+
+static void vfs_ofd_unwait(struct vfs_ofd_waiter *waiter)
+{
+	glist_del(&waiter->list);
+	waiter->ofd->waiters--;
+	vfs_ofd_put(waiter->ofd);
+	waiter->ofd = NULL;
+}
+
+/**
+ * @brief Try the blocked locks of a file again
+ *
+ * Must be called with ofd_mutex held.  Waiters that are done are
+ * moved to @a done, for vfs_ofd_upcall once the mutex is dropped.
+ *
+ * @param[in]  myself File handle
+ * @param[out] done   Waiters that got their lock or failed
+ */
+
+static void vfs_ofd_try(struct vfs_fsal_obj_handle *myself,
+			struct glist_head *done)
+{
+	struct glist_head *glist, *glistn;
+	struct vfs_ofd_waiter *waiter;
+
+	glist_for_each_safe(glist, glistn, &myself->u.file.ofd_waiters) {
+		waiter = glist_entry(glist, struct vfs_ofd_waiter, list);
+		if (!vfs_ofd_reserve(waiter->ofd))
+			continue;
+		waiter->error = 0;
+		if (fcntl(waiter->ofd->fd, F_OFD_SETLK, &waiter->flock) == 0) {
+			vfs_ofd_cover(waiter->ofd, &waiter->flock);
+		} else {
+			waiter->error = errno;
+			if (waiter->error == EAGAIN || waiter->error == EACCES)
+				continue;
+		}
+		vfs_ofd_unwait(waiter);
+		glist_add_tail(done, &waiter->list);
+	}
+}
+
+/**
+ * @brief Report the waiters vfs_ofd_try is done with
+ *
+ * @param[in] done Waiters, with no mutex held
+ */
+
+static void vfs_ofd_finish(struct glist_head *done)
+{
+	struct glist_head *glist, *glistn;
+	struct vfs_ofd_waiter *waiter;
+
+	glist_for_each_safe(glist, glistn, done) {
+		waiter = glist_entry(glist, struct vfs_ofd_waiter, list);
+		glist_del(&waiter->list);
+		vfs_ofd_upcall(waiter, waiter->error);
+	}
+}
+
+/**
+ * @brief Periodic retry of every blocked lock
+ *
+ * Run by the delayed executor.  It only makes non-blocking fcntl
+ * calls, and a file whose ofd_mutex is busy is left for the next
+ * pass.  It rearms itself while any lock is blocked.
+ */
+
+static void vfs_ofd_retry(void *arg)
+{
+	struct glist_head done;
+	struct glist_head *glist, *glistn;
+	struct vfs_fsal_obj_handle *myself;
+
+	glist_init(&done);
+
+	PTHREAD_MUTEX_lock(&vfs_ofd_blocked_mutex);
+	glist_for_each_safe(glist, glistn, &vfs_ofd_blocked) {
+		myself = glist_entry(glist, struct vfs_fsal_obj_handle,
+				     u.file.ofd_blocked);
+		if (pthread_mutex_trylock(&myself->u.file.ofd_mutex) != 0)
+			continue;
+		vfs_ofd_try(myself, &done);
+		if (glist_empty(&myself->u.file.ofd_waiters))
+			glist_del(&myself->u.file.ofd_blocked);
+		PTHREAD_MUTEX_unlock(&myself->u.file.ofd_mutex);
+	}
+	vfs_ofd_retry_armed = !glist_empty(&vfs_ofd_blocked) &&
+	    delayed_submit(vfs_ofd_retry, NULL, vfs_ofd_retry_ns) == 0;
+	PTHREAD_MUTEX_unlock(&vfs_ofd_blocked_mutex);
+
+	vfs_ofd_finish(&done);
+}
+
+/**
+ * @brief Keep a file on the blocked list while it has waiters
+ *
+ * Must be called with ofd_mutex held, once waiters have been added or
+ * removed.
+ *
+ * @param[in] myself      File handle
+ * @param[in] was_blocked Whether the file had waiters before
+ */
+
+static void vfs_ofd_blocked_update(struct vfs_fsal_obj_handle *myself,
+				   bool was_blocked)
+{
+	bool blocked = !glist_empty(&myself->u.file.ofd_waiters);
+	struct fsal_staticfsinfo_t *info;
+
+	if (blocked == was_blocked)
+		return;
+
+	PTHREAD_MUTEX_lock(&vfs_ofd_blocked_mutex);
+	if (!blocked) {
+		glist_del(&myself->u.file.ofd_blocked);
+	} else {
+		glist_add_tail(&vfs_ofd_blocked, &myself->u.file.ofd_blocked);
+		info = vfs_staticinfo(myself->obj_handle.fsal);
+		vfs_ofd_retry_ns = info->lock_retry_ms * NS_PER_MSEC;
+		if (!vfs_ofd_retry_armed)
+			vfs_ofd_retry_armed =
+			    delayed_submit(vfs_ofd_retry, NULL,
+					   vfs_ofd_retry_ns) == 0;
+	}
+	PTHREAD_MUTEX_unlock(&vfs_ofd_blocked_mutex);
+}
+
+/**
+ * @brief Queue a blocked lock
+ *
+ * Blocked locks are not waited for in the kernel, which would take a
+ * thread for each, but tried again whenever an owner unlocks or
+ * downgrades through vfs_lock_op, so handing a lock from one NFS owner
+ * to the next is immediate.  Conflicts held by local processes, which
+ * tell us nothing when they go, are found gone by vfs_ofd_retry every
+ * ofd_retry_ms.
+ *
+ * Must be called with ofd_mutex held.
+ */
+
+static fsal_errors_t vfs_ofd_block(struct vfs_fsal_obj_handle *myself,
+				   struct vfs_ofd_owner *ofd,
+				   struct flock *lock_args,
+				   fsal_lock_param_t *request_lock)
+{
+	struct vfs_ofd_waiter *waiter;
+
+	waiter = gsh_calloc(1, sizeof(struct vfs_ofd_waiter));
+	if (waiter == NULL)
+		return ERR_FSAL_NOMEM;
+
+	waiter->owner = ofd->owner;
+	waiter->ofd = ofd;
+	waiter->flock = *lock_args;
+	waiter->lock = *request_lock;
+	waiter->fsal = myself->obj_handle.fsal;
+	waiter->up_ops = myself->up_ops;
+	memcpy(&waiter->fh, myself->handle, sizeof(vfs_file_handle_t));
+
+	ofd->waiters++;
+	glist_add_tail(&myself->u.file.ofd_waiters, &waiter->list);
+
+	return ERR_FSAL_BLOCKED;
+}
+
+/**
+ * @brief Cancel a blocked lock
+ *
+ * Nothing runs on behalf of a waiter, so taking it off the list under
+ * ofd_mutex is all it takes.
+ *
+ * @retval ERR_FSAL_NO_ERROR if the wait was stopped.
+ * @retval ERR_FSAL_NOENT if it already finished, in which case an
+ *         upcall is on its way.
+ */
+
+static fsal_errors_t vfs_ofd_cancel(struct vfs_fsal_obj_handle *myself,
+				    void *owner,
+				    fsal_lock_param_t *request_lock)
+{
+	struct glist_head *glist;
+	struct vfs_ofd_waiter *waiter, *found = NULL;
+
+	PTHREAD_MUTEX_lock(&myself->u.file.ofd_mutex);
+	glist_for_each(glist, &myself->u.file.ofd_waiters) {
+		waiter = glist_entry(glist, struct vfs_ofd_waiter, list);
+		if (waiter->owner == owner &&
+		    waiter->ofd->owner_id == request_lock->lock_owner_id &&
+		    waiter->lock.lock_type == request_lock->lock_type &&
+		    waiter->lock.lock_start == request_lock->lock_start &&
+		    waiter->lock.lock_length == request_lock->lock_length) {
+			found = waiter;
+			vfs_ofd_unwait(found);
+			break;
+		}
+	}
+	if (found != NULL)
+		vfs_ofd_blocked_update(myself, true);
+	PTHREAD_MUTEX_unlock(&myself->u.file.ofd_mutex);
+
+	if (found == NULL)
+		return ERR_FSAL_NOENT;
+
+	gsh_free(found);
+	return ERR_FSAL_NO_ERROR;
+}
+
+/**
+ * @brief Release all lock owner state on a file
+ *
+ * Drops any blocked waiters and closes every owner's description,
+ * which drops the locks they hold.
+ */
+
+static void vfs_ofd_release(struct vfs_fsal_obj_handle *myself)
+{
+	struct glist_head *glist, *glistn;
+	struct vfs_ofd_waiter *waiter;
+	bool was_blocked;
+
+	PTHREAD_MUTEX_lock(&myself->u.file.ofd_mutex);
+	was_blocked = !glist_empty(&myself->u.file.ofd_waiters);
+	glist_for_each_safe(glist, glistn, &myself->u.file.ofd_waiters) {
+		waiter = glist_entry(glist, struct vfs_ofd_waiter, list);
+		glist_del(&waiter->list);
+		gsh_free(waiter);
 	}
+	vfs_ofd_blocked_update(myself, was_blocked);
+	glist_for_each_safe(glist, glistn, &myself->u.file.ofd_owners)
+		vfs_ofd_free(glist_entry(glist, struct vfs_ofd_owner, list));
+	PTHREAD_MUTEX_unlock(&myself->u.file.ofd_mutex);
+}
+
+/**
+ * @brief Lock operations on behalf of a specific lock owner
+ *
+ * Used when the FSAL advertises lock_support_owner.  Each owner
+ * gets its own open file description so F_OFD_* locks give us exact
+ * per-owner conflict detection from the kernel.  FSAL_OP_LOCKB that
+ * cannot be granted is queued, see vfs_ofd_block.
+ *
+ * Only the file's ofd_mutex is held for the fcntl calls, so owners of
+ * different files do not wait on each other.
+ */
+
+static fsal_status_t vfs_ofd_lock_op(struct vfs_fsal_obj_handle *myself,
+				     void *p_owner,
+				     fsal_lock_op_t lock_op,
+				     struct flock *lock_args,
+				     fsal_lock_param_t *request_lock,
+				     fsal_lock_param_t *conflicting_lock)
+{
+	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
+	int retval = 0;
+	struct vfs_ofd_owner *ofd;
+	struct glist_head done;
+	bool was_blocked;
+	int fd;
+
+	if (lock_op == FSAL_OP_CANCEL) {
+		fsal_error = vfs_ofd_cancel(myself, p_owner, request_lock);
+		return fsalstat(fsal_error, 0);
+	}
+
+	glist_init(&done);
+
+	PTHREAD_MUTEX_lock(&myself->u.file.ofd_mutex);
+	was_blocked = !glist_empty(&myself->u.file.ofd_waiters);
+
+	ofd = vfs_ofd_get(myself, p_owner, request_lock->lock_owner_id,
+			  lock_op != FSAL_OP_UNLOCK &&
+			  lock_op != FSAL_OP_LOCKT,
+			  &fsal_error);
+
+	if (lock_op == FSAL_OP_LOCKT) {
+		/* An owner without a description holds nothing, and the
+		 * file's own descriptor holds no OFD locks, so testing on
+		 * it sees every lock as the owner would.
+		 */
+		fd = ofd != NULL ? ofd->fd : myself->u.file.fd;
+		if (fcntl(fd, F_OFD_GETLK, lock_args) != 0) {
+			retval = errno;
+			fsal_error = posix2fsal_error(retval);
+			goto out;
+		}
+		if (conflicting_lock != NULL) {
+			if (lock_args->l_type != F_UNLCK) {
+				conflicting_lock->lock_length =
+				    lock_args->l_len;
+				conflicting_lock->lock_start =
+				    lock_args->l_start;
+				conflicting_lock->lock_type =
+				    lock_args->l_type == F_RDLCK
+				    ? FSAL_LOCK_R : FSAL_LOCK_W;
+			} else {
+				conflicting_lock->lock_length = 0;
+				conflicting_lock->lock_start = 0;
+				conflicting_lock->lock_type = FSAL_NO_LOCK;
+			}
+		}
+		goto out;
+	}
+
+	if (ofd == NULL) {
+		/* An owner we never saw holds nothing to unlock */
+		if (lock_op == FSAL_OP_UNLOCK)
+			fsal_error = ERR_FSAL_NO_ERROR;
+		goto out;
+	}
+
+	if (!vfs_ofd_reserve(ofd)) {
+		fsal_error = ERR_FSAL_NOMEM;
+		goto put;
+	}
+
+	if (fcntl(ofd->fd, F_OFD_SETLK, lock_args) == 0) {
+		if (lock_op == FSAL_OP_UNLOCK)
+			vfs_ofd_uncover(ofd, lock_args);
+		else
+			vfs_ofd_cover(ofd, lock_args);
+		vfs_ofd_put(ofd);
+		/* An unlock or a downgrade may let a blocked lock in */
+		if (was_blocked)
+			vfs_ofd_try(myself, &done);
+		goto out;
+	}
+
+	retval = errno;
+	if (lock_op == FSAL_OP_LOCKB &&
+	    (retval == EAGAIN || retval == EACCES)) {
+		retval = 0;
+		fsal_error = vfs_ofd_block(myself, ofd, lock_args,
+					   request_lock);
+		goto put;
+	}
+
+	if (lock_op != FSAL_OP_UNLOCK && conflicting_lock != NULL) {
+		struct flock conflict = *lock_args;
+
+		if (fcntl(ofd->fd, F_OFD_GETLK, &conflict) == 0 &&
+		    conflict.l_type != F_UNLCK) {
+			conflicting_lock->lock_length = conflict.l_len;
+			conflicting_lock->lock_start = conflict.l_start;
+			conflicting_lock->lock_type =
+			    conflict.l_type == F_RDLCK
+			    ? FSAL_LOCK_R : FSAL_LOCK_W;
+		}
+	}
+	fsal_error = posix2fsal_error(retval);
+
+ put:
+	vfs_ofd_put(ofd);
+ out:
+	vfs_ofd_blocked_update(myself, was_blocked);
+	PTHREAD_MUTEX_unlock(&myself->u.file.ofd_mutex);
+	vfs_ofd_finish(&done);
 	return fsalstat(fsal_error, retval);
 }
 
+#endif				/* F_OFD_SETLK */
+
 /* vfs_lock_op
  * lock a region of the file
  * throw an error if the fd is not open.  The old fsal didn't
@@ -265,15 +1198,19 @@ fsal_status_t vfs_lock_op(struct fsal_obj_handle *obj_hdl,
 		fsal_error = ERR_FSAL_FAULT;
 		goto out;
 	}
-	if (p_owner != NULL) {
-		fsal_error = ERR_FSAL_NOTSUPP;
-		goto out;
-	}
 	LogFullDebug(COMPONENT_FSAL,
 		     "Locking: op:%d type:%d start:%" PRIu64 " length:%lu ",
 		     lock_op, request_lock->lock_type, request_lock->lock_start,
 		     request_lock->lock_length);
-	if (lock_op == FSAL_OP_LOCKT) {
+	if (p_owner != NULL) {
+#ifdef F_OFD_SETLK
+		/* Owner aware locking, see vfs_ofd_lock_op */
+		fcntl_comm = F_OFD_SETLK;
+#else
+		fsal_error = ERR_FSAL_NOTSUPP;
+		goto out;
+#endif
+	} else if (lock_op == FSAL_OP_LOCKT) {
 		fcntl_comm = F_GETLK;
 	} else if (lock_op == FSAL_OP_LOCK || lock_op == FSAL_OP_UNLOCK) {
 		fcntl_comm = F_SETLK;
@@ -301,6 +1238,13 @@ fsal_status_t vfs_lock_op(struct fsal_obj_handle *obj_hdl,
 	lock_args.l_len = request_lock->lock_length;
 	lock_args.l_start = request_lock->lock_start;
 	lock_args.l_whence = SEEK_SET;
+	lock_args.l_pid = 0;
+
+#ifdef F_OFD_SETLK
+	if (fcntl_comm == F_OFD_SETLK)
+		return vfs_ofd_lock_op(myself, p_owner, lock_op, &lock_args,
+				       request_lock, conflicting_lock);
+#endif
 
 	errno = 0;
 	retval = fcntl(myself->u.file.fd, fcntl_comm, &lock_args);
@@ -369,6 +1313,10 @@ fsal_status_t vfs_close(struct fsal_obj_handle *obj_hdl)
 		return fsalstat(fsal_error, retval);
 	}
 
+#ifdef F_OFD_SETLK
+	vfs_ofd_release(myself);
+#endif
+
 	if (myself->u.file.fd >= 0 &&
 	    myself->u.file.openflags != FSAL_O_CLOSED) {
 		retval = close(myself->u.file.fd);
@@ -379,6 +1327,7 @@ fsal_status_t vfs_close(struct fsal_obj_handle *obj_hdl)
 		myself->u.file.fd = -1;
 		myself->u.file.openflags = FSAL_O_CLOSED;
 	}
+	vfs_close_direct(myself);
 	return fsalstat(fsal_error, retval);
 }
 
@@ -410,6 +1359,7 @@ fsal_status_t vfs_lru_cleanup(struct fsal_obj_handle *obj_hdl,
 		retval = close(myself->u.file.fd);
 		myself->u.file.fd = -1;
 		myself->u.file.openflags = FSAL_O_CLOSED;
+		vfs_close_direct(myself);
 	}
 	if (retval == -1) {
 		retval = errno;
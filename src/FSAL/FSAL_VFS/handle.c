@@ -89,6 +89,12 @@ static struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	if (hdl->obj_handle.type == REGULAR_FILE) {
 		hdl->u.file.fd = -1;	/* no open on this yet */
 		hdl->u.file.openflags = FSAL_O_CLOSED;
+		hdl->u.file.direct = false;
+		hdl->u.file.buffered_fd = -1;
+		PTHREAD_MUTEX_init(&hdl->u.file.ofd_mutex, NULL);
+		glist_init(&hdl->u.file.ofd_owners);
+		glist_init(&hdl->u.file.ofd_waiters);
+		glist_init(&hdl->u.file.ofd_blocked);
 	} else if (hdl->obj_handle.type == SYMBOLIC_LINK) {
 		ssize_t retlink;
 		size_t len = stat->st_size + 1;
@@ -132,13 +138,19 @@ static struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	hdl->obj_handle.attributes.fsid = fs->fsid;
 	fsal_obj_handle_init(&hdl->obj_handle, exp_hdl,
 			     posix2fsal_type(stat->st_mode));
+	/* A watched file system tells us when attributes change */
+	if (fs->private != NULL &&
+	    ((struct vfs_filesystem *)fs->private)->notify_fd >= 0)
+		hdl->obj_handle.attributes.expire_time_attr = -1;
 	vfs_handle_ops_init(&hdl->obj_handle.obj_ops);
 	vfs_sub_init_handle_ops(myself, &hdl->obj_handle.obj_ops);
 
 	return hdl;
 
  spcerr:
-	if (hdl->obj_handle.type == SYMBOLIC_LINK) {
+	if (hdl->obj_handle.type == REGULAR_FILE) {
+		PTHREAD_MUTEX_destroy(&hdl->u.file.ofd_mutex);
+	} else if (hdl->obj_handle.type == SYMBOLIC_LINK) {
 		if (hdl->u.symlink.link_content != NULL)
 			gsh_free(hdl->u.symlink.link_content);
 	} else if (vfs_unopenable_type(hdl->obj_handle.type)) {
@@ -151,6 +163,45 @@ static struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	return NULL;
 }
 
+/**
+ * @brief Return post-operation attributes
+ *
+ * A namespace operation holds descriptors on the directories it
+ * changes, so one stat on them spares the caller a getattrs (open by
+ * handle, stat, close).  If the stat fails the mask is left empty
+ * and the caller does the getattrs.
+ *
+ * @param[in]  fd    Descriptor on the object, or on its directory
+ * @param[in]  fh    Handle of the object fd is on
+ * @param[in]  name  Name of the object in directory fd, or NULL
+ * @param[in]  fs    File system of the object
+ * @param[out] attrs Attributes
+ */
+
+static void vfs_postop_attrs(int fd, vfs_file_handle_t *fh, const char *name,
+			     struct fsal_filesystem *fs, struct attrlist *attrs)
+{
+	struct stat stat;
+	int retval;
+
+	if (name != NULL)
+		retval = fstatat(fd, name, &stat, AT_SYMLINK_NOFOLLOW);
+	else
+		retval = vfs_stat_by_handle(fd, fh, &stat, O_PATH | O_NOACCESS);
+
+	if (retval < 0) {
+		LogDebug(COMPONENT_FSAL, "post-op stat failed with %s",
+			 strerror(errno));
+		return;
+	}
+
+	if (FSAL_IS_ERROR(posix2fsal_attributes(&stat, attrs))) {
+		FSAL_CLEAR_MASK(attrs->mask);
+		return;
+	}
+	attrs->fsid = fs->fsid;
+}
+
 /* handle methods
  */
 
@@ -346,7 +397,8 @@ static inline int make_file_safe(struct vfs_fsal_obj_handle *dir_hdl,
 
 static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 			    const char *name, struct attrlist *attrib,
-			    struct fsal_obj_handle **handle)
+			    struct fsal_obj_handle **handle,
+			    struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *myself, *hdl;
 	int fd, dir_fd;
@@ -418,6 +470,9 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 		goto fileerr;
 	}
 	*handle = &hdl->obj_handle;
+	if (postop != NULL)
+		vfs_postop_attrs(dir_fd, myself->handle, NULL, dir_hdl->fs,
+				 &postop->dir);
 	close(dir_fd);
 	close(fd);
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -432,9 +487,131 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 	return fsalstat(fsal_error, retval);
 }
 
+/* create_open
+ * exclusively create a regular file and keep the descriptor the
+ * create returned as the handle's open file
+ */
+
+static fsal_status_t create_open(struct fsal_obj_handle *dir_hdl,
+				 const char *name,
+				 fsal_openflags_t openflags,
+				 struct attrlist *attrib,
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
+{
+	struct vfs_fsal_obj_handle *myself, *hdl;
+	int fd, dir_fd;
+	struct stat stat;
+	mode_t unix_mode;
+	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
+	int retval = 0;
+	int posix_flags = 0;
+	vfs_file_handle_t *fh = NULL;
+	vfs_alloc_handle(fh);
+
+	LogDebug(COMPONENT_FSAL, "create_open %s", name);
+
+	*handle = NULL;		/* poison it */
+
+	if (!dir_hdl->obj_ops.handle_is(dir_hdl, DIRECTORY)) {
+		LogCrit(COMPONENT_FSAL,
+			"Parent handle is not a directory. hdl = 0x%p",
+			dir_hdl);
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+	}
+	myself = container_of(dir_hdl, struct vfs_fsal_obj_handle, obj_handle);
+	if (dir_hdl->fsal != dir_hdl->fs->fsal) {
+		LogDebug(COMPONENT_FSAL,
+			 "FSAL %s operation for handle belonging to FSAL %s, return EXDEV",
+			 dir_hdl->fsal->name,
+			 dir_hdl->fs->fsal != NULL
+				? dir_hdl->fs->fsal->name
+				: "(none)");
+		retval = EXDEV;
+		goto hdlerr;
+	}
+	fsal2posix_openflags(openflags, &posix_flags);
+	unix_mode = fsal2unix_mode(attrib->mode)
+	    & ~op_ctx->fsal_export->exp_ops.fs_umask(op_ctx->fsal_export);
+	dir_fd = vfs_fsal_open(myself, O_PATH | O_NOACCESS, &fsal_error);
+	if (dir_fd < 0)
+		return fsalstat(fsal_error, -dir_fd);
+	/* Become the user because we are creating an object in this dir.
+	 * The new file can be opened for writing whatever its mode.
+	 */
+	fsal_set_credentials(op_ctx->creds);
+	fd = openat(dir_fd, name, posix_flags | O_CREAT | O_EXCL, unix_mode);
+	if (fd < 0) {
+		retval = errno;
+		fsal_restore_ganesha_credentials();
+		goto direrr;
+	}
+	fsal_restore_ganesha_credentials();
+	/* Store the exclusive create verifier before anyone can see
+	 * the file without it.
+	 */
+	if (FSAL_TEST_MASK(attrib->mask, ATTR_ATIME | ATTR_MTIME)) {
+		struct timespec timebuf[2];
+
+		if (FSAL_TEST_MASK(attrib->mask, ATTR_ATIME)) {
+			timebuf[0] = attrib->atime;
+		} else {
+			timebuf[0].tv_sec = 0;
+			timebuf[0].tv_nsec = UTIME_OMIT;
+		}
+		if (FSAL_TEST_MASK(attrib->mask, ATTR_MTIME)) {
+			timebuf[1] = attrib->mtime;
+		} else {
+			timebuf[1].tv_sec = 0;
+			timebuf[1].tv_nsec = UTIME_OMIT;
+		}
+		retval = vfs_utimes(fd, timebuf);
+		if (retval != 0) {
+			retval = errno;
+			goto fileerr;
+		}
+	}
+	retval = vfs_name_to_handle(dir_fd, dir_hdl->fs, name, fh);
+	if (retval < 0) {
+		retval = errno;
+		goto fileerr;
+	}
+	retval = fstat(fd, &stat);
+	if (retval < 0) {
+		retval = errno;
+		goto fileerr;
+	}
+	/* allocate an obj_handle and fill it up */
+	hdl = alloc_handle(dir_fd, fh, dir_hdl->fs, &stat, myself->handle, name,
+			   op_ctx->fsal_export);
+	if (hdl == NULL) {
+		retval = ENOMEM;
+		goto fileerr;
+	}
+	hdl->u.file.fd = fd;
+	hdl->u.file.openflags = openflags;
+	vfs_direct_created(hdl);
+	*handle = &hdl->obj_handle;
+	if (postop != NULL)
+		vfs_postop_attrs(dir_fd, myself->handle, NULL, dir_hdl->fs,
+				 &postop->dir);
+	close(dir_fd);
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+ fileerr:
+	close(fd);
+	unlinkat(dir_fd, name, 0);
+ direrr:
+	close(dir_fd);
+ hdlerr:
+	fsal_error = posix2fsal_error(retval);
+	return fsalstat(fsal_error, retval);
+}
+
 static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 			     const char *name, struct attrlist *attrib,
-			     struct fsal_obj_handle **handle)
+			     struct fsal_obj_handle **handle,
+			     struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *myself, *hdl;
 	int dir_fd;
@@ -506,6 +683,9 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 		goto fileerr;
 	}
 	*handle = &hdl->obj_handle;
+	if (postop != NULL)
+		vfs_postop_attrs(dir_fd, myself->handle, NULL, dir_hdl->fs,
+				 &postop->dir);
 
 	close(dir_fd);
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -524,7 +704,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 			      object_file_type_t nodetype,	/* IN */
 			      fsal_dev_t *dev,	/* IN */
 			      struct attrlist *attrib,
-			      struct fsal_obj_handle **handle)
+			      struct fsal_obj_handle **handle,
+			      struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *myself, *hdl;
 	int dir_fd = -1;
@@ -608,6 +789,9 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 	retval = make_file_safe(myself, op_ctx, dir_fd, name,
 				unix_mode, user, group, &hdl);
 	if (!retval) {
+		if (postop != NULL)
+			vfs_postop_attrs(dir_fd, myself->handle, NULL,
+					 dir_hdl->fs, &postop->dir);
 		close(dir_fd);	/* done with parent */
 		*handle = &hdl->obj_handle;
 		return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -633,7 +817,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name, const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *myself, *hdl;
 	int dir_fd = -1;
@@ -705,6 +890,9 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 		goto linkerr;
 	}
 	*handle = &hdl->obj_handle;
+	if (postop != NULL)
+		vfs_postop_attrs(dir_fd, myself->handle, NULL, dir_hdl->fs,
+				 &postop->dir);
 
 	close(dir_fd);
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -774,7 +962,8 @@ static fsal_status_t readsymlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *myself, *destdir;
 	int srcfd, destdirfd;
@@ -847,6 +1036,11 @@ static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 		LogFullDebug(COMPONENT_FSAL,
 			     "link returned %d", retval);
 		fsal_error = posix2fsal_error(retval);
+	} else if (postop != NULL) {
+		vfs_postop_attrs(srcfd, myself->handle, NULL, obj_hdl->fs,
+				 &postop->obj);
+		vfs_postop_attrs(destdirfd, destdir->handle, NULL,
+				 destdir_hdl->fs, &postop->dir);
 	}
 
 	close(destdirfd);
@@ -929,7 +1123,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 				goto skip;	/* must skip '.' and '..' */
 
 			/* callback to cache inode */
-			if (!cb(dentryp->vd_name, dir_state,
+			if (!cb(dentryp->vd_name, NULL, dir_state,
 				(fsal_cookie_t) dentryp->vd_offset)) {
 				goto done;
 			}
@@ -950,7 +1144,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *olddir, *newdir, *obj;
 	int oldfd = -1, newfd = -1;
@@ -1026,6 +1221,15 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 		}
 	}
 	fsal_restore_ganesha_credentials();
+	if (retval == 0 && postop != NULL) {
+		vfs_postop_attrs(oldfd, olddir->handle, NULL, olddir_hdl->fs,
+				 &postop->dir);
+		if (newdir_hdl != olddir_hdl)
+			vfs_postop_attrs(newfd, newdir->handle, NULL,
+					 newdir_hdl->fs, &postop->newdir);
+		vfs_postop_attrs(newfd, NULL, new_name, obj_hdl->fs,
+				 &postop->obj);
+	}
  out:
 	if (oldfd >= 0)
 		close(oldfd);
@@ -1290,6 +1494,17 @@ static fsal_status_t setattrs(struct fsal_obj_handle *obj_hdl,
 			} else
 				goto fileerr;
 		}
+		/* Replaying writes logged before this would extend the
+		 * file again */
+		if (EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->intent_log) {
+			retval = vfs_intent_log_retire(
+			    EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->intent_log,
+			    myself, cfd.fd);
+			if (retval != 0) {
+				fsal_error = posix2fsal_error(retval);
+				goto out;
+			}
+		}
 	}
 
 	/** CHMOD **/
@@ -1386,7 +1601,8 @@ static fsal_status_t setattrs(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	struct vfs_fsal_obj_handle *myself;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
@@ -1433,6 +1649,24 @@ static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
 	}
 	fsal_restore_ganesha_credentials();
 
+	if (retval == 0 && postop != NULL) {
+		vfs_postop_attrs(fd, myself->handle, NULL, dir_hdl->fs,
+				 &postop->dir);
+		/* The object can no longer be looked up, but is what we
+		 * saw before less a link.  Its new ctime is unknown, so
+		 * it is left out.
+		 */
+		if (postop->dir.mask != 0 &&
+		    !FSAL_IS_ERROR(posix2fsal_attributes(&stat,
+							 &postop->obj))) {
+			postop->obj.fsid = dir_hdl->fs->fsid;
+			postop->obj.numlinks =
+			    S_ISDIR(stat.st_mode) ? 0 : stat.st_nlink - 1;
+			FSAL_UNSET_MASK(postop->obj.mask,
+					ATTR_CTIME | ATTR_CHGTIME);
+		}
+	}
+
  errout:
 	close(fd);
  out:
@@ -1523,6 +1757,7 @@ static void release(struct fsal_obj_handle *obj_hdl)
 				"Could not close hdl 0x%p, error %s(%d)",
 				obj_hdl, strerror(st.minor), st.minor);
 		}
+		PTHREAD_MUTEX_destroy(&myself->u.file.ofd_mutex);
 	}
 
 	fsal_obj_handle_fini(obj_hdl);
@@ -1546,6 +1781,7 @@ void vfs_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->lookup = lookup;
 	ops->readdir = read_dirents;
 	ops->create = create;
+	ops->create_open = create_open;
 	ops->mkdir = makedir;
 	ops->mknode = makenode;
 	ops->symlink = makesymlink;
@@ -0,0 +1,880 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file FSAL/FSAL_VFS/intent_log.c
+ * @brief Intent log for stable writes
+ *
+ * A stable write is written to the file as usual and then appended,
+ * with the file's handle and offset, to a log on a fast device; it is
+ * acknowledged once the log is flushed, which concurrent writers
+ * share.  A checkpoint thread fsyncs the files with logged writes and
+ * moves the start of the log past them, so the space their records
+ * took can be reused, and starts the log over when all of it is
+ * retired.
+ *
+ * Whatever is left in the log when the server stops is written back
+ * to the files when the export is next created, before any client
+ * can use it.  A COMMIT or truncate of a file with logged writes
+ * appends a retire record voiding the file's earlier records, so that
+ * replay does not put back data that was since overwritten and made
+ * stable some other way.
+ *
+ * The log starts with a header naming its generation and first live
+ * record.  The rest of the file is a ring of records, each
+ * checksummed with its data.  Log offsets keep growing through a
+ * generation and are taken modulo the ring to find a record; each
+ * record names the offset it was appended at, so one left from an
+ * earlier time round is told apart.  A record never wraps: if it
+ * does not fit before the end of the ring it goes at the start.
+ * Replay stops at the first record that does not check out.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "fsal.h"
+#include "fsal_convert.h"
+#include "FSAL/fsal_commonlib.h"
+#include "city.h"
+#include "vfs_methods.h"
+
+#define VFS_LOG_MAGIC 0x474c4f47	/* GLOG */
+#define VFS_LOG_VERSION 2
+#define VFS_LOG_HEADER_SIZE 4096
+#define VFS_LOG_WRITE 1
+#define VFS_LOG_RETIRE 2
+#define VFS_LOG_BUCKETS 1024
+#define VFS_LOG_CHECKPOINT_SECONDS 1
+
+struct vfs_log_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation;
+	uint64_t head;		/*< First record not yet retired */
+	uint64_t checksum;
+};
+
+struct vfs_log_record {
+	uint32_t magic;
+	uint32_t type;		/*< VFS_LOG_WRITE or VFS_LOG_RETIRE */
+	uint64_t generation;
+	uint64_t position;	/*< Log offset the record was appended at */
+	uint64_t offset;	/*< In the file, or for a retire, the log
+				    offset its file's records are void before */
+	uint32_t length;	/*< Of the data following the record */
+	uint8_t handle_len;
+	uint8_t handle[VFS_HANDLE_LEN];
+	uint64_t checksum;	/*< Of the record and its data */
+};
+
+/**
+ * @brief A file with records in the log
+ */
+
+struct vfs_log_file {
+	struct glist_head list;	/*< On a bucket */
+	struct vfs_filesystem *vfs_fs;
+	vfs_file_handle_t fh;
+	uint64_t last;		/*< End of its last record; in replay,
+				    where its records stop being void */
+};
+
+struct vfs_intent_log {
+	int fd;
+	uint64_t size;		/*< Of the log file */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;	/*< Flush done or space freed */
+	pthread_cond_t kick;	/*< Wakes the checkpoint thread */
+	pthread_t thread;
+	bool stop;
+	uint64_t generation;
+	uint64_t head;
+	uint64_t tail;		/*< Where the next record goes */
+	uint64_t flushed;	/*< Log durable up to here */
+	bool flushing;
+	struct glist_head buckets[VFS_LOG_BUCKETS];
+};
+
+static inline uint64_t record_size(size_t length)
+{
+	return (sizeof(struct vfs_log_record) + length + 7) & ~7ULL;
+}
+
+static inline uint64_t ring_size(const struct vfs_intent_log *log)
+{
+	return log->size - VFS_LOG_HEADER_SIZE;
+}
+
+/**
+ * @brief Where in the file a log offset is
+ */
+
+static inline uint64_t log_pos(const struct vfs_intent_log *log,
+			       uint64_t at)
+{
+	return VFS_LOG_HEADER_SIZE + (at - VFS_LOG_HEADER_SIZE) %
+	    ring_size(log);
+}
+
+/**
+ * @brief Space from a log offset to the end of the ring
+ */
+
+static inline uint64_t ring_left(const struct vfs_intent_log *log,
+				 uint64_t at)
+{
+	return ring_size(log) - (at - VFS_LOG_HEADER_SIZE) % ring_size(log);
+}
+
+static inline struct glist_head *bucket(struct vfs_intent_log *log,
+					const vfs_file_handle_t *fh)
+{
+	return &log->buckets[CityHash64((char *)fh->handle_data,
+					fh->handle_len) % VFS_LOG_BUCKETS];
+}
+
+static struct vfs_log_file *find_file(struct vfs_intent_log *log,
+				      const vfs_file_handle_t *fh)
+{
+	struct glist_head *glist;
+	struct vfs_log_file *file;
+
+	glist_for_each(glist, bucket(log, fh)) {
+		file = glist_entry(glist, struct vfs_log_file, list);
+		if (file->fh.handle_len == fh->handle_len &&
+		    memcmp(file->fh.handle_data, fh->handle_data,
+			   fh->handle_len) == 0)
+			return file;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Write the header and make it durable
+ *
+ * Called with the mutex held.
+ */
+
+static int write_header(struct vfs_intent_log *log)
+{
+	struct vfs_log_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = VFS_LOG_MAGIC;
+	hdr.version = VFS_LOG_VERSION;
+	hdr.generation = log->generation;
+	hdr.head = log->head;
+	hdr.checksum = CityHash64((char *)&hdr, sizeof(hdr));
+
+	if (pwrite(log->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    fdatasync(log->fd) != 0)
+		return errno;
+	return 0;
+}
+
+/**
+ * @brief Wait until the log is durable up to a point
+ *
+ * Called with the mutex held.  One waiter flushes for everyone who
+ * has appended by then.
+ *
+ * @param[in] log        The log
+ * @param[in] generation Generation the records were appended in
+ * @param[in] end        End of the last of them
+ *
+ * @return 0 or an errno.
+ */
+
+static int log_sync(struct vfs_intent_log *log, uint64_t generation,
+		    uint64_t end)
+{
+	uint64_t target;
+	int rc = 0;
+
+	/* Once the generation moves on the records' files have all
+	 * been fsynced. */
+	while (log->generation == generation && log->flushed < end) {
+		if (log->flushing) {
+			pthread_cond_wait(&log->cond, &log->mutex);
+			continue;
+		}
+		target = log->tail;
+		log->flushing = true;
+		PTHREAD_MUTEX_unlock(&log->mutex);
+
+		rc = fdatasync(log->fd) == 0 ? 0 : errno;
+
+		PTHREAD_MUTEX_lock(&log->mutex);
+		log->flushing = false;
+		if (rc == 0 && log->generation == generation &&
+		    target > log->flushed)
+			log->flushed = target;
+		pthread_cond_broadcast(&log->cond);
+		if (rc != 0)
+			break;
+	}
+
+	return rc;
+}
+
+/**
+ * @brief Append a record and wait for it to be durable
+ *
+ * @param[in] log    The log
+ * @param[in] vfs_fs File system of the file
+ * @param[in] fh     Handle of the file
+ * @param[in] type   VFS_LOG_WRITE or VFS_LOG_RETIRE
+ * @param[in] buffer Data written
+ * @param[in] length Length of data
+ * @param[in] offset Offset it was written at
+ * @param[in] generation Generation @a offset belongs to, 0 if any
+ *
+ * @return 0, ENOSPC if it can never fit, or another errno.
+ */
+
+static int log_append(struct vfs_intent_log *log,
+		      struct vfs_filesystem *vfs_fs,
+		      const vfs_file_handle_t *fh, uint32_t type,
+		      const void *buffer, size_t length, uint64_t offset,
+		      uint64_t generation)
+{
+	struct vfs_log_record rec;
+	struct vfs_log_file *file;
+	static const char zeros[8];
+	uint64_t reclen = record_size(length);
+	uint64_t data_hash, at;
+	struct iovec iov[3];
+	int rc;
+
+	if (reclen > ring_size(log))
+		return ENOSPC;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = VFS_LOG_MAGIC;
+	rec.type = type;
+	rec.offset = offset;
+	rec.length = length;
+	rec.handle_len = fh->handle_len;
+	memcpy(rec.handle, fh->handle_data, fh->handle_len);
+	data_hash = CityHash64((char *)buffer, length);
+
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = (void *)buffer;
+	iov[1].iov_len = length;
+	iov[2].iov_base = (void *)zeros;
+	iov[2].iov_len = reclen - sizeof(rec) - length;
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+
+	for (;;) {
+		/* Skip what is left of the ring if it would not fit */
+		at = log->tail;
+		if (ring_left(log, at) < reclen)
+			at += ring_left(log, at);
+		if (at + reclen - log->head <= ring_size(log) || log->stop)
+			break;
+		/* Full, let the checkpoint make room */
+		pthread_cond_signal(&log->kick);
+		pthread_cond_wait(&log->cond, &log->mutex);
+	}
+	if (log->stop) {
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		return ESHUTDOWN;
+	}
+	if (generation != 0 && generation != log->generation) {
+		/* Everything it would void is already retired */
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		return 0;
+	}
+
+	rec.generation = log->generation;
+	rec.position = at;
+	rec.checksum = CityHash64WithSeed((char *)&rec, sizeof(rec),
+					  data_hash);
+
+	/* Appending under the mutex means everything before the tail
+	 * is written whenever a flush starts. */
+	if (pwritev(log->fd, iov, 3, log_pos(log, at)) != (ssize_t)reclen) {
+		rc = errno;
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		return rc;
+	}
+	log->tail = at + reclen;
+
+	file = find_file(log, fh);
+	if (file == NULL) {
+		file = gsh_calloc(1, sizeof(*file));
+		if (file == NULL) {
+			/* Without it a checkpoint would retire the
+			 * record without syncing the file. */
+			log->tail = at;
+			PTHREAD_MUTEX_unlock(&log->mutex);
+			return ENOMEM;
+		}
+		file->vfs_fs = vfs_fs;
+		memcpy(&file->fh, fh, sizeof(*fh));
+		glist_add_tail(bucket(log, fh), &file->list);
+	}
+	file->last = log->tail;
+
+	if (log->tail - log->head > ring_size(log) / 2)
+		pthread_cond_signal(&log->kick);
+
+	rc = log_sync(log, log->generation, log->tail);
+
+	PTHREAD_MUTEX_unlock(&log->mutex);
+	return rc;
+}
+
+/**
+ * @brief Log a stable write
+ *
+ * The data has already been written to the file.
+ *
+ * @param[in] log    The export's log
+ * @param[in] myself File written
+ * @param[in] buffer Data written
+ * @param[in] length Length written
+ * @param[in] offset Where
+ *
+ * @return 0 if the write is stable, else an errno; the caller must
+ *         then fsync the file and retire its records.
+ */
+
+int vfs_intent_log_write(struct vfs_intent_log *log,
+			 struct vfs_fsal_obj_handle *myself,
+			 const void *buffer, size_t length, uint64_t offset)
+{
+	return log_append(log, myself->obj_handle.fs->private,
+			  myself->handle, VFS_LOG_WRITE, buffer, length,
+			  offset, 0);
+}
+
+/**
+ * @brief Void a file's logged writes
+ *
+ * For when the file has been changed and made stable some other way,
+ * so replaying its logged writes would undo that.  The file is synced
+ * here, and only records appended before that started are voided, so
+ * a write logged meanwhile is still replayed.
+ *
+ * @param[in] log    The export's log
+ * @param[in] myself The file
+ * @param[in] fd     Descriptor of the file
+ *
+ * @return 0 or an errno.
+ */
+
+int vfs_intent_log_retire(struct vfs_intent_log *log,
+			  struct vfs_fsal_obj_handle *myself, int fd)
+{
+	uint64_t mark, generation;
+	bool logged;
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+	logged = find_file(log, myself->handle) != NULL;
+	mark = log->tail;
+	generation = log->generation;
+	PTHREAD_MUTEX_unlock(&log->mutex);
+
+	if (!logged)
+		return 0;
+
+	if (fsync(fd) != 0)
+		return errno;
+
+	return log_append(log, myself->obj_handle.fs->private,
+			  myself->handle, VFS_LOG_RETIRE, NULL, 0, mark,
+			  generation);
+}
+
+/**
+ * @brief Retire everything logged so far
+ *
+ * The files with records are fsynced outside the mutex, then the head
+ * moves past their records, or, if nothing was appended meanwhile,
+ * the log starts over in a new generation.
+ */
+
+static void checkpoint(struct vfs_intent_log *log)
+{
+	struct glist_head *glist, *glistn;
+	struct vfs_log_file *file, *files;
+	fsal_errors_t fsal_error;
+	uint64_t generation, end;
+	size_t nfiles = 0, i;
+	int fd, rc;
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+	end = log->tail;
+	generation = log->generation;
+	if (end == log->head) {
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		return;
+	}
+	for (i = 0; i < VFS_LOG_BUCKETS; i++)
+		glist_for_each(glist, &log->buckets[i])
+			nfiles++;
+	files = gsh_malloc(nfiles * sizeof(*files));
+	if (files == NULL) {
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		return;
+	}
+	nfiles = 0;
+	for (i = 0; i < VFS_LOG_BUCKETS; i++)
+		glist_for_each(glist, &log->buckets[i])
+			files[nfiles++] =
+			    *glist_entry(glist, struct vfs_log_file, list);
+	PTHREAD_MUTEX_unlock(&log->mutex);
+
+	for (i = 0; i < nfiles; i++) {
+		fsal_error = ERR_FSAL_NO_ERROR;
+		fd = vfs_open_by_handle(files[i].vfs_fs, &files[i].fh,
+					O_RDONLY, &fsal_error);
+		if (fd < 0) {
+			/* Removed, nothing left to lose */
+			if (fd == -ESTALE || fd == -ENOENT)
+				continue;
+			LogCrit(COMPONENT_FSAL,
+				"Intent log checkpoint could not open a file: %s",
+				strerror(-fd));
+			gsh_free(files);
+			return;
+		}
+		rc = fsync(fd);
+		close(fd);
+		if (rc != 0) {
+			LogCrit(COMPONENT_FSAL,
+				"Intent log checkpoint could not sync a file: %s",
+				strerror(errno));
+			gsh_free(files);
+			return;
+		}
+	}
+	gsh_free(files);
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+	if (log->generation == generation) {
+		for (i = 0; i < VFS_LOG_BUCKETS; i++) {
+			glist_for_each_safe(glist, glistn, &log->buckets[i]) {
+				file = glist_entry(glist, struct vfs_log_file,
+						   list);
+				if (file->last <= end) {
+					glist_del(&file->list);
+					gsh_free(file);
+				}
+			}
+		}
+		if (log->tail == end) {
+			log->generation++;
+			log->head = VFS_LOG_HEADER_SIZE;
+			log->tail = VFS_LOG_HEADER_SIZE;
+			log->flushed = VFS_LOG_HEADER_SIZE;
+		} else {
+			log->head = end;
+		}
+		rc = write_header(log);
+		if (rc != 0)
+			LogCrit(COMPONENT_FSAL,
+				"Could not write intent log header: %s",
+				strerror(rc));
+		pthread_cond_broadcast(&log->cond);
+	}
+	PTHREAD_MUTEX_unlock(&log->mutex);
+}
+
+static void *checkpoint_thread(void *arg)
+{
+	struct vfs_intent_log *log = arg;
+	struct timespec ts;
+
+	SetNameFunction("vfs_intent_log");
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+	while (!log->stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += VFS_LOG_CHECKPOINT_SECONDS;
+		pthread_cond_timedwait(&log->kick, &log->mutex, &ts);
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		checkpoint(log);
+		PTHREAD_MUTEX_lock(&log->mutex);
+	}
+	PTHREAD_MUTEX_unlock(&log->mutex);
+
+	return NULL;
+}
+
+/**
+ * @brief Find the file system a logged handle is on
+ */
+
+static struct vfs_filesystem *handle_fs(struct vfs_fsal_export *exp,
+					vfs_file_handle_t *fh)
+{
+	struct fsal_filesystem *fs;
+	struct fsal_fsid__ fsid;
+	enum fsid_type fsid_type;
+
+	if (vfs_extract_fsid(fh, &fsid_type, &fsid) != 0)
+		return NULL;
+	fs = lookup_fsid(&fsid, fsid_type);
+	if (fs == NULL || fs->fsal != exp->export.fsal)
+		return NULL;
+	return fs->private;
+}
+
+/**
+ * @brief Read and check the record at a log offset
+ *
+ * @return The data, which the caller frees, or NULL if there is no
+ *         record there.  A retire record has no data but returns
+ *         non-NULL.
+ */
+
+static void *read_record_at(struct vfs_intent_log *log, uint64_t at,
+			    struct vfs_log_record *rec)
+{
+	uint64_t checksum;
+	void *data;
+
+	if (ring_left(log, at) < sizeof(*rec) ||
+	    pread(log->fd, rec, sizeof(*rec), log_pos(log, at)) !=
+	    sizeof(*rec) ||
+	    rec->magic != VFS_LOG_MAGIC ||
+	    rec->generation != log->generation ||
+	    rec->position != at ||
+	    record_size(rec->length) > ring_left(log, at) ||
+	    rec->handle_len > VFS_HANDLE_LEN)
+		return NULL;
+
+	data = gsh_malloc(rec->length + 1);
+	if (data == NULL)
+		return NULL;
+	if (pread(log->fd, data, rec->length,
+		  log_pos(log, at) + sizeof(*rec)) != rec->length)
+		goto bad;
+
+	checksum = rec->checksum;
+	rec->checksum = 0;
+	if (CityHash64WithSeed((char *)rec, sizeof(*rec),
+			       CityHash64(data, rec->length)) != checksum)
+		goto bad;
+	rec->checksum = checksum;
+
+	return data;
+
+ bad:
+	gsh_free(data);
+	return NULL;
+}
+
+/**
+ * @brief Read the next record of the log
+ *
+ * @param[in]     log The log
+ * @param[in,out] at  Where the record should be, moved to the start
+ *                    of the ring if the writer skipped to it
+ * @param[out]    rec The record
+ *
+ * @return As read_record_at; NULL at the end of the log.
+ */
+
+static void *read_record(struct vfs_intent_log *log, uint64_t *at,
+			 struct vfs_log_record *rec)
+{
+	void *data = read_record_at(log, *at, rec);
+	uint64_t next;
+
+	if (data != NULL || ring_left(log, *at) == ring_size(log))
+		return data;
+
+	/* A record appended at the start of the ring names the offset
+	 * the writer skipped to, and nothing else there can. */
+	next = *at + ring_left(log, *at);
+	data = read_record_at(log, next, rec);
+	if (data != NULL)
+		*at = next;
+	return data;
+}
+
+/**
+ * @brief Put back what the log holds
+ *
+ * Writes whose file was retired later in the log are skipped.
+ *
+ * @return Number of writes replayed, or -1 if the log is unreadable.
+ */
+
+static int replay(struct vfs_fsal_export *exp, struct vfs_intent_log *log)
+{
+	struct vfs_log_record rec;
+	struct vfs_log_file *file;
+	struct vfs_filesystem *vfs_fs;
+	fsal_errors_t fsal_error;
+	vfs_file_handle_t fh;
+	uint64_t at;
+	void *data;
+	int replayed = 0;
+	int fd;
+
+	/* Note how far each file's records are void */
+	for (at = log->head; (data = read_record(log, &at, &rec)) != NULL;
+	     at += record_size(rec.length)) {
+		gsh_free(data);
+		fh.handle_len = rec.handle_len;
+		memcpy(fh.handle_data, rec.handle, rec.handle_len);
+		file = find_file(log, &fh);
+		if (file == NULL) {
+			file = gsh_calloc(1, sizeof(*file));
+			if (file == NULL)
+				return -1;
+			memcpy(&file->fh, &fh, sizeof(fh));
+			glist_add_tail(bucket(log, &fh), &file->list);
+		}
+		if (rec.type == VFS_LOG_RETIRE && rec.offset > file->last)
+			file->last = rec.offset;
+	}
+
+	for (at = log->head; (data = read_record(log, &at, &rec)) != NULL;
+	     at += record_size(rec.length), gsh_free(data)) {
+		if (rec.type != VFS_LOG_WRITE)
+			continue;
+		fh.handle_len = rec.handle_len;
+		memcpy(fh.handle_data, rec.handle, rec.handle_len);
+		file = find_file(log, &fh);
+		if (at < file->last)
+			continue;
+
+		vfs_fs = handle_fs(exp, &file->fh);
+		fsal_error = ERR_FSAL_NO_ERROR;
+		fd = vfs_fs == NULL ? -ESTALE
+		    : vfs_open_by_handle(vfs_fs, &file->fh, O_WRONLY,
+					 &fsal_error);
+		if (fd < 0) {
+			/* Removed since */
+			LogDebug(COMPONENT_FSAL,
+				 "Skipping logged write to a file that is gone: %s",
+				 strerror(-fd));
+			continue;
+		}
+		if (pwrite(fd, data, rec.length, rec.offset) != rec.length ||
+		    fsync(fd) != 0) {
+			LogCrit(COMPONENT_FSAL,
+				"Could not replay logged write: %s",
+				strerror(errno));
+			close(fd);
+			gsh_free(data);
+			return -1;
+		}
+		close(fd);
+		replayed++;
+	}
+
+	return replayed;
+}
+
+/**
+ * @brief Write out the whole log once
+ *
+ * So appends neither allocate blocks nor change the size, and a flush
+ * is of the data alone.
+ */
+
+static int prefill(struct vfs_intent_log *log)
+{
+	static const char zeros[65536];
+	struct stat st;
+	off_t off;
+	size_t len;
+
+	if (fstat(log->fd, &st) != 0)
+		return errno;
+
+	for (off = st.st_size; off < (off_t)log->size; off += len) {
+		len = MIN(sizeof(zeros), log->size - off);
+		if (pwrite(log->fd, zeros, len, off) != (ssize_t)len)
+			return errno;
+	}
+
+	return fsync(log->fd) == 0 ? 0 : errno;
+}
+
+/**
+ * @brief Open an export's intent log, replaying what it holds
+ *
+ * @param[in] exp Export with intent_log_path set
+ *
+ * @return 0 or an errno.
+ */
+
+int vfs_intent_log_init(struct vfs_fsal_export *exp)
+{
+	struct vfs_intent_log *log;
+	struct vfs_log_header hdr;
+	struct glist_head *glist, *glistn;
+	uint64_t checksum;
+	int replayed = 0;
+	int retval;
+	int i;
+
+	log = gsh_calloc(1, sizeof(*log));
+	if (log == NULL)
+		return ENOMEM;
+	for (i = 0; i < VFS_LOG_BUCKETS; i++)
+		glist_init(&log->buckets[i]);
+	/* Records start on 8 byte boundaries, so must the ring's end */
+	log->size = exp->intent_log_size & ~7ULL;
+
+	log->fd = open(exp->intent_log_path, O_RDWR | O_CREAT | O_CLOEXEC,
+		       0600);
+	if (log->fd < 0) {
+		retval = errno;
+		LogCrit(COMPONENT_FSAL, "Could not open intent log %s: %s",
+			exp->intent_log_path, strerror(retval));
+		gsh_free(log);
+		return retval;
+	}
+
+	retval = prefill(log);
+	if (retval != 0) {
+		LogCrit(COMPONENT_FSAL, "Could not allocate intent log %s: %s",
+			exp->intent_log_path, strerror(retval));
+		close(log->fd);
+		gsh_free(log);
+		return retval;
+	}
+
+	if (pread(log->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+	    hdr.magic == VFS_LOG_MAGIC && hdr.version == VFS_LOG_VERSION) {
+		checksum = hdr.checksum;
+		hdr.checksum = 0;
+		if (CityHash64((char *)&hdr, sizeof(hdr)) != checksum) {
+			LogCrit(COMPONENT_FSAL,
+				"Intent log %s has a bad header, not using it",
+				exp->intent_log_path);
+			close(log->fd);
+			gsh_free(log);
+			return EIO;
+		}
+		log->generation = hdr.generation;
+		log->head = hdr.head;
+		replayed = replay(exp, log);
+		if (replayed < 0) {
+			LogCrit(COMPONENT_FSAL,
+				"Could not replay intent log %s, keeping it for another try",
+				exp->intent_log_path);
+			close(log->fd);
+			gsh_free(log);
+			return EIO;
+		}
+	}
+
+	/* Everything replayed is on disk, start afresh */
+	for (i = 0; i < VFS_LOG_BUCKETS; i++) {
+		glist_for_each_safe(glist, glistn, &log->buckets[i]) {
+			glist_del(glist);
+			gsh_free(glist_entry(glist, struct vfs_log_file,
+					     list));
+		}
+	}
+	log->generation++;
+	log->head = VFS_LOG_HEADER_SIZE;
+	log->tail = VFS_LOG_HEADER_SIZE;
+	log->flushed = VFS_LOG_HEADER_SIZE;
+	retval = write_header(log);
+	if (retval != 0) {
+		LogCrit(COMPONENT_FSAL, "Could not write intent log %s: %s",
+			exp->intent_log_path, strerror(retval));
+		close(log->fd);
+		gsh_free(log);
+		return retval;
+	}
+
+	PTHREAD_MUTEX_init(&log->mutex, NULL);
+	pthread_cond_init(&log->cond, NULL);
+	pthread_cond_init(&log->kick, NULL);
+
+	retval = pthread_create(&log->thread, NULL, checkpoint_thread, log);
+	if (retval != 0) {
+		PTHREAD_MUTEX_destroy(&log->mutex);
+		pthread_cond_destroy(&log->cond);
+		pthread_cond_destroy(&log->kick);
+		close(log->fd);
+		gsh_free(log);
+		return retval;
+	}
+
+	if (replayed > 0)
+		LogEvent(COMPONENT_FSAL,
+			 "Replayed %d stable writes from intent log %s",
+			 replayed, exp->intent_log_path);
+	LogInfo(COMPONENT_FSAL, "Logging stable writes to %s",
+		exp->intent_log_path);
+
+	exp->intent_log = log;
+	return 0;
+}
+
+/**
+ * @brief Retire everything and close an export's intent log
+ *
+ * @param[in] exp Export
+ */
+
+void vfs_intent_log_fini(struct vfs_fsal_export *exp)
+{
+	struct vfs_intent_log *log = exp->intent_log;
+	struct glist_head *glist, *glistn;
+	int i;
+
+	if (log == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+	log->stop = true;
+	pthread_cond_signal(&log->kick);
+	pthread_cond_broadcast(&log->cond);
+	PTHREAD_MUTEX_unlock(&log->mutex);
+	pthread_join(log->thread, NULL);
+
+	checkpoint(log);
+
+	for (i = 0; i < VFS_LOG_BUCKETS; i++) {
+		glist_for_each_safe(glist, glistn, &log->buckets[i]) {
+			glist_del(glist);
+			gsh_free(glist_entry(glist, struct vfs_log_file,
+					     list));
+		}
+	}
+	PTHREAD_MUTEX_destroy(&log->mutex);
+	pthread_cond_destroy(&log->cond);
+	pthread_cond_destroy(&log->kick);
+	close(log->fd);
+	gsh_free(log);
+	exp->intent_log = NULL;
+}
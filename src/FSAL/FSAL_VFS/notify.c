@@ -0,0 +1,449 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file FSAL/FSAL_VFS/notify.c
+ * @brief Turn local changes to an exported file system into upcalls
+ *
+ * A watcher thread per file system reads fanotify events reporting
+ * file handles, for changes made by anyone but us, and tells the
+ * cache about them: changes to a directory's entries invalidate the
+ * directory, changes to an object's data or attributes update its
+ * cached attributes from a fresh stat.  Handles created on a watched
+ * file system have attributes that do not expire, so the cache only
+ * goes to the file system when something has actually changed.
+ * If events are lost, every cached object on the file system is
+ * invalidated, and if the watcher stops, they expire again.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef LINUX
+#include <sys/fanotify.h>
+#endif
+
+#include "fsal.h"
+#include "fsal_api.h"
+#include "fsal_convert.h"
+#include "fsal_up.h"
+#include "FSAL/fsal_commonlib.h"
+#include "fsal_handle_syscalls.h"
+#include "vfs_methods.h"
+
+#if defined(LINUX) && defined(FAN_REPORT_FID) && defined(FAN_MARK_FILESYSTEM)
+
+/* Changes to a directory's entries, reported on the directory */
+#define NOTIFY_DIRENT_EVENTS \
+	(FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)
+
+/* Changes to an object, reported on the object */
+#define NOTIFY_OBJECT_EVENTS \
+	(FAN_MODIFY | FAN_ATTRIB | FAN_DELETE_SELF | FAN_MOVE_SELF)
+
+/**
+ * @brief Refresh the cached attributes of a changed object
+ *
+ * @param[in] vfs_fs    File system the object is on
+ * @param[in] kernel_fh Handle reported by fanotify
+ * @param[in] key       Cache key for the object
+ *
+ * @return Result of the upcall.
+ */
+
+static cache_inode_status_t notify_update(struct vfs_filesystem *vfs_fs,
+					  struct file_handle *kernel_fh,
+					  struct gsh_buffdesc *key)
+{
+	const struct fsal_up_vector *up_ops = vfs_fs->up_ops;
+	struct attrlist attr;
+	struct stat st;
+	uint32_t upflags = fsal_up_update_null;
+	int fd;
+	int rc;
+
+	fd = open_by_handle_at(vfs_fs->root_fd, kernel_fh, O_PATH);
+	if (fd < 0) {
+		/* Gone already, the next use will find it stale */
+		return up_ops->invalidate(vfs_fs->fs->fsal, key,
+					  CACHE_INODE_INVALIDATE_ATTRS);
+	}
+
+	rc = fstat(fd, &st);
+	close(fd);
+
+	if (rc < 0)
+		return up_ops->invalidate(vfs_fs->fs->fsal, key,
+					  CACHE_INODE_INVALIDATE_ATTRS);
+
+	memset(&attr, 0, sizeof(attr));
+	posix2fsal_attributes(&st, &attr);
+
+	/* The cache refuses updates to what identifies the object */
+	FSAL_UNSET_MASK(attr.mask, ATTR_TYPE | ATTR_FSID | ATTR_FILEID |
+			ATTR_RAWDEV | ATTR_GENERATION);
+	attr.expire_time_attr = -1;
+
+	if (st.st_nlink == 0)
+		upflags = fsal_up_nlink;
+
+	return up_ops->update(vfs_fs->fs->fsal, key, &attr, upflags);
+}
+
+/**
+ * @brief Handle one fanotify event
+ *
+ * @param[in] vfs_fs    File system being watched
+ * @param[in] mask      Events, possibly merged
+ * @param[in] kernel_fh Handle of the object or directory
+ */
+
+static void notify_event(struct vfs_filesystem *vfs_fs, uint64_t mask,
+			 struct file_handle *kernel_fh)
+{
+	vfs_file_handle_t *fh;
+	struct gsh_buffdesc key;
+	cache_inode_status_t rc;
+
+	vfs_alloc_handle(fh);
+
+	if (vfs_kernel_to_handle(kernel_fh, vfs_fs->fs, fh) != 0) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Could not map event handle on %s: %s",
+			 vfs_fs->fs->path, strerror(errno));
+		return;
+	}
+
+	key.addr = fh->handle_data;
+	key.len = fh->handle_len;
+
+	if (mask & NOTIFY_DIRENT_EVENTS)
+		rc = vfs_fs->up_ops->invalidate(vfs_fs->fs->fsal, &key,
+						CACHE_INODE_INVALIDATE_ATTRS |
+						CACHE_INODE_INVALIDATE_CONTENT);
+	else
+		rc = notify_update(vfs_fs, kernel_fh, &key);
+
+	if (rc != CACHE_INODE_SUCCESS && rc != CACHE_INODE_NOT_FOUND)
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Event 0x%"PRIx64" on %s could not be processed: %s",
+			 mask, vfs_fs->fs->path, cache_inode_err_str(rc));
+}
+
+/**
+ * @brief Invalidate every cached object on a file system
+ *
+ * The keys are copied out under the FSAL's handle list lock and the
+ * upcalls made without it, since they may release handles.
+ *
+ * @param[in] vfs_fs File system
+ * @param[in] flags  Further cache_inode_invalidate flags
+ */
+
+static void notify_invalidate_all(struct vfs_filesystem *vfs_fs,
+				  uint32_t flags)
+{
+	struct fsal_module *fsal = vfs_fs->fs->fsal;
+	struct glist_head *glist;
+	struct fsal_obj_handle *obj;
+	struct vfs_fsal_obj_handle *hdl;
+	vfs_file_handle_t *fhs;
+	struct gsh_buffdesc key;
+	size_t count = 0, i;
+
+	PTHREAD_RWLOCK_rdlock(&fsal->lock);
+
+	glist_for_each(glist, &fsal->handles)
+		count++;
+
+	fhs = gsh_malloc((count ? count : 1) * sizeof(vfs_file_handle_t));
+	if (fhs == NULL) {
+		PTHREAD_RWLOCK_unlock(&fsal->lock);
+		LogCrit(COMPONENT_FSAL_UP,
+			"Out of memory invalidating %s, cached attributes may be stale",
+			vfs_fs->fs->path);
+		return;
+	}
+
+	count = 0;
+	glist_for_each(glist, &fsal->handles) {
+		obj = glist_entry(glist, struct fsal_obj_handle, handles);
+		if (obj->fs != vfs_fs->fs)
+			continue;
+		hdl = container_of(obj, struct vfs_fsal_obj_handle,
+				   obj_handle);
+		memcpy(&fhs[count++], hdl->handle, sizeof(vfs_file_handle_t));
+	}
+
+	PTHREAD_RWLOCK_unlock(&fsal->lock);
+
+	for (i = 0; i < count; i++) {
+		key.addr = fhs[i].handle_data;
+		key.len = fhs[i].handle_len;
+		(void) vfs_fs->up_ops->invalidate(fsal, &key,
+						  CACHE_INODE_INVALIDATE_ATTRS |
+						  CACHE_INODE_INVALIDATE_CONTENT |
+						  flags);
+	}
+
+	gsh_free(fhs);
+}
+
+/**
+ * @brief Handle the events read from a file system's fanotify group
+ *
+ * @param[in] vfs_fs File system being watched
+ * @param[in] buf    Events, as read from the group
+ * @param[in] len    Bytes read
+ *
+ * @return false if the events cannot be understood, and watching
+ *	   must stop.
+ */
+
+bool vfs_notify_events(struct vfs_filesystem *vfs_fs, const void *buf,
+		       ssize_t len)
+{
+	const struct fanotify_event_metadata *md;
+	const struct fanotify_event_info_fid *fid;
+	pid_t self = getpid();
+
+	for (md = buf; FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+		if (md->vers != FANOTIFY_METADATA_VERSION) {
+			LogCrit(COMPONENT_FSAL_UP,
+				"Unexpected fanotify version %d", md->vers);
+			return false;
+		}
+
+		if (md->mask & FAN_Q_OVERFLOW) {
+			LogWarn(COMPONENT_FSAL_UP,
+				"Lost change events on %s, invalidating its cached objects",
+				vfs_fs->fs->path);
+			notify_invalidate_all(vfs_fs, 0);
+			continue;
+		}
+
+		/* Our own changes are already in the cache */
+		if (md->pid == self)
+			continue;
+
+		fid = (const void *)(md + 1);
+		if (md->event_len < sizeof(*md) + sizeof(*fid) ||
+		    fid->hdr.info_type != FAN_EVENT_INFO_TYPE_FID)
+			continue;
+
+		notify_event(vfs_fs, md->mask,
+			     (struct file_handle *)fid->handle);
+	}
+
+	return true;
+}
+
+static void *notify_thread(void *arg)
+{
+	struct vfs_filesystem *vfs_fs = arg;
+	char buf[64 * 1024] __attribute__ ((aligned(8)));
+	struct pollfd pfd[2];
+	char thr_name[32];
+	bool stopping = false;
+	ssize_t len;
+	int fd;
+
+	snprintf(thr_name, sizeof(thr_name),
+		 "vfs_notify_%"PRIu64".%"PRIu64,
+		 vfs_fs->fs->dev.major, vfs_fs->fs->dev.minor);
+	SetNameFunction(thr_name);
+
+	pfd[0].fd = vfs_fs->notify_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = vfs_fs->notify_pipe[0];
+	pfd[1].events = POLLIN;
+
+	while (true) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			LogCrit(COMPONENT_FSAL_UP,
+				"Watching %s failed: %s",
+				vfs_fs->fs->path, strerror(errno));
+			break;
+		}
+
+		if (pfd[1].revents != 0) {
+			stopping = true;
+			break;
+		}
+
+		len = read(vfs_fs->notify_fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			LogCrit(COMPONENT_FSAL_UP,
+				"Reading events for %s failed: %s",
+				vfs_fs->fs->path, strerror(errno));
+			break;
+		}
+
+		if (!vfs_notify_events(vfs_fs, buf, len))
+			break;
+	}
+
+	if (!stopping) {
+		/* Nothing will tell us about changes any more, so new
+		 * handles get timed expiry and cached ones get it back.
+		 */
+		fd = vfs_fs->notify_fd;
+		vfs_fs->notify_fd = -1;
+		close(fd);
+		LogCrit(COMPONENT_FSAL_UP,
+			"No longer watching %s, relying on Attr_Expiration_Time",
+			vfs_fs->fs->path);
+		notify_invalidate_all(vfs_fs, CACHE_INODE_INVALIDATE_EXPIRE);
+	}
+
+	LogDebug(COMPONENT_FSAL_UP,
+		 "Stopped watching %s", vfs_fs->fs->path);
+	return NULL;
+}
+
+/**
+ * @brief Start turning local changes to a file system into upcalls
+ *
+ * @param[in] vfs_fs File system to watch
+ *
+ * @return 0 on success, an errno if the kernel cannot watch it.
+ */
+
+int vfs_notify_start(struct vfs_filesystem *vfs_fs)
+{
+	int fd;
+	int retval;
+
+	if (vfs_fs->notify_fd >= 0)
+		return 0;
+
+	/* Reap a watcher that failed before starting a new one */
+	vfs_notify_stop(vfs_fs);
+
+	/* Unlimited queue, since a lost event would leave the cache
+	 * stale indefinitely. */
+	fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+			   FAN_REPORT_FID | FAN_UNLIMITED_QUEUE,
+			   O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		retval = errno;
+		goto errout;
+	}
+
+	if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+			  NOTIFY_DIRENT_EVENTS | NOTIFY_OBJECT_EVENTS |
+			  FAN_ONDIR, AT_FDCWD, vfs_fs->fs->path) < 0) {
+		retval = errno;
+		close(fd);
+		goto errout;
+	}
+
+	if (pipe2(vfs_fs->notify_pipe, O_CLOEXEC) < 0) {
+		retval = errno;
+		close(fd);
+		goto errout;
+	}
+
+	vfs_fs->notify_fd = fd;
+
+	retval = pthread_create(&vfs_fs->notify_thread, NULL, notify_thread,
+				vfs_fs);
+	if (retval != 0) {
+		close(vfs_fs->notify_pipe[0]);
+		close(vfs_fs->notify_pipe[1]);
+		vfs_fs->notify_pipe[0] = -1;
+		vfs_fs->notify_pipe[1] = -1;
+		close(fd);
+		vfs_fs->notify_fd = -1;
+		goto errout;
+	}
+
+	LogInfo(COMPONENT_FSAL,
+		"Watching %s for local changes", vfs_fs->fs->path);
+	return 0;
+
+ errout:
+	LogWarn(COMPONENT_FSAL,
+		"Could not watch %s for local changes (%s), relying on Attr_Expiration_Time",
+		vfs_fs->fs->path, strerror(retval));
+	return retval;
+}
+
+/**
+ * @brief Stop watching a file system
+ *
+ * Also reaps a watcher that stopped on its own after an error.
+ *
+ * @param[in] vfs_fs File system being watched
+ */
+
+void vfs_notify_stop(struct vfs_filesystem *vfs_fs)
+{
+	if (vfs_fs->notify_pipe[1] < 0)
+		return;
+
+	if (write(vfs_fs->notify_pipe[1], "", 1) != 1)
+		LogCrit(COMPONENT_FSAL,
+			"Could not stop watching %s: %s",
+			vfs_fs->fs->path, strerror(errno));
+	else
+		pthread_join(vfs_fs->notify_thread, NULL);
+
+	close(vfs_fs->notify_pipe[0]);
+	close(vfs_fs->notify_pipe[1]);
+	vfs_fs->notify_pipe[0] = -1;
+	vfs_fs->notify_pipe[1] = -1;
+	if (vfs_fs->notify_fd >= 0) {
+		close(vfs_fs->notify_fd);
+		vfs_fs->notify_fd = -1;
+	}
+}
+
+#else				/* LINUX && FAN_REPORT_FID && FAN_MARK_FILESYSTEM */
+
+int vfs_notify_start(struct vfs_filesystem *vfs_fs)
+{
+	LogWarn(COMPONENT_FSAL,
+		"Watching %s for local changes is not supported, relying on Attr_Expiration_Time",
+		vfs_fs->fs->path);
+	return ENOTSUP;
+}
+
+void vfs_notify_stop(struct vfs_filesystem *vfs_fs)
+{
+}
+
+bool vfs_notify_events(struct vfs_filesystem *vfs_fs, const void *buf,
+		       ssize_t len)
+{
+	return false;
+}
+
+#endif				/* LINUX && FAN_REPORT_FID && FAN_MARK_FILESYSTEM */
@@ -116,3 +116,7 @@ int vfs_sub_init_export(struct vfs_fsal_export *vfs)
 
 	return retval;
 }
+
+void vfs_sub_fini_filesystem(struct vfs_filesystem *vfs_fs)
+{
+}
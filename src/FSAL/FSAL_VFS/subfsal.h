@@ -49,4 +49,6 @@ void vfs_sub_init_export_ops(struct vfs_fsal_export *myself,
 
 int vfs_sub_init_export(struct vfs_fsal_export *myself);
 
+void vfs_sub_fini_filesystem(struct vfs_filesystem *vfs_fs);
+
 #endif /* SUBFSAL_H */
@@ -36,6 +36,7 @@
 #include <string.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include "gsh_list.h"
 #include "fsal.h"
 #include "FSAL/fsal_init.h"
@@ -101,6 +102,10 @@ static struct config_item vfs_params[] = {
 		       fsal_staticfsinfo_t, auth_exportpath_xdev),
 	CONF_ITEM_MODE("xattr_access_rights", 0400,
 		       fsal_staticfsinfo_t, xattr_access_rights),
+	CONF_ITEM_BOOL("ofd_locks", false,
+		       fsal_staticfsinfo_t, lock_support_owner),
+	CONF_ITEM_UI32("ofd_retry_ms", 10, 10000, 200,
+		       fsal_staticfsinfo_t, lock_retry_ms),
 	CONFIG_EOL
 };
 
@@ -146,6 +151,19 @@ static fsal_status_t init_config(struct fsal_module *fsal_hdl,
 				      err_type);
 	if (!config_error_is_harmless(err_type))
 		return fsalstat(ERR_FSAL_INVAL, 0);
+	/* OFD locks give each lock owner its own open file description,
+	 * so the kernel can track owners and block on our behalf.
+	 */
+#ifdef F_OFD_SETLK
+	vfs_me->fs_info.lock_support_async_block =
+	    vfs_me->fs_info.lock_support_owner;
+#else
+	if (vfs_me->fs_info.lock_support_owner) {
+		LogWarn(COMPONENT_FSAL,
+			"OFD locks are not available on this platform, ignoring ofd_locks");
+		vfs_me->fs_info.lock_support_owner = false;
+	}
+#endif
 	display_fsinfo(&vfs_me->fs_info);
 	LogFullDebug(COMPONENT_FSAL,
 		     "Supported attributes constant = 0x%" PRIx64,
@@ -52,6 +52,14 @@ static struct config_item export_params[] = {
 	CONF_ITEM_ENUM("fsid_type", -1,
 		       fsid_types,
 		       vfs_fsal_export, fsid_type),
+	CONF_ITEM_BOOL("change_notify", false,
+		       vfs_fsal_export, change_notify),
+	CONF_ITEM_BOOL("direct_io", false,
+		       vfs_fsal_export, direct_io),
+	CONF_ITEM_PATH("intent_log", 1, MAXPATHLEN, NULL,
+		       vfs_fsal_export, intent_log_path),
+	CONF_ITEM_UI64("intent_log_size", 1024 * 1024, UINT64_MAX,
+		       256 * 1024 * 1024, vfs_fsal_export, intent_log_size),
 	CONFIG_EOL
 };
 
@@ -84,5 +92,26 @@ void vfs_sub_init_export_ops(struct vfs_fsal_export *myself,
 
 int vfs_sub_init_export(struct vfs_fsal_export *myself)
 {
+	struct glist_head *glist;
+	struct vfs_filesystem_export_map *map;
+
+	if (!myself->change_notify)
+		return 0;
+
+	/* A watcher failing to start is not fatal, the export just
+	 * keeps relying on attribute expiration. */
+	glist_for_each(glist, &myself->filesystems) {
+		map = glist_entry(glist,
+				  struct vfs_filesystem_export_map,
+				  on_filesystems);
+		map->fs->up_ops = myself->export.up_ops;
+		(void) vfs_notify_start(map->fs);
+	}
+
 	return 0;
 }
+
+void vfs_sub_fini_filesystem(struct vfs_filesystem *vfs_fs)
+{
+	vfs_notify_stop(vfs_fs);
+}
@@ -28,11 +28,13 @@
 #ifndef VFS_METHODS_H
 #define VFS_METHODS_H
 
+#include <pthread.h>
 #include "fsal_handle_syscalls.h"
 
 struct vfs_fsal_obj_handle;
 struct vfs_fsal_export;
 struct vfs_filesystem;
+struct vfs_intent_log;
 
 /*
  * VFS internal export
@@ -42,6 +44,11 @@ struct vfs_fsal_export {
 	struct fsal_filesystem *root_fs;
 	struct glist_head filesystems;
 	int fsid_type;
+	bool change_notify;
+	bool direct_io;
+	char *intent_log_path;
+	uint64_t intent_log_size;
+	struct vfs_intent_log *intent_log;	/*< NULL if not logging */
 };
 
 #define EXPORT_VFS_FROM_FSAL(fsal) \
@@ -54,6 +61,13 @@ struct vfs_filesystem {
 	struct fsal_filesystem *fs;
 	int root_fd;
 	struct glist_head exports;
+	int notify_fd;		/*< fanotify group, -1 if not watched */
+	int notify_pipe[2];	/*< Wakes the watcher to stop it, -1 if
+				    there is no watcher to reap */
+	pthread_t notify_thread;
+	const struct fsal_up_vector *up_ops;	/*< Upcalls for changes */
+	uint32_t dio_offset_align;	/*< O_DIRECT file offset and length */
+	uint32_t dio_mem_align;	/*< and buffer alignment, 0 until known */
 };
 
 /*
@@ -74,6 +88,8 @@ void vfs_unexport_filesystems(struct vfs_fsal_export *exp);
 
 void vfs_handle_ops_init(struct fsal_obj_ops *ops);
 
+struct fsal_staticfsinfo_t *vfs_staticinfo(struct fsal_module *hdl);
+
 int vfs_get_root_fd(struct fsal_export *exp_hdl);
 
 /* method proto linkage to handle.c for export
@@ -110,6 +126,17 @@ struct vfs_fsal_obj_handle {
 		struct {
 			int fd;
 			fsal_openflags_t openflags;
+			/* fd is O_DIRECT; unaligned heads and tails of I/O
+			   go through buffered_fd, opened along with it */
+			bool direct;
+			int buffered_fd;
+			/* Per lock owner open file descriptions (OFD
+			   locks), see vfs_lock_op */
+			pthread_mutex_t ofd_mutex;
+			struct glist_head ofd_owners;
+			struct glist_head ofd_waiters;
+			/* On the list of files with blocked locks */
+			struct glist_head ofd_blocked;
 		} file;
 		struct {
 			unsigned char *link_content;
@@ -135,6 +162,12 @@ int vfs_open_by_handle(struct vfs_filesystem *fs,
 		       vfs_file_handle_t *fh, int openflags,
 		       fsal_errors_t *fsal_error);
 
+#ifdef LINUX
+int vfs_kernel_to_handle(struct file_handle *kernel_fh,
+			 struct fsal_filesystem *fs,
+			 vfs_file_handle_t *fh);
+#endif
+
 int vfs_encode_dummy_handle(vfs_file_handle_t *fh,
 			    struct fsal_filesystem *fs);
 
@@ -161,6 +194,19 @@ int vfs_get_root_handle(struct vfs_filesystem *vfs_fs,
 int vfs_re_index(struct vfs_filesystem *vfs_fs,
 		 struct vfs_fsal_export *exp);
 
+int vfs_notify_start(struct vfs_filesystem *vfs_fs);
+void vfs_notify_stop(struct vfs_filesystem *vfs_fs);
+bool vfs_notify_events(struct vfs_filesystem *vfs_fs, const void *buf,
+		       ssize_t len);
+
+int vfs_intent_log_init(struct vfs_fsal_export *exp);
+void vfs_intent_log_fini(struct vfs_fsal_export *exp);
+int vfs_intent_log_write(struct vfs_intent_log *log,
+			 struct vfs_fsal_obj_handle *myself,
+			 const void *buffer, size_t length, uint64_t offset);
+int vfs_intent_log_retire(struct vfs_intent_log *log,
+			  struct vfs_fsal_obj_handle *myself, int fd);
+
 /*
  * VFS structure to tell subfunctions wether they should close the
  * returned fd or not
@@ -188,6 +234,7 @@ static inline bool vfs_unopenable_type(object_file_type_t type)
 	/* I/O management */
 fsal_status_t vfs_open(struct fsal_obj_handle *obj_hdl,
 		       fsal_openflags_t openflags);
+void vfs_direct_created(struct vfs_fsal_obj_handle *myself);
 fsal_openflags_t vfs_status(struct fsal_obj_handle *obj_hdl);
 fsal_status_t vfs_read(struct fsal_obj_handle *obj_hdl,
 		       uint64_t offset,
@@ -37,6 +37,12 @@
 
 static struct config_item export_params[] = {
 	CONF_ITEM_NOOP("name"),
+	CONF_ITEM_BOOL("direct_io", false,
+		       vfs_fsal_export, direct_io),
+	CONF_ITEM_PATH("intent_log", 1, MAXPATHLEN, NULL,
+		       vfs_fsal_export, intent_log_path),
+	CONF_ITEM_UI64("intent_log_size", 1024 * 1024, UINT64_MAX,
+		       256 * 1024 * 1024, vfs_fsal_export, intent_log_size),
 	CONFIG_EOL
 };
 
@@ -71,3 +77,7 @@ int vfs_sub_init_export(struct vfs_fsal_export *myself)
 {
 	return 0;
 }
+
+void vfs_sub_fini_filesystem(struct vfs_filesystem *vfs_fs)
+{
+}
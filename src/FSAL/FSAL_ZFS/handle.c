@@ -295,7 +295,8 @@ fsal_status_t tank_lookup_path(struct fsal_export *exp_hdl,
 
 static fsal_status_t tank_create(struct fsal_obj_handle *dir_hdl,
 				 const char *name, struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	struct zfs_fsal_obj_handle *myself, *hdl;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
@@ -350,7 +351,8 @@ static fsal_status_t tank_create(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t tank_mkdir(struct fsal_obj_handle *dir_hdl,
 				const char *name, struct attrlist *attrib,
-				struct fsal_obj_handle **handle)
+				struct fsal_obj_handle **handle,
+				struct fsal_postop_attrs *postop)
 {
 	struct zfs_fsal_obj_handle *myself, *hdl;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
@@ -408,7 +410,8 @@ static fsal_status_t tank_makenode(struct fsal_obj_handle *dir_hdl,
 				   object_file_type_t nodetype,	/* IN */
 				   fsal_dev_t *dev,	/* IN */
 				   struct attrlist *attrib,
-				   struct fsal_obj_handle **handle)
+				   struct fsal_obj_handle **handle,
+				   struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -422,7 +425,8 @@ static fsal_status_t tank_makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t tank_makesymlink(struct fsal_obj_handle *dir_hdl,
 				      const char *name, const char *link_path,
 				      struct attrlist *attrib,
-				      struct fsal_obj_handle **handle)
+				      struct fsal_obj_handle **handle,
+				      struct fsal_postop_attrs *postop)
 {
 	struct zfs_fsal_obj_handle *myself, *hdl;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
@@ -526,7 +530,8 @@ static fsal_status_t tank_readsymlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t tank_linkfile(struct fsal_obj_handle *obj_hdl,
 				   struct fsal_obj_handle *destdir_hdl,
-				   const char *name)
+				   const char *name,
+				   struct fsal_postop_attrs *postop)
 {
 	struct zfs_fsal_obj_handle *myself, *destdir;
 	int retval = 0;
@@ -621,6 +626,7 @@ static fsal_status_t tank_readdir(struct fsal_obj_handle *dir_hdl,
 
 			/* callback to cache inode */
 			if (!cb(dirents[index].psz_filename,
+				NULL,
 				dir_state,
 				(fsal_cookie_t) index))
 				goto done;
@@ -647,7 +653,8 @@ static fsal_status_t tank_rename(struct fsal_obj_handle *obj_hdl,
 				 struct fsal_obj_handle *olddir_hdl,
 				 const char *old_name,
 				 struct fsal_obj_handle *newdir_hdl,
-				 const char *new_name)
+				 const char *new_name,
+				 struct fsal_postop_attrs *postop)
 {
 	struct zfs_fsal_obj_handle *olddir, *newdir;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
@@ -855,7 +862,8 @@ static fsal_status_t tank_setattrs(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t tank_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	struct zfs_fsal_obj_handle *myself;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
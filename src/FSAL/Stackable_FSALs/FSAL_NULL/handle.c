@@ -60,26 +60,42 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 
 static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 			    const char *name, struct attrlist *attrib,
-			    struct fsal_obj_handle **handle)
+			    struct fsal_obj_handle **handle,
+			    struct fsal_postop_attrs *postop)
 {
-	return next_ops.obj_ops.create(dir_hdl, name, attrib, handle);
+	return next_ops.obj_ops.create(dir_hdl, name, attrib, handle,
+				       postop);
+}
+
+static fsal_status_t create_open(struct fsal_obj_handle *dir_hdl,
+				 const char *name,
+				 fsal_openflags_t openflags,
+				 struct attrlist *attrib,
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
+{
+	return next_ops.obj_ops.create_open(dir_hdl, name, openflags,
+					     attrib, handle, postop);
 }
 
 static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 			     const char *name, struct attrlist *attrib,
-			     struct fsal_obj_handle **handle)
+			     struct fsal_obj_handle **handle,
+			     struct fsal_postop_attrs *postop)
 {
-	return next_ops.obj_ops.mkdir(dir_hdl, name, attrib, handle);
+	return next_ops.obj_ops.mkdir(dir_hdl, name, attrib, handle,
+				      postop);
 }
 
 static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 			      const char *name, object_file_type_t nodetype,
 			      fsal_dev_t *dev,	/* IN */
 			      struct attrlist *attrib,
-			      struct fsal_obj_handle **handle)
+			      struct fsal_obj_handle **handle,
+			      struct fsal_postop_attrs *postop)
 {
 	return next_ops.obj_ops.mknode(dir_hdl, name, nodetype, dev,
-					attrib, handle);
+					attrib, handle, postop);
 }
 
 /** makesymlink
@@ -91,10 +107,11 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name, const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	return next_ops.obj_ops.symlink(dir_hdl, name, link_path,
-					 attrib, handle);
+					 attrib, handle, postop);
 }
 
 static fsal_status_t readsymlink(struct fsal_obj_handle *obj_hdl,
@@ -107,9 +124,10 @@ static fsal_status_t readsymlink(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
-	return next_ops.obj_ops.link(obj_hdl, destdir_hdl, name);
+	return next_ops.obj_ops.link(obj_hdl, destdir_hdl, name, postop);
 }
 
 /**
@@ -135,10 +153,11 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	return next_ops.obj_ops.rename(obj_hdl, olddir_hdl, old_name,
-				       newdir_hdl, new_name);
+				       newdir_hdl, new_name, postop);
 }
 
 static fsal_status_t getattrs(struct fsal_obj_handle *obj_hdl)
@@ -162,9 +181,10 @@ static fsal_status_t setattrs(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
-	return next_ops.obj_ops.unlink(dir_hdl, name);
+	return next_ops.obj_ops.unlink(dir_hdl, name, postop);
 }
 
 /* handle_digest
@@ -210,6 +230,7 @@ void nullfs_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->lookup = lookup;
 	ops->readdir = read_dirents;
 	ops->create = create;
+	ops->create_open = create_open;
 	ops->mkdir = makedir;
 	ops->mknode = makenode;
 	ops->symlink = makesymlink;
@@ -588,7 +588,22 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 			    const char *name, struct attrlist *attrib,
-			    struct fsal_obj_handle **handle)
+			    struct fsal_obj_handle **handle,
+			    struct fsal_postop_attrs *postop)
+{
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+}
+
+/* create_open
+ * default case not supported
+ */
+
+static fsal_status_t create_open(struct fsal_obj_handle *dir_hdl,
+				 const char *name,
+				 fsal_openflags_t openflags,
+				 struct attrlist *attrib,
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -599,7 +614,8 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 
 static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 			     const char *name, struct attrlist *attrib,
-			     struct fsal_obj_handle **handle)
+			     struct fsal_obj_handle **handle,
+			     struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -611,7 +627,8 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 			      const char *name, object_file_type_t nodetype,
 			      fsal_dev_t *dev, struct attrlist *attrib,
-			      struct fsal_obj_handle **handle)
+			      struct fsal_obj_handle **handle,
+			      struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -623,7 +640,8 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 				 const char *name, const char *link_path,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **handle)
+				 struct fsal_obj_handle **handle,
+				 struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -664,7 +682,8 @@ static fsal_status_t setattrs(struct fsal_obj_handle *obj_hdl,
 
 static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 			      struct fsal_obj_handle *destdir_hdl,
-			      const char *name)
+			      const char *name,
+			      struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -677,7 +696,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 				struct fsal_obj_handle *olddir_hdl,
 				const char *old_name,
 				struct fsal_obj_handle *newdir_hdl,
-				const char *new_name)
+				const char *new_name,
+				struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -687,7 +707,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
  */
 
 static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
-				 const char *name)
+				 const char *name,
+				 struct fsal_postop_attrs *postop)
 {
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
@@ -1056,6 +1077,7 @@ struct fsal_obj_ops def_handle_ops = {
 	.lookup = lookup,
 	.readdir = read_dirents,
 	.create = create,
+	.create_open = create_open,
 	.mkdir = makedir,
 	.mknode = makenode,
 	.symlink = makesymlink,
@@ -1746,7 +1746,16 @@ static int schedule_delegrevoke_check(struct delegrecall_context *ctx,
 	return rc;
 }
 
-state_status_t delegrecall_impl(cache_entry_t *entry)
+/**
+ * @brief Recall the delegations on a file
+ *
+ * @param[in] entry    The file
+ * @param[in] clientid Only recall this client's, or NULL for all
+ *
+ * @return STATE_SUCCESS.
+ */
+static state_status_t delegrecall_clients(cache_entry_t *entry,
+					  nfs_client_id_t *clientid)
 {
 	struct glist_head *glist, *glist_n;
 	state_status_t rc = 0;
@@ -1767,6 +1776,11 @@ state_status_t delegrecall_impl(cache_entry_t *entry)
 		if (state->state_type != STATE_TYPE_DELEG)
 			continue;
 
+		if (clientid != NULL && (state->state_owner == NULL ||
+		    state->state_owner->so_owner.so_nfs4_owner.so_clientrec
+		    != clientid))
+			continue;
+
 		if (isDebug(COMPONENT_NFS_CB)) {
 			char str[LOG_BUFF_LEN];
 			struct display_buffer dspbuf = {sizeof(str), str, str};
@@ -1819,6 +1833,19 @@ state_status_t delegrecall_impl(cache_entry_t *entry)
 		 * skip it here.
 		 */
 		PTHREAD_MUTEX_lock(&drc_ctx->drc_clid->cid_mutex);
+		if (drc_ctx->drc_clid->cid_courtesy) {
+			/* No one to recall from, revoke by expiring the
+			 * client.  Checked before reserve_lease, which
+			 * would renew it.
+			 */
+			PTHREAD_MUTEX_unlock(&drc_ctx->drc_clid->cid_mutex);
+			*deleg_state = DELEG_GRANTED;
+			expire_courtesy_client_async(drc_ctx->drc_clid);
+			put_gsh_export(drc_ctx->drc_exp);
+			dec_client_id_ref(drc_ctx->drc_clid);
+			gsh_free(drc_ctx);
+			continue;
+		}
 		if (!reserve_lease(drc_ctx->drc_clid)) {
 			PTHREAD_MUTEX_unlock(&drc_ctx->drc_clid->cid_mutex);
 			put_gsh_export(drc_ctx->drc_exp);
@@ -1834,6 +1861,25 @@ state_status_t delegrecall_impl(cache_entry_t *entry)
 	return rc;
 }
 
+state_status_t delegrecall_impl(cache_entry_t *entry)
+{
+	return delegrecall_clients(entry, NULL);
+}
+
+/**
+ * @brief Recall one client's delegation on a file
+ *
+ * @param[in] entry    The file
+ * @param[in] clientid The client
+ *
+ * @return STATE_SUCCESS.
+ */
+state_status_t delegrecall_client(cache_entry_t *entry,
+				  nfs_client_id_t *clientid)
+{
+	return delegrecall_clients(entry, clientid);
+}
+
 /**
  * @brief Recall a delegation
  *
@@ -41,6 +41,10 @@
 #include "idmapper.h"
 #include "delayed_exec.h"
 #include "export_mgr.h"
+#include "mem_governor.h"
+#include "nfs_capture.h"
+#include "stats_recorder.h"
+#include "nfs_upgrade.h"
 #include "fsal.h"
 #ifdef USE_DBUS
 #include "gsh_dbus.h"
@@ -312,6 +316,7 @@ static void do_shutdown(void)
 {
 	int rc = 0;
 	bool disorderly = false;
+	bool handed_off;
 
 	LogEvent(COMPONENT_MAIN, "NFS EXIT: stopping NFS service");
 
@@ -364,6 +369,11 @@ static void do_shutdown(void)
 			 "Worker threads successfully shut down.");
 	}
 
+	/* With no requests in flight, hand the sockets and state to the
+	 * server taking over from us, if there is one.
+	 */
+	handed_off = nfs_upgrade_handoff(!disorderly);
+
 	/* finalize RPC package */
 	Clean_RPC(); /* we MUST do this first */
 	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
@@ -386,6 +396,29 @@ static void do_shutdown(void)
 		LogEvent(COMPONENT_THREAD, "Reaper thread shut down.");
 	}
 
+	rc = mem_governor_shutdown();
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Error shutting down memory governor: %d", rc);
+		disorderly = true;
+	} else {
+		LogEvent(COMPONENT_THREAD, "Memory governor shut down.");
+	}
+
+	rc = nfs_capture_shutdown();
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Error closing request capture log: %d", rc);
+		disorderly = true;
+	}
+
+	rc = stats_recorder_shutdown();
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Error shutting down statistics recorder: %d", rc);
+		disorderly = true;
+	}
+
 	LogEvent(COMPONENT_MAIN, "Stopping LRU thread.");
 	rc = cache_inode_lru_pkgshutdown();
 	if (rc != 0) {
@@ -397,6 +430,16 @@ static void do_shutdown(void)
 		LogEvent(COMPONENT_THREAD, "LRU thread system shut down.");
 	}
 
+	if (handed_off) {
+		/* The new server carries on with our state; it takes over
+		 * the files and locks once we have exited.
+		 */
+		LogEvent(COMPONENT_MAIN,
+			 "Handed over, leaving state to the new server.");
+		emergency_cleanup_fsals();
+		return;
+	}
+
 	LogEvent(COMPONENT_MAIN, "Removing all exports.");
 	remove_all_exports();
 
@@ -0,0 +1,833 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup nfs_capture
+ * @{
+ */
+
+/**
+ * @file nfs_capture.c
+ * @brief Append executed requests to a capture log
+ *
+ * Each worker encodes its records into a buffer of its own and copies
+ * them into its own ring, so a request pays for one XDR encode and
+ * one memcpy and takes no lock.  A writer thread drains the rings
+ * into the log.  A record that finds its ring full is dropped and
+ * counted rather than holding up the reply.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <endian.h>
+#include <sys/param.h>
+#include <netinet/in.h>
+#include "log.h"
+#include "fsal.h"
+#include "gsh_rpc.h"
+#include "nfs_core.h"
+#include "nfs_proto_data.h"
+#include "nfs_capture.h"
+#include "fridgethr.h"
+#ifdef _USE_9P
+#include "9p.h"
+#endif
+
+/**
+ * @brief Capture parameters
+ */
+
+struct nfs_capture_parameter nfs_capture_param;
+
+static struct config_item nfs_capture_params[] = {
+	CONF_ITEM_BOOL("Enable", false,
+		       nfs_capture_parameter, enable),
+	CONF_ITEM_PATH("Path", 1, MAXPATHLEN, "/var/log/ganesha.capture",
+		       nfs_capture_parameter, path),
+	CONF_ITEM_UI64("Max_Size", 0, UINT64_MAX, 1024 * 1024 * 1024,
+		       nfs_capture_parameter, max_size),
+	CONF_ITEM_BOOL("Record_Results", true,
+		       nfs_capture_parameter, record_results),
+	CONF_ITEM_UI32("Thread_Buffer", 64 * 1024, NFS_CAPTURE_MAX_RECORD,
+		       4 * 1024 * 1024,
+		       nfs_capture_parameter, thread_buffer),
+	CONFIG_EOL
+};
+
+static void *nfs_capture_param_init(void *link_mem, void *self_struct)
+{
+	if (self_struct == NULL)
+		return &nfs_capture_param;
+	else
+		return NULL;
+}
+
+struct config_block nfs_capture_param_blk = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.capture",
+	.blk_desc.name = "NFS_Capture",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = nfs_capture_param_init,
+	.blk_desc.u.blk.params = nfs_capture_params,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
+/**
+ * @brief Nonzero while capturing
+ */
+
+uint32_t nfs_capture_on;
+
+/**
+ * @brief A worker's capture buffers
+ *
+ * The worker builds each record in buf, then copies it into ring and
+ * advances head.  The writer thread copies from tail up to head into
+ * the log and advances tail.  Records are padded to 4 bytes and the
+ * ring size is a power of two, so a record's length word never wraps.
+ */
+
+struct capture_thread {
+	struct glist_head list;	/*< On capture_threads */
+	char *buf;		/*< Record being built, worker only */
+	uint32_t buf_size;
+	char *ring;		/*< capture_ring_size bytes */
+	uint64_t head;		/*< Bytes put in the ring, by the worker */
+	uint64_t tail;		/*< Bytes taken out, by the writer */
+	uint64_t dropped;	/*< Records that found the ring full */
+	bool exited;		/*< Worker is gone, free once drained */
+};
+
+static __thread struct capture_thread *capture_self;
+
+/**
+ * @brief Frees a worker's buffers when it exits
+ */
+
+static pthread_key_t capture_key;
+
+/**
+ * @brief The log, its size, its start time and the rings, under
+ *        capture_mtx
+ *
+ * Workers only take the mutex to register their ring and when they
+ * exit.
+ */
+
+static pthread_mutex_t capture_mtx = PTHREAD_MUTEX_INITIALIZER;
+static FILE *capture_file;
+static uint64_t capture_size;
+static struct timespec capture_start;
+static struct glist_head capture_threads = GLIST_HEAD_INIT(capture_threads);
+static bool capture_draining;	/*< The writer will free exited rings */
+static uint64_t capture_dropped;	/*< Drops of freed rings */
+static uint64_t capture_dropped_logged;
+
+static uint32_t capture_ring_size;
+static uint32_t capture_wake_pending;
+static struct fridgethr *capture_fridge;
+
+#define CAPTURE_STDIO_BUFFER (1024 * 1024)
+
+/**
+ * @brief Release a worker's buffers as it exits
+ *
+ * The ring is left for the writer to drain and free, unless the
+ * writer has already stopped.
+ */
+
+static void capture_thread_exit(void *arg)
+{
+	struct capture_thread *ct = arg;
+
+	gsh_free(ct->buf);
+	ct->buf = NULL;
+	ct->buf_size = 0;
+
+	PTHREAD_MUTEX_lock(&capture_mtx);
+	if (capture_draining) {
+		ct->exited = true;
+		ct = NULL;
+	} else {
+		glist_del(&ct->list);
+		capture_dropped += ct->dropped;
+	}
+	PTHREAD_MUTEX_unlock(&capture_mtx);
+
+	if (ct != NULL) {
+		gsh_free(ct->ring);
+		gsh_free(ct);
+	}
+}
+
+/**
+ * @brief Get this worker's capture buffers, setting them up at first
+ *
+ * @return The buffers, or NULL if out of memory.
+ */
+
+static struct capture_thread *capture_thread_get(void)
+{
+	struct capture_thread *ct = capture_self;
+
+	if (likely(ct != NULL))
+		return ct;
+
+	ct = gsh_calloc(1, sizeof(*ct));
+	if (ct == NULL)
+		return NULL;
+
+	ct->ring = gsh_malloc(capture_ring_size);
+	if (ct->ring == NULL) {
+		gsh_free(ct);
+		return NULL;
+	}
+
+	PTHREAD_MUTEX_lock(&capture_mtx);
+	glist_add_tail(&capture_threads, &ct->list);
+	PTHREAD_MUTEX_unlock(&capture_mtx);
+
+	(void)pthread_setspecific(capture_key, ct);
+	capture_self = ct;
+
+	return ct;
+}
+
+static bool capture_buf_grow(struct capture_thread *ct, uint32_t want)
+{
+	uint32_t size = ct->buf_size ? ct->buf_size : 64 * 1024;
+	char *buf;
+
+	while (size < want)
+		size *= 2;
+
+	if (size > NFS_CAPTURE_MAX_RECORD)
+		return false;
+
+	if (size != ct->buf_size) {
+		buf = gsh_realloc(ct->buf, size);
+		if (buf == NULL)
+			return false;
+		ct->buf = buf;
+		ct->buf_size = size;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Run an XDR encode into the record buffer
+ */
+
+static bool capture_encode_pass(struct capture_thread *ct, xdrproc_t proc,
+				void *obj, uint32_t off, uint32_t size,
+				uint32_t *len)
+{
+	XDR xdrs;
+	bool ok;
+
+	xdrmem_create(&xdrs, ct->buf + off, size, XDR_ENCODE);
+	ok = (*proc)(&xdrs, obj);
+	*len = xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+
+	return ok;
+}
+
+/**
+ * @brief Encode an XDR object into the record buffer
+ *
+ * The file handle routines byte swap the export id in place when
+ * encoding, and the object is encoded again when the reply is sent,
+ * so every pass over it must be matched by another.  A pass that
+ * runs out of room is repeated at the same size, which stops at the
+ * same place, before growing the buffer, and a successful one is
+ * followed by a pass into scratch space after the encoded bytes.
+ *
+ * @param[in]  ct   Buffers of this worker
+ * @param[in]  proc XDR routine
+ * @param[in]  obj  Object to encode
+ * @param[in]  off  Where in the buffer to put it
+ * @param[out] len  Encoded length
+ *
+ * @return false if it would not fit in NFS_CAPTURE_MAX_RECORD.
+ */
+
+static bool capture_encode(struct capture_thread *ct, xdrproc_t proc,
+			   void *obj, uint32_t off, uint32_t *len)
+{
+	uint32_t size, scratch;
+
+	if (!capture_buf_grow(ct, off + 4096))
+		return false;
+
+	for (;;) {
+		size = ct->buf_size - off;
+		if (capture_encode_pass(ct, proc, obj, off, size, len))
+			break;
+
+		(void)capture_encode_pass(ct, proc, obj, off, size, &scratch);
+		if (!capture_buf_grow(ct, ct->buf_size * 2))
+			return false;
+	}
+
+	if (!capture_buf_grow(ct, off + 2 * nfs_capture_pad(*len))) {
+		/* No room to undo the pass in scratch space, so undo it
+		 * over the encoded bytes and drop the record. */
+		(void)capture_encode_pass(ct, proc, obj, off, size, &scratch);
+		return false;
+	}
+
+	(void)capture_encode_pass(ct, proc, obj, off + nfs_capture_pad(*len),
+				  nfs_capture_pad(*len), &scratch);
+	return true;
+}
+
+static void capture_addr(struct nfs_capture_record *rec,
+			 const struct sockaddr_storage *ss)
+{
+	memset(rec->addr, 0, sizeof(rec->addr));
+
+	if (ss->ss_family == AF_INET) {
+		const struct sockaddr_in *sin = (const void *)ss;
+
+		rec->addr[10] = 0xff;
+		rec->addr[11] = 0xff;
+		memcpy(rec->addr + 12, &sin->sin_addr, 4);
+		rec->port = ntohs(sin->sin_port);
+	} else if (ss->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const void *)ss;
+
+		memcpy(rec->addr, &sin6->sin6_addr, 16);
+		rec->port = ntohs(sin6->sin6_port);
+	} else {
+		rec->port = 0;
+	}
+}
+
+/**
+ * @brief Fill in the times for a record
+ *
+ * @param[out] rec    Record
+ * @param[in]  queued When the request was queued
+ */
+
+static void capture_times(struct nfs_capture_record *rec,
+			  const struct timespec *queued)
+{
+	struct timespec ts;
+
+	now(&ts);
+	rec->service_ns = (op_ctx != NULL && op_ctx->start_time != 0)
+	    ? timespec_diff(&ServerBootTime, &ts) - op_ctx->start_time
+	    : 0;
+
+	if (queued->tv_sec < capture_start.tv_sec
+	    || (queued->tv_sec == capture_start.tv_sec
+		&& queued->tv_nsec < capture_start.tv_nsec))
+		rec->arrival_ns = 0;
+	else
+		rec->arrival_ns = timespec_diff(&capture_start, queued);
+}
+
+/**
+ * @brief Queue the record in the buffer for the writer
+ *
+ * Only the worker owning the ring moves head, and only the writer
+ * moves tail, so neither needs a lock.
+ *
+ * @param[in] ct     Buffers of this worker
+ * @param[in] length Length of the record
+ */
+
+static void capture_append(struct capture_thread *ct, uint32_t length)
+{
+	uint64_t tail = atomic_fetch_uint64_t(&ct->tail);
+	uint32_t off, first;
+
+	if (ct->head + length - tail > capture_ring_size) {
+		atomic_inc_uint64_t(&ct->dropped);
+		return;
+	}
+
+	off = ct->head & (capture_ring_size - 1);
+	first = MIN(length, capture_ring_size - off);
+	memcpy(ct->ring + off, ct->buf, first);
+	memcpy(ct->ring, ct->buf + first, length - first);
+	atomic_store_uint64_t(&ct->head, ct->head + length);
+
+	/* Don't wait for the writer's next pass once half full */
+	if (ct->head - tail > capture_ring_size / 2 &&
+	    atomic_inc_uint32_t(&capture_wake_pending) == 1)
+		(void)fridgethr_wake(capture_fridge);
+}
+
+/**
+ * @brief Stop capturing, with capture_mtx held
+ */
+
+static void capture_stop(void)
+{
+	if (!atomic_fetch_uint32_t(&nfs_capture_on))
+		return;
+
+	atomic_store_uint32_t(&nfs_capture_on, 0);
+	fflush(capture_file);
+	LogEvent(COMPONENT_DISPATCH,
+		 "Request capture stopped after %" PRIu64 " bytes",
+		 capture_size);
+}
+
+/**
+ * @brief Write out one record from a ring
+ *
+ * Must be called with capture_mtx held.
+ *
+ * @param[in] ct     Ring
+ * @param[in] off    Offset of the record in the ring
+ * @param[in] length Length of the record
+ */
+
+static void capture_write(struct capture_thread *ct, uint32_t off,
+			  uint32_t length)
+{
+	uint32_t first = MIN(length, capture_ring_size - off);
+
+	if (capture_file == NULL || !atomic_fetch_uint32_t(&nfs_capture_on))
+		return;
+
+	if (nfs_capture_param.max_size != 0
+	    && capture_size + length > nfs_capture_param.max_size) {
+		capture_stop();
+		return;
+	}
+
+	if (fwrite(ct->ring + off, first, 1, capture_file) != 1
+	    || (length > first
+		&& fwrite(ct->ring, length - first, 1, capture_file) != 1)) {
+		LogCrit(COMPONENT_DISPATCH,
+			"Could not write capture log %s: %s",
+			nfs_capture_param.path, strerror(errno));
+		capture_stop();
+		return;
+	}
+
+	capture_size += length;
+}
+
+/**
+ * @brief Drain every ring into the log
+ *
+ * Rings of workers that have exited are freed once empty.
+ */
+
+static void capture_drain(void)
+{
+	struct glist_head *glist, *glistn;
+	struct capture_thread *ct;
+	uint64_t head, tail, dropped;
+	uint32_t off, length;
+
+	PTHREAD_MUTEX_lock(&capture_mtx);
+
+	dropped = capture_dropped;
+	glist_for_each_safe(glist, glistn, &capture_threads) {
+		ct = glist_entry(glist, struct capture_thread, list);
+		head = atomic_fetch_uint64_t(&ct->head);
+		tail = ct->tail;
+
+		while (tail < head) {
+			off = tail & (capture_ring_size - 1);
+			length = *(uint32_t *)(ct->ring + off);
+			capture_write(ct, off, length);
+			tail += length;
+		}
+		atomic_store_uint64_t(&ct->tail, tail);
+		dropped += atomic_fetch_uint64_t(&ct->dropped);
+
+		if (ct->exited) {
+			glist_del(&ct->list);
+			capture_dropped += ct->dropped;
+			gsh_free(ct->ring);
+			gsh_free(ct);
+		}
+	}
+
+	if (capture_file != NULL)
+		fflush(capture_file);
+
+	if (dropped > capture_dropped_logged) {
+		LogWarn(COMPONENT_DISPATCH,
+			"%" PRIu64
+			" requests not captured for want of buffer space, raise Thread_Buffer",
+			dropped - capture_dropped_logged);
+		capture_dropped_logged = dropped;
+	}
+
+	PTHREAD_MUTEX_unlock(&capture_mtx);
+}
+
+/**
+ * @brief The writer thread
+ */
+
+static void capture_run(struct fridgethr_context *ctx)
+{
+	atomic_store_uint32_t(&capture_wake_pending, 0);
+	capture_drain();
+}
+
+/**
+ * @brief Whether the replayer needs the result of a call
+ *
+ * These are the calls that hand out file handles, client ids,
+ * session ids and stateids, which differ on the replay server and
+ * must be mapped.
+ */
+
+static bool capture_want_res(nfs_request_data_t *reqnfs)
+{
+	struct svc_req *req = &reqnfs->req;
+	COMPOUND4args *args;
+	u_int i;
+
+	if (!nfs_capture_param.record_results)
+		return false;
+
+	if (req->rq_prog == nfs_param.core_param.program[P_MNT])
+		return req->rq_vers == MOUNT_V3 && req->rq_proc == MOUNTPROC3_MNT;
+
+	if (req->rq_prog != nfs_param.core_param.program[P_NFS])
+		return false;
+
+	if (req->rq_vers == NFS_V3) {
+		switch (req->rq_proc) {
+		case NFSPROC3_LOOKUP:
+		case NFSPROC3_CREATE:
+		case NFSPROC3_MKDIR:
+		case NFSPROC3_SYMLINK:
+		case NFSPROC3_MKNOD:
+		case NFSPROC3_READDIRPLUS:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	if (req->rq_vers != NFS_V4 || req->rq_proc != NFSPROC4_COMPOUND)
+		return false;
+
+	args = &reqnfs->arg_nfs.arg_compound4;
+	for (i = 0; i < args->argarray.argarray_len; i++) {
+		switch (args->argarray.argarray_val[i].argop) {
+		case NFS4_OP_GETFH:
+		case NFS4_OP_OPEN:
+		case NFS4_OP_OPEN_CONFIRM:
+		case NFS4_OP_OPEN_DOWNGRADE:
+		case NFS4_OP_LOCK:
+		case NFS4_OP_SETCLIENTID:
+		case NFS4_OP_EXCHANGE_ID:
+		case NFS4_OP_CREATE_SESSION:
+			return true;
+		default:
+			break;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Capture an executed RPC
+ *
+ * Called from nfs_rpc_execute once the service function has run (or
+ * the request was refused), before the reply is sent, and when a
+ * retransmission is answered from the duplicate request cache.
+ *
+ * @param[in] req   The request
+ * @param[in] res   Its result, or NULL
+ * @param[in] flags NFS_CAPTURE_DROPPED if no reply will be sent,
+ *                  NFS_CAPTURE_DRC_HIT for a cached reply
+ */
+
+void nfs_capture_rpc(struct request_data *req, void *res, uint16_t flags)
+{
+	nfs_request_data_t *reqnfs = req->r_u.nfs;
+	struct svc_req *svcreq = &reqnfs->req;
+	struct capture_thread *ct;
+	struct nfs_capture_record *rec;
+	uint32_t off, len;
+	uint32_t ngroups = 0;
+
+	if (reqnfs->funcdesc == NULL || reqnfs->funcdesc->xdr_decode_func ==
+	    NULL)
+		return;
+
+	ct = capture_thread_get();
+	if (ct == NULL || !capture_buf_grow(ct, sizeof(*rec) +
+					    NFS_CAPTURE_MAX_GROUPS *
+					    sizeof(uint32_t)))
+		return;
+
+	rec = (struct nfs_capture_record *)ct->buf;
+	memset(rec, 0, sizeof(*rec));
+	rec->kind = NFS_CAPTURE_RPC;
+	rec->flags = flags;
+	rec->conn = (uintptr_t) reqnfs->xprt;
+	capture_addr(rec, op_ctx->caller_addr);
+	capture_times(rec, &req->time_queued);
+	rec->xid = svcreq->rq_xid;
+	rec->prog = svcreq->rq_prog;
+	rec->vers = svcreq->rq_vers;
+	rec->proc = svcreq->rq_proc;
+
+	if (op_ctx->creds != NULL) {
+		uint32_t *gids = (uint32_t *)(ct->buf + sizeof(*rec));
+		uint32_t i;
+
+		rec->uid = op_ctx->creds->caller_uid;
+		rec->gid = op_ctx->creds->caller_gid;
+		ngroups = MIN(op_ctx->creds->caller_glen,
+			      NFS_CAPTURE_MAX_GROUPS);
+		for (i = 0; i < ngroups; i++)
+			gids[i] = op_ctx->creds->caller_garray[i];
+		rec->ngroups = ngroups;
+	}
+
+	off = sizeof(*rec) + ngroups * sizeof(uint32_t);
+	if (!capture_encode(ct, reqnfs->funcdesc->xdr_decode_func,
+			    &reqnfs->arg_nfs, off, &len))
+		return;
+	/* the buffer may have moved */
+	rec = (struct nfs_capture_record *)ct->buf;
+	rec->arg_len = len;
+	off += nfs_capture_pad(len);
+
+	if (!(flags & NFS_CAPTURE_DROPPED) && res != NULL
+	    && capture_want_res(reqnfs)) {
+		if (!capture_encode(ct, reqnfs->funcdesc->xdr_encode_func, res,
+				    off, &len))
+			return;
+		rec = (struct nfs_capture_record *)ct->buf;
+		rec->res_len = len;
+		rec->flags |= NFS_CAPTURE_HAS_RES;
+		off += nfs_capture_pad(len);
+	}
+
+	rec->length = off;
+	capture_append(ct, off);
+}
+
+#ifdef _USE_9P
+/**
+ * @brief Capture an executed 9P message
+ *
+ * @param[in] req The request
+ */
+
+void nfs_capture_9p(struct request_data *req)
+{
+	struct _9p_request_data *req9p = &req->r_u._9p;
+	struct capture_thread *ct;
+	struct nfs_capture_record *rec;
+	uint32_t msglen;
+	uint16_t tag;
+	uint8_t type;
+
+	if (req9p->_9pmsg == NULL)
+		return;
+
+	/* size[4] type[1] tag[2], little endian */
+	msglen = le32toh(*(uint32_t *)req9p->_9pmsg);
+	type = *(uint8_t *)(req9p->_9pmsg + 4);
+	tag = le16toh(*(uint16_t *)(req9p->_9pmsg + 5));
+
+	if (msglen < 7)
+		return;
+
+	ct = capture_thread_get();
+	if (ct == NULL || !capture_buf_grow(ct, sizeof(*rec) +
+					    nfs_capture_pad(msglen)))
+		return;
+
+	rec = (struct nfs_capture_record *)ct->buf;
+	memset(rec, 0, sizeof(*rec));
+	rec->kind = NFS_CAPTURE_9P;
+	rec->conn = (uintptr_t) req9p->pconn;
+	capture_addr(rec, &req9p->pconn->addrpeer);
+	capture_times(rec, &req->time_queued);
+	rec->xid = tag;
+	rec->proc = type;
+	rec->arg_len = msglen;
+	memcpy(ct->buf + sizeof(*rec), req9p->_9pmsg, msglen);
+	rec->length = sizeof(*rec) + nfs_capture_pad(msglen);
+
+	capture_append(ct, rec->length);
+}
+#endif
+
+/**
+ * @brief Keep the previous log, if any, as Path.1
+ */
+
+static void capture_rotate(void)
+{
+	char old[MAXPATHLEN + 3];
+
+	if (snprintf(old, sizeof(old), "%s.1", nfs_capture_param.path)
+	    >= sizeof(old))
+		return;
+
+	if (rename(nfs_capture_param.path, old) != 0 && errno != ENOENT)
+		LogWarn(COMPONENT_INIT, "Could not rename capture log %s: %s",
+			nfs_capture_param.path, strerror(errno));
+}
+
+/**
+ * @brief Open the capture log and start the writer if capture is
+ *        enabled
+ *
+ * @return 0 on success, errno otherwise.
+ */
+
+int nfs_capture_init(void)
+{
+	struct fridgethr_params frp;
+	FILE *f;
+	int rc;
+
+	if (!nfs_capture_param.enable)
+		return 0;
+
+	capture_ring_size = 1;
+	while (capture_ring_size < nfs_capture_param.thread_buffer)
+		capture_ring_size <<= 1;
+
+	rc = pthread_key_create(&capture_key, capture_thread_exit);
+	if (rc != 0)
+		return rc;
+
+	capture_rotate();
+	f = fopen(nfs_capture_param.path, "w");
+	if (f == NULL) {
+		rc = errno;
+		LogCrit(COMPONENT_INIT, "Could not open capture log %s: %s",
+			nfs_capture_param.path, strerror(rc));
+		return rc;
+	}
+	setvbuf(f, NULL, _IOFBF, CAPTURE_STDIO_BUFFER);
+
+	if (fwrite(NFS_CAPTURE_MAGIC, NFS_CAPTURE_MAGIC_LEN, 1, f) != 1) {
+		rc = errno;
+		fclose(f);
+		return rc;
+	}
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	frp.thread_delay = 1;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&capture_fridge, "capture", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_INIT,
+			 "Unable to initialize capture writer fridge, error code %d.",
+			 rc);
+		fclose(f);
+		return rc;
+	}
+
+	PTHREAD_MUTEX_lock(&capture_mtx);
+	capture_file = f;
+	capture_size = NFS_CAPTURE_MAGIC_LEN;
+	capture_draining = true;
+	now(&capture_start);
+	PTHREAD_MUTEX_unlock(&capture_mtx);
+
+	rc = fridgethr_submit(capture_fridge, capture_run, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_INIT,
+			 "Unable to start capture writer thread, error code %d.",
+			 rc);
+		return rc;
+	}
+
+	atomic_store_uint32_t(&nfs_capture_on, 1);
+
+	LogEvent(COMPONENT_INIT, "Capturing requests to %s",
+		 nfs_capture_param.path);
+	return 0;
+}
+
+/**
+ * @brief Stop capturing, write out what is queued and close the log
+ *
+ * @return 0 on success, errno otherwise.
+ */
+
+int nfs_capture_shutdown(void)
+{
+	struct glist_head *glist, *glistn;
+	struct capture_thread *ct;
+	int rc = 0;
+
+	if (capture_fridge == NULL)
+		return 0;
+
+	rc = fridgethr_sync_command(capture_fridge, fridgethr_comm_stop, 120);
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_THREAD,
+			 "Shutdown timed out, cancelling threads.");
+		fridgethr_cancel(capture_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Failed shutting down capture writer thread: %d", rc);
+	}
+
+	/* Whatever the workers queued before noticing */
+	capture_drain();
+
+	PTHREAD_MUTEX_lock(&capture_mtx);
+	atomic_store_uint32_t(&nfs_capture_on, 0);
+	capture_draining = false;
+	glist_for_each_safe(glist, glistn, &capture_threads) {
+		ct = glist_entry(glist, struct capture_thread, list);
+		if (!ct->exited)
+			continue;	/* Freed by its worker */
+		glist_del(&ct->list);
+		gsh_free(ct->ring);
+		gsh_free(ct);
+	}
+	if (capture_file != NULL) {
+		if (fclose(capture_file) != 0 && rc == 0)
+			rc = errno;
+		capture_file = NULL;
+	}
+	PTHREAD_MUTEX_unlock(&capture_mtx);
+
+	return rc;
+}
+
+/** @} */
@@ -64,6 +64,11 @@
 #include "delayed_exec.h"
 #include "client_mgr.h"
 #include "export_mgr.h"
+#include "mem_governor.h"
+#include "nfs_capture.h"
+#include "stats_recorder.h"
+#include "nfs_upgrade.h"
+#include "keyed_hash.h"
 #ifdef USE_CAPS
 #include <sys/capability.h>	/* For capget/capset */
 #endif
@@ -134,6 +139,7 @@ void *sigmgr_thread(void *UnusedArg)
 				 "SIGHUP_HANDLER: Received SIGHUP.... initiating export list reload");
 			admin_replace_exports();
 			reread_log_config();
+			reread_core_config();
 			svcauth_gss_release_cred();
 		}
 	}
@@ -162,6 +168,11 @@ void nfs_prereq_init(char *program_name, char *host_name, int debug_level,
 	SetNameHost(host_name);
 
 	init_logging(log_path, debug_level);
+
+	/* Before any hash table keyed on client data is populated */
+	if (!keyed_hash_init())
+		LogWarn(COMPONENT_INIT,
+			"Could not read /dev/urandom, hash keys are predictable");
 }
 
 /**
@@ -198,6 +209,10 @@ void nfs_print_param_config()
 	       nfs_param.core_param.decoder_fridge_expiration_delay);
 	printf("\tDecoder_Fridge_Block_Timeout = %" PRIu64 " ;\n",
 	       nfs_param.core_param.decoder_fridge_block_timeout);
+	printf("\tDecoder_Threads = %u ;\n",
+	       nfs_param.core_param.decoder_threads);
+	printf("\tDecoder_Budget = %u ;\n",
+	       nfs_param.core_param.decoder_budget);
 
 	printf("\tManage_Gids_Expiration = %" PRIu64 " ;\n",
 	       nfs_param.core_param.manage_gids_expiration);
@@ -316,6 +331,54 @@ int nfs_set_param_from_conf(config_file_t parse_tree,
 		return -1;
 	}
 
+	/* Memory governor parameters */
+	(void) load_config_from_parse(parse_tree,
+				      &mem_governor_param_blk,
+				      NULL,
+				      true,
+				      err_type);
+	if (!config_error_is_harmless(err_type)) {
+		LogCrit(COMPONENT_INIT,
+			"Error while parsing memory governor configuration");
+		return -1;
+	}
+
+	/* Request capture parameters */
+	(void) load_config_from_parse(parse_tree,
+				      &nfs_capture_param_blk,
+				      NULL,
+				      true,
+				      err_type);
+	if (!config_error_is_harmless(err_type)) {
+		LogCrit(COMPONENT_INIT,
+			"Error while parsing request capture configuration");
+		return -1;
+	}
+
+	/* Statistics recorder parameters */
+	(void) load_config_from_parse(parse_tree,
+				      &stats_recorder_param_blk,
+				      NULL,
+				      true,
+				      err_type);
+	if (!config_error_is_harmless(err_type)) {
+		LogCrit(COMPONENT_INIT,
+			"Error while parsing statistics recorder configuration");
+		return -1;
+	}
+
+	/* Upgrade handoff parameters */
+	(void) load_config_from_parse(parse_tree,
+				      &nfs_upgrade_param_blk,
+				      NULL,
+				      true,
+				      err_type);
+	if (!config_error_is_harmless(err_type)) {
+		LogCrit(COMPONENT_INIT,
+			"Error while parsing upgrade configuration");
+		return -1;
+	}
+
 	LogEvent(COMPONENT_INIT, "Configuration file successfully parsed");
 
 	return 0;
@@ -488,6 +551,36 @@ static void nfs_Start_threads(void)
 	}
 	LogEvent(COMPONENT_THREAD, "General fridge was started successfully");
 
+	/* Starting the memory governor */
+	rc = mem_governor_init();
+	if (rc != 0) {
+		LogFatal(COMPONENT_THREAD,
+			 "Could not start memory governor, error = %d (%s)",
+			 rc, strerror(rc));
+	}
+	LogEvent(COMPONENT_THREAD, "Memory governor was started successfully");
+
+	/* Request capture, if configured */
+	rc = nfs_capture_init();
+	if (rc != 0)
+		LogCrit(COMPONENT_INIT,
+			"Request capture not started, error = %d (%s)",
+			rc, strerror(rc));
+
+	/* Statistics recorder, if configured */
+	rc = stats_recorder_init();
+	if (rc != 0)
+		LogCrit(COMPONENT_INIT,
+			"Statistics recorder not started, error = %d (%s)",
+			rc, strerror(rc));
+
+	/* Listen for a server to hand over to, if configured */
+	rc = nfs_upgrade_init();
+	if (rc != 0)
+		LogCrit(COMPONENT_INIT,
+			"Not listening for upgrades, error = %d (%s)",
+			rc, strerror(rc));
+
 }
 
 /**
@@ -719,11 +812,13 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
 	 */
 	nfs4_create_recov_dir();
 
-	/* read in the client IDs */
-	nfs4_load_recov_clids(NULL);
-
-	/* Start grace period */
-	nfs4_start_grace(NULL);
+	/* Install the state of the server we took over from, or read in
+	 * the client IDs and start the grace period.
+	 */
+	if (!nfs_upgrade_install_state()) {
+		nfs4_load_recov_clids(NULL);
+		nfs4_start_grace(NULL);
+	}
 
 	/* callback dispatch */
 	nfs_rpc_cb_pkginit();
@@ -820,6 +915,9 @@ void nfs_start(nfs_start_info_t *p_start_info)
 	/* Make sure Ganesha runs with a 0000 umask. */
 	umask(0000);
 
+	/* Take over from a running server, keeping its epoch */
+	nfs_upgrade_connect();
+
 	{
 		/* Set the write verifiers */
 		union {
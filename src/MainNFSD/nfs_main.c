@@ -42,6 +42,7 @@
 #include "nfs_init.h"
 #include "nfs_exports.h"
 #include "pnfs_utils.h"
+#include "nfs_upgrade.h"
 
 /**
  * @brief LTTng trace enabling magic
@@ -123,6 +124,7 @@ int main(int argc, char *argv[])
 	int dsc;
 	int rc;
 	int pidfile;
+	bool pidfile_busy = false;
 #ifndef HAVE_DAEMON
 	int dev_null_fd = 0;
 	pid_t son_pid;
@@ -372,14 +374,20 @@ int main(int argc, char *argv[])
 		lk.l_whence = SEEK_SET;
 		lk.l_start = (off_t) 0;
 		lk.l_len = (off_t) 0;
-		if (fcntl(pidfile, F_SETLK, &lk) == -1)
-			LogFatal(COMPONENT_MAIN, "Ganesha already started");
-
-		/* Put pid into file, then close it */
-		(void)snprintf(linebuf, sizeof(linebuf), "%u\n", getpid());
-		if (write(pidfile, linebuf, strlen(linebuf)) == -1)
-			LogCrit(COMPONENT_MAIN, "Couldn't write pid to file %s",
-				pidfile_path);
+		if (fcntl(pidfile, F_SETLK, &lk) == -1) {
+			/* Unless we are taking over from it, which the
+			 * configuration tells.
+			 */
+			pidfile_busy = true;
+		} else {
+			/* Put pid into file, then close it */
+			(void)snprintf(linebuf, sizeof(linebuf), "%u\n",
+				       getpid());
+			if (write(pidfile, linebuf, strlen(linebuf)) == -1)
+				LogCrit(COMPONENT_MAIN,
+					"Couldn't write pid to file %s",
+					pidfile_path);
+		}
 	}
 
 	/* Set up for the signal handler.
@@ -445,6 +453,12 @@ int main(int argc, char *argv[])
 		goto fatal_die;
 	}
 
+	if (pidfile_busy) {
+		if (!nfs_upgrade_param.enable)
+			LogFatal(COMPONENT_MAIN, "Ganesha already started");
+		nfs_upgrade_pidfile(pidfile);
+	}
+
 	/* initialize core subsystems and data structures */
 	if (init_server_pkgs() != 0) {
 		LogCrit(COMPONENT_INIT,
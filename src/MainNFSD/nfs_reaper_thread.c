@@ -161,7 +161,12 @@ static int reap_hash_table(hash_table_t *ht_reap)
 
 			PTHREAD_MUTEX_lock(&pclientid->cid_mutex);
 
-			if (!valid_lease(pclientid)) {
+			/* A confirmed client with state may be kept as a
+			 * courtesy client until its state is wanted.
+			 */
+			if (!valid_lease(pclientid) &&
+			    !(ht_reap == ht_confirmed_client_id &&
+			      keep_courtesy_client(pclientid))) {
 				char str[LOG_BUFF_LEN];
 				struct display_buffer dspbuf = {
 					sizeof(str), str, str};
@@ -237,6 +242,21 @@ static struct reaper_state reaper_state = {
 	.in_grace = false
 };
 
+/**
+ * @brief How often to look for expired clients
+ *
+ * At least twice per lease, so that an expired lease is not kept
+ * much longer than it lasted.
+ */
+
+static unsigned int reaper_delay_for_lease(void)
+{
+	if (nfs_param.nfsv4_param.lease_lifetime < (2 * REAPER_DELAY))
+		return nfs_param.nfsv4_param.lease_lifetime / 2;
+
+	return REAPER_DELAY;
+}
+
 static void reaper_run(struct fridgethr_context *ctx)
 {
 	struct reaper_state *rst = ctx->arg;
@@ -271,6 +291,10 @@ static void reaper_run(struct fridgethr_context *ctx)
 	     reap_hash_table(ht_unconfirmed_client_id));
 
 	rst->count += reap_expired_open_owners(ht_nfs4_owner);
+
+	/* Lease_Lifetime may have been changed by a configuration reload */
+	reaper_delay = reaper_delay_for_lease();
+	fridgethr_setwait(ctx, reaper_delay);
 }
 
 int reaper_init(void)
@@ -278,8 +302,7 @@ int reaper_init(void)
 	struct fridgethr_params frp;
 	int rc = 0;
 
-	if (nfs_param.nfsv4_param.lease_lifetime < (2 * REAPER_DELAY))
-		reaper_delay = nfs_param.nfsv4_param.lease_lifetime / 2;
+	reaper_delay = reaper_delay_for_lease();
 
 	memset(&frp, 0, sizeof(struct fridgethr_params));
 	frp.thr_max = 1;
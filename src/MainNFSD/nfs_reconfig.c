@@ -0,0 +1,217 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file nfs_reconfig.c
+ * @brief Apply reloaded tunables to a running server
+ *
+ * On SIGHUP the NFS_Core_Param, NFSv4 and CacheInode blocks are read
+ * again into scratch copies.  If every value is acceptable the
+ * tunables that can change while serving are applied: Nb_Worker
+ * resizes the worker fridge, the DRC sizes and high water marks go to
+ * the DRCs, a longer Lease_Lifetime is granted to the next renewals,
+ * and the LRU watermarks and LRU_Run_Interval go to the LRU thread.
+ * If any value is not, nothing changes.  Other parameters of these
+ * blocks still need a restart.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "nfs_core.h"
+#include "nfs_dupreq.h"
+#include "cache_inode.h"
+#include "cache_inode_lru.h"
+#include "config_parsing.h"
+
+/**
+ * @brief Check reloaded tunables before applying any of them
+ *
+ * @param[in] core  Reloaded NFS_Core_Param
+ * @param[in] v4    Reloaded NFSv4
+ * @param[in] cache Reloaded CacheInode
+ *
+ * @return true if they can all be applied.
+ */
+
+static bool reconfig_valid(nfs_core_parameter_t *core,
+			   nfs_version4_parameter_t *v4,
+			   struct cache_inode_parameter *cache)
+{
+	nfs_core_parameter_t *cur = &nfs_param.core_param;
+	bool valid = true;
+
+	if (core->drc.tcp.hiwat > core->drc.tcp.size) {
+		LogCrit(COMPONENT_CONFIG,
+			"DRC_TCP_Hiwat %" PRIu32 " above DRC_TCP_Size %" PRIu32,
+			core->drc.tcp.hiwat, core->drc.tcp.size);
+		valid = false;
+	}
+
+	if (core->drc.udp.hiwat > core->drc.udp.size) {
+		LogCrit(COMPONENT_CONFIG,
+			"DRC_UDP_Hiwat %" PRIu32 " above DRC_UDP_Size %" PRIu32,
+			core->drc.udp.hiwat, core->drc.udp.size);
+		valid = false;
+	}
+
+	/* Clients renew at the rate they were granted, so a shorter
+	 * lease would expire them under their feet.
+	 */
+	if (v4->lease_lifetime < nfs_param.nfsv4_param.lease_lifetime) {
+		LogCrit(COMPONENT_CONFIG,
+			"Lease_Lifetime can only be raised while running (%"
+			PRIu32 " to %" PRIu32 ")",
+			nfs_param.nfsv4_param.lease_lifetime,
+			v4->lease_lifetime);
+		valid = false;
+	}
+
+	if (cache->fd_lwmark_percent > cache->fd_hwmark_percent ||
+	    cache->fd_hwmark_percent > cache->fd_limit_percent) {
+		LogCrit(COMPONENT_CONFIG,
+			"FD_LWMark_Percent %" PRIu32 ", FD_HWMark_Percent %"
+			PRIu32 " and FD_Limit_Percent %" PRIu32
+			" must be in ascending order",
+			cache->fd_lwmark_percent, cache->fd_hwmark_percent,
+			cache->fd_limit_percent);
+		valid = false;
+	}
+
+	if (core->drc.tcp.npart != cur->drc.tcp.npart ||
+	    core->drc.tcp.cachesz != cur->drc.tcp.cachesz ||
+	    core->drc.tcp.recycle_npart != cur->drc.tcp.recycle_npart ||
+	    core->drc.udp.npart != cur->drc.udp.npart ||
+	    core->drc.udp.cachesz != cur->drc.udp.cachesz)
+		LogWarn(COMPONENT_CONFIG,
+			"DRC partitions and cache sizes take effect on restart");
+
+	return valid;
+}
+
+/**
+ * @brief Re-read the core, NFSv4 and cache tunables and apply them
+ */
+
+void reread_core_config(void)
+{
+	config_file_t config_struct;
+	struct config_error_type err_type;
+	nfs_core_parameter_t core;
+	nfs_version4_parameter_t v4;
+	struct cache_inode_parameter cache;
+	nfs_core_parameter_t *cur = &nfs_param.core_param;
+	uint32_t old_nb_worker = cur->nb_worker;
+	int rc;
+
+	if (config_path[0] == '\0') {
+		LogCrit(COMPONENT_CONFIG,
+			"No configuration file was specified for reloading core config.");
+		return;
+	}
+
+	if (!init_error_type(&err_type))
+		return;
+
+	config_struct = config_ParseFile(config_path, &err_type);
+	if (!config_error_no_error(&err_type)) {
+		config_Free(config_struct);
+		LogCrit(COMPONENT_CONFIG,
+			"Error while parsing new configuration file %s",
+			config_path);
+		report_config_errors(&err_type, NULL, config_errs_to_log);
+		return;
+	}
+
+	memset(&core, 0, sizeof(core));
+	memset(&v4, 0, sizeof(v4));
+	memset(&cache, 0, sizeof(cache));
+
+	(void) load_config_from_parse(config_struct, &nfs_core, &core, true,
+				      &err_type);
+	(void) load_config_from_parse(config_struct, &version4_param, &v4,
+				      true, &err_type);
+	(void) load_config_from_parse(config_struct, &cache_inode_param_blk,
+				      &cache, true, &err_type);
+	report_config_errors(&err_type, NULL, config_errs_to_log);
+	config_Free(config_struct);
+
+	if (!config_error_is_harmless(&err_type) ||
+	    !reconfig_valid(&core, &v4, &cache)) {
+		LogCrit(COMPONENT_CONFIG,
+			"Keeping the running core, NFSv4 and CacheInode parameters");
+		goto out;
+	}
+
+	/* The only step that can fail, so it goes first and nothing
+	 * else needs to be undone.
+	 */
+	if (core.nb_worker != old_nb_worker) {
+		rc = worker_resize(core.nb_worker);
+		if (rc != 0) {
+			LogCrit(COMPONENT_CONFIG,
+				"Unable to change Nb_Worker from %" PRIu32
+				" to %" PRIu32 ", keeping the running parameters",
+				old_nb_worker, core.nb_worker);
+			(void) worker_resize(old_nb_worker);
+			goto out;
+		}
+		cur->nb_worker = core.nb_worker;
+	}
+
+	cur->drc.tcp.size = core.drc.tcp.size;
+	cur->drc.tcp.hiwat = core.drc.tcp.hiwat;
+	cur->drc.tcp.recycle_expire_s = core.drc.tcp.recycle_expire_s;
+	cur->drc.udp.size = core.drc.udp.size;
+	cur->drc.udp.hiwat = core.drc.udp.hiwat;
+	dupreq2_reconfig();
+
+	/* The reaper picks up its new cadence on its next pass */
+	nfs_param.nfsv4_param.lease_lifetime = v4.lease_lifetime;
+
+	cache_param.entries_hwmark = cache.entries_hwmark;
+	cache_param.lru_run_interval = cache.lru_run_interval;
+	cache_param.use_fd_cache = cache.use_fd_cache;
+	cache_param.fd_limit_percent = cache.fd_limit_percent;
+	cache_param.fd_hwmark_percent = cache.fd_hwmark_percent;
+	cache_param.fd_lwmark_percent = cache.fd_lwmark_percent;
+	cache_param.reaper_work = cache.reaper_work;
+	cache_param.biggest_window = cache.biggest_window;
+	cache_param.required_progress = cache.required_progress;
+	cache_param.futility_count = cache.futility_count;
+	cache_inode_lru_reconfig();
+
+	LogEvent(COMPONENT_CONFIG,
+		 "Reloaded Nb_Worker=%" PRIu32 " Lease_Lifetime=%" PRIu32
+		 " Entries_HWMark=%" PRIu32 " LRU_Run_Interval=%" PRIu64
+		 " FD_HWMark_Percent=%" PRIu32,
+		 cur->nb_worker, nfs_param.nfsv4_param.lease_lifetime,
+		 cache_param.entries_hwmark,
+		 (uint64_t) cache_param.lru_run_interval,
+		 cache_param.fd_hwmark_percent);
+
+out:
+	gsh_free(core.ganesha_modules_loc);
+	gsh_free(v4.domainname);
+	gsh_free(v4.idmapconf);
+}
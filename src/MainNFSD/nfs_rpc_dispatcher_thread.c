@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>		/* for having FNDELAY */
 #include <sys/select.h>
@@ -55,6 +56,8 @@
 #include "nfs_req_queue.h"
 #include "nfs_dupreq.h"
 #include "nfs_file_handle.h"
+#include "nfs_upgrade.h"
+#include "sal_functions.h"
 #include "fridgethr.h"
 
 /**
@@ -83,7 +86,8 @@ const char *req_q_s[N_REQ_QUEUES] = {
 	"REQ_Q_MOUNT",
 	"REQ_Q_CALL",
 	"REQ_Q_LOW_LATENCY",
-	"REQ_Q_HIGH_LATENCY"
+	"REQ_Q_HIGH_LATENCY",
+	"REQ_Q_LEASE"
 };
 
 static u_int nfs_rpc_rdvs(SVCXPRT *xprt, SVCXPRT *newxprt, const u_int flags,
@@ -662,10 +666,51 @@ void Clean_RPC(void)
    * @todo Consider the need to call Svc_dg_destroy for UDP & ?? for
    * TCP based services
    */
-	unregister_rpc();
+	/* The sockets, and with them the registrations, belong to the
+	 * server we handed over to.
+	 */
+	if (!nfs_upgrade_handed_off())
+		unregister_rpc();
 	close_rpc_fd();
 }
 
+/**
+ * @brief Use the sockets of the server we took over from
+ *
+ * @return false if there are none.
+ */
+static bool Inherit_sockets(void)
+{
+	protos p;
+
+	if (!nfs_upgrade_sockets(udp_socket, tcp_socket, P_COUNT,
+				 &v6disabled))
+		return false;
+
+	for (p = P_NFS; p < P_COUNT; p++) {
+		if (test_for_additional_nfs_protocols(p)) {
+			if (udp_socket[p] == -1 || tcp_socket[p] == -1)
+				LogFatal(COMPONENT_DISPATCH,
+					 "No socket handed over for protocol %d",
+					 p);
+			continue;
+		}
+
+		/* Not served by this configuration */
+		if (udp_socket[p] != -1)
+			close(udp_socket[p]);
+		if (tcp_socket[p] != -1)
+			close(tcp_socket[p]);
+		udp_socket[p] = -1;
+		tcp_socket[p] = -1;
+	}
+
+	LogEvent(COMPONENT_DISPATCH,
+		 "Serving on the sockets handed over, v6disabled = %d",
+		 v6disabled);
+	return true;
+}
+
 #define UDP_REGISTER(prot, vers, netconfig) \
 	svc_reg(udp_xprt[prot], nfs_param.core_param.program[prot], \
 		(u_long) vers,					    \
@@ -728,6 +773,8 @@ void nfs_Init_svc()
 {
 	svc_init_params svc_params;
 	int ix, code __attribute__ ((unused)) = 0;
+	protos p;
+	bool inherited;
 
 	LogDebug(COMPONENT_DISPATCH, "NFS INIT: Core options = %d",
 		 nfs_param.core_param.core_options);
@@ -827,10 +874,19 @@ void nfs_Init_svc()
 		LogFullDebug(COMPONENT_DISPATCH,
 			     "netconfig found for UDPv6 and TCPv6");
 
-	/* Allocate the UDP and TCP sockets for the RPC */
-	Allocate_sockets();
+	for (p = P_NFS; p < P_COUNT; p++) {
+		udp_socket[p] = -1;
+		tcp_socket[p] = -1;
+	}
 
-	socket_setoptions(tcp_socket[P_NFS]);
+	/* Take the sockets over from a running server, or allocate the
+	 * UDP and TCP sockets for the RPC
+	 */
+	inherited = Inherit_sockets();
+	if (!inherited) {
+		Allocate_sockets();
+		socket_setoptions(tcp_socket[P_NFS]);
+	}
 
 	if ((nfs_param.core_param.core_options & CORE_OPTION_NFSV3) != 0) {
 		/* Some log that can be useful when debug ONC/RPC
@@ -856,7 +912,8 @@ void nfs_Init_svc()
 		 udp_socket[P_RQUOTA], tcp_socket[P_RQUOTA]);
 
 	/* Bind the tcp and udp sockets */
-	Bind_sockets();
+	if (!inherited)
+		Bind_sockets();
 
 	/* Unregister from portmapper/rpcbind */
 	unregister_rpc();
@@ -1156,6 +1213,31 @@ static bool nfs_rpc_cond_stall_xprt(SVCXPRT *xprt)
 	return true;
 }
 
+/**
+ * @brief Size of the decoder thread pool
+ *
+ * @return Decoder_Threads, or a multiple of the online CPUs if that
+ *         is 0.
+ */
+static uint32_t nfs_rpc_decoder_threads(void)
+{
+	uint32_t nthreads = nfs_param.core_param.decoder_threads;
+	long ncpu;
+
+	if (nthreads != 0)
+		return nthreads;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+
+	nthreads = ncpu * DECODER_THREADS_PER_CPU;
+	if (nthreads < DECODER_THREADS_MIN)
+		nthreads = DECODER_THREADS_MIN;
+
+	return nthreads;
+}
+
 void nfs_rpc_queue_init(void)
 {
 	struct fridgethr_params reqparams;
@@ -1164,16 +1246,16 @@ void nfs_rpc_queue_init(void)
 	int ix;
 
 	memset(&reqparams, 0, sizeof(struct fridgethr_params));
-    /**
-     * @todo Add a configuration parameter to set a max.
-     */
-	reqparams.thr_max = 0;
+	/* A bounded pool: with many connections a burst of ready
+	 * transports would otherwise get a thread each.  Transports
+	 * beyond what the pool can take wait on the fridge queue in
+	 * arrival order.
+	 */
+	reqparams.thr_max = nfs_rpc_decoder_threads();
 	reqparams.thr_min = 1;
 	reqparams.thread_delay =
 		nfs_param.core_param.decoder_fridge_expiration_delay;
-	reqparams.deferment = fridgethr_defer_block;
-	reqparams.block_delay =
-		nfs_param.core_param.decoder_fridge_block_timeout;
+	reqparams.deferment = fridgethr_defer_queue;
 
 	/* decoder thread pool */
 	rc = fridgethr_init(&req_fridge, "decoder", &reqparams);
@@ -1181,6 +1263,11 @@ void nfs_rpc_queue_init(void)
 		LogFatal(COMPONENT_DISPATCH,
 			 "Unable to initialize decoder thread pool: %d", rc);
 
+	LogInfo(COMPONENT_DISPATCH,
+		"Decoder pool: %" PRIu32 " threads, budget %" PRIu32
+		" requests per transport", reqparams.thr_max,
+		nfs_param.core_param.decoder_budget);
+
 	/* queues */
 	pthread_spin_init(&nfs_req_st.reqs.sp, PTHREAD_PROCESS_PRIVATE);
 	nfs_req_st.reqs.size = 0;
@@ -1205,6 +1292,9 @@ void nfs_rpc_queue_init(void)
 static uint32_t enqueued_reqs;
 static uint32_t dequeued_reqs;
 
+/* Lease renewals dequeued since a request of another queue was */
+static uint32_t lease_run;
+
 uint32_t get_enqueue_count()
 {
 	return enqueued_reqs;
@@ -1229,6 +1319,10 @@ void nfs_rpc_enqueue_req(request_data_t *req)
 			     "enter rq_xid=%u lookahead.flags=%u",
 			     req->r_u.nfs->req.rq_xid,
 			     req->r_u.nfs->lookahead.flags);
+		if (req->r_u.nfs->lookahead.flags & NFS_LOOKAHEAD_LEASE) {
+			qpair = &(nfs_request_q->qset[REQ_Q_LEASE]);
+			break;
+		}
 		if (req->r_u.nfs->lookahead.flags & NFS_LOOKAHEAD_MOUNT) {
 			qpair = &(nfs_request_q->qset[REQ_Q_MOUNT]);
 			break;
@@ -1377,8 +1471,24 @@ request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker)
 	/* XXX: the following stands in for a more robust/flexible
 	 * weighting function */
 
-	/* slot in 1..4 */
  retry_deq:
+	/* Lease renewals go first, so that no client loses its lease
+	 * because the server is busy, but no more than REQ_Q_LEASE_RUN in
+	 * a row while the other queues wait.
+	 */
+	qpair = &(nfs_request_q->qset[REQ_Q_LEASE]);
+	if (atomic_fetch_uint32_t(&lease_run) < REQ_Q_LEASE_RUN &&
+	    atomic_fetch_uint32_t(&qpair->producer.size) +
+	    atomic_fetch_uint32_t(&qpair->consumer.size) > 0) {
+		nfsreq = nfs_rpc_consume_req(qpair);
+		if (nfsreq) {
+			atomic_inc_uint32_t(&lease_run);
+			atomic_inc_uint32_t(&dequeued_reqs);
+			return nfsreq;
+		}
+	}
+
+	/* slot in 1..4 */
 	slot = (nfs_rpc_q_next_slot() % 4);
 	for (ix = 0; ix < 4; ++ix) {
 		switch (slot) {
@@ -1411,6 +1521,7 @@ request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker)
 		/* anything? */
 		nfsreq = nfs_rpc_consume_req(qpair);
 		if (nfsreq) {
+			atomic_store_uint32_t(&lease_run, 0);
 			atomic_inc_uint32_t(&dequeued_reqs);
 			break;
 		}
@@ -1420,6 +1531,14 @@ request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker)
 
 	}			/* for */
 
+	/* Nothing else waits, so renewals past the run go now */
+	if (!nfsreq) {
+		nfsreq =
+		    nfs_rpc_consume_req(&(nfs_request_q->qset[REQ_Q_LEASE]));
+		if (nfsreq)
+			atomic_inc_uint32_t(&dequeued_reqs);
+	}
+
 	/* wait */
 	if (!nfsreq) {
 		wait_q_entry_t *wqe = &worker->wqe;
@@ -1503,6 +1622,7 @@ static inline request_data_t *alloc_nfs_request(SVCXPRT *xprt)
 
 	/* set up xprt */
 	nfsreq->r_u.nfs->xprt = xprt;
+	nfsreq->r_u.nfs->lease_held = NULL;
 	req->rq_xprt = xprt;
 	req->rq_rtaddr.len = 0;
 
@@ -1765,6 +1885,30 @@ static bool is_rpc_call_valid(nfs_request_data_t *reqnfs)
 	return false;
 }				/* is_rpc_call_valid */
 
+/**
+ * @brief Whether a decoded request only renews a lease
+ *
+ * That is an NFSv4 COMPOUND of a lone RENEW or SEQUENCE.
+ *
+ * @param[in] reqnfs Request, with its arguments decoded
+ *
+ * @return true if it goes on the lease queue.
+ */
+
+static bool nfs_rpc_is_lease_renewal(nfs_request_data_t *reqnfs)
+{
+	struct svc_req *req = &reqnfs->req;
+	COMPOUND4args *args = &reqnfs->arg_nfs.arg_compound4;
+
+	if (req->rq_prog != nfs_param.core_param.program[P_NFS] ||
+	    req->rq_vers != NFS_V4 || req->rq_proc != NFSPROC4_COMPOUND ||
+	    args->argarray.argarray_len != 1)
+		return false;
+
+	return args->argarray.argarray_val[0].argop == NFS4_OP_RENEW ||
+	       args->argarray.argarray_val[0].argop == NFS4_OP_SEQUENCE;
+}
+
 enum xprt_stat thr_decode_rpc_request(struct fridgethr_context
 						    *thr_ctx, SVCXPRT *xprt)
 {
@@ -1857,6 +2001,17 @@ enum xprt_stat thr_decode_rpc_request(struct fridgethr_context
 			goto finish;
 		}
 
+		/* Keep the lease from expiring while the renewal waits
+		 * for a worker.
+		 */
+		if (nfs_rpc_is_lease_renewal(nfsreq->r_u.nfs)) {
+			nfsreq->r_u.nfs->lookahead.flags |=
+			    NFS_LOOKAHEAD_LEASE;
+			nfsreq->r_u.nfs->lease_held =
+			    hold_queued_renewal(&nfsreq->r_u.nfs->arg_nfs.
+						arg_compound4);
+		}
+
 		/* XXX as above, the call has already passed is_rpc_call_valid,
 		 * the former check here is removed. */
 		nfs_rpc_enqueue_req(nfsreq);
@@ -1903,12 +2058,26 @@ void thr_decode_rpc_requests(struct fridgethr_context *thr_ctx)
 {
 	enum xprt_stat stat;
 	SVCXPRT *xprt = (SVCXPRT *) thr_ctx->arg;
+	uint32_t budget = nfs_param.core_param.decoder_budget;
+	bool more;
 
 	LogFullDebug(COMPONENT_RPC, "enter xprt=%p", xprt);
 
 	do {
 		stat = thr_decode_rpc_request(thr_ctx, xprt);
-	} while (thr_continue_decoding(xprt, stat));
+		more = thr_continue_decoding(xprt, stat);
+	} while (more && --budget > 0);
+
+	/* Budget spent with records still buffered.  Epoll won't fire
+	 * for those, so rather than rearm, go to the back of the ready
+	 * queue, keeping our reference and the decoding flag.
+	 */
+	if (more &&
+	    fridgethr_submit(req_fridge, thr_decode_rpc_requests, xprt) == 0) {
+		LogFullDebug(COMPONENT_DISPATCH, "budget spent, requeued %p",
+			     xprt);
+		return;
+	}
 
 	LogDebug(COMPONENT_DISPATCH, "exiting, stat=%s", xprt_stat_s[stat]);
 
@@ -0,0 +1,2012 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup nfs_upgrade
+ * @{
+ */
+
+/**
+ * @file nfs_upgrade.c
+ * @brief Hand the service over to an upgraded server
+ *
+ * The old server listens on the upgrade socket from a thread of its
+ * own and, once a new server has connected, halts.  do_shutdown calls
+ * nfs_upgrade_handoff when the workers are done, which sends the
+ * sockets and the state snapshot.
+ *
+ * The new server calls nfs_upgrade_connect before anything else, which
+ * reads everything the old server sends, then takes the sockets in
+ * nfs_Init_svc and installs the state where it would otherwise start
+ * the grace period.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "log.h"
+#include "gsh_rpc.h"
+#include "nfs_core.h"
+#include "nfs4.h"
+#include "hashtable.h"
+#include "sal_functions.h"
+#include "cache_inode.h"
+#include "cache_inode_lru.h"
+#include "export_mgr.h"
+#include "client_mgr.h"
+#include "nfs_file_handle.h"
+#include "nfs_rpc_callback.h"
+#include "fsal.h"
+#include "abstract_atomic.h"
+#include "nfs_upgrade.h"
+
+/**
+ * @brief Upgrade parameters
+ */
+
+struct nfs_upgrade_parameter nfs_upgrade_param;
+
+static struct config_item nfs_upgrade_params[] = {
+	CONF_ITEM_BOOL("Enable", false,
+		       nfs_upgrade_parameter, enable),
+	CONF_ITEM_PATH("Socket", 1, MAXPATHLEN, "/var/run/ganesha.upgrade",
+		       nfs_upgrade_parameter, socket),
+	CONF_ITEM_UI32("Timeout", 1, 3600, 120,
+		       nfs_upgrade_parameter, timeout),
+	CONFIG_EOL
+};
+
+static void *nfs_upgrade_param_init(void *link_mem, void *self_struct)
+{
+	if (self_struct == NULL)
+		return &nfs_upgrade_param;
+	else
+		return NULL;
+}
+
+struct config_block nfs_upgrade_param_blk = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.upgrade",
+	.blk_desc.name = "NFS_Upgrade",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = nfs_upgrade_param_init,
+	.blk_desc.u.blk.params = nfs_upgrade_params,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
+/**
+ * @brief Largest message accepted
+ */
+
+#define UPGRADE_MAX_MESSAGE (16 * 1024 * 1024)
+
+/**
+ * @brief A growing buffer of messages
+ */
+
+struct upgrade_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+/* Old server, under upgrade_mtx */
+static pthread_mutex_t upgrade_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int upgrade_listen_fd = -1;
+static bool upgrade_listening;
+static pthread_t upgrade_thrid;
+static int upgrade_peer_fd = -1;	/*< Connection to the new server */
+static bool upgrade_done;		/*< Sockets handed over */
+
+/* New server */
+static int upgrade_pidfile_fd = -1;	/*< Pid file still locked */
+static int upgrade_from_fd = -1;	/*< Connection to the old server */
+static bool upgrade_have_sockets;
+static int upgrade_udp[NFS_UPGRADE_PROTOS];
+static int upgrade_tcp[NFS_UPGRADE_PROTOS];
+static bool upgrade_v6disabled;
+static struct upgrade_buf upgrade_snapshot;
+static struct nfs_upgrade_end upgrade_end;
+
+static bool upgrade_buf_reserve(struct upgrade_buf *buf, size_t more)
+{
+	size_t size = buf->size ? buf->size : 64 * 1024;
+	char *data;
+
+	if (buf->len + more <= buf->size)
+		return true;
+
+	while (size < buf->len + more)
+		size *= 2;
+
+	data = gsh_realloc(buf->data, size);
+	if (data == NULL)
+		return false;
+
+	buf->data = data;
+	buf->size = size;
+	return true;
+}
+
+/**
+ * @brief Append a message
+ *
+ * @param[in,out] buf    Buffer
+ * @param[in]     type   Message type
+ * @param[in]     rec    Fixed record
+ * @param[in]     len    Its length
+ * @param[in]     parts  Variable parts, each padded
+ * @param[in]     nparts How many
+ *
+ * @return false if out of memory.
+ */
+
+static bool upgrade_put(struct upgrade_buf *buf, uint32_t type,
+			const void *rec, uint32_t len,
+			const struct gsh_buffdesc *parts, int nparts)
+{
+	struct nfs_upgrade_hdr hdr;
+	uint32_t total = nfs_upgrade_pad(len);
+	int i;
+
+	for (i = 0; i < nparts; i++)
+		total += nfs_upgrade_pad(parts[i].len);
+
+	if (!upgrade_buf_reserve(buf, sizeof(hdr) + total))
+		return false;
+
+	hdr.type = type;
+	hdr.length = total;
+	memcpy(buf->data + buf->len, &hdr, sizeof(hdr));
+	buf->len += sizeof(hdr);
+
+	memset(buf->data + buf->len, 0, total);
+	memcpy(buf->data + buf->len, rec, len);
+	buf->len += nfs_upgrade_pad(len);
+
+	for (i = 0; i < nparts; i++) {
+		if (parts[i].len != 0)
+			memcpy(buf->data + buf->len, parts[i].addr,
+			       parts[i].len);
+		buf->len += nfs_upgrade_pad(parts[i].len);
+	}
+
+	return true;
+}
+
+static int upgrade_write(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read exactly len bytes
+ *
+ * @return 0, an errno, or EPIPE at end of stream.
+ */
+
+static int upgrade_read(int fd, void *data, size_t len)
+{
+	char *p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = recv(fd, p, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			return EPIPE;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Send a message, with descriptors attached to its first byte
+ */
+
+static int upgrade_send(int fd, uint32_t type, const void *rec, uint32_t len,
+			const int *fds, int nfds)
+{
+	struct upgrade_buf buf = { NULL, 0, 0 };
+	union {
+		struct cmsghdr align;
+		char data[CMSG_SPACE(sizeof(int) * 2 * NFS_UPGRADE_PROTOS)];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+	int rc;
+
+	if (!upgrade_put(&buf, type, rec, len, NULL, 0))
+		return ENOMEM;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf.data;
+	iov.iov_len = buf.len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (nfds > 0) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.data;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	do {
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		rc = errno;
+	else
+		rc = upgrade_write(fd, buf.data + n, buf.len - n);
+
+	gsh_free(buf.data);
+	return rc;
+}
+
+/**
+ * @brief Receive a message into buf, and any descriptors with it
+ *
+ * @param[in]     fd    Connection
+ * @param[out]    hdr   Message header
+ * @param[in,out] buf   The message body is appended here
+ * @param[out]    fds   Descriptors received, may be NULL
+ * @param[in,out] nfds  Room in fds, then how many were received
+ *
+ * @return 0, an errno, or EPIPE at end of stream.
+ */
+
+static int upgrade_recv(int fd, struct nfs_upgrade_hdr *hdr,
+			struct upgrade_buf *buf, int *fds, int *nfds)
+{
+	union {
+		struct cmsghdr align;
+		char data[CMSG_SPACE(sizeof(int) * 2 * NFS_UPGRADE_PROTOS)];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	int got = 0, room = nfds ? *nfds : 0;
+	ssize_t n;
+	int rc;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(*hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	do {
+		n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return errno;
+	if (n == 0)
+		return EPIPE;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		int *passed = (int *)CMSG_DATA(cmsg);
+		int i, count;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < count; i++) {
+			if (got < room)
+				fds[got++] = passed[i];
+			else
+				close(passed[i]);
+		}
+	}
+
+	if (nfds)
+		*nfds = got;
+
+	if ((size_t)n < sizeof(*hdr)) {
+		rc = upgrade_read(fd, (char *)hdr + n, sizeof(*hdr) - n);
+		if (rc != 0)
+			return rc;
+	}
+
+	if (hdr->length > UPGRADE_MAX_MESSAGE)
+		return EPROTO;
+
+	if (!upgrade_buf_reserve(buf, hdr->length))
+		return ENOMEM;
+
+	rc = upgrade_read(fd, buf->data + buf->len, hdr->length);
+	if (rc == 0)
+		buf->len += hdr->length;
+
+	return rc;
+}
+
+static void upgrade_timeout(int fd, uint32_t seconds)
+{
+	struct timeval tv = { .tv_sec = seconds, .tv_usec = 0 };
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0)
+		LogWarn(COMPONENT_INIT,
+			"Could not set upgrade socket timeout: %s",
+			strerror(errno));
+}
+
+static bool upgrade_address(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(nfs_upgrade_param.socket) >= sizeof(addr->sun_path)) {
+		LogCrit(COMPONENT_INIT, "Upgrade socket path %s is too long",
+			nfs_upgrade_param.socket);
+		return false;
+	}
+
+	strcpy(addr->sun_path, nfs_upgrade_param.socket);
+	return true;
+}
+
+/*
+ * The old server
+ */
+
+static void *upgrade_listener(void *arg)
+{
+	struct nfs_upgrade_hdr hdr;
+	struct nfs_upgrade_hello hello;
+	struct upgrade_buf buf = { NULL, 0, 0 };
+	int fd, rc;
+
+	SetNameFunction("upgrade");
+
+	for (;;) {
+		fd = accept4(upgrade_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* Closed by nfs_upgrade_handoff */
+			break;
+		}
+
+		upgrade_timeout(fd, 5);
+		buf.len = 0;
+		rc = upgrade_recv(fd, &hdr, &buf, NULL, NULL);
+
+		memset(&hello, 0, sizeof(hello));
+		if (rc == 0 && buf.len >= sizeof(hello))
+			memcpy(&hello, buf.data, sizeof(hello));
+
+		hello.pid = getpid();
+
+		if (rc != 0 || hdr.type != NFS_UPGRADE_HELLO ||
+		    hello.magic != NFS_UPGRADE_MAGIC ||
+		    hello.version != NFS_UPGRADE_VERSION) {
+			LogCrit(COMPONENT_INIT,
+				"Refusing upgrade request, error %d, version %"
+				PRIu32, rc, hello.version);
+			hello.magic = NFS_UPGRADE_MAGIC;
+			hello.version = NFS_UPGRADE_VERSION;
+			(void)upgrade_send(fd, NFS_UPGRADE_REFUSE, &hello,
+					   sizeof(hello), NULL, 0);
+			close(fd);
+			continue;
+		}
+
+		rc = upgrade_send(fd, NFS_UPGRADE_ACCEPT, &hello,
+				  sizeof(hello), NULL, 0);
+		if (rc != 0) {
+			close(fd);
+			continue;
+		}
+
+		PTHREAD_MUTEX_lock(&upgrade_mtx);
+		upgrade_peer_fd = fd;
+		PTHREAD_MUTEX_unlock(&upgrade_mtx);
+
+		LogEvent(COMPONENT_INIT,
+			 "Handing over to an upgraded server, shutting down");
+		admin_halt();
+		break;
+	}
+
+	gsh_free(buf.data);
+	return NULL;
+}
+
+/**
+ * @brief Listen for a server to hand over to
+ *
+ * @return 0 or an errno.
+ */
+
+int nfs_upgrade_init(void)
+{
+	struct sockaddr_un addr;
+	int fd, rc;
+
+	if (!nfs_upgrade_param.enable)
+		return 0;
+
+	if (!upgrade_address(&addr))
+		return ENAMETOOLONG;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return errno;
+
+	/* The server we took over from is gone, or never was */
+	(void)unlink(addr.sun_path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    chmod(addr.sun_path, 0600) != 0 || listen(fd, 1) != 0) {
+		rc = errno;
+		close(fd);
+		return rc;
+	}
+
+	upgrade_listen_fd = fd;
+
+	rc = pthread_create(&upgrade_thrid, NULL, upgrade_listener, NULL);
+	if (rc != 0) {
+		close(fd);
+		upgrade_listen_fd = -1;
+		return rc;
+	}
+
+	upgrade_listening = true;
+
+	LogInfo(COMPONENT_INIT, "Listening for upgrades on %s",
+		addr.sun_path);
+	return 0;
+}
+
+static void upgrade_stop_listener(void)
+{
+	if (!upgrade_listening)
+		return;
+
+	/* Wakes accept */
+	(void)shutdown(upgrade_listen_fd, SHUT_RDWR);
+	pthread_join(upgrade_thrid, NULL);
+	close(upgrade_listen_fd);
+	upgrade_listen_fd = -1;
+	upgrade_listening = false;
+
+	(void)unlink(nfs_upgrade_param.socket);
+}
+
+/**
+ * @brief Collect references to the confirmed clients
+ */
+
+static nfs_client_id_t **upgrade_clients(uint32_t *count)
+{
+	hash_table_t *ht = ht_confirmed_client_id;
+	struct rbt_head *head_rbt;
+	struct rbt_node *pn;
+	struct hash_data *pdata;
+	nfs_client_id_t **clients = NULL, **more;
+	nfs_client_id_t *clientid;
+	uint32_t n = 0, room = 0, i;
+
+	for (i = 0; i < ht->parameter.index_size; i++) {
+		PTHREAD_RWLOCK_rdlock(&ht->partitions[i].lock);
+		head_rbt = &ht->partitions[i].rbt;
+
+		RBT_LOOP(head_rbt, pn) {
+			pdata = RBT_OPAQ(pn);
+			clientid = pdata->val.addr;
+			RBT_INCREMENT(pn);
+
+			if (clientid->cid_confirmed != CONFIRMED_CLIENT_ID)
+				continue;
+
+			if (n == room) {
+				room = room ? room * 2 : 64;
+				more = gsh_realloc(clients,
+						   room * sizeof(*clients));
+				if (more == NULL)
+					break;
+				clients = more;
+			}
+
+			inc_client_id_ref(clientid);
+			clients[n++] = clientid;
+		}
+
+		PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
+	}
+
+	*count = n;
+	return clients;
+}
+
+/**
+ * @brief Collect references to a client's owners of one kind
+ */
+
+static state_owner_t **upgrade_owners(nfs_client_id_t *clientid,
+				      struct glist_head *list, uint32_t *count)
+{
+	struct glist_head *glist;
+	state_owner_t **owners;
+	uint32_t n = 0;
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+
+	glist_for_each(glist, list)
+		n++;
+
+	owners = gsh_calloc(n + 1, sizeof(*owners));
+	if (owners != NULL) {
+		n = 0;
+		glist_for_each(glist, list) {
+			owners[n] = glist_entry(glist, state_owner_t,
+						so_owner.so_nfs4_owner.
+						so_perclient);
+			inc_state_owner_ref(owners[n]);
+			n++;
+		}
+	} else {
+		n = 0;
+	}
+
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	*count = n;
+	return owners;
+}
+
+/**
+ * @brief Collect references to an owner's states
+ */
+
+static state_t **upgrade_states(state_owner_t *owner, uint32_t *count)
+{
+	struct glist_head *glist;
+	state_t **states;
+	uint32_t n = 0;
+
+	PTHREAD_MUTEX_lock(&owner->so_mutex);
+
+	glist_for_each(glist, &owner->so_owner.so_nfs4_owner.so_state_list)
+		n++;
+
+	states = gsh_calloc(n + 1, sizeof(*states));
+	if (states != NULL) {
+		n = 0;
+		glist_for_each(glist,
+			       &owner->so_owner.so_nfs4_owner.so_state_list) {
+			states[n] = glist_entry(glist, state_t,
+						state_owner_list);
+			inc_state_t_ref(states[n]);
+			n++;
+		}
+	} else {
+		n = 0;
+	}
+
+	PTHREAD_MUTEX_unlock(&owner->so_mutex);
+
+	*count = n;
+	return states;
+}
+
+/**
+ * @brief Add a state to the snapshot
+ *
+ * @return false if it could not be carried.
+ */
+
+static bool upgrade_put_state(struct upgrade_buf *buf,
+			      nfs_client_id_t *clientid, state_t *state)
+{
+	struct nfs_upgrade_state rec;
+	struct nfs_upgrade_range *ranges = NULL;
+	struct gsh_buffdesc parts[4];
+	cache_entry_t *entry = NULL;
+	struct gsh_export *export = NULL;
+	state_owner_t *owner = NULL, *open_owner = NULL;
+	struct glist_head *glist;
+	state_lock_entry_t *lock;
+	char fhbuf[NFS4_FHSIZE];
+	nfs_fh4 fh;
+	uint32_t type, n;
+	bool ok = false;
+
+	switch (state->state_type) {
+	case STATE_TYPE_SHARE:
+		type = NFS_UPGRADE_OPEN;
+		break;
+	case STATE_TYPE_LOCK:
+		type = NFS_UPGRADE_LOCK;
+		break;
+	case STATE_TYPE_DELEG:
+		type = NFS_UPGRADE_DELEG;
+		break;
+	default:
+		/* Layouts are not carried */
+		return false;
+	}
+
+	if (!get_state_entry_export_owner_refs(state, &entry, &export,
+					       &owner))
+		return false;
+
+	memset(&rec, 0, sizeof(rec));
+	memcpy(rec.other, state->stateid_other, OTHERSIZE);
+	rec.seqid = state->state_seqid;
+	rec.clientid = clientid->cid_clientid;
+
+	fh.nfs_fh4_val = fhbuf;
+	fh.nfs_fh4_len = sizeof(fhbuf);
+	if (!nfs4_FSALToFhandle(&fh, entry->obj_handle, export))
+		goto out;
+
+	rec.fh_len = fh.nfs_fh4_len;
+	parts[0].addr = fh.nfs_fh4_val;
+	parts[0].len = fh.nfs_fh4_len;
+	parts[1].len = 0;
+	parts[2].len = 0;
+	parts[3].len = 0;
+
+	if (type != NFS_UPGRADE_DELEG) {
+		rec.owner_len = owner->so_owner_len;
+		rec.owner_seqid = owner->so_owner.so_nfs4_owner.so_seqid;
+		rec.owner_confirmed = owner->so_owner.so_nfs4_owner.
+		    so_confirmed;
+		parts[1].addr = owner->so_owner_val;
+		parts[1].len = owner->so_owner_len;
+	}
+
+	PTHREAD_RWLOCK_rdlock(&entry->state_lock);
+
+	switch (type) {
+	case NFS_UPGRADE_OPEN:
+		rec.share_access = state->state_data.share.share_access;
+		rec.share_deny = state->state_data.share.share_deny;
+		rec.share_access_prev =
+		    state->state_data.share.share_access_prev;
+		rec.share_deny_prev = state->state_data.share.share_deny_prev;
+		break;
+
+	case NFS_UPGRADE_LOCK:
+		open_owner = owner->so_owner.so_nfs4_owner.so_related_owner;
+		if (open_owner == NULL ||
+		    state->state_data.lock.openstate == NULL) {
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			goto out;
+		}
+
+		memcpy(rec.open_other,
+		       state->state_data.lock.openstate->stateid_other,
+		       OTHERSIZE);
+		rec.open_owner_len = open_owner->so_owner_len;
+		parts[2].addr = open_owner->so_owner_val;
+		parts[2].len = open_owner->so_owner_len;
+
+		n = 0;
+		glist_for_each(glist, &state->state_data.lock.state_locklist)
+			n++;
+
+		ranges = gsh_calloc(n + 1, sizeof(*ranges));
+		if (ranges == NULL) {
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			goto out;
+		}
+
+		n = 0;
+		glist_for_each(glist,
+			       &state->state_data.lock.state_locklist) {
+			lock = glist_entry(glist, state_lock_entry_t,
+					   sle_locks);
+			if (lock->sle_blocked != STATE_NON_BLOCKING)
+				continue;
+			ranges[n].start = lock->sle_lock.lock_start;
+			ranges[n].length = lock->sle_lock.lock_length;
+			ranges[n].type = lock->sle_lock.lock_type;
+			n++;
+		}
+
+		rec.nranges = n;
+		parts[3].addr = ranges;
+		parts[3].len = n * sizeof(*ranges);
+		break;
+
+	case NFS_UPGRADE_DELEG:
+		rec.deleg_type = state->state_data.deleg.sd_type;
+		rec.grant_time = state->state_data.deleg.sd_grant_time;
+		break;
+	}
+
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+
+	ok = upgrade_put(buf, type, &rec, sizeof(rec), parts, 4);
+
+ out:
+	gsh_free(ranges);
+	dec_state_owner_ref(owner);
+	put_gsh_export(export);
+	cache_inode_put(entry);
+	return ok;
+}
+
+/**
+ * @brief Add a client's states of one kind to the snapshot
+ */
+
+static void upgrade_put_owner_states(struct upgrade_buf *buf,
+				     nfs_client_id_t *clientid,
+				     state_owner_t *owner,
+				     struct nfs_upgrade_end *end)
+{
+	state_t **states;
+	uint32_t n, i;
+
+	states = upgrade_states(owner, &n);
+	if (states == NULL) {
+		end->skipped++;
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (upgrade_put_state(buf, clientid, states[i]))
+			end->states++;
+		else
+			end->skipped++;
+		dec_state_t_ref(states[i]);
+	}
+
+	gsh_free(states);
+}
+
+static void upgrade_put_channel(struct nfs_upgrade_channel *chan,
+				const channel_attrs4 *attrs)
+{
+	chan->headerpadsize = attrs->ca_headerpadsize;
+	chan->maxrequestsize = attrs->ca_maxrequestsize;
+	chan->maxresponsesize = attrs->ca_maxresponsesize;
+	chan->maxresponsesize_cached = attrs->ca_maxresponsesize_cached;
+	chan->maxoperations = attrs->ca_maxoperations;
+	chan->maxrequests = attrs->ca_maxrequests;
+}
+
+/**
+ * @brief Add a client, its sessions and its states to the snapshot
+ */
+
+static void upgrade_put_client(struct upgrade_buf *buf,
+			       nfs_client_id_t *clientid,
+			       struct nfs_upgrade_end *end)
+{
+	struct nfs_upgrade_client rec;
+	struct nfs_upgrade_session srec;
+	nfs_client_record_t *record = clientid->cid_client_record;
+	struct gsh_buffdesc owner;
+	struct glist_head *glist;
+	nfs41_session_t *session;
+	state_owner_t **owners;
+	uint32_t n, i;
+	int s;
+
+	if (clientid->cid_credential.flavor != AUTH_NONE &&
+	    clientid->cid_credential.flavor != AUTH_UNIX) {
+		/* An RPCSEC_GSS context cannot be carried */
+		end->skipped++;
+		return;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.clientid = clientid->cid_clientid;
+	rec.last_renew = clientid->cid_last_renew;
+	memcpy(rec.verifier, clientid->cid_verifier, sizeof(rec.verifier));
+	memcpy(rec.incoming_verifier, clientid->cid_incoming_verifier,
+	       sizeof(rec.incoming_verifier));
+	rec.minorversion = clientid->cid_minorversion;
+	rec.create_session_sequence =
+	    clientid->cid_create_session_sequence;
+	rec.cred_flavor = clientid->cid_credential.flavor;
+	rec.cred_uid = clientid->cid_credential.auth_union.auth_unix.aup_uid;
+	rec.cred_gid = clientid->cid_credential.auth_union.auth_unix.aup_gid;
+	rec.pnfs_flags = record->cr_pnfs_flags;
+	rec.server_addr = record->cr_server_addr;
+	rec.owner_len = record->cr_client_val_len;
+
+	if (clientid->gsh_client != NULL &&
+	    clientid->gsh_client->addr.len <= sizeof(rec.addr)) {
+		rec.addr_len = clientid->gsh_client->addr.len;
+		memcpy(rec.addr, clientid->gsh_client->addr.addr,
+		       rec.addr_len);
+	}
+
+	if (clientid->cid_minorversion == 0) {
+		rec.cb_program = clientid->cid_cb.v40.cb_program;
+		rec.cb_callback_ident = clientid->cid_cb.v40.cb_callback_ident;
+		rec.cb_chan_down = clientid->cid_cb.v40.cb_chan_down;
+		rec.cb_nc = clientid->cid_cb.v40.cb_addr.nc;
+		rec.cb_port = clientid->cid_cb.v40.cb_addr.port;
+		memcpy(rec.cb_ss, &clientid->cid_cb.v40.cb_addr.ss,
+		       sizeof(rec.cb_ss));
+		memcpy(rec.cb_r_addr, clientid->cid_cb.v40.cb_client_r_addr,
+		       sizeof(clientid->cid_cb.v40.cb_client_r_addr));
+	} else {
+		memcpy(rec.server_owner, clientid->cid_server_owner,
+		       sizeof(clientid->cid_server_owner));
+		memcpy(rec.server_scope, clientid->cid_server_scope,
+		       sizeof(clientid->cid_server_scope));
+		rec.reclaim_complete =
+		    clientid->cid_cb.v41.cid_reclaim_complete;
+	}
+
+	/* New stateids for this client must not collide with carried ones,
+	 * so the counter is read before the states are.
+	 */
+	rec.stateid_counter =
+	    atomic_fetch_uint32_t(&clientid->cid_stateid_counter);
+
+	owner.addr = record->cr_client_val;
+	owner.len = record->cr_client_val_len;
+
+	if (!upgrade_put(buf, NFS_UPGRADE_CLIENT, &rec, sizeof(rec),
+			 &owner, 1)) {
+		end->skipped++;
+		return;
+	}
+
+	end->clients++;
+
+	if (clientid->cid_minorversion != 0) {
+		PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+
+		glist_for_each(glist, &clientid->cid_cb.v41.cb_session_list) {
+			session = glist_entry(glist, nfs41_session_t,
+					      session_link);
+
+			memset(&srec, 0, sizeof(srec));
+			memcpy(srec.session_id, session->session_id,
+			       sizeof(srec.session_id));
+			srec.clientid = session->clientid;
+			srec.cb_program = session->cb_program;
+			srec.nslots = NFS41_NB_SLOTS;
+			upgrade_put_channel(&srec.fore,
+					    &session->fore_channel_attrs);
+			upgrade_put_channel(&srec.back,
+					    &session->back_channel_attrs);
+			for (s = 0; s < NFS41_NB_SLOTS; s++)
+				srec.slot_sequence[s] =
+				    session->slots[s].sequence;
+
+			if (upgrade_put(buf, NFS_UPGRADE_SESSION, &srec,
+					sizeof(srec), NULL, 0))
+				end->sessions++;
+			else
+				end->skipped++;
+		}
+
+		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+	}
+
+	/* Opens before the locks made under them */
+	owners = upgrade_owners(clientid, &clientid->cid_openowners, &n);
+	for (i = 0; i < n; i++) {
+		upgrade_put_owner_states(buf, clientid, owners[i], end);
+		dec_state_owner_ref(owners[i]);
+	}
+	gsh_free(owners);
+
+	owners = upgrade_owners(clientid, &clientid->cid_lockowners, &n);
+	for (i = 0; i < n; i++) {
+		upgrade_put_owner_states(buf, clientid, owners[i], end);
+		dec_state_owner_ref(owners[i]);
+	}
+	gsh_free(owners);
+
+	/* Delegations, and layouts, belong to the clientid owner */
+	upgrade_put_owner_states(buf, clientid, &clientid->cid_owner, end);
+}
+
+/**
+ * @brief Count the NLM clients, whose locks are not carried
+ */
+
+static uint32_t upgrade_nlm_clients(void)
+{
+	hash_table_t *ht = ht_nsm_client;
+	uint32_t n = 0, i;
+
+	if (ht == NULL)
+		return 0;
+
+	for (i = 0; i < ht->parameter.index_size; i++) {
+		PTHREAD_RWLOCK_rdlock(&ht->partitions[i].lock);
+		n += ht->partitions[i].count;
+		PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
+	}
+
+	return n;
+}
+
+/**
+ * @brief Hand the sockets and state over to the new server
+ *
+ * Called from do_shutdown once the workers have stopped, or have
+ * failed to.  Stops listening for upgrades in any case.
+ *
+ * @param[in] drained Whether the workers stopped cleanly
+ *
+ * @return true if the sockets were handed over.
+ */
+
+bool nfs_upgrade_handoff(bool drained)
+{
+	struct nfs_upgrade_sockets socks;
+	struct nfs_upgrade_hello hello;
+	struct nfs_upgrade_end end;
+	struct upgrade_buf buf = { NULL, 0, 0 };
+	nfs_client_id_t **clients;
+	int fds[2 * NFS_UPGRADE_PROTOS];
+	int nfds = 0, fd, rc;
+	uint32_t n, i;
+	int p;
+
+	upgrade_stop_listener();
+
+	PTHREAD_MUTEX_lock(&upgrade_mtx);
+	fd = upgrade_peer_fd;
+	PTHREAD_MUTEX_unlock(&upgrade_mtx);
+
+	if (fd == -1)
+		return false;
+
+	if (!drained) {
+		LogCrit(COMPONENT_INIT,
+			"Requests did not drain, not handing over");
+		memset(&hello, 0, sizeof(hello));
+		hello.magic = NFS_UPGRADE_MAGIC;
+		hello.version = NFS_UPGRADE_VERSION;
+		hello.pid = getpid();
+		/* The new server starts afresh once we are gone */
+		(void)upgrade_send(fd, NFS_UPGRADE_ABORT, &hello,
+				   sizeof(hello), NULL, 0);
+		return false;
+	}
+
+	memset(&socks, 0, sizeof(socks));
+	socks.epoch = (uint64_t) ServerEpoch;
+	socks.v6disabled = v6disabled;
+
+	for (p = 0; p < NFS_UPGRADE_PROTOS; p++) {
+		socks.udp[p] = -1;
+		socks.tcp[p] = -1;
+		if (p >= P_COUNT)
+			continue;
+		if (udp_socket[p] != -1) {
+			socks.udp[p] = nfds;
+			fds[nfds++] = udp_socket[p];
+		}
+		if (tcp_socket[p] != -1) {
+			socks.tcp[p] = nfds;
+			fds[nfds++] = tcp_socket[p];
+		}
+	}
+
+	socks.nfds = nfds;
+
+	rc = upgrade_send(fd, NFS_UPGRADE_SOCKETS, &socks, sizeof(socks),
+			  fds, nfds);
+	if (rc != 0) {
+		LogCrit(COMPONENT_INIT,
+			"Could not hand sockets over: %s", strerror(rc));
+		return false;
+	}
+
+	PTHREAD_MUTEX_lock(&upgrade_mtx);
+	upgrade_done = true;
+	PTHREAD_MUTEX_unlock(&upgrade_mtx);
+
+	/* The new server serves these now, whatever becomes of the state */
+	memset(&end, 0, sizeof(end));
+
+	clients = upgrade_clients(&n);
+	for (i = 0; i < n; i++) {
+		upgrade_put_client(&buf, clients[i], &end);
+		dec_client_id_ref(clients[i]);
+	}
+	gsh_free(clients);
+
+	/* NLM clients reclaim their locks in a grace period */
+	end.skipped += upgrade_nlm_clients();
+
+	if (!upgrade_put(&buf, NFS_UPGRADE_END, &end, sizeof(end), NULL, 0)) {
+		/* A bare END, so the new server falls back to grace */
+		buf.len = 0;
+		end.skipped++;
+		(void)upgrade_put(&buf, NFS_UPGRADE_END, &end, sizeof(end),
+				  NULL, 0);
+	}
+
+	rc = buf.data ? upgrade_write(fd, buf.data, buf.len) : ENOMEM;
+	gsh_free(buf.data);
+
+	if (rc != 0)
+		LogCrit(COMPONENT_INIT, "Could not hand state over: %s",
+			strerror(rc));
+	else
+		LogEvent(COMPONENT_INIT,
+			 "Handed over %" PRIu32 " clients, %" PRIu32
+			 " sessions and %" PRIu32 " states, %" PRIu32
+			 " not carried", end.clients, end.sessions,
+			 end.states, end.skipped);
+
+	/* The connection stays open until we exit, which tells the new
+	 * server our locks are released.
+	 */
+	return true;
+}
+
+/**
+ * @brief Whether the sockets went to another server
+ */
+
+bool nfs_upgrade_handed_off(void)
+{
+	bool done;
+
+	PTHREAD_MUTEX_lock(&upgrade_mtx);
+	done = upgrade_done;
+	PTHREAD_MUTEX_unlock(&upgrade_mtx);
+
+	return done;
+}
+
+/*
+ * The new server
+ */
+
+/**
+ * @brief Note a pid file still locked by the server being upgraded
+ *
+ * It is written once that server has exited.
+ *
+ * @param[in] fd The open pid file
+ */
+
+void nfs_upgrade_pidfile(int fd)
+{
+	upgrade_pidfile_fd = fd;
+}
+
+static void upgrade_take_pidfile(void)
+{
+	struct flock lk;
+	char linebuf[32];
+
+	if (upgrade_pidfile_fd == -1)
+		return;
+
+	lk.l_type = F_WRLCK;
+	lk.l_whence = SEEK_SET;
+	lk.l_start = (off_t) 0;
+	lk.l_len = (off_t) 0;
+
+	if (fcntl(upgrade_pidfile_fd, F_SETLKW, &lk) == -1)
+		LogFatal(COMPONENT_MAIN, "Ganesha already started");
+
+	(void)snprintf(linebuf, sizeof(linebuf), "%u\n", getpid());
+	if (ftruncate(upgrade_pidfile_fd, 0) == -1 ||
+	    pwrite(upgrade_pidfile_fd, linebuf, strlen(linebuf), 0) == -1)
+		LogCrit(COMPONENT_MAIN, "Couldn't write pid to file %s",
+			pidfile_path);
+
+	upgrade_pidfile_fd = -1;
+}
+
+/**
+ * @brief Wait for the old server to exit
+ */
+
+static void upgrade_wait_exit(void)
+{
+	char c;
+	ssize_t n;
+
+	if (upgrade_from_fd == -1)
+		return;
+
+	upgrade_timeout(upgrade_from_fd, nfs_upgrade_param.timeout);
+
+	do {
+		n = recv(upgrade_from_fd, &c, 1, 0);
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	if (n < 0)
+		LogCrit(COMPONENT_INIT,
+			"Old server has not exited: %s", strerror(errno));
+
+	close(upgrade_from_fd);
+	upgrade_from_fd = -1;
+
+	upgrade_take_pidfile();
+}
+
+/**
+ * @brief Take over from a running server, if there is one
+ *
+ * Called before anything else is set up.  Connects to the upgrade
+ * socket and, if a server answers, waits for it to drain and reads
+ * its sockets, epoch and state.  Otherwise returns for a normal start.
+ */
+
+void nfs_upgrade_connect(void)
+{
+	struct sockaddr_un addr;
+	struct nfs_upgrade_hello hello;
+	struct nfs_upgrade_sockets socks;
+	struct nfs_upgrade_hdr hdr;
+	struct upgrade_buf buf = { NULL, 0, 0 };
+	int fds[2 * NFS_UPGRADE_PROTOS];
+	int nfds, fd, rc, i;
+
+	if (!nfs_upgrade_param.enable || !upgrade_address(&addr)) {
+		if (upgrade_pidfile_fd != -1)
+			LogFatal(COMPONENT_MAIN, "Ganesha already started");
+		return;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr,
+			      sizeof(addr)) != 0) {
+		if (fd >= 0)
+			close(fd);
+		if (upgrade_pidfile_fd != -1)
+			LogFatal(COMPONENT_MAIN, "Ganesha already started");
+		LogInfo(COMPONENT_INIT, "No server to take over from at %s",
+			addr.sun_path);
+		return;
+	}
+
+	upgrade_from_fd = fd;
+	upgrade_timeout(fd, nfs_upgrade_param.timeout);
+
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = NFS_UPGRADE_MAGIC;
+	hello.version = NFS_UPGRADE_VERSION;
+	hello.pid = getpid();
+
+	rc = upgrade_send(fd, NFS_UPGRADE_HELLO, &hello, sizeof(hello),
+			  NULL, 0);
+	if (rc == 0)
+		rc = upgrade_recv(fd, &hdr, &buf, NULL, NULL);
+
+	if (rc != 0 || hdr.type != NFS_UPGRADE_ACCEPT ||
+	    buf.len < sizeof(hello))
+		LogFatal(COMPONENT_INIT,
+			 "Running server at %s refused to hand over (%s)",
+			 addr.sun_path, rc ? strerror(rc) : "refused");
+
+	memcpy(&hello, buf.data, sizeof(hello));
+	LogEvent(COMPONENT_INIT,
+		 "Taking over from server %" PRIu32
+		 ", waiting for it to drain", hello.pid);
+
+	buf.len = 0;
+	nfds = 2 * NFS_UPGRADE_PROTOS;
+	rc = upgrade_recv(fd, &hdr, &buf, fds, &nfds);
+
+	if (rc == 0 && hdr.type == NFS_UPGRADE_ABORT) {
+		LogCrit(COMPONENT_INIT,
+			"Old server did not drain, starting afresh once it exits");
+		upgrade_wait_exit();
+		gsh_free(buf.data);
+		return;
+	}
+
+	if (rc != 0 || hdr.type != NFS_UPGRADE_SOCKETS ||
+	    buf.len < sizeof(socks))
+		LogFatal(COMPONENT_INIT,
+			 "Old server did not hand its sockets over (%s)",
+			 rc ? strerror(rc) : "bad message");
+
+	memcpy(&socks, buf.data, sizeof(socks));
+
+	for (i = 0; i < NFS_UPGRADE_PROTOS; i++) {
+		upgrade_udp[i] = socks.udp[i] >= 0 && socks.udp[i] < nfds
+		    ? fds[socks.udp[i]] : -1;
+		upgrade_tcp[i] = socks.tcp[i] >= 0 && socks.tcp[i] < nfds
+		    ? fds[socks.tcp[i]] : -1;
+	}
+
+	upgrade_v6disabled = socks.v6disabled;
+	upgrade_have_sockets = true;
+
+	/* Keep clientids, stateids and write verifiers valid */
+	ServerEpoch = (time_t) socks.epoch;
+
+	/* Then the state, up to END */
+	gsh_free(buf.data);
+	memset(&upgrade_end, 0, sizeof(upgrade_end));
+
+	for (;;) {
+		size_t start = upgrade_snapshot.len;
+
+		if (!upgrade_buf_reserve(&upgrade_snapshot, sizeof(hdr))) {
+			rc = ENOMEM;
+			break;
+		}
+		upgrade_snapshot.len += sizeof(hdr);
+
+		rc = upgrade_recv(fd, &hdr, &upgrade_snapshot, NULL, NULL);
+		if (rc != 0)
+			break;
+
+		memcpy(upgrade_snapshot.data + start, &hdr, sizeof(hdr));
+
+		if (hdr.type == NFS_UPGRADE_END) {
+			if (hdr.length >= sizeof(upgrade_end))
+				memcpy(&upgrade_end,
+				       upgrade_snapshot.data + start +
+				       sizeof(hdr), sizeof(upgrade_end));
+			break;
+		}
+	}
+
+	if (rc != 0) {
+		LogCrit(COMPONENT_INIT,
+			"Old server state incomplete (%s), falling back to a grace period",
+			strerror(rc));
+		upgrade_end.skipped++;
+	}
+
+	LogEvent(COMPONENT_INIT,
+		 "Took over sockets, %" PRIu32 " clients, %" PRIu32
+		 " sessions and %" PRIu32 " states, %" PRIu32
+		 " not carried", upgrade_end.clients, upgrade_end.sessions,
+		 upgrade_end.states, upgrade_end.skipped);
+}
+
+/**
+ * @brief Take the sockets handed over
+ *
+ * @param[out] udp        UDP socket for each protocol, -1 for none
+ * @param[out] tcp        TCP socket for each protocol, -1 for none
+ * @param[in]  count      P_COUNT
+ * @param[out] v6disabled Whether the sockets are IPv4 only
+ *
+ * @return false if nothing was handed over.
+ */
+
+bool nfs_upgrade_sockets(int *udp, int *tcp, int count, bool *v6disabled)
+{
+	int i;
+
+	if (!upgrade_have_sockets)
+		return false;
+
+	for (i = 0; i < count && i < NFS_UPGRADE_PROTOS; i++) {
+		udp[i] = upgrade_udp[i];
+		tcp[i] = upgrade_tcp[i];
+	}
+
+	*v6disabled = upgrade_v6disabled;
+	return true;
+}
+
+static void upgrade_get_channel(channel_attrs4 *attrs,
+				const struct nfs_upgrade_channel *chan)
+{
+	memset(attrs, 0, sizeof(*attrs));
+	attrs->ca_headerpadsize = chan->headerpadsize;
+	attrs->ca_maxrequestsize = chan->maxrequestsize;
+	attrs->ca_maxresponsesize = chan->maxresponsesize;
+	attrs->ca_maxresponsesize_cached = chan->maxresponsesize_cached;
+	attrs->ca_maxoperations = chan->maxoperations;
+	attrs->ca_maxrequests = chan->maxrequests;
+}
+
+/**
+ * @brief Recreate a confirmed client
+ *
+ * @return The client, referenced, or NULL.
+ */
+
+static nfs_client_id_t *upgrade_install_client(
+				const struct nfs_upgrade_client *rec,
+				const char *owner)
+{
+	struct root_op_context root_op_context;
+	sockaddr_t sockaddr;
+	struct gsh_client *gsh_client;
+	nfs_client_record_t *record;
+	nfs_client_id_t *clientid = NULL;
+	nfs_client_cred_t cred;
+	int rc;
+
+	memset(&sockaddr, 0, sizeof(sockaddr));
+	if (rec->addr_len == 4) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&sockaddr;
+
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, rec->addr, 4);
+	} else if (rec->addr_len == 16) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&sockaddr;
+
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, rec->addr, 16);
+	} else {
+		return NULL;
+	}
+
+	gsh_client = get_gsh_client(&sockaddr, false);
+	if (gsh_client == NULL)
+		return NULL;
+
+	init_root_op_context(&root_op_context, NULL, NULL, NFS_V4,
+			     rec->minorversion, NFS_REQUEST);
+	op_ctx->client = gsh_client;
+
+	record = get_client_record(owner, rec->owner_len, rec->pnfs_flags,
+				   rec->server_addr);
+	if (record == NULL)
+		goto out;
+
+	PTHREAD_MUTEX_lock(&record->cr_mutex);
+
+	if (record->cr_confirmed_rec != NULL)
+		goto unlock;
+
+	memset(&cred, 0, sizeof(cred));
+	cred.flavor = rec->cred_flavor;
+	cred.auth_union.auth_unix.aup_uid = rec->cred_uid;
+	cred.auth_union.auth_unix.aup_gid = rec->cred_gid;
+
+	clientid = create_client_id(rec->clientid, record, &cred,
+				    rec->minorversion);
+	if (clientid == NULL)
+		goto unlock;
+
+	memcpy(clientid->cid_verifier, rec->verifier, NFS4_VERIFIER_SIZE);
+	memcpy(clientid->cid_incoming_verifier, rec->incoming_verifier,
+	       NFS4_VERIFIER_SIZE);
+
+	if (rec->minorversion == 0) {
+		clientid->cid_cb.v40.cb_program = rec->cb_program;
+		clientid->cid_cb.v40.cb_callback_ident =
+		    rec->cb_callback_ident;
+		clientid->cid_cb.v40.cb_addr.nc = rec->cb_nc;
+		clientid->cid_cb.v40.cb_addr.port = rec->cb_port;
+		memcpy(&clientid->cid_cb.v40.cb_addr.ss, rec->cb_ss,
+		       sizeof(rec->cb_ss));
+		memcpy(clientid->cid_cb.v40.cb_client_r_addr, rec->cb_r_addr,
+		       sizeof(clientid->cid_cb.v40.cb_client_r_addr));
+		clientid->cid_cb.v40.cb_client_r_addr[
+		    sizeof(clientid->cid_cb.v40.cb_client_r_addr) - 1] = '\0';
+	} else {
+		glist_init(&clientid->cid_cb.v41.cb_session_list);
+		clientid->cid_cb.v41.cid_reclaim_complete =
+		    rec->reclaim_complete;
+		clientid->cid_create_session_sequence =
+		    rec->create_session_sequence;
+		memcpy(clientid->cid_server_owner, rec->server_owner,
+		       sizeof(clientid->cid_server_owner));
+		memcpy(clientid->cid_server_scope, rec->server_scope,
+		       sizeof(clientid->cid_server_scope));
+		clientid->cid_server_owner[MAXNAMLEN] = '\0';
+		clientid->cid_server_scope[MAXNAMLEN] = '\0';
+	}
+
+	rc = nfs_client_id_insert(clientid);
+	if (rc != CLIENT_ID_SUCCESS) {
+		/* Record is already freed */
+		clientid = NULL;
+		goto unlock;
+	}
+
+	if (rec->minorversion == 0)
+		nfs4_create_clid_name(record, clientid, NULL);
+
+	/* A reference of our own, the table keeps the other */
+	inc_client_id_ref(clientid);
+
+	rc = nfs_client_id_confirm(clientid, COMPONENT_CLIENTID);
+	if (rc != CLIENT_ID_SUCCESS) {
+		dec_client_id_ref(clientid);
+		clientid = NULL;
+		goto unlock;
+	}
+
+	if (rec->minorversion == 0)
+		set_cb_chan_down(clientid, rec->cb_chan_down);
+
+	clientid->cid_last_renew = rec->last_renew;
+	reserve_clientid(rec->clientid);
+
+ unlock:
+	PTHREAD_MUTEX_unlock(&record->cr_mutex);
+	dec_client_record_ref(record);
+
+ out:
+	release_root_op_context();
+	put_gsh_client(gsh_client);
+	return clientid;
+}
+
+/**
+ * @brief Recreate an NFSv4.1 session, its back channel left down
+ */
+
+static bool upgrade_install_session(const struct nfs_upgrade_session *rec)
+{
+	nfs_client_id_t *clientid;
+	nfs41_session_t *session;
+	int i;
+
+	if (nfs_client_id_get_confirmed(rec->clientid, &clientid) !=
+	    CLIENT_ID_SUCCESS)
+		return false;
+
+	session = pool_alloc(nfs41_session_pool, NULL);
+	if (session == NULL) {
+		dec_client_id_ref(clientid);
+		return false;
+	}
+
+	memcpy(session->session_id, rec->session_id, NFS4_SESSIONID_SIZE);
+	session->clientid = rec->clientid;
+	session->clientid_record = clientid;
+	session->refcount = 1;	/* sentinel ref */
+	upgrade_get_channel(&session->fore_channel_attrs, &rec->fore);
+	upgrade_get_channel(&session->back_channel_attrs, &rec->back);
+	session->xprt = NULL;
+	session->flags = 0;
+	session->cb_program = rec->cb_program;
+	PTHREAD_MUTEX_init(&session->cb_mutex, NULL);
+	PTHREAD_COND_init(&session->cb_cond, NULL);
+	for (i = 0; i < NFS41_NB_SLOTS; i++) {
+		PTHREAD_MUTEX_init(&session->slots[i].lock, NULL);
+		if (i < rec->nslots && i < NFS_UPGRADE_SLOTS)
+			session->slots[i].sequence = rec->slot_sequence[i];
+	}
+
+	/* The session's reference to the clientid is the one we got */
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	glist_add(&clientid->cid_cb.v41.cb_session_list,
+		  &session->session_link);
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	if (!nfs41_Session_Set(session)) {
+		dec_session_ref(session);
+		return false;
+	}
+
+	nfs41_Reserve_sessionid(session->session_id);
+	return true;
+}
+
+/**
+ * @brief Find the file a carried state is on
+ *
+ * Sets up op_ctx for its export.
+ *
+ * @return The entry, referenced, or NULL.
+ */
+
+static cache_entry_t *upgrade_entry(struct root_op_context *ctx,
+				    const char *fhdata, uint32_t fh_len,
+				    uint32_t minorversion)
+{
+	const file_handle_v4_t *fh = (const file_handle_v4_t *)fhdata;
+	cache_inode_fsal_data_t fsal_data;
+	struct gsh_export *export;
+	cache_entry_t *entry = NULL;
+	char opaque[NFS4_FHSIZE];
+	fsal_status_t status;
+
+	if (fh_len < offsetof(file_handle_v4_t, fsopaque) ||
+	    fh_len < offsetof(file_handle_v4_t, fsopaque) + fh->fs_len ||
+	    fh->fs_len > sizeof(opaque))
+		return NULL;
+
+	export = get_gsh_export(fh->id.exports);
+	if (export == NULL)
+		return NULL;
+
+	init_root_op_context(ctx, export, export->fsal_export, NFS_V4,
+			     minorversion, NFS_REQUEST);
+
+	memcpy(opaque, fh->fsopaque, fh->fs_len);
+	fsal_data.export = export->fsal_export;
+	fsal_data.fh_desc.addr = opaque;
+	fsal_data.fh_desc.len = fh->fs_len;
+
+	status = fsal_data.export->exp_ops.extract_handle(fsal_data.export,
+							  FSAL_DIGEST_NFSV4,
+							  &fsal_data.fh_desc,
+							  fh->fhflags1);
+	if (FSAL_IS_ERROR(status) ||
+	    cache_inode_get(&fsal_data, &entry) != CACHE_INODE_SUCCESS)
+		entry = NULL;
+
+	if (entry == NULL) {
+		release_root_op_context();
+		put_gsh_export(export);
+	}
+
+	return entry;
+}
+
+static void upgrade_release_entry(cache_entry_t *entry)
+{
+	struct gsh_export *export = op_ctx->export;
+
+	release_root_op_context();
+	put_gsh_export(export);
+	cache_inode_put(entry);
+}
+
+/**
+ * @brief Find or create the owner of a carried state
+ */
+
+static state_owner_t *upgrade_owner(nfs_client_id_t *clientid,
+				    const char *name, uint32_t len,
+				    state_owner_type_t type,
+				    state_owner_t *related,
+				    const struct nfs_upgrade_state *rec)
+{
+	state_nfs4_owner_name_t owner_name;
+	state_owner_t *owner;
+	bool_t isnew;
+
+	owner_name.son_owner_len = len;
+	owner_name.son_owner_val = (char *)name;
+
+	owner = create_nfs4_owner(&owner_name, clientid, type, related,
+				  rec ? rec->owner_seqid : 0, &isnew,
+				  CARE_ALWAYS);
+
+	if (owner != NULL && rec != NULL) {
+		owner->so_owner.so_nfs4_owner.so_seqid = rec->owner_seqid;
+		owner->so_owner.so_nfs4_owner.so_confirmed =
+		    rec->owner_confirmed;
+	}
+
+	return owner;
+}
+
+/**
+ * @brief Recreate a state with its stateid
+ *
+ * @return false if it could not be.
+ */
+
+static bool upgrade_add_state(uint32_t type,
+				  const struct nfs_upgrade_state *rec,
+				  const char *fh, const char *owner_name,
+				  const char *open_owner_name,
+				  const struct nfs_upgrade_range *ranges)
+{
+	struct root_op_context root_op_context;
+	nfs_client_id_t *clientid;
+	cache_entry_t *entry;
+	state_owner_t *owner = NULL, *open_owner = NULL;
+	state_t *state = NULL, *open_state = NULL;
+	union state_data data;
+	state_owner_t *holder;
+	fsal_lock_param_t lock, conflict;
+	fsal_openflags_t openflags;
+	uint32_t counter, saved, i;
+	state_status_t status;
+	bool ok = false;
+
+	if (nfs_client_id_get_confirmed(rec->clientid, &clientid) !=
+	    CLIENT_ID_SUCCESS)
+		return false;
+
+	entry = upgrade_entry(&root_op_context, fh, rec->fh_len,
+			      clientid->cid_minorversion);
+	if (entry == NULL) {
+		dec_client_id_ref(clientid);
+		return false;
+	}
+
+	memset(&data, 0, sizeof(data));
+
+	switch (type) {
+	case NFS_UPGRADE_OPEN:
+		owner = upgrade_owner(clientid, owner_name, rec->owner_len,
+				      STATE_OPEN_OWNER_NFSV4, NULL, rec);
+		data.share.share_access = rec->share_access;
+		data.share.share_deny = rec->share_deny;
+		data.share.share_access_prev = rec->share_access_prev;
+		data.share.share_deny_prev = rec->share_deny_prev;
+		break;
+
+	case NFS_UPGRADE_LOCK:
+		open_owner = upgrade_owner(clientid, open_owner_name,
+					   rec->open_owner_len,
+					   STATE_OPEN_OWNER_NFSV4, NULL, NULL);
+		if (open_owner == NULL)
+			goto out;
+		owner = upgrade_owner(clientid, owner_name, rec->owner_len,
+				      STATE_LOCK_OWNER_NFSV4, open_owner,
+				      rec);
+		open_state = nfs4_State_Get_Pointer((char *)rec->open_other);
+		if (open_state == NULL)
+			goto out;
+		data.lock.openstate = open_state;
+		break;
+
+	case NFS_UPGRADE_DELEG:
+		init_new_deleg_state(&data, rec->deleg_type, clientid);
+		data.deleg.sd_grant_time = rec->grant_time;
+		owner = &clientid->cid_owner;
+		inc_state_owner_ref(owner);
+		break;
+	}
+
+	if (owner == NULL)
+		goto out;
+
+	/* state_add takes the next stateid of the client, so have it be
+	 * the one carried over.
+	 */
+	memcpy(&counter, rec->other + sizeof(clientid4), sizeof(counter));
+	saved = atomic_fetch_uint32_t(&clientid->cid_stateid_counter);
+	atomic_store_uint32_t(&clientid->cid_stateid_counter, counter - 1);
+
+	if (clientid->cid_minorversion == 0)
+		op_ctx->clientid = &owner->so_owner.so_nfs4_owner.so_clientid;
+
+	switch (type) {
+	case NFS_UPGRADE_OPEN:
+		PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+
+		status = state_add_impl(entry, STATE_TYPE_SHARE, &data, owner,
+					&state, NULL);
+		if (status != STATE_SUCCESS) {
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			break;
+		}
+
+		glist_init(&state->state_data.share.share_lockstates);
+
+		if ((rec->share_access & OPEN4_SHARE_ACCESS_BOTH) ==
+		    OPEN4_SHARE_ACCESS_READ)
+			openflags = FSAL_O_READ;
+		else
+			openflags = FSAL_O_RDWR;
+
+		if (cache_inode_open(entry, openflags, 0) !=
+		    CACHE_INODE_SUCCESS) {
+			state_del_locked(state);
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			break;
+		}
+
+		status = state_share_add(entry, owner, state, false);
+		if (status != STATE_SUCCESS) {
+			(void)cache_inode_close(entry, 0);
+			state_del_locked(state);
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			break;
+		}
+
+		PTHREAD_RWLOCK_unlock(&entry->state_lock);
+		ok = true;
+		break;
+
+	case NFS_UPGRADE_LOCK:
+		status = state_add(entry, STATE_TYPE_LOCK, &data, owner,
+				   &state, NULL);
+		if (status != STATE_SUCCESS)
+			break;
+
+		glist_init(&state->state_data.lock.state_locklist);
+		glist_add_tail(&open_state->state_data.share.share_lockstates,
+			       &state->state_data.lock.state_sharelist);
+
+		ok = true;
+		for (i = 0; i < rec->nranges && ok; i++) {
+			memset(&lock, 0, sizeof(lock));
+			lock.lock_type = ranges[i].type;
+			lock.lock_start = ranges[i].start;
+			lock.lock_length = ranges[i].length;
+			lock.lock_sle_type = FSAL_POSIX_LOCK;
+			lock.lock_reclaim = false;
+
+			status = state_lock(entry, owner, state,
+					    STATE_NON_BLOCKING, NULL, &lock,
+					    &holder, &conflict);
+			if (status != STATE_SUCCESS)
+				ok = false;
+		}
+
+		if (!ok)
+			state_del(state);
+		break;
+
+	case NFS_UPGRADE_DELEG:
+		PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+
+		status = state_add_impl(entry, STATE_TYPE_DELEG, &data, owner,
+					&state, NULL);
+		if (status != STATE_SUCCESS) {
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			break;
+		}
+
+		status = acquire_lease_lock(entry, owner, state);
+		if (status != STATE_SUCCESS) {
+			state_del_locked(state);
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			break;
+		}
+
+		entry->object.file.fdeleg_stats.fds_deleg_type =
+		    rec->deleg_type;
+
+		PTHREAD_RWLOCK_unlock(&entry->state_lock);
+		ok = true;
+		break;
+	}
+
+	op_ctx->clientid = NULL;
+
+	if (saved > counter)
+		counter = saved;
+	atomic_store_uint32_t(&clientid->cid_stateid_counter, counter);
+
+	if (ok)
+		state->state_seqid = rec->seqid;
+
+	if (state != NULL)
+		dec_state_t_ref(state);
+
+ out:
+	if (open_state != NULL)
+		dec_state_t_ref(open_state);
+	if (owner != NULL)
+		dec_state_owner_ref(owner);
+	if (open_owner != NULL)
+		dec_state_owner_ref(open_owner);
+	upgrade_release_entry(entry);
+	dec_client_id_ref(clientid);
+	return ok;
+}
+
+/**
+ * @brief Expire a client whose state did not all come over
+ */
+
+static void upgrade_expire(clientid4 id)
+{
+	nfs_client_id_t *clientid;
+	nfs_client_record_t *record;
+
+	if (nfs_client_id_get_confirmed(id, &clientid) != CLIENT_ID_SUCCESS)
+		return;
+
+	record = clientid->cid_client_record;
+	inc_client_record_ref(record);
+
+	PTHREAD_MUTEX_lock(&record->cr_mutex);
+	(void)nfs_client_id_expire(clientid, false);
+	PTHREAD_MUTEX_unlock(&record->cr_mutex);
+
+	dec_client_record_ref(record);
+	dec_client_id_ref(clientid);
+}
+
+/**
+ * @brief Install the state handed over
+ *
+ * Waits for the old server to exit first, so that its locks are gone.
+ * If any state could not be carried, clients are recovered as after a
+ * restart: the grace period is started with the clients on stable
+ * storage, and clients that lost state are expired so that they
+ * reclaim it.
+ *
+ * @return false if nothing was handed over, and the grace period is
+ *         to be started as usual.
+ */
+
+bool nfs_upgrade_install_state(void)
+{
+	struct upgrade_buf *buf = &upgrade_snapshot;
+	const struct nfs_upgrade_hdr *hdr;
+	const struct nfs_upgrade_state *srec;
+	nfs_client_id_t *clientid;
+	clientid4 *failed = NULL, *more;
+	uint32_t nfailed = 0, room = 0, installed = 0, i;
+	const char *body;
+	size_t off;
+	bool ok;
+
+	upgrade_wait_exit();
+
+	if (!upgrade_have_sockets)
+		return false;
+
+	if (upgrade_end.skipped != 0) {
+		/* Not worth carrying part of it */
+		LogEvent(COMPONENT_INIT,
+			 "Not all state was carried, clients will reclaim it");
+		gsh_free(buf->data);
+		memset(buf, 0, sizeof(*buf));
+		return false;
+	}
+
+	for (off = 0; off + sizeof(*hdr) <= buf->len;
+	     off += sizeof(*hdr) + hdr->length) {
+		hdr = (const struct nfs_upgrade_hdr *)(buf->data + off);
+		body = buf->data + off + sizeof(*hdr);
+		ok = true;
+
+		switch (hdr->type) {
+		case NFS_UPGRADE_CLIENT: {
+			const struct nfs_upgrade_client *crec =
+			    (const void *)body;
+
+			clientid = upgrade_install_client(crec,
+				body + nfs_upgrade_pad(sizeof(*crec)));
+			if (clientid == NULL) {
+				ok = false;
+				LogCrit(COMPONENT_INIT,
+					"Could not carry clientid %" PRIx64,
+					crec->clientid);
+				/* Its states fail in turn */
+				break;
+			}
+			/* Stateids after those carried */
+			if (crec->stateid_counter >
+			    clientid->cid_stateid_counter)
+				clientid->cid_stateid_counter =
+				    crec->stateid_counter;
+			dec_client_id_ref(clientid);
+			installed++;
+			break;
+		}
+
+		case NFS_UPGRADE_SESSION:
+			ok = upgrade_install_session((const void *)body);
+			if (!ok)
+				LogCrit(COMPONENT_INIT,
+					"Could not carry a session of clientid %"
+					PRIx64,
+					((const struct nfs_upgrade_session *)
+					 body)->clientid);
+			break;
+
+		case NFS_UPGRADE_OPEN:
+		case NFS_UPGRADE_LOCK:
+		case NFS_UPGRADE_DELEG: {
+			const char *fh, *owner, *open_owner;
+
+			srec = (const void *)body;
+			fh = body + nfs_upgrade_pad(sizeof(*srec));
+			owner = fh + nfs_upgrade_pad(srec->fh_len);
+			open_owner = owner + nfs_upgrade_pad(srec->owner_len);
+
+			ok = upgrade_add_state(hdr->type, srec, fh, owner,
+				open_owner,
+				(const void *)(open_owner +
+				nfs_upgrade_pad(srec->open_owner_len)));
+
+			if (!ok) {
+				LogCrit(COMPONENT_INIT,
+					"Could not carry a state of clientid %"
+					PRIx64, srec->clientid);
+				/* Record the client to expire */
+				if (nfailed == room) {
+					room = room ? room * 2 : 16;
+					more = gsh_realloc(failed,
+						room * sizeof(*failed));
+					if (more == NULL) {
+						room = nfailed;
+						break;
+					}
+					failed = more;
+				}
+				failed[nfailed++] = srec->clientid;
+			}
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		if (!ok)
+			upgrade_end.skipped++;
+	}
+
+	gsh_free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+
+	if (upgrade_end.skipped == 0) {
+		LogEvent(COMPONENT_INIT,
+			 "Carried over %" PRIu32
+			 " clients and their state, no grace period",
+			 installed);
+		gsh_free(failed);
+		return true;
+	}
+
+	/* The carried clients are on stable storage as well, so they may
+	 * reclaim as much as the rest.
+	 */
+	LogEvent(COMPONENT_INIT,
+		 "%" PRIu32 " items could not be carried, starting grace",
+		 upgrade_end.skipped);
+
+	nfs4_load_recov_clids(NULL);
+	nfs4_start_grace(NULL);
+
+	for (i = 0; i < nfailed; i++)
+		upgrade_expire(failed[i]);
+
+	gsh_free(failed);
+	return true;
+}
+
+/** @} */
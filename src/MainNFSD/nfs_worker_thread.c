@@ -60,6 +60,8 @@
 #include "export_mgr.h"
 #include "server_stats.h"
 #include "uid2grp.h"
+#include "nfs_capture.h"
+#include "sal_functions.h"
 
 #ifdef USE_LTTNG
 #include "gsh_lttng/nfs_rpc.h"
@@ -694,6 +696,74 @@ const nfs_function_desc_t *nfs_rpc_get_funcdesc(nfs_request_data_t *reqnfs)
 	return funcdesc;
 }
 
+/**
+ * @brief Queue-age deadline for a request
+ *
+ * A client that has not heard back within its retransmit timeout
+ * sends the request again, so once a request has waited that long in
+ * our queues executing it only competes with the retransmission and
+ * with fresh requests.  NFSv4.1 and later requests are never shed;
+ * the client waits on its session slot instead of retransmitting.
+ *
+ * @param[in] reqnfs The request
+ *
+ * @return The deadline in nanoseconds, 0 if the request must be run.
+ */
+static nsecs_elapsed_t nfs_rpc_queue_deadline(nfs_request_data_t *reqnfs)
+{
+	struct svc_req *svcreq = &reqnfs->req;
+	uint32_t udp_ms = nfs_param.core_param.queue_deadline.udp_ms;
+	uint32_t ms;
+
+	if (svcreq->rq_prog == nfs_param.core_param.program[P_NFS]
+	    && svcreq->rq_vers == NFS_V4) {
+		if (reqnfs->arg_nfs.arg_compound4.minorversion != 0)
+			return 0;
+		ms = nfs_param.core_param.queue_deadline.nfsv40_ms;
+	} else {
+		ms = nfs_param.core_param.queue_deadline.nfsv3_ms;
+	}
+
+	if (ms != 0 && udp_ms != 0 && udp_ms < ms
+	    && svc_get_xprt_type(reqnfs->xprt) == XPRT_UDP)
+		ms = udp_ms;
+
+	return ms * NS_PER_MSEC;
+}
+
+/**
+ * @brief Answer a shed NFSv4.0 COMPOUND with NFS4ERR_DELAY
+ *
+ * RFC 7530 does not let us silently drop a request on a connection we
+ * keep open, so rather than executing a stale COMPOUND we fail it as
+ * a whole and let the client retry when we are less busy.
+ *
+ * @param[in]  arg The COMPOUND arguments
+ * @param[out] res The result to fill in
+ */
+static void nfs4_shed_compound(nfs_arg_t *arg, nfs_res_t *res)
+{
+	utf8string *tag = &arg->arg_compound4.tag;
+
+	res->res_compound4.status = NFS4ERR_DELAY;
+	res->res_compound4.resarray.resarray_len = 0;
+	res->res_compound4.resarray.resarray_val = NULL;
+	res->res_compound4.tag.utf8string_len = 0;
+	res->res_compound4.tag.utf8string_val = NULL;
+
+	/* Keeping the same tag as in the arguments */
+	if (tag->utf8string_len > 0) {
+		res->res_compound4.tag.utf8string_val =
+		    gsh_malloc(tag->utf8string_len);
+		if (res->res_compound4.tag.utf8string_val != NULL) {
+			memcpy(res->res_compound4.tag.utf8string_val,
+			       tag->utf8string_val, tag->utf8string_len);
+			res->res_compound4.tag.utf8string_len =
+			    tag->utf8string_len;
+		}
+	}
+}
+
 /**
  * @brief Main RPC dispatcher routine
  *
@@ -839,6 +909,9 @@ static void nfs_rpc_execute(request_data_t *req,
 					 errno);
 				svcerr_systemerr(xprt, svcreq);
 			}
+			if (nfs_capture_active())
+				nfs_capture_rpc(req, res_nfs,
+						NFS_CAPTURE_DRC_HIT);
 			break;
 
 			/* Another thread owns the request */
@@ -882,6 +955,47 @@ static void nfs_rpc_execute(request_data_t *req,
 		goto freeargs;
 	}
 
+	/* Shed requests that sat in the queue past the point where the
+	 * client retransmits.  The DRC entry is deleted on the way out
+	 * so the retransmission, if it is queued behind us, gets
+	 * executed instead of finding us in progress; a retransmission
+	 * of a request we did execute hits the cached reply above.
+	 * A lone RENEW or SEQUENCE is always run: it is cheap, and
+	 * failing it lets the lease it was queued to keep run out.
+	 */
+	if (svcreq->rq_proc != NFSPROC_NULL
+	    && !(reqnfs->lookahead.flags & NFS_LOOKAHEAD_LEASE)) {
+		nsecs_elapsed_t deadline = nfs_rpc_queue_deadline(reqnfs);
+
+		if (deadline != 0 && op_ctx->queue_wait > deadline) {
+			LogDebug(COMPONENT_DISPATCH,
+				 "Shedding request xid=%u from %s, program %d, version %d, function %d, queued for %"
+				 PRIu64 " ms",
+				 svcreq->rq_xid, client_ip,
+				 (int)svcreq->rq_prog, (int)svcreq->rq_vers,
+				 (int)svcreq->rq_proc,
+				 op_ctx->queue_wait / NS_PER_MSEC);
+
+			if (svcreq->rq_prog !=
+			    nfs_param.core_param.program[P_NFS]
+			    || svcreq->rq_vers != NFS_V4) {
+				rc = NFS_REQ_DROP;
+				goto req_error;
+			}
+
+			nfs4_shed_compound(arg_nfs, res_nfs);
+			if (nfs_dupreq_delete(svcreq) != DUPREQ_SUCCESS) {
+				LogCrit(COMPONENT_DISPATCH,
+					"Attempt to delete duplicate request failed on line %d",
+					__LINE__);
+			}
+			/* Deleted, so do not let the DELAY reply be cached */
+			dpq_status = DUPREQ_ERROR;
+			rc = NFS_REQ_OK;
+			goto req_error;
+		}
+	}
+
 	/* Don't waste time for null or invalid ops
 	 * null op code in all valid protos == 0
 	 * and invalid protos all point to invalid_funcdesc
@@ -1283,6 +1397,10 @@ static void nfs_rpc_execute(request_data_t *req,
 	    || svcreq->rq_vers != NFS_V4)
 		server_stats_nfs_done(req, rc, false);
 
+	if (nfs_capture_active())
+		nfs_capture_rpc(req, res_nfs,
+				rc == NFS_REQ_DROP ? NFS_CAPTURE_DROPPED : 0);
+
 	/* If request is dropped, no return to the client */
 	if (rc == NFS_REQ_DROP) {
 		/* The request was dropped */
@@ -1422,6 +1540,9 @@ static void _9p_execute(request_data_t *req, nfs_worker_data_t *worker_data)
 		_9p_rdma_process_request(req9p, worker_data);
 #endif
 
+	if (nfs_capture_active() && req9p->pconn->trans_type == _9P_TCP)
+		nfs_capture_9p(req);
+
 	return;
 }				/* _9p_execute */
 
@@ -1554,6 +1675,9 @@ static void worker_run(struct fridgethr_context *ctx)
 
 		switch (nfsreq->rtype) {
 		case NFS_REQUEST:
+			if (nfsreq->r_u.nfs->lease_held)
+				release_queued_renewal(nfsreq->r_u.nfs->
+						       lease_held);
 			/* adjust req_cnt and return xprt ref */
 			gsh_xprt_unref(nfsreq->r_u.nfs->xprt,
 				       XPRT_PRIVATE_FLAG_DECREQ, __func__,
@@ -1610,6 +1734,28 @@ int worker_init(void)
 	return rc;
 }
 
+/**
+ * @brief Change the number of worker threads
+ *
+ * Surplus workers exit once they have finished their current request.
+ *
+ * @param[in] nb_worker New number of workers
+ *
+ * @return 0 or an errno.
+ */
+
+int worker_resize(uint32_t nb_worker)
+{
+	int rc = fridgethr_resize(worker_fridge, nb_worker, nb_worker,
+				  worker_run, NULL);
+
+	if (rc != 0)
+		LogMajor(COMPONENT_DISPATCH,
+			 "Unable to resize worker fridge: %d", rc);
+
+	return rc;
+}
+
 int worker_shutdown(void)
 {
 	int rc = fridgethr_sync_command(worker_fridge,
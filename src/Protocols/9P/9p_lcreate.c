@@ -67,6 +67,7 @@ int _9p_lcreate(struct _9p_request_data *req9p, void *worker_data,
 	int64_t fileid;
 	cache_inode_status_t cache_status;
 	fsal_openflags_t openflags = 0;
+	bool created;
 
 	/* Get data */
 	_9p_getptr(cursor, msgtag, u16);
@@ -103,17 +104,19 @@ int _9p_lcreate(struct _9p_request_data *req9p, void *worker_data,
 	op_ctx = &pfid->op_context;
 	snprintf(file_name, MAXNAMLEN, "%.*s", *name_len, name_str);
 
-	/* Create the file */
+	_9p_openflags2FSAL(flags, &openflags);
+
+	/* Create the file, already open */
 
-	/* BUGAZOMEU: @todo : the gid parameter is not used yet,
-	 * flags is not yet used */
+	/* BUGAZOMEU: @todo : the gid parameter is not used yet */
 	cache_status =
-	    cache_inode_create(pfid->pentry, file_name, REGULAR_FILE, *mode,
-			       NULL, &pentry_newfile);
+	    cache_inode_create_open(pfid->pentry, file_name, *mode, openflags,
+				    NULL, &pentry_newfile);
 	if (pentry_newfile == NULL)
 		return _9p_rerror(req9p, worker_data, msgtag,
 				  _9p_tools_errno(cache_status), plenout,
 				  preply);
+	created = cache_status == CACHE_INODE_SUCCESS;
 
 	cache_status =
 	    cache_inode_fileid(pentry_newfile, &fileid);
@@ -122,9 +125,9 @@ int _9p_lcreate(struct _9p_request_data *req9p, void *worker_data,
 				  _9p_tools_errno(cache_status), plenout,
 				  preply);
 
-	_9p_openflags2FSAL(flags, &openflags);
-
-	cache_status = cache_inode_open(pentry_newfile, openflags, 0);
+	/* A file that was already there still has to be opened */
+	if (!created)
+		cache_status = cache_inode_open(pentry_newfile, openflags, 0);
 	if (cache_status != CACHE_INODE_SUCCESS) {
 		/* Owner override..
 		 * deal with this stupid 04xy mode corner case */
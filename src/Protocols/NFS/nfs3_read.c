@@ -208,7 +208,7 @@ int nfs3_read(nfs_arg_t *arg,
 		rc = NFS_REQ_OK;
 		goto out;
 	} else {
-		data = gsh_malloc(size);
+		data = gsh_malloc_aligned(4096, size);
 		if (data == NULL) {
 			rc = NFS_REQ_DROP;
 			goto out;
@@ -226,6 +226,19 @@ int nfs3_read(nfs_arg_t *arg,
 			goto out;
 		}
 
+		if (state_lock_check_io(entry, NULL, false, offset, size)
+		    == STATE_LOCK_CONFLICT) {
+			state_share_anonymous_io_done(entry,
+						      OPEN4_SHARE_ACCESS_READ);
+			res->res_read3.status = NFS3ERR_JUKEBOX;
+			nfs_SetPostOpAttr(entry,
+					  &res->res_read3.READ3res_u.resfail.
+					  file_attributes);
+			rc = NFS_REQ_OK;
+			gsh_free(data);
+			goto out;
+		}
+
 		cache_status = cache_inode_rdwr(entry,
 						CACHE_INODE_READ,
 						offset,
@@ -230,6 +230,18 @@ int nfs3_write(nfs_arg_t *arg,
 			goto out;
 		}
 
+		if (state_lock_check_io(entry, NULL, true, offset, size)
+		    == STATE_LOCK_CONFLICT) {
+			state_share_anonymous_io_done(entry,
+						      OPEN4_SHARE_ACCESS_WRITE);
+			res->res_write3.status = NFS3ERR_JUKEBOX;
+			nfs_SetWccData(NULL, entry,
+				       &res->res_write3.WRITE3res_u.resfail.
+				       file_wcc);
+			rc = NFS_REQ_OK;
+			goto out;
+		}
+
 		cache_status =
 		    cache_inode_rdwr(entry, CACHE_INODE_WRITE, offset, size,
 				     &written_size, data, &eof_met, &sync);
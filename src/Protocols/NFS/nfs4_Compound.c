@@ -537,6 +537,8 @@ int nfs4_Compound(nfs_arg_t *arg,
 	data.minorversion = compound4_minor;
 	data.worker = worker;
 	data.req = req;
+	data.argarray = argarray;
+	data.argarray_len = argarray_len;
 
 	/* Building the client credential field */
 	if (nfs_rpc_req2client_cred(req, &(data.credential)) == -1)
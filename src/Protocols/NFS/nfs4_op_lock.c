@@ -563,6 +563,14 @@ int nfs4_op_lock(struct nfs_argop4 *op, compound_data_t *data,
 			Process_nfs4_conflict(&res_LOCK4->LOCK4res_u.denied,
 					      conflict_owner,
 					      &conflict_desc);
+
+			/* Let an NFSv4.1 client know when to ask again */
+			if (blocking == STATE_NFSV4_BLOCKING
+			    && data->minorversion > 0
+			    && nfs_param.nfsv4_param.blocking_lock_notify)
+				state_nfs4_lock_wait(data->current_entry,
+						     lock_owner, &lock_desc,
+						     &data->currentFH);
 		}
 
 		LogDebug(COMPONENT_NFS_V4_LOCK, "LOCK failed with status %s",
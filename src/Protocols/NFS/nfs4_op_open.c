@@ -171,9 +171,16 @@ static nfsstat4 open4_do_open(struct nfs_argop4 *op, compound_data_t *data,
 				       candidate_data.share.share_deny,
 				       SHARE_BYPASS_NONE);
 
-	/* Quick exit if there is any share conflict */
-	if (state_status != STATE_SUCCESS)
+	/* Quick exit if there is any share conflict.  Opens held by
+	 * courtesy clients are being revoked, so retry.
+	 */
+	if (state_status != STATE_SUCCESS) {
+		if (state_share_courtesy_conflict(data->current_entry,
+					candidate_data.share.share_access,
+					candidate_data.share.share_deny))
+			return NFS4ERR_DELAY;
 		return nfs4_Errno_state(state_status);
+	}
 
 	/* Check if any existing delegations conflict with this open.
 	 * Delegation recalls will be scheduled if there is a conflict.
@@ -609,6 +616,8 @@ static nfsstat4 open4_create(OPEN4args *arg, compound_data_t *data,
 	bool verf_provided = false;
 	/* Client provided verifier, split into two piees */
 	uint32_t verf_hi = 0, verf_lo = 0;
+	/* How the new file is opened */
+	fsal_openflags_t openflags;
 
 	*entry = NULL;
 	*created = false;
@@ -723,12 +732,20 @@ static nfsstat4 open4_create(OPEN4args *arg, compound_data_t *data,
 		cache_inode_create_set_verifier(&sattr, verf_hi, verf_lo);
 	}
 
-	cache_status = cache_inode_create(parent,
-					  filename,
-					  REGULAR_FILE,
-					  mode,
-					  NULL,
-					  &entry_newfile);
+	/* Create the file already open the way open4_do_open will want
+	 * it, with any times (the verifier) stored in the same step. */
+	if ((arg->share_access & OPEN4_SHARE_ACCESS_BOTH) ==
+	    OPEN4_SHARE_ACCESS_READ)
+		openflags = FSAL_O_READ;
+	else
+		openflags = FSAL_O_RDWR;
+
+	cache_status = cache_inode_create_open(parent,
+					       filename,
+					       mode,
+					       openflags,
+					       sattr_provided ? &sattr : NULL,
+					       &entry_newfile);
 
 	/* Complete failure */
 	if ((cache_status != CACHE_INODE_SUCCESS)
@@ -775,8 +792,10 @@ static nfsstat4 open4_create(OPEN4args *arg, compound_data_t *data,
 		/* Clear error code */
 		cache_status = CACHE_INODE_SUCCESS;
 	} else {
-		/* Successful creation */
+		/* Successful creation, times were set by the create */
 		*created = true;
+		if (sattr_provided)
+			FSAL_UNSET_MASK(sattr.mask, ATTR_ATIME | ATTR_MTIME);
 	}
 
 	if (sattr_provided) {
@@ -1468,6 +1487,12 @@ int nfs4_op_open(struct nfs_argop4 *op, compound_data_t *data,
 
 	res_OPEN4->OPEN4res_u.resok4.rflags |= OPEN4_RESULT_LOCKTYPE_POSIX;
 
+	/* Waiters on blocking locks are sent CB_NOTIFY_LOCK */
+	if (data->minorversion > 0
+	    && nfs_param.nfsv4_param.blocking_lock_notify)
+		res_OPEN4->OPEN4res_u.resok4.rflags |=
+		    OPEN4_RESULT_MAY_NOTIFY_LOCK;
+
 	LogFullDebug(COMPONENT_STATE, "NFS4 OPEN returning NFS4_OK");
 
 	/* regular exit */
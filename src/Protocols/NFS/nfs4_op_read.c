@@ -266,9 +266,6 @@ static int nfs4_read(struct nfs_argop4 *op, compound_data_t *data,
 			 * simplifies logic below.
 			 */
 			inc_state_t_ref(state_open);
-			/**
-			 * @todo FSF: need to check against existing locks
-			 */
 			break;
 
 		case STATE_TYPE_LOCK:
@@ -458,6 +455,11 @@ static int nfs4_read(struct nfs_argop4 *op, compound_data_t *data,
 		goto done;
 	}
 
+	res_READ4->status = nfs4_check_mandatory_lock(entry, state_found,
+						      false, offset, size);
+	if (res_READ4->status != NFS4_OK)
+		goto done;
+
 	/* Some work is to be done */
 	bufferdata = gsh_malloc_aligned(4096, size);
 
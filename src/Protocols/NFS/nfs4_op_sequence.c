@@ -34,6 +34,60 @@
 #include "sal_functions.h"
 #include "nfs_rpc_callback.h"
 #include "nfs_convert.h"
+#include "nfs_proto_functions.h"
+
+/**
+ * @brief Check whether a compound can safely be executed again
+ *
+ * A retry of a compound that changes state or the namespace must get
+ * the original reply, so its reply is cached even when the client did
+ * not set sa_cachethis.  Reads, lookups and the like can simply be
+ * redone.
+ *
+ * @param[in] data Compound request's data
+ *
+ * @return true if every operation is idempotent.
+ */
+static bool nfs4_compound_idempotent(compound_data_t *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < data->argarray_len; i++) {
+		switch (data->argarray[i].argop) {
+		case NFS4_OP_SEQUENCE:
+		case NFS4_OP_ACCESS:
+		case NFS4_OP_GETATTR:
+		case NFS4_OP_GETFH:
+		case NFS4_OP_LOOKUP:
+		case NFS4_OP_LOOKUPP:
+		case NFS4_OP_NVERIFY:
+		case NFS4_OP_PUTFH:
+		case NFS4_OP_PUTPUBFH:
+		case NFS4_OP_PUTROOTFH:
+		case NFS4_OP_READ:
+		case NFS4_OP_READDIR:
+		case NFS4_OP_READLINK:
+		case NFS4_OP_RESTOREFH:
+		case NFS4_OP_SAVEFH:
+		case NFS4_OP_SECINFO:
+		case NFS4_OP_VERIFY:
+		case NFS4_OP_WRITE:
+		case NFS4_OP_COMMIT:
+		case NFS4_OP_GETDEVICEINFO:
+		case NFS4_OP_GETDEVICELIST:
+		case NFS4_OP_SECINFO_NO_NAME:
+		case NFS4_OP_TEST_STATEID:
+		case NFS4_OP_READ_PLUS:
+		case NFS4_OP_SEEK:
+		case NFS4_OP_IO_ADVISE:
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
 
 /**
  * @brief the NFS4_OP_SEQUENCE operation
@@ -119,15 +173,8 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 	    arg_SEQUENCE4->sa_sequenceid) {
 		if (session->slots[arg_SEQUENCE4->sa_slotid].sequence ==
 		    arg_SEQUENCE4->sa_sequenceid) {
-#if IMPLEMENT_CACHETHIS
-			/** @todo
-			 *
-			 * Ganesha always caches result anyway so ignore
-			 * cachethis
-			 */
 			if (session->slots[arg_SEQUENCE4->sa_slotid]
 			    .cache_used) {
-#endif
 				/* Replay operation through the DRC */
 				data->use_drc = true;
 				data->cached_res =
@@ -146,9 +193,9 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 				dec_session_ref(session);
 				res_SEQUENCE4->sr_status = NFS4_OK;
 				return res_SEQUENCE4->sr_status;
-#if IMPLEMENT_CACHETHIS
 			} else {
-				/* Illegal replay */
+				/* The client did not ask for the reply to
+				 * be cached, so it cannot be replayed */
 				PTHREAD_MUTEX_unlock(&session->
 					slots[arg_SEQUENCE4->sa_slotid].lock);
 				dec_session_ref(session);
@@ -161,7 +208,6 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 							    sr_status));
 				return res_SEQUENCE4->sr_status;
 			}
-#endif
 		}
 
 		PTHREAD_MUTEX_unlock(&session->
@@ -202,10 +248,9 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 		    SEQ4_STATUS_CB_PATH_DOWN;
 	}
 
-#if IMPLEMENT_CACHETHIS
-/* Ganesha always caches result anyway so ignore cachethis */
-	if (arg_SEQUENCE4->sa_cachethis) {
-#endif
+	/* Non-idempotent compounds are cached whatever the client says,
+	 * a retry must not be executed twice. */
+	if (arg_SEQUENCE4->sa_cachethis || !nfs4_compound_idempotent(data)) {
 		data->cached_res =
 		    &session->slots[arg_SEQUENCE4->sa_slotid].cached_result;
 		session->slots[arg_SEQUENCE4->sa_slotid].cache_used = true;
@@ -213,8 +258,18 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 		LogFullDebugAlt(COMPONENT_SESSIONS, COMPONENT_CLIENTID,
 				"Use sesson slot %" PRIu32 "=%p for DRC",
 				arg_SEQUENCE4->sa_slotid, data->cached_res);
-#if IMPLEMENT_CACHETHIS
 	} else {
+		struct COMPOUND4res_extended *cached =
+		    &session->slots[arg_SEQUENCE4->sa_slotid].cached_result;
+
+		/* Only the sequence id is kept.  Release the previous
+		 * reply now rather than holding its buffers until the
+		 * slot next caches one. */
+		if (cached->res_cached) {
+			cached->res_cached = false;
+			nfs4_Compound_Free((nfs_res_t *) cached);
+		}
+
 		data->cached_res = NULL;
 		session->slots[arg_SEQUENCE4->sa_slotid].cache_used = false;
 
@@ -222,7 +277,6 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 				"Don't use sesson slot %" PRIu32
 				"=NULL for DRC", arg_SEQUENCE4->sa_slotid);
 	}
-#endif
 
 	PTHREAD_MUTEX_unlock(&session->slots[arg_SEQUENCE4->sa_slotid].lock);
 
@@ -233,7 +233,6 @@ static int nfs4_write(struct nfs_argop4 *op, compound_data_t *data,
 			 * simplifies logic below.
 			 */
 			inc_state_t_ref(state_open);
-			/** @todo FSF: need to check against existing locks */
 			break;
 
 		case STATE_TYPE_LOCK:
@@ -391,6 +390,11 @@ static int nfs4_write(struct nfs_argop4 *op, compound_data_t *data,
 		goto done;
 	}
 
+	res_WRITE4->status = nfs4_check_mandatory_lock(entry, state_found,
+						       true, offset, size);
+	if (res_WRITE4->status != NFS4_OK)
+		goto done;
+
 	if (arg_WRITE4->stable == UNSTABLE4)
 		sync = false;
 	else
@@ -1007,7 +1007,6 @@ static fattr_xdr_result encode_filehandle(XDR *xdr,
 static fattr_xdr_result decode_filehandle(XDR *xdr,
 					  struct xdr_attrs_args *args)
 {
-	file_handle_v4_t *fh;
 	uint32_t fhlen = 0, pos;
 
 	if (args->hdl4 == NULL || args->hdl4->nfs_fh4_val == NULL) {
@@ -1017,12 +1016,11 @@ static fattr_xdr_result decode_filehandle(XDR *xdr,
 		if (!xdr_setpos(xdr, pos + fhlen))
 			return FATTR_XDR_FAILED;
 	} else {
+		/* Another server's handle, kept as it came, as from GETFH */
 		if (!inline_xdr_bytes
 		    (xdr, &args->hdl4->nfs_fh4_val, &args->hdl4->nfs_fh4_len,
 		     NFS4_FHSIZE))
 			return FATTR_XDR_FAILED;
-		fh = (file_handle_v4_t *)args->hdl4->nfs_fh4_val;
-		fh->id.exports = ntohs(fh->id.exports);
 	}
 
 	return FATTR_XDR_SUCCESS;
@@ -4097,6 +4095,26 @@ int nfs4_Fattr_To_FSAL_attr(struct attrlist *FSAL_attr, fattr4 *Fattr,
 	return Fattr4_To_FSAL_attr(FSAL_attr, Fattr, NULL, NULL, data);
 }
 
+/**
+ * @brief Convert NFSv4 attributes and file handle to an FSAL attribute list
+ *
+ * As nfs4_Fattr_To_FSAL_attr, also decoding FATTR4_FILEHANDLE into a
+ * buffer supplied by the caller.
+ *
+ * @param[out]    FSAL_attr FSAL attributes
+ * @param[in]     Fattr     NFSv4 attributes
+ * @param[in,out] hdl4      Buffer of NFS4_FHSIZE bytes for the handle;
+ *                          nfs_fh4_len is left alone if Fattr has none
+ *
+ * @return NFS4_OK if successful, NFS4ERR codes if not.
+ */
+int nfs4_Fattr_To_FSAL_attr_fh(struct attrlist *FSAL_attr, fattr4 *Fattr,
+			       nfs_fh4 *hdl4)
+{
+	memset(FSAL_attr, 0, sizeof(struct attrlist));
+	return Fattr4_To_FSAL_attr(FSAL_attr, Fattr, hdl4, NULL, NULL);
+}
+
 /**
  *
  * nfs4_Fattr_To_fsinfo: Decode filesystem info out of NFSv4 attributes.
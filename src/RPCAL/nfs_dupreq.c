@@ -49,6 +49,7 @@
 #include "abstract_mem.h"
 #include "gsh_intrinsic.h"
 #include "wait_queue.h"
+#include "mem_governor.h"
 
 #define DUPREQ_BAD_ADDR1 0x01	/* safe for marked pointers, etc */
 #define DUPREQ_NOCACHE   0x02
@@ -82,6 +83,31 @@ struct drc_st {
 
 static struct drc_st *drc_st;
 
+/**
+ * @brief Number of dupreq entries in all DRCs, for the memory governor
+ */
+static uint64_t dupreq_entries;
+
+/**
+ * @brief Approximate bytes held by one cached request
+ */
+#define DUPREQ_ENTRY_BYTES (sizeof(dupreq_entry_t) + sizeof(nfs_res_t))
+
+static uint64_t dupreq_mem_usage(void)
+{
+	return atomic_fetch_uint64_t(&dupreq_entries) * DUPREQ_ENTRY_BYTES;
+}
+
+/* The DRC gives memory back lazily, by retiring entries in
+ * nfs_dupreq_finish while over budget, so there is no reclaim
+ * callback.
+ */
+static struct mem_gov_consumer dupreq_mem_consumer = {
+	.name = "DRC",
+	.usage = dupreq_mem_usage,
+	.budget = MEM_GOV_UNLIMITED
+};
+
 /**
  * @brief Comparison function for duplicate request entries.
  *
@@ -306,6 +332,10 @@ void dupreq2_pkginit(void)
 
 	/* UDP DRC is global, shared */
 	init_shared_drc();
+
+	dupreq_mem_consumer.weight = mem_gov_param.drc_weight;
+	dupreq_mem_consumer.floor = mem_gov_param.drc_floor;
+	mem_governor_register(&dupreq_mem_consumer);
 }
 
 /**
@@ -374,7 +404,7 @@ static inline drc_t *alloc_tcp_drc(enum drc_type dtype)
 	drc->maxsize = nfs_param.core_param.drc.tcp.size;
 	drc->cachesz = nfs_param.core_param.drc.tcp.cachesz;
 	drc->npart = nfs_param.core_param.drc.tcp.npart;
-	drc->hiwat = nfs_param.core_param.drc.udp.hiwat;
+	drc->hiwat = nfs_param.core_param.drc.tcp.hiwat;
 
 	PTHREAD_MUTEX_init(&drc->mtx, NULL);
 
@@ -591,6 +621,11 @@ nfs_dupreq_get_drc(struct svc_req *req)
 					--(drc_st->tcp_drc_recycle_qlen);
 					tdrc->flags &= ~DRC_FLAG_RECYCLE;
 				}
+				/* Limits may have been reloaded since */
+				tdrc->maxsize =
+				    nfs_param.core_param.drc.tcp.size;
+				tdrc->hiwat =
+				    nfs_param.core_param.drc.tcp.hiwat;
 				drc = tdrc;
 				LogFullDebug(COMPONENT_DUPREQ,
 					     "recycle TCP DRC=%p for xprt=%p",
@@ -789,6 +824,7 @@ static inline dupreq_entry_t *alloc_dupreq(void)
 	memset(dv, 0, sizeof(dupreq_entry_t));	/* XXX pool_zalloc */
 	gsh_mutex_init(&dv->mtx, NULL);
 	TAILQ_INIT_ENTRY(dv, fifo_q);
+	atomic_inc_uint64_t(&dupreq_entries);
 out:
 	return dv;
 }
@@ -811,6 +847,7 @@ static inline void nfs_dupreq_free_dupreq(dupreq_entry_t *dv)
 	}
 	PTHREAD_MUTEX_destroy(&dv->mtx);
 	pool_free(dupreq_pool, dv);
+	atomic_dec_uint64_t(&dupreq_entries);
 }
 
 /**
@@ -871,6 +908,11 @@ static inline bool drc_should_retire(drc_t *drc)
 	if (unlikely(drc->size > drc->maxsize))
 		return true;
 
+	/* nor the memory governor's budget, when under pressure */
+	if (unlikely(dupreq_mem_usage() >
+		     mem_gov_budget(&dupreq_mem_consumer)))
+		return true;
+
 	/* otherwise, are we permitted to retire requests */
 	if (unlikely(drc->retwnd > 0))
 		return false;
@@ -1285,6 +1327,38 @@ void nfs_dupreq_rele(struct svc_req *req, const nfs_function_desc_t *func)
 	return;
 }
 
+/**
+ * @brief Apply reloaded DRC limits
+ *
+ * The shared UDP DRC takes the new size and high water mark at once,
+ * per-connection DRCs as they are created or recycled.  The number
+ * of partitions and the cache size of a DRC are fixed when it is
+ * made.
+ */
+void dupreq2_reconfig(void)
+{
+	drc_t *drc = &drc_st->udp_drc;
+
+	DRC_ST_LOCK();
+	drc_st->expire_delta = nfs_param.core_param.drc.tcp.recycle_expire_s;
+	DRC_ST_UNLOCK();
+
+	PTHREAD_MUTEX_lock(&drc->mtx);
+	drc->maxsize = nfs_param.core_param.drc.udp.size;
+	drc->hiwat = nfs_param.core_param.drc.udp.hiwat;
+	PTHREAD_MUTEX_unlock(&drc->mtx);
+}
+
+/**
+ * @brief The shared UDP DRC
+ *
+ * @return The DRC, which lives as long as the package.
+ */
+drc_t *dupreq2_udp_drc(void)
+{
+	return &drc_st->udp_drc;
+}
+
 /**
  * @brief Shutdown the dupreq2 package.
  */
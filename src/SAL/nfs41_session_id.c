@@ -37,6 +37,7 @@
 #include "config.h"
 #include "nfs_core.h"
 #include "sal_functions.h"
+#include "nfs_proto_functions.h"
 
 /**
  * @brief Pool for allocating session data
@@ -229,6 +230,24 @@ void nfs41_Build_sessionid(clientid4 *clientid, char *sessionid)
 	memcpy(sessionid + sizeof(clientid4), &seq, sizeof(seq));
 }
 
+/**
+ * @brief Keep new sessionids clear of one already in use
+ *
+ * For sessions carried over from the server this one took over from.
+ *
+ * @param[in] sessionid The sessionid in use
+ */
+
+void nfs41_Reserve_sessionid(char *sessionid)
+{
+	uint64_t seq;
+
+	memcpy(&seq, sessionid + sizeof(clientid4), sizeof(seq));
+
+	if (seq > atomic_fetch_uint64_t(&global_sequence))
+		atomic_store_uint64_t(&global_sequence, seq);
+}
+
 int32_t inc_session_ref(nfs41_session_t *session)
 {
 	int32_t refcnt = atomic_inc_int32_t(&session->refcount);
@@ -252,8 +271,17 @@ int32_t dec_session_ref(nfs41_session_t *session)
 		dec_client_id_ref(session->clientid_record);
 		/* Destroy this session's mutexes and condition variable */
 
-		for (i = 0; i < NFS41_NB_SLOTS; i++)
+		/* Release any replies still cached in the slots */
+		for (i = 0; i < NFS41_NB_SLOTS; i++) {
+			struct COMPOUND4res_extended *cached =
+			    &session->slots[i].cached_result;
+
+			if (cached->res_cached) {
+				cached->res_cached = false;
+				nfs4_Compound_Free((nfs_res_t *) cached);
+			}
 			PTHREAD_MUTEX_destroy(&session->slots[i].lock);
+		}
 
 		PTHREAD_COND_destroy(&session->cb_cond);
 		PTHREAD_MUTEX_destroy(&session->cb_mutex);
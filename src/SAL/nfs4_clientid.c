@@ -833,6 +833,8 @@ bool nfs_client_id_expire(nfs_client_id_t *clientid, bool make_stale)
 		return false;
 	}
 
+	end_courtesy(clientid);
+
 	if (isDebug(COMPONENT_CLIENTID)) {
 		display_client_id_rec(&dspbuf, clientid);
 		LogDebug(COMPONENT_CLIENTID, "Expiring {%s}", str);
@@ -1287,6 +1289,22 @@ clientid4 new_clientid(void)
 	return newid + (epoch_low << (clientid4) 32);
 }
 
+/**
+ * @brief Keep new clientids clear of one already in use
+ *
+ * For clientids carried over from the server this one took over from.
+ *
+ * @param[in] clientid The clientid in use
+ */
+
+void reserve_clientid(clientid4 clientid)
+{
+	uint32_t counter = (uint32_t) clientid;
+
+	if (counter > atomic_fetch_uint32_t(&clientid_counter))
+		atomic_store_uint32_t(&clientid_counter, counter);
+}
+
 /**
  * @brief Builds a new verifier4 value.
  *
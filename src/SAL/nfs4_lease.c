@@ -40,6 +40,12 @@
 #include "nfs4.h"
 #include "sal_functions.h"
 
+/**
+ * @brief Number of courtesy clients
+ */
+
+static uint32_t courtesy_clients;
+
 /**
  * @brief Return the lifetime of a valid lease
  *
@@ -112,6 +118,16 @@ int reserve_lease(nfs_client_id_t *clientid)
 
 	valid = _valid_lease(clientid);
 
+	if (valid == 0 && clientid->cid_courtesy &&
+	    clientid->cid_confirmed != EXPIRED_CLIENT_ID) {
+		/* Came back before anyone wanted its state */
+		LogInfo(COMPONENT_CLIENTID,
+			"Courtesy clientid %" PRIx64 " renewed its lease",
+			clientid->cid_clientid);
+		end_courtesy(clientid);
+		valid = nfs_param.nfsv4_param.lease_lifetime;
+	}
+
 	if (valid != 0)
 		clientid->cid_lease_reservations++;
 
@@ -132,8 +148,8 @@ int reserve_lease(nfs_client_id_t *clientid)
  * @brief Release a lease reservation and update lease.
  *
  * Lease reservation prevents any other thread from expiring the lease. This
- * function releases the lease reservation. Before releasing the last
- * reservation, cid_last_renew will be updated.
+ * function releases the lease reservation and updates cid_last_renew, so
+ * the lease runs from the last release.
  *
  * @param[in] clientid Clientid record to update
  *
@@ -144,9 +160,10 @@ void update_lease(nfs_client_id_t *clientid)
 {
 	clientid->cid_lease_reservations--;
 
-	/* Renew lease when last reservation is released */
-	if (clientid->cid_lease_reservations == 0)
-		clientid->cid_last_renew = time(NULL);
+	/* Renew lease, even if a queued renewal still holds it, as that
+	 * one is released without renewing.
+	 */
+	clientid->cid_last_renew = time(NULL);
 
 	if (isFullDebug(COMPONENT_CLIENTID)) {
 		char str[LOG_BUFF_LEN];
@@ -157,4 +174,253 @@ void update_lease(nfs_client_id_t *clientid)
 	}
 }
 
+/**
+ * @brief Spare a client from the reaper while its renewal is queued
+ *
+ * Called when a lone RENEW or SEQUENCE has been decoded.  A renewal
+ * received before the lease ran out must not lose the race with the
+ * reaper just because the workers have not got to it yet.
+ *
+ * @param[in] args The decoded compound
+ *
+ * @return The client, referenced and with its lease reserved, or NULL.
+ */
+
+nfs_client_id_t *hold_queued_renewal(COMPOUND4args *args)
+{
+	nfs_argop4 *op = &args->argarray.argarray_val[0];
+	nfs_client_id_t *clientid;
+	nfs41_session_t *session;
+	int valid;
+
+	switch (op->argop) {
+	case NFS4_OP_RENEW:
+		if (nfs_client_id_get_confirmed(op->nfs_argop4_u.oprenew.
+						clientid,
+						&clientid) != CLIENT_ID_SUCCESS)
+			return NULL;
+		break;
+	case NFS4_OP_SEQUENCE:
+		if (!nfs41_Session_Get_Pointer(op->nfs_argop4_u.opsequence.
+					       sa_sessionid, &session))
+			return NULL;
+		clientid = session->clientid_record;
+		inc_client_id_ref(clientid);
+		dec_session_ref(session);
+		break;
+	default:
+		return NULL;
+	}
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	valid = reserve_lease(clientid);
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	if (!valid) {
+		dec_client_id_ref(clientid);
+		return NULL;
+	}
+
+	return clientid;
+}
+
+/**
+ * @brief Release the lease held by hold_queued_renewal
+ *
+ * Called once the request is done with, however it ended.  The lease
+ * is not renewed here: a RENEW or SEQUENCE that succeeded renewed it
+ * through its own update_lease, and one that failed, or was never
+ * executed because its transport went away, must not.
+ *
+ * @param[in] clientid Client returned by hold_queued_renewal
+ */
+
+void release_queued_renewal(nfs_client_id_t *clientid)
+{
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	clientid->cid_lease_reservations--;
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	dec_client_id_ref(clientid);
+}
+
+/**
+ * @brief Decide whether a client whose lease lapsed becomes or stays
+ *        a courtesy client
+ *
+ * Called by the reaper in place of expiring the client.  A courtesy
+ * client keeps its opens, locks and delegations until another client
+ * conflicts with them, the server runs short of resources or
+ * Courtesy_Max_Time passes.  If it comes back first, reserve_lease
+ * revives it.
+ *
+ * The caller must hold cid_mutex.
+ *
+ * @param[in] clientid Client whose lease is no longer valid
+ *
+ * @retval true if the client is kept.
+ * @retval false if it should be expired.
+ */
+
+bool keep_courtesy_client(nfs_client_id_t *clientid)
+{
+	time_t lapsed = clientid->cid_last_renew +
+			nfs_param.nfsv4_param.lease_lifetime;
+
+	if (!nfs_param.nfsv4_param.courteous_server ||
+	    clientid->cid_confirmed != CONFIRMED_CLIENT_ID ||
+	    time(NULL) - lapsed > nfs_param.nfsv4_param.courtesy_max_time)
+		goto expire;
+
+	/* A client without state has nothing worth keeping.  The lists
+	 * are only looked at, so no owner lock is needed.
+	 */
+	if (glist_empty(&clientid->cid_openowners) &&
+	    glist_empty(&clientid->cid_lockowners) &&
+	    glist_empty(&clientid->cid_owner.so_owner.so_nfs4_owner
+			 .so_state_list))
+		goto expire;
+
+	if (clientid->cid_courtesy)
+		return true;
+
+	if (atomic_inc_uint32_t(&courtesy_clients) >
+	    nfs_param.nfsv4_param.courtesy_max_clients) {
+		atomic_dec_uint32_t(&courtesy_clients);
+		goto expire;
+	}
+
+	clientid->cid_courtesy = true;
+
+	LogInfo(COMPONENT_CLIENTID,
+		"Lease of clientid %" PRIx64
+		" lapsed, keeping its state as a courtesy",
+		clientid->cid_clientid);
+
+	return true;
+
+ expire:
+
+	end_courtesy(clientid);
+	return false;
+}
+
+/**
+ * @brief Stop treating a client as a courtesy client
+ *
+ * The caller must hold cid_mutex.
+ *
+ * @param[in] clientid Client record
+ */
+
+void end_courtesy(nfs_client_id_t *clientid)
+{
+	if (!clientid->cid_courtesy)
+		return;
+
+	clientid->cid_courtesy = false;
+	atomic_dec_uint32_t(&courtesy_clients);
+}
+
+/**
+ * @brief Expire a courtesy client whose state is in the way
+ *
+ * Nothing is done if the client renewed its lease in the meantime.
+ *
+ * The caller must hold no state or client locks.
+ *
+ * @param[in] clientid Client record, referenced by the caller
+ *
+ * @retval true if the client was expired.
+ * @retval false if it is no longer a courtesy client.
+ */
+
+bool expire_courtesy_client(nfs_client_id_t *clientid)
+{
+	nfs_client_record_t *record;
+	bool expire = false;
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+
+	if (!clientid->cid_courtesy) {
+		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+		return false;
+	}
+
+	record = clientid->cid_client_record;
+	inc_client_record_ref(record);
+
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	PTHREAD_MUTEX_lock(&record->cr_mutex);
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+
+	if (clientid->cid_courtesy) {
+		/* Once off, reserve_lease can no longer revive it */
+		expire = !valid_lease(clientid);
+		end_courtesy(clientid);
+	}
+
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	if (expire) {
+		LogInfo(COMPONENT_CLIENTID,
+			"Expiring courtesy clientid %" PRIx64
+			", its state conflicts",
+			clientid->cid_clientid);
+		nfs_client_id_expire(clientid, false);
+	}
+
+	PTHREAD_MUTEX_unlock(&record->cr_mutex);
+
+	dec_client_record_ref(record);
+
+	return expire;
+}
+
+/**
+ * @brief A courtesy client to expire from the async fridge
+ */
+
+struct courtesy_expire {
+	state_async_queue_t ce_queue;	/*< For state_async_schedule */
+	nfs_client_id_t *ce_clientid;	/*< Client, referenced */
+};
+
+static void courtesy_expire_func(state_async_queue_t *arg)
+{
+	struct courtesy_expire *ce =
+	    container_of(arg, struct courtesy_expire, ce_queue);
+
+	expire_courtesy_client(ce->ce_clientid);
+	dec_client_id_ref(ce->ce_clientid);
+	gsh_free(ce);
+}
+
+/**
+ * @brief Queue a courtesy client to be expired
+ *
+ * For callers holding a file's state_lock, which the expiry takes.
+ *
+ * @param[in] clientid Client record
+ */
+
+void expire_courtesy_client_async(nfs_client_id_t *clientid)
+{
+	struct courtesy_expire *ce;
+
+	ce = gsh_malloc(sizeof(*ce));
+	if (ce == NULL)
+		return;
+
+	ce->ce_clientid = clientid;
+	inc_client_id_ref(clientid);
+	ce->ce_queue.state_async_func = courtesy_expire_func;
+
+	if (state_async_schedule(&ce->ce_queue) != STATE_SUCCESS) {
+		dec_client_id_ref(clientid);
+		gsh_free(ce);
+	}
+}
+
 /** @} */
@@ -41,6 +41,7 @@
 #include "sal_functions.h"
 #include "nfs_proto_functions.h"
 #include "nfs_core.h"
+#include "keyed_hash.h"
 
 hash_table_t *ht_nfs4_owner;
 
@@ -235,9 +236,24 @@ int compare_nfs4_owner_key(struct gsh_buffdesc *buff1,
 }
 
 /**
- * @brief Compute the hash index for an NFSv4 owner
+ * @brief Hash an NFSv4 owner key
+ *
+ * The owner string is hashed under the client id and owner type, so
+ * identical owner strings from different clients do not collide.
+ *
+ * @param[in] pkey The owner
  *
- * @todo Destroy this function and replace it with a real hash.
+ * @return 64-bit keyed hash.
+ */
+static inline uint64_t nfs4_owner_hash(state_owner_t *pkey)
+{
+	return keyed_hash(pkey->so_owner_val, pkey->so_owner_len,
+			  pkey->so_owner.so_nfs4_owner.so_clientid ^
+			  ((uint64_t) pkey->so_type << 56));
+}
+
+/**
+ * @brief Compute the hash index for an NFSv4 owner
  *
  * @param[in] hparam Hash parameter
  * @param[in] key    The key
@@ -247,23 +263,7 @@ int compare_nfs4_owner_key(struct gsh_buffdesc *buff1,
 uint32_t nfs4_owner_value_hash_func(hash_parameter_t *hparam,
 				    struct gsh_buffdesc *key)
 {
-	unsigned int sum = 0;
-	unsigned int i = 0;
-	unsigned char c = 0;
-	uint32_t res = 0;
-
-	state_owner_t *pkey = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < pkey->so_owner_len; i++) {
-		c = ((char *)pkey->so_owner_val)[i];
-		sum += c;
-	}
-
-	res =
-	    ((uint32_t) pkey->so_owner.so_nfs4_owner.so_clientid +
-	     (uint32_t) sum + pkey->so_owner_len +
-	     (uint32_t) pkey->so_type) % (uint32_t) hparam->index_size;
+	uint32_t res = nfs4_owner_hash(key->addr) % hparam->index_size;
 
 	if (isDebug(COMPONENT_HASHTABLE))
 		LogFullDebug(COMPONENT_STATE, "value = %" PRIu32, res);
@@ -274,8 +274,6 @@ uint32_t nfs4_owner_value_hash_func(hash_parameter_t *hparam,
 /**
  * @brief Compute the RBT hash for an NFSv4 owner
  *
- * @todo Destroy this function and replace it with a real hash.
- *
  * @param[in] hparam Hash parameter
  * @param[in] key    The key
  *
@@ -284,22 +282,7 @@ uint32_t nfs4_owner_value_hash_func(hash_parameter_t *hparam,
 uint64_t nfs4_owner_rbt_hash_func(hash_parameter_t *hparam,
 				  struct gsh_buffdesc *key)
 {
-	state_owner_t *pkey = key->addr;
-
-	unsigned int sum = 0;
-	unsigned int i = 0;
-	unsigned char c = 0;
-	uint64_t res = 0;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < pkey->so_owner_len; i++) {
-		c = ((char *)pkey->so_owner_val)[i];
-		sum += c;
-	}
-
-	res =
-	    (uint64_t) pkey->so_owner.so_nfs4_owner.so_clientid +
-	    (uint64_t) sum + pkey->so_owner_len + (uint64_t) pkey->so_type;
+	uint64_t res = nfs4_owner_hash(key->addr);
 
 	if (isDebug(COMPONENT_HASHTABLE))
 		LogFullDebug(COMPONENT_STATE, "rbt = %" PRIu64, res);
@@ -215,6 +215,9 @@ state_status_t state_add_impl(cache_entry_t *entry, enum state_type state_type,
 	PTHREAD_MUTEX_unlock(&pnew_state->state_mutex);
 	PTHREAD_MUTEX_unlock(&owner_input->so_mutex);
 
+	if (state_type == STATE_TYPE_LAYOUT)
+		atomic_inc_uint32_t(&owner_input->so_owner.so_nfs4_owner
+				    .so_clientrec->curr_layouts);
 
 #ifdef DEBUG_SAL
 	PTHREAD_MUTEX_lock(&all_state_v4_mutex);
@@ -228,6 +231,12 @@ state_status_t state_add_impl(cache_entry_t *entry, enum state_type state_type,
 	    pnew_state->state_data.deleg.sd_type == OPEN_DELEGATE_WRITE)
 		entry->object.file.write_delegated = true;
 
+	/* Count the entries a CB_RECALL_ANY could unpin */
+	if ((state_type == STATE_TYPE_DELEG ||
+	     state_type == STATE_TYPE_LAYOUT) &&
+	    entry->object.file.recallable_states++ == 0)
+		atomic_inc_uint64_t(&recall_any_pinned);
+
 	/* Copy the result */
 	*state = pnew_state;
 
@@ -351,6 +360,14 @@ void state_del_locked(state_t *state)
 	PTHREAD_MUTEX_unlock(&state->state_mutex);
 
 	if (owner != NULL) {
+		if (state->state_type == STATE_TYPE_LAYOUT) {
+			nfs_client_id_t *clientid =
+			    owner->so_owner.so_nfs4_owner.so_clientrec;
+
+			atomic_dec_uint32_t(&clientid->curr_layouts);
+			atomic_inc_uint32_t(&clientid->cid_returned);
+		}
+
 		/* Remove from list of states owned by owner and
 		 * release the state owner reference.
 		 */
@@ -383,6 +400,11 @@ void state_del_locked(state_t *state)
 	    state->state_data.deleg.sd_type == OPEN_DELEGATE_WRITE)
 		entry->object.file.write_delegated = false;
 
+	if ((state->state_type == STATE_TYPE_DELEG ||
+	     state->state_type == STATE_TYPE_LAYOUT) &&
+	    --entry->object.file.recallable_states == 0)
+		atomic_dec_uint64_t(&recall_any_pinned);
+
 	/* Remove from list of states for a particular export.
 	 * In this case, it is safe to look at state_export without yet
 	 * holding the state_mutex because this is the only place where it
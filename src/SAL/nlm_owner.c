@@ -44,6 +44,7 @@
 #include "log.h"
 #include "client_mgr.h"
 #include "fsal.h"
+#include "keyed_hash.h"
 
 /**
  * @brief NSM clients
@@ -199,9 +200,23 @@ int compare_nsm_client_key(struct gsh_buffdesc *buff1,
 }
 
 /**
- * @brief Calculate hash index for an NSM key
+ * @brief Hash an NSM key
  *
- * @todo Replace with a good hash function.
+ * @param[in] pkey The NSM client
+ *
+ * @return 64-bit keyed hash.
+ */
+static inline uint64_t nsm_client_hash(state_nsm_client_t *pkey)
+{
+	if (nfs_param.core_param.nsm_use_caller_name)
+		return keyed_hash(pkey->ssc_nlm_caller_name,
+				  pkey->ssc_nlm_caller_name_len, 0);
+
+	return keyed_hash_u64((uintptr_t) pkey->ssc_client);
+}
+
+/**
+ * @brief Calculate hash index for an NSM key
  *
  * @param[in]  hparam Hash params
  * @param[out] key    Key to hash
@@ -211,36 +226,17 @@ int compare_nsm_client_key(struct gsh_buffdesc *buff1,
 uint32_t nsm_client_value_hash_func(hash_parameter_t *hparam,
 				    struct gsh_buffdesc *key)
 {
-	unsigned long res;
-	state_nsm_client_t *pkey = key->addr;
-
-	if (nfs_param.core_param.nsm_use_caller_name) {
-		unsigned int sum = 0;
-		unsigned int i;
-
-		/* Compute the sum of all the characters */
-		for (i = 0; i < pkey->ssc_nlm_caller_name_len; i++)
-			sum += (unsigned char)pkey->ssc_nlm_caller_name[i];
-
-		res =
-		    (unsigned long)sum +
-		    (unsigned long)pkey->ssc_nlm_caller_name_len;
-	} else {
-		res = (unsigned long) pkey->ssc_client;
-	}
+	uint64_t res = nsm_client_hash(key->addr) % hparam->index_size;
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "value = %lu",
-			     res % hparam->index_size);
+		LogFullDebug(COMPONENT_STATE, "value = %" PRIu64, res);
 
-	return (unsigned long)(res % hparam->index_size);
+	return (uint32_t) res;
 }
 
 /**
  * @brief Calculate RBT hash for an NSM key
  *
- * @todo Replace with a good hash function.
- *
  * @param[in]  hparam Hash params
  * @param[out] key    Key to hash
  *
@@ -249,26 +245,10 @@ uint32_t nsm_client_value_hash_func(hash_parameter_t *hparam,
 uint64_t nsm_client_rbt_hash_func(hash_parameter_t *hparam,
 				  struct gsh_buffdesc *key)
 {
-	unsigned long res;
-	state_nsm_client_t *pkey = key->addr;
-
-	if (nfs_param.core_param.nsm_use_caller_name) {
-		unsigned int sum = 0;
-		unsigned int i;
-
-		/* Compute the sum of all the characters */
-		for (i = 0; i < pkey->ssc_nlm_caller_name_len; i++)
-			sum += (unsigned char)pkey->ssc_nlm_caller_name[i];
-
-		res =
-		    (unsigned long)sum +
-		    (unsigned long)pkey->ssc_nlm_caller_name_len;
-	} else {
-		res = (unsigned long) pkey->ssc_client;
-	}
+	uint64_t res = nsm_client_hash(key->addr);
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "rbt = %lu", res);
+		LogFullDebug(COMPONENT_STATE, "rbt = %" PRIu64, res);
 
 	return res;
 }				/* nsm_client_rbt_hash_func */
@@ -418,9 +398,20 @@ int compare_nlm_client_key(struct gsh_buffdesc *buff1,
 }
 
 /**
- * @brief Calculate hash index for an NLM key
+ * @brief Hash an NLM client key
+ *
+ * @param[in] pkey The NLM client
  *
- * @todo Replace with a good hash function.
+ * @return 64-bit keyed hash.
+ */
+static inline uint64_t nlm_client_hash(state_nlm_client_t *pkey)
+{
+	return keyed_hash(pkey->slc_nlm_caller_name,
+			  pkey->slc_nlm_caller_name_len, 0);
+}
+
+/**
+ * @brief Calculate hash index for an NLM key
  *
  * @param[in]  hparam Hash params
  * @param[out] key    Key to hash
@@ -430,29 +421,17 @@ int compare_nlm_client_key(struct gsh_buffdesc *buff1,
 uint32_t nlm_client_value_hash_func(hash_parameter_t *hparam,
 				    struct gsh_buffdesc *key)
 {
-	uint32_t sum = 0;
-	unsigned int i;
-	unsigned long res;
-	state_nlm_client_t *pkey = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < pkey->slc_nlm_caller_name_len; i++)
-		sum += (unsigned char)pkey->slc_nlm_caller_name[i];
-
-	res = (unsigned long)sum + (unsigned long)pkey->slc_nlm_caller_name_len;
+	uint64_t res = nlm_client_hash(key->addr) % hparam->index_size;
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "value = %lu",
-			     res % hparam->index_size);
+		LogFullDebug(COMPONENT_STATE, "value = %" PRIu64, res);
 
-	return (unsigned long)(res % hparam->index_size);
+	return (uint32_t) res;
 }
 
 /**
  * @brief Calculate RBT hash for an NLM key
  *
- * @todo Replace with a good hash function.
- *
  * @param[in]  hparam Hash params
  * @param[out] key    Key to hash
  *
@@ -461,19 +440,10 @@ uint32_t nlm_client_value_hash_func(hash_parameter_t *hparam,
 uint64_t nlm_client_rbt_hash_func(hash_parameter_t *hparam,
 				  struct gsh_buffdesc *key)
 {
-	unsigned int sum = 0;
-	unsigned int i;
-	unsigned long res;
-	state_nlm_client_t *pkey = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < pkey->slc_nlm_caller_name_len; i++)
-		sum += (unsigned char)pkey->slc_nlm_caller_name[i];
-
-	res = (unsigned long)sum + (unsigned long)pkey->slc_nlm_caller_name_len;
+	uint64_t res = nlm_client_hash(key->addr);
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "rbt = %lu", res);
+		LogFullDebug(COMPONENT_STATE, "rbt = %" PRIu64, res);
 
 	return res;
 }				/* nlm_client_rbt_hash_func */
@@ -618,9 +588,20 @@ int compare_nlm_owner_key(struct gsh_buffdesc *buff1,
 }
 
 /**
- * @brief Calculate hash index for an NLM owner key
+ * @brief Hash an NLM owner key
  *
- * @todo Replace with a good hash function.
+ * @param[in] pkey The NLM owner
+ *
+ * @return 64-bit keyed hash.
+ */
+static inline uint64_t nlm_owner_hash(state_owner_t *pkey)
+{
+	return keyed_hash(pkey->so_owner_val, pkey->so_owner_len,
+			  (uint64_t) pkey->so_owner.so_nlm_owner.so_nlm_svid);
+}
+
+/**
+ * @brief Calculate hash index for an NLM owner key
  *
  * @param[in]  hparam Hash params
  * @param[out] key    Key to hash
@@ -630,32 +611,17 @@ int compare_nlm_owner_key(struct gsh_buffdesc *buff1,
 uint32_t nlm_owner_value_hash_func(hash_parameter_t *hparam,
 				   struct gsh_buffdesc *key)
 {
-	unsigned int sum = 0;
-	unsigned int i;
-	unsigned long res;
-	state_owner_t *pkey = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < pkey->so_owner_len; i++)
-		sum += (unsigned char)pkey->so_owner_val[i];
-
-	res =
-	    (unsigned long)(pkey->so_owner.so_nlm_owner.so_nlm_svid) +
-	    (unsigned long)sum + (unsigned long)pkey->so_owner_len;
+	uint64_t res = nlm_owner_hash(key->addr) % hparam->index_size;
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "value = %lu",
-			     res % hparam->index_size);
-
-	return (unsigned long)(res % hparam->index_size);
+		LogFullDebug(COMPONENT_STATE, "value = %" PRIu64, res);
 
+	return (uint32_t) res;
 }
 
 /**
  * @brief Calculate RBT hash for an NLM owner key
  *
- * @todo Replace with a good hash function.
- *
  * @param[in]  hparam Hash params
  * @param[out] key    Key to hash
  *
@@ -664,21 +630,10 @@ uint32_t nlm_owner_value_hash_func(hash_parameter_t *hparam,
 uint64_t nlm_owner_rbt_hash_func(hash_parameter_t *hparam,
 				 struct gsh_buffdesc *key)
 {
-	unsigned int sum = 0;
-	unsigned int i;
-	unsigned long res;
-	state_owner_t *pkey = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < pkey->so_owner_len; i++)
-		sum += (unsigned char)pkey->so_owner_val[i];
-
-	res =
-	    (unsigned long)(pkey->so_owner.so_nlm_owner.so_nlm_svid) +
-	    (unsigned long)sum + (unsigned long)pkey->so_owner_len;
+	uint64_t res = nlm_owner_hash(key->addr);
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "rbt = %lu", res);
+		LogFullDebug(COMPONENT_STATE, "rbt = %" PRIu64, res);
 
 	return res;
 }				/* state_id_rbt_hash_func */
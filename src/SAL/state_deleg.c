@@ -269,6 +269,7 @@ void deleg_heuristics_recall(cache_entry_t *entry,
 	/* Update delegation stats for client. */
 	dec_grants(client->gsh_client);
 	client->curr_deleg_grants--;
+	atomic_inc_uint32_t(&client->cid_returned);
 
 	/* Update delegation stats for file. */
 	statistics->fds_avg_hold = advance_avg(statistics->fds_avg_hold,
@@ -376,6 +377,14 @@ bool should_we_grant_deleg(cache_entry_t *entry, nfs_client_id_t *client,
 		}
 	}
 
+	/* A file only reachable through immutable exports can have no
+	 * conflicting opens, so any number of read delegations can be
+	 * handed out on it. */
+	if (entry->flags & CACHE_INODE_IMMUTABLE) {
+		LogDebug(COMPONENT_STATE, "Immutable, let's delegate!!");
+		return true;
+	}
+
 	/* If there is a recent recall on this file, the client that made
 	 * the conflicting open may retry the open later. Don't give out
 	 * delegation to avoid starving the client's open that caused
@@ -47,10 +47,14 @@
 #include "fsal.h"
 #include "nfs_core.h"
 #include "nfs4.h"
+#include "nfs_exports.h"
 #include "sal_functions.h"
 #include "nlm_util.h"
 #include "cache_inode_lru.h"
 #include "export_mgr.h"
+#include "keyed_hash.h"
+#include "nfs_rpc_callback.h"
+#include "delayed_exec.h"
 
 /**
  * @page state_lock_entry_locking state_lock_entry_t locking rule
@@ -1273,8 +1277,6 @@ int compare_lock_cookie_key(struct gsh_buffdesc *buff1,
 /**
  * @brief Hash index for lock cookie
  *
- * @todo Replace with a good hash function.
- *
  * @param[in] hparam Hash parameters
  * @param[in] key    Key to hash
  *
@@ -1283,29 +1285,17 @@ int compare_lock_cookie_key(struct gsh_buffdesc *buff1,
 uint32_t lock_cookie_value_hash_func(hash_parameter_t *hparam,
 				     struct gsh_buffdesc *key)
 {
-	unsigned int sum = 0;
-	unsigned int i;
-	unsigned long res;
-	unsigned char *addr = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < key->len; i++)
-		sum += (unsigned char)addr[i];
-
-	res = (unsigned long)sum + (unsigned long)key->len;
+	uint32_t res = keyed_hash(key->addr, key->len, 0) % hparam->index_size;
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "value = %lu",
-			     res % hparam->index_size);
+		LogFullDebug(COMPONENT_STATE, "value = %" PRIu32, res);
 
-	return (unsigned long)(res % hparam->index_size);
+	return res;
 }
 
 /**
  * @brief RBT hash for lock cookie
  *
- * @todo Replace with a good hash function.
- *
  * @param[in] hparam Hash parameters
  * @param[in] key    Key to hash
  *
@@ -1314,19 +1304,10 @@ uint32_t lock_cookie_value_hash_func(hash_parameter_t *hparam,
 uint64_t lock_cookie_rbt_hash_func(hash_parameter_t *hparam,
 				   struct gsh_buffdesc *key)
 {
-	unsigned int sum = 0;
-	unsigned int i;
-	unsigned long res;
-	unsigned char *addr = key->addr;
-
-	/* Compute the sum of all the characters */
-	for (i = 0; i < key->len; i++)
-		sum += (unsigned char)addr[i];
-
-	res = (unsigned long)sum + (unsigned long)key->len;
+	uint64_t res = keyed_hash(key->addr, key->len, 0);
 
 	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "rbt = %lu", res);
+		LogFullDebug(COMPONENT_STATE, "rbt = %" PRIu64, res);
 
 	return res;
 }
@@ -1828,9 +1809,351 @@ void process_blocked_lock_upcall(state_block_data_t *block_data)
 	}
 }
 
+/******************************************************************************
+ *
+ * NFSv4.1 lock waiters
+ *
+ ******************************************************************************/
+
+/**
+ * @brief A CB_NOTIFY_LOCK waiting to be sent
+ */
+
+struct lock_notify {
+	state_async_queue_t ln_queue;	/*< For state_async_schedule */
+	nfs_client_id_t *ln_clientid;	/*< Client to notify, referenced */
+	nfs_cb_argop4 ln_arg;	/*< The operation */
+};
+
+static void lock_notify_free(struct lock_notify *notify)
+{
+	CB_NOTIFY_LOCK4args *args = &notify->ln_arg.nfs_cb_argop4_u
+					.opcbnotify_lock;
+
+	gsh_free(args->cnla_fh.nfs_fh4_val);
+	gsh_free(args->cnla_lock_owner.owner.owner_val);
+	if (notify->ln_clientid != NULL)
+		dec_client_id_ref(notify->ln_clientid);
+	gsh_free(notify);
+}
+
+static int32_t lock_notify_completion(rpc_call_t *call, rpc_call_hook hook,
+				      void *arg, uint32_t flags)
+{
+	LogFullDebug(COMPONENT_NFS_CB, "CB_NOTIFY_LOCK status %d",
+		     call->cbt.v_u.v4.res.status);
+
+	nfs41_complete_single(call, hook, arg, flags);
+	lock_notify_free(arg);
+	return 0;
+}
+
+static void lock_notify_send(state_async_queue_t *arg)
+{
+	struct lock_notify *notify =
+	    container_of(arg, struct lock_notify, ln_queue);
+	int rc;
+
+	rc = nfs_rpc_v41_single(notify->ln_clientid, &notify->ln_arg, NULL,
+				lock_notify_completion, notify, NULL);
+	if (rc != 0) {
+		LogDebug(COMPONENT_STATE, "CB_NOTIFY_LOCK not sent, error %d",
+			 rc);
+		lock_notify_free(notify);
+	}
+}
+
+/**
+ * @brief Queue a CB_NOTIFY_LOCK to a waiter
+ *
+ * The call is made from the async fridge, since finding a back channel
+ * slot may wait and the caller holds the file's state_lock.
+ *
+ * @param[in] waiter Waiter to notify
+ */
+
+static void lock_waiter_notify(state_lock_waiter_t *waiter)
+{
+	state_owner_t *owner = waiter->slw_owner;
+	state_nfs4_owner_t *nfs4_owner = &owner->so_owner.so_nfs4_owner;
+	struct lock_notify *notify;
+	CB_NOTIFY_LOCK4args *args;
+
+	notify = gsh_calloc(1, sizeof(*notify));
+	if (notify == NULL)
+		return;
+
+	notify->ln_arg.argop = NFS4_OP_CB_NOTIFY_LOCK;
+	args = &notify->ln_arg.nfs_cb_argop4_u.opcbnotify_lock;
+	args->cnla_fh.nfs_fh4_val = gsh_malloc(waiter->slw_fh.nfs_fh4_len);
+	args->cnla_lock_owner.owner.owner_val =
+	    gsh_malloc(owner->so_owner_len);
+	if (args->cnla_fh.nfs_fh4_val == NULL ||
+	    args->cnla_lock_owner.owner.owner_val == NULL) {
+		lock_notify_free(notify);
+		return;
+	}
+
+	args->cnla_fh.nfs_fh4_len = waiter->slw_fh.nfs_fh4_len;
+	memcpy(args->cnla_fh.nfs_fh4_val, waiter->slw_fh.nfs_fh4_val,
+	       waiter->slw_fh.nfs_fh4_len);
+	args->cnla_lock_owner.clientid = nfs4_owner->so_clientid;
+	args->cnla_lock_owner.owner.owner_len = owner->so_owner_len;
+	memcpy(args->cnla_lock_owner.owner.owner_val, owner->so_owner_val,
+	       owner->so_owner_len);
+
+	notify->ln_clientid = nfs4_owner->so_clientrec;
+	inc_client_id_ref(notify->ln_clientid);
+	notify->ln_queue.state_async_func = lock_notify_send;
+
+	if (state_async_schedule(&notify->ln_queue) != STATE_SUCCESS)
+		lock_notify_free(notify);
+}
+
+static void lock_waiter_free(state_lock_waiter_t *waiter)
+{
+	glist_del(&waiter->slw_list);
+	dec_state_owner_ref(waiter->slw_owner);
+	gsh_free(waiter->slw_fh.nfs_fh4_val);
+	gsh_free(waiter);
+}
+
+static inline bool locks_conflict(fsal_lock_param_t *lock1,
+				  fsal_lock_param_t *lock2)
+{
+	return lock_end(lock1) >= lock2->lock_start
+	    && lock1->lock_start <= lock_end(lock2)
+	    && (lock1->lock_type == FSAL_LOCK_W
+		|| lock2->lock_type == FSAL_LOCK_W);
+}
+
+/**
+ * @brief Find a range held for a notified waiter that a lock conflicts with
+ *
+ * @param[in] entry File
+ * @param[in] owner Owner asking for the lock
+ * @param[in] lock  Lock asked for
+ * @param[in] ts    Now
+ *
+ * @return The waiter or NULL.
+ */
+
+static state_lock_waiter_t *reserved_lock_waiter(cache_entry_t *entry,
+						 state_owner_t *owner,
+						 fsal_lock_param_t *lock,
+						 struct timespec *ts)
+{
+	struct glist_head *glist;
+	state_lock_waiter_t *waiter;
+
+	glist_for_each(glist, &entry->object.file.lock_waiters) {
+		waiter = glist_entry(glist, state_lock_waiter_t, slw_list);
+
+		if (waiter->slw_notified
+		    && gsh_time_cmp(&waiter->slw_expire, ts) > 0
+		    && different_owners(waiter->slw_owner, owner)
+		    && locks_conflict(&waiter->slw_lock, lock))
+			return waiter;
+	}
+
+	return NULL;
+}
+
+static void expire_lock_waiters(cache_entry_t *entry, struct timespec *ts)
+{
+	struct glist_head *glist, *glistn;
+	state_lock_waiter_t *waiter;
+
+	glist_for_each_safe(glist, glistn, &entry->object.file.lock_waiters) {
+		waiter = glist_entry(glist, state_lock_waiter_t, slw_list);
+
+		if (gsh_time_cmp(&waiter->slw_expire, ts) > 0)
+			continue;
+
+		LogLock(COMPONENT_STATE, NIV_FULL_DEBUG,
+			waiter->slw_notified ? "Reservation lapsed for"
+					     : "Forgetting lock waiter",
+			entry, waiter->slw_owner, &waiter->slw_lock);
+		lock_waiter_free(waiter);
+	}
+}
+
+static void notify_lock_waiters(cache_entry_t *entry);
+
+static void lock_reservation_expired(void *arg)
+{
+	cache_entry_t *entry = arg;
+
+	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+	notify_lock_waiters(entry);
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+
+	cache_inode_lru_unref(entry, LRU_FLAG_NONE);
+}
+
+/**
+ * @brief Notify the waiters on a file whose lock could now be granted
+ *
+ * Waiters are taken in the order they first asked.  Each one notified
+ * has its range held for Blocking_Lock_Reservation, during which
+ * conflicting requests from other owners, later waiters included, are
+ * denied.  The state_lock of the entry must be held for write.
+ *
+ * @param[in] entry File
+ */
+
+static void notify_lock_waiters(cache_entry_t *entry)
+{
+	uint32_t reservation = nfs_param.nfsv4_param.blocking_lock_reservation;
+	struct glist_head *glist, *glistn;
+	state_lock_waiter_t *waiter;
+	struct timespec ts;
+	bool reserved = false;
+
+	if (glist_empty(&entry->object.file.lock_waiters))
+		return;
+
+	now(&ts);
+	expire_lock_waiters(entry, &ts);
+
+	glist_for_each_safe(glist, glistn, &entry->object.file.lock_waiters) {
+		waiter = glist_entry(glist, state_lock_waiter_t, slw_list);
+
+		if (waiter->slw_notified)
+			continue;
+
+		if (get_overlapping_entry(entry, waiter->slw_owner,
+					  &waiter->slw_lock) != NULL
+		    || reserved_lock_waiter(entry, waiter->slw_owner,
+					    &waiter->slw_lock, &ts) != NULL)
+			continue;
+
+		LogLock(COMPONENT_STATE, NIV_DEBUG, "Notifying lock waiter",
+			entry, waiter->slw_owner, &waiter->slw_lock);
+		lock_waiter_notify(waiter);
+
+		if (reservation == 0) {
+			lock_waiter_free(waiter);
+			continue;
+		}
+
+		waiter->slw_notified = true;
+		waiter->slw_expire = ts;
+		timespec_add_nsecs(reservation * NS_PER_MSEC,
+				   &waiter->slw_expire);
+		reserved = true;
+	}
+
+	/* Let the next waiters know if a reservation goes unused */
+	if (reserved
+	    && cache_inode_lru_ref(entry, LRU_FLAG_NONE) == CACHE_INODE_SUCCESS
+	    && delayed_submit(lock_reservation_expired, entry,
+			      (reservation + 1) * NS_PER_MSEC) != 0)
+		cache_inode_lru_unref(entry, LRU_FLAG_NONE);
+}
+
+/**
+ * @brief Forget the waits of an owner that got its lock
+ *
+ * @param[in] entry File
+ * @param[in] owner Lock owner
+ * @param[in] lock  Lock granted
+ */
+
+static void lock_waiters_granted(cache_entry_t *entry, state_owner_t *owner,
+				 fsal_lock_param_t *lock)
+{
+	struct glist_head *glist, *glistn;
+	state_lock_waiter_t *waiter;
+
+	glist_for_each_safe(glist, glistn, &entry->object.file.lock_waiters) {
+		waiter = glist_entry(glist, state_lock_waiter_t, slw_list);
+
+		if (waiter->slw_owner == owner
+		    && lock_end(&waiter->slw_lock) >= lock->lock_start
+		    && waiter->slw_lock.lock_start <= lock_end(lock))
+			lock_waiter_free(waiter);
+	}
+}
+
+/**
+ * @brief Remember an NFSv4.1 lock owner denied a blocking lock
+ *
+ * The owner is sent CB_NOTIFY_LOCK once the lock might be granted.  Its
+ * place in line is kept while it keeps asking within a lease period.
+ *
+ * @param[in] entry File
+ * @param[in] owner Lock owner
+ * @param[in] lock  Lock it was denied
+ * @param[in] fh    Handle it named the file with
+ */
+
+void state_nfs4_lock_wait(cache_entry_t *entry, state_owner_t *owner,
+			  fsal_lock_param_t *lock, nfs_fh4 *fh)
+{
+	state_lock_waiter_t *waiter = NULL;
+	struct glist_head *glist;
+	struct timespec ts;
+
+	now(&ts);
+
+	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+
+	expire_lock_waiters(entry, &ts);
+
+	glist_for_each(glist, &entry->object.file.lock_waiters) {
+		waiter = glist_entry(glist, state_lock_waiter_t, slw_list);
+
+		if (waiter->slw_owner == owner
+		    && !different_lock(&waiter->slw_lock, lock))
+			break;
+
+		waiter = NULL;
+	}
+
+	if (waiter == NULL) {
+		waiter = gsh_calloc(1, sizeof(*waiter));
+		if (waiter == NULL)
+			goto out;
+
+		waiter->slw_fh.nfs_fh4_val = gsh_malloc(fh->nfs_fh4_len);
+		if (waiter->slw_fh.nfs_fh4_val == NULL) {
+			gsh_free(waiter);
+			goto out;
+		}
+		waiter->slw_fh.nfs_fh4_len = fh->nfs_fh4_len;
+		memcpy(waiter->slw_fh.nfs_fh4_val, fh->nfs_fh4_val,
+		       fh->nfs_fh4_len);
+
+		waiter->slw_owner = owner;
+		inc_state_owner_ref(owner);
+		waiter->slw_lock = *lock;
+
+		glist_add_tail(&entry->object.file.lock_waiters,
+			       &waiter->slw_list);
+
+		LogLock(COMPONENT_STATE, NIV_FULL_DEBUG, "New lock waiter",
+			entry, owner, lock);
+	}
+
+	/* A notified owner that still could not lock waits for the next
+	 * release, as its conflict came from outside the lock list.
+	 */
+	waiter->slw_notified = false;
+	waiter->slw_expire = ts;
+	timespec_add_nsecs(nfs_param.nfsv4_param.lease_lifetime * NS_PER_SEC,
+			   &waiter->slw_expire);
+
+ out:
+
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+}
+
 /**
  * @brief Attempt to grant all blocked locks on a file
  *
+ * Also notifies the NFSv4.1 lock waiters that may now get their locks.
+ *
  * @param[in] entry Cache entry for the file
  */
 
@@ -1840,6 +2163,8 @@ static void grant_blocked_locks(cache_entry_t *entry)
 	struct glist_head *glist, *glistn;
 	struct fsal_export *export = op_ctx->export->fsal_export;
 
+	notify_lock_waiters(entry);
+
 	/* If FSAL supports async blocking locks,
 	 * allow it to grant blocked locks.
 	 */
@@ -2249,6 +2574,7 @@ state_status_t do_lock_op(cache_entry_t *entry,
 	struct fsal_export *fsal_export = op_ctx->fsal_export;
 
 	lock->lock_sle_type = sle_type;
+	lock->lock_owner_id = owner->so_id;
 
 	/* Quick exit if:
 	 * Locks are not supported by FSAL
@@ -2451,6 +2777,213 @@ state_status_t state_test(cache_entry_t *entry,
 	return status;
 }
 
+/**
+ * @brief Check an I/O against the granted locks on a file
+ *
+ * Used to enforce mandatory locking on exports that ask for it.  A
+ * READ conflicts with a write lock, and a WRITE with any lock, held
+ * by a different owner over any byte of the range.  Only locks known
+ * to SAL are considered, so the cost is a walk of the entry's lock
+ * list; callers should use state_lock_check_io, which skips even that
+ * for files nobody has locked.
+ *
+ * I/O without an owner (NFSv3, NFSv4 special stateids) does not
+ * conflict with NLM locks taken by the same client, since NFSv3
+ * clients do their I/O under their own locks without saying so.
+ * Likewise I/O done for an NFSv4 open owner does not conflict with
+ * the locks of any lock owner of the same clientid.
+ *
+ * A conflicting lock held by a courtesy client is revoked, by
+ * expiring the client, and the check made again.  The caller must
+ * hold no state or client locks.
+ *
+ * @param[in] entry  File being read or written
+ * @param[in] owner  Owner the I/O is done for, NULL if none
+ * @param[in] client Client doing the I/O
+ * @param[in] write  Whether this is a write
+ * @param[in] offset First byte of the I/O
+ * @param[in] length Number of bytes, must not be 0
+ *
+ * @retval STATE_SUCCESS if the I/O may proceed.
+ * @retval STATE_LOCK_CONFLICT if another owner holds a conflicting lock.
+ */
+state_status_t state_lock_io_conflict(cache_entry_t *entry,
+				      state_owner_t *owner,
+				      struct gsh_client *client,
+				      bool write, uint64_t offset,
+				      uint64_t length)
+{
+	struct glist_head *glist;
+	state_lock_entry_t *found_entry;
+	state_owner_t *holder;
+	state_status_t status;
+	uint64_t range_end = offset + length - 1;
+	nfs_client_id_t *courtesy;
+
+	if (range_end < offset)
+		range_end = UINT64_MAX;
+
+ again:
+
+	status = STATE_SUCCESS;
+	courtesy = NULL;
+
+	PTHREAD_RWLOCK_rdlock(&entry->state_lock);
+
+	glist_for_each(glist, &entry->object.file.lock_list) {
+		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+
+		/* Only granted locks count */
+		if (found_entry->sle_blocked != STATE_NON_BLOCKING)
+			continue;
+
+		if (lock_end(&found_entry->sle_lock) < offset
+		    || found_entry->sle_lock.lock_start > range_end)
+			continue;
+
+		if (!write && found_entry->sle_lock.lock_type != FSAL_LOCK_W)
+			continue;
+
+		holder = found_entry->sle_owner;
+
+		if (!different_owners(holder, owner))
+			continue;
+
+		/* I/O under an open stateid is done for the client as a
+		 * whole, which may hold locks under any of its lock owners.
+		 */
+		if (owner != NULL && holder != NULL
+		    && owner->so_type == STATE_OPEN_OWNER_NFSV4
+		    && holder->so_type == STATE_LOCK_OWNER_NFSV4
+		    && holder->so_owner.so_nfs4_owner.so_clientid ==
+		       owner->so_owner.so_nfs4_owner.so_clientid)
+			continue;
+
+		if (owner == NULL && client != NULL && holder != NULL
+		    && holder->so_type == STATE_LOCK_OWNER_NLM
+		    && holder->so_owner.so_nlm_owner.so_client->slc_nsm_client
+		       ->ssc_client == client)
+			continue;
+
+		LogEntry("I/O conflicts with", found_entry);
+		status = STATE_LOCK_CONFLICT;
+
+		courtesy = holder != NULL ? courtesy_client(holder) : NULL;
+		if (courtesy != NULL)
+			inc_client_id_ref(courtesy);
+		break;
+	}
+
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+
+	if (courtesy != NULL) {
+		bool expired;
+
+		/* Expire the courtesy client, releasing its locks, and
+		 * check again.  If it came back, the conflict stands.
+		 */
+		expired = expire_courtesy_client(courtesy);
+		dec_client_id_ref(courtesy);
+		if (expired)
+			goto again;
+	}
+
+	return status;
+}
+
+/**
+ * @brief Whether an I/O can skip the mandatory lock check
+ *
+ * True unless the export enforces mandatory locks.  The lock list
+ * head doubles as the "no locks" flag: its next pointer is loaded
+ * atomically without taking the state lock, so files that nobody has
+ * locked pay a single load and no lock traffic.
+ *
+ * The race is benign.  The list is only changed under the state lock,
+ * and the load sees either the head itself (no locks) or some entry,
+ * never a torn pointer.  Seeing no locks while one is being granted
+ * lets the I/O through as if it had arrived just before the LOCK,
+ * which no client can tell apart since the two are not ordered.
+ * Seeing an entry that is being removed only costs the locked walk in
+ * state_lock_io_conflict, which decides with the list stable.
+ *
+ * @param[in] entry  File being read or written
+ * @param[in] length Number of bytes
+ *
+ * @return true if no check is needed.
+ */
+static inline bool state_lock_io_unchecked(cache_entry_t *entry,
+					   uint64_t length)
+{
+	struct glist_head *locks = &entry->object.file.lock_list;
+
+	return (op_ctx->export->options & EXPORT_OPTION_MANDATORY_LOCKS) == 0
+	    || length == 0
+	    || atomic_fetch_voidptr((void **)&locks->next) == locks;
+}
+
+/**
+ * @brief Check an I/O against mandatory byte-range locks
+ *
+ * @param[in] entry  File being read or written
+ * @param[in] owner  Owner the I/O is done for, NULL if none
+ * @param[in] write  Whether this is a write
+ * @param[in] offset First byte of the I/O
+ * @param[in] length Number of bytes
+ *
+ * @retval STATE_SUCCESS if the I/O may proceed.
+ * @retval STATE_LOCK_CONFLICT if another owner holds a conflicting lock.
+ */
+state_status_t state_lock_check_io(cache_entry_t *entry,
+				   state_owner_t *owner,
+				   bool write, uint64_t offset,
+				   uint64_t length)
+{
+	if (state_lock_io_unchecked(entry, length))
+		return STATE_SUCCESS;
+
+	return state_lock_io_conflict(entry, owner, op_ctx->client, write,
+				      offset, length);
+}
+
+/**
+ * @brief Check an NFSv4 READ or WRITE against mandatory locks
+ *
+ * The I/O is done for the owner of the stateid used: the lock owner
+ * for a lock stateid, the open owner otherwise, and nobody for the
+ * special stateids.
+ *
+ * @param[in] entry  File being read or written
+ * @param[in] state  State from the stateid, NULL for special stateids
+ * @param[in] write  Whether this is a write
+ * @param[in] offset First byte of the I/O
+ * @param[in] length Number of bytes
+ *
+ * @retval NFS4_OK if the I/O may proceed.
+ * @retval NFS4ERR_LOCKED if another owner holds a conflicting lock.
+ */
+nfsstat4 nfs4_check_mandatory_lock(cache_entry_t *entry, state_t *state,
+				   bool write, uint64_t offset,
+				   uint64_t length)
+{
+	state_owner_t *owner = NULL;
+	state_status_t status;
+
+	if (state_lock_io_unchecked(entry, length))
+		return NFS4_OK;
+
+	if (state != NULL)
+		owner = get_state_owner_ref(state);
+
+	status = state_lock_io_conflict(entry, owner, op_ctx->client, write,
+					offset, length);
+
+	if (owner != NULL)
+		dec_state_owner_ref(owner);
+
+	return status == STATE_LOCK_CONFLICT ? NFS4ERR_LOCKED : NFS4_OK;
+}
+
 /**
  * @brief Attempt to acquire a lock
  *
@@ -2487,6 +3020,9 @@ state_status_t state_lock(cache_entry_t *entry,
 	fsal_openflags_t openflags;
 	bool unpin = true;
 	bool release_state_lock = true;
+	nfs_client_id_t *courtesy = NULL;
+
+ again:
 
 	cache_status = cache_inode_lru_ref(entry, LRU_FLAG_NONE);
 
@@ -2624,6 +3160,18 @@ state_status_t state_lock(cache_entry_t *entry,
 				LogEntry("Conflicts with", found_entry);
 				LogList("Locks", entry,
 					&entry->object.file.lock_list);
+
+				/* The lock of a client whose lease lapsed
+				 * is revoked rather than honoured.
+				 */
+				courtesy = courtesy_client(
+						found_entry->sle_owner);
+				if (courtesy != NULL) {
+					inc_client_id_ref(courtesy);
+					status = STATE_LOCK_CONFLICT;
+					goto out_unlock;
+				}
+
 				copy_conflict(found_entry, holder, conflict);
 				allow = false;
 				overlap = true;
@@ -2675,6 +3223,33 @@ state_status_t state_lock(cache_entry_t *entry,
 		}
 	}
 
+	/* A range just released is held for the NFSv4.1 lock owner told
+	 * of it, against other NFSv4 owners only.  NLM and 9P requests,
+	 * which cannot be told of it, lock as they always have.
+	 */
+	if (allow && owner->so_type == STATE_LOCK_OWNER_NFSV4
+	    && !lock->lock_reclaim
+	    && !glist_empty(&entry->object.file.lock_waiters)) {
+		state_lock_waiter_t *waiter;
+		struct timespec ts;
+
+		now(&ts);
+		waiter = reserved_lock_waiter(entry, owner, lock, &ts);
+		if (waiter != NULL) {
+			LogLock(COMPONENT_STATE, NIV_DEBUG,
+				"Range reserved for", entry,
+				waiter->slw_owner, &waiter->slw_lock);
+			if (holder != NULL) {
+				*holder = waiter->slw_owner;
+				inc_state_owner_ref(waiter->slw_owner);
+			}
+			if (conflict != NULL)
+				*conflict = waiter->slw_lock;
+			status = STATE_LOCK_CONFLICT;
+			goto out_unlock;
+		}
+	}
+
 	/* Decide how to proceed */
 	if (fsal_export->exp_ops.
 	    fs_supports(fsal_export, fso_lock_support_async_block)
@@ -2792,6 +3367,9 @@ state_status_t state_lock(cache_entry_t *entry,
 		glist_add_tail(&entry->object.file.lock_list,
 			       &found_entry->sle_list);
 
+		/* An owner that was waiting has what it waited for */
+		lock_waiters_granted(entry, owner, lock);
+
 		/* A lock downgrade could unblock blocked locks */
 		grant_blocked_locks(entry);
 	} else if (status == STATE_LOCK_CONFLICT) {
@@ -2849,6 +3427,19 @@ state_status_t state_lock(cache_entry_t *entry,
 		cache_inode_lru_unref(entry, LRU_FLAG_NONE);
 	}
 
+	if (courtesy != NULL) {
+		/* Expire the courtesy client, releasing its locks, and
+		 * try again.
+		 */
+		expire_courtesy_client(courtesy);
+		dec_client_id_ref(courtesy);
+		courtesy = NULL;
+		allow = true;
+		overlap = false;
+		status = 0;
+		goto again;
+	}
+
 	return status;
 }
 
@@ -3681,6 +4272,11 @@ void available_blocked_lock_upcall(cache_entry_t *entry, void *owner,
  */
 void state_lock_wipe(cache_entry_t *entry)
 {
+	while (!glist_empty(&entry->object.file.lock_waiters))
+		lock_waiter_free(glist_first_entry(
+					&entry->object.file.lock_waiters,
+					state_lock_waiter_t, slw_list));
+
 	if (glist_empty(&entry->object.file.lock_list))
 		return;
 
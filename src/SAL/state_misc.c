@@ -52,6 +52,9 @@
 
 pool_t *state_owner_pool;	/*< Pool for NFSv4 files's open owner */
 
+/* Last state_owner_t.so_id handed out */
+static uint64_t state_owner_next_id;
+
 #ifdef DEBUG_SAL
 struct glist_head state_owners_all = GLIST_HEAD_INIT(state_owners_all);
 pthread_mutex_t all_state_owners_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -1182,6 +1185,7 @@ state_owner_t *get_state_owner(care_t care, state_owner_t *key,
 
 	/* Copy everything over */
 	memcpy(owner, key, sizeof(*key));
+	owner->so_id = atomic_inc_uint64_t(&state_owner_next_id);
 
 	PTHREAD_MUTEX_init(&owner->so_mutex, NULL);
 
@@ -0,0 +1,394 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup SAL State abstraction layer
+ * @{
+ */
+
+/**
+ * @file state_recall_any.c
+ * @brief Asking clients to give back state when entries run short
+ *
+ * Delegations and layouts pin the cache entries of their files, so
+ * the LRU cannot reap them however short of entries or memory the
+ * server is.  When the LRU's call to state_recall_any_check finds too
+ * many entries pinned by them, the clients holding the most
+ * delegations and layouts are sent CB_RECALL_ANY asking them to keep
+ * only Recall_Any_Keep_Percent of them.
+ *
+ * A client that has not given back at least half of what it was asked
+ * for after Recall_Any_Grace seconds is counted as having ignored the
+ * request, and has its delegations recalled one at a time: what it
+ * holds by then is no guide, as it may have been granted more since.
+ * NFSv4.0 clients, which have no CB_RECALL_ANY, and clients that
+ * ignored it RECALL_ANY_IGNORED_MAX times in a row go straight to
+ * those recalls.
+ */
+
+#include "config.h"
+#include <time.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "log.h"
+#include "hashtable.h"
+#include "nfs_core.h"
+#include "nfs4.h"
+#include "sal_functions.h"
+#include "cache_inode_lru.h"
+#include "abstract_atomic.h"
+#include "nfs_rpc_callback.h"
+
+/**
+ * @brief Most delegations recalled from one client at a time
+ */
+#define RECALL_ANY_TARGETED_MAX 256
+
+/**
+ * @brief CB_RECALL_ANY ignored in a row before we stop sending it
+ */
+#define RECALL_ANY_IGNORED_MAX 3
+
+/**
+ * @brief A client picked for recall
+ */
+
+struct recall_any_client {
+	nfs_client_id_t *clientid;	/*< Referenced */
+	uint32_t held;		/*< Delegations and layouts */
+};
+
+/** Entries holding a delegation or layout, under their state_lock */
+uint64_t recall_any_pinned;
+
+/** Set while a round is queued or running */
+static uint32_t recall_any_busy;
+
+static state_async_queue_t recall_any_queue;
+
+/**
+ * @brief Pick the confirmed clients holding the most
+ *
+ * @param[out] picked Clients, most first, referenced
+ * @param[in]  max    Size of picked
+ *
+ * @return How many were picked.
+ */
+
+static uint32_t recall_any_pick(struct recall_any_client *picked,
+				uint32_t max)
+{
+	hash_table_t *ht = ht_confirmed_client_id;
+	struct rbt_head *head_rbt;
+	struct rbt_node *pn;
+	struct hash_data *pdata;
+	nfs_client_id_t *clientid;
+	uint32_t npicked = 0, held, i, j;
+
+	for (i = 0; i < ht->parameter.index_size; i++) {
+		PTHREAD_RWLOCK_rdlock(&ht->partitions[i].lock);
+		head_rbt = &ht->partitions[i].rbt;
+
+		RBT_LOOP(head_rbt, pn) {
+			pdata = RBT_OPAQ(pn);
+			clientid = pdata->val.addr;
+			RBT_INCREMENT(pn);
+
+			if (clientid->cid_confirmed != CONFIRMED_CLIENT_ID)
+				continue;
+
+			held = clientid->curr_deleg_grants +
+			    atomic_fetch_uint32_t(&clientid->curr_layouts);
+
+			if (held == 0 ||
+			    (npicked == max && held <= picked[max - 1].held))
+				continue;
+
+			/* The hash table holds a reference too, so this
+			 * cannot be the last.
+			 */
+			if (npicked == max)
+				dec_client_id_ref(picked[--npicked].clientid);
+
+			for (j = npicked; j > 0 && picked[j - 1].held < held;
+			     j--)
+				picked[j] = picked[j - 1];
+
+			inc_client_id_ref(clientid);
+			picked[j].clientid = clientid;
+			picked[j].held = held;
+			npicked++;
+		}
+
+		PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
+	}
+
+	return npicked;
+}
+
+static int32_t recall_any_completion(rpc_call_t *call, rpc_call_hook hook,
+				     void *arg, uint32_t flags)
+{
+	nfs_client_id_t *clientid = arg;
+
+	LogDebug(COMPONENT_NFS_CB,
+		 "CB_RECALL_ANY to clientid %" PRIx64 " status %d",
+		 clientid->cid_clientid, call->cbt.v_u.v4.res.status);
+
+	nfs41_complete_single(call, hook, arg, flags);
+	dec_client_id_ref(clientid);
+	return 0;
+}
+
+/**
+ * @brief Send CB_RECALL_ANY
+ *
+ * @param[in] clientid Client
+ * @param[in] keep     Objects of each type it may keep
+ * @param[in] delegs   Whether to ask for delegations
+ * @param[in] layouts  Whether to ask for layouts
+ *
+ * @return 0 or an errno.
+ */
+
+static int recall_any_send(nfs_client_id_t *clientid, uint32_t keep,
+			   bool delegs, bool layouts)
+{
+	nfs_cb_argop4 argop;
+	CB_RECALL_ANY4args *args = &argop.nfs_cb_argop4_u.opcbrecall_any;
+	int rc;
+
+	memset(&argop, 0, sizeof(argop));
+	argop.argop = NFS4_OP_CB_RECALL_ANY;
+	args->craa_objects_to_keep = keep;
+	args->craa_type_mask.bitmap4_len = 1;
+	if (delegs)
+		args->craa_type_mask.map[0] |=
+		    1 << RCA4_TYPE_MASK_RDATA_DLG |
+		    1 << RCA4_TYPE_MASK_WDATA_DLG;
+	if (layouts)
+		args->craa_type_mask.map[0] |=
+		    1 << RCA4_TYPE_MASK_FILE_LAYOUT;
+
+	inc_client_id_ref(clientid);
+	rc = nfs_rpc_v41_single(clientid, &argop, NULL, recall_any_completion,
+				clientid, NULL);
+	if (rc != 0)
+		dec_client_id_ref(clientid);
+
+	return rc;
+}
+
+/**
+ * @brief Recall a client's delegations one at a time
+ *
+ * The oldest are recalled first.  Layouts are left to the FSAL's own
+ * CB_LAYOUTRECALL.
+ *
+ * @param[in] clientid Client
+ * @param[in] count    How many to recall
+ */
+
+static void recall_any_targeted(nfs_client_id_t *clientid, uint32_t count)
+{
+	state_owner_t *owner = &clientid->cid_owner;
+	cache_entry_t *entries[RECALL_ANY_TARGETED_MAX];
+	struct glist_head *glist;
+	state_t *state;
+	uint32_t n = 0, i;
+
+	if (count > RECALL_ANY_TARGETED_MAX)
+		count = RECALL_ANY_TARGETED_MAX;
+
+	PTHREAD_MUTEX_lock(&owner->so_mutex);
+
+	glist_for_each(glist, &owner->so_owner.so_nfs4_owner.so_state_list) {
+		if (n == count)
+			break;
+
+		state = glist_entry(glist, state_t, state_owner_list);
+
+		if (state->state_type != STATE_TYPE_DELEG
+		    || state->state_data.deleg.sd_state != DELEG_GRANTED)
+			continue;
+
+		entries[n] = get_state_entry_ref(state);
+		if (entries[n] != NULL)
+			n++;
+	}
+
+	PTHREAD_MUTEX_unlock(&owner->so_mutex);
+
+	LogDebug(COMPONENT_STATE,
+		 "Recalling %" PRIu32 " delegations of clientid %" PRIx64,
+		 n, clientid->cid_clientid);
+
+	for (i = 0; i < n; i++) {
+		delegrecall_client(entries[i], clientid);
+		cache_inode_lru_unref(entries[i], LRU_FLAG_NONE);
+	}
+}
+
+/**
+ * @brief Ask one client to give back state
+ *
+ * @param[in] clientid Client
+ * @param[in] t        Now
+ */
+
+static void recall_any_client(nfs_client_id_t *clientid, time_t t)
+{
+	uint32_t keep_pct = nfs_param.nfsv4_param.recall_any_keep_pct;
+	uint32_t delegs, layouts, keep, returned;
+	bool ignored = false;
+	bool targeted;
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+
+	if (clientid->cid_courtesy) {
+		/* Short of resources, a lapsed lease is not worth keeping */
+		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+		expire_courtesy_client(clientid);
+		return;
+	}
+
+	delegs = clientid->curr_deleg_grants;
+	layouts = atomic_fetch_uint32_t(&clientid->curr_layouts);
+
+	if (clientid->cid_recall_any_sent != 0) {
+		if (t - clientid->cid_recall_any_sent <
+		    nfs_param.nfsv4_param.recall_any_grace) {
+			/* Still has time */
+			PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+			return;
+		}
+
+		clientid->cid_recall_any_sent = 0;
+		returned = atomic_fetch_uint32_t(&clientid->cid_returned) -
+		    clientid->cid_recall_any_returned;
+
+		if (returned * 2 >= clientid->cid_recall_any_asked) {
+			clientid->cid_recall_any_ignored = 0;
+		} else {
+			clientid->cid_recall_any_ignored++;
+			ignored = true;
+			LogInfo(COMPONENT_STATE,
+				"Clientid %" PRIx64
+				" ignored CB_RECALL_ANY, gave back %" PRIu32
+				" of %" PRIu32 " asked",
+				clientid->cid_clientid, returned,
+				clientid->cid_recall_any_asked);
+		}
+	}
+
+	targeted = clientid->cid_minorversion == 0 || ignored
+	    || clientid->cid_recall_any_ignored >= RECALL_ANY_IGNORED_MAX;
+
+	keep = (delegs > layouts ? delegs : layouts) * keep_pct / 100;
+
+	if (!targeted) {
+		clientid->cid_recall_any_sent = t;
+		clientid->cid_recall_any_returned =
+		    atomic_fetch_uint32_t(&clientid->cid_returned);
+		clientid->cid_recall_any_asked =
+		    (delegs > keep ? delegs - keep : 0) +
+		    (layouts > keep ? layouts - keep : 0);
+	}
+
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	if (!targeted) {
+		if (recall_any_send(clientid, keep, delegs > 0,
+				    layouts > 0) == 0)
+			return;
+
+		LogDebug(COMPONENT_STATE,
+			 "CB_RECALL_ANY not sent to clientid %" PRIx64,
+			 clientid->cid_clientid);
+
+		PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+		clientid->cid_recall_any_sent = 0;
+		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+	}
+
+	recall_any_targeted(clientid, delegs - delegs * keep_pct / 100);
+}
+
+static void recall_any_round(state_async_queue_t *arg)
+{
+	uint32_t max = nfs_param.nfsv4_param.recall_any_clients;
+	struct recall_any_client *picked;
+	time_t t = time(NULL);
+	uint32_t n, i;
+
+	picked = gsh_calloc(max, sizeof(*picked));
+	if (picked == NULL)
+		goto out;
+
+	n = recall_any_pick(picked, max);
+
+	for (i = 0; i < n; i++) {
+		LogDebug(COMPONENT_STATE,
+			 "Clientid %" PRIx64 " holds %" PRIu32
+			 " delegations and layouts",
+			 picked[i].clientid->cid_clientid, picked[i].held);
+		recall_any_client(picked[i].clientid, t);
+		dec_client_id_ref(picked[i].clientid);
+	}
+
+	gsh_free(picked);
+
+ out:
+	atomic_store_uint32_t(&recall_any_busy, 0);
+}
+
+/**
+ * @brief Ask clients for state back if too many entries are pinned
+ *
+ * Called from the LRU thread on each pass.  The clients are picked
+ * and called from the state async fridge.
+ *
+ * @param[in] limit Entries the cache may hold now
+ */
+
+void state_recall_any_check(uint64_t limit)
+{
+	uint32_t pct = nfs_param.nfsv4_param.recall_any_pinned_pct;
+	uint64_t pinned = atomic_fetch_uint64_t(&recall_any_pinned);
+
+	if (pct == 0 || pinned * 100 < limit * pct)
+		return;
+
+	if (!atomic_cas_uint32_t(&recall_any_busy, 0, 1))
+		return;
+
+	LogDebug(COMPONENT_STATE,
+		 "%" PRIu64 " of %" PRIu64
+		 " entries pinned by delegations or layouts, recalling state",
+		 pinned, limit);
+
+	recall_any_queue.state_async_func = recall_any_round;
+	if (state_async_schedule(&recall_any_queue) != STATE_SUCCESS)
+		atomic_store_uint32_t(&recall_any_busy, 0);
+}
+
+/** @} */
@@ -545,6 +545,193 @@ state_status_t state_share_check_conflict(cache_entry_t *entry,
 	return STATE_STATE_CONFLICT;
 }
 
+/**
+ * @brief Whether a share request conflicts with a share held
+ *
+ * @param[in] share_access Desired access mode
+ * @param[in] share_deny   Desired deny mode
+ * @param[in] held_access  Access mode held
+ * @param[in] held_deny    Deny mode held
+ *
+ * @return true if they conflict.
+ */
+static inline bool share_conflicts(int share_access, int share_deny,
+				   int held_access, int held_deny)
+{
+	return (share_access & held_deny) != 0 ||
+	       (share_deny & held_access) != 0;
+}
+
+/**
+ * @brief Whether every share conflicting with a request is a courtesy
+ *        client's
+ *
+ * The state lock _must_ be held for this call.
+ *
+ * @param[in] entry        File to query
+ * @param[in] share_access Desired access mode
+ * @param[in] share_deny   Desired deny mode
+ *
+ * @retval true if there are conflicts and all are courtesy ones.
+ * @retval false otherwise.
+ */
+static bool share_courtesy_only(cache_entry_t *entry, int share_access,
+				int share_deny)
+{
+	struct glist_head *glist;
+	state_t *state;
+	state_nlm_share_t *nlm_share;
+	state_owner_t *owner;
+	bool found = false, courtesy = true;
+
+	/* NLM shares are never courtesy ones */
+	glist_for_each(glist, &entry->object.file.nlm_share_list) {
+		nlm_share = glist_entry(glist, state_nlm_share_t,
+					sns_share_per_file);
+
+		if (share_conflicts(share_access, share_deny,
+				    nlm_share->sns_access,
+				    nlm_share->sns_deny))
+			return false;
+	}
+
+	glist_for_each(glist, &entry->list_of_states) {
+		state = glist_entry(glist, state_t, state_list);
+
+		if (state->state_type != STATE_TYPE_SHARE)
+			continue;
+
+		if (!share_conflicts(share_access, share_deny,
+				     state->state_data.share.share_access,
+				     state->state_data.share.share_deny))
+			continue;
+
+		found = true;
+
+		owner = get_state_owner_ref(state);
+		if (owner == NULL)
+			continue;
+
+		if (courtesy_client(owner) == NULL)
+			courtesy = false;
+
+		dec_state_owner_ref(owner);
+
+		if (!courtesy)
+			return false;
+	}
+
+	return found;
+}
+
+/**
+ * @brief Find a courtesy client whose shares are in the way
+ *
+ * Called after state_share_check_conflict found a conflict, by callers
+ * that can drop the state lock and expire the client themselves.
+ *
+ * The state lock _must_ be held for this call.
+ *
+ * @param[in] entry        File to query
+ * @param[in] share_access Desired access mode
+ * @param[in] share_deny   Desired deny mode
+ *
+ * @return A referenced client if every conflict is a courtesy one,
+ *         else NULL.
+ */
+static nfs_client_id_t *share_courtesy_holder(cache_entry_t *entry,
+					      int share_access,
+					      int share_deny)
+{
+	struct glist_head *glist;
+	state_t *state;
+	state_owner_t *owner;
+	nfs_client_id_t *clientid = NULL;
+
+	if (!share_courtesy_only(entry, share_access, share_deny))
+		return NULL;
+
+	glist_for_each(glist, &entry->list_of_states) {
+		state = glist_entry(glist, state_t, state_list);
+
+		if (state->state_type != STATE_TYPE_SHARE)
+			continue;
+
+		if (!share_conflicts(share_access, share_deny,
+				     state->state_data.share.share_access,
+				     state->state_data.share.share_deny))
+			continue;
+
+		owner = get_state_owner_ref(state);
+		if (owner == NULL)
+			continue;
+
+		clientid = courtesy_client(owner);
+		if (clientid != NULL)
+			inc_client_id_ref(clientid);
+
+		dec_state_owner_ref(owner);
+
+		if (clientid != NULL)
+			break;
+	}
+
+	return clientid;
+}
+
+/**
+ * @brief Revoke share state of courtesy clients in the way of an OPEN
+ *
+ * Called after state_share_check_conflict found a conflict.  If every
+ * share conflicting with the request belongs to a client whose lease
+ * lapsed, those clients are queued for expiry and the caller should
+ * have the client retry.
+ *
+ * The state lock _must_ be held for this call.
+ *
+ * @param[in] entry        File to query
+ * @param[in] share_access Desired access mode
+ * @param[in] share_deny   Desired deny mode
+ *
+ * @retval true if the conflict is going away.
+ * @retval false if it is a real one.
+ */
+bool state_share_courtesy_conflict(cache_entry_t *entry, int share_access,
+				   int share_deny)
+{
+	struct glist_head *glist;
+	state_t *state;
+	state_owner_t *owner;
+	nfs_client_id_t *clientid;
+
+	if (!share_courtesy_only(entry, share_access, share_deny))
+		return false;
+
+	glist_for_each(glist, &entry->list_of_states) {
+		state = glist_entry(glist, state_t, state_list);
+
+		if (state->state_type != STATE_TYPE_SHARE)
+			continue;
+
+		if (!share_conflicts(share_access, share_deny,
+				     state->state_data.share.share_access,
+				     state->state_data.share.share_deny))
+			continue;
+
+		owner = get_state_owner_ref(state);
+		if (owner == NULL)
+			continue;
+
+		clientid = courtesy_client(owner);
+		if (clientid != NULL)
+			expire_courtesy_client_async(clientid);
+
+		dec_state_owner_ref(owner);
+	}
+
+	return true;
+}
+
 /**
  * @brief Update the ref counter of share state
  *
@@ -639,6 +826,25 @@ static unsigned int state_share_get_share_deny(cache_entry_t *entry)
 	return share_deny;
 }
 
+/**
+ * @brief Check whether anonymous I/O can skip the share checks
+ *
+ * Only reads through an immutable export do.  The decision is made on
+ * the export of the request rather than on the entry, which may be
+ * shared with writable exports, so that the start and the end of the
+ * I/O always agree.
+ *
+ * @param[in] share_access Access matching I/O done
+ *
+ * @return true if the I/O is neither checked nor counted.
+ */
+static inline bool state_share_immutable_io(int share_access)
+{
+	return share_access == OPEN4_SHARE_ACCESS_READ
+	    && op_ctx != NULL && op_ctx->export != NULL
+	    && (op_ctx->export->options & EXPORT_OPTION_IMMUTABLE);
+}
+
 /**
  * @brief Start I/O by an anonymous stateid
  *
@@ -661,6 +867,15 @@ state_status_t state_share_anonymous_io_start(cache_entry_t *entry,
 	 *             should be called indicating v3 or v4...
 	 */
 	state_status_t status = 0;
+	nfs_client_id_t *courtesy;
+	bool expired;
+
+	/* Reads through an immutable export check nothing */
+	if (state_share_immutable_io(share_access))
+		return STATE_SUCCESS;
+
+ again:
+
 	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
 
 	status = state_share_check_conflict(entry,
@@ -668,10 +883,20 @@ state_status_t state_share_anonymous_io_start(cache_entry_t *entry,
 					    OPEN4_SHARE_DENY_NONE,
 					    bypass);
 	if (status != STATE_SUCCESS) {
-		/* Need to convert the error from STATE_SHARE_CONFLICT */
-		status = STATE_LOCKED;
+		courtesy = share_courtesy_holder(entry, share_access,
+						 OPEN4_SHARE_DENY_NONE);
 		PTHREAD_RWLOCK_unlock(&entry->state_lock);
-		return status;
+
+		/* Revoke the shares of a courtesy client and retry */
+		if (courtesy != NULL) {
+			expired = expire_courtesy_client(courtesy);
+			dec_client_id_ref(courtesy);
+			if (expired)
+				goto again;
+		}
+
+		/* Need to convert the error from STATE_SHARE_CONFLICT */
+		return STATE_LOCKED;
 	}
 
 	if (state_deleg_conflict(entry,
@@ -705,6 +930,9 @@ state_status_t state_share_anonymous_io_start(cache_entry_t *entry,
  */
 void state_share_anonymous_io_done(cache_entry_t *entry, int share_access)
 {
+	if (state_share_immutable_io(share_access))
+		return;
+
 	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
 
 	/* Undo the temporary bump to the access counters, v4 mode doesn't
@@ -748,6 +976,8 @@ state_status_t state_nlm_share(cache_entry_t *entry,
 	state_status_t status = 0;
 	struct fsal_export *fsal_export = op_ctx->fsal_export;
 	bool unpin = true;
+	nfs_client_id_t *courtesy;
+	bool expired;
 
 	cache_status = cache_inode_lru_ref(entry, LRU_FLAG_NONE);
 
@@ -789,6 +1019,8 @@ state_status_t state_nlm_share(cache_entry_t *entry,
 		goto out;
 	}
 
+ again:
+
 	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
 
 	/* Check if new share state has conflicts. */
@@ -798,6 +1030,20 @@ state_status_t state_nlm_share(cache_entry_t *entry,
 					    SHARE_BYPASS_NONE);
 
 	if (status != STATE_SUCCESS) {
+		courtesy = share_courtesy_holder(entry, share_access,
+						 share_deny);
+		if (courtesy != NULL) {
+			/* Revoke the shares of a courtesy client and
+			 * retry.
+			 */
+			PTHREAD_RWLOCK_unlock(&entry->state_lock);
+			expired = expire_courtesy_client(courtesy);
+			dec_client_id_ref(courtesy);
+			if (expired)
+				goto again;
+			PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+		}
+
 		LogEvent(COMPONENT_STATE,
 			 "Share conflicts detected during add");
 		goto out_unlock;
@@ -76,12 +76,14 @@ cache_inode_create(cache_entry_t *parent,
 	fsal_status_t fsal_status = { 0, 0 };
 	struct fsal_obj_handle *object_handle;
 	struct attrlist object_attributes;
+	struct fsal_postop_attrs postop;
 	struct fsal_obj_handle *dir_handle;
 	cache_inode_create_arg_t zero_create_arg;
 	bool needdec = false;
 
 	memset(&zero_create_arg, 0, sizeof(zero_create_arg));
 	memset(&object_attributes, 0, sizeof(object_attributes));
+	memset(&postop, 0, sizeof(postop));
 
 	if (create_arg == NULL)
 		create_arg = &zero_create_arg;
@@ -119,13 +121,15 @@ cache_inode_create(cache_entry_t *parent,
 	case REGULAR_FILE:
 		fsal_status =
 		    dir_handle->obj_ops.create(dir_handle, name,
-					    &object_attributes, &object_handle);
+					    &object_attributes, &object_handle,
+					    &postop);
 		break;
 
 	case DIRECTORY:
 		fsal_status =
 		    dir_handle->obj_ops.mkdir(dir_handle, name,
-					   &object_attributes, &object_handle);
+					   &object_attributes, &object_handle,
+					   &postop);
 		break;
 
 	case SYMBOLIC_LINK:
@@ -133,7 +137,7 @@ cache_inode_create(cache_entry_t *parent,
 		    dir_handle->obj_ops.symlink(dir_handle, name,
 					     create_arg->link_content,
 					     &object_attributes,
-					     &object_handle);
+					     &object_handle, &postop);
 		break;
 
 	case SOCKET_FILE:
@@ -142,7 +146,7 @@ cache_inode_create(cache_entry_t *parent,
 						      name, type,
 						      NULL, /* dev_t !needed */
 						      &object_attributes,
-						      &object_handle);
+						      &object_handle, &postop);
 		break;
 
 	case BLOCK_FILE:
@@ -150,7 +154,8 @@ cache_inode_create(cache_entry_t *parent,
 		fsal_status =
 		    dir_handle->obj_ops.mknode(dir_handle, name, type,
 					    &create_arg->dev_spec,
-					    &object_attributes, &object_handle);
+					    &object_attributes, &object_handle,
+					    &postop);
 		break;
 
 	case NO_FILE_TYPE:
@@ -165,7 +170,7 @@ cache_inode_create(cache_entry_t *parent,
 	}
 
 	/* Refresh the parent's attributes */
-	cache_inode_refresh_attrs_locked(parent);
+	cache_inode_postop_attrs_locked(parent, &postop.dir);
 
 	/* Check for the result */
 	if (FSAL_IS_ERROR(fsal_status)) {
@@ -245,6 +250,167 @@ cache_inode_create(cache_entry_t *parent,
 	return status;
 }
 
+/**
+ * @brief Exclusively create a regular file and open it
+ *
+ * The FSAL creates the file, stores any atime/mtime in sattr (the
+ * exclusive create verifier) and hands it back already open, so the
+ * caller's later cache_inode_open with the same flags finds nothing
+ * to do.  If the FSAL cannot do that in one step, the file is created,
+ * its times set and opened in turn.  As for cache_inode_create, an
+ * entry is returned with a +1 refcount for both CACHE_INODE_SUCCESS
+ * and CACHE_INODE_ENTRY_EXISTS; only in the former case has it been
+ * created and opened.
+ *
+ * @param[in]  parent    Parent directory
+ * @param[in]  name      Name of the file to create
+ * @param[in]  mode      Mode to be used at file creation
+ * @param[in]  openflags Mode to open the new file in
+ * @param[in]  sattr     Verifier times to set, or NULL
+ * @param[out] entry     Cache entry for the created file
+ *
+ * @return CACHE_INODE_SUCCESS or errors.
+ */
+
+cache_inode_status_t
+cache_inode_create_open(cache_entry_t *parent, const char *name,
+			uint32_t mode, fsal_openflags_t openflags,
+			const struct attrlist *sattr, cache_entry_t **entry)
+{
+	cache_inode_status_t status = CACHE_INODE_SUCCESS;
+	fsal_status_t fsal_status = { 0, 0 };
+	struct fsal_obj_handle *object_handle;
+	struct attrlist object_attributes;
+	struct fsal_postop_attrs postop;
+	struct fsal_obj_handle *dir_handle = parent->obj_handle;
+
+	*entry = NULL;
+	memset(&object_attributes, 0, sizeof(object_attributes));
+	memset(&postop, 0, sizeof(postop));
+
+	/* Filter out overloaded FSAL_O_RECLAIM */
+	openflags &= ~FSAL_O_RECLAIM;
+
+	/* Better not to create the file than to create it and then
+	 * fail to open it. */
+	if (!cache_inode_lru_fds_available())
+		return CACHE_INODE_DELAY;
+
+	FSAL_SET_MASK(object_attributes.mask,
+		      ATTR_MODE | ATTR_OWNER | ATTR_GROUP);
+	object_attributes.owner = op_ctx->creds->caller_uid;
+	object_attributes.group = op_ctx->creds->caller_gid;
+	object_attributes.mode = mode;
+	if (sattr != NULL) {
+		if (FSAL_TEST_MASK(sattr->mask, ATTR_ATIME)) {
+			object_attributes.atime = sattr->atime;
+			FSAL_SET_MASK(object_attributes.mask, ATTR_ATIME);
+		}
+		if (FSAL_TEST_MASK(sattr->mask, ATTR_MTIME)) {
+			object_attributes.mtime = sattr->mtime;
+			FSAL_SET_MASK(object_attributes.mask, ATTR_MTIME);
+		}
+	}
+
+	/* increase the refcount to ensure forced lookup in FSAL */
+	atomic_inc_uint32_t(&parent->icreate_refcnt);
+	fsal_status = dir_handle->obj_ops.create_open(dir_handle, name,
+						      openflags,
+						      &object_attributes,
+						      &object_handle,
+						      &postop);
+	if (fsal_status.major == ERR_FSAL_NOTSUPP) {
+		atomic_dec_uint32_t(&parent->icreate_refcnt);
+		goto fallback;
+	}
+
+	/* Refresh the parent's attributes */
+	cache_inode_postop_attrs_locked(parent, &postop.dir);
+
+	if (FSAL_IS_ERROR(fsal_status)) {
+		atomic_dec_uint32_t(&parent->icreate_refcnt);
+		if (fsal_status.major == ERR_FSAL_STALE) {
+			LogEvent(COMPONENT_CACHE_INODE,
+				 "FSAL returned STALE on create_open");
+			cache_inode_kill_entry(parent);
+		} else if (fsal_status.major == ERR_FSAL_EXIST) {
+			/* Let the caller decide what an existing file
+			 * means, as cache_inode_create does. */
+			status = cache_inode_lookup(parent, name, entry);
+			if (*entry != NULL) {
+				if ((*entry)->type != REGULAR_FILE) {
+					cache_inode_put(*entry);
+					*entry = NULL;
+				}
+				return CACHE_INODE_ENTRY_EXISTS;
+			}
+			if (status == CACHE_INODE_NOT_FOUND)
+				return CACHE_INODE_INCONSISTENT_ENTRY;
+		}
+		return cache_inode_error_convert(fsal_status);
+	}
+
+	/* The descriptor is ours until the entry is in the cache; if
+	 * someone else got there first the handle, and the descriptor
+	 * with it, is released. */
+	atomic_inc_size_t(&open_fd_count);
+
+	status = cache_inode_new_entry(object_handle, CACHE_INODE_FLAG_CREATE,
+				       entry);
+	if (status != CACHE_INODE_SUCCESS)
+		atomic_dec_size_t(&open_fd_count);
+	if (*entry == NULL) {
+		LogFullDebug(COMPONENT_CACHE_INODE,
+			     "create_open failed because insert new entry failed");
+		goto out;
+	}
+
+	PTHREAD_RWLOCK_wrlock(&parent->content_lock);
+	/* Add this entry to the directory (also takes an internal ref) */
+	status = cache_inode_add_cached_dirent(parent, name, *entry, NULL);
+	PTHREAD_RWLOCK_unlock(&parent->content_lock);
+	if (status != CACHE_INODE_SUCCESS) {
+		cache_inode_put(*entry);
+		*entry = NULL;
+		LogFullDebug(COMPONENT_CACHE_INODE,
+			     "create_open failed because add dirent failed");
+	}
+
+ out:
+	atomic_dec_uint32_t(&parent->icreate_refcnt);
+	LogFullDebug(COMPONENT_CACHE_INODE,
+		     "Returning entry=%p status=%s for %s FSAL=%s", *entry,
+		     cache_inode_err_str(status), name,
+		     parent->obj_handle->fsal->name);
+	return status;
+
+ fallback:
+	status = cache_inode_create(parent, name, REGULAR_FILE, mode, NULL,
+				    entry);
+	if (status != CACHE_INODE_SUCCESS)
+		return status;
+
+	if (FSAL_TEST_MASK(object_attributes.mask, ATTR_ATIME | ATTR_MTIME)) {
+		struct attrlist times;
+
+		memset(&times, 0, sizeof(times));
+		times.mask = object_attributes.mask & (ATTR_ATIME | ATTR_MTIME);
+		times.atime = object_attributes.atime;
+		times.mtime = object_attributes.mtime;
+		status = cache_inode_setattr(*entry, &times, false);
+	}
+
+	if (status == CACHE_INODE_SUCCESS)
+		status = cache_inode_open(*entry, openflags, 0);
+
+	if (status != CACHE_INODE_SUCCESS) {
+		cache_inode_put(*entry);
+		*entry = NULL;
+	}
+
+	return status;
+}
+
 /**
  * @brief Set the create verifier
  *
@@ -134,6 +134,17 @@ again:
 	glist_add_tail(&export->entry_list,
 		       &expmap->entry_per_export);
 
+	/* Other exports can write what an immutable export only reads,
+	 * so the entry gets the ordinary treatment from now on. */
+	if ((entry->flags & CACHE_INODE_IMMUTABLE)
+	    && !(export->options & EXPORT_OPTION_IMMUTABLE)) {
+		atomic_clear_uint32_t_bits(&entry->flags,
+					   CACHE_INODE_IMMUTABLE);
+		if (entry->obj_handle->attributes.expire_time_attr < 0)
+			entry->obj_handle->attributes.expire_time_attr =
+			    export->expire_time_attr;
+	}
+
 	PTHREAD_RWLOCK_unlock(&export->lock);
 	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
 
@@ -95,6 +95,12 @@ cache_inode_invalidate(cache_entry_t *entry, uint32_t flags)
 					   CACHE_INODE_TRUST_CONTENT |
 					   CACHE_INODE_DIR_POPULATED);
 
+	if ((flags & CACHE_INODE_INVALIDATE_EXPIRE)
+	    && entry->obj_handle->attributes.expire_time_attr < 0
+	    && !(entry->flags & CACHE_INODE_IMMUTABLE))
+		entry->obj_handle->attributes.expire_time_attr =
+		    cache_param.expire_time_attr;
+
 	/* lock order requires that we release entry->attr_lock before
 	 * calling cache_inode_close! */
 	if (!(flags & CACHE_INODE_INVALIDATE_GOT_LOCK))
@@ -73,6 +73,7 @@ cache_inode_link(cache_entry_t *entry,
 	cache_inode_status_t status = CACHE_INODE_SUCCESS;
 	cache_inode_status_t status_ref_entry = CACHE_INODE_SUCCESS;
 	cache_inode_status_t status_ref_dest_dir = CACHE_INODE_SUCCESS;
+	struct fsal_postop_attrs postop;
 
 	/* The file to be hardlinked can't be a DIRECTORY */
 	if (entry->type == DIRECTORY) {
@@ -102,12 +103,13 @@ cache_inode_link(cache_entry_t *entry,
 
 	/* Rather than performing a lookup first, just try to make the
 	   link and return the FSAL's error if it fails. */
+	memset(&postop, 0, sizeof(postop));
 	fsal_status =
 	    entry->obj_handle->obj_ops.link(entry->obj_handle,
-					 dest_dir->obj_handle, name);
-	status_ref_entry = cache_inode_refresh_attrs_locked(entry);
+					 dest_dir->obj_handle, name, &postop);
+	status_ref_entry = cache_inode_postop_attrs_locked(entry, &postop.obj);
 	status_ref_dest_dir =
-	    cache_inode_refresh_attrs_locked(dest_dir);
+	    cache_inode_postop_attrs_locked(dest_dir, &postop.dir);
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		status = cache_inode_error_convert(fsal_status);
@@ -55,6 +55,7 @@
 #include "gsh_intrinsic.h"
 #include "sal_functions.h"
 #include "nfs_exports.h"
+#include "mem_governor.h"
 
 /**
  *
@@ -181,6 +182,10 @@ size_t open_fd_count = 0;
 
 static struct fridgethr *lru_fridge;
 
+/* Set when the LRU parameters are reloaded, so lru_run starts again
+   from the new LRU_Run_Interval. */
+static uint32_t lru_reset_wait;
+
 enum lru_edge {
 	LRU_HEAD,		/* LRU */
 	LRU_TAIL		/* MRU */
@@ -509,12 +514,34 @@ lru_reap_impl(enum lru_q_id qid)
 	return lru;
 }
 
+static struct mem_gov_consumer lru_mem_consumer;
+
+/**
+ * @brief How many entries the cache may hold now
+ *
+ * @return Entries_HWMark, or less under memory pressure.
+ */
+
+static inline uint64_t
+lru_entries_limit(void)
+{
+	uint64_t limit = lru_state.entries_hiwat;
+	uint64_t budget = mem_gov_budget(&lru_mem_consumer);
+
+	/* Under memory pressure, recycle rather than grow */
+	if (budget != MEM_GOV_UNLIMITED &&
+	    budget / sizeof(cache_entry_t) < limit)
+		limit = budget / sizeof(cache_entry_t);
+
+	return limit;
+}
+
 static inline cache_inode_lru_t *
 lru_try_reap_entry(void)
 {
 	cache_inode_lru_t *lru;
 
-	if (lru_state.entries_used < lru_state.entries_hiwat)
+	if (lru_state.entries_used < lru_entries_limit())
 		return NULL;
 
 	lru = lru_reap_impl(LRU_ENTRY_L2);
@@ -689,6 +716,9 @@ lru_run(struct fridgethr_context *ctx)
 
 	SetNameFunction("cache_lru");
 
+	if (atomic_postclear_uint32_t_bits(&lru_reset_wait, 1))
+		threadwait = cache_param.lru_run_interval;
+
 	fds_avg = (lru_state.fds_hiwat - lru_state.fds_lowat) / 2;
 
 	if (cache_param.use_fd_cache)
@@ -840,7 +870,12 @@ lru_run(struct fridgethr_context *ctx)
 					 * it. */
 					PTHREAD_RWLOCK_wrlock(&entry->
 							      content_lock);
-					if (is_open(entry)) {
+					/* Spare immutable files unless fds
+					 * are running out */
+					if (is_open(entry) &&
+					    (extremis ||
+					     !(entry->flags &
+					       CACHE_INODE_IMMUTABLE))) {
 						cache_status =
 						    cache_inode_close(
 							    entry, CL_FLAGS);
@@ -896,6 +931,11 @@ lru_run(struct fridgethr_context *ctx)
 		}
 	}
 
+	/* Entries pinned by state cannot be reaped, but clients can be
+	 * asked to give back the delegations and layouts pinning them.
+	 */
+	state_recall_any_check(lru_entries_limit());
+
 	/* The following calculation will progressively garbage collect
 	 * more frequently as these two factors increase:
 	 * 1. current number of open file descriptors
@@ -938,6 +978,93 @@ lru_run(struct fridgethr_context *ctx)
 		     lru_state.fds_lowat);
 }
 
+/**
+ * @brief Bytes held in cache entries, for the memory governor
+ *
+ * Only the entries themselves are counted, not the dirents or
+ * attribute data hanging off them.
+ */
+
+static uint64_t
+lru_mem_usage(void)
+{
+	return atomic_fetch_uint64_t(&lru_state.entries_used) *
+	    sizeof(cache_entry_t);
+}
+
+/**
+ * @brief Free unreferenced entries at the request of the memory governor
+ *
+ * @param[in] bytes How much the governor would like back
+ *
+ * @return Bytes freed.
+ */
+
+static uint64_t
+lru_mem_reclaim(uint64_t bytes)
+{
+	uint64_t want = bytes / sizeof(cache_entry_t);
+	uint64_t freed = 0;
+	cache_inode_lru_t *lru;
+	cache_entry_t *entry;
+
+	while (freed < want) {
+		lru = lru_reap_impl(LRU_ENTRY_L2);
+		if (!lru)
+			lru = lru_reap_impl(LRU_ENTRY_L1);
+		if (!lru)
+			break;
+		/* we uniquely hold entry */
+		entry = container_of(lru, cache_entry_t, lru);
+		cache_inode_lru_clean(entry);
+		pool_free(cache_inode_entry_pool, entry);
+		atomic_dec_int64_t(&lru_state.entries_used);
+		++freed;
+	}
+
+	LogDebug(COMPONENT_CACHE_INODE_LRU,
+		 "Memory governor reclaimed %" PRIu64 " of %" PRIu64
+		 " entries", freed, want);
+
+	return freed * sizeof(cache_entry_t);
+}
+
+static struct mem_gov_consumer lru_mem_consumer = {
+	.name = "cache_inode",
+	.usage = lru_mem_usage,
+	.reclaim = lru_mem_reclaim,
+	.budget = MEM_GOV_UNLIMITED
+};
+
+/**
+ * @brief Derive the LRU limits from cache_param
+ */
+
+static void
+lru_set_limits(void)
+{
+	/* Set high and low watermark for cache entries.  This seems a
+	   bit fishy, so come back and revisit this. */
+	lru_state.entries_hiwat = cache_param.entries_hwmark;
+
+	lru_state.fds_hard_limit =
+	    (cache_param.fd_limit_percent *
+	     lru_state.fds_system_imposed) / 100;
+	lru_state.fds_hiwat =
+	    (cache_param.fd_hwmark_percent *
+	     lru_state.fds_system_imposed) / 100;
+	lru_state.fds_lowat =
+	    (cache_param.fd_lwmark_percent *
+	     lru_state.fds_system_imposed) / 100;
+	lru_state.futility = 0;
+
+	lru_state.per_lane_work =
+	    (cache_param.reaper_work / LRU_N_Q_LANES);
+	lru_state.biggest_window =
+	    (cache_param.biggest_window *
+	     lru_state.fds_system_imposed) / 100;
+}
+
 /* Public functions */
 
 /**
@@ -963,9 +1090,6 @@ cache_inode_lru_pkginit(void)
 
 	atomic_store_size_t(&open_fd_count, 0);
 
-	/* Set high and low watermark for cache entries.  This seems a
-	   bit fishy, so come back and revisit this. */
-	lru_state.entries_hiwat = cache_param.entries_hwmark;
 	lru_state.entries_used = 0;
 
 	/* Find out the system-imposed file descriptor limit */
@@ -1043,22 +1167,7 @@ err_open:
 			lru_state.fds_system_imposed);
 	}
 
-	lru_state.fds_hard_limit =
-	    (cache_param.fd_limit_percent *
-	     lru_state.fds_system_imposed) / 100;
-	lru_state.fds_hiwat =
-	    (cache_param.fd_hwmark_percent *
-	     lru_state.fds_system_imposed) / 100;
-	lru_state.fds_lowat =
-	    (cache_param.fd_lwmark_percent *
-	     lru_state.fds_system_imposed) / 100;
-	lru_state.futility = 0;
-
-	lru_state.per_lane_work =
-	    (cache_param.reaper_work / LRU_N_Q_LANES);
-	lru_state.biggest_window =
-	    (cache_param.biggest_window *
-	     lru_state.fds_system_imposed) / 100;
+	lru_set_limits();
 
 	lru_state.prev_fd_count = 0;
 
@@ -1067,6 +1176,10 @@ err_open:
 	/* init queue complex */
 	lru_init_queues();
 
+	lru_mem_consumer.weight = mem_gov_param.cache_inode_weight;
+	lru_mem_consumer.floor = mem_gov_param.cache_inode_floor;
+	mem_governor_register(&lru_mem_consumer);
+
 	/* spawn LRU background thread */
 	code = fridgethr_init(&lru_fridge, "LRU_fridge", &frp);
 	if (code != 0) {
@@ -1086,6 +1199,22 @@ err_open:
 	return 0;
 }
 
+/**
+ * @brief Apply reloaded LRU parameters
+ *
+ * The watermarks take effect on the next pass of the LRU thread,
+ * which is woken to run it now with the new LRU_Run_Interval.
+ */
+void
+cache_inode_lru_reconfig(void)
+{
+	lru_set_limits();
+	lru_state.caching_fds = cache_param.use_fd_cache;
+
+	atomic_set_uint32_t_bits(&lru_reset_wait, 1);
+	fridgethr_wake(lru_fridge);
+}
+
 /**
  * Shutdown subsystem
  *
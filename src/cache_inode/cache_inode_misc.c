@@ -335,10 +335,12 @@ cache_inode_new_entry(struct fsal_obj_handle *new_obj,
 
 		/* No shares or locks, yet. */
 		glist_init(&nentry->object.file.lock_list);
+		glist_init(&nentry->object.file.lock_waiters);
 		glist_init(&nentry->object.file.nlm_share_list);
 		memset(&nentry->object.file.share_state, 0,
 		       sizeof(cache_inode_share_t));
 		nentry->object.file.write_delegated = false;
+		nentry->object.file.recallable_states = 0;
 
 		/* Init statistics used for intelligently granting delegations*/
 		init_deleg_heuristics(nentry);
@@ -389,7 +391,10 @@ cache_inode_new_entry(struct fsal_obj_handle *new_obj,
 
 	nentry->obj_handle = new_obj;
 
-	if (nentry->obj_handle->attributes.expire_time_attr == 0) {
+	if (op_ctx->export->options & EXPORT_OPTION_IMMUTABLE) {
+		/* Nothing will change it behind our back */
+		nentry->obj_handle->attributes.expire_time_attr = -1;
+	} else if (nentry->obj_handle->attributes.expire_time_attr == 0) {
 		nentry->obj_handle->attributes.expire_time_attr =
 					op_ctx->export->expire_time_attr;
 	}
@@ -401,6 +406,9 @@ cache_inode_new_entry(struct fsal_obj_handle *new_obj,
 	 */
 	nentry->flags = LRU_FLAG_NONE;
 
+	if (op_ctx->export->options & EXPORT_OPTION_IMMUTABLE)
+		nentry->flags |= CACHE_INODE_IMMUTABLE;
+
 	/* Hash and insert entry */
 	rc = cih_set_latched(nentry, &latch,
 			     op_ctx->fsal_export->fsal, &fh_desc,
@@ -564,6 +572,77 @@ void cache_inode_unexport(struct gsh_export *export)
 	}
 }
 
+/**
+ * @brief Invalidate everything cached for an export
+ *
+ * Used to pick up changes to an immutable export's underlying data,
+ * which are otherwise never looked for.  Attributes and content of
+ * every entry reachable through the export are marked untrusted and
+ * open files are closed, so each is reloaded from the FSAL on its
+ * next use.  Entries stay hashed and mapped, so handles held by
+ * clients and states on the entries remain valid.
+ *
+ * @param[in] export The export to refresh
+ *
+ * @return Number of entries invalidated.
+ */
+
+int cache_inode_invalidate_export(struct gsh_export *export)
+{
+	cache_entry_t **entries;
+	struct entry_export_map *expmap;
+	struct glist_head *glist;
+	cache_inode_status_t status;
+	size_t count = 0, alloc = 0, i;
+
+	/* The entry locks come before the export lock, so take a
+	 * reference on each entry under the export lock and invalidate
+	 * them after dropping it. */
+	PTHREAD_RWLOCK_rdlock(&export->lock);
+
+	glist_for_each(glist, &export->entry_list)
+		alloc++;
+
+	entries = gsh_malloc(sizeof(*entries) * (alloc ? alloc : 1));
+	if (entries == NULL) {
+		PTHREAD_RWLOCK_unlock(&export->lock);
+		LogCrit(COMPONENT_CACHE_INODE,
+			"Could not allocate %zu entries to invalidate export %d",
+			alloc, export->export_id);
+		return 0;
+	}
+
+	glist_for_each(glist, &export->entry_list) {
+		expmap = glist_entry(glist, struct entry_export_map,
+				     entry_per_export);
+		if (cache_inode_lru_ref(expmap->entry, LRU_FLAG_NONE) ==
+		    CACHE_INODE_SUCCESS)
+			entries[count++] = expmap->entry;
+	}
+
+	PTHREAD_RWLOCK_unlock(&export->lock);
+
+	for (i = 0; i < count; i++) {
+		status = cache_inode_invalidate(entries[i],
+						CACHE_INODE_INVALIDATE_ATTRS |
+						CACHE_INODE_INVALIDATE_CONTENT |
+						CACHE_INODE_INVALIDATE_CLOSE);
+		if (status != CACHE_INODE_SUCCESS)
+			LogDebug(COMPONENT_CACHE_INODE,
+				 "Invalidating entry %p failed: %s",
+				 entries[i], cache_inode_err_str(status));
+		cache_inode_lru_unref(entries[i], LRU_FLAG_NONE);
+	}
+
+	gsh_free(entries);
+
+	LogEvent(COMPONENT_CACHE_INODE,
+		 "Invalidated %zu cached entries of export %d",
+		 count, export->export_id);
+
+	return count;
+}
+
 /**
  * @brief Converts an FSAL error to the corresponding cache_inode error
  *
@@ -888,4 +967,50 @@ cache_inode_lock_trust_attrs(cache_entry_t *entry,
 	return cache_status;
 }
 
+/**
+ * @brief Adapt an entry's attribute expiry after a refresh
+ *
+ * When the export sets Attr_Expiration_Max_Time, an object whose
+ * attributes keep coming back unchanged is trusted twice as long each
+ * time, up to the maximum, and one seen to change drops back to
+ * Attr_Expiration_Min_Time.  Growth is also held to half the time
+ * since the object last changed, so something that changed recently
+ * is not trusted for long just because a couple of refreshes happened
+ * to fall between changes.  Static files end up revalidated rarely
+ * and changing ones promptly.  Entries that never expire, or are
+ * never trusted, are left alone.
+ *
+ * @param[in] expire  Expiry in seconds before the refresh
+ * @param[in] changed Whether the refresh found the object changed
+ * @param[in] chgtime When the object last changed
+ *
+ * @return The expiry to use from now on.
+ */
+
+int32_t cache_inode_adapt_expire(int32_t expire, bool changed,
+				 const struct timespec *chgtime)
+{
+	int32_t min, max;
+	time_t age;
+
+	if (expire <= 0 || op_ctx == NULL || op_ctx->export == NULL)
+		return expire;
+
+	max = op_ctx->export->expire_time_attr_max;
+	if (max == 0)
+		return expire;
+
+	min = op_ctx->export->expire_time_attr_min;
+	if (changed || expire < min)
+		return min;
+
+	expire = expire > max / 2 ? max : expire * 2;
+
+	age = time(NULL) - chgtime->tv_sec;
+	if (expire > age / 2)
+		expire = age / 2 < min ? min : age / 2;
+
+	return expire;
+}
+
 /** @} */
@@ -298,7 +298,10 @@ cache_inode_close(cache_entry_t *entry, uint32_t flags)
 	}
 
 
-	if (!cache_inode_lru_caching_fds()
+	/* Files of immutable exports stay open read-only until the
+	 * reaper or an invalidation really closes them. */
+	if ((!cache_inode_lru_caching_fds()
+	     && !(entry->flags & CACHE_INODE_IMMUTABLE))
 	    || (flags & CACHE_INODE_FLAG_REALLYCLOSE)
 	    || (entry->obj_handle->attributes.numlinks == 0)) {
 		LogFullDebug(COMPONENT_CACHE_INODE, "Closing entry %p", entry);
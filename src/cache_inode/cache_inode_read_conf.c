@@ -89,7 +89,7 @@ static void *cache_inode_param_init(void *link_mem, void *self_struct)
 	if (self_struct == NULL)
 		return &cache_param;
 	else
-		return NULL;
+		return self_struct;
 }
 
 struct config_block cache_inode_param_blk = {
@@ -364,6 +364,7 @@ struct cache_inode_populate_cb_state {
  * readdir.
  *
  * @param[in]     name      Name of the directory entry
+ * @param[in]     obj       Handle for the entry, NULL to look it up
  * @param[in,out] dir_state Callback state
  * @param[in]     cookie    Directory cookie
  *
@@ -372,8 +373,8 @@ struct cache_inode_populate_cb_state {
  */
 
 static bool
-populate_dirent(const char *name, void *dir_state,
-		fsal_cookie_t cookie)
+populate_dirent(const char *name, struct fsal_obj_handle *obj,
+		void *dir_state, fsal_cookie_t cookie)
 {
 	struct cache_inode_populate_cb_state *state =
 	    (struct cache_inode_populate_cb_state *)dir_state;
@@ -383,6 +384,12 @@ populate_dirent(const char *name, void *dir_state,
 	fsal_status_t fsal_status = { 0, 0 };
 	struct fsal_obj_handle *dir_hdl = state->directory->obj_handle;
 
+	if (obj != NULL) {
+		/* The FSAL got it with the name, no need to look it up */
+		entry_hdl = obj;
+		goto new_entry;
+	}
+
 	fsal_status = dir_hdl->obj_ops.lookup(dir_hdl, name, &entry_hdl);
 	if (FSAL_IS_ERROR(fsal_status)) {
 		*state->status = cache_inode_error_convert(fsal_status);
@@ -399,6 +406,7 @@ populate_dirent(const char *name, void *dir_state,
 		return !cache_param.retry_readdir;
 	}
 
+ new_entry:
 	LogFullDebug(COMPONENT_NFS_READDIR, "Creating entry for %s", name);
 
 	*state->status =
@@ -74,6 +74,7 @@ cache_inode_remove(cache_entry_t *entry, const char *name)
 	fsal_status_t fsal_status = { 0, 0 };
 	cache_inode_status_t status = CACHE_INODE_SUCCESS;
 	cache_inode_status_t status_ref_entry = CACHE_INODE_SUCCESS;
+	struct fsal_postop_attrs postop;
 
 	if (entry->type != DIRECTORY) {
 		status = CACHE_INODE_NOT_A_DIRECTORY;
@@ -136,8 +137,10 @@ cache_inode_remove(cache_entry_t *entry, const char *name)
 		}
 	}
 
+	memset(&postop, 0, sizeof(postop));
 	fsal_status =
-	    entry->obj_handle->obj_ops.unlink(entry->obj_handle, name);
+	    entry->obj_handle->obj_ops.unlink(entry->obj_handle, name,
+					      &postop);
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		if (fsal_status.major == ERR_FSAL_STALE)
@@ -169,7 +172,7 @@ cache_inode_remove(cache_entry_t *entry, const char *name)
 		 cache_inode_err_str(status_ref_entry));
 	PTHREAD_RWLOCK_unlock(&entry->content_lock);
 
-	status_ref_entry = cache_inode_refresh_attrs_locked(entry);
+	status_ref_entry = cache_inode_postop_attrs_locked(entry, &postop.dir);
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		status = cache_inode_error_convert(fsal_status);
@@ -179,8 +182,17 @@ cache_inode_remove(cache_entry_t *entry, const char *name)
 		goto out;
 	}
 
-	/* Update the attributes for the removed entry */
-	(void)cache_inode_refresh_attrs_locked(to_remove_entry);
+	/* Update the attributes for the removed entry.  One the FSAL says
+	 * has no links left is gone, unless it is still open or has
+	 * state, which keep it alive until they go.
+	 */
+	if (postop.obj.mask != 0 && postop.obj.numlinks == 0 &&
+	    !is_open(to_remove_entry) &&
+	    !cache_inode_is_pinned(to_remove_entry))
+		cache_inode_kill_entry(to_remove_entry);
+	else
+		(void)cache_inode_postop_attrs_locked(to_remove_entry,
+						      &postop.obj);
 
 	status = status_ref_entry;
 	if (status != CACHE_INODE_SUCCESS) {
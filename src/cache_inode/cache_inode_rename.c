@@ -198,6 +198,7 @@ cache_inode_rename(cache_entry_t *dir_src,
 	cache_inode_status_t status_ref_dir_dst = CACHE_INODE_SUCCESS;
 	cache_inode_status_t status_ref_src = CACHE_INODE_SUCCESS;
 	cache_inode_status_t status_ref_dst = CACHE_INODE_SUCCESS;
+	struct fsal_postop_attrs postop;
 
 	if ((dir_src->type != DIRECTORY) || (dir_dest->type != DIRECTORY)) {
 		status = CACHE_INODE_NOT_A_DIRECTORY;
@@ -291,20 +292,25 @@ cache_inode_rename(cache_entry_t *dir_src,
 	 */
 	LogFullDebug(COMPONENT_CACHE_INODE, "about to call FSAL rename");
 
+	memset(&postop, 0, sizeof(postop));
 	fsal_status =
 	    dir_src->obj_handle->obj_ops.rename(lookup_src->obj_handle,
 						dir_src->obj_handle, oldname,
-						dir_dest->obj_handle, newname);
+						dir_dest->obj_handle, newname,
+						&postop);
 
 	LogFullDebug(COMPONENT_CACHE_INODE, "returned from FSAL rename");
 
-	status_ref_dir_src = cache_inode_refresh_attrs_locked(dir_src);
+	status_ref_dir_src = cache_inode_postop_attrs_locked(dir_src,
+							     &postop.dir);
 
 	if (dir_src != dir_dest)
 		status_ref_dir_dst =
-			cache_inode_refresh_attrs_locked(dir_dest);
+			cache_inode_postop_attrs_locked(dir_dest,
+							&postop.newdir);
 
-	status_ref_src = cache_inode_refresh_attrs_locked(lookup_src);
+	status_ref_src = cache_inode_postop_attrs_locked(lookup_src,
+							 &postop.obj);
 
 	LogFullDebug(COMPONENT_CACHE_INODE, "done refreshing attributes");
 
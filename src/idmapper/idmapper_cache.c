@@ -43,6 +43,7 @@
 #include "avltree.h"
 #include "idmapper.h"
 #include "abstract_atomic.h"
+#include "mem_governor.h"
 
 /**
  * @brief User entry in the IDMapper cache
@@ -128,6 +129,149 @@ static struct avltree gname_tree;
 
 static struct avltree gid_tree;
 
+/**
+ * @brief Bytes held by both caches, for the memory governor
+ */
+
+static uint64_t idmapper_cache_bytes;
+
+#define USER_BYTES(u) (sizeof(struct cache_user) + (u)->uname.len)
+#define GROUP_BYTES(g) (sizeof(struct cache_group) + (g)->gname.len)
+
+static uint64_t idmapper_mem_usage(void)
+{
+	return atomic_fetch_uint64_t(&idmapper_cache_bytes);
+}
+
+/**
+ * @brief Where the last reclaim stopped in each name tree
+ *
+ * Entries carry no recency information, so successive reclaims go
+ * round the cache rather than always dropping the same entries.
+ */
+
+static uint32_t idmapper_user_reclaim_pos;
+static uint32_t idmapper_group_reclaim_pos;
+
+/**
+ * @brief Find where the last reclaim of a tree stopped
+ *
+ * @param[in]     tree Name tree
+ * @param[in,out] pos  Position in tree order, reset if past the end
+ *
+ * @return The node to reclaim next, NULL if the tree is empty.
+ */
+
+static struct avltree_node *idmapper_reclaim_start(const struct avltree *tree,
+						   uint32_t *pos)
+{
+	struct avltree_node *node = avltree_first(tree);
+	uint32_t i;
+
+	for (i = 0; node != NULL && i < *pos; i++)
+		node = avltree_next(node);
+
+	if (node == NULL) {
+		*pos = 0;
+		node = avltree_first(tree);
+	}
+
+	return node;
+}
+
+/**
+ * @brief Drop a user from the cache
+ *
+ * @note The caller must hold idmapper_user_lock for write.
+ */
+
+static void idmapper_drop_user(struct cache_user *user)
+{
+	if (user->in_uidtree) {
+		uid_cache[user->uid % id_cache_size] = NULL;
+		avltree_remove(&user->uid_node, &uid_tree);
+	}
+	avltree_remove(&user->uname_node, &uname_tree);
+	atomic_sub_uint64_t(&idmapper_cache_bytes, USER_BYTES(user));
+	gsh_free(user);
+}
+
+/**
+ * @brief Drop a group from the cache
+ *
+ * @note The caller must hold idmapper_group_lock for write.
+ */
+
+static void idmapper_drop_group(struct cache_group *group)
+{
+	gid_cache[group->gid % id_cache_size] = NULL;
+	avltree_remove(&group->gid_node, &gid_tree);
+	avltree_remove(&group->gname_node, &gname_tree);
+	atomic_sub_uint64_t(&idmapper_cache_bytes, GROUP_BYTES(group));
+	gsh_free(group);
+}
+
+/**
+ * @brief Give memory back to the governor
+ *
+ * Users and groups are dropped in turn until about @a bytes have been
+ * released.  They are looked up again on demand.
+ */
+
+static uint64_t idmapper_mem_reclaim(uint64_t bytes)
+{
+	struct avltree_node *unode, *gnode;
+	struct cache_user *user;
+	struct cache_group *group;
+	uint64_t freed = 0;
+
+	PTHREAD_RWLOCK_wrlock(&idmapper_user_lock);
+	PTHREAD_RWLOCK_wrlock(&idmapper_group_lock);
+
+	unode = idmapper_reclaim_start(&uname_tree,
+				       &idmapper_user_reclaim_pos);
+	gnode = idmapper_reclaim_start(&gname_tree,
+				       &idmapper_group_reclaim_pos);
+
+	while (freed < bytes && (unode != NULL || gnode != NULL)) {
+		if (unode != NULL) {
+			user = avltree_container_of(unode, struct cache_user,
+						    uname_node);
+			unode = avltree_next(unode);
+			freed += USER_BYTES(user);
+			idmapper_drop_user(user);
+			if (unode == NULL) {
+				idmapper_user_reclaim_pos = 0;
+				unode = avltree_first(&uname_tree);
+			}
+		}
+
+		if (gnode != NULL && freed < bytes) {
+			group = avltree_container_of(gnode, struct cache_group,
+						     gname_node);
+			gnode = avltree_next(gnode);
+			freed += GROUP_BYTES(group);
+			idmapper_drop_group(group);
+			if (gnode == NULL) {
+				idmapper_group_reclaim_pos = 0;
+				gnode = avltree_first(&gname_tree);
+			}
+		}
+	}
+
+	PTHREAD_RWLOCK_unlock(&idmapper_group_lock);
+	PTHREAD_RWLOCK_unlock(&idmapper_user_lock);
+
+	return freed;
+}
+
+static struct mem_gov_consumer idmapper_mem_consumer = {
+	.name = "idmapper",
+	.usage = idmapper_mem_usage,
+	.reclaim = idmapper_mem_reclaim,
+	.budget = MEM_GOV_UNLIMITED
+};
+
 /**
  * @brief Compare two buffers
  *
@@ -278,6 +422,10 @@ void idmapper_cache_init(void)
 	avltree_init(&gname_tree, gname_comparator, 0);
 	avltree_init(&gid_tree, gid_comparator, 0);
 	memset(gid_cache, 0, id_cache_size * sizeof(struct avltree_node *));
+
+	idmapper_mem_consumer.weight = mem_gov_param.idmapper_weight;
+	idmapper_mem_consumer.floor = mem_gov_param.idmapper_floor;
+	mem_governor_register(&idmapper_mem_consumer);
 }
 
 /**
@@ -321,6 +469,7 @@ bool idmapper_add_user(const struct gsh_buffdesc *name, uid_t uid,
 		new->gid = -1;
 		new->gid_set = false;
 	}
+	atomic_add_uint64_t(&idmapper_cache_bytes, USER_BYTES(new));
 
 	/*
 	 * The threads that lookup by-name or by-id use the read lock. If
@@ -345,6 +494,7 @@ bool idmapper_add_user(const struct gsh_buffdesc *name, uid_t uid,
 			uid_cache[tmp->uid % id_cache_size] = NULL;
 			avltree_remove(&tmp->uid_node, &uid_tree);
 		}
+		atomic_sub_uint64_t(&idmapper_cache_bytes, USER_BYTES(tmp));
 		gsh_free(tmp);
 		found_name = avltree_insert(&new->uname_node, &uname_tree);
 		assert(found_name == NULL);
@@ -364,6 +514,7 @@ bool idmapper_add_user(const struct gsh_buffdesc *name, uid_t uid,
 		uid_cache[tmp->uid % id_cache_size] = NULL;
 		avltree_remove(found_id, &uid_tree);
 		avltree_remove(&tmp->uname_node, &uname_tree);
+		atomic_sub_uint64_t(&idmapper_cache_bytes, USER_BYTES(tmp));
 		gsh_free(tmp);
 		found_id = avltree_insert(&new->uid_node, &uid_tree);
 		assert(found_id == NULL);
@@ -404,6 +555,7 @@ bool idmapper_add_group(const struct gsh_buffdesc *name, const gid_t gid)
 	new->gname.len = name->len;
 	new->gid = gid;
 	memcpy(new->gname.addr, name->addr, name->len);
+	atomic_add_uint64_t(&idmapper_cache_bytes, GROUP_BYTES(new));
 
 	/*
 	 * The threads that lookup by-name or by-id use the read lock. If
@@ -426,6 +578,7 @@ bool idmapper_add_group(const struct gsh_buffdesc *name, const gid_t gid)
 		avltree_remove(found_name, &gname_tree);
 		avltree_remove(&tmp->gid_node, &gid_tree);
 		gid_cache[tmp->gid % id_cache_size] = NULL;
+		atomic_sub_uint64_t(&idmapper_cache_bytes, GROUP_BYTES(tmp));
 		gsh_free(tmp);
 		found_name = avltree_insert(&new->gname_node, &gname_tree);
 		assert(found_name == NULL);
@@ -439,6 +592,7 @@ bool idmapper_add_group(const struct gsh_buffdesc *name, const gid_t gid)
 		gid_cache[tmp->gid % id_cache_size] = NULL;
 		avltree_remove(found_id, &gid_tree);
 		avltree_remove(&tmp->gname_node, &gname_tree);
+		atomic_sub_uint64_t(&idmapper_cache_bytes, GROUP_BYTES(tmp));
 		gsh_free(tmp);
 		found_id = avltree_insert(&new->gid_node, &gid_tree);
 		assert(found_id == NULL);
@@ -696,6 +850,8 @@ void idmapper_clear_cache(void)
 
 	assert(avltree_first(&gid_tree) == NULL);
 
+	atomic_store_uint64_t(&idmapper_cache_bytes, 0);
+
 	PTHREAD_RWLOCK_unlock(&idmapper_group_lock);
 	PTHREAD_RWLOCK_unlock(&idmapper_user_lock);
 }
@@ -66,12 +66,17 @@
  * uint64_t atomic_postclear_uint64_t_bits(uint64_t *var,
  * uint64_t atomic_postset_uint64_t_bits(uint64_t *var,
  *
+ * Compare and swap is provided for uint64_t and uint32_t:
+ *
+ * bool atomic_cas_uint64_t(uint64_t *var, uint64_t oldval, uint64_t newval)
+ *
  */
 
 #ifndef _ABSTRACT_ATOMIC_H
 #define _ABSTRACT_ATOMIC_H
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <time.h>
 
 #undef GCC_SYNC_FUNCTIONS
@@ -2470,4 +2475,66 @@ static inline void atomic_store_uint8_t(uint8_t *var, uint8_t val)
 	(void)__sync_lock_test_and_set(var, val);
 }
 #endif
+
+/*
+ * Compare and swap
+ */
+
+/**
+ * @brief Atomically compare and swap a uint64_t
+ *
+ * This function atomically replaces the value indicated by the
+ * supplied pointer with @c newval if and only if it currently holds
+ * @c oldval.
+ *
+ * @param[in,out] var    Pointer to the variable to modify
+ * @param[in]     oldval The value expected to be in var
+ * @param[in]     newval The value to store
+ *
+ * @return true if the value was swapped.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline bool atomic_cas_uint64_t(uint64_t *var, uint64_t oldval,
+				       uint64_t newval)
+{
+	return __atomic_compare_exchange_n(var, &oldval, newval, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline bool atomic_cas_uint64_t(uint64_t *var, uint64_t oldval,
+				       uint64_t newval)
+{
+	return __sync_bool_compare_and_swap(var, oldval, newval);
+}
+#endif
+
+/**
+ * @brief Atomically compare and swap a uint32_t
+ *
+ * This function atomically replaces the value indicated by the
+ * supplied pointer with @c newval if and only if it currently holds
+ * @c oldval.
+ *
+ * @param[in,out] var    Pointer to the variable to modify
+ * @param[in]     oldval The value expected to be in var
+ * @param[in]     newval The value to store
+ *
+ * @return true if the value was swapped.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline bool atomic_cas_uint32_t(uint32_t *var, uint32_t oldval,
+				       uint32_t newval)
+{
+	return __atomic_compare_exchange_n(var, &oldval, newval, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline bool atomic_cas_uint32_t(uint32_t *var, uint32_t oldval,
+				       uint32_t newval)
+{
+	return __sync_bool_compare_and_swap(var, oldval, newval);
+}
+#endif
 #endif				/* !_ABSTRACT_ATOMIC_H */
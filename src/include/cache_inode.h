@@ -242,6 +242,10 @@ static const uint32_t CACHE_INODE_TRUST_ATTRS = 0x00000001;
 static const uint32_t CACHE_INODE_TRUST_CONTENT = 0x00000002;
 /** The directory has been populated (negative lookups are meaningful) */
 static const uint32_t CACHE_INODE_DIR_POPULATED = 0x00000004;
+/** Entry is only mapped into immutable exports, its attributes and
+    content only go stale when explicitly invalidated.  Cleared for good
+    once the entry is mapped into an export that is not immutable. */
+static const uint32_t CACHE_INODE_IMMUTABLE = 0x00000008;
 
 /**
  * @brief The ref counted share reservation state.
@@ -487,11 +491,15 @@ struct cache_entry_t {
 		struct cache_inode_file {
 			/** Pointers for lock list */
 			struct glist_head lock_list;
+			/** NFSv4.1 lock owners waiting for blocking locks */
+			struct glist_head lock_waiters;
 			/** Pointers for NLM share list */
 			struct glist_head nlm_share_list;
 			/** Share reservation state for this file. */
 			cache_inode_share_t share_state;
 			bool write_delegated; /* true iff write delegated */
+			/** Delegations and layouts held, under state_lock */
+			uint32_t recallable_states;
 			/** Delegation statistics */
 			struct file_deleg_stats fdeleg_stats;
 			uint32_t anon_ops;   /* number of anonymous operations
@@ -603,6 +611,9 @@ static const uint32_t CACHE_INODE_INVALIDATE_ATTRS = 0x01;
 static const uint32_t CACHE_INODE_INVALIDATE_CONTENT = 0x02;
 static const uint32_t CACHE_INODE_INVALIDATE_CLOSE = 0x04;
 static const uint32_t CACHE_INODE_INVALIDATE_GOT_LOCK = 0x08;
+/** Attributes that never expired do again; the FSAL can no longer
+    tell us when they change */
+static const uint32_t CACHE_INODE_INVALIDATE_EXPIRE = 0x10;
 
 enum cb_state {
 	CB_ORIGINAL,
@@ -670,6 +681,7 @@ cache_entry_t *cache_inode_get_keyed(cache_inode_key_t *key,
 				     cache_inode_status_t *status);
 
 void cache_inode_unexport(struct gsh_export *export);
+int cache_inode_invalidate_export(struct gsh_export *export);
 
 cache_inode_status_t cache_inode_access_sw(cache_entry_t *entry,
 					   fsal_accessflags_t access_type,
@@ -740,6 +752,12 @@ cache_inode_status_t cache_inode_create(cache_entry_t *entry_parent,
 					cache_inode_create_arg_t *create_arg,
 					cache_entry_t **created);
 
+cache_inode_status_t cache_inode_create_open(cache_entry_t *parent,
+					     const char *name, uint32_t mode,
+					     fsal_openflags_t openflags,
+					     const struct attrlist *sattr,
+					     cache_entry_t **created);
+
 cache_inode_status_t cache_inode_getattr(cache_entry_t *entry,
 					 void *opaque,
 					 cache_inode_getattr_cb_t cb,
@@ -853,6 +871,9 @@ void cache_inode_release_dirents(cache_entry_t *entry,
 
 void cache_inode_kill_entry(cache_entry_t *entry);
 
+int32_t cache_inode_adapt_expire(int32_t expire, bool changed,
+				 const struct timespec *chgtime);
+
 cache_inode_status_t cache_inode_invalidate(cache_entry_t *entry,
 					    uint32_t flags);
 
@@ -916,6 +937,9 @@ cache_inode_is_attrs_valid(const cache_entry_t *entry)
 	if (FSAL_TEST_MASK(entry->obj_handle->attributes.mask, ATTR_RDATTR_ERR))
 		return false;
 
+	if (entry->flags & CACHE_INODE_IMMUTABLE)
+		return true;
+
 	if (entry->type == DIRECTORY
 	    && cache_param.getattr_dir_invalidation)
 		return false;
@@ -950,6 +974,9 @@ cache_inode_refresh_attrs(cache_entry_t *entry)
 {
 	fsal_status_t fsal_status = { ERR_FSAL_NO_ERROR, 0 };
 	cache_inode_status_t cache_status = CACHE_INODE_SUCCESS;
+	struct attrlist *attrs;
+	int32_t expire = entry->obj_handle->attributes.expire_time_attr;
+	time_t change_time = entry->change_time;
 
 	if (entry->obj_handle->attributes.acl) {
 		fsal_acl_status_t acl_status = 0;
@@ -974,6 +1001,15 @@ cache_inode_refresh_attrs(cache_entry_t *entry)
 		goto out;
 	}
 
+	/* The FSAL may have supplied its own expiry, otherwise keep
+	 * adapting ours. */
+	attrs = &entry->obj_handle->attributes;
+	if (attrs->expire_time_attr == expire)
+		attrs->expire_time_attr = cache_inode_adapt_expire(
+			expire,
+			timespec_to_nsecs(&attrs->chgtime) != change_time,
+			&attrs->chgtime);
+
 	cache_inode_fixup_md(entry);
 
  out:
@@ -1002,6 +1038,104 @@ cache_inode_refresh_attrs_locked(cache_entry_t *entry)
 	return status;
 }
 
+/**
+ * @brief Merge attributes into the cached ones by mask
+ *
+ * The ACL is left alone: the cached one is referenced, and namespace
+ * operations do not change it.
+ *
+ * @param[in,out] cached Cached attributes
+ * @param[in]     attrs  Attributes to merge, by their mask
+ */
+static inline void
+cache_inode_merge_attrs(struct attrlist *cached, const struct attrlist *attrs)
+{
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_TYPE))
+		cached->type = attrs->type;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_SIZE))
+		cached->filesize = attrs->filesize;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_FSID))
+		cached->fsid = attrs->fsid;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_FILEID))
+		cached->fileid = attrs->fileid;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_MODE))
+		cached->mode = attrs->mode;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_NUMLINKS))
+		cached->numlinks = attrs->numlinks;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_OWNER))
+		cached->owner = attrs->owner;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_GROUP))
+		cached->group = attrs->group;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_RAWDEV))
+		cached->rawdev = attrs->rawdev;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_ATIME))
+		cached->atime = attrs->atime;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_CREATION))
+		cached->creation = attrs->creation;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_CTIME))
+		cached->ctime = attrs->ctime;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_MTIME))
+		cached->mtime = attrs->mtime;
+	/* posix2fsal_attributes derives change from chgtime */
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_CHGTIME)) {
+		cached->chgtime = attrs->chgtime;
+		cached->change = attrs->change;
+	}
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_CHANGE))
+		cached->change = attrs->change;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_SPACEUSED))
+		cached->spaceused = attrs->spaceused;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_GENERATION))
+		cached->generation = attrs->generation;
+
+	cached->mask |= attrs->mask & ~ATTR_ACL;
+}
+
+/**
+ * @brief Install attributes a namespace operation returned
+ *
+ * Does what cache_inode_refresh_attrs_locked does with attributes the
+ * FSAL handed back from create, link, rename or unlink, saving it a
+ * getattrs.  If it left them out (empty mask) they are fetched as
+ * usual.  Otherwise they are merged into the cached ones by mask.
+ * Every such operation changes the ctime of what it touches, so if
+ * the FSAL left the ctime out, the attributes are marked untrusted
+ * and the next use fetches them.
+ *
+ * @param[in,out] entry The entry to be refreshed
+ * @param[in]     attrs Attributes from the FSAL
+ */
+static inline cache_inode_status_t
+cache_inode_postop_attrs_locked(cache_entry_t *entry,
+				const struct attrlist *attrs)
+{
+	struct attrlist *cached = &entry->obj_handle->attributes;
+	int32_t expire;
+
+	if (attrs->mask == 0)
+		return cache_inode_refresh_attrs_locked(entry);
+
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+
+	expire = cached->expire_time_attr;
+
+	cache_inode_merge_attrs(cached, attrs);
+	cached->expire_time_attr = cache_inode_adapt_expire(
+		expire,
+		timespec_to_nsecs(&cached->chgtime) != entry->change_time,
+		&cached->chgtime);
+
+	cache_inode_fixup_md(entry);
+
+	if (!FSAL_TEST_MASK(attrs->mask, ATTR_CTIME))
+		atomic_clear_uint32_t_bits(&entry->flags,
+					   CACHE_INODE_TRUST_ATTRS);
+
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	return CACHE_INODE_SUCCESS;
+}
+
 /**
  * @brief Return a changeid4 for this entry.
  *
@@ -136,6 +136,7 @@ extern struct lru_state lru_state;
 #define LRU_N_Q_LANES  17
 
 extern int cache_inode_lru_pkginit(void);
+extern void cache_inode_lru_reconfig(void);
 extern int cache_inode_lru_pkgshutdown(void);
 
 extern size_t open_fd_count;
@@ -122,6 +122,14 @@ struct gsh_export {
 	/** Expiration time interval in seconds for attributes.  Settable with
 	    Attr_Expiration_Time. */
 	int32_t expire_time_attr;
+	/** Shortest interval an object's attributes are trusted for once
+	    they have been seen to change.  Settable with
+	    Attr_Expiration_Min_Time. */
+	int32_t expire_time_attr_min;
+	/** Longest interval an unchanging object's attributes are
+	    trusted for, 0 to keep the interval fixed.  Settable with
+	    Attr_Expiration_Max_Time. */
+	int32_t expire_time_attr_max;
 	/** Export_Id for this export */
 	uint16_t export_id;
 
@@ -45,6 +45,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "gsh_list.h"
+#include "gsh_mpmc.h"
+#include "gsh_eventcount.h"
 
 struct fridgethr;
 
@@ -141,6 +143,10 @@ struct fridgethr_params {
 					 fridge */
 	time_t block_delay; /*< How long to wait before a thread
 				becomes available. */
+	uint32_t queue_depth; /*< Size of the lock-free submission
+				  ring in fridgethr_flavor_worker
+				  fridges.  Zero selects
+				  FRIDGETHR_DEFAULT_QUEUE_DEPTH. */
 	/**
 	 * If non-NULL, run after every submitted job.
 	 */
@@ -169,6 +175,11 @@ struct fridgethr_params {
 	void *wake_threads_arg;
 };
 
+/**
+ * @brief Default depth of the lock-free submission ring
+ */
+#define FRIDGETHR_DEFAULT_QUEUE_DEPTH 1024
+
 /**
  * @brief Queued requests
  */
@@ -200,7 +211,8 @@ struct fridgethr {
 	pthread_attr_t attr;	/*< Creation attributes */
 	struct glist_head thread_list;	/*< List of threads */
 	uint32_t nthreads;	/*< Number of threads in fridge */
-	struct glist_head idle_q;	/*< Idle threads */
+	struct glist_head idle_q;	/*< Idle looper threads; idle workers
+					    park on lf.ec */
 	uint32_t nidle;		/*< Number of idle threads */
 	uint32_t flags;		/*< Fridge-wide flags */
 	fridgethr_comm_t command;	/*< Command state */
@@ -221,6 +233,22 @@ struct fridgethr {
 					      thread. */
 		} block;
 	} deferment;
+	/**
+	 * Lock-free submission path, used by fridgethr_flavor_worker
+	 * fridges.  Idle workers park on the event count rather than
+	 * on their own condition variables, so a submitter that finds
+	 * one parked need only enqueue and notify without taking
+	 * the fridge mutex.
+	 */
+	struct {
+		struct gsh_mpmc q; /*< Submitted work */
+		struct gsh_eventcount ec; /*< Where idle workers park */
+		uint32_t command; /*< Atomic mirror of command */
+		uint32_t parked; /*< Workers counted in nidle */
+		uint32_t pending; /*< A wakeup is outstanding */
+		uint32_t submitters; /*< Submitters on the fast path */
+		uint32_t resizes; /*< Bumped by fridgethr_resize */
+	} lf;
 };
 
 #define fridgethr_flag_none 0x0000 /*< Null flag */
@@ -246,6 +274,8 @@ int fridgethr_sync_command(struct fridgethr *, fridgethr_comm_t, time_t);
 bool fridgethr_you_should_break(struct fridgethr_context *);
 int fridgethr_populate(struct fridgethr *, void (*)(struct fridgethr_context *),
 		      void *);
+int fridgethr_resize(struct fridgethr *, uint32_t, uint32_t,
+		     void (*)(struct fridgethr_context *), void *);
 
 void fridgethr_setwait(struct fridgethr_context *ctx, time_t thread_delay);
 time_t fridgethr_getwait(struct fridgethr_context *ctx);
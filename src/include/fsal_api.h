@@ -304,7 +304,7 @@ struct fsal_up_vector;		/* From fsal_up.h */
  * e.g.  the argument list changed or a method is removed.
  */
 
-#define FSAL_MAJOR_VERSION 3
+#define FSAL_MAJOR_VERSION 4
 
 /**
  * @brief Minor Version
@@ -1096,7 +1096,28 @@ static inline int sizeof_fsid(enum fsid_type type)
 
 typedef uint64_t fsal_cookie_t;
 
-typedef bool(*fsal_readdir_cb) (const char *name, void *dir_state,
+/**
+ * @brief Callback to receive readdir entries
+ *
+ * An FSAL that gets an entry's handle and attributes along with its
+ * name, as PROXY does from READDIR, may pass a handle for the entry,
+ * with its attributes filled in, so that the caller need not look the
+ * name up.  Otherwise obj is NULL.  The callback takes over obj,
+ * whatever it returns.
+ *
+ * @param[in] name      Name of the entry
+ * @param[in] obj       Handle for the entry, or NULL
+ * @param[in] dir_state Opaque pointer passed to readdir
+ * @param[in] cookie    Cookie of the entry
+ *
+ * @retval true if more entries are requested
+ * @retval false if no more entries are requested (and the current one
+ *               has not been consumed)
+ */
+
+typedef bool(*fsal_readdir_cb) (const char *name,
+				struct fsal_obj_handle *obj,
+				void *dir_state,
 				fsal_cookie_t cookie);
 /**
  * @brief FSAL object operations vector
@@ -1157,7 +1178,8 @@ struct fsal_obj_ops {
  * @param[in]  whence    Point at which to start reading.  NULL to
  *                       start at beginning.
  * @param[in]  dir_state Opaque pointer to be passed to callback
- * @param[in]  cb        Callback to receive names
+ * @param[in]  cb        Callback to receive names, and handles if the
+ *                       FSAL has them
  * @param[out] eof       true if the last entry was reached
  *
  * @retval true if more entries are required
@@ -1187,12 +1209,42 @@ struct fsal_obj_ops {
  * @param[in,out] attrib  Attributes to set on newly created
  *                        object/attributes you actually got.
  * @param[out]    new_obj Newly created object
+ * @param[out]    postop  Attributes of dir_hdl afterwards, or NULL
  *
  * @return FSAL status.
  */
 	 fsal_status_t(*create) (struct fsal_obj_handle *dir_hdl,
 				 const char *name, struct attrlist *attrib,
-				 struct fsal_obj_handle **new_obj);
+				 struct fsal_obj_handle **new_obj,
+				 struct fsal_postop_attrs *postop);
+
+/**
+ * @brief Exclusively create a regular file and open it
+ *
+ * This function creates a new regular file that must not already
+ * exist and returns it already open, as if open had been called on
+ * it with openflags.  If ATTR_ATIME and ATTR_MTIME are set in attrib
+ * (an exclusive create verifier), they are applied in the same step,
+ * so the file is never visible without them.  FSALs that cannot do
+ * this return ERR_FSAL_NOTSUPP and the caller falls back to create,
+ * setattrs and open.
+ *
+ * @param[in]     dir_hdl   Directory in which to create the file
+ * @param[in]     name      Name of file to create
+ * @param[in]     openflags Mode to open the new file in
+ * @param[in,out] attrib    Attributes to set on newly created
+ *                          object/attributes you actually got.
+ * @param[out]    new_obj   Newly created, open object
+ * @param[out]    postop    Attributes of dir_hdl afterwards, or NULL
+ *
+ * @return FSAL status, ERR_FSAL_EXIST if the name is already in use.
+ */
+	 fsal_status_t(*create_open) (struct fsal_obj_handle *dir_hdl,
+				      const char *name,
+				      fsal_openflags_t openflags,
+				      struct attrlist *attrib,
+				      struct fsal_obj_handle **new_obj,
+				      struct fsal_postop_attrs *postop);
 
 /**
  * @brief Create a directory
@@ -1204,12 +1256,14 @@ struct fsal_obj_ops {
  * @param[in,out] attrib  Attributes to set on newly created
  *                        object/attributes you actually got.
  * @param[out]    new_obj Newly created object
+ * @param[out]    postop  Attributes of dir_hdl afterwards, or NULL
  *
  * @return FSAL status.
  */
 	 fsal_status_t(*mkdir) (struct fsal_obj_handle *dir_hdl,
 				const char *name, struct attrlist *attrib,
-				struct fsal_obj_handle **new_obj);
+				struct fsal_obj_handle **new_obj,
+				struct fsal_postop_attrs *postop);
 
 /**
  * @brief Create a special file
@@ -1224,6 +1278,7 @@ struct fsal_obj_ops {
  * @param[in,out] attrib   Attributes to set on newly created
  *                         object/attributes you actually got.
  * @param[out]    new_obj  Newly created object
+ * @param[out]    postop   Attributes of dir_hdl afterwards, or NULL
  *
  * @return FSAL status.
  */
@@ -1232,7 +1287,8 @@ struct fsal_obj_ops {
 				 object_file_type_t nodetype,
 				 fsal_dev_t *dev,
 				 struct attrlist *attrib,
-				 struct fsal_obj_handle **new_obj);
+				 struct fsal_obj_handle **new_obj,
+				 struct fsal_postop_attrs *postop);
 
 /**
  * @brief Create a symbolic link
@@ -1245,6 +1301,7 @@ struct fsal_obj_ops {
  * @param[in,out] attrib    Attributes to set on newly created
  *                          object/attributes you actually got.
  * @param[out] new_obj      Newly created object
+ * @param[out] postop       Attributes of dir_hdl afterwards, or NULL
  *
  * @return FSAL status.
  */
@@ -1252,7 +1309,8 @@ struct fsal_obj_ops {
 				  const char *name,
 				  const char *link_path,
 				  struct attrlist *attrib,
-				  struct fsal_obj_handle **new_obj);
+				  struct fsal_obj_handle **new_obj,
+				  struct fsal_postop_attrs *postop);
 /**@}*/
 
 /**@{*/
@@ -1342,12 +1400,15 @@ struct fsal_obj_ops {
  * @param[in] obj_hdl     Object to be linked to
  * @param[in] destdir_hdl Directory in which to create the link
  * @param[in] name        Name for link
+ * @param[out] postop     Attributes of destdir_hdl (dir) and obj_hdl
+ *                        (obj) afterwards, or NULL
  *
  * @return FSAL status
  */
 	 fsal_status_t(*link) (struct fsal_obj_handle *obj_hdl,
 			       struct fsal_obj_handle *destdir_hdl,
-			       const char *name);
+			       const char *name,
+			       struct fsal_postop_attrs *postop);
 
 /**
  * @brief get fs_locations
@@ -1372,6 +1433,8 @@ struct fsal_obj_ops {
  * @param[in] old_name   Old name
  * @param[in] newdir_hdl New parent directory
  * @param[in] new_name   New name
+ * @param[out] postop    Attributes of olddir_hdl (dir), newdir_hdl
+ *                       (newdir) and obj_hdl (obj) afterwards, or NULL
  *
  * @return FSAL status
  */
@@ -1379,7 +1442,8 @@ struct fsal_obj_ops {
 				 struct fsal_obj_handle *olddir_hdl,
 				 const char *old_name,
 				 struct fsal_obj_handle *newdir_hdl,
-				 const char *new_name);
+				 const char *new_name,
+				 struct fsal_postop_attrs *postop);
 /**
  * @brief Remove a name from a directory
  *
@@ -1388,11 +1452,15 @@ struct fsal_obj_ops {
  *
  * @param[in] obj_hdl The directory from which to remove the name
  * @param[in] name    The name to remove
+ * @param[out] postop Attributes of obj_hdl (dir) and of the object
+ *                    removed if it still exists (obj) afterwards, or
+ *                    NULL
  *
  * @return FSAL status.
  */
 	 fsal_status_t(*unlink) (struct fsal_obj_handle *obj_hdl,
-				 const char *name);
+				 const char *name,
+				 struct fsal_postop_attrs *postop);
 
 /**@}*/
 
@@ -422,6 +422,24 @@ struct attrlist {
 					   for attributes. Settable by FSAL. */
 };
 
+/**
+ * @brief Attributes left by a namespace operation
+ *
+ * The caller of create, mkdir, mknode, symlink, link, rename or unlink
+ * may pass one of these, zeroed.  An FSAL that can read the attributes
+ * of what it changed cheaply, from the descriptors it already holds for
+ * the operation, fills them in and sets their mask.  Those it leaves
+ * with an empty mask the caller has to fetch with getattrs.
+ */
+
+struct fsal_postop_attrs {
+	struct attrlist dir;	/*< The directory operated on, the source
+				   directory of a rename */
+	struct attrlist newdir;	/*< The destination directory of a rename */
+	struct attrlist obj;	/*< The object linked, unlinked or
+				   renamed */
+};
+
 /******************************************************
  *            Attribute mask management.
  ******************************************************/
@@ -613,6 +631,8 @@ typedef struct fsal_staticfsinfo_t {
 	bool auth_exportpath_xdev;	/*< This flag indicates weither
 					   it is possible to cross junctions
 					   for resolving an NFS export path. */
+	uint32_t lock_retry_ms;	/*< How often blocked locks the FS cannot
+				   wait on are tried again, in ms */
 
 	uint32_t xattr_access_rights;	/*< This indicates who is allowed
 					   to read/modify xattrs value. */
@@ -790,6 +810,8 @@ typedef struct fsal_lock_param_t {
 	uint64_t lock_start;
 	uint64_t lock_length;
 	bool lock_reclaim;
+	uint64_t lock_owner_id;	/*< SAL's id for the lock owner, never
+				   reused, when the FSAL is given owners */
 } fsal_lock_param_t;
 
 typedef struct fsal_share_param_t {
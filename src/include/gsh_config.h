@@ -82,6 +82,40 @@ typedef enum protos {
  */
 #define NB_WORKER_THREAD_DEFAULT 16
 
+/**
+ * @brief Decoder threads per online CPU when Decoder_Threads is 0
+ */
+#define DECODER_THREADS_PER_CPU 2
+
+/**
+ * @brief Fewest decoder threads chosen when Decoder_Threads is 0
+ */
+#define DECODER_THREADS_MIN 4
+
+/**
+ * @brief Default value for core_param.decoder_budget
+ */
+#define DECODER_BUDGET_DEFAULT 8
+
+/**
+ * @brief Default value for core_param.queue_deadline.nfsv3_ms
+ *
+ * Linux NFSv3 clients over TCP retransmit after timeo=600 (60s).
+ */
+#define QUEUE_DEADLINE_NFSV3_DEFAULT 60000
+
+/**
+ * @brief Default value for core_param.queue_deadline.nfsv40_ms
+ */
+#define QUEUE_DEADLINE_NFSV40_DEFAULT 60000
+
+/**
+ * @brief Default value for core_param.queue_deadline.udp_ms
+ *
+ * Linux clients over UDP first retransmit after timeo=11 (1.1s).
+ */
+#define QUEUE_DEADLINE_UDP_DEFAULT 1100
+
 /**
  * @brief Default value for core_param.drc.tcp.npart
  */
@@ -224,6 +258,29 @@ typedef struct nfs_core_param {
 	    specific transport.  Defaults to 512 and settable by
 	    Dispatch_Max_Reqs_Xprt. */
 	uint32_t dispatch_max_reqs_xprt;
+	/** How long (in milliseconds) a request may wait in the
+	    dispatch queues before it is shed rather than executed.
+	    By then the client has given up on it and retransmitted,
+	    so the work would be wasted.  0 disables shedding.
+	    NFSv4.1 and later requests are never shed. */
+	struct {
+		/** For NFSv3 and its side protocols (MNT, NLM,
+		    RQUOTA), which are dropped.  Defaults to
+		    QUEUE_DEADLINE_NFSV3_DEFAULT and settable by
+		    Queue_Deadline_NFSv3. */
+		uint32_t nfsv3_ms;
+		/** For NFSv4.0, which is answered with
+		    NFS4ERR_DELAY.  Defaults to
+		    QUEUE_DEADLINE_NFSV40_DEFAULT and settable by
+		    Queue_Deadline_NFSv40. */
+		uint32_t nfsv40_ms;
+		/** Shorter deadline for requests that came in over
+		    UDP, where clients retransmit much sooner.  0 uses
+		    the protocol deadline.  Defaults to
+		    QUEUE_DEADLINE_UDP_DEFAULT and settable by
+		    Queue_Deadline_UDP. */
+		uint32_t udp_ms;
+	} queue_deadline;
 	/** Parameters controlling the Duplicate Request Cache.  */
 	struct {
 		/** Whether to disable the DRC entirely.  Defaults to
@@ -324,8 +381,18 @@ typedef struct nfs_core_param {
 	time_t decoder_fridge_expiration_delay;
 	/** How long (in seconds) to wait for the decoder fridge to
 	    accept a task before erroring.  Settable with
-	    Decoder_Fridge_Block_Timeout. */
+	    Decoder_Fridge_Block_Timeout.  Unused now that the decoder
+	    fridge queues. */
 	time_t decoder_fridge_block_timeout;
+	/** Number of decoder threads.  0, the default, picks
+	    DECODER_THREADS_PER_CPU per online CPU.  Transports that
+	    become ready while all decoders are busy wait their turn
+	    in order.  Settable with Decoder_Threads. */
+	uint32_t decoder_threads;
+	/** Requests a decoder takes from one transport before putting
+	    it back at the end of the ready list.  Defaults to
+	    DECODER_BUDGET_DEFAULT and settable with Decoder_Budget. */
+	uint32_t decoder_budget;
 	/** Protocols to support.  Should probably be renamed.
 	    Defaults to CORE_OPTION_ALL_VERS and is settable with
 	    NFS_Protocols (as a comma-separated list of 3 and 4.) */
@@ -390,6 +457,25 @@ typedef struct nfs_core_param {
  */
 #define DELEG_RECALL_RETRY_DELAY_DEFAULT 1
 
+/**
+ * @brief Default value of blocking_lock_reservation.
+ */
+#define BLOCKING_LOCK_RESERVATION_DEFAULT 500
+
+/**
+ * @brief Defaults for the CB_RECALL_ANY parameters.
+ */
+#define RECALL_ANY_PINNED_PCT_DEFAULT 80
+#define RECALL_ANY_CLIENTS_DEFAULT 4
+#define RECALL_ANY_KEEP_PCT_DEFAULT 50
+#define RECALL_ANY_GRACE_DEFAULT 10
+
+/**
+ * @brief Defaults for courtesy clients.
+ */
+#define COURTESY_MAX_CLIENTS_DEFAULT 1024
+#define COURTESY_MAX_TIME_DEFAULT 86400
+
 typedef struct nfs_version4_parameter {
 	/** Whether to disable the NFSv4 grace period.  Defaults to
 	    false and settable with Graceless. */
@@ -421,6 +507,45 @@ typedef struct nfs_version4_parameter {
 	bool allow_delegations;
 	/** Delay after which server will retry a recall in case of failures */
 	uint32_t deleg_recall_retry_delay;
+	/** Whether to send NFSv4.1 clients CB_NOTIFY_LOCK when a lock
+	    they were denied is released.  Defaults to false and settable
+	    with Blocking_Lock_Notify. */
+	bool blocking_lock_notify;
+	/** Milliseconds a released range is held for the notified lock
+	    owner against other NFSv4 lock owners.  Defaults to BLOCKING_LOCK_RESERVATION_DEFAULT and
+	    settable with Blocking_Lock_Reservation. */
+	uint32_t blocking_lock_reservation;
+	/** Ask clients to return delegations and layouts once the
+	    entries holding them pass this percentage of the cache
+	    entry limit, 0 never does.  Defaults to
+	    RECALL_ANY_PINNED_PCT_DEFAULT and settable with
+	    Recall_Any_Pinned_Percent. */
+	uint32_t recall_any_pinned_pct;
+	/** How many of the clients holding the most are asked at a
+	    time.  Defaults to RECALL_ANY_CLIENTS_DEFAULT and settable
+	    with Recall_Any_Clients. */
+	uint32_t recall_any_clients;
+	/** Percentage of its delegations and layouts a client is asked
+	    to keep.  Defaults to RECALL_ANY_KEEP_PCT_DEFAULT and
+	    settable with Recall_Any_Keep_Percent. */
+	uint32_t recall_any_keep_pct;
+	/** Seconds a client is given to comply before its delegations
+	    are recalled one by one.  Defaults to
+	    RECALL_ANY_GRACE_DEFAULT and settable with
+	    Recall_Any_Grace. */
+	uint32_t recall_any_grace;
+	/** Whether a client whose lease lapses keeps its state until
+	    another client wants it.  Defaults to false and settable with
+	    Courteous_Server. */
+	bool courteous_server;
+	/** Most courtesy clients kept at once.  Defaults to
+	    COURTESY_MAX_CLIENTS_DEFAULT and settable with
+	    Courtesy_Max_Clients. */
+	uint32_t courtesy_max_clients;
+	/** Seconds past its last renewal a courtesy client is kept.
+	    Defaults to COURTESY_MAX_TIME_DEFAULT and settable with
+	    Courtesy_Max_Time. */
+	uint32_t courtesy_max_time;
 	/** Whether this a pNFS MDS server. Defaults to false */
 	bool pnfs_mds;
 	/** Whether this a pNFS DS server. Defaults to false */
@@ -0,0 +1,196 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file gsh_eventcount.h
+ * @brief Futex-style parking for lock-free consumers
+ *
+ * An event count lets a thread sleep until "something happened"
+ * without a mutex on the signalling side.  The waiter takes a key
+ * with gsh_ec_prepare, re-checks its condition (e.g. that a lock-free
+ * queue really is empty) and only then calls gsh_ec_wait with the
+ * key.  A notifier that changed the condition in between bumps the
+ * count, so the wait returns immediately instead of losing the
+ * wakeup.  Notifiers only make a system call when somebody is
+ * actually parked.
+ *
+ * On Linux this sits directly on a private futex.  Elsewhere it falls
+ * back to a mutex and condition variable with the same semantics.
+ */
+
+#ifndef GSH_EVENTCOUNT_H
+#define GSH_EVENTCOUNT_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#ifdef LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "abstract_atomic.h"
+
+struct gsh_eventcount {
+	uint32_t seq;		/*< Bumped on every notification */
+	uint32_t waiters;	/*< Threads between prepare and wakeup */
+#ifndef LINUX
+	pthread_mutex_t mtx;
+	pthread_cond_t cv;
+#endif
+};
+
+static inline void gsh_ec_init(struct gsh_eventcount *ec)
+{
+	ec->seq = 0;
+	ec->waiters = 0;
+#ifndef LINUX
+	pthread_mutex_init(&ec->mtx, NULL);
+	pthread_cond_init(&ec->cv, NULL);
+#endif
+}
+
+static inline void gsh_ec_destroy(struct gsh_eventcount *ec)
+{
+#ifndef LINUX
+	pthread_mutex_destroy(&ec->mtx);
+	pthread_cond_destroy(&ec->cv);
+#endif
+}
+
+/**
+ * @brief Announce intent to wait
+ *
+ * Must be followed by exactly one of gsh_ec_wait or gsh_ec_cancel.
+ *
+ * @param[in,out] ec The event count
+ *
+ * @return The key to pass to gsh_ec_wait.
+ */
+
+static inline uint32_t gsh_ec_prepare(struct gsh_eventcount *ec)
+{
+	atomic_inc_uint32_t(&ec->waiters);
+	return atomic_fetch_uint32_t(&ec->seq);
+}
+
+/**
+ * @brief Abandon a prepared wait
+ *
+ * @param[in,out] ec The event count
+ */
+
+static inline void gsh_ec_cancel(struct gsh_eventcount *ec)
+{
+	atomic_dec_uint32_t(&ec->waiters);
+}
+
+/**
+ * @brief Sleep until notified
+ *
+ * Returns at once if there has been a notification since the key
+ * was taken.  Spurious returns are possible; callers re-check their
+ * condition.
+ *
+ * @param[in,out] ec      The event count
+ * @param[in]     key     Key from gsh_ec_prepare
+ * @param[in]     timeout Relative timeout in seconds, 0 for none
+ *
+ * @retval 0 on (possibly spurious) wakeup.
+ * @retval ETIMEDOUT if the timeout expired.
+ */
+
+static inline int gsh_ec_wait(struct gsh_eventcount *ec, uint32_t key,
+			      time_t timeout)
+{
+	int rc = 0;
+#ifdef LINUX
+	struct timespec ts = {
+		.tv_sec = timeout,
+		.tv_nsec = 0
+	};
+
+	if (atomic_fetch_uint32_t(&ec->seq) == key &&
+	    syscall(SYS_futex, &ec->seq, FUTEX_WAIT_PRIVATE, key,
+		    timeout > 0 ? &ts : NULL, NULL, 0) != 0 &&
+	    errno == ETIMEDOUT)
+		rc = ETIMEDOUT;
+#else
+	struct timespec ts;
+
+	if (timeout > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout;
+	}
+	pthread_mutex_lock(&ec->mtx);
+	while ((ec->seq == key) && (rc == 0)) {
+		if (timeout > 0)
+			rc = pthread_cond_timedwait(&ec->cv, &ec->mtx, &ts);
+		else
+			rc = pthread_cond_wait(&ec->cv, &ec->mtx);
+	}
+	pthread_mutex_unlock(&ec->mtx);
+#endif
+	atomic_dec_uint32_t(&ec->waiters);
+	return rc;
+}
+
+/**
+ * @brief Wake up to @c n parked threads
+ *
+ * @param[in,out] ec The event count
+ * @param[in]     n  Maximum number of threads to wake
+ */
+
+static inline void gsh_ec_notify(struct gsh_eventcount *ec, int n)
+{
+#ifdef LINUX
+	atomic_inc_uint32_t(&ec->seq);
+	if (atomic_fetch_uint32_t(&ec->waiters) != 0)
+		syscall(SYS_futex, &ec->seq, FUTEX_WAKE_PRIVATE, n, NULL,
+			NULL, 0);
+#else
+	pthread_mutex_lock(&ec->mtx);
+	++(ec->seq);
+	if (ec->waiters != 0) {
+		if (n == 1)
+			pthread_cond_signal(&ec->cv);
+		else
+			pthread_cond_broadcast(&ec->cv);
+	}
+	pthread_mutex_unlock(&ec->mtx);
+#endif
+}
+
+/**
+ * @brief Wake every parked thread
+ *
+ * @param[in,out] ec The event count
+ */
+
+static inline void gsh_ec_notify_all(struct gsh_eventcount *ec)
+{
+	gsh_ec_notify(ec, INT_MAX);
+}
+
+#endif				/* GSH_EVENTCOUNT_H */
@@ -0,0 +1,217 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file gsh_mpmc.h
+ * @brief Bounded lock-free multi-producer, multi-consumer queue
+ *
+ * A fixed-size ring of cells, each carrying a sequence number that
+ * tells producers and consumers whether the cell is free for them.
+ * Producers and consumers only contend on a single compare-and-swap
+ * of the tail or head respectively, and never on each other.
+ *
+ * The ring holds opaque (function, argument) pairs, which is what
+ * the thread fridge needs.  The queue does not block; callers that
+ * want to sleep when it is empty or full must arrange that
+ * themselves (see gsh_eventcount.h).
+ */
+
+#ifndef GSH_MPMC_H
+#define GSH_MPMC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include "abstract_atomic.h"
+#include "abstract_mem.h"
+#include "gsh_intrinsic.h"
+
+/**
+ * @brief A single slot in the ring
+ */
+
+struct gsh_mpmc_cell {
+	uint64_t seq;		/*< Turn counter for this cell */
+	void *func;		/*< Queued function */
+	void *arg;		/*< Queued argument */
+};
+
+/**
+ * @brief The queue itself
+ *
+ * Head and tail live on their own cache lines so that producers and
+ * consumers do not false-share.
+ */
+
+struct gsh_mpmc {
+	struct gsh_mpmc_cell *cells;	/*< The ring */
+	uint64_t mask;		/*< Number of cells minus one */
+	 CACHE_PAD(0);
+	uint64_t tail;		/*< Next position to enqueue */
+	 CACHE_PAD(1);
+	uint64_t head;		/*< Next position to dequeue */
+	 CACHE_PAD(2);
+};
+
+/**
+ * @brief Initialize a queue
+ *
+ * @param[out] q    The queue to initialize
+ * @param[in]  size Requested number of cells, rounded up to a
+ *                  power of two.
+ *
+ * @return 0 on success, ENOMEM or EINVAL on failure.
+ */
+
+static inline int gsh_mpmc_init(struct gsh_mpmc *q, uint32_t size)
+{
+	uint64_t cells = 2;
+	uint64_t i;
+
+	if (size == 0)
+		return EINVAL;
+
+	while (cells < size)
+		cells <<= 1;
+
+	q->cells = gsh_calloc(cells, sizeof(struct gsh_mpmc_cell));
+	if (q->cells == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < cells; ++i)
+		q->cells[i].seq = i;
+
+	q->mask = cells - 1;
+	q->tail = 0;
+	q->head = 0;
+
+	return 0;
+}
+
+/**
+ * @brief Release the storage of a queue
+ *
+ * Anything still queued is lost; the caller is expected to have
+ * drained it.
+ *
+ * @param[in,out] q The queue
+ */
+
+static inline void gsh_mpmc_destroy(struct gsh_mpmc *q)
+{
+	gsh_free(q->cells);
+	q->cells = NULL;
+}
+
+/**
+ * @brief Add an item to the tail of the queue
+ *
+ * @param[in,out] q    The queue
+ * @param[in]     func Function to queue
+ * @param[in]     arg  Argument to queue
+ *
+ * @retval true if the item was queued.
+ * @retval false if the queue is full.
+ */
+
+static inline bool gsh_mpmc_enqueue(struct gsh_mpmc *q, void *func,
+				    void *arg)
+{
+	struct gsh_mpmc_cell *cell;
+	uint64_t pos = atomic_fetch_uint64_t(&q->tail);
+
+	while (true) {
+		int64_t dif;
+
+		cell = &q->cells[pos & q->mask];
+		dif = (int64_t) (atomic_fetch_uint64_t(&cell->seq) - pos);
+		if (dif == 0) {
+			if (atomic_cas_uint64_t(&q->tail, pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			return false;
+		}
+		pos = atomic_fetch_uint64_t(&q->tail);
+	}
+
+	cell->func = func;
+	cell->arg = arg;
+	atomic_store_uint64_t(&cell->seq, pos + 1);
+
+	return true;
+}
+
+/**
+ * @brief Remove an item from the head of the queue
+ *
+ * @param[in,out] q    The queue
+ * @param[out]    func Dequeued function
+ * @param[out]    arg  Dequeued argument
+ *
+ * @retval true if an item was dequeued.
+ * @retval false if the queue is empty.
+ */
+
+static inline bool gsh_mpmc_dequeue(struct gsh_mpmc *q, void **func,
+				    void **arg)
+{
+	struct gsh_mpmc_cell *cell;
+	uint64_t pos = atomic_fetch_uint64_t(&q->head);
+
+	while (true) {
+		int64_t dif;
+
+		cell = &q->cells[pos & q->mask];
+		dif = (int64_t) (atomic_fetch_uint64_t(&cell->seq) - (pos + 1));
+		if (dif == 0) {
+			if (atomic_cas_uint64_t(&q->head, pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			return false;
+		}
+		pos = atomic_fetch_uint64_t(&q->head);
+	}
+
+	*func = cell->func;
+	*arg = cell->arg;
+	atomic_store_uint64_t(&cell->seq, pos + q->mask + 1);
+
+	return true;
+}
+
+/**
+ * @brief Guess whether the queue is empty
+ *
+ * The answer may be stale by the time it is returned; it is only
+ * useful as a hint or when producers are known to be quiescent.
+ *
+ * @param[in] q The queue
+ *
+ * @return true if the queue appeared empty.
+ */
+
+static inline bool gsh_mpmc_empty(struct gsh_mpmc *q)
+{
+	return atomic_fetch_uint64_t(&q->head) ==
+		atomic_fetch_uint64_t(&q->tail);
+}
+
+#endif				/* GSH_MPMC_H */
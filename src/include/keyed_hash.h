@@ -0,0 +1,78 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file keyed_hash.h
+ * @brief Seeded hashing for client-controlled keys
+ *
+ * Hash tables keyed on strings chosen by clients (caller names, owner
+ * strings, lock cookies) must not let a client pick keys that all land
+ * in one partition.  These helpers run CityHash with a pair of seeds
+ * drawn at random once per boot, so the placement of a key cannot be
+ * predicted from outside.
+ *
+ * keyed_hash_init must be called before any table using these hashes
+ * is populated; the seeds never change afterwards.
+ */
+
+#ifndef KEYED_HASH_H
+#define KEYED_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "city.h"
+
+extern uint64_t keyed_hash_seed[2];
+
+bool keyed_hash_init(void);
+
+/**
+ * @brief Hash a buffer under the per-boot key
+ *
+ * @param[in] buf   Data to hash
+ * @param[in] len   Length of the data
+ * @param[in] tweak Fixed-size part of the key (ids, lengths, types)
+ *
+ * @return 64-bit hash.
+ */
+
+static inline uint64_t keyed_hash(const void *buf, size_t len,
+				  uint64_t tweak)
+{
+	return CityHash64WithSeeds(buf, len, keyed_hash_seed[0] ^ tweak,
+				   keyed_hash_seed[1]);
+}
+
+/**
+ * @brief Hash a scalar under the per-boot key
+ *
+ * @param[in] val Value to hash, e.g. a pointer or an id
+ *
+ * @return 64-bit hash.
+ */
+
+static inline uint64_t keyed_hash_u64(uint64_t val)
+{
+	return keyed_hash(&val, sizeof(val), 0);
+}
+
+#endif				/* KEYED_HASH_H */
@@ -108,6 +108,7 @@ typedef enum log_components {
 	COMPONENT_FSAL_UP,
 	COMPONENT_DBUS,
 	COMPONENT_NFS_MSK,
+	COMPONENT_MEMORY,
 	COMPONENT_COUNT
 } log_components_t;
 
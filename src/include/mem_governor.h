@@ -0,0 +1,149 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup mem_governor Memory governor
+ *
+ * The caches in the server (cache inode entries, the duplicate
+ * request cache, the idmapper and uid2grp caches) are each sized by
+ * their own static knobs.  The memory governor ties them together:
+ * every cache registers a consumer that reports how many bytes it
+ * holds and how to give some back.  When enabled, a background thread
+ * watches the memory usage and memory pressure (PSI) of the cgroup we
+ * run in and, when either is too high, asks the consumers to shrink in
+ * proportion to their weight and to what they hold above their floor.
+ *
+ * A consumer is also handed a byte budget, which it should honour in
+ * its own admission path until pressure goes away; the budget then
+ * grows back gradually.
+ *
+ * @{
+ */
+
+/**
+ * @file mem_governor.h
+ * @brief Central accounting and reclaim for server caches
+ */
+
+#ifndef MEM_GOVERNOR_H
+#define MEM_GOVERNOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "gsh_list.h"
+#include "abstract_atomic.h"
+#include "config_parsing.h"
+
+/**
+ * @brief Budget meaning "no limit imposed by the governor"
+ */
+
+#define MEM_GOV_UNLIMITED UINT64_MAX
+
+/**
+ * @brief A cache registered with the governor
+ *
+ * The registering module owns the storage; name, weight, floor and
+ * the callbacks must be set before mem_governor_register.
+ */
+
+struct mem_gov_consumer {
+	const char *name;	/*< For logging */
+	uint32_t weight;	/*< Relative share of reclaim, 0 exempts */
+	uint64_t floor;		/*< Never ask to shrink below this */
+	/** Bytes currently held.  Called without locks, from the
+	    governor thread or mem_governor_reclaim. */
+	uint64_t (*usage)(void);
+	/** Try to give back about the given number of bytes now.
+	    Returns what was actually freed; caches that can only shrink
+	    lazily may return 0 and rely on the budget. */
+	uint64_t (*reclaim)(uint64_t bytes);
+	/* Owned by the governor */
+	uint64_t budget;	/*< Current budget, read atomically */
+	uint64_t held;		/*< Usage at the last sample */
+	struct glist_head list;
+};
+
+/**
+ * @brief Memory governor parameters, settable in the Mem_Governor
+ *        stanza.
+ */
+
+struct mem_governor_parameter {
+	/** Whether the governor runs at all. Settable by Enable. */
+	bool enable;
+	/** Seconds between samples.  Settable by Interval. */
+	uint32_t interval;
+	/** Memory limit in bytes; 0 uses the cgroup limit.  Settable by
+	    Memory_Limit. */
+	uint64_t memory_limit;
+	/** Start reclaiming above this percentage of the limit.
+	    Settable by High_Water_Percent. */
+	uint32_t high_water_pct;
+	/** Reclaim down to this percentage of the limit.  Settable by
+	    Low_Water_Percent. */
+	uint32_t low_water_pct;
+	/** Treat memory "some" avg10 PSI above this percentage as
+	    pressure, 0 disables.  Settable by PSI_Threshold. */
+	uint32_t psi_threshold;
+	/** Fall back to system wide PSI when our cgroup has none.
+	    Settable by System_PSI. */
+	bool system_psi;
+	/** Percentage of cache bytes to reclaim per interval under PSI
+	    pressure.  Settable by PSI_Reclaim_Percent. */
+	uint32_t psi_reclaim_pct;
+	/** Per-cache weights and floors */
+	uint32_t cache_inode_weight;
+	uint64_t cache_inode_floor;
+	uint32_t drc_weight;
+	uint64_t drc_floor;
+	uint32_t idmapper_weight;
+	uint64_t idmapper_floor;
+	uint32_t uid2grp_weight;
+	uint64_t uid2grp_floor;
+};
+
+extern struct mem_governor_parameter mem_gov_param;
+extern struct config_block mem_governor_param_blk;
+
+void mem_governor_register(struct mem_gov_consumer *consumer);
+void mem_governor_unregister(struct mem_gov_consumer *consumer);
+uint64_t mem_governor_reclaim(uint64_t bytes);
+int mem_governor_init(void);
+int mem_governor_shutdown(void);
+
+/**
+ * @brief Fetch a consumer's current budget
+ *
+ * @param[in] consumer The consumer
+ *
+ * @return Budget in bytes, MEM_GOV_UNLIMITED if none.
+ */
+
+static inline uint64_t mem_gov_budget(struct mem_gov_consumer *consumer)
+{
+	return atomic_fetch_uint64_t(&consumer->budget);
+}
+
+#endif				/* MEM_GOVERNOR_H */
+
+/** @} */
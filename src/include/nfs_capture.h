@@ -0,0 +1,165 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup nfs_capture Workload capture
+ *
+ * When enabled, every request that reaches a worker is appended to a
+ * binary log: its arrival time, how long it took, the client and
+ * connection it came from, the caller's credentials, and its decoded
+ * arguments re-encoded as XDR.  9P messages are logged as received.
+ * For the requests a replayer needs to map file handles and NFSv4
+ * state (lookups, creates, mounts, and compounds with GETFH, OPEN,
+ * LOCK or client and session setup), the encoded result is logged
+ * too.
+ *
+ * tools/ganesha_replay.c reads such a log and plays it back against
+ * a server holding a copy of the captured export.
+ *
+ * The log is a NFS_CAPTURE_MAGIC header followed by records.  Each
+ * record is a struct nfs_capture_record, then ngroups gids, then
+ * arg_len bytes of arguments and res_len bytes of result, each
+ * padded to 4 bytes.  Integers are in host byte order; the log is
+ * meant to be replayed on the same kind of machine.
+ *
+ * @{
+ */
+
+/**
+ * @file nfs_capture.h
+ * @brief Request capture log format and interface
+ */
+
+#ifndef NFS_CAPTURE_H
+#define NFS_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief First bytes of a capture log
+ */
+
+#define NFS_CAPTURE_MAGIC "GSHCAP1\n"
+#define NFS_CAPTURE_MAGIC_LEN 8
+
+/**
+ * @brief Most supplementary groups recorded per request
+ */
+
+#define NFS_CAPTURE_MAX_GROUPS 16
+
+/**
+ * @brief Largest record written; bigger requests are skipped
+ */
+
+#define NFS_CAPTURE_MAX_RECORD (16 * 1024 * 1024)
+
+enum nfs_capture_kind {
+	NFS_CAPTURE_RPC = 1,	/*< ONC RPC call, args and result are XDR */
+	NFS_CAPTURE_9P = 2	/*< 9P message, args is the raw message */
+};
+
+#define NFS_CAPTURE_DROPPED 0x0001	/*< No reply was sent */
+#define NFS_CAPTURE_HAS_RES 0x0002	/*< Result follows the args */
+#define NFS_CAPTURE_DRC_HIT 0x0004	/*< Answered from the DRC */
+
+struct nfs_capture_record {
+	uint32_t length;	/*< Whole record, padded, in bytes */
+	uint16_t kind;		/*< enum nfs_capture_kind */
+	uint16_t flags;		/*< NFS_CAPTURE_* */
+	uint64_t arrival_ns;	/*< Queued at, since capture began */
+	uint64_t service_ns;	/*< Time from dequeue to reply */
+	uint64_t conn;		/*< Identifies the transport */
+	uint8_t addr[16];	/*< Client address, IPv4 mapped into IPv6 */
+	uint16_t port;		/*< Client port */
+	uint16_t ngroups;	/*< Gids following the record */
+	uint32_t xid;		/*< RPC xid, 9P tag */
+	uint32_t prog;		/*< RPC program, 0 for 9P */
+	uint32_t vers;		/*< RPC version, 0 for 9P */
+	uint32_t proc;		/*< RPC procedure, 9P message type */
+	uint32_t uid;		/*< Caller credentials after mapping */
+	uint32_t gid;
+	uint32_t arg_len;	/*< Bytes of arguments */
+	uint32_t res_len;	/*< Bytes of result */
+	uint32_t reserved;
+};
+
+/**
+ * @brief Pad a length to XDR alignment
+ */
+
+static inline uint32_t nfs_capture_pad(uint32_t len)
+{
+	return (len + 3) & ~3;
+}
+
+#ifndef NFS_CAPTURE_FORMAT_ONLY
+
+#include "config_parsing.h"
+#include "abstract_atomic.h"
+
+struct request_data;
+
+/**
+ * @brief Capture parameters, settable in the NFS_Capture stanza.
+ */
+
+struct nfs_capture_parameter {
+	/** Whether to capture at all.  Settable by Enable. */
+	bool enable;
+	/** File to write; an existing one is kept as Path.1.
+	    Settable by Path. */
+	char *path;
+	/** Stop capturing once the file reaches this many bytes.
+	    Settable by Max_Size. */
+	uint64_t max_size;
+	/** Record results needed for replay.  Settable by
+	    Record_Results. */
+	bool record_results;
+	/** Bytes of records each worker may have queued for the
+	    writer.  Settable by Thread_Buffer. */
+	uint32_t thread_buffer;
+};
+
+extern struct nfs_capture_parameter nfs_capture_param;
+extern struct config_block nfs_capture_param_blk;
+extern uint32_t nfs_capture_on;
+
+int nfs_capture_init(void);
+int nfs_capture_shutdown(void);
+void nfs_capture_rpc(struct request_data *req, void *res, uint16_t flags);
+void nfs_capture_9p(struct request_data *req);
+
+/**
+ * @brief Whether requests are being captured
+ */
+
+static inline bool nfs_capture_active(void)
+{
+	return atomic_fetch_uint32_t(&nfs_capture_on) != 0;
+}
+
+#endif				/* NFS_CAPTURE_FORMAT_ONLY */
+
+#endif				/* NFS_CAPTURE_H */
+
+/** @} */
@@ -181,6 +181,11 @@ void nfs_rpc_dispatch_threads(pthread_attr_t *attr_thr);
 void nfs_rpc_dispatch_stop(void);
 void Clean_RPC(void);
 
+/* RPC listening sockets, -1 where a protocol has none */
+extern int udp_socket[P_COUNT];
+extern int tcp_socket[P_COUNT];
+extern bool v6disabled;
+
 /* Config parsing routines */
 extern config_file_t config_struct;
 extern struct config_block nfs_core;
@@ -195,6 +200,7 @@ extern struct config_block version4_param;
 void nfs_Init_admin_thread(void);
 void admin_replace_exports(void);
 void admin_halt(void);
+void reread_core_config(void);
 
 /* Tools */
 
@@ -216,6 +222,7 @@ int reaper_init(void);
 int reaper_shutdown(void);
 
 int worker_init(void);
+int worker_resize(uint32_t nb_worker);
 int worker_shutdown(void);
 
 #endif				/* !NFS_CORE_H */
@@ -134,6 +134,8 @@ typedef enum dupreq_status {
 } dupreq_status_t;
 
 void dupreq2_pkginit(void);
+void dupreq2_reconfig(void);
+drc_t *dupreq2_udp_drc(void);
 void dupreq2_pkgshutdown(void);
 
 drc_t *drc_get_tcp_drc(struct svc_req *);
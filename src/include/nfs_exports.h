@@ -112,6 +112,12 @@ typedef struct exportlist_client_entry__ {
 /** Controls whether a directory's dirent cache is trusted for
     negative results. */
 #define EXPORT_OPTION_TRUST_READIR_NEGATIVE_CACHE 0x00000008
+/** Check READ and WRITE against byte-range locks held by other
+    owners (mandatory locking). */
+#define EXPORT_OPTION_MANDATORY_LOCKS 0x00000010
+/** Exported data never changes: serve it read-only and trust the
+    cache for it until told otherwise. */
+#define EXPORT_OPTION_IMMUTABLE 0x00000020
 
 /* Constants for export permissions masks */
 #define EXPORT_OPTION_ROOT 0x00000001	/*< Allow root access as root uid */
@@ -210,6 +210,7 @@ typedef struct nfs_request_data {
 	nfs_arg_t arg_nfs;
 	nfs_res_t *res_nfs;
 	const nfs_function_desc_t *funcdesc;
+	nfs_client_id_t *lease_held;	/*< Lease reserved while queued */
 } nfs_request_data_t;
 
 enum rpc_chan_type {
@@ -332,6 +333,8 @@ typedef struct compound_data {
 	struct export_perms saved_export_perms; /*< Permissions for export for
 					       savedFH */
 	struct svc_req *req;	/*< RPC Request related to the compound */
+	nfs_argop4 *argarray;	/*< Operations of the compound */
+	uint32_t argarray_len;	/*< Number of operations in the compound */
 	struct nfs_worker_data *worker;	/*< Worker thread data */
 	nfs_client_cred_t credential;	/*< Raw RPC credentials */
 	nfs_client_id_t *preserved_clientid;	/*< clientid that has lease
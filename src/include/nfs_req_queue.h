@@ -63,9 +63,13 @@ struct req_q_pair {
 
 #define REQ_Q_MOUNT 0
 #define REQ_Q_CALL 1
-#define REQ_Q_LOW_LATENCY 2	/*< GETATTR, RENEW, etc */
+#define REQ_Q_LOW_LATENCY 2	/*< GETATTR, LOOKUP, etc */
 #define REQ_Q_HIGH_LATENCY 3	/*< READ, WRITE, COMMIT, etc */
-#define N_REQ_QUEUES 4
+#define REQ_Q_LEASE 4		/*< Lone RENEW or SEQUENCE, served first */
+#define N_REQ_QUEUES 5
+
+/* Lease renewals served in a row before the other queues get a turn */
+#define REQ_Q_LEASE_RUN 8
 
 extern const char *req_q_s[N_REQ_QUEUES];	/* for debug prints */
 
@@ -0,0 +1,285 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup nfs_upgrade Server upgrade handoff
+ *
+ * A server started while another one runs with the same NFS_Upgrade
+ * Socket takes over from it instead of restarting the service.
+ *
+ * The new server connects to the Unix socket and sends HELLO.  The old
+ * one answers ACCEPT and shuts down.  Once its workers have drained, it
+ * sends SOCKETS, with its RPC listening sockets attached as
+ * SCM_RIGHTS, then a snapshot of its NFSv4 state: a CLIENT record for
+ * each confirmed client, a SESSION record for each NFSv4.1 session,
+ * and OPEN, LOCK and DELEG records for the states, ending with END.
+ * It then exits, leaving the connection open until it is gone, so
+ * that the new server knows the old one's file locks are released.
+ *
+ * The new server serves on the inherited sockets with the old
+ * ServerEpoch, so clientids, stateids and write verifiers stay valid,
+ * and installs the state before starting its threads.  Clients whose
+ * connections were closed reconnect and carry on without a grace
+ * period.  State that cannot be carried (RPCSEC_GSS clients, layouts,
+ * anything the new server fails to install) is counted, and if there
+ * is any the new server falls back to a grace period as after a
+ * restart.
+ *
+ * Neither the duplicate request cache nor the session slot reply
+ * caches are carried.  A request in flight at the handoff that the
+ * client retransmits is done again by the new server, or, on an
+ * NFSv4.1 slot, answered NFS4ERR_RETRY_UNCACHED_REP, as after a
+ * restart.
+ *
+ * nfs_upgrade_handoff and nfs_upgrade_install_state have no tests.
+ *
+ * Each message is a struct nfs_upgrade_hdr followed by length bytes:
+ * a fixed record, then the variable parts it announces, each padded
+ * to 8 bytes.  Integers are in host byte order; both servers run on
+ * the same machine.
+ *
+ * @{
+ */
+
+/**
+ * @file nfs_upgrade.h
+ * @brief Server upgrade handoff protocol and interface
+ */
+
+#ifndef NFS_UPGRADE_H
+#define NFS_UPGRADE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config_parsing.h"
+
+#define NFS_UPGRADE_MAGIC 0x47534855	/* "GSHU" */
+#define NFS_UPGRADE_VERSION 1
+
+/**
+ * @brief Protocols whose sockets are passed, at least P_COUNT
+ */
+
+#define NFS_UPGRADE_PROTOS 8
+
+#define NFS_UPGRADE_OTHER_SIZE 12	/*< stateid4 other */
+#define NFS_UPGRADE_SESSIONID_SIZE 16
+#define NFS_UPGRADE_SLOTS 8		/*< At least NFS41_NB_SLOTS */
+#define NFS_UPGRADE_NAME_MAX 256	/*< Server owner and scope */
+#define NFS_UPGRADE_RADDR_MAX 132	/*< Callback universal address */
+
+enum nfs_upgrade_type {
+	NFS_UPGRADE_HELLO = 1,	/*< New server asks to take over */
+	NFS_UPGRADE_ACCEPT,	/*< Old server shuts down to hand over */
+	NFS_UPGRADE_REFUSE,	/*< Old server will not hand over */
+	NFS_UPGRADE_ABORT,	/*< Old server shut down without draining */
+	NFS_UPGRADE_SOCKETS,	/*< Listening sockets and epoch */
+	NFS_UPGRADE_CLIENT,	/*< A confirmed clientid */
+	NFS_UPGRADE_SESSION,	/*< An NFSv4.1 session */
+	NFS_UPGRADE_OPEN,	/*< A share state and its open owner */
+	NFS_UPGRADE_LOCK,	/*< A lock state, its owner and ranges */
+	NFS_UPGRADE_DELEG,	/*< A delegation */
+	NFS_UPGRADE_END		/*< Snapshot complete */
+};
+
+struct nfs_upgrade_hdr {
+	uint32_t type;		/*< enum nfs_upgrade_type */
+	uint32_t length;	/*< Bytes following the header */
+};
+
+/**
+ * @brief HELLO, ACCEPT, REFUSE and ABORT
+ */
+
+struct nfs_upgrade_hello {
+	uint32_t magic;		/*< NFS_UPGRADE_MAGIC */
+	uint32_t version;	/*< NFS_UPGRADE_VERSION */
+	uint32_t pid;		/*< Sender */
+	uint32_t reserved;
+};
+
+/**
+ * @brief SOCKETS
+ *
+ * udp and tcp give the index of each protocol's socket among the
+ * passed descriptors, -1 if it has none.
+ */
+
+struct nfs_upgrade_sockets {
+	uint64_t epoch;		/*< ServerEpoch */
+	uint32_t v6disabled;
+	uint32_t nfds;		/*< Descriptors passed */
+	int32_t udp[NFS_UPGRADE_PROTOS];
+	int32_t tcp[NFS_UPGRADE_PROTOS];
+};
+
+/**
+ * @brief CLIENT, followed by owner_len bytes of client owner
+ */
+
+struct nfs_upgrade_client {
+	uint64_t clientid;
+	uint64_t last_renew;	/*< cid_last_renew */
+	uint8_t verifier[8];
+	uint8_t incoming_verifier[8];
+	uint32_t minorversion;
+	uint32_t stateid_counter;
+	uint32_t create_session_sequence;
+	uint32_t cred_flavor;	/*< AUTH_NONE or AUTH_UNIX */
+	uint32_t cred_uid;
+	uint32_t cred_gid;
+	uint32_t pnfs_flags;	/*< Of the client record */
+	uint32_t server_addr;	/*< Of the client record */
+	uint32_t addr_len;	/*< 4 or 16 */
+	uint8_t addr[16];	/*< Client address */
+	uint32_t owner_len;
+	/* NFSv4.0 callback */
+	uint32_t cb_program;
+	uint32_t cb_callback_ident;
+	uint32_t cb_chan_down;
+	uint32_t cb_nc;		/*< nc_type */
+	uint32_t cb_port;
+	uint8_t cb_ss[128];	/*< struct sockaddr_storage */
+	char cb_r_addr[NFS_UPGRADE_RADDR_MAX];
+	/* NFSv4.1 */
+	char server_owner[NFS_UPGRADE_NAME_MAX];
+	char server_scope[NFS_UPGRADE_NAME_MAX];
+	uint32_t reclaim_complete;
+	uint32_t reserved;
+};
+
+struct nfs_upgrade_channel {
+	uint32_t headerpadsize;
+	uint32_t maxrequestsize;
+	uint32_t maxresponsesize;
+	uint32_t maxresponsesize_cached;
+	uint32_t maxoperations;
+	uint32_t maxrequests;
+};
+
+/**
+ * @brief SESSION
+ */
+
+struct nfs_upgrade_session {
+	uint8_t session_id[NFS_UPGRADE_SESSIONID_SIZE];
+	uint64_t clientid;
+	uint32_t cb_program;
+	uint32_t nslots;
+	struct nfs_upgrade_channel fore;
+	struct nfs_upgrade_channel back;
+	uint32_t slot_sequence[NFS_UPGRADE_SLOTS];
+};
+
+/**
+ * @brief A byte range held by a LOCK state
+ */
+
+struct nfs_upgrade_range {
+	uint64_t start;
+	uint64_t length;	/*< 0 to end of file */
+	uint32_t type;		/*< fsal_lock_t */
+	uint32_t reserved;
+};
+
+/**
+ * @brief OPEN, LOCK and DELEG
+ *
+ * Followed by fh_len bytes of NFSv4 file handle, owner_len bytes of
+ * owner, open_owner_len bytes of the open owner a lock owner was
+ * created under, and nranges struct nfs_upgrade_range.
+ */
+
+struct nfs_upgrade_state {
+	uint8_t other[NFS_UPGRADE_OTHER_SIZE];
+	uint32_t seqid;
+	uint64_t clientid;
+	uint32_t fh_len;
+	uint32_t owner_len;	/*< 0 for a delegation */
+	uint32_t open_owner_len;	/*< LOCK only */
+	uint32_t owner_seqid;
+	uint32_t owner_confirmed;
+	uint32_t nranges;	/*< LOCK only */
+	/* OPEN */
+	uint32_t share_access;
+	uint32_t share_deny;
+	uint32_t share_access_prev;
+	uint32_t share_deny_prev;
+	/* LOCK */
+	uint8_t open_other[NFS_UPGRADE_OTHER_SIZE];
+	/* DELEG */
+	uint32_t deleg_type;	/*< open_delegation_type4 */
+	uint64_t grant_time;
+};
+
+/**
+ * @brief END
+ */
+
+struct nfs_upgrade_end {
+	uint32_t clients;
+	uint32_t sessions;
+	uint32_t states;
+	uint32_t skipped;	/*< Clients and states not carried */
+};
+
+/**
+ * @brief Pad a length to the record alignment
+ */
+
+static inline uint32_t nfs_upgrade_pad(uint32_t len)
+{
+	return (len + 7) & ~7;
+}
+
+/**
+ * @brief Upgrade parameters, settable in the NFS_Upgrade stanza.
+ */
+
+struct nfs_upgrade_parameter {
+	/** Whether to take over from, and hand over to, another
+	    server.  Settable by Enable. */
+	bool enable;
+	/** Unix socket the running server listens on.  Settable by
+	    Socket. */
+	char *socket;
+	/** Seconds to wait for the old server to drain and exit.
+	    Settable by Timeout. */
+	uint32_t timeout;
+};
+
+extern struct nfs_upgrade_parameter nfs_upgrade_param;
+extern struct config_block nfs_upgrade_param_blk;
+
+/* Old server */
+int nfs_upgrade_init(void);
+bool nfs_upgrade_handoff(bool drained);
+bool nfs_upgrade_handed_off(void);
+
+/* New server */
+void nfs_upgrade_pidfile(int fd);
+void nfs_upgrade_connect(void);
+bool nfs_upgrade_sockets(int *udp, int *tcp, int count, bool *v6disabled);
+bool nfs_upgrade_install_state(void);
+
+#endif				/* NFS_UPGRADE_H */
+
+/** @} */
@@ -572,6 +572,7 @@ struct state_owner_t {
 #endif				/* _DEBUG_MEMLEAKS */
 	pthread_mutex_t so_mutex;	/*< Mutex on this owner */
 	int32_t so_refcount;	/*< Reference count for lifecyce management */
+	uint64_t so_id;		/*< Never reused, unlike the owner's address */
 	int so_owner_len;	/*< Length of owner name */
 	char *so_owner_val;	/*< Owner name */
 	union {
@@ -680,12 +681,23 @@ struct nfs_client_id_t {
 	int32_t cid_refcount;	/*< Reference count for lifecycle */
 	int cid_lease_reservations;	/*< Counted lease reservations, to spare
 					   this clientid from the reaper */
+	bool cid_courtesy;	/*< Lease lapsed, state kept until it
+				   conflicts */
 	uint32_t cid_minorversion;
 	uint32_t cid_stateid_counter;
 
 	uint32_t curr_deleg_grants; /* current num of delegations owned by
 				       this client */
 	uint32_t num_revokes;       /* Num revokes for the client */
+	uint32_t curr_layouts;	/*< Layouts held, changed atomically */
+	uint32_t cid_returned;	/*< Delegations and layouts given back or
+				   revoked, ever, changed atomically */
+	time_t cid_recall_any_sent;	/*< When CB_RECALL_ANY went out, 0 if
+					   none is outstanding */
+	uint32_t cid_recall_any_returned; /*< cid_returned at that time */
+	uint32_t cid_recall_any_asked;	/*< How many it was asked to give
+					   back */
+	uint32_t cid_recall_any_ignored; /*< CB_RECALL_ANY ignored in a row */
 	struct gsh_client *gsh_client; /* for client specific statistics. */
 };
 
@@ -807,6 +819,24 @@ struct state_lock_entry_t {
 	pthread_mutex_t sle_mutex;	/*< Mutex to protect the structure */
 };
 
+/**
+ * @brief An NFSv4.1 lock owner waiting for a blocking lock
+ *
+ * NFSv4 has no way to grant a lock later, so instead of a blocked lock
+ * entry the owner is remembered on the file's lock_waiters, under the
+ * entry's state_lock, and sent CB_NOTIFY_LOCK once the range is free.
+ * The range is then held for it a short while.
+ */
+
+typedef struct state_lock_waiter_t {
+	struct glist_head slw_list;	/*< Link on the file's waiters */
+	state_owner_t *slw_owner;	/*< Waiting lock owner, referenced */
+	fsal_lock_param_t slw_lock;	/*< Lock asked for */
+	nfs_fh4 slw_fh;		/*< Handle to notify with */
+	struct timespec slw_expire;	/*< When to forget the waiter */
+	bool slw_notified;	/*< Notified, range reserved until expiry */
+} state_lock_waiter_t;
+
 /**
  * @brief Description of a layout segment
  */
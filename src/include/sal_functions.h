@@ -226,6 +226,7 @@ bool nfs_client_id_expire(nfs_client_id_t *clientid, bool make_stale);
 #define DISPLAY_CLIENTID_SIZE 36
 int display_clientid(struct display_buffer *dspbuf, clientid4 clientid);
 clientid4 new_clientid(void);
+void reserve_clientid(clientid4 clientid);
 void new_clientid_verifier(char *verf);
 
 int display_client_id_key(struct gsh_buffdesc *buff, char *str);
@@ -313,6 +314,7 @@ int nfs41_Session_Get_Pointer(char sessionid[NFS4_SESSIONID_SIZE],
 
 int nfs41_Session_Del(char sessionid[NFS4_SESSIONID_SIZE]);
 void nfs41_Build_sessionid(clientid4 *clientid, char *sessionid);
+void nfs41_Reserve_sessionid(char *sessionid);
 void nfs41_Session_PrintAll(void);
 
 /******************************************************************************
@@ -386,6 +388,35 @@ uint64_t state_id_rbt_hash_func(hash_parameter_t *hparam,
 int reserve_lease(nfs_client_id_t *clientid);
 void update_lease(nfs_client_id_t *clientid);
 bool valid_lease(nfs_client_id_t *clientid);
+nfs_client_id_t *hold_queued_renewal(COMPOUND4args *args);
+void release_queued_renewal(nfs_client_id_t *clientid);
+bool keep_courtesy_client(nfs_client_id_t *clientid);
+void end_courtesy(nfs_client_id_t *clientid);
+bool expire_courtesy_client(nfs_client_id_t *clientid);
+void expire_courtesy_client_async(nfs_client_id_t *clientid);
+
+/**
+ * @brief Find the courtesy client holding state through an owner
+ *
+ * @param[in] owner State owner
+ *
+ * @return The client if its lease has lapsed but its state is kept,
+ *         else NULL.
+ */
+
+static inline nfs_client_id_t *courtesy_client(state_owner_t *owner)
+{
+	nfs_client_id_t *clientid;
+
+	if (owner->so_type != STATE_OPEN_OWNER_NFSV4 &&
+	    owner->so_type != STATE_LOCK_OWNER_NFSV4 &&
+	    owner->so_type != STATE_CLIENTID_OWNER_NFSV4)
+		return NULL;
+
+	clientid = owner->so_owner.so_nfs4_owner.so_clientrec;
+
+	return clientid != NULL && clientid->cid_courtesy ? clientid : NULL;
+}
 
 /******************************************************************************
  *
@@ -526,6 +557,17 @@ state_status_t state_test(cache_entry_t *entry,
 			  /* description of conflicting lock */
 			  fsal_lock_param_t *conflict);
 
+state_status_t state_lock_io_conflict(cache_entry_t *entry,
+				      state_owner_t *owner,
+				      struct gsh_client *client,
+				      bool write, uint64_t offset,
+				      uint64_t length);
+
+state_status_t state_lock_check_io(cache_entry_t *entry,
+				   state_owner_t *owner,
+				   bool write, uint64_t offset,
+				   uint64_t length);
+
 state_status_t state_lock(cache_entry_t *entry,
 			  state_owner_t *owner,
 			  state_t *state, state_blocking_t blocking,
@@ -560,6 +602,9 @@ void state_export_unlock_all(void);
 
 void state_lock_wipe(cache_entry_t *entry);
 
+void state_nfs4_lock_wait(cache_entry_t *entry, state_owner_t *owner,
+			  fsal_lock_param_t *lock, nfs_fh4 *fh);
+
 void cancel_all_nlm_blocked();
 
 /******************************************************************************
@@ -691,6 +736,10 @@ static inline bool state_same_owner(state_t *state, state_owner_t *owner)
 	return same;
 }
 
+nfsstat4 nfs4_check_mandatory_lock(cache_entry_t *entry, state_t *state,
+				   bool write, uint64_t offset,
+				   uint64_t length);
+
 bool get_state_entry_export_owner_refs(state_t *state,
 				       cache_entry_t **entry,
 				       struct gsh_export **export,
@@ -738,10 +787,22 @@ void update_delegation_stats(cache_entry_t *entry,
 			     state_owner_t *owner,
 			     struct state_t *deleg);
 state_status_t delegrecall_impl(cache_entry_t *entry);
+state_status_t delegrecall_client(cache_entry_t *entry,
+				  nfs_client_id_t *clientid);
 state_status_t deleg_revoke(cache_entry_t *entry, struct state_t *deleg_state);
 void state_deleg_revoke(cache_entry_t *entry, state_t *state);
 bool state_deleg_conflict(cache_entry_t *entry, bool write);
 
+/******************************************************************************
+ *
+ * CB_RECALL_ANY functions
+ *
+ ******************************************************************************/
+
+extern uint64_t recall_any_pinned;
+
+void state_recall_any_check(uint64_t limit);
+
 /******************************************************************************
  *
  * Layout functions
@@ -807,6 +868,8 @@ state_status_t state_share_check_conflict(cache_entry_t *entry,
 					  int share_acccess,
 					  int share_deny,
 					  enum share_bypass_modes bypass);
+bool state_share_courtesy_conflict(cache_entry_t *entry, int share_access,
+				   int share_deny);
 bool state_open_deleg_conflict(cache_entry_t *entry, const state_t *open_state);
 
 state_status_t state_share_anonymous_io_start(cache_entry_t *entry,
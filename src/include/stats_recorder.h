@@ -0,0 +1,402 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup stats_recorder Statistics recorder
+ *
+ * When enabled, the server statistics are sampled at a fixed interval
+ * and what changed since the previous sample is appended to a ring
+ * file of fixed size, overwriting the oldest samples once it is full.
+ * Counters (operations, errors, latency, bytes, cache lookups) are
+ * recorded as their increase over the interval, gauges (queue depths,
+ * cache entries, open files) as their value.
+ *
+ * tools/ganesha_stats.c prints the time series in such a file.
+ *
+ * The file is a struct stats_recorder_header padded to
+ * STATS_RECORDER_HEADER_SIZE, then ring_size bytes of records.  Each
+ * record is a struct stats_recorder_record followed by nkeys pairs
+ * of LEB128 varints: the key's difference from the previous key, in
+ * increasing key order, then the value; it is padded to 8 bytes with
+ * zeros.  Keys with a zero value are left out.  A record that does
+ * not fit before the end of the ring goes at its start.  Records are
+ * found by scanning the ring for ones whose checksum holds, and are
+ * ordered by sequence number, so a record torn by a crash or partly
+ * overwritten is just skipped.  Integers are in host byte order.
+ *
+ * @{
+ */
+
+/**
+ * @file stats_recorder.h
+ * @brief Statistics recorder file format and interface
+ */
+
+#ifndef STATS_RECORDER_H
+#define STATS_RECORDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_RECORDER_MAGIC "GSHSTAT1"
+#define STATS_RECORDER_MAGIC_LEN 8
+#define STATS_RECORDER_HEADER_SIZE 4096
+#define STATS_RECORDER_RECORD_MAGIC 0x52545347	/* GSTR */
+
+struct stats_recorder_header {
+	char magic[STATS_RECORDER_MAGIC_LEN];
+	uint64_t ring_size;	/*< Bytes of records after the header */
+	uint64_t checksum;
+};
+
+struct stats_recorder_record {
+	uint32_t magic;		/*< STATS_RECORDER_RECORD_MAGIC */
+	uint32_t length;	/*< Whole record, padded, in bytes */
+	uint64_t seq;		/*< Increases by one per record */
+	uint64_t time_ns;	/*< Wall clock at the end of the interval */
+	uint32_t interval_ms;	/*< Length of the interval */
+	uint32_t nkeys;
+	uint64_t boot;		/*< ServerBootTime, changes on restart */
+	uint64_t checksum;	/*< Of the record with this zero */
+};
+
+/**
+ * @brief Keys
+ *
+ * The top byte of a key is its class.  For STATS_KEY_PROTO it is
+ * followed by a protocol and a field nibble; for STATS_KEY_EXPORT by
+ * the export id, a protocol and a field; for the operation classes
+ * by the operation number.
+ */
+
+#define STATS_KEY_PROTO 0x01
+#define STATS_KEY_NFSV3_OP 0x02
+#define STATS_KEY_NFSV4_OP 0x03
+#define STATS_KEY_NLM_OP 0x04
+#define STATS_KEY_MNT_OP 0x05
+#define STATS_KEY_RQUOTA_OP 0x06
+#define STATS_KEY_CACHE 0x07
+#define STATS_KEY_GAUGE 0x08
+#define STATS_KEY_EXPORT 0x10
+
+#define STATS_KEY_CLASS(key) ((key) >> 24)
+
+enum stats_proto {
+	STATS_NFSV3,
+	STATS_NFSV40,
+	STATS_NFSV41,
+	STATS_NFSV42,
+	STATS_NLM4,
+	STATS_MNTV1,
+	STATS_MNTV3,
+	STATS_RQUOTA,
+	STATS_9P,
+	STATS_PROTO_COUNT
+};
+
+enum stats_field {
+	STATS_OPS,		/*< Requests, or compounds for NFSv4 */
+	STATS_ERRORS,
+	STATS_DUPS,
+	STATS_LATENCY_NS,	/*< Summed over the requests */
+	STATS_QUEUE_NS,		/*< Summed time waiting for a worker */
+	STATS_READ_OPS,
+	STATS_READ_BYTES,
+	STATS_WRITE_OPS,
+	STATS_WRITE_BYTES,
+	STATS_FIELD_COUNT
+};
+
+enum stats_cache_field {
+	STATS_CACHE_REQ,
+	STATS_CACHE_HIT,
+	STATS_CACHE_MISS,
+	STATS_CACHE_CONFLICT,
+	STATS_CACHE_ADDED,
+	STATS_CACHE_COUNT
+};
+
+/* Gauges 0 to N_REQ_QUEUES - 1 are the request queue depths */
+#define STATS_GAUGE_QUEUE 0
+#define STATS_GAUGE_STALLED 8	/*< Transports stalled on queue limits */
+#define STATS_GAUGE_ENTRIES 9	/*< Cache inode entries in use */
+#define STATS_GAUGE_OPEN_FDS 10	/*< File descriptors cached open */
+
+static inline uint32_t stats_proto_key(enum stats_proto proto,
+				       enum stats_field field)
+{
+	return (STATS_KEY_PROTO << 24) | (proto << 4) | field;
+}
+
+static inline uint32_t stats_export_key(uint16_t export_id,
+					enum stats_proto proto,
+					enum stats_field field)
+{
+	return (STATS_KEY_EXPORT << 24) | (export_id << 8) | (proto << 4) |
+	    field;
+}
+
+static inline uint32_t stats_key(uint32_t class, uint32_t item)
+{
+	return (class << 24) | item;
+}
+
+/**
+ * @brief Checksum of a header or record, FNV-1a
+ *
+ * @param[in] h   STATS_RECORDER_SUM_INIT, or the sum so far
+ * @param[in] buf Bytes to add
+ * @param[in] len How many
+ */
+
+#define STATS_RECORDER_SUM_INIT 0xcbf29ce484222325ULL
+
+static inline uint64_t stats_recorder_sum(uint64_t h, const void *buf,
+					  size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len--)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h;
+}
+
+static inline uint8_t *stats_put_varint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/**
+ * @return Past the varint, NULL if it runs past @a end.
+ */
+
+static inline const uint8_t *stats_get_varint(const uint8_t *p,
+					      const uint8_t *end,
+					      uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (p < end && shift < 64) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0)
+			return p;
+		shift += 7;
+	}
+	return NULL;
+}
+
+/**
+ * @brief A key and its value in a record
+ */
+
+struct stats_pair {
+	uint32_t key;
+	uint64_t value;
+};
+
+static inline int stats_pair_cmp(const void *a, const void *b)
+{
+	const struct stats_pair *x = a, *y = b;
+
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/**
+ * @brief Most bytes a record with @a nkeys keys takes
+ */
+
+static inline size_t stats_record_max(uint32_t nkeys)
+{
+	return sizeof(struct stats_recorder_record) + nkeys * 15 + 7;
+}
+
+/**
+ * @brief Encode a record
+ *
+ * @param[out] buf   At least stats_record_max(nkeys) bytes
+ * @param[in]  rec   Record header, length and checksum are filled in
+ * @param[in]  pairs rec->nkeys keys and values, in increasing key
+ *                   order, no value zero
+ *
+ * @return Length of the record.
+ */
+
+static inline uint32_t stats_record_encode(uint8_t *buf,
+					   struct stats_recorder_record *rec,
+					   const struct stats_pair *pairs)
+{
+	uint8_t *p = buf + sizeof(*rec);
+	uint32_t prev = 0, i;
+
+	for (i = 0; i < rec->nkeys; i++) {
+		p = stats_put_varint(p, pairs[i].key - prev);
+		p = stats_put_varint(p, pairs[i].value);
+		prev = pairs[i].key;
+	}
+	while ((p - buf) % 8 != 0)
+		*p++ = 0;
+
+	rec->magic = STATS_RECORDER_RECORD_MAGIC;
+	rec->length = p - buf;
+	rec->checksum = 0;
+	memcpy(buf, rec, sizeof(*rec));
+	rec->checksum = stats_recorder_sum(STATS_RECORDER_SUM_INIT, buf,
+					   rec->length);
+	memcpy(buf, rec, sizeof(*rec));
+
+	return rec->length;
+}
+
+/**
+ * @brief Whether a valid record starts at an offset in the ring
+ */
+
+static inline bool stats_record_valid(const uint8_t *ring, uint64_t size,
+				      uint64_t off)
+{
+	struct stats_recorder_record rec;
+	uint64_t checksum, sum;
+
+	if (off + sizeof(rec) > size)
+		return false;
+	memcpy(&rec, ring + off, sizeof(rec));
+	if (rec.magic != STATS_RECORDER_RECORD_MAGIC ||
+	    rec.length < sizeof(rec) || rec.length % 8 != 0 ||
+	    off + rec.length > size)
+		return false;
+
+	checksum = rec.checksum;
+	rec.checksum = 0;
+	sum = stats_recorder_sum(STATS_RECORDER_SUM_INIT, &rec, sizeof(rec));
+	sum = stats_recorder_sum(sum, ring + off + sizeof(rec),
+				 rec.length - sizeof(rec));
+	return sum == checksum;
+}
+
+struct stats_record_ref {
+	uint64_t seq;
+	uint64_t off;
+};
+
+static inline int stats_record_ref_cmp(const void *a, const void *b)
+{
+	const struct stats_record_ref *x = a, *y = b;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/**
+ * @brief Find the records in a ring, oldest first
+ *
+ * @param[in]  ring  The ring's bytes
+ * @param[in]  size  Its size
+ * @param[out] count Number found
+ *
+ * @return Their sequence numbers and offsets, to be freed, NULL if
+ *         none or out of memory.
+ */
+
+static inline struct stats_record_ref *stats_ring_scan(const uint8_t *ring,
+						       uint64_t size,
+						       size_t *count)
+{
+	struct stats_record_ref *refs = NULL, *grown;
+	struct stats_recorder_record rec;
+	size_t n = 0, max = 0;
+	uint64_t off = 0;
+
+	while (off + sizeof(rec) <= size) {
+		if (!stats_record_valid(ring, size, off)) {
+			off += 8;
+			continue;
+		}
+		memcpy(&rec, ring + off, sizeof(rec));
+		if (n == max) {
+			max = max ? max * 2 : 1024;
+			grown = realloc(refs, max * sizeof(*refs));
+			if (grown == NULL) {
+				free(refs);
+				*count = 0;
+				return NULL;
+			}
+			refs = grown;
+		}
+		refs[n].seq = rec.seq;
+		refs[n].off = off;
+		n++;
+		off += rec.length;
+	}
+
+	if (n != 0)
+		qsort(refs, n, sizeof(*refs), stats_record_ref_cmp);
+	*count = n;
+	return refs;
+}
+
+#ifndef STATS_RECORDER_FORMAT_ONLY
+
+#include "config_parsing.h"
+
+/**
+ * @brief Recorder parameters, settable in the Stats_Recorder stanza.
+ */
+
+struct stats_recorder_parameter {
+	/** Whether to record at all.  Settable by Enable. */
+	bool enable;
+	/** Ring file.  Settable by Path. */
+	char *path;
+	/** Seconds between samples.  Settable by Interval. */
+	uint32_t interval;
+	/** Bytes of samples kept.  Settable by Max_Size. */
+	uint64_t max_size;
+	/** Record per export statistics too.  Settable by
+	    Per_Export. */
+	bool per_export;
+};
+
+extern struct stats_recorder_parameter stats_recorder_param;
+extern struct config_block stats_recorder_param_blk;
+
+int stats_recorder_init(void);
+int stats_recorder_shutdown(void);
+
+/**
+ * @brief Receives the counters server_stats_sample walks
+ */
+
+typedef void (*stats_sample_cb)(uint32_t key, uint64_t value, void *arg);
+
+void server_stats_sample(stats_sample_cb cb, void *arg, bool per_export);
+
+#endif				/* STATS_RECORDER_FORMAT_ONLY */
+
+#endif				/* STATS_RECORDER_H */
+
+/** @} */
@@ -1507,7 +1507,8 @@ static log_levels_t default_log_levels[] = {
 	[COMPONENT_9P_DISPATCH] = NIV_EVENT,
 	[COMPONENT_FSAL_UP] = NIV_EVENT,
 	[COMPONENT_DBUS] = NIV_EVENT,
-	[COMPONENT_NFS_MSK] = NIV_EVENT
+	[COMPONENT_NFS_MSK] = NIV_EVENT,
+	[COMPONENT_MEMORY] = NIV_EVENT
 };
 
 log_levels_t *component_log_level = default_log_levels;
@@ -1620,7 +1621,10 @@ struct log_component_info LogComponents[COMPONENT_COUNT] = {
 		.comp_str = "DBUS",},
 	[COMPONENT_NFS_MSK] = {
 		.comp_name = "COMPONENT_NFS_MSK",
-		.comp_str = "NFS_MSK",}
+		.comp_str = "NFS_MSK",},
+	[COMPONENT_MEMORY] = {
+		.comp_name = "COMPONENT_MEMORY",
+		.comp_str = "MEMORY",}
 };
 
 void DisplayLogComponentLevel(log_components_t component, char *file, int line,
@@ -1771,6 +1775,7 @@ HANDLE_PROP(9P_DISPATCH);
 HANDLE_PROP(FSAL_UP);
 HANDLE_PROP(DBUS);
 HANDLE_PROP(NFS_MSK);
+HANDLE_PROP(MEMORY);
 
 static struct gsh_dbus_prop *log_props[] = {
 	LOG_PROPERTY_ITEM(ALL),
@@ -1809,6 +1814,7 @@ static struct gsh_dbus_prop *log_props[] = {
 	LOG_PROPERTY_ITEM(FSAL_UP),
 	LOG_PROPERTY_ITEM(DBUS),
 	LOG_PROPERTY_ITEM(NFS_MSK),
+	LOG_PROPERTY_ITEM(MEMORY),
 	NULL
 };
 
@@ -2102,6 +2108,8 @@ static struct config_item component_levels[] = {
 			 COMPONENT_DBUS, int),
 	CONF_INDEX_TOKEN("COMPONENT_NFS_MSK", NB_LOG_LEVEL, log_levels,
 			 COMPONENT_NFS_MSK, int),
+	CONF_INDEX_TOKEN("MEMORY", NB_LOG_LEVEL, log_levels,
+			 COMPONENT_MEMORY, int),
 	CONFIG_EOL
 };
 
@@ -164,6 +164,15 @@ class ExportMgr():
            return False, e
         return True, "Done"
 
+    def InvalidateExport(self, exp_id):
+        invalidate_export_method = self.dbusobj.get_dbus_method("InvalidateExport",
+                                                                self.dbus_interface)
+        try:
+           invalidate_export_method(int(exp_id))
+        except dbus.exceptions.DBusException as e:
+           return False, e
+        return True, "Done"
+
     def DisplayExport(self, exp_id):
         display_export_method = self.dbusobj.get_dbus_method("DisplayExport",
                                                              self.dbus_interface)
@@ -104,6 +104,11 @@ class ShowExports():
         print "Remove Export with id %d" % int(exp_id)
         self.exportmgr.RemoveExport(exp_id)
 
+    def invalidateexport(self, exp_id):
+        print "Invalidate cache of export with id %d" % int(exp_id)
+        status, msg = self.exportmgr.InvalidateExport(exp_id)
+        self.status_message(status, msg)
+
     def displayexport(self, exp_id):
         print "Display export with id %d" % int(exp_id)
         status, msg, reply = self.exportmgr.DisplayExport(exp_id)
@@ -223,6 +228,8 @@ if __name__ == '__main__':
        "      Example: \n"                                                   \
        "      add_export /etc/ganesha/gpfs.conf \"EXPORT(Export_ID=77)\"\n\n"\
        "   remove_export id: Removes the export with the given id    \n\n"   \
+       "   invalidate_export id: Drops cached attributes and content\n"   \
+       "      of the export with the given id\n\n"                          \
        "   shutdown: Shuts down the ganesha nfs server\n\n"                  \
        "   grace ipaddr: Begins grace for the given IP\n\n"                  \
        "   get_log component: Gets the log level for the given component\n\n"\
@@ -256,6 +263,11 @@ if __name__ == '__main__':
            print "remove_export requires an export ID."\
                  " Try \"ganesha_mgr.py help\" for more info"
         exportmgr.removeexport(sys.argv[2])
+    elif sys.argv[1] == "invalidate_export":
+        if len(sys.argv) < 3:
+           print "invalidate_export requires an export ID."\
+                 " Try \"ganesha_mgr.py help\" for more info"
+        exportmgr.invalidateexport(sys.argv[2])
     elif sys.argv[1] == "display_export":
         if len(sys.argv) < 3:
            print "display_export requires an export ID."\
@@ -64,6 +64,7 @@
 #include "nfs_exports.h"
 #include "nfs_proto_functions.h"
 #include "pnfs_utils.h"
+#include "cache_inode.h"
 
 /**
  * @brief Exports are stored in an AVL tree with front-end cache.
@@ -1088,6 +1089,50 @@ static struct gsh_dbus_method export_remove_export = {
 		 END_ARG_LIST}
 };
 
+/**
+ * @brief Drop everything cached for an export
+ *
+ * Mostly for immutable exports whose data has been refreshed.
+ *
+ * @param "id"  [IN] the id of the export to invalidate
+ *
+ * @return           As above, use DBusError to return errors.
+ */
+
+static bool gsh_export_invalidateexport(DBusMessageIter *args,
+					DBusMessage *reply,
+					DBusError *error)
+{
+	struct gsh_export *export = NULL;
+	char *errormsg;
+	int count;
+
+	export = lookup_export(args, &errormsg);
+	if (export == NULL) {
+		LogDebug(COMPONENT_EXPORT, "lookup_export failed with %s",
+			errormsg);
+		dbus_set_error(error, DBUS_ERROR_INVALID_ARGS,
+			       "lookup_export failed with %s",
+			       errormsg);
+		return false;
+	}
+
+	count = cache_inode_invalidate_export(export);
+	LogInfo(COMPONENT_EXPORT,
+		"Invalidated %d cached entries of export with id %d",
+		count, export->export_id);
+
+	put_gsh_export(export);
+	return true;
+}
+
+static struct gsh_dbus_method export_invalidate_export = {
+	.name = "InvalidateExport",
+	.method = gsh_export_invalidateexport,
+	.args = {ID_ARG,
+		 END_ARG_LIST}
+};
+
 #define DISP_EXP_REPLY		\
 {				\
 	.name = "id",		\
@@ -1230,6 +1275,7 @@ static struct gsh_dbus_method export_show_exports = {
 static struct gsh_dbus_method *export_mgr_methods[] = {
 	&export_add_export,
 	&export_remove_export,
+	&export_invalidate_export,
 	&export_display_export,
 	&export_show_exports,
 	NULL
@@ -722,6 +722,13 @@ static int export_commit_common(void *node, void *link_mem, void *self_struct,
 			errcnt++;
 		}
 	}
+	if (export->expire_time_attr_max != 0 &&
+	    export->expire_time_attr_max < export->expire_time_attr_min) {
+		LogCrit(COMPONENT_CONFIG,
+			"Attr_Expiration_Max_Time must not be less than Attr_Expiration_Min_Time");
+		err_type->invalid = true;
+		errcnt++;
+	}
 	if (errcnt)
 		goto err_out;  /* have basic errors. don't even try more... */
 
@@ -1216,6 +1223,12 @@ static struct config_item export_params[] = {
 	CONF_ITEM_BOOLBIT_SET("Trust_Readdir_Negative_Cache",
 		false, EXPORT_OPTION_TRUST_READIR_NEGATIVE_CACHE,
 		gsh_export, options, options_set),
+	CONF_ITEM_BOOLBIT_SET("Mandatory_Locks",
+		false, EXPORT_OPTION_MANDATORY_LOCKS,
+		gsh_export, options, options_set),
+	CONF_ITEM_BOOLBIT_SET("Immutable",
+		false, EXPORT_OPTION_IMMUTABLE,
+		gsh_export, options, options_set),
 	CONF_EXPORT_PERMS(gsh_export, export_perms),
 	CONF_ITEM_BLOCK("Client", client_params,
 			client_init, client_commit,
@@ -1223,6 +1236,10 @@ static struct config_item export_params[] = {
 	CONF_ITEM_I32_SET("Attr_Expiration_Time", -1, INT32_MAX, 60,
 		       gsh_export, expire_time_attr,
 		       EXPORT_OPTION_EXPIRE_SET,  options_set),
+	CONF_ITEM_I32("Attr_Expiration_Min_Time", 1, INT32_MAX, 1,
+		       gsh_export, expire_time_attr_min),
+	CONF_ITEM_I32("Attr_Expiration_Max_Time", 0, INT32_MAX, 0,
+		       gsh_export, expire_time_attr_max),
 	CONF_RELAX_BLOCK("FSAL", fsal_params,
 			 fsal_init, fsal_commit,
 			 gsh_export, fsal_export),
@@ -2324,6 +2341,17 @@ void export_check_access(void)
 
 	op_ctx->export_perms->set |= export_opt.def.set;
 
+	/* Immutable exports are read-only whatever the client entries
+	 * say, and hand out read delegations unless the export itself
+	 * says otherwise. */
+	if (op_ctx->export->options & EXPORT_OPTION_IMMUTABLE) {
+		op_ctx->export_perms->options &= ~EXPORT_OPTION_MODIFY_ACCESS;
+		if ((op_ctx->export->export_perms.set &
+		     EXPORT_OPTION_DELEGATIONS) == 0)
+			op_ctx->export_perms->options |=
+						EXPORT_OPTION_READ_DELEG;
+	}
+
 	if (isMidDebug(COMPONENT_EXPORT)) {
 		char perms[1024];
 		if (client != NULL) {
@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #ifdef LINUX
 #include <sys/signal.h>
 #elif FREEBSD
@@ -50,6 +51,25 @@
 #include "fridgethr.h"
 #include "nfs_core.h"
 
+/**
+ * @brief Set the command state of a fridge
+ *
+ * The lock-free submission path reads the command without the fridge
+ * mutex, so keep an atomic mirror of it.
+ *
+ * @note This function must be called with the fridge mutex held.
+ *
+ * @param[in,out] fr      The fridge
+ * @param[in]     command The new command
+ */
+
+static inline void fridgethr_set_command(struct fridgethr *fr,
+					 fridgethr_comm_t command)
+{
+	fr->command = command;
+	atomic_store_uint32_t(&fr->lf.command, command);
+}
+
 /**
  * @brief Initialize a thread fridge
  *
@@ -75,6 +95,8 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 	bool attrinit = false;
 	/* True if the fridge mutex has been initialized */
 	bool mutexinit = false;
+	/* True if the submission ring has been initialized */
+	bool ringinit = false;
 
 	if ((p->thr_min > p->thr_max) && p->thr_max != 0) {
 		LogMajor(COMPONENT_THREAD,
@@ -147,8 +169,12 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 		goto out;
 	}
 
-	frobj->command = fridgethr_comm_run;
+	fridgethr_set_command(frobj, fridgethr_comm_run);
 	frobj->transitioning = false;
+	frobj->lf.parked = 0;
+	frobj->lf.pending = 0;
+	frobj->lf.submitters = 0;
+	frobj->lf.resizes = 0;
 
 	/* Thread list */
 	glist_init(&frobj->thread_list);
@@ -159,6 +185,19 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 	/* Flavor */
 
 	if (frobj->p.flavor == fridgethr_flavor_worker) {
+		rc = gsh_mpmc_init(&frobj->lf.q,
+				   frobj->p.queue_depth != 0 ?
+				   frobj->p.queue_depth :
+				   FRIDGETHR_DEFAULT_QUEUE_DEPTH);
+		if (rc != 0) {
+			LogMajor(COMPONENT_THREAD,
+				 "Unable to allocate submission ring for "
+				 "fridge %s: %d", s, rc);
+			goto out;
+		}
+		gsh_ec_init(&frobj->lf.ec);
+		ringinit = true;
+
 		/* Deferment */
 		switch (frobj->p.deferment) {
 		case fridgethr_defer_queue:
@@ -204,6 +243,11 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
  out:
 
 	if (rc != 0) {
+		if (ringinit) {
+			gsh_ec_destroy(&frobj->lf.ec);
+			gsh_mpmc_destroy(&frobj->lf.q);
+			ringinit = false;
+		}
 		if (mutexinit) {
 			PTHREAD_MUTEX_destroy(&frobj->mtx);
 			mutexinit = false;
@@ -233,6 +277,10 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 
 void fridgethr_destroy(struct fridgethr *fr)
 {
+	if (fr->p.flavor == fridgethr_flavor_worker) {
+		gsh_ec_destroy(&fr->lf.ec);
+		gsh_mpmc_destroy(&fr->lf.q);
+	}
 	PTHREAD_MUTEX_destroy(&fr->mtx);
 	pthread_attr_destroy(&fr->attr);
 	gsh_free(fr->s);
@@ -277,6 +325,24 @@ static void fridgethr_finish_transition(struct fridgethr *fr, bool locked)
 	fr->transitioning = false;
 }
 
+/**
+ * @brief Test whether the fridge has more threads than it may
+ *
+ * True after fridgethr_resize has lowered the maximum, until enough
+ * threads have exited.
+ *
+ * @note This function must be called with the fridge mutex held.
+ *
+ * @param[in] fr The fridge
+ *
+ * @return true if a thread should exit.
+ */
+
+static inline bool fridgethr_excess(struct fridgethr *fr)
+{
+	return (fr->p.thr_max != 0) && (fr->nthreads > fr->p.thr_max);
+}
+
 /**
  * @brief Test whether the fridge has deferred work waiting
  *
@@ -303,16 +369,67 @@ static bool fridgethr_deferredwork(struct fridgethr *fr)
 		break;
 	}
 
+	if (!res && (fr->p.flavor == fridgethr_flavor_worker))
+		res = !gsh_mpmc_empty(&fr->lf.q);
+
 	return res;
 }
 
+/**
+ * @brief Wake a parked worker
+ *
+ * Only one wakeup is kept outstanding at a time; the thread that
+ * takes it clears the flag and then drains the ring, so a burst of
+ * submissions costs a single futex wake rather than one per task.
+ *
+ * @param[in,out] fr Fridge
+ */
+
+static void fridgethr_lf_wake(struct fridgethr *fr)
+{
+	if ((atomic_fetch_uint32_t(&fr->lf.parked) != 0)
+	    && atomic_cas_uint32_t(&fr->lf.pending, 0, 1))
+		gsh_ec_notify(&fr->lf.ec, 1);
+}
+
+/**
+ * @brief Take work from the submission ring
+ *
+ * This may be called with or without the fridge mutex.  If work
+ * remains after we take ours, wake another worker to help.
+ *
+ * @param[in,out] fr Fridge
+ * @param[in,out] fe Fridge entry
+ *
+ * @return true if work has been dequeued.
+ */
+
+static bool fridgethr_lf_getwork(struct fridgethr *fr,
+				 struct fridgethr_entry *fe)
+{
+	void *func;
+	void *arg;
+
+	if (!gsh_mpmc_dequeue(&fr->lf.q, &func, &arg))
+		return false;
+
+	fe->ctx.func = (void (*)(struct fridgethr_context *))func;
+	fe->ctx.arg = arg;
+
+	if (!gsh_mpmc_empty(&fr->lf.q))
+		fridgethr_lf_wake(fr);
+
+	return true;
+}
+
 /**
  * @brief Get deferred work
  *
  * This function only does something in the case of a queueing
- * fridge.  If work is available, it loads it into the thread context
- * and returns true.  If work is not available (or the fridge is not a
- * queueing fridge) it returns false and leaves the context untouched.
+ * fridge or a worker fridge with work in its submission ring.  If
+ * work is available, it loads it into the thread context and
+ * returns true.  If work is not available it returns false and
+ * leaves the context untouched.
  *
  * @param[in,out] fr Fridge
  * @param[in,out] fe Fridge entry
@@ -324,11 +441,8 @@ static bool fridgethr_deferredwork(struct fridgethr *fr)
 
 static bool fridgethr_getwork(struct fridgethr *fr, struct fridgethr_entry *fe)
 {
-	if ((fr->p.deferment == fridgethr_defer_block)
-	    || (fr->p.deferment == fridgethr_defer_fail)
-	    || glist_empty(&fr->deferment.work_q)) {
-		return false;
-	} else {
+	if ((fr->p.deferment == fridgethr_defer_queue)
+	    && !glist_empty(&fr->deferment.work_q)) {
 		struct fridgethr_work *q =
 		    glist_first_entry(&fr->deferment.work_q,
 				      struct fridgethr_work,
@@ -339,6 +453,142 @@ static bool fridgethr_getwork(struct fridgethr *fr, struct fridgethr_entry *fe)
 		gsh_free(q);
 		return true;
 	}
+
+	if (fr->p.flavor == fridgethr_flavor_worker)
+		return fridgethr_lf_getwork(fr, fe);
+
+	return false;
+}
+
+/**
+ * @brief Decide whether a parked worker has a reason to get up
+ *
+ * Besides work and a stop, a resize since the worker parked wakes it,
+ * so that it looks at the new limits and exits if it is in excess.
+ *
+ * @param[in] fr      Fridge
+ * @param[in] resizes fr->lf.resizes when the worker parked
+ *
+ * @return true if the worker should leave the event count.
+ */
+
+static bool fridgethr_lf_should_wake(struct fridgethr *fr,
+				     uint32_t resizes)
+{
+	uint32_t command = atomic_fetch_uint32_t(&fr->lf.command);
+
+	return (command == fridgethr_comm_stop)
+		|| (atomic_fetch_uint32_t(&fr->lf.resizes) != resizes)
+		|| ((command == fridgethr_comm_run)
+		    && !gsh_mpmc_empty(&fr->lf.q));
+}
+
+/**
+ * @brief Wait for more work in a worker fridge
+ *
+ * Worker fridges take all their work from the submission ring.  A
+ * worker that finishes a task drains the ring without touching the
+ * fridge mutex; only when the ring is empty does it take the mutex
+ * to account itself idle (or exit) and park on the event count.
+ *
+ * A worker that wants to exit first waits out any submitter that
+ * might have enqueued on the strength of its being parked, then
+ * looks at the ring once more.
+ *
+ * @param[in,out] fr Fridge
+ * @param[in,out] fe Fridge entry
+ *
+ * @retval true if we have more work to do.
+ * @retval false if we need to go away.
+ */
+
+static bool fridgethr_park(struct fridgethr *fr, struct fridgethr_entry *fe)
+{
+	/* Return code from waiting */
+	int rc = 0;
+	/* Event count key */
+	uint32_t key;
+	/* Resizes seen before parking */
+	uint32_t resizes;
+
+	if ((atomic_fetch_uint32_t(&fr->lf.command) != fridgethr_comm_pause)
+	    && fridgethr_lf_getwork(fr, fe))
+		return true;
+
+	PTHREAD_MUTEX_lock(&fr->mtx);
+	while (true) {
+		if ((fr->command != fridgethr_comm_pause)
+		    && fridgethr_getwork(fr, fe)) {
+			PTHREAD_MUTEX_unlock(&fr->mtx);
+			return true;
+		}
+
+		if (((rc == ETIMEDOUT) && (fr->nthreads > fr->p.thr_min))
+		    || fridgethr_excess(fr)
+		    || (fr->command == fridgethr_comm_stop)) {
+			if ((atomic_fetch_uint32_t(&fr->lf.submitters) != 0)
+			    || ((fr->command != fridgethr_comm_pause)
+				&& !gsh_mpmc_empty(&fr->lf.q))) {
+				PTHREAD_MUTEX_unlock(&fr->mtx);
+				sched_yield();
+				PTHREAD_MUTEX_lock(&fr->mtx);
+				continue;
+			}
+			--(fr->nthreads);
+			glist_del(&fe->thread_link);
+			if ((fr->nthreads == 0)
+			    && (fr->command == fridgethr_comm_stop)
+			    && (fr->transitioning)
+			    && !fridgethr_deferredwork(fr)) {
+				/* We're the last thread to exit, signal the
+				   transition to stop complete. */
+				fridgethr_finish_transition(fr, false);
+			}
+			PTHREAD_MUTEX_unlock(&fr->mtx);
+			return false;
+		}
+
+		++(fr->nidle);
+		atomic_inc_uint32_t(&fr->lf.parked);
+		if ((fr->nidle == fr->nthreads)
+		    && (fr->command == fridgethr_comm_pause)
+		    && (fr->transitioning)) {
+			/* We're the last thread to suspend, signal the
+			   transition to pause complete. */
+			fridgethr_finish_transition(fr, false);
+		}
+		if ((fr->command == fridgethr_comm_run)
+		    && (fr->transitioning) && !fridgethr_deferredwork(fr)) {
+			/* The backlog found by fridgethr_start is
+			   drained, signal the start complete. */
+			fridgethr_finish_transition(fr, false);
+		}
+		if ((fr->p.deferment == fridgethr_defer_block)
+		    && (fr->deferment.block.waiters > 0)) {
+			pthread_cond_signal(&fr->deferment.block.cond);
+		}
+		/* Taken under the mutex, as fridgethr_resize bumps it */
+		resizes = atomic_fetch_uint32_t(&fr->lf.resizes);
+		PTHREAD_MUTEX_unlock(&fr->mtx);
+
+		atomic_store_uint32_t(&fr->lf.pending, 0);
+		do {
+			key = gsh_ec_prepare(&fr->lf.ec);
+			if (fridgethr_lf_should_wake(fr, resizes)) {
+				gsh_ec_cancel(&fr->lf.ec);
+				rc = 0;
+				break;
+			}
+			rc = gsh_ec_wait(&fr->lf.ec, key,
+					 fr->p.thread_delay);
+		} while ((rc == 0) && !fridgethr_lf_should_wake(fr, resizes));
+		atomic_store_uint32_t(&fr->lf.pending, 0);
+		fe->ctx.woke = (rc != ETIMEDOUT);
+
+		PTHREAD_MUTEX_lock(&fr->mtx);
+		--(fr->nidle);
+		atomic_dec_uint32_t(&fr->lf.parked);
+	}
 }
 
 /**
@@ -367,6 +617,9 @@ static bool fridgethr_freeze(struct fridgethr *fr,
 	/* Return code from system calls */
 	int rc = 0;
 
+	if (fr->p.flavor == fridgethr_flavor_worker)
+		return fridgethr_park(fr, fe);
+
 	PTHREAD_MUTEX_lock(&fr->mtx);
  restart:
 	/* If we are not paused and there is work left to do in the
@@ -379,6 +632,7 @@ static bool fridgethr_freeze(struct fridgethr *fr,
 
 	/* rc would have been set in the while loop below */
 	if (((rc == ETIMEDOUT) && (fr->nthreads > fr->p.thr_min))
+	    || fridgethr_excess(fr)
 	    || (fr->command == fridgethr_comm_stop)) {
 		/* We do this here since we already have the fridge
 		   lock. */
@@ -406,6 +660,12 @@ static bool fridgethr_freeze(struct fridgethr *fr,
 		   transition to pause complete. */
 		fridgethr_finish_transition(fr, false);
 	}
+	if ((fr->command == fridgethr_comm_run) && (fr->transitioning)
+	    && !fridgethr_deferredwork(fr)) {
+		/* The backlog found by fridgethr_start is drained,
+		   signal the start complete. */
+		fridgethr_finish_transition(fr, false);
+	}
 
 	PTHREAD_MUTEX_lock(&fe->ctx.mtx);
 	fe->frozen = true;
@@ -692,6 +952,11 @@ static int fridgethr_queue(struct fridgethr *fr,
 
 	assert(fr->p.deferment == fridgethr_defer_queue);
 
+	/* Busy workers drain the ring before they go idle, so prefer
+	   it and only spill to the list if it's full. */
+	if (gsh_mpmc_enqueue(&fr->lf.q, func, arg))
+		return 0;
+
 	q = gsh_malloc(sizeof(struct fridgethr_work));
 	if (q == NULL) {
 		PTHREAD_MUTEX_unlock(&fr->mtx);
@@ -733,6 +998,16 @@ static bool fridgethr_dispatch(struct fridgethr *fr,
 	/* If we successfully dispatched */
 	bool dispatched = false;
 
+	/* Idle workers are parked on the event count and pick their
+	   work up from the ring. */
+	if (fr->p.flavor == fridgethr_flavor_worker) {
+		if ((fr->nidle == 0)
+		    || !gsh_mpmc_enqueue(&fr->lf.q, func, arg))
+			return false;
+		fridgethr_lf_wake(fr);
+		return true;
+	}
+
 	/* Try to grab a thread */
 	glist_for_each_safe(g, n, &fr->idle_q) {
 		fe = container_of(g, struct fridgethr_entry, idle_link);
@@ -831,6 +1106,10 @@ static int fridgethr_block(struct fridgethr *fr,
  * reached maxthreads, defer the request in accord with the fridge's
  * deferment policy.
  *
+ * In worker fridges, if a thread is parked and the fridge is running,
+ * the job is put on the submission ring and a parked thread woken
+ * without taking the fridge mutex.
+ *
  * @param[in] fr   The fridge in which to find a thread
  * @param[in] func The thing to do
  * @param[in] arg  The thing to do it to
@@ -853,6 +1132,21 @@ int fridgethr_submit(struct fridgethr *fr,
 		return EPIPE;
 	}
 
+	if (fr->p.flavor == fridgethr_flavor_worker) {
+		/* Parked workers won't exit while we're counted here,
+		   see fridgethr_park. */
+		atomic_inc_uint32_t(&fr->lf.submitters);
+		if ((atomic_fetch_uint32_t(&fr->lf.command) ==
+		     fridgethr_comm_run)
+		    && (atomic_fetch_uint32_t(&fr->lf.parked) != 0)
+		    && gsh_mpmc_enqueue(&fr->lf.q, func, arg)) {
+			fridgethr_lf_wake(fr);
+			atomic_dec_uint32_t(&fr->lf.submitters);
+			return 0;
+		}
+		atomic_dec_uint32_t(&fr->lf.submitters);
+	}
+
 	PTHREAD_MUTEX_lock(&fr->mtx);
 	if (fr->command == fridgethr_comm_stop) {
 		LogMajor(COMPONENT_THREAD,
@@ -927,6 +1221,9 @@ int fridgethr_wake(struct fridgethr *fr)
 		return EPIPE;
 	}
 
+	if (fr->p.flavor == fridgethr_flavor_worker)
+		gsh_ec_notify_all(&fr->lf.ec);
+
 	/* Wake the threads */
 	glist_for_each(g, &fr->idle_q) {
 		/* The entry for the found thread */
@@ -998,7 +1295,7 @@ int fridgethr_pause(struct fridgethr *fr, pthread_mutex_t *mtx,
 		return EINVAL;
 	}
 
-	fr->command = fridgethr_comm_pause;
+	fridgethr_set_command(fr, fridgethr_comm_pause);
 	fr->transitioning = true;
 	fr->cb_mtx = mtx;
 	fr->cb_cv = cv;
@@ -1076,7 +1373,7 @@ int fridgethr_stop(struct fridgethr *fr, pthread_mutex_t *mtx,
 		return EINVAL;
 	}
 
-	fr->command = fridgethr_comm_stop;
+	fridgethr_set_command(fr, fridgethr_comm_stop);
 	fr->transitioning = true;
 	fr->cb_mtx = mtx;
 	fr->cb_cv = cv;
@@ -1101,6 +1398,9 @@ int fridgethr_stop(struct fridgethr *fr, pthread_mutex_t *mtx,
 		/* Iterator over the list */
 		struct glist_head *g = NULL;
 
+		if (fr->p.flavor == fridgethr_flavor_worker)
+			gsh_ec_notify_all(&fr->lf.ec);
+
 		glist_for_each(g, &fr->idle_q) {
 			struct fridgethr_entry *fe;
 
@@ -1122,8 +1422,8 @@ int fridgethr_stop(struct fridgethr *fr, pthread_mutex_t *mtx,
 		PTHREAD_MUTEX_unlock(&fr->mtx);
 	} else {
 		/* Well, this is embarrassing. */
-		assert(fr->p.deferment != fridgethr_defer_fail);
-		if (fr->p.deferment == fridgethr_defer_queue) {
+		if ((fr->p.deferment == fridgethr_defer_queue)
+		    && !glist_empty(&fr->deferment.work_q)) {
 			struct fridgethr_work *q =
 			    glist_first_entry(&fr->deferment.work_q,
 					      struct fridgethr_work,
@@ -1192,7 +1492,7 @@ int fridgethr_start(struct fridgethr *fr, pthread_mutex_t *mtx,
 		return EINVAL;
 	}
 
-	fr->command = fridgethr_comm_run;
+	fridgethr_set_command(fr, fridgethr_comm_run);
 	fr->transitioning = true;
 	fr->cb_mtx = mtx;
 	fr->cb_cv = cv;
@@ -1210,6 +1510,9 @@ int fridgethr_start(struct fridgethr *fr, pthread_mutex_t *mtx,
 		/* Iterator over the list */
 		struct glist_head *g = NULL;
 
+		if (fr->p.flavor == fridgethr_flavor_worker)
+			gsh_ec_notify_all(&fr->lf.ec);
+
 		glist_for_each(g, &fr->idle_q) {
 			struct fridgethr_entry *fe;
 
@@ -1229,9 +1532,9 @@ int fridgethr_start(struct fridgethr *fr, pthread_mutex_t *mtx,
 
 	while (fridgethr_deferredwork(fr) && (maybe_spawn-- > 0)
 	       && ((fr->nthreads < fr->p.thr_max) || (fr->p.thr_max == 0))) {
-		assert(fr->p.deferment != fridgethr_defer_block);
 		/* Start some threads to finish the work */
-		if (fr->p.deferment == fridgethr_defer_queue) {
+		if ((fr->p.deferment == fridgethr_defer_queue)
+		    && !glist_empty(&fr->deferment.work_q)) {
 			struct fridgethr_work *q =
 			    glist_first_entry(&fr->deferment.work_q,
 					      struct fridgethr_work,
@@ -1253,6 +1556,13 @@ int fridgethr_start(struct fridgethr *fr, pthread_mutex_t *mtx,
 	if (fr->p.wake_threads != NULL)
 		fr->p.wake_threads(fr->p.wake_threads_arg);
 
+	if ((rc == 0) && !fridgethr_deferredwork(fr)) {
+		/* The idle are awake and the backlog has threads, so
+		   the start is done.  Otherwise the thread that drains
+		   the backlog reports it, on going idle. */
+		fridgethr_finish_transition(fr, true);
+	}
+
 	PTHREAD_MUTEX_unlock(&fr->mtx);
 	return rc;
 }
@@ -1364,11 +1674,72 @@ bool fridgethr_you_should_break(struct fridgethr_context *ctx)
 	bool rc;
 
 	PTHREAD_MUTEX_lock(&fr->mtx);
-	rc = fr->transitioning;
+	rc = fr->transitioning || fridgethr_excess(fr);
 	PTHREAD_MUTEX_unlock(&fr->mtx);
 	return rc;
 }
 
+/**
+ * @brief Add a thread running the same thing as the others
+ *
+ * @note This function must be called with the fridge mutex held.
+ *
+ * @param[in,out] fr   Fridge to populate
+ * @param[in]     func Function the thread should run
+ * @param[in]     arg  Argument supplied for that function
+ *
+ * @retval 0 on success.
+ * @retval Other codes from thread creation.
+ */
+
+static int fridgethr_populate_one(struct fridgethr *fr,
+				  void (*func) (struct fridgethr_context *),
+				  void *arg)
+{
+	struct fridgethr_entry *fe = NULL;
+	int rc = 0;
+
+	fe = gsh_calloc(sizeof(struct fridgethr_entry), 1);
+	if (fe == NULL)
+		return ENOMEM;
+
+	/* Make a new thread */
+	++(fr->nthreads);
+
+	glist_add_tail(&fr->thread_list, &fe->thread_link);
+
+	fe->fr = fr;
+	rc = pthread_mutex_init(&fe->ctx.mtx, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to initialize mutex for new thread "
+			 "in fridge %s: %d", fr->s, rc);
+		return rc;
+	}
+	rc = pthread_cond_init(&fe->ctx.cv, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to initialize condition variable "
+			 "for new thread in fridge %s: %d", fr->s, rc);
+		return rc;
+	}
+
+	fe->ctx.func = func;
+	fe->ctx.arg = arg;
+	fe->frozen = false;
+
+	rc = pthread_create(&fe->ctx.id, &fr->attr,
+			    fridgethr_start_routine, fe);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to create new thread "
+			 "in fridge %s: %d", fr->s, rc);
+		return rc;
+	}
+
+	return 0;
+}
+
 /**
  * @brief Populate a fridge with threads all running the same thing
  *
@@ -1401,55 +1772,76 @@ int fridgethr_populate(struct fridgethr *fr,
 	}
 
 	for (i = 0; i < threads_to_run; ++i) {
-		struct fridgethr_entry *fe = NULL;
-		int rc = 0;
+		int rc = fridgethr_populate_one(fr, func, arg);
 
-		fe = gsh_calloc(sizeof(struct fridgethr_entry), 1);
-		if (fe == NULL) {
+		if (rc != 0) {
 			PTHREAD_MUTEX_unlock(&fr->mtx);
-			return ENOMEM;
+			return rc;
 		}
+	}
+	PTHREAD_MUTEX_unlock(&fr->mtx);
 
-		/* Make a new thread */
-		++(fr->nthreads);
+	return 0;
+}
 
-		glist_add_tail(&fr->thread_list, &fe->thread_link);
+/**
+ * @brief Change the number of threads in a running fridge
+ *
+ * Threads beyond the new maximum exit once they are done with what
+ * they are doing; a looper thread is asked to by
+ * fridgethr_you_should_break.  If a function is given, threads
+ * running it are added up to the new minimum, as fridgethr_populate
+ * does, otherwise the fridge grows on demand.
+ *
+ * @param[in,out] fr      The fridge
+ * @param[in]     thr_min New minimum number of threads
+ * @param[in]     thr_max New maximum number of threads, 0 for no limit
+ * @param[in]     func    Function new threads should run, may be NULL
+ * @param[in]     arg     Argument supplied for that function
+ *
+ * @retval 0 on success.
+ * @retval EINVAL if thr_min exceeds thr_max.
+ * @retval EPIPE if the fridge is stopped or paused.
+ * @retval Other codes from thread creation.
+ */
 
-		fe->fr = fr;
-		rc = pthread_mutex_init(&fe->ctx.mtx, NULL);
-		if (rc != 0) {
-			LogMajor(COMPONENT_THREAD,
-				 "Unable to initialize mutex for new thread "
-				 "in fridge %s: %d", fr->s, rc);
-			PTHREAD_MUTEX_unlock(&fr->mtx);
-			return rc;
-		}
-		rc = pthread_cond_init(&fe->ctx.cv, NULL);
-		if (rc != 0) {
-			LogMajor(COMPONENT_THREAD,
-				 "Unable to initialize condition variable "
-				 "for new thread in fridge %s: %d", fr->s, rc);
-			PTHREAD_MUTEX_unlock(&fr->mtx);
-			return rc;
-		}
+int fridgethr_resize(struct fridgethr *fr, uint32_t thr_min,
+		     uint32_t thr_max,
+		     void (*func) (struct fridgethr_context *), void *arg)
+{
+	int rc = 0;
 
-		fe->ctx.func = func;
-		fe->ctx.arg = arg;
-		fe->frozen = false;
+	if ((thr_max != 0) && (thr_min > thr_max))
+		return EINVAL;
 
-		rc = pthread_create(&fe->ctx.id, &fr->attr,
-				    fridgethr_start_routine, fe);
-		if (rc != 0) {
-			LogMajor(COMPONENT_THREAD,
-				 "Unable to create new thread "
-				 "in fridge %s: %d", fr->s, rc);
-			PTHREAD_MUTEX_unlock(&fr->mtx);
-			return rc;
-		}
+	PTHREAD_MUTEX_lock(&fr->mtx);
+	if (fr->command != fridgethr_comm_run) {
+		LogMajor(COMPONENT_THREAD,
+			 "Attempt to resize stopped/paused fridge %s.", fr->s);
+		PTHREAD_MUTEX_unlock(&fr->mtx);
+		return EPIPE;
 	}
+
+	LogEvent(COMPONENT_THREAD,
+		 "Resizing fridge %s from %" PRIu32 " threads to %" PRIu32
+		 " (max %" PRIu32 ")", fr->s, fr->nthreads, thr_min, thr_max);
+
+	fr->p.thr_min = thr_min;
+	fr->p.thr_max = thr_max;
+	/* Parked workers wake only for a reason; give them this one */
+	atomic_inc_uint32_t(&fr->lf.resizes);
+
+	while ((func != NULL) && (rc == 0) && (fr->nthreads < thr_min))
+		rc = fridgethr_populate_one(fr, func, arg);
+
 	PTHREAD_MUTEX_unlock(&fr->mtx);
 
-	return 0;
+	/* Get the threads to look at the new limits */
+	(void)fridgethr_wake(fr);
+	if (fr->p.wake_threads != NULL)
+		fr->p.wake_threads(fr->p.wake_threads_arg);
+
+	return rc;
 }
 
 /**
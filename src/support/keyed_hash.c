@@ -0,0 +1,75 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file keyed_hash.c
+ * @brief Per-boot seeds for keyed hashing
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include "keyed_hash.h"
+
+/**
+ * @brief The per-boot hash key
+ */
+
+uint64_t keyed_hash_seed[2];
+
+/**
+ * @brief Draw the per-boot hash key
+ *
+ * Reads the key from /dev/urandom.  Should that fail, the key is
+ * derived from the clock and process id, which still differs from
+ * boot to boot but is guessable; the caller may want to warn.
+ *
+ * @retval true if the key came from the system random source.
+ * @retval false if the fallback was used.
+ */
+
+bool keyed_hash_init(void)
+{
+	struct timespec ts;
+	ssize_t got = 0;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		got = read(fd, keyed_hash_seed, sizeof(keyed_hash_seed));
+		close(fd);
+	}
+
+	if (got == sizeof(keyed_hash_seed))
+		return true;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	keyed_hash_seed[0] = CityHash64WithSeed((const char *)&ts, sizeof(ts),
+						(uint64_t) getpid());
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	keyed_hash_seed[1] = CityHash64WithSeed((const char *)&ts, sizeof(ts),
+						keyed_hash_seed[0]);
+
+	return false;
+}
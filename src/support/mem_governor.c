@@ -0,0 +1,636 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup mem_governor
+ * @{
+ */
+
+/**
+ * @file mem_governor.c
+ * @brief Drive cache reclaim from cgroup memory usage and pressure
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "common_utils.h"
+#include "fridgethr.h"
+#include "mem_governor.h"
+
+/**
+ * @brief Memory governor parameters
+ */
+
+struct mem_governor_parameter mem_gov_param;
+
+static struct config_item mem_governor_params[] = {
+	CONF_ITEM_BOOL("Enable", false,
+		       mem_governor_parameter, enable),
+	CONF_ITEM_UI32("Interval", 1, 3600, 5,
+		       mem_governor_parameter, interval),
+	CONF_ITEM_UI64("Memory_Limit", 0, UINT64_MAX, 0,
+		       mem_governor_parameter, memory_limit),
+	CONF_ITEM_UI32("High_Water_Percent", 1, 100, 90,
+		       mem_governor_parameter, high_water_pct),
+	CONF_ITEM_UI32("Low_Water_Percent", 1, 100, 80,
+		       mem_governor_parameter, low_water_pct),
+	CONF_ITEM_UI32("PSI_Threshold", 0, 100, 10,
+		       mem_governor_parameter, psi_threshold),
+	CONF_ITEM_BOOL("System_PSI", false,
+		       mem_governor_parameter, system_psi),
+	CONF_ITEM_UI32("PSI_Reclaim_Percent", 1, 100, 5,
+		       mem_governor_parameter, psi_reclaim_pct),
+	CONF_ITEM_UI32("Cache_Inode_Weight", 0, 1000, 100,
+		       mem_governor_parameter, cache_inode_weight),
+	CONF_ITEM_UI64("Cache_Inode_Floor", 0, UINT64_MAX, 16 * 1024 * 1024,
+		       mem_governor_parameter, cache_inode_floor),
+	CONF_ITEM_UI32("DRC_Weight", 0, 1000, 50,
+		       mem_governor_parameter, drc_weight),
+	CONF_ITEM_UI64("DRC_Floor", 0, UINT64_MAX, 4 * 1024 * 1024,
+		       mem_governor_parameter, drc_floor),
+	CONF_ITEM_UI32("Idmapper_Weight", 0, 1000, 10,
+		       mem_governor_parameter, idmapper_weight),
+	CONF_ITEM_UI64("Idmapper_Floor", 0, UINT64_MAX, 1024 * 1024,
+		       mem_governor_parameter, idmapper_floor),
+	CONF_ITEM_UI32("Uid2grp_Weight", 0, 1000, 10,
+		       mem_governor_parameter, uid2grp_weight),
+	CONF_ITEM_UI64("Uid2grp_Floor", 0, UINT64_MAX, 1024 * 1024,
+		       mem_governor_parameter, uid2grp_floor),
+	CONFIG_EOL
+};
+
+static void *mem_governor_param_init(void *link_mem, void *self_struct)
+{
+	if (self_struct == NULL)
+		return &mem_gov_param;
+	else
+		return NULL;
+}
+
+static int mem_governor_param_commit(void *node, void *link_mem,
+				     void *self_struct,
+				     struct config_error_type *err_type)
+{
+	struct mem_governor_parameter *param = self_struct;
+
+	if (param->low_water_pct > param->high_water_pct) {
+		LogCrit(COMPONENT_CONFIG,
+			"Low_Water_Percent (%" PRIu32
+			") must not exceed High_Water_Percent (%" PRIu32 ")",
+			param->low_water_pct, param->high_water_pct);
+		err_type->validate = true;
+		return 1;
+	}
+	return 0;
+}
+
+struct config_block mem_governor_param_blk = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.mem_governor",
+	.blk_desc.name = "Mem_Governor",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = mem_governor_param_init,
+	.blk_desc.u.blk.params = mem_governor_params,
+	.blk_desc.u.blk.commit = mem_governor_param_commit
+};
+
+/**
+ * @brief Registered consumers, protected by mem_gov_mtx
+ *
+ * Consumers are called without the mutex, from a copy of the list.
+ * mem_gov_busy counts the copies in use, and a consumer is only taken
+ * off the list once there are none.
+ */
+
+static struct glist_head mem_gov_consumers = {
+	.next = &mem_gov_consumers,
+	.prev = &mem_gov_consumers
+};
+
+static pthread_mutex_t mem_gov_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mem_gov_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int mem_gov_busy;
+
+static struct fridgethr *mem_gov_fridge;
+
+/**
+ * @brief Where to find our memory statistics
+ */
+
+static struct {
+	char usage[MAXPATHLEN];		/*< Bytes in use by our cgroup */
+	char limit[MAXPATHLEN];		/*< Its hard limit */
+	char pressure[MAXPATHLEN];	/*< Its PSI memory pressure */
+} mem_gov_files;
+
+/**
+ * @brief Register a cache with the governor
+ *
+ * May be called before the governor is started.
+ *
+ * @param[in,out] consumer The consumer, owned by the caller
+ */
+
+void mem_governor_register(struct mem_gov_consumer *consumer)
+{
+	consumer->budget = MEM_GOV_UNLIMITED;
+	PTHREAD_MUTEX_lock(&mem_gov_mtx);
+	glist_add_tail(&mem_gov_consumers, &consumer->list);
+	PTHREAD_MUTEX_unlock(&mem_gov_mtx);
+	LogDebug(COMPONENT_MEMORY,
+		 "Registered %s, weight %" PRIu32 " floor %" PRIu64,
+		 consumer->name, consumer->weight, consumer->floor);
+}
+
+/**
+ * @brief Remove a cache from the governor
+ *
+ * Waits for a pass that may be calling the consumer to finish, so it
+ * must not be called from the consumer's own callbacks.
+ *
+ * @param[in,out] consumer The consumer
+ */
+
+void mem_governor_unregister(struct mem_gov_consumer *consumer)
+{
+	PTHREAD_MUTEX_lock(&mem_gov_mtx);
+	while (mem_gov_busy != 0)
+		pthread_cond_wait(&mem_gov_cond, &mem_gov_mtx);
+	glist_del(&consumer->list);
+	PTHREAD_MUTEX_unlock(&mem_gov_mtx);
+}
+
+/**
+ * @brief Copy the consumer list, and sample what each holds
+ *
+ * The consumers stay registered until mem_gov_put.
+ *
+ * @param[out] consumers Copy, to give to mem_gov_put
+ * @param[out] caches    Bytes held by all of them
+ *
+ * @return Number of consumers, 0 if none or out of memory.
+ */
+
+static unsigned int mem_gov_get(struct mem_gov_consumer ***consumers,
+				uint64_t *caches)
+{
+	struct glist_head *glist;
+	unsigned int i, n = 0;
+
+	*consumers = NULL;
+	*caches = 0;
+
+	PTHREAD_MUTEX_lock(&mem_gov_mtx);
+	glist_for_each(glist, &mem_gov_consumers)
+		n++;
+	if (n != 0)
+		*consumers = gsh_malloc(n * sizeof(**consumers));
+	if (*consumers == NULL) {
+		PTHREAD_MUTEX_unlock(&mem_gov_mtx);
+		return 0;
+	}
+	i = 0;
+	glist_for_each(glist, &mem_gov_consumers)
+		(*consumers)[i++] =
+		    glist_entry(glist, struct mem_gov_consumer, list);
+	mem_gov_busy++;
+	PTHREAD_MUTEX_unlock(&mem_gov_mtx);
+
+	for (i = 0; i < n; i++) {
+		(*consumers)[i]->held = (*consumers)[i]->usage();
+		*caches += (*consumers)[i]->held;
+	}
+
+	return n;
+}
+
+/**
+ * @brief Done with a copy of the consumer list
+ *
+ * @param[in] consumers Copy from mem_gov_get
+ */
+
+static void mem_gov_put(struct mem_gov_consumer **consumers)
+{
+	if (consumers == NULL)
+		return;
+
+	gsh_free(consumers);
+	PTHREAD_MUTEX_lock(&mem_gov_mtx);
+	if (--mem_gov_busy == 0)
+		pthread_cond_broadcast(&mem_gov_cond);
+	PTHREAD_MUTEX_unlock(&mem_gov_mtx);
+}
+
+/**
+ * @brief Read a single number from a cgroup or proc file
+ *
+ * @param[in]  path  File to read
+ * @param[out] value Value; "max" reads as UINT64_MAX
+ *
+ * @return true if a value was read.
+ */
+
+static bool mem_gov_read_u64(const char *path, uint64_t *value)
+{
+	char buf[64];
+	FILE *fp;
+	bool ok = false;
+
+	if (path[0] == '\0')
+		return false;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return false;
+
+	if (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (strncmp(buf, "max", 3) == 0) {
+			*value = UINT64_MAX;
+			ok = true;
+		} else {
+			ok = sscanf(buf, "%" SCNu64, value) == 1;
+		}
+	}
+	fclose(fp);
+
+	return ok;
+}
+
+/**
+ * @brief Read the "some" avg10 memory pressure
+ *
+ * @return Percentage of time stalled, or -1 if unavailable.
+ */
+
+static double mem_gov_read_psi(void)
+{
+	char buf[256];
+	FILE *fp;
+	double avg10 = -1;
+
+	if (mem_gov_files.pressure[0] == '\0')
+		return -1;
+
+	fp = fopen(mem_gov_files.pressure, "r");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (sscanf(buf, "some avg10=%lf", &avg10) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return avg10;
+}
+
+/**
+ * @brief Our resident set, for when there is no memory cgroup
+ */
+
+static uint64_t mem_gov_rss(void)
+{
+	unsigned long size, resident;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	uint64_t rss = 0;
+
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%lu %lu", &size, &resident) == 2)
+		rss = (uint64_t) resident * sysconf(_SC_PAGESIZE);
+	fclose(fp);
+
+	return rss;
+}
+
+/**
+ * @brief Find the memory cgroup we run in
+ *
+ * Both the unified (v2) and the legacy (v1) hierarchy are handled.
+ * Pressure is only read from our own v2 cgroup, as the system wide PSI
+ * file is raised by every other workload on the host too.  With v1,
+ * or with no cgroup at all, it is used only if System_PSI is set.
+ */
+
+static void mem_gov_find_cgroup(void)
+{
+	char line[MAXPATHLEN];
+	FILE *fp;
+
+	memset(&mem_gov_files, 0, sizeof(mem_gov_files));
+
+	fp = fopen("/proc/self/cgroup", "r");
+
+	while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+		char *controllers, *path;
+
+		line[strcspn(line, "\n")] = '\0';
+		controllers = strchr(line, ':');
+		if (controllers == NULL)
+			continue;
+		*controllers++ = '\0';
+		path = strchr(controllers, ':');
+		if (path == NULL)
+			continue;
+		*path++ = '\0';
+
+		if (strcmp(line, "0") == 0 && controllers[0] == '\0') {
+			char pressure[MAXPATHLEN];
+
+			snprintf(mem_gov_files.usage, MAXPATHLEN,
+				 "/sys/fs/cgroup%s/memory.current", path);
+			snprintf(mem_gov_files.limit, MAXPATHLEN,
+				 "/sys/fs/cgroup%s/memory.max", path);
+			snprintf(pressure, MAXPATHLEN,
+				 "/sys/fs/cgroup%s/memory.pressure", path);
+			if (access(pressure, R_OK) == 0)
+				strcpy(mem_gov_files.pressure, pressure);
+			if (access(mem_gov_files.usage, R_OK) == 0)
+				break;
+		} else if (strstr(controllers, "memory") != NULL) {
+			snprintf(mem_gov_files.usage, MAXPATHLEN,
+				 "/sys/fs/cgroup/memory%s/memory.usage_in_bytes",
+				 path);
+			snprintf(mem_gov_files.limit, MAXPATHLEN,
+				 "/sys/fs/cgroup/memory%s/memory.limit_in_bytes",
+				 path);
+			if (access(mem_gov_files.usage, R_OK) == 0)
+				break;
+		}
+		mem_gov_files.usage[0] = '\0';
+		mem_gov_files.limit[0] = '\0';
+		mem_gov_files.pressure[0] = '\0';
+	}
+	if (fp != NULL)
+		fclose(fp);
+
+	if (mem_gov_files.pressure[0] == '\0' && mem_gov_param.system_psi &&
+	    access("/proc/pressure/memory", R_OK) == 0)
+		strcpy(mem_gov_files.pressure, "/proc/pressure/memory");
+
+	LogInfo(COMPONENT_MEMORY,
+		"Memory usage from %s, limit from %s, pressure from %s",
+		mem_gov_files.usage[0] ? mem_gov_files.usage : "RSS",
+		mem_gov_files.limit[0] ? mem_gov_files.limit : "config",
+		mem_gov_files.pressure[0] ? mem_gov_files.pressure : "nowhere");
+}
+
+/**
+ * @brief Spread a reclaim target across the consumers
+ *
+ * Each consumer is asked for a share proportional to its weight times
+ * what it holds above its floor, and gets a budget of what it holds
+ * less that share.
+ *
+ * @param[in] consumers Consumers, from mem_gov_get
+ * @param[in] n         How many
+ * @param[in] excess    Bytes we would like back
+ *
+ * @return Bytes the consumers reported as freed.
+ */
+
+static uint64_t mem_gov_reclaim(struct mem_gov_consumer **consumers,
+				unsigned int n, uint64_t excess)
+{
+	struct mem_gov_consumer *consumer;
+	double total = 0;
+	uint64_t freed = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		consumer = consumers[i];
+		if (consumer->held > consumer->floor)
+			total += (double)consumer->weight *
+			    (consumer->held - consumer->floor);
+	}
+
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		uint64_t avail, ask;
+
+		consumer = consumers[i];
+		if (consumer->held <= consumer->floor ||
+		    consumer->weight == 0)
+			continue;
+		avail = consumer->held - consumer->floor;
+		ask = (uint64_t) (excess * (consumer->weight * avail / total));
+		if (ask > avail)
+			ask = avail;
+		atomic_store_uint64_t(&consumer->budget, consumer->held - ask);
+		if (ask != 0 && consumer->reclaim != NULL)
+			freed += consumer->reclaim(ask);
+		LogDebug(COMPONENT_MEMORY,
+			 "%s: holds %" PRIu64 ", asked for %" PRIu64
+			 ", budget %" PRIu64,
+			 consumer->name, consumer->held, ask,
+			 consumer->held - ask);
+	}
+
+	return freed;
+}
+
+/**
+ * @brief Let budgets grow back once pressure has gone
+ */
+
+static void mem_gov_relax(struct mem_gov_consumer **consumers,
+			  unsigned int n)
+{
+	struct mem_gov_consumer *consumer;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		uint64_t budget;
+
+		consumer = consumers[i];
+		budget = atomic_fetch_uint64_t(&consumer->budget);
+		if (budget == MEM_GOV_UNLIMITED)
+			continue;
+		budget += budget / 4 + 1024 * 1024;
+		if (budget / 2 > consumer->held)
+			budget = MEM_GOV_UNLIMITED;
+		atomic_store_uint64_t(&consumer->budget, budget);
+	}
+}
+
+/**
+ * @brief One governor pass
+ *
+ * @param[in] ctx Fridge context
+ */
+
+static void mem_gov_run(struct fridgethr_context *ctx)
+{
+	uint64_t usage = 0, limit = 0, excess = 0, caches, freed;
+	struct mem_gov_consumer **consumers;
+	unsigned int n;
+	double psi;
+
+	SetNameFunction("mem_governor");
+
+	if (!mem_gov_read_u64(mem_gov_files.usage, &usage))
+		usage = mem_gov_rss();
+	if (mem_gov_param.memory_limit != 0)
+		limit = mem_gov_param.memory_limit;
+	else if (!mem_gov_read_u64(mem_gov_files.limit, &limit) ||
+		 limit == UINT64_MAX)
+		limit = 0;
+	psi = mem_gov_read_psi();
+
+	n = mem_gov_get(&consumers, &caches);
+
+	if (limit != 0 &&
+	    usage > limit / 100 * mem_gov_param.high_water_pct)
+		excess = usage - limit / 100 * mem_gov_param.low_water_pct;
+
+	if (mem_gov_param.psi_threshold != 0 &&
+	    psi >= mem_gov_param.psi_threshold) {
+		uint64_t step = caches / 100 * mem_gov_param.psi_reclaim_pct;
+
+		if (step > excess)
+			excess = step;
+	}
+
+	if (excess != 0) {
+		freed = mem_gov_reclaim(consumers, n, excess);
+		LogInfo(COMPONENT_MEMORY,
+			"Memory pressure: usage %" PRIu64 " limit %" PRIu64
+			" psi %.2f caches %" PRIu64 ", reclaiming %" PRIu64
+			", freed %" PRIu64,
+			usage, limit, psi, caches, excess, freed);
+	} else if (limit == 0 ||
+		   usage < limit / 100 * mem_gov_param.low_water_pct) {
+		mem_gov_relax(consumers, n);
+	}
+
+	mem_gov_put(consumers);
+
+	LogFullDebug(COMPONENT_MEMORY,
+		     "usage %" PRIu64 " limit %" PRIu64 " psi %.2f caches %"
+		     PRIu64, usage, limit, psi, caches);
+}
+
+/**
+ * @brief Ask the caches for memory back now
+ *
+ * The bytes are spread across the consumers as a governor pass under
+ * pressure would, whether or not the governor runs.
+ *
+ * @param[in] bytes Bytes wanted back
+ *
+ * @return Bytes the consumers reported as freed.
+ */
+
+uint64_t mem_governor_reclaim(uint64_t bytes)
+{
+	struct mem_gov_consumer **consumers;
+	uint64_t caches, freed;
+	unsigned int n;
+
+	n = mem_gov_get(&consumers, &caches);
+	freed = mem_gov_reclaim(consumers, n, bytes);
+	mem_gov_put(consumers);
+
+	return freed;
+}
+
+/**
+ * @brief Start the governor thread
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int mem_governor_init(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (!mem_gov_param.enable) {
+		LogInfo(COMPONENT_MEMORY, "Memory governor disabled");
+		return 0;
+	}
+
+	mem_gov_find_cgroup();
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	frp.thread_delay = mem_gov_param.interval;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&mem_gov_fridge, "mem_gov", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_MEMORY,
+			 "Unable to initialize memory governor fridge, error code %d.",
+			 rc);
+		return rc;
+	}
+
+	rc = fridgethr_submit(mem_gov_fridge, mem_gov_run, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_MEMORY,
+			 "Unable to start memory governor thread, error code %d.",
+			 rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Stop the governor thread
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int mem_governor_shutdown(void)
+{
+	int rc;
+
+	if (mem_gov_fridge == NULL)
+		return 0;
+
+	rc = fridgethr_sync_command(mem_gov_fridge, fridgethr_comm_stop, 120);
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_MEMORY,
+			 "Shutdown timed out, cancelling threads.");
+		fridgethr_cancel(mem_gov_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_MEMORY,
+			 "Failed shutting down memory governor thread: %d",
+			 rc);
+	}
+	return rc;
+}
+
+/** @} */
@@ -102,6 +102,15 @@ static struct config_item core_params[] = {
 		       nfs_core_param, dispatch_max_reqs),
 	CONF_ITEM_UI32("Dispatch_Max_Reqs_Xprt", 1, 2048, 512,
 		       nfs_core_param, dispatch_max_reqs_xprt),
+	CONF_ITEM_UI32("Queue_Deadline_NFSv3", 0, 3600000,
+		       QUEUE_DEADLINE_NFSV3_DEFAULT,
+		       nfs_core_param, queue_deadline.nfsv3_ms),
+	CONF_ITEM_UI32("Queue_Deadline_NFSv40", 0, 3600000,
+		       QUEUE_DEADLINE_NFSV40_DEFAULT,
+		       nfs_core_param, queue_deadline.nfsv40_ms),
+	CONF_ITEM_UI32("Queue_Deadline_UDP", 0, 3600000,
+		       QUEUE_DEADLINE_UDP_DEFAULT,
+		       nfs_core_param, queue_deadline.udp_ms),
 	CONF_ITEM_BOOL("DRC_Disabled", false,
 		       nfs_core_param, drc.disabled),
 	CONF_ITEM_UI32("DRC_TCP_Npart", 1, 20, DRC_TCP_NPART,
@@ -146,6 +155,10 @@ static struct config_item core_params[] = {
 		      nfs_core_param, decoder_fridge_expiration_delay),
 	CONF_ITEM_I64("Decoder_Fridge_Block_Timeout", 0, 7200, 600,
 		      nfs_core_param, decoder_fridge_block_timeout),
+	CONF_ITEM_UI32("Decoder_Threads", 0, 1024, 0,
+		       nfs_core_param, decoder_threads),
+	CONF_ITEM_UI32("Decoder_Budget", 1, 1024, DECODER_BUDGET_DEFAULT,
+		       nfs_core_param, decoder_budget),
 	CONF_ITEM_LIST("NFS_Protocols", CORE_OPTION_ALL_VERS, protocols,
 		       nfs_core_param, core_options),
 	CONF_ITEM_LIST("Protocols", CORE_OPTION_ALL_VERS, protocols,
@@ -237,6 +250,31 @@ static struct config_item version4_params[] = {
 	CONF_ITEM_UI32("Deleg_Recall_Retry_Delay", 0, 10,
 			DELEG_RECALL_RETRY_DELAY_DEFAULT,
 			nfs_version4_parameter, deleg_recall_retry_delay),
+	CONF_ITEM_BOOL("Blocking_Lock_Notify", false,
+		       nfs_version4_parameter, blocking_lock_notify),
+	CONF_ITEM_UI32("Blocking_Lock_Reservation", 0, 10000,
+		       BLOCKING_LOCK_RESERVATION_DEFAULT,
+		       nfs_version4_parameter, blocking_lock_reservation),
+	CONF_ITEM_UI32("Recall_Any_Pinned_Percent", 0, 100,
+		       RECALL_ANY_PINNED_PCT_DEFAULT,
+		       nfs_version4_parameter, recall_any_pinned_pct),
+	CONF_ITEM_UI32("Recall_Any_Clients", 1, 1024,
+		       RECALL_ANY_CLIENTS_DEFAULT,
+		       nfs_version4_parameter, recall_any_clients),
+	CONF_ITEM_UI32("Recall_Any_Keep_Percent", 0, 99,
+		       RECALL_ANY_KEEP_PCT_DEFAULT,
+		       nfs_version4_parameter, recall_any_keep_pct),
+	CONF_ITEM_UI32("Recall_Any_Grace", 1, 3600,
+		       RECALL_ANY_GRACE_DEFAULT,
+		       nfs_version4_parameter, recall_any_grace),
+	CONF_ITEM_BOOL("Courteous_Server", false,
+		       nfs_version4_parameter, courteous_server),
+	CONF_ITEM_UI32("Courtesy_Max_Clients", 0, UINT32_MAX,
+		       COURTESY_MAX_CLIENTS_DEFAULT,
+		       nfs_version4_parameter, courtesy_max_clients),
+	CONF_ITEM_UI32("Courtesy_Max_Time", 0, UINT32_MAX,
+		       COURTESY_MAX_TIME_DEFAULT,
+		       nfs_version4_parameter, courtesy_max_time),
 	CONF_ITEM_BOOL("PNFS_MDS", true,
 		       nfs_version4_parameter, pnfs_mds),
 	CONF_ITEM_BOOL("PNFS_DS", true,
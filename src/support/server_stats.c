@@ -58,6 +58,7 @@
 #include "client_mgr.h"
 #include "export_mgr.h"
 #include "server_stats.h"
+#include "stats_recorder.h"
 #include <abstract_atomic.h>
 #include "nfs_proto_functions.h"
 
@@ -1787,6 +1788,179 @@ void server_dbus_delegations(struct deleg_stats *ds, DBusMessageIter *iter)
 
 #endif				/* USE_DBUS */
 
+/**
+ * @brief Sample a protocol's counters for the statistics recorder
+ *
+ * Every key of the protocol is derived from @a key by putting a
+ * field in its low nibble.
+ */
+
+static void sample_proto_op(stats_sample_cb cb, void *arg, uint32_t key,
+			    struct proto_op *op)
+{
+	cb(key | STATS_OPS, op->total, arg);
+	cb(key | STATS_ERRORS, op->errors, arg);
+	cb(key | STATS_DUPS, op->dups, arg);
+	cb(key | STATS_LATENCY_NS, op->latency.latency, arg);
+	cb(key | STATS_QUEUE_NS, op->queue_latency.latency, arg);
+}
+
+static void sample_xfer(stats_sample_cb cb, void *arg, uint32_t key,
+			struct xfer_op *read, struct xfer_op *write)
+{
+	cb(key | STATS_READ_OPS, read->cmd.total, arg);
+	cb(key | STATS_READ_BYTES, read->transferred, arg);
+	cb(key | STATS_WRITE_OPS, write->cmd.total, arg);
+	cb(key | STATS_WRITE_BYTES, write->transferred, arg);
+}
+
+/**
+ * @brief Sample a gsh_stats, whose protocols may not all be there
+ */
+
+static void sample_gsh_stats(stats_sample_cb cb, void *arg,
+			     uint16_t export_id, struct gsh_stats *st)
+{
+	if (st->nfsv3 != NULL) {
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_NFSV3, 0),
+				&st->nfsv3->cmds);
+		sample_xfer(cb, arg, stats_export_key(export_id,
+						      STATS_NFSV3, 0),
+			    &st->nfsv3->read, &st->nfsv3->write);
+	}
+	if (st->nfsv40 != NULL) {
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_NFSV40, 0),
+				&st->nfsv40->compounds);
+		sample_xfer(cb, arg, stats_export_key(export_id,
+						      STATS_NFSV40, 0),
+			    &st->nfsv40->read, &st->nfsv40->write);
+	}
+	if (st->nfsv41 != NULL) {
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_NFSV41, 0),
+				&st->nfsv41->compounds);
+		sample_xfer(cb, arg, stats_export_key(export_id,
+						      STATS_NFSV41, 0),
+			    &st->nfsv41->read, &st->nfsv41->write);
+	}
+	if (st->nfsv42 != NULL) {
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_NFSV42, 0),
+				&st->nfsv42->compounds);
+		sample_xfer(cb, arg, stats_export_key(export_id,
+						      STATS_NFSV42, 0),
+			    &st->nfsv42->read, &st->nfsv42->write);
+	}
+	if (st->nlm4 != NULL)
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_NLM4, 0),
+				&st->nlm4->ops);
+	if (st->mnt != NULL) {
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_MNTV1, 0),
+				&st->mnt->v1_ops);
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_MNTV3, 0),
+				&st->mnt->v3_ops);
+	}
+	if (st->rquota != NULL)
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_RQUOTA, 0),
+				&st->rquota->ops);
+	if (st->_9p != NULL) {
+		sample_proto_op(cb, arg, stats_export_key(export_id,
+							  STATS_9P, 0),
+				&st->_9p->cmds);
+		sample_xfer(cb, arg, stats_export_key(export_id, STATS_9P, 0),
+			    &st->_9p->read, &st->_9p->write);
+	}
+}
+
+struct sample_state {
+	stats_sample_cb cb;
+	void *arg;
+};
+
+static bool sample_export(struct gsh_export *export, void *state)
+{
+	struct sample_state *ss = state;
+	struct export_stats *export_st =
+	    container_of(export, struct export_stats, export);
+
+	sample_gsh_stats(ss->cb, ss->arg, export->export_id, &export_st->st);
+	return true;
+}
+
+/**
+ * @brief Walk the counters for the statistics recorder
+ *
+ * Passes every counter's running total to @a cb, keyed as in
+ * stats_recorder.h.  Counters are read without locks, as the DBus
+ * reports do.
+ *
+ * @param[in] cb         Called for each counter
+ * @param[in] arg        Passed to @a cb
+ * @param[in] per_export Also walk each export's counters
+ */
+
+void server_stats_sample(stats_sample_cb cb, void *arg, bool per_export)
+{
+	struct sample_state ss = { .cb = cb, .arg = arg };
+	int i;
+
+	sample_proto_op(cb, arg, stats_proto_key(STATS_NFSV3, 0),
+			&global_st.nfsv3.cmds);
+	sample_xfer(cb, arg, stats_proto_key(STATS_NFSV3, 0),
+		    &global_st.nfsv3.read, &global_st.nfsv3.write);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_NFSV40, 0),
+			&global_st.nfsv40.compounds);
+	sample_xfer(cb, arg, stats_proto_key(STATS_NFSV40, 0),
+		    &global_st.nfsv40.read, &global_st.nfsv40.write);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_NFSV41, 0),
+			&global_st.nfsv41.compounds);
+	sample_xfer(cb, arg, stats_proto_key(STATS_NFSV41, 0),
+		    &global_st.nfsv41.read, &global_st.nfsv41.write);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_NFSV42, 0),
+			&global_st.nfsv42.compounds);
+	sample_xfer(cb, arg, stats_proto_key(STATS_NFSV42, 0),
+		    &global_st.nfsv42.read, &global_st.nfsv42.write);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_NLM4, 0),
+			&global_st.nlm4.ops);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_MNTV1, 0),
+			&global_st.mnt.v1_ops);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_MNTV3, 0),
+			&global_st.mnt.v3_ops);
+	sample_proto_op(cb, arg, stats_proto_key(STATS_RQUOTA, 0),
+			&global_st.rquota.ops);
+
+	for (i = 0; i < NFS_V3_NB_COMMAND; i++)
+		cb(stats_key(STATS_KEY_NFSV3_OP, i), global_st.v3.op[i], arg);
+	for (i = 0; i < NFS4_OP_LAST_ONE; i++)
+		cb(stats_key(STATS_KEY_NFSV4_OP, i), global_st.v4.op[i], arg);
+	for (i = 0; i < NLM_V4_NB_OPERATION; i++)
+		cb(stats_key(STATS_KEY_NLM_OP, i), global_st.lm.op[i], arg);
+	for (i = 0; i < MNT_V3_NB_COMMAND; i++)
+		cb(stats_key(STATS_KEY_MNT_OP, i), global_st.mn.op[i], arg);
+	for (i = 0; i < RQUOTA_NB_COMMAND; i++)
+		cb(stats_key(STATS_KEY_RQUOTA_OP, i), global_st.qt.op[i], arg);
+
+	cb(stats_key(STATS_KEY_CACHE, STATS_CACHE_REQ), cache_st.inode_req,
+	   arg);
+	cb(stats_key(STATS_KEY_CACHE, STATS_CACHE_HIT), cache_st.inode_hit,
+	   arg);
+	cb(stats_key(STATS_KEY_CACHE, STATS_CACHE_MISS), cache_st.inode_miss,
+	   arg);
+	cb(stats_key(STATS_KEY_CACHE, STATS_CACHE_CONFLICT),
+	   cache_st.inode_conf, arg);
+	cb(stats_key(STATS_KEY_CACHE, STATS_CACHE_ADDED), cache_st.inode_added,
+	   arg);
+
+	if (per_export)
+		foreach_gsh_export(sample_export, &ss);
+}
+
 /**
  * @brief Free statistics storage
  *
@@ -0,0 +1,497 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup stats_recorder
+ * @{
+ */
+
+/**
+ * @file stats_recorder.c
+ * @brief Sample server statistics into a ring file
+ *
+ * One looper thread walks the counters each interval, keeps their
+ * totals in an open addressed table to take differences against, and
+ * writes one record with what changed.  Requests are not touched.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/param.h>
+#include "log.h"
+#include "common_utils.h"
+#include "abstract_atomic.h"
+#include "fridgethr.h"
+#include "nfs_core.h"
+#include "nfs_req_queue.h"
+#include "cache_inode_lru.h"
+#include "stats_recorder.h"
+
+/**
+ * @brief Recorder parameters
+ */
+
+struct stats_recorder_parameter stats_recorder_param;
+
+static struct config_item stats_recorder_params[] = {
+	CONF_ITEM_BOOL("Enable", false,
+		       stats_recorder_parameter, enable),
+	CONF_ITEM_PATH("Path", 1, MAXPATHLEN, "/var/log/ganesha.stats",
+		       stats_recorder_parameter, path),
+	CONF_ITEM_UI32("Interval", 1, 3600, 10,
+		       stats_recorder_parameter, interval),
+	CONF_ITEM_UI64("Max_Size", 64 * 1024, UINT64_MAX, 16 * 1024 * 1024,
+		       stats_recorder_parameter, max_size),
+	CONF_ITEM_BOOL("Per_Export", true,
+		       stats_recorder_parameter, per_export),
+	CONFIG_EOL
+};
+
+static void *stats_recorder_param_init(void *link_mem, void *self_struct)
+{
+	if (self_struct == NULL)
+		return &stats_recorder_param;
+	else
+		return NULL;
+}
+
+struct config_block stats_recorder_param_blk = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.stats_recorder",
+	.blk_desc.name = "Stats_Recorder",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = stats_recorder_param_init,
+	.blk_desc.u.blk.params = stats_recorder_params,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
+static struct fridgethr *recorder_fridge;
+
+/**
+ * @brief Last total of a counter
+ */
+
+struct recorder_total {
+	uint32_t key;		/*< 0 if the slot is free */
+	uint64_t value;
+};
+
+/**
+ * @brief Recorder state, only touched by the recorder thread once
+ *        started
+ */
+
+static struct {
+	int fd;
+	uint64_t ring_size;
+	uint64_t pos;		/*< Where the next record goes */
+	uint64_t seq;
+	struct timespec last;	/*< When the previous sample was taken */
+	struct recorder_total *totals;
+	uint32_t totals_size;	/*< A power of two */
+	uint32_t totals_used;
+	struct stats_pair *pairs;	/*< This sample's changes */
+	uint32_t nkeys;
+	uint32_t max_keys;
+	uint8_t *buf;
+	size_t buf_size;
+	bool failed;		/*< Out of memory this sample */
+} rec = {
+	.fd = -1,
+};
+
+static struct recorder_total *recorder_total(uint32_t key)
+{
+	uint32_t i = (key * 2654435761U) & (rec.totals_size - 1);
+
+	while (rec.totals[i].key != 0 && rec.totals[i].key != key)
+		i = (i + 1) & (rec.totals_size - 1);
+	return &rec.totals[i];
+}
+
+static bool recorder_totals_grow(void)
+{
+	struct recorder_total *old = rec.totals, *slot;
+	uint32_t old_size = rec.totals_size, i;
+
+	rec.totals_size = old_size ? old_size * 2 : 1024;
+	rec.totals = gsh_calloc(rec.totals_size, sizeof(*rec.totals));
+	if (rec.totals == NULL) {
+		rec.totals = old;
+		rec.totals_size = old_size;
+		return false;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].key == 0)
+			continue;
+		slot = recorder_total(old[i].key);
+		*slot = old[i];
+	}
+	gsh_free(old);
+	return true;
+}
+
+static void recorder_add(uint32_t key, uint64_t value)
+{
+	if (value == 0)
+		return;
+
+	if (rec.nkeys == rec.max_keys) {
+		uint32_t max = rec.max_keys ? rec.max_keys * 2 : 1024;
+		struct stats_pair *pairs =
+		    gsh_realloc(rec.pairs, max * sizeof(*pairs));
+
+		if (pairs == NULL) {
+			rec.failed = true;
+			return;
+		}
+		rec.pairs = pairs;
+		rec.max_keys = max;
+	}
+	rec.pairs[rec.nkeys].key = key;
+	rec.pairs[rec.nkeys].value = value;
+	rec.nkeys++;
+}
+
+/**
+ * @brief Take a counter's increase since the last sample
+ */
+
+static void recorder_counter(uint32_t key, uint64_t value, void *arg)
+{
+	struct recorder_total *total;
+	uint64_t delta;
+
+	if (rec.totals_used >= rec.totals_size / 2 &&
+	    !recorder_totals_grow()) {
+		rec.failed = true;
+		return;
+	}
+
+	total = recorder_total(key);
+	if (total->key == 0) {
+		total->key = key;
+		total->value = 0;
+		rec.totals_used++;
+	}
+	/* An export that was removed and added back starts over */
+	delta = value >= total->value ? value - total->value : value;
+	total->value = value;
+
+	if (arg != NULL)
+		recorder_add(key, delta);
+}
+
+/**
+ * @brief Collect a sample
+ *
+ * @param[in] record false to only take the totals
+ */
+
+static void recorder_collect(bool record)
+{
+	struct req_q_pair *qpair;
+	int ix;
+
+	rec.nkeys = 0;
+	rec.failed = false;
+
+	server_stats_sample(recorder_counter, record ? &rec : NULL,
+			    stats_recorder_param.per_export);
+
+	for (ix = 0; ix < N_REQ_QUEUES; ix++) {
+		qpair = &nfs_req_st.reqs.nfs_request_q.qset[ix];
+		recorder_add(stats_key(STATS_KEY_GAUGE, STATS_GAUGE_QUEUE + ix),
+			     atomic_fetch_uint32_t(&qpair->producer.size) +
+			     atomic_fetch_uint32_t(&qpair->consumer.size));
+	}
+	recorder_add(stats_key(STATS_KEY_GAUGE, STATS_GAUGE_STALLED),
+		     nfs_req_st.stallq.stalled);
+	recorder_add(stats_key(STATS_KEY_GAUGE, STATS_GAUGE_ENTRIES),
+		     lru_state.entries_used);
+	recorder_add(stats_key(STATS_KEY_GAUGE, STATS_GAUGE_OPEN_FDS),
+		     atomic_fetch_size_t(&open_fd_count));
+
+	/* Export keys come in export list order */
+	qsort(rec.pairs, rec.nkeys, sizeof(*rec.pairs), stats_pair_cmp);
+}
+
+/**
+ * @brief Write a sample
+ */
+
+static void recorder_write(uint64_t interval_ns)
+{
+	struct stats_recorder_record hdr;
+	struct timespec wall;
+	size_t need = stats_record_max(rec.nkeys);
+	uint32_t len;
+
+	if (need > rec.buf_size) {
+		uint8_t *buf = gsh_realloc(rec.buf, need);
+
+		if (buf == NULL)
+			return;
+		rec.buf = buf;
+		rec.buf_size = need;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &wall);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.seq = rec.seq;
+	hdr.time_ns = wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+	hdr.interval_ms = interval_ns / 1000000;
+	hdr.nkeys = rec.nkeys;
+	hdr.boot = ServerBootTime.tv_sec;
+	len = stats_record_encode(rec.buf, &hdr, rec.pairs);
+
+	if (len > rec.ring_size) {
+		LogCrit(COMPONENT_MAIN,
+			"Statistics sample of %" PRIu32
+			" bytes does not fit the recorder's Max_Size", len);
+		return;
+	}
+	if (rec.pos + len > rec.ring_size)
+		rec.pos = 0;
+
+	if (pwrite(rec.fd, rec.buf, len, STATS_RECORDER_HEADER_SIZE + rec.pos)
+	    != len) {
+		LogMajor(COMPONENT_MAIN, "Could not write statistics to %s: %s",
+			 stats_recorder_param.path, strerror(errno));
+		return;
+	}
+	rec.pos += len;
+	rec.seq++;
+}
+
+/**
+ * @brief One sample
+ *
+ * @param[in] ctx Fridge context
+ */
+
+static void stats_recorder_run(struct fridgethr_context *ctx)
+{
+	struct timespec ts;
+	uint64_t interval_ns;
+
+	now(&ts);
+	interval_ns = timespec_diff(&rec.last, &ts);
+	rec.last = ts;
+
+	recorder_collect(true);
+	if (rec.failed) {
+		LogMajor(COMPONENT_MAIN,
+			 "Out of memory taking statistics sample");
+		return;
+	}
+	recorder_write(interval_ns);
+}
+
+/**
+ * @brief Open the ring, carrying on after the samples it has
+ *
+ * @return 0 or an errno.
+ */
+
+static int recorder_open(void)
+{
+	struct stats_recorder_header hdr;
+	struct stats_recorder_record last;
+	struct stats_record_ref *refs;
+	uint8_t *ring;
+	size_t count = 0;
+	uint64_t checksum;
+	int rc;
+
+	rec.ring_size = stats_recorder_param.max_size -
+	    STATS_RECORDER_HEADER_SIZE;
+	rec.fd = open(stats_recorder_param.path, O_RDWR | O_CREAT | O_CLOEXEC,
+		      0644);
+	if (rec.fd < 0)
+		return errno;
+
+	if (pread(rec.fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+	    memcmp(hdr.magic, STATS_RECORDER_MAGIC,
+		   STATS_RECORDER_MAGIC_LEN) == 0 &&
+	    hdr.ring_size == rec.ring_size) {
+		checksum = hdr.checksum;
+		hdr.checksum = 0;
+		if (stats_recorder_sum(STATS_RECORDER_SUM_INIT, &hdr,
+				       sizeof(hdr)) != checksum)
+			goto fresh;
+
+		ring = gsh_malloc(rec.ring_size);
+		if (ring == NULL) {
+			close(rec.fd);
+			rec.fd = -1;
+			return ENOMEM;
+		}
+		/* A short file reads as zeros past its end */
+		memset(ring, 0, rec.ring_size);
+		if (pread(rec.fd, ring, rec.ring_size,
+			  STATS_RECORDER_HEADER_SIZE) < 0) {
+			rc = errno;
+			gsh_free(ring);
+			close(rec.fd);
+			rec.fd = -1;
+			return rc;
+		}
+		refs = stats_ring_scan(ring, rec.ring_size, &count);
+		if (count != 0) {
+			memcpy(&last, ring + refs[count - 1].off,
+			       sizeof(last));
+			rec.seq = last.seq + 1;
+			rec.pos = refs[count - 1].off + last.length;
+		}
+		gsh_free(refs);
+		gsh_free(ring);
+
+		LogEvent(COMPONENT_INIT,
+			 "Recording statistics to %s after %zu earlier samples",
+			 stats_recorder_param.path, count);
+		return 0;
+	}
+
+ fresh:
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, STATS_RECORDER_MAGIC, STATS_RECORDER_MAGIC_LEN);
+	hdr.ring_size = rec.ring_size;
+	hdr.checksum = stats_recorder_sum(STATS_RECORDER_SUM_INIT, &hdr,
+					  sizeof(hdr));
+	if (ftruncate(rec.fd, 0) != 0 ||
+	    pwrite(rec.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    ftruncate(rec.fd, STATS_RECORDER_HEADER_SIZE + rec.ring_size)
+	    != 0) {
+		rc = errno;
+		close(rec.fd);
+		rec.fd = -1;
+		return rc;
+	}
+
+	LogEvent(COMPONENT_INIT, "Recording statistics to new file %s",
+		 stats_recorder_param.path);
+	return 0;
+}
+
+/**
+ * @brief Start the recorder thread
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int stats_recorder_init(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (!stats_recorder_param.enable)
+		return 0;
+
+	if (stats_recorder_param.max_size <= STATS_RECORDER_HEADER_SIZE) {
+		LogCrit(COMPONENT_INIT, "Stats_Recorder Max_Size is too small");
+		return EINVAL;
+	}
+
+	rc = recorder_open();
+	if (rc != 0) {
+		LogCrit(COMPONENT_INIT, "Could not open statistics file %s: %s",
+			stats_recorder_param.path, strerror(rc));
+		return rc;
+	}
+
+	/* Start the totals where they are */
+	now(&rec.last);
+	recorder_collect(false);
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	frp.thread_delay = stats_recorder_param.interval;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&recorder_fridge, "stats_rec", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_INIT,
+			 "Unable to initialize statistics recorder fridge, error code %d.",
+			 rc);
+		return rc;
+	}
+
+	rc = fridgethr_submit(recorder_fridge, stats_recorder_run, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_INIT,
+			 "Unable to start statistics recorder thread, error code %d.",
+			 rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Stop the recorder thread and close the file
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int stats_recorder_shutdown(void)
+{
+	int rc = 0;
+
+	if (recorder_fridge != NULL) {
+		rc = fridgethr_sync_command(recorder_fridge,
+					    fridgethr_comm_stop, 120);
+		if (rc == ETIMEDOUT) {
+			LogMajor(COMPONENT_THREAD,
+				 "Shutdown timed out, cancelling threads.");
+			fridgethr_cancel(recorder_fridge);
+		} else if (rc != 0) {
+			LogMajor(COMPONENT_THREAD,
+				 "Failed shutting down statistics recorder thread: %d",
+				 rc);
+		} else {
+			fridgethr_destroy(recorder_fridge);
+			recorder_fridge = NULL;
+		}
+	}
+
+	if (rec.fd >= 0)
+		close(rec.fd);
+	gsh_free(rec.totals);
+	gsh_free(rec.pairs);
+	gsh_free(rec.buf);
+
+	/* So the recorder can be started again */
+	memset(&rec, 0, sizeof(rec));
+	rec.fd = -1;
+
+	return rc;
+}
+
+/** @} */
@@ -44,6 +44,7 @@
 #include "avltree.h"
 #include "uid2grp.h"
 #include "abstract_atomic.h"
+#include "mem_governor.h"
 
 /**
  * @brief User entry in the IDMapper cache
@@ -174,6 +175,79 @@ static int uid_comparator(const struct avltree_node *node1,
 		return 0;
 }
 
+/**
+ * @brief Bytes held by the cache, for the memory governor
+ */
+
+static uint64_t uid2grp_cache_bytes;
+
+/* The group data is shared with callers that hold a reference, so
+ * this is what dropping an entry would eventually release.
+ */
+#define INFO_BYTES(i) (sizeof(struct cache_info) + sizeof(struct group_data) \
+		       + (i)->uname.len + (i)->gdata->nbgroups * sizeof(gid_t))
+
+static uint64_t uid2grp_mem_usage(void)
+{
+	return atomic_fetch_uint64_t(&uid2grp_cache_bytes);
+}
+
+/**
+ * @brief Where the last reclaim stopped, in tree order
+ *
+ * Entries carry no recency information, so successive reclaims go
+ * round the cache rather than always dropping the same users.
+ */
+
+static uint32_t uid2grp_reclaim_pos;
+
+/**
+ * @brief Give memory back to the governor
+ *
+ * Users are dropped until about @a bytes have been released.  Their
+ * groups are fetched again on demand.
+ */
+
+static uint64_t uid2grp_mem_reclaim(uint64_t bytes)
+{
+	struct avltree_node *node;
+	struct cache_info *info;
+	uint64_t freed = 0;
+	uint32_t pos;
+
+	PTHREAD_RWLOCK_wrlock(&uid2grp_user_lock);
+
+	node = avltree_first(&uname_tree);
+	for (pos = 0; node != NULL && pos < uid2grp_reclaim_pos; pos++)
+		node = avltree_next(node);
+
+	while (freed < bytes) {
+		if (node == NULL) {
+			pos = 0;
+			node = avltree_first(&uname_tree);
+			if (node == NULL)
+				break;
+		}
+		info = avltree_container_of(node, struct cache_info,
+					    uname_node);
+		node = avltree_next(node);
+		freed += INFO_BYTES(info);
+		uid2grp_remove_user(info);
+	}
+	uid2grp_reclaim_pos = pos;
+
+	PTHREAD_RWLOCK_unlock(&uid2grp_user_lock);
+
+	return freed;
+}
+
+static struct mem_gov_consumer uid2grp_mem_consumer = {
+	.name = "uid2grp",
+	.usage = uid2grp_mem_usage,
+	.reclaim = uid2grp_mem_reclaim,
+	.budget = MEM_GOV_UNLIMITED
+};
+
 /**
  * @brief Initialize the IDMapper cache
  */
@@ -184,6 +258,10 @@ void uid2grp_cache_init(void)
 	avltree_init(&uid_tree, uid_comparator, 0);
 	memset(uid_grplist_cache, 0,
 	       id_cache_size * sizeof(struct avltree_node *));
+
+	uid2grp_mem_consumer.weight = mem_gov_param.uid2grp_weight;
+	uid2grp_mem_consumer.floor = mem_gov_param.uid2grp_floor;
+	mem_governor_register(&uid2grp_mem_consumer);
 }
 
 /* Remove given user/cache_info from the AVL trees
@@ -195,6 +273,7 @@ static void uid2grp_remove_user(struct cache_info *info)
 	uid_grplist_cache[info->uid % id_cache_size] = NULL;
 	avltree_remove(&info->uid_node, &uid_tree);
 	avltree_remove(&info->uname_node, &uname_tree);
+	atomic_sub_uint64_t(&uid2grp_cache_bytes, INFO_BYTES(info));
 	/* We decrement hold on group data when it is
 	 * removed from cache trees.
 	 */
@@ -235,6 +314,7 @@ bool uid2grp_add_user(struct group_data *gdata)
 	 * AVL trees.
 	 */
 	uid2grp_hold_group_data(gdata);
+	atomic_add_uint64_t(&uid2grp_cache_bytes, INFO_BYTES(info));
 
 	/* We may have lost the race to insert. We remove existing
 	 * entry and insert this new entry if so!
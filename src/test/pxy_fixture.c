@@ -0,0 +1,152 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file pxy_fixture.c
+ * @brief An FSAL_PROXY export of a backend's directory, for tests
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "fsal.h"
+#include "nfs_core.h"
+#include "FSAL/fsal_commonlib.h"
+#include "pxy_fixture.h"
+
+/**
+ * @brief Export a backend's directory through FSAL_PROXY
+ *
+ * The PROXY module connects to the backend, and sets its client id,
+ * as its configuration is loaded; its threads stay up until exit.
+ *
+ * @param[out] fx            Fixture
+ * @param[in]  server        Address of the backend
+ * @param[in]  path          Directory on the backend, from its root
+ * @param[in]  remote_params More of the Remote_Server {} block, or NULL
+ * @param[in]  up_ops        Upcalls the export makes
+ *
+ * @return 0, or an errno.
+ */
+
+int pxy_fixture_init(struct pxy_fixture *fx, const char *server,
+		     const char *path, const char *remote_params,
+		     const struct fsal_up_vector *up_ops)
+{
+	char conf[] = "/tmp/pxy_fixture.XXXXXX";
+	struct config_error_type err_type;
+	struct config_node_list *node = NULL;
+	fsal_status_t status;
+	FILE *f;
+	int fd;
+
+	memset(fx, 0, sizeof(*fx));
+	fx->export = &fx->export_st.export;
+
+	fd = mkstemp(conf);
+	if (fd < 0)
+		return errno;
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlink(conf);
+		return EIO;
+	}
+	fprintf(f, "PROXY {\nRemote_Server {\nSrv_Addr = %s;\n%s\n}\n}\n"
+		"FSAL {\nName = PROXY;\n}\n", server,
+		remote_params != NULL ? remote_params : "");
+	fclose(f);
+
+	(void) init_error_type(&err_type);
+	fx->config = config_ParseFile(conf, &err_type);
+	unlink(conf);
+	if (fx->config == NULL || !config_error_is_harmless(&err_type))
+		return EINVAL;
+
+	fx->fsal = lookup_fsal("PROXY");
+	if (fx->fsal == NULL)
+		return ENOENT;
+
+	status = fx->fsal->m_ops.init_config(fx->fsal, fx->config, &err_type);
+	if (FSAL_IS_ERROR(status))
+		return status.minor != 0 ? status.minor : EINVAL;
+
+	if (find_config_nodes(fx->config, "FSAL", &node, &err_type) != 0)
+		return EINVAL;
+
+	fx->export->fullpath = (char *)path;
+	fx->export->pseudopath = (char *)path;
+	fx->export->export_id = 1;
+	PTHREAD_RWLOCK_init(&fx->export->lock, NULL);
+	glist_init(&fx->export->entry_list);
+	glist_init(&fx->export->exp_state_list);
+	glist_init(&fx->export->exp_lock_list);
+	glist_init(&fx->export->exp_nlm_share_list);
+	glist_init(&fx->export->exp_root_list);
+	init_root_op_context(&fx->root_op_context, fx->export, NULL,
+			     NFS_V4, 1, NFS_REQUEST);
+
+	status = fx->fsal->m_ops.create_export(fx->fsal, node->tree_node,
+					       &err_type, up_ops);
+	gsh_free(node);
+	if (FSAL_IS_ERROR(status))
+		return status.minor != 0 ? status.minor : EINVAL;
+
+	fx->exp = op_ctx->fsal_export;
+	fx->export->fsal_export = fx->exp;
+
+	status = fx->exp->exp_ops.lookup_path(fx->exp, path, &fx->root);
+	if (FSAL_IS_ERROR(status))
+		return status.minor != 0 ? status.minor : EINVAL;
+
+	return 0;
+}
+
+/**
+ * @brief Look a name up in the exported directory
+ */
+
+fsal_status_t pxy_fixture_lookup(struct pxy_fixture *fx, const char *name,
+				 struct fsal_obj_handle **obj)
+{
+	return fx->root->obj_ops.lookup(fx->root, name, obj);
+}
+
+/**
+ * @brief Take the export down
+ */
+
+void pxy_fixture_fini(struct pxy_fixture *fx)
+{
+	if (fx->root != NULL)
+		fx->root->obj_ops.release(fx->root);
+	if (fx->exp != NULL)
+		fx->exp->exp_ops.release(fx->exp);
+	if (fx->fsal != NULL)
+		fsal_put(fx->fsal);
+	if (fx->config != NULL)
+		config_Free(fx->config);
+	op_ctx = NULL;
+}
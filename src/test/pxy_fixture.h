@@ -0,0 +1,64 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file pxy_fixture.h
+ * @brief An FSAL_PROXY export of a backend's directory, for tests
+ *
+ * The tests using this are built with FSAL_PROXY itself, which then
+ * registers at startup as a static FSAL would.  pxy_fixture_init gives
+ * it its global configuration, pointing it at a running NFSv4 server,
+ * creates an export and looks up the directory on the server, under a
+ * root op context that stays current until pxy_fixture_fini.  op_ctx
+ * is per thread, so other threads calling the FSAL need one of their
+ * own.
+ *
+ * The backend may be any NFSv4.0 server; another ganesha exporting a
+ * local directory through FSAL_VFS does.
+ */
+
+#ifndef PXY_FIXTURE_H
+#define PXY_FIXTURE_H
+
+#include "fsal.h"
+#include "fsal_up.h"
+#include "export_mgr.h"
+#include "server_stats_private.h"
+
+struct pxy_fixture {
+	struct export_stats export_st;	/*< As alloc_export makes it */
+	struct gsh_export *export;
+	struct root_op_context root_op_context;
+	config_file_t config;
+	struct fsal_module *fsal;
+	struct fsal_export *exp;
+	struct fsal_obj_handle *root;
+};
+
+int pxy_fixture_init(struct pxy_fixture *fx, const char *server,
+		     const char *path, const char *remote_params,
+		     const struct fsal_up_vector *up_ops);
+void pxy_fixture_fini(struct pxy_fixture *fx);
+
+fsal_status_t pxy_fixture_lookup(struct pxy_fixture *fx, const char *name,
+				 struct fsal_obj_handle **obj);
+
+#endif				/* PXY_FIXTURE_H */
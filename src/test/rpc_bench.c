@@ -0,0 +1,323 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file rpc_bench.c
+ * @brief Helpers for the benchmarks driving a running server
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "rpc_bench.h"
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Sum the context switches of the server's threads
+ */
+
+static void server_switches(pid_t server, struct server_usage *u)
+{
+	char path[300];
+	char line[1024];
+	struct dirent *de;
+	DIR *dir;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", (int)server);
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/status",
+			 (int)server, de->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strncmp(line, "voluntary_ctxt_switches:", 24) == 0)
+				u->voluntary += atoll(line + 24);
+			else if (strncmp(line, "nonvoluntary_ctxt_switches:",
+					 27) == 0)
+				u->involuntary += atoll(line + 27);
+		}
+		fclose(f);
+	}
+	closedir(dir);
+}
+
+/**
+ * @brief Read the server's usage from /proc
+ *
+ * @param[in]  server   The server's pid
+ * @param[out] u        Usage
+ * @param[in]  switches Whether to walk the threads for their context
+ *                      switches, too slow to do while sampling
+ */
+
+void server_usage(pid_t server, struct server_usage *u, bool switches)
+{
+	char path[64];
+	char line[1024];
+	FILE *f;
+
+	memset(u, 0, sizeof(*u));
+	u->threads = -1;
+	u->rss_kb = -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)server);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "Threads:", 8) == 0)
+			u->threads = atol(line + 8);
+		else if (strncmp(line, "VmRSS:", 6) == 0)
+			u->rss_kb = atol(line + 6);
+	}
+	fclose(f);
+
+	/* The process totals include threads that have exited */
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)server);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	if (fgets(line, sizeof(line), f) != NULL) {
+		char *p = strrchr(line, ')');
+		unsigned long long minflt, utime, stime;
+
+		/* minflt is the 8th field after comm, utime and stime the
+		 * 12th and 13th
+		 */
+		if (p != NULL &&
+		    sscanf(p + 2,
+			   "%*c %*d %*d %*d %*d %*d %*u %llu %*u %*u %*u %llu %llu",
+			   &minflt, &utime, &stime) == 3) {
+			u->minflt = minflt;
+			u->ticks = utime + stime;
+		}
+	}
+	fclose(f);
+
+	if (switches)
+		server_switches(server, u);
+}
+
+int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Connect to the server at 127.0.0.1
+ *
+ * @return The socket, or -1.
+ */
+
+int connect_one(int port)
+{
+	struct sockaddr_in sin;
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0) {
+		close(fd);
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return fd;
+}
+
+void put_u32(struct xdr *x, uint32_t v)
+{
+	uint32_t n = htonl(v);
+
+	memcpy(x->p, &n, 4);
+	x->p += 4;
+}
+
+void put_u64(struct xdr *x, uint64_t v)
+{
+	put_u32(x, v >> 32);
+	put_u32(x, v);
+}
+
+void put_fixed(struct xdr *x, const void *data, uint32_t len)
+{
+	memcpy(x->p, data, len);
+	x->p += len;
+}
+
+void put_opaque(struct xdr *x, const void *data, uint32_t len)
+{
+	put_u32(x, len);
+	memcpy(x->p, data, len);
+	memset(x->p + len, 0, (4 - (len & 3)) & 3);
+	x->p += (len + 3) & ~3;
+}
+
+bool get_u32(struct xdr *x, uint32_t *v)
+{
+	uint32_t n;
+
+	if (x->end - x->p < 4)
+		return false;
+	memcpy(&n, x->p, 4);
+	x->p += 4;
+	*v = ntohl(n);
+	return true;
+}
+
+bool get_u64(struct xdr *x, uint64_t *v)
+{
+	uint32_t hi, lo;
+
+	if (!get_u32(x, &hi) || !get_u32(x, &lo))
+		return false;
+	*v = ((uint64_t) hi << 32) | lo;
+	return true;
+}
+
+bool skip(struct xdr *x, uint32_t len)
+{
+	len = (len + 3) & ~3;
+	if (x->end - x->p < len)
+		return false;
+	x->p += len;
+	return true;
+}
+
+bool skip_opaque(struct xdr *x, uint32_t *len)
+{
+	return get_u32(x, len) && skip(x, *len);
+}
+
+bool get_opaque(struct xdr *x, void *buf, uint32_t max, uint32_t *len)
+{
+	if (!get_u32(x, len) || *len > max || x->end - x->p < *len)
+		return false;
+	memcpy(buf, x->p, *len);
+	return skip(x, *len);
+}
+
+/**
+ * @brief Start a call with an AUTH_SYS root credential
+ *
+ * Leaves room for the record mark, filled in by rpc_call.
+ */
+
+void rpc_header(struct xdr *x, uint32_t xid, uint32_t prog, uint32_t vers,
+		uint32_t proc)
+{
+	x->p += 4;		/* record mark */
+	put_u32(x, xid);
+	put_u32(x, 0);		/* CALL */
+	put_u32(x, 2);		/* RPC version */
+	put_u32(x, prog);
+	put_u32(x, vers);
+	put_u32(x, proc);
+	put_u32(x, 1);		/* AUTH_SYS */
+	put_u32(x, 20);
+	put_u32(x, 0);		/* stamp */
+	put_u32(x, 0);		/* machine name */
+	put_u32(x, 0);		/* uid */
+	put_u32(x, 0);		/* gid */
+	put_u32(x, 0);		/* gids */
+	put_u32(x, 0);		/* AUTH_NONE verf */
+	put_u32(x, 0);
+}
+
+/**
+ * @brief Send a call built in buf and read its reply into buf
+ *
+ * @return false on a transport or RPC error, otherwise x is set up to
+ *         decode the procedure's result.
+ */
+
+bool rpc_call(int fd, unsigned char *buf, size_t buflen, struct xdr *x)
+{
+	uint32_t len = x->p - buf - 4;
+	uint32_t mark = htonl(0x80000000 | len);
+	uint32_t total = 0, v;
+	bool last = false;
+
+	memcpy(buf, &mark, 4);
+	if (write(fd, buf, len + 4) != len + 4)
+		return false;
+
+	while (!last) {
+		if (read_full(fd, &mark, 4) != 0)
+			return false;
+		mark = ntohl(mark);
+		last = (mark & 0x80000000) != 0;
+		len = mark & 0x7fffffff;
+		if (total + len > buflen)
+			return false;
+		if (read_full(fd, buf + total, len) != 0)
+			return false;
+		total += len;
+	}
+
+	x->p = buf;
+	x->end = buf + total;
+
+	/* xid, REPLY, MSG_ACCEPTED, verifier, SUCCESS */
+	return get_u32(x, &v) && get_u32(x, &v) && v == 1 &&
+	    get_u32(x, &v) && v == 0 && get_u32(x, &v) &&
+	    get_u32(x, &v) && skip(x, v) && get_u32(x, &v) && v == 0;
+}
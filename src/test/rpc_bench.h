@@ -0,0 +1,79 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file rpc_bench.h
+ * @brief Helpers for the benchmarks driving a running server
+ *
+ * The benchmarks are standalone programs talking ONC RPC over TCP to
+ * a ganesha at 127.0.0.1 and watching it through /proc.  Calls are
+ * encoded by hand into a buffer with the put_ functions, after
+ * rpc_header, and sent with rpc_call, which leaves the buffer set up
+ * for the get_ functions to decode the procedure's result.
+ */
+
+#ifndef RPC_BENCH_H
+#define RPC_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct xdr {
+	unsigned char *p;
+	unsigned char *end;
+};
+
+/**
+ * @brief What /proc says of the server
+ */
+
+struct server_usage {
+	long threads;		/*< Threads, -1 if unknown */
+	long rss_kb;		/*< VmRSS, -1 if unknown */
+	uint64_t minflt;	/*< Minor faults */
+	uint64_t ticks;		/*< User and system CPU, in clock ticks */
+	uint64_t voluntary;	/*< Context switches of the live threads */
+	uint64_t involuntary;
+};
+
+uint64_t now_ns(void);
+void server_usage(pid_t server, struct server_usage *u, bool switches);
+
+int read_full(int fd, void *buf, size_t len);
+int connect_one(int port);
+
+void put_u32(struct xdr *x, uint32_t v);
+void put_u64(struct xdr *x, uint64_t v);
+void put_fixed(struct xdr *x, const void *data, uint32_t len);
+void put_opaque(struct xdr *x, const void *data, uint32_t len);
+bool get_u32(struct xdr *x, uint32_t *v);
+bool get_u64(struct xdr *x, uint64_t *v);
+bool skip(struct xdr *x, uint32_t len);
+bool skip_opaque(struct xdr *x, uint32_t *len);
+bool get_opaque(struct xdr *x, void *buf, uint32_t max, uint32_t *len);
+
+void rpc_header(struct xdr *x, uint32_t xid, uint32_t prog, uint32_t vers,
+		uint32_t proc);
+bool rpc_call(int fd, unsigned char *buf, size_t buflen, struct xdr *x);
+
+#endif				/* RPC_BENCH_H */
@@ -0,0 +1,399 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file sal_fixture.c
+ * @brief NFSv4 client records and sessions, for tests
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "nfs_core.h"
+#include "client_mgr.h"
+#include "export_mgr.h"
+#include "cache_inode.h"
+#include "../MainNFSD/nfs_init.h"
+#include "sal_fixture.h"
+
+/**
+ * @brief Load the parameters and build the SAL tables
+ *
+ * @param[in] params Configuration text, or NULL for all defaults
+ *
+ * @return 0, or an errno.
+ */
+
+int sal_fixture_init(const char *params)
+{
+	char path[] = "/tmp/sal_fixture.XXXXXX";
+	struct config_error_type err_type;
+	nfs_start_info_t start_info;
+	config_file_t config;
+	FILE *f;
+	int fd, rc;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return errno;
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlink(path);
+		return EIO;
+	}
+	fprintf(f, "%s\n", params != NULL ? params : "");
+	fclose(f);
+
+	(void) init_error_type(&err_type);
+	config = config_ParseFile(path, &err_type);
+	unlink(path);
+	if (config == NULL || !config_error_is_harmless(&err_type))
+		return EINVAL;
+
+	memset(&start_info, 0, sizeof(start_info));
+	rc = nfs_set_param_from_conf(config, &start_info, &err_type);
+	config_Free(config);
+	if (rc != 0)
+		return EINVAL;
+
+	if (nfs_Init_client_id() != CLIENT_ID_SUCCESS ||
+	    nfs4_Init_state_id() != 0 || Init_nfs4_owner() != 0)
+		return ENOMEM;
+
+	nfs41_session_pool =
+	    pool_init("NFSv4.1 session pool", sizeof(nfs41_session_t),
+		      pool_basic_substrate, NULL, NULL, NULL);
+	if (nfs41_session_pool == NULL || nfs41_Init_session_id() != 0)
+		return ENOMEM;
+
+	return 0;
+}
+
+/**
+ * @brief Make a confirmed client
+ *
+ * @param[in] name         The client's owner name
+ * @param[in] minorversion 0 as by SETCLIENTID, 1 as by EXCHANGE_ID
+ *
+ * @return The client, with a reference for the caller, or NULL.
+ */
+
+nfs_client_id_t *sal_fixture_client(const char *name, uint32_t minorversion)
+{
+	struct root_op_context root_op_context;
+	struct sockaddr_in *sin;
+	sockaddr_t sockaddr;
+	struct gsh_client *gsh_client;
+	nfs_client_record_t *record;
+	nfs_client_id_t *clientid = NULL;
+	nfs_client_cred_t cred;
+
+	memset(&sockaddr, 0, sizeof(sockaddr));
+	sin = (struct sockaddr_in *)&sockaddr;
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	gsh_client = get_gsh_client(&sockaddr, false);
+	if (gsh_client == NULL)
+		return NULL;
+
+	init_root_op_context(&root_op_context, NULL, NULL, NFS_V4,
+			     minorversion, NFS_REQUEST);
+	op_ctx->client = gsh_client;
+
+	record = get_client_record(name, strlen(name), 0, 0);
+	if (record == NULL)
+		goto out;
+
+	PTHREAD_MUTEX_lock(&record->cr_mutex);
+
+	memset(&cred, 0, sizeof(cred));
+	cred.flavor = AUTH_UNIX;
+
+	clientid = create_client_id(0, record, &cred, minorversion);
+	if (clientid == NULL)
+		goto unlock;
+
+	if (minorversion != 0)
+		glist_init(&clientid->cid_cb.v41.cb_session_list);
+
+	if (nfs_client_id_insert(clientid) != CLIENT_ID_SUCCESS) {
+		clientid = NULL;
+		goto unlock;
+	}
+
+	if (minorversion == 0)
+		nfs4_create_clid_name(record, clientid, NULL);
+
+	inc_client_id_ref(clientid);
+
+	if (nfs_client_id_confirm(clientid, COMPONENT_CLIENTID) !=
+	    CLIENT_ID_SUCCESS) {
+		dec_client_id_ref(clientid);
+		clientid = NULL;
+	}
+
+ unlock:
+	PTHREAD_MUTEX_unlock(&record->cr_mutex);
+	dec_client_record_ref(record);
+
+ out:
+	release_root_op_context();
+	put_gsh_client(gsh_client);
+	return clientid;
+}
+
+/**
+ * @brief Give an NFSv4.1 client a session
+ *
+ * @param[in] clientid The client
+ *
+ * @return The session, with a reference for the caller, or NULL.
+ */
+
+nfs41_session_t *sal_fixture_session(nfs_client_id_t *clientid)
+{
+	nfs41_session_t *session;
+	int i;
+
+	session = pool_alloc(nfs41_session_pool, NULL);
+	if (session == NULL)
+		return NULL;
+
+	session->clientid = clientid->cid_clientid;
+	session->clientid_record = clientid;
+	session->refcount = 2;	/* sentinel ref + caller's ref */
+	session->fore_channel_attrs.ca_maxrequests = NFS41_NB_SLOTS;
+	session->xprt = NULL;
+	session->flags = 0;
+	session->cb_program = 0;
+	PTHREAD_MUTEX_init(&session->cb_mutex, NULL);
+	PTHREAD_COND_init(&session->cb_cond, NULL);
+	for (i = 0; i < NFS41_NB_SLOTS; i++)
+		PTHREAD_MUTEX_init(&session->slots[i].lock, NULL);
+
+	inc_client_id_ref(clientid);
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	glist_add(&clientid->cid_cb.v41.cb_session_list,
+		  &session->session_link);
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	nfs41_Build_sessionid(&session->clientid, session->session_id);
+
+	if (!nfs41_Session_Set(session)) {
+		dec_session_ref(session);
+		dec_session_ref(session);
+		return NULL;
+	}
+
+	return session;
+}
+
+/**
+ * @brief Open a file for a client, as OPEN would
+ *
+ * The open owner is made if need be.  The caller must have an op
+ * context for the file's export.
+ *
+ * @param[in] entry        The file
+ * @param[in] clientid     The client
+ * @param[in] owner_name   The open owner's name
+ * @param[in] share_access OPEN4_SHARE_ACCESS_*
+ * @param[in] share_deny   OPEN4_SHARE_DENY_*
+ *
+ * @return The open state, with a reference for the caller, or NULL.
+ */
+
+state_t *sal_fixture_open(cache_entry_t *entry, nfs_client_id_t *clientid,
+			  const char *owner_name, int share_access,
+			  int share_deny)
+{
+	state_nfs4_owner_name_t name;
+	state_owner_t *owner;
+	union state_data data;
+	state_t *state = NULL;
+	bool_t isnew;
+
+	name.son_owner_len = strlen(owner_name);
+	name.son_owner_val = (char *)owner_name;
+
+	owner = create_nfs4_owner(&name, clientid, STATE_OPEN_OWNER_NFSV4,
+				  NULL, 0, &isnew, CARE_ALWAYS);
+	if (owner == NULL)
+		return NULL;
+
+	memset(&data, 0, sizeof(data));
+	data.share.share_access = share_access;
+	data.share.share_deny = share_deny;
+
+	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+
+	if (state_add_impl(entry, STATE_TYPE_SHARE, &data, owner, &state,
+			   NULL) != STATE_SUCCESS) {
+		state = NULL;
+		goto out;
+	}
+
+	glist_init(&state->state_data.share.share_lockstates);
+
+	if (cache_inode_open(entry, FSAL_O_RDWR, 0) != CACHE_INODE_SUCCESS ||
+	    state_share_add(entry, owner, state, false) != STATE_SUCCESS) {
+		state_del_locked(state);
+		dec_state_t_ref(state);
+		state = NULL;
+	}
+
+ out:
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+	dec_state_owner_ref(owner);
+	return state;
+}
+
+/**
+ * @brief Make the lock state of an open, as a LOCK with a new lock
+ *	  owner would
+ *
+ * @param[in] entry      The file
+ * @param[in] open_state The open, of the same file
+ * @param[in] owner_name The lock owner's name
+ *
+ * @return The lock state, with a reference for the caller, or NULL.
+ *	   Its owner is the state's state_owner.
+ */
+
+state_t *sal_fixture_lock_state(cache_entry_t *entry, state_t *open_state,
+				const char *owner_name)
+{
+	state_nfs4_owner_name_t name;
+	state_owner_t *open_owner, *owner;
+	union state_data data;
+	state_t *state;
+	bool_t isnew;
+
+	open_owner = get_state_owner_ref(open_state);
+	if (open_owner == NULL)
+		return NULL;
+
+	name.son_owner_len = strlen(owner_name);
+	name.son_owner_val = (char *)owner_name;
+
+	owner = create_nfs4_owner(&name,
+				  open_owner->so_owner.so_nfs4_owner
+					.so_clientrec,
+				  STATE_LOCK_OWNER_NFSV4, open_owner, 0,
+				  &isnew, CARE_ALWAYS);
+	dec_state_owner_ref(open_owner);
+	if (owner == NULL)
+		return NULL;
+
+	memset(&data, 0, sizeof(data));
+	data.lock.openstate = open_state;
+
+	if (state_add(entry, STATE_TYPE_LOCK, &data, owner, &state, NULL) !=
+	    STATE_SUCCESS) {
+		dec_state_owner_ref(owner);
+		return NULL;
+	}
+
+	glist_init(&state->state_data.lock.state_locklist);
+	glist_add_tail(&open_state->state_data.share.share_lockstates,
+		       &state->state_data.lock.state_sharelist);
+
+	dec_state_owner_ref(owner);
+	return state;
+}
+
+/**
+ * @brief Grant a client a read delegation, as OPEN would
+ *
+ * @param[in] entry    The file, which the client has open
+ * @param[in] clientid The client
+ *
+ * @return The delegation state, with a reference for the caller, or
+ *	   NULL.
+ */
+
+state_t *sal_fixture_deleg(cache_entry_t *entry, nfs_client_id_t *clientid)
+{
+	state_owner_t *owner = &clientid->cid_owner;
+	union state_data data;
+	state_t *state = NULL;
+
+	memset(&data, 0, sizeof(data));
+	init_new_deleg_state(&data, OPEN_DELEGATE_READ, clientid);
+
+	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+
+	if (state_add_impl(entry, STATE_TYPE_DELEG, &data, owner, &state,
+			   NULL) != STATE_SUCCESS) {
+		state = NULL;
+		goto out;
+	}
+
+	if (acquire_lease_lock(entry, owner, state) != STATE_SUCCESS) {
+		state_del_locked(state);
+		dec_state_t_ref(state);
+		state = NULL;
+	}
+
+ out:
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+	return state;
+}
+
+/**
+ * @brief Give a delegation back, as DELEGRETURN would
+ *
+ * @param[in] entry The file
+ * @param[in] deleg The delegation, whose reference the caller keeps
+ *
+ * @return State status.
+ */
+
+state_status_t sal_fixture_delegreturn(cache_entry_t *entry, state_t *deleg)
+{
+	state_owner_t *owner;
+	state_status_t status;
+
+	PTHREAD_RWLOCK_wrlock(&entry->state_lock);
+
+	owner = get_state_owner_ref(deleg);
+	if (owner == NULL) {
+		PTHREAD_RWLOCK_unlock(&entry->state_lock);
+		return STATE_ESTALE;
+	}
+
+	deleg_heuristics_recall(entry, owner, deleg);
+	dec_state_owner_ref(owner);
+
+	status = release_lease_lock(entry, deleg);
+	if (status == STATE_SUCCESS)
+		state_del_locked(deleg);
+
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+	return status;
+}
@@ -0,0 +1,58 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file sal_fixture.h
+ * @brief NFSv4 client records and sessions, for tests
+ *
+ * sal_fixture_init loads the server parameters from a configuration
+ * holding only the given text, every other parameter keeping its
+ * default, and builds the client ID, state ID, owner and session
+ * tables as nfs_Init does.  Clients are then made as SETCLIENTID and
+ * SETCLIENTID_CONFIRM, or EXCHANGE_ID and CREATE_SESSION, would make
+ * them, from 127.0.0.1, with no callback channel.
+ *
+ * Given a cached file, such as vfs_fixture_entry finds, a client may
+ * then open it, lock it and be granted a delegation on it as OPEN and
+ * LOCK would, and return the delegation as DELEGRETURN would.
+ */
+
+#ifndef SAL_FIXTURE_H
+#define SAL_FIXTURE_H
+
+#include "sal_data.h"
+#include "sal_functions.h"
+#include "cache_inode.h"
+
+int sal_fixture_init(const char *params);
+
+nfs_client_id_t *sal_fixture_client(const char *name, uint32_t minorversion);
+nfs41_session_t *sal_fixture_session(nfs_client_id_t *clientid);
+
+state_t *sal_fixture_open(cache_entry_t *entry, nfs_client_id_t *clientid,
+			  const char *owner_name, int share_access,
+			  int share_deny);
+state_t *sal_fixture_lock_state(cache_entry_t *entry, state_t *open_state,
+				const char *owner_name);
+state_t *sal_fixture_deleg(cache_entry_t *entry, nfs_client_id_t *clientid);
+state_status_t sal_fixture_delegreturn(cache_entry_t *entry, state_t *deleg);
+
+#endif				/* SAL_FIXTURE_H */
@@ -0,0 +1,104 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_adaptive_ttl.c
+ * @brief Check cache_inode_adapt_expire against an export's limits
+ *
+ * The expiry a refresh leaves behind is checked for an export with
+ * fixed expiry, for attributes that never expire, and for an export
+ * with Attr_Expiration_Min_Time and Attr_Expiration_Max_Time set:
+ * back to the minimum on a change, doubling while nothing changes, up
+ * to the maximum, and never past half the time since the object last
+ * changed.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "fsal.h"
+#include "export_mgr.h"
+#include "cache_inode.h"
+
+#define MIN_TIME 2
+#define MAX_TIME 64
+
+static int failures;
+
+static void expect(const char *what, int32_t expire, bool changed,
+		   time_t age, int32_t want)
+{
+	struct timespec chgtime = {
+		.tv_sec = time(NULL) - age,
+		.tv_nsec = 0
+	};
+	int32_t got = cache_inode_adapt_expire(expire, changed, &chgtime);
+
+	if (got != want) {
+		printf("FAIL %s: %d -> %d, expected %d\n",
+		       what, expire, got, want);
+		failures++;
+	} else {
+		printf("ok   %s: %d -> %d\n", what, expire, got);
+	}
+}
+
+int main(void)
+{
+	struct gsh_export export;
+	struct req_op_context ctx;
+	time_t old = 24 * 3600;
+
+	memset(&export, 0, sizeof(export));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.export = &export;
+
+	/* Outside a request nothing is adapted */
+	op_ctx = NULL;
+	expect("no op context", 10, false, old, 10);
+
+	op_ctx = &ctx;
+
+	/* Attr_Expiration_Max_Time unset: the export's fixed expiry */
+	export.expire_time_attr = 10;
+	expect("fixed expiry", 10, false, old, 10);
+	expect("fixed expiry, changed", 10, true, old, 10);
+
+	export.expire_time_attr_min = MIN_TIME;
+	export.expire_time_attr_max = MAX_TIME;
+
+	/* Never expire, or always refetch, stay that way */
+	expect("never expires", -1, false, old, -1);
+	expect("never trusted", 0, true, old, 0);
+
+	expect("changed", 32, true, old, MIN_TIME);
+	expect("below the minimum", 1, false, old, MIN_TIME);
+	expect("unchanged", 4, false, old, 8);
+	expect("unchanged, near the maximum", 40, false, old, MAX_TIME);
+	expect("at the maximum", MAX_TIME, false, old, MAX_TIME);
+	expect("changed 20s ago", 16, false, 20, 10);
+	expect("changed just now", 16, false, 0, MIN_TIME);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,386 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_courtesy.c
+ * @brief Courtesy clients, kept until their state is wanted
+ *
+ * With Courteous_Server on and a two second Lease_Lifetime, a
+ * directory is exported through FSAL_VFS behind the inode cache and
+ * NFSv4.0 clients open and lock a file in it.  Their leases are left
+ * to lapse and the reaper's test, valid_lease or keep_courtesy_client,
+ * is applied to each:
+ *
+ * - A client holding a lock is kept, lock and all, until another
+ *   client asks for a conflicting lock.  state_lock then expires it
+ *   with expire_courtesy_client and grants the new lock.
+ * - A client holding an open is kept and, renewing late, is revived
+ *   by reserve_lease with its open intact.
+ * - A client without state, or any client once Courteous_Server is
+ *   off, is not kept.
+ *
+ * Usage: test_courtesy [directory]
+ * The export is made in a new directory in it, /tmp by default.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "nfs_core.h"
+#include "nfs_proto_functions.h"
+#include "sal_fixture.h"
+#include "vfs_fixture.h"
+
+#define LEASE 2
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+/**
+ * @brief Whether the reaper would leave a client alone
+ */
+
+static bool reaper_keeps(nfs_client_id_t *clientid)
+{
+	bool keep;
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	keep = valid_lease(clientid) || keep_courtesy_client(clientid);
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	return keep;
+}
+
+static bool confirmed(nfs_client_id_t *clientid)
+{
+	nfs_client_id_t *found;
+
+	if (nfs_client_id_get_confirmed(clientid->cid_clientid, &found) !=
+	    CLIENT_ID_SUCCESS)
+		return false;
+
+	dec_client_id_ref(found);
+	return found == clientid;
+}
+
+static state_status_t lock_range(cache_entry_t *entry, state_t *state,
+				 uint64_t start, uint64_t length)
+{
+	fsal_lock_param_t lock, conflict;
+	state_owner_t *holder = NULL;
+	state_status_t status;
+
+	memset(&lock, 0, sizeof(lock));
+	lock.lock_type = FSAL_LOCK_W;
+	lock.lock_start = start;
+	lock.lock_length = length;
+
+	status = state_lock(entry, state->state_owner, state,
+			    STATE_NON_BLOCKING, NULL, &lock, &holder,
+			    &conflict);
+
+	if (holder != NULL)
+		dec_state_owner_ref(holder);
+
+	return status;
+}
+
+/**
+ * @brief Count the locks on a file, and those of a client
+ */
+
+static int count_locks(cache_entry_t *entry, nfs_client_id_t *clientid,
+		       int *of_client)
+{
+	struct glist_head *glist;
+	state_lock_entry_t *lock_entry;
+	state_owner_t *owner;
+	int count = 0;
+
+	*of_client = 0;
+
+	PTHREAD_RWLOCK_rdlock(&entry->state_lock);
+	glist_for_each(glist, &entry->object.file.lock_list) {
+		lock_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+		owner = lock_entry->sle_owner;
+		count++;
+		if (owner->so_owner.so_nfs4_owner.so_clientrec == clientid)
+			(*of_client)++;
+	}
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+
+	return count;
+}
+
+static bool has_open(cache_entry_t *entry, nfs_client_id_t *clientid)
+{
+	struct glist_head *glist;
+	state_t *state;
+	bool found = false;
+
+	PTHREAD_RWLOCK_rdlock(&entry->state_lock);
+	glist_for_each(glist, &entry->list_of_states) {
+		state = glist_entry(glist, state_t, state_list);
+		if (state->state_type == STATE_TYPE_SHARE &&
+		    state->state_owner->so_owner.so_nfs4_owner.so_clientrec ==
+		    clientid)
+			found = true;
+	}
+	PTHREAD_RWLOCK_unlock(&entry->state_lock);
+
+	return found;
+}
+
+/**
+ * @brief A lapsed lock holder loses its lock to a conflicting one
+ */
+
+static void conflict(cache_entry_t *entry)
+{
+	nfs_client_id_t *holder, *contender;
+	state_t *open_state, *lock_state;
+	fsal_lock_param_t all;
+	int mine;
+
+	holder = sal_fixture_client("courtesy holder", 0);
+	contender = sal_fixture_client("courtesy contender", 0);
+	CHECK(holder != NULL && contender != NULL, "no clients");
+	if (holder == NULL || contender == NULL)
+		return;
+
+	open_state = sal_fixture_open(entry, holder, "holder",
+				      OPEN4_SHARE_ACCESS_BOTH,
+				      OPEN4_SHARE_DENY_NONE);
+	lock_state = open_state != NULL ?
+	    sal_fixture_lock_state(entry, open_state, "holder") : NULL;
+	CHECK(lock_state != NULL, "holder could not open");
+	if (lock_state == NULL)
+		goto out;
+
+	CHECK(lock_range(entry, lock_state, 0, 100) == STATE_SUCCESS,
+	      "holder could not lock");
+
+	/* Expiry frees the states, as a client's own requests would not
+	 * be holding them.
+	 */
+	dec_state_t_ref(lock_state);
+	dec_state_t_ref(open_state);
+
+	sleep(LEASE + 1);
+
+	CHECK(reaper_keeps(holder), "lapsed lock holder not kept");
+	CHECK(holder->cid_courtesy, "lapsed lock holder not a courtesy client");
+	CHECK(confirmed(holder), "courtesy client gone from the table");
+	CHECK(count_locks(entry, holder, &mine) == 1 && mine == 1,
+	      "courtesy client's lock not kept");
+	printf("ok   lapsed lock holder kept with its lock\n");
+
+	/* Asking again changes nothing */
+	CHECK(reaper_keeps(holder), "courtesy client not kept again");
+
+	open_state = sal_fixture_open(entry, contender, "contender",
+				      OPEN4_SHARE_ACCESS_BOTH,
+				      OPEN4_SHARE_DENY_NONE);
+	lock_state = open_state != NULL ?
+	    sal_fixture_lock_state(entry, open_state, "contender") : NULL;
+	CHECK(lock_state != NULL, "contender could not open");
+	if (lock_state == NULL)
+		goto out;
+
+	CHECK(lock_range(entry, lock_state, 50, 100) == STATE_SUCCESS,
+	      "conflicting lock not granted");
+	CHECK(!holder->cid_courtesy, "expired client still a courtesy one");
+	CHECK(holder->cid_confirmed == EXPIRED_CLIENT_ID,
+	      "courtesy client not expired");
+	CHECK(!confirmed(holder), "expired client still in the table");
+	CHECK(count_locks(entry, holder, &mine) == 1 && mine == 0,
+	      "courtesy client's lock not released");
+	CHECK(count_locks(entry, contender, &mine) == 1 && mine == 1,
+	      "conflicting lock not in the list");
+	CHECK(!has_open(entry, holder), "courtesy client's open kept");
+	printf("ok   conflicting lock expired the courtesy client\n");
+
+	memset(&all, 0, sizeof(all));
+	all.lock_type = FSAL_LOCK_W;
+	CHECK(state_unlock(entry, lock_state->state_owner, lock_state,
+			   &all) == STATE_SUCCESS,
+	      "contender could not unlock");
+	dec_state_t_ref(lock_state);
+	dec_state_t_ref(open_state);
+
+ out:
+	dec_client_id_ref(holder);
+	dec_client_id_ref(contender);
+}
+
+/**
+ * @brief A lapsed client renewing before anyone wants its state
+ */
+
+static void revival(cache_entry_t *entry)
+{
+	nfs_client_id_t *clientid;
+	state_t *open_state;
+	compound_data_t data;
+	nfs_argop4 op;
+	nfs_resop4 res;
+	bool valid;
+
+	clientid = sal_fixture_client("courtesy revived", 0);
+	CHECK(clientid != NULL, "no client");
+	if (clientid == NULL)
+		return;
+
+	open_state = sal_fixture_open(entry, clientid, "revived",
+				      OPEN4_SHARE_ACCESS_READ,
+				      OPEN4_SHARE_DENY_NONE);
+	CHECK(open_state != NULL, "could not open");
+	if (open_state == NULL)
+		goto out;
+	dec_state_t_ref(open_state);
+
+	sleep(LEASE + 1);
+
+	CHECK(reaper_keeps(clientid), "lapsed open holder not kept");
+	CHECK(clientid->cid_courtesy, "lapsed client not a courtesy client");
+
+	memset(&op, 0, sizeof(op));
+	op.argop = NFS4_OP_RENEW;
+	op.nfs_argop4_u.oprenew.clientid = clientid->cid_clientid;
+	memset(&data, 0, sizeof(data));
+	data.minorversion = 0;
+	CHECK(nfs4_op_renew(&op, &data, &res) == NFS4_OK,
+	      "late RENEW failed: %d", res.nfs_resop4_u.oprenew.status);
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	valid = valid_lease(clientid);
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	CHECK(!clientid->cid_courtesy, "revived client still a courtesy one");
+	CHECK(valid, "revived client's lease not valid");
+	CHECK(confirmed(clientid), "revived client gone from the table");
+	CHECK(has_open(entry, clientid), "revived client lost its open");
+	printf("ok   late RENEW revived the courtesy client\n");
+
+	/* A conflict now finds a live client, not a courtesy one */
+	CHECK(!expire_courtesy_client(clientid),
+	      "revived client expired as a courtesy one");
+	CHECK(confirmed(clientid), "revived client expired");
+
+ out:
+	dec_client_id_ref(clientid);
+}
+
+/**
+ * @brief Clients not kept
+ */
+
+static void not_kept(cache_entry_t *entry)
+{
+	nfs_client_id_t *bare, *holder;
+	state_t *open_state;
+
+	bare = sal_fixture_client("courtesy bare", 0);
+	holder = sal_fixture_client("courtesy uncourted", 0);
+	CHECK(bare != NULL && holder != NULL, "no clients");
+	if (bare == NULL || holder == NULL)
+		return;
+
+	open_state = sal_fixture_open(entry, holder, "uncourted",
+				      OPEN4_SHARE_ACCESS_READ,
+				      OPEN4_SHARE_DENY_NONE);
+	CHECK(open_state != NULL, "could not open");
+	if (open_state != NULL)
+		dec_state_t_ref(open_state);
+
+	sleep(LEASE + 1);
+
+	CHECK(!reaper_keeps(bare), "client without state kept");
+	CHECK(!bare->cid_courtesy, "client without state a courtesy one");
+	printf("ok   lapsed client without state not kept\n");
+
+	nfs_param.nfsv4_param.courteous_server = false;
+	CHECK(!reaper_keeps(holder), "client kept with Courteous_Server off");
+	CHECK(!holder->cid_courtesy, "courtesy client with the option off");
+	nfs_param.nfsv4_param.courteous_server = true;
+	printf("ok   lapsed client not kept with Courteous_Server off\n");
+
+	dec_client_id_ref(bare);
+	dec_client_id_ref(holder);
+}
+
+int main(int argc, char **argv)
+{
+	const char *parent = argc > 1 ? argv[1] : "/tmp";
+	struct vfs_fixture fx;
+	cache_entry_t *entry;
+	char dir[256], path[300];
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s/test_courtesy.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || write(fd, "courtesy", 8) != 8) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	if (sal_fixture_init("NFSv4 { Lease_Lifetime = 2; "
+			     "Courteous_Server = true; }") != 0 ||
+	    vfs_fixture_init(&fx, dir, NULL, NULL, NULL) != 0 ||
+	    vfs_fixture_cache(&fx) != 0 ||
+	    vfs_fixture_entry(&fx, "file", &entry) != CACHE_INODE_SUCCESS) {
+		printf("FAIL: could not set up\n");
+		unlink(path);
+		rmdir(dir);
+		return 1;
+	}
+
+	conflict(entry);
+	revival(entry);
+	not_kept(entry);
+
+	cache_inode_put(entry);
+	vfs_fixture_fini(&fx);
+	unlink(path);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_create_open.c
+ * @brief Exclusive creates through FSAL_VFS create_open
+ *
+ * A directory is exported through FSAL_VFS behind the inode cache and
+ * files are created in it with cache_inode_create_open, the verifier
+ * of an EXCLUSIVE4 OPEN set and checked as open4_create does:
+ *
+ * - An exclusive create makes the file, already open for writing,
+ *   with the verifier stored in its times.
+ * - A retransmission with the same verifier succeeds, on the same
+ *   file.
+ * - A create with another verifier fails with NFS4ERR_EXIST, and
+ *   leaves the file's verifier alone.
+ * - A create over a directory fails with NFS4ERR_EXIST.
+ *
+ * Must run as root.  Usage: test_create_open [directory]
+ * The export is made in a new directory in it, /dev/shm by default,
+ * which is tmpfs.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "nfs_core.h"
+#include "nfs_convert.h"
+#include "sal_fixture.h"
+#include "vfs_fixture.h"
+
+#define VERF_HI 0x1234567
+#define VERF_LO 0x7654321
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static struct vfs_fixture fx;
+
+/**
+ * @brief Create a file as an EXCLUSIVE4 OPEN would
+ *
+ * @param[in]  name    Name of the file
+ * @param[in]  verf_hi High word of the verifier
+ * @param[in]  verf_lo Low word of the verifier
+ * @param[out] entry   The file, with a reference, on NFS4_OK
+ *
+ * @return NFS4_OK if created, or if the verifier matched.
+ */
+
+static nfsstat4 exclusive_create(const char *name, uint32_t verf_hi,
+				 uint32_t verf_lo, cache_entry_t **entry)
+{
+	struct attrlist sattr;
+	cache_inode_status_t status;
+
+	memset(&sattr, 0, sizeof(sattr));
+	cache_inode_create_set_verifier(&sattr, verf_hi, verf_lo);
+
+	status = cache_inode_create_open(fx.root_entry, name, 0644,
+					 FSAL_O_RDWR, &sattr, entry);
+
+	if (status == CACHE_INODE_ENTRY_EXISTS && *entry != NULL) {
+		if (cache_inode_create_verify(*entry, verf_hi, verf_lo))
+			return NFS4_OK;
+		cache_inode_put(*entry);
+		*entry = NULL;
+	}
+
+	return nfs4_Errno(status);
+}
+
+static bool stored_verifier(const char *path, uint32_t verf_hi,
+			    uint32_t verf_lo)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_atime == verf_hi && st.st_mtime == verf_lo;
+}
+
+static void run(const char *dir)
+{
+	cache_entry_t *created = NULL, *again = NULL, *other = NULL;
+	char path[300];
+	int had = failures;
+
+	snprintf(path, sizeof(path), "%s/file", dir);
+
+	CHECK(exclusive_create("file", VERF_HI, VERF_LO, &created) == NFS4_OK,
+	      "exclusive create failed");
+	if (created == NULL) {
+		printf("FAIL  exclusive create makes the file\n");
+		return;
+	}
+	CHECK(created->type == REGULAR_FILE, "not a regular file");
+	CHECK(is_open_for_write(created), "not left open for writing");
+	CHECK(stored_verifier(path, VERF_HI, VERF_LO),
+	      "verifier not stored in the file's times");
+	printf("%s  exclusive create makes the file, open, with its "
+	       "verifier\n", failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(exclusive_create("file", VERF_HI, VERF_LO, &again) == NFS4_OK,
+	      "retransmission refused");
+	CHECK(again == created, "retransmission found another entry");
+	printf("%s  retransmission with the same verifier succeeds\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(exclusive_create("file", VERF_HI, VERF_LO + 1, &other) ==
+	      NFS4ERR_EXIST, "other verifier not refused");
+	CHECK(other == NULL, "entry returned with NFS4ERR_EXIST");
+	CHECK(stored_verifier(path, VERF_HI, VERF_LO),
+	      "other verifier overwrote the stored one");
+	printf("%s  another verifier gets NFS4ERR_EXIST\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(exclusive_create("dir", VERF_HI, VERF_LO, &other) ==
+	      NFS4ERR_EXIST, "create over a directory not refused");
+	CHECK(other == NULL, "entry returned for a directory");
+	printf("%s  create over a directory gets NFS4ERR_EXIST\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	if (other != NULL)
+		cache_inode_put(other);
+	if (again != NULL)
+		cache_inode_put(again);
+	cache_inode_put(created);
+}
+
+int main(int argc, char **argv)
+{
+	const char *parent = argc > 1 ? argv[1] : "/dev/shm";
+	char dir[256], path[300], sub[300];
+
+	if (geteuid() != 0) {
+		printf("SKIP: open_by_handle_at needs root\n");
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "%s/test_create_open.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	snprintf(sub, sizeof(sub), "%s/dir", dir);
+	if (mkdir(sub, 0755) != 0) {
+		perror(sub);
+		rmdir(dir);
+		return 1;
+	}
+
+	if (sal_fixture_init(NULL) != 0 ||
+	    vfs_fixture_init(&fx, dir, NULL, NULL, NULL) != 0 ||
+	    vfs_fixture_cache(&fx) != 0) {
+		printf("FAIL: could not set up\n");
+		rmdir(sub);
+		rmdir(dir);
+		return 1;
+	}
+
+	run(dir);
+
+	vfs_fixture_fini(&fx);
+	unlink(path);
+	rmdir(sub);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,306 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_decoder_pool.c
+ * @brief Many-connection burst against a running server
+ *
+ * Opens a large number of TCP connections to a local ganesha and has
+ * every one of them send a burst of NFS NULL calls at once, so that
+ * most transports become ready together.  Reports per-call latency
+ * percentiles and, from /proc, the server's thread count and RSS
+ * before, at peak during, and after the run.  Compare runs with
+ * different Decoder_Threads and Decoder_Budget settings.
+ *
+ * Usage: test_decoder_pool server-pid [connections [depth [rounds
+ *        [port]]]]
+ *
+ * The server is reached at 127.0.0.1, port 2049 by default.  Raise
+ * the open file limit for large connection counts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "rpc_bench.h"
+
+#define NFS_PROGRAM 100003
+#define NFS_V3 3
+#define CALL_WORDS 10
+#define NBUCKETS 40
+#define NCLIENTS 8
+
+static int nconns = 2000;
+static int depth = 4;
+static int rounds = 20;
+static int port = 2049;
+static pid_t server;
+
+static uint64_t hist[NBUCKETS];
+static uint64_t total_ns;
+static uint64_t calls;
+static int failures;
+
+static volatile bool running = true;
+static long peak_threads;
+static long peak_rss_kb;
+
+struct client {
+	int first;
+	int count;
+	int *fds;
+	pthread_t thr;
+};
+
+static void *sampler(void *arg)
+{
+	struct server_usage u;
+
+	while (running) {
+		server_usage(server, &u, false);
+		if (u.threads > peak_threads)
+			peak_threads = u.threads;
+		if (u.rss_kb > peak_rss_kb)
+			peak_rss_kb = u.rss_kb;
+		usleep(20000);
+	}
+
+	return NULL;
+}
+
+static void make_call(uint32_t *call, uint32_t xid)
+{
+	call[0] = htonl(0x80000000 | (CALL_WORDS * 4));
+	call[1] = htonl(xid);
+	call[2] = htonl(0);		/* CALL */
+	call[3] = htonl(2);		/* RPC version */
+	call[4] = htonl(NFS_PROGRAM);
+	call[5] = htonl(NFS_V3);
+	call[6] = htonl(0);		/* NULL */
+	call[7] = htonl(0);		/* AUTH_NONE cred */
+	call[8] = htonl(0);
+	call[9] = htonl(0);		/* AUTH_NONE verf */
+	call[10] = htonl(0);
+}
+
+/**
+ * @brief Read one reply, returning its xid or 0 on error
+ */
+
+static uint32_t read_reply(int fd)
+{
+	uint32_t mark, len;
+	uint32_t body[64];
+
+	if (read_full(fd, &mark, sizeof(mark)) != 0)
+		return 0;
+	len = ntohl(mark) & 0x7fffffff;
+	if (len < 24 || len > sizeof(body))
+		return 0;
+	if (read_full(fd, body, len) != 0)
+		return 0;
+	/* REPLY, MSG_ACCEPTED, SUCCESS */
+	if (ntohl(body[1]) != 1 || ntohl(body[2]) != 0 || ntohl(body[5]) != 0)
+		return 0;
+	return ntohl(body[0]);
+}
+
+static void record(uint64_t ns)
+{
+	int bucket = 0;
+
+	while ((bucket < NBUCKETS - 1) && ((1ULL << (bucket + 1)) <= ns))
+		++bucket;
+	__sync_fetch_and_add(&hist[bucket], 1);
+	__sync_fetch_and_add(&total_ns, ns);
+	__sync_fetch_and_add(&calls, 1);
+}
+
+/**
+ * @brief Drive a slice of the connections
+ *
+ * Each round writes depth calls on every connection in the slice,
+ * then collects the replies.  Latency runs from the write of a
+ * connection's burst to each of its replies.
+ */
+
+static void *client(void *arg)
+{
+	struct client *cl = arg;
+	uint32_t call[CALL_WORDS + 1];
+	uint64_t *sent = calloc(cl->count, sizeof(uint64_t));
+	int r, i, d;
+
+	if (sent == NULL) {
+		__sync_fetch_and_add(&failures, 1);
+		return NULL;
+	}
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < cl->count; i++) {
+			sent[i] = now_ns();
+			for (d = 0; d < depth; d++) {
+				make_call(call, ((cl->first + i) << 8) + d + 1);
+				if (write(cl->fds[i], call, sizeof(call)) !=
+				    sizeof(call)) {
+					__sync_fetch_and_add(&failures, 1);
+					goto out;
+				}
+			}
+		}
+		for (i = 0; i < cl->count; i++) {
+			for (d = 0; d < depth; d++) {
+				if (read_reply(cl->fds[i]) == 0) {
+					__sync_fetch_and_add(&failures, 1);
+					goto out;
+				}
+				record(now_ns() - sent[i]);
+			}
+		}
+	}
+
+ out:
+	free(sent);
+	return NULL;
+}
+
+static uint64_t percentile(double p)
+{
+	uint64_t want = (uint64_t) (p * calls);
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < NBUCKETS; ++i) {
+		seen += hist[i];
+		if (seen >= want)
+			return 1ULL << (i + 1);
+	}
+
+	return 1ULL << NBUCKETS;
+}
+
+int main(int argc, char *argv[])
+{
+	struct client clients[NCLIENTS];
+	pthread_t sample_thr;
+	struct server_usage u;
+	int *fds;
+	uint64_t start, elapsed;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr,
+			"usage: %s server-pid [connections [depth [rounds [port]]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	server = atoi(argv[1]);
+	if (argc > 2)
+		nconns = atoi(argv[2]);
+	if (argc > 3)
+		depth = atoi(argv[3]);
+	if (argc > 4)
+		rounds = atoi(argv[4]);
+	if (argc > 5)
+		port = atoi(argv[5]);
+
+	if (server <= 0 || nconns < NCLIENTS || depth <= 0 || rounds <= 0) {
+		fprintf(stderr, "bad arguments\n");
+		return 1;
+	}
+
+	fds = calloc(nconns, sizeof(int));
+	if (fds == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	server_usage(server, &u, false);
+	if (u.threads < 0) {
+		fprintf(stderr, "no such process %d\n", (int)server);
+		return 1;
+	}
+	printf("before: threads %ld rss %ldkB\n", u.threads, u.rss_kb);
+
+	for (i = 0; i < nconns; i++) {
+		fds[i] = connect_one(port);
+		if (fds[i] < 0) {
+			fprintf(stderr, "connect %d: %s\n", i, strerror(errno));
+			return 1;
+		}
+	}
+
+	peak_threads = u.threads;
+	peak_rss_kb = u.rss_kb;
+	pthread_create(&sample_thr, NULL, sampler, NULL);
+
+	start = now_ns();
+	for (i = 0; i < NCLIENTS; i++) {
+		clients[i].first = i * (nconns / NCLIENTS);
+		clients[i].count = (i == NCLIENTS - 1)
+			? nconns - clients[i].first : nconns / NCLIENTS;
+		clients[i].fds = fds + clients[i].first;
+		pthread_create(&clients[i].thr, NULL, client, &clients[i]);
+	}
+	for (i = 0; i < NCLIENTS; i++)
+		pthread_join(clients[i].thr, NULL);
+	elapsed = now_ns() - start;
+
+	running = false;
+	pthread_join(sample_thr, NULL);
+
+	for (i = 0; i < nconns; i++)
+		close(fds[i]);
+	free(fds);
+
+	printf("connections %d depth %d rounds %d calls %llu\n", nconns,
+	       depth, rounds, (unsigned long long)calls);
+	printf("peak:   threads %ld rss %ldkB\n", peak_threads, peak_rss_kb);
+	sleep(1);
+	server_usage(server, &u, false);
+	printf("after:  threads %ld rss %ldkB\n", u.threads, u.rss_kb);
+
+	if (calls != 0) {
+		printf("elapsed %.3fs, %.0f calls/sec\n", elapsed / 1e9,
+		       calls / (elapsed / 1e9));
+		printf("latency: mean %lluns p50 <%lluns p99 <%lluns "
+		       "p99.9 <%lluns\n",
+		       (unsigned long long)(total_ns / calls),
+		       (unsigned long long)percentile(0.5),
+		       (unsigned long long)percentile(0.99),
+		       (unsigned long long)percentile(0.999));
+	}
+
+	if (failures != 0) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
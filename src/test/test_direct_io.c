@@ -0,0 +1,328 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_direct_io.c
+ * @brief FSAL_VFS reads and writes with direct_io set
+ *
+ * A directory is exported through FSAL_VFS with direct_io, a file in
+ * it is opened through the FSAL, and so with O_DIRECT, and read and
+ * written through vfs_read and vfs_write.  What the FSAL reads is
+ * checked against what was written, and the file, as read by another
+ * buffered descriptor, against what the FSAL wrote:
+ *
+ * - A write at an unaligned offset and of an unaligned length, from a
+ *   badly aligned buffer, is stored whole.
+ * - Reads at unaligned offsets and of unaligned lengths, and aligned
+ *   reads into a badly aligned buffer, give the file's data.
+ * - Reads reaching past the end of the file are short, stopping at
+ *   the end, with end of file set, whichever of the head, middle or
+ *   tail of the read the end falls in.
+ * - A write past the end of the file extends it, leaving a hole that
+ *   reads as zeroes.
+ *
+ * Must run as root.  Usage: test_direct_io [directory]
+ * The export is made in a new directory in it, /var/tmp by default,
+ * which must be on a file system supporting O_DIRECT.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fsal.h"
+#include "FSAL/fsal_commonlib.h"
+#include "../FSAL/FSAL_VFS/vfs_methods.h"
+#include "vfs_fixture.h"
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static char path[300];
+static struct fsal_obj_handle *obj;
+static size_t align;
+
+/* What the file should hold */
+static char *model;
+static size_t model_size;
+
+/* Aligned for O_DIRECT, used one byte in to be badly aligned */
+static char *io_buf;
+
+static void fill(char *buf, size_t len, char base)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = base + i % 23;
+}
+
+/**
+ * @brief Write through the FSAL and into the model
+ */
+
+static bool fsal_write(uint64_t offset, size_t len, char *buf)
+{
+	size_t written = 0;
+	bool stable = false;
+	fsal_status_t status;
+
+	status = obj->obj_ops.write(obj, offset, len, buf, &written, &stable);
+	if (FSAL_IS_ERROR(status) || written != len)
+		return false;
+
+	if (offset > model_size)
+		memset(model + model_size, 0, offset - model_size);
+	memcpy(model + offset, buf, len);
+	if (offset + len > model_size)
+		model_size = offset + len;
+
+	/* vfs_read finds the end of file from the attributes */
+	status = obj->obj_ops.getattrs(obj);
+	return !FSAL_IS_ERROR(status);
+}
+
+/**
+ * @brief Read through the FSAL and check against the model
+ *
+ * @return Bytes read, or -1 on error or if they do not match.
+ */
+
+static ssize_t fsal_read(uint64_t offset, size_t len, char *buf, bool *eof)
+{
+	size_t nread = 0;
+	fsal_status_t status;
+
+	*eof = false;
+	status = obj->obj_ops.read(obj, offset, len, buf, &nread, eof);
+	if (FSAL_IS_ERROR(status) || nread > len)
+		return -1;
+	if (nread != 0 && (offset + nread > model_size ||
+			   memcmp(buf, model + offset, nread) != 0))
+		return -1;
+
+	return nread;
+}
+
+/**
+ * @brief Check the file, read buffered, holds the model
+ */
+
+static bool file_matches(void)
+{
+	struct stat st;
+	char *buf;
+	bool same;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	buf = gsh_malloc(model_size + 1);
+	same = fstat(fd, &st) == 0 && (size_t)st.st_size == model_size &&
+	    pread(fd, buf, model_size + 1, 0) == (ssize_t)model_size &&
+	    memcmp(buf, model, model_size) == 0;
+	gsh_free(buf);
+	close(fd);
+
+	return same;
+}
+
+static void unaligned(void)
+{
+	char *buf = io_buf + 1;
+	size_t len = 2 * align + 11;
+	uint64_t offset = align / 2 + 3;
+	bool eof;
+	int had = failures;
+
+	fill(buf, len, 'A');
+	CHECK(fsal_write(offset, len, buf), "unaligned write failed");
+	CHECK(file_matches(), "unaligned write not stored");
+	printf("%s  unaligned write from an unaligned buffer\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(fsal_read(7, 2 * align + 5, buf, &eof) == 2 * align + 5,
+	      "unaligned read wrong");
+	CHECK(fsal_read(align / 2 + 1, align, buf, &eof) == align,
+	      "unaligned read within two blocks wrong");
+	CHECK(fsal_read(3, 10, buf, &eof) == 10,
+	      "read within a block wrong");
+	CHECK(fsal_read(align, align, buf, &eof) == align,
+	      "aligned read into an unaligned buffer wrong");
+	CHECK(fsal_read(0, 2 * align, io_buf, &eof) == 2 * align,
+	      "aligned read wrong");
+	printf("%s  unaligned reads\n", failures != had ? "FAIL" : "ok  ");
+}
+
+static void short_reads(void)
+{
+	char *buf = io_buf + 1;
+	size_t size = model_size;
+	uint64_t last = size / align * align;
+	bool eof;
+	int had = failures;
+
+	CHECK(size % align != 0, "file size %zu aligned", size);
+
+	/* The end falls in the head */
+	CHECK(fsal_read(size - 10, 2 * align, buf, &eof) == 10 && eof,
+	      "short read in the head wrong");
+	/* In the middle */
+	CHECK(fsal_read(align, 3 * align, io_buf, &eof) == size - align &&
+	      eof, "short aligned read wrong");
+	CHECK(fsal_read(align - 5, 3 * align, buf, &eof) ==
+	      size - align + 5 && eof, "short read in the middle wrong");
+	/* In the tail */
+	CHECK(fsal_read(last - 1, size - last + 20, buf, &eof) ==
+	      size - last + 1 && eof, "short read in the tail wrong");
+	/* Past it */
+	CHECK(fsal_read(size, align, buf, &eof) == 0 && eof,
+	      "read at the end not empty");
+	CHECK(fsal_read(size + align + 1, 7, buf, &eof) == 0 && eof,
+	      "read past the end not empty");
+	printf("%s  short reads at end of file\n",
+	       failures != had ? "FAIL" : "ok  ");
+}
+
+static void past_eof(void)
+{
+	char *buf = io_buf + 1;
+	uint64_t offset = model_size + align + 3;
+	size_t len = align + 1;
+	bool eof;
+	int had = failures;
+
+	fill(buf, len, 'a');
+	CHECK(fsal_write(offset, len, buf), "write past the end failed");
+	CHECK(file_matches(), "write past the end not stored");
+	CHECK(fsal_read(offset - align - 10, align + 20, buf, &eof) ==
+	      align + 20, "hole not read as zeroes");
+	CHECK(fsal_read(offset - 1, len + 10, buf, &eof) == len + 1 && eof,
+	      "extended file read wrong");
+	printf("%s  write past end of file\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	offset = model_size / align * align + 2 * align;
+	len = align;
+	fill(io_buf, len, 'k');
+	CHECK(fsal_write(offset, len, io_buf),
+	      "aligned write past the end failed");
+	CHECK(file_matches(), "aligned write past the end not stored");
+	printf("%s  aligned write past end of file\n",
+	       failures != had ? "FAIL" : "ok  ");
+}
+
+int main(int argc, char **argv)
+{
+	const char *parent = argc > 1 ? argv[1] : "/var/tmp";
+	struct vfs_fixture fx;
+	struct vfs_fsal_obj_handle *myself;
+	struct vfs_filesystem *vfs_fs;
+	char dir[256], initial[100];
+	fsal_status_t status;
+	int fd, rc;
+
+	if (geteuid() != 0) {
+		printf("SKIP: open_by_handle_at needs root\n");
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "%s/test_direct_io.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	fill(initial, sizeof(initial), '0');
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || write(fd, initial, sizeof(initial)) != sizeof(initial)) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	rc = vfs_fixture_init(&fx, dir, NULL, "direct_io = true;", NULL);
+	if (rc != 0) {
+		printf("FAIL: cannot export %s: %s\n", dir, strerror(rc));
+		failures++;
+		goto out;
+	}
+
+	status = vfs_fixture_lookup(&fx, "file", &obj);
+	if (!FSAL_IS_ERROR(status))
+		status = obj->obj_ops.open(obj, FSAL_O_RDWR);
+	if (FSAL_IS_ERROR(status)) {
+		printf("FAIL: open: %s\n", msg_fsal_err(status.major));
+		failures++;
+		goto fini;
+	}
+
+	myself = container_of(obj, struct vfs_fsal_obj_handle, obj_handle);
+	vfs_fs = obj->fs->private;
+	if (!myself->u.file.direct) {
+		printf("SKIP: %s does not support O_DIRECT\n", obj->fs->path);
+		goto close;
+	}
+	align = vfs_fs->dio_offset_align;
+	if (vfs_fs->dio_mem_align > align)
+		align = vfs_fs->dio_mem_align;
+
+	model = gsh_calloc(8, align);
+	io_buf = gsh_malloc_aligned(align, 4 * align);
+	memcpy(model, initial, sizeof(initial));
+	model_size = sizeof(initial);
+
+	unaligned();
+	short_reads();
+	past_eof();
+
+	gsh_free(io_buf);
+	gsh_free(model);
+
+ close:
+	obj->obj_ops.close(obj);
+ fini:
+	if (obj != NULL)
+		obj->obj_ops.release(obj);
+	vfs_fixture_fini(&fx);
+ out:
+	unlink(path);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_fridgethr_bench.c
+ * @brief Submission microbenchmark for the thread fridge
+ *
+ * Many producer threads submit trivial jobs to a worker fridge.  Each
+ * job records how long it waited between fridgethr_submit and the
+ * start of its execution.  We report tasks per second and the
+ * submit-to-run latency distribution.
+ *
+ * Usage: test_fridgethr_bench [producers [workers [tasks_per_producer]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "abstract_atomic.h"
+#include "fridgethr.h"
+
+#define NBUCKETS 40
+
+struct job {
+	struct timespec submitted;
+};
+
+static struct fridgethr *fr;
+static struct job *jobs;
+static uint64_t hist[NBUCKETS];
+static uint64_t total_ns;
+static uint64_t completed;
+static uint64_t expected;
+static pthread_mutex_t done_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+static int tasks_per_producer = 100000;
+
+static uint64_t ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000000ULL
+		+ b->tv_nsec - a->tv_nsec;
+}
+
+static void run_job(struct fridgethr_context *ctx)
+{
+	struct job *job = ctx->arg;
+	struct timespec now;
+	uint64_t ns;
+	int bucket = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = ts_diff_ns(&job->submitted, &now);
+	while ((bucket < NBUCKETS - 1) && ((1ULL << (bucket + 1)) <= ns))
+		++bucket;
+	atomic_inc_uint64_t(&hist[bucket]);
+	atomic_add_uint64_t(&total_ns, ns);
+
+	if (atomic_inc_uint64_t(&completed) == expected) {
+		pthread_mutex_lock(&done_mtx);
+		pthread_cond_signal(&done_cv);
+		pthread_mutex_unlock(&done_mtx);
+	}
+}
+
+static void *producer(void *arg)
+{
+	struct job *mine = jobs + (uintptr_t) arg * tasks_per_producer;
+	int i;
+
+	for (i = 0; i < tasks_per_producer; ++i) {
+		clock_gettime(CLOCK_MONOTONIC, &mine[i].submitted);
+		while (fridgethr_submit(fr, run_job, &mine[i]) != 0)
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static uint64_t percentile(double p)
+{
+	uint64_t want = (uint64_t) (p * expected);
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < NBUCKETS; ++i) {
+		seen += hist[i];
+		if (seen >= want)
+			return 1ULL << (i + 1);
+	}
+
+	return 1ULL << NBUCKETS;
+}
+
+int main(int argc, char *argv[])
+{
+	struct fridgethr_params frp;
+	struct timespec start, end;
+	pthread_t *producers;
+	int nproducers = 8;
+	int nworkers = 4;
+	double secs;
+	uintptr_t i;
+	int rc;
+
+	if (argc > 1)
+		nproducers = atoi(argv[1]);
+	if (argc > 2)
+		nworkers = atoi(argv[2]);
+	if (argc > 3)
+		tasks_per_producer = atoi(argv[3]);
+
+	if (nproducers <= 0 || nworkers <= 0 || tasks_per_producer <= 0) {
+		fprintf(stderr,
+			"usage: %s [producers [workers [tasks_per_producer]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = nworkers;
+	frp.thr_min = nworkers;
+	frp.flavor = fridgethr_flavor_worker;
+	frp.deferment = fridgethr_defer_queue;
+
+	rc = fridgethr_init(&fr, "bench", &frp);
+	if (rc != 0) {
+		fprintf(stderr, "fridgethr_init: %d\n", rc);
+		return 1;
+	}
+
+	expected = (uint64_t) nproducers * tasks_per_producer;
+	jobs = calloc(expected, sizeof(struct job));
+	producers = calloc(nproducers, sizeof(pthread_t));
+	if (jobs == NULL || producers == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nproducers; ++i)
+		pthread_create(&producers[i], NULL, producer, (void *)i);
+	for (i = 0; i < nproducers; ++i)
+		pthread_join(producers[i], NULL);
+
+	pthread_mutex_lock(&done_mtx);
+	while (atomic_fetch_uint64_t(&completed) < expected)
+		pthread_cond_wait(&done_cv, &done_mtx);
+	pthread_mutex_unlock(&done_mtx);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = ts_diff_ns(&start, &end) / 1e9;
+	printf("producers %d workers %d tasks %llu\n", nproducers, nworkers,
+	       (unsigned long long)expected);
+	printf("elapsed %.3fs, %.0f tasks/sec\n", secs, expected / secs);
+	printf("submit-to-run latency: mean %lluns p50 <%lluns "
+	       "p99 <%lluns p99.9 <%lluns\n",
+	       (unsigned long long)(total_ns / expected),
+	       (unsigned long long)percentile(0.5),
+	       (unsigned long long)percentile(0.99),
+	       (unsigned long long)percentile(0.999));
+
+	fridgethr_sync_command(fr, fridgethr_comm_stop, 10);
+	free(producers);
+	free(jobs);
+
+	return 0;
+}
@@ -0,0 +1,479 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_immutable_bench.c
+ * @brief Read-only workload against a normal and an immutable export
+ *
+ * Mounts two exports of a running ganesha over NFSv3, normally the
+ * same read-only tree exported once as is and once with Immutable set,
+ * and walks each with READDIRPLUS to learn its handles.  A number of
+ * clients then send a read-mostly mix of GETATTR, ACCESS, LOOKUP, READ
+ * and READLINK against each export in turn for a fixed time.
+ *
+ * For each export the ops/sec are reported, with the server's context
+ * switches and CPU time per operation taken from /proc.  Lock
+ * acquisitions cannot be counted from outside the server; contended
+ * ones show up as voluntary context switches, uncontended ones as CPU.
+ *
+ * Usage: test_immutable_bench server-pid normal-path immutable-path
+ *        [clients [seconds [port]]]
+ *
+ * The server is reached at 127.0.0.1, port 2049 by default, for both
+ * MOUNT and NFS.  Use Attr_Expiration_Time = 0 on the normal export to
+ * see the cost of revalidation at its worst.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rpc_bench.h"
+
+#define NFS_PROGRAM 100003
+#define NFS_V3 3
+#define MOUNT_PROGRAM 100005
+#define MOUNT_V3 3
+
+#define NFSPROC3_GETATTR 1
+#define NFSPROC3_LOOKUP 3
+#define NFSPROC3_ACCESS 4
+#define NFSPROC3_READLINK 5
+#define NFSPROC3_READ 6
+#define NFSPROC3_READDIRPLUS 17
+#define MOUNTPROC3_MNT 1
+
+#define NF3REG 1
+#define NF3DIR 2
+#define NF3LNK 5
+
+#define FH_MAX 64
+#define NAME_MAX_LEN 255
+#define MAX_OBJECTS 20000
+#define FATTR3_LEN 84
+#define BUF_LEN (64 * 1024)
+#define READ_SIZE 4096
+
+struct fh {
+	uint32_t len;
+	unsigned char data[FH_MAX];
+};
+
+struct object {
+	struct fh fh;
+	struct fh parent;
+	char name[NAME_MAX_LEN + 1];
+	uint32_t type;
+};
+
+struct tree {
+	struct object *obj;
+	int count;
+	int nfiles;
+	int nlinks;
+};
+
+struct client {
+	const struct tree *tree;
+	pthread_t thr;
+	uint64_t seed;
+	uint64_t ops;
+	int failures;
+};
+
+static int port = 2049;
+static pid_t server;
+static volatile bool running;
+
+static uint64_t next_rand(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void put_fh(struct xdr *x, const struct fh *fh)
+{
+	put_opaque(x, fh->data, fh->len);
+}
+
+static bool skip_post_op_attr(struct xdr *x, uint32_t *type)
+{
+	uint32_t follows;
+
+	if (!get_u32(x, &follows))
+		return false;
+	if (!follows)
+		return true;
+	if (type != NULL) {
+		if (!get_u32(x, type))
+			return false;
+		return skip(x, FATTR3_LEN - 4);
+	}
+	return skip(x, FATTR3_LEN);
+}
+
+/**
+ * @brief Get the root handle of an export with MOUNT v3
+ */
+
+static bool mount_export(int fd, const char *path, struct fh *root)
+{
+	unsigned char buf[BUF_LEN];
+	struct xdr x = { buf, buf + BUF_LEN };
+	uint32_t status;
+
+	rpc_header(&x, 1, MOUNT_PROGRAM, MOUNT_V3, MOUNTPROC3_MNT);
+	put_opaque(&x, path, strlen(path));
+
+	if (!rpc_call(fd, buf, BUF_LEN, &x) || !get_u32(&x, &status)) {
+		fprintf(stderr, "MNT %s: RPC failed\n", path);
+		return false;
+	}
+	if (status != 0) {
+		fprintf(stderr, "MNT %s: status %u\n", path, status);
+		return false;
+	}
+
+	return get_opaque(&x, root->data, FH_MAX, &root->len);
+}
+
+/**
+ * @brief Learn every object under a directory, breadth first
+ */
+
+static void walk(int fd, struct tree *tree, const struct fh *root)
+{
+	static unsigned char buf[BUF_LEN];
+	int next_dir = -1;
+	struct fh dir = *root;
+
+	while (tree->count < MAX_OBJECTS) {
+		uint64_t cookie = 0;
+		unsigned char verf[8] = { 0 };
+		uint32_t eof = 0;
+
+		while (!eof && tree->count < MAX_OBJECTS) {
+			struct xdr x = { buf, buf + BUF_LEN };
+			uint32_t status, follows;
+
+			rpc_header(&x, 2, NFS_PROGRAM, NFS_V3,
+				    NFSPROC3_READDIRPLUS);
+			put_fh(&x, &dir);
+			put_u64(&x, cookie);
+			put_fixed(&x, verf, 8);
+			put_u32(&x, 8192);	/* dircount */
+			put_u32(&x, 32768);	/* maxcount */
+
+			if (!rpc_call(fd, buf, BUF_LEN, &x) || !get_u32(&x, &status) ||
+			    status != 0 || !skip_post_op_attr(&x, NULL) ||
+			    x.end - x.p < 8)
+				break;
+			memcpy(verf, x.p, 8);
+			x.p += 8;
+
+			while (get_u32(&x, &follows) && follows) {
+				struct object *o = &tree->obj[tree->count];
+				uint64_t fileid;
+				uint32_t len, type = 0, has_fh;
+
+				if (!get_u64(&x, &fileid) ||
+				    !get_opaque(&x, o->name, NAME_MAX_LEN,
+						&len) ||
+				    !get_u64(&x, &cookie) ||
+				    !skip_post_op_attr(&x, &type) ||
+				    !get_u32(&x, &has_fh))
+					goto done;
+				o->name[len] = '\0';
+				o->type = type;
+				o->fh.len = 0;
+				if (has_fh &&
+				    !get_opaque(&x, o->fh.data, FH_MAX,
+						&o->fh.len))
+					goto done;
+
+				if (strcmp(o->name, ".") == 0 ||
+				    strcmp(o->name, "..") == 0 ||
+				    o->fh.len == 0)
+					continue;
+
+				o->parent = dir;
+				if (type == NF3REG)
+					tree->nfiles++;
+				else if (type == NF3LNK)
+					tree->nlinks++;
+				if (++tree->count >= MAX_OBJECTS)
+					break;
+			}
+			if (!get_u32(&x, &eof))
+				break;
+		}
+
+		/* Next directory we learned of */
+		do {
+			next_dir++;
+		} while (next_dir < tree->count &&
+			 tree->obj[next_dir].type != NF3DIR);
+		if (next_dir >= tree->count)
+			break;
+		dir = tree->obj[next_dir].fh;
+	}
+
+ done:
+	return;
+}
+
+static const struct object *pick(const struct tree *tree, uint64_t *seed,
+				 uint32_t type)
+{
+	int i, n;
+
+	/* A few tries at a random object of the wanted type */
+	for (n = 0; n < 16; n++) {
+		i = next_rand(seed) % tree->count;
+		if (type == 0 || tree->obj[i].type == type)
+			return &tree->obj[i];
+	}
+
+	return &tree->obj[next_rand(seed) % tree->count];
+}
+
+/**
+ * @brief Send a read-mostly mix until told to stop
+ *
+ * 35% GETATTR, 20% ACCESS, 25% LOOKUP, 15% READ, 5% READLINK (GETATTR
+ * when the tree has no symlinks).
+ */
+
+static void *client(void *arg)
+{
+	struct client *cl = arg;
+	const struct tree *tree = cl->tree;
+	unsigned char *buf = malloc(BUF_LEN);
+	uint32_t xid = 1;
+	int fd = connect_one(port);
+
+	if (fd < 0 || buf == NULL) {
+		cl->failures++;
+		goto out;
+	}
+
+	while (running) {
+		struct xdr x = { buf, buf + BUF_LEN };
+		uint32_t r = next_rand(&cl->seed) % 100;
+		uint32_t status;
+		const struct object *o;
+
+		if (r < 35 || (r >= 95 && tree->nlinks == 0)) {
+			o = pick(tree, &cl->seed, 0);
+			rpc_header(&x, xid++, NFS_PROGRAM, NFS_V3,
+				    NFSPROC3_GETATTR);
+			put_fh(&x, &o->fh);
+		} else if (r < 55) {
+			o = pick(tree, &cl->seed, 0);
+			rpc_header(&x, xid++, NFS_PROGRAM, NFS_V3,
+				    NFSPROC3_ACCESS);
+			put_fh(&x, &o->fh);
+			put_u32(&x, 0x3f);
+		} else if (r < 80) {
+			o = pick(tree, &cl->seed, 0);
+			rpc_header(&x, xid++, NFS_PROGRAM, NFS_V3,
+				    NFSPROC3_LOOKUP);
+			put_fh(&x, &o->parent);
+			put_opaque(&x, o->name, strlen(o->name));
+		} else if (r < 95 && tree->nfiles != 0) {
+			o = pick(tree, &cl->seed, NF3REG);
+			rpc_header(&x, xid++, NFS_PROGRAM, NFS_V3,
+				    NFSPROC3_READ);
+			put_fh(&x, &o->fh);
+			put_u64(&x, 0);
+			put_u32(&x, READ_SIZE);
+		} else {
+			o = pick(tree, &cl->seed, NF3LNK);
+			rpc_header(&x, xid++, NFS_PROGRAM, NFS_V3,
+				    NFSPROC3_READLINK);
+			put_fh(&x, &o->fh);
+		}
+
+		if (!rpc_call(fd, buf, BUF_LEN, &x) || !get_u32(&x, &status)) {
+			cl->failures++;
+			break;
+		}
+		if (status != 0)
+			cl->failures++;
+		cl->ops++;
+	}
+
+ out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+struct result {
+	uint64_t ops;
+	double seconds;
+	uint64_t voluntary;
+	uint64_t involuntary;
+	uint64_t ticks;
+	int failures;
+};
+
+static void run(const struct tree *tree, int nclients, int seconds,
+		struct result *res)
+{
+	struct client *clients = calloc(nclients, sizeof(*clients));
+	struct server_usage u0, u;
+	uint64_t start;
+	int i;
+
+	memset(res, 0, sizeof(*res));
+	if (clients == NULL) {
+		res->failures = 1;
+		return;
+	}
+
+	server_usage(server, &u0, true);
+	running = true;
+	start = now_ns();
+
+	for (i = 0; i < nclients; i++) {
+		clients[i].tree = tree;
+		clients[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		pthread_create(&clients[i].thr, NULL, client, &clients[i]);
+	}
+
+	sleep(seconds);
+	running = false;
+
+	for (i = 0; i < nclients; i++) {
+		pthread_join(clients[i].thr, NULL);
+		res->ops += clients[i].ops;
+		res->failures += clients[i].failures;
+	}
+
+	res->seconds = (now_ns() - start) / 1e9;
+	server_usage(server, &u, true);
+	res->voluntary = u.voluntary - u0.voluntary;
+	res->involuntary = u.involuntary - u0.involuntary;
+	res->ticks = u.ticks - u0.ticks;
+
+	free(clients);
+}
+
+static bool load(const char *path, struct tree *tree)
+{
+	struct fh root;
+	int fd = connect_one(port);
+	bool ok;
+
+	if (fd < 0) {
+		fprintf(stderr, "connect: %s\n", strerror(errno));
+		return false;
+	}
+
+	tree->obj = calloc(MAX_OBJECTS, sizeof(*tree->obj));
+	ok = tree->obj != NULL && mount_export(fd, path, &root);
+	if (ok)
+		walk(fd, tree, &root);
+	close(fd);
+
+	if (ok && tree->count == 0) {
+		fprintf(stderr, "%s: nothing found to read\n", path);
+		ok = false;
+	}
+
+	return ok;
+}
+
+static void report(const char *name, const struct tree *tree,
+		   const struct result *res)
+{
+	long hz = sysconf(_SC_CLK_TCK);
+	double ops = res->ops ? (double)res->ops : 1;
+
+	printf("%-10s %6d %10.0f %12.3f %12.3f %10.2f %8d\n", name,
+	       tree->count, res->ops / res->seconds,
+	       res->voluntary / ops, res->involuntary / ops,
+	       res->ticks * 1e6 / hz / ops, res->failures);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tree normal = { 0 }, immutable = { 0 };
+	struct result rnormal, rimmutable;
+	int nclients = 16;
+	int seconds = 10;
+
+	if (argc < 4) {
+		fprintf(stderr,
+			"Usage: %s server-pid normal-path immutable-path [clients [seconds [port]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	server = atoi(argv[1]);
+	if (argc > 4)
+		nclients = atoi(argv[4]);
+	if (argc > 5)
+		seconds = atoi(argv[5]);
+	if (argc > 6)
+		port = atoi(argv[6]);
+
+	if (!load(argv[2], &normal) || !load(argv[3], &immutable))
+		return 1;
+
+	/* Warm both caches before measuring either */
+	run(&normal, nclients, 1, &rnormal);
+	run(&immutable, nclients, 1, &rimmutable);
+
+	run(&normal, nclients, seconds, &rnormal);
+	run(&immutable, nclients, seconds, &rimmutable);
+
+	printf("%d clients, %ds per export\n\n", nclients, seconds);
+	printf("%-10s %6s %10s %12s %12s %10s %8s\n", "export", "objs",
+	       "ops/sec", "vol cs/op", "invol cs/op", "cpu us/op",
+	       "errors");
+	report("normal", &normal, &rnormal);
+	report("immutable", &immutable, &rimmutable);
+
+	if (rnormal.ops != 0 && rimmutable.ops != 0)
+		printf("\nimmutable/normal: %.2fx ops/sec, %.2fx context switches per op\n",
+		       (rimmutable.ops / rimmutable.seconds) /
+		       (rnormal.ops / rnormal.seconds),
+		       ((double)rimmutable.voluntary / rimmutable.ops) /
+		       ((double)(rnormal.voluntary ? rnormal.voluntary : 1) /
+			rnormal.ops));
+
+	if (rnormal.failures != 0 || rimmutable.failures != 0) {
+		printf("FAIL\n");
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
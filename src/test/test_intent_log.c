@@ -0,0 +1,362 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_intent_log.c
+ * @brief Crash test of the FSAL_VFS stable write intent log
+ *
+ * Built with FSAL/FSAL_VFS/intent_log.c and the VFS handle syscalls.
+ * A child process opens the log with vfs_intent_log_init, and writers
+ * make stable writes through vfs_intent_log_write, unstable writes,
+ * and commits as vfs_commit does, to blocks of a file.  Their writes
+ * go to a copy of the file in the child's memory, which stands in for
+ * the page cache: fsync is taken over here to write that copy back
+ * first, so the file only gets what was synced, by a commit or by the
+ * log's checkpoint, and killing the child loses the rest.
+ *
+ * The child is killed at a random time, the log is replayed by
+ * vfs_intent_log_init in this process, and every block must then hold
+ * a whole write no older than the last one acknowledged as stable.
+ * The log is 1MiB, so it goes round many times in a round.
+ *
+ * Must run as root, on a file system with file handles.
+ * Usage: test_intent_log [directory [rounds]]
+ * The directory defaults to /var/tmp.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "fsal.h"
+#include "fsal_convert.h"
+#include "FSAL/fsal_commonlib.h"
+#include "../FSAL/FSAL_VFS/vfs_methods.h"
+
+#define BLOCK 4096
+#define NBLOCKS 512
+#define WRITERS 8
+#define LOG_SIZE (1024 * 1024)
+
+struct shared {
+	uint64_t next_seq;
+	uint64_t durable[NBLOCKS];	/* Last write acknowledged stable */
+	uint64_t latest[NBLOCKS];	/* Last write begun */
+};
+
+static struct shared *sh;
+static char (*cache)[BLOCK];	/* Page cache stand in, child only */
+static bool dirty[NBLOCKS];
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char log_path[4200], data_path[4200];
+static struct fsal_module fsal;
+static struct vfs_filesystem vfs_fs;
+static struct vfs_fsal_export exp;
+static struct vfs_fsal_obj_handle obj;
+static vfs_file_handle_t fh;
+static ino_t data_ino;
+static int data_fd;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(2);
+}
+
+/**
+ * @brief fsync, writing back the page cache stand in first
+ *
+ * Whoever syncs the data file, a commit or the log's checkpoint on a
+ * descriptor of its own, gets the stand in written back.
+ */
+
+int fsync(int fd)
+{
+	struct stat st;
+	int b;
+
+	if (cache != NULL && fstat(fd, &st) == 0 && st.st_ino == data_ino) {
+		pthread_mutex_lock(&cache_mutex);
+		for (b = 0; b < NBLOCKS; b++) {
+			if (!dirty[b])
+				continue;
+			if (pwrite(fd, cache[b], BLOCK, (off_t)b * BLOCK) !=
+			    BLOCK) {
+				pthread_mutex_unlock(&cache_mutex);
+				return -1;
+			}
+			dirty[b] = false;
+		}
+		pthread_mutex_unlock(&cache_mutex);
+	}
+
+	return syscall(SYS_fsync, fd);
+}
+
+static uint64_t fnv(const void *p, size_t n)
+{
+	const unsigned char *c = p;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (n--)
+		h = (h ^ *c++) * 0x100000001b3ULL;
+	return h;
+}
+
+static void fill_block(char *buf, uint64_t b, uint64_t seq)
+{
+	uint64_t *w = (uint64_t *)buf;
+
+	memset(buf, (int)(seq & 0xff), BLOCK);
+	w[0] = b;
+	w[1] = seq;
+	w[2] = fnv(w, 16);
+}
+
+/* @return The write a block holds, 0 if none, -1 if not a whole one */
+
+static int64_t block_seq(const char *buf, uint64_t b)
+{
+	const uint64_t *w = (const uint64_t *)buf;
+	char expect[BLOCK];
+	int i;
+
+	for (i = 0; i < BLOCK && buf[i] == 0; i++)
+		;
+	if (i == BLOCK)
+		return 0;
+	if (w[0] != b)
+		return -1;
+	fill_block(expect, b, w[1]);
+	return memcmp(buf, expect, BLOCK) == 0 ? (int64_t)w[1] : -1;
+}
+
+static void *crash_writer(void *arg)
+{
+	int id = (intptr_t)arg;
+	uint64_t snap[NBLOCKS];
+	unsigned int seed = getpid() * 31 + id;
+	char buf[BLOCK];
+	uint64_t b, seq;
+	int r;
+
+	for (;;) {
+		b = (rand_r(&seed) % (NBLOCKS / WRITERS)) * WRITERS + id;
+		seq = __atomic_add_fetch(&sh->next_seq, 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&sh->latest[b], seq, __ATOMIC_SEQ_CST);
+		fill_block(buf, b, seq);
+
+		/* As vfs_write's pwrite */
+		pthread_mutex_lock(&cache_mutex);
+		memcpy(cache[b], buf, BLOCK);
+		dirty[b] = true;
+		pthread_mutex_unlock(&cache_mutex);
+
+		r = rand_r(&seed) % 10;
+		if (r < 5) {
+			/* Stable */
+			if (vfs_intent_log_write(exp.intent_log, &obj, buf,
+						 BLOCK, b * BLOCK) != 0)
+				die("vfs_intent_log_write");
+			__atomic_store_n(&sh->durable[b], seq,
+					 __ATOMIC_SEQ_CST);
+		} else if (r < 8) {
+			/* Unstable, nothing more */
+		} else {
+			/* As vfs_commit */
+			for (b = id; b < NBLOCKS; b += WRITERS)
+				snap[b] = sh->latest[b];
+			if (fsync(data_fd) != 0)
+				die("fsync");
+			if (vfs_intent_log_retire(exp.intent_log, &obj,
+						  data_fd) != 0)
+				die("vfs_intent_log_retire");
+			for (b = id; b < NBLOCKS; b += WRITERS)
+				if (snap[b] > sh->durable[b])
+					__atomic_store_n(&sh->durable[b],
+							 snap[b],
+							 __ATOMIC_SEQ_CST);
+		}
+	}
+	return NULL;
+}
+
+static void crash_child(void)
+{
+	pthread_t thread;
+	intptr_t i;
+
+	cache = malloc((size_t)NBLOCKS * BLOCK);
+	if (cache == NULL)
+		die("malloc");
+	if (pread(data_fd, cache, (size_t)NBLOCKS * BLOCK, 0) !=
+	    NBLOCKS * BLOCK)
+		die("read data");
+	if (vfs_intent_log_init(&exp) != 0)
+		die("vfs_intent_log_init");
+	for (i = 0; i < WRITERS; i++)
+		pthread_create(&thread, NULL, crash_writer, (void *)i);
+	pause();
+}
+
+static int crash_test(int rounds)
+{
+	char buf[BLOCK];
+	int round, b, failures = 0;
+	uint64_t acked = 0;
+	int64_t seq;
+	pid_t pid;
+
+	sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sh == MAP_FAILED)
+		die("mmap");
+	srand(getpid());
+
+	for (round = 0; round < rounds; round++) {
+		pid = fork();
+		if (pid == 0)
+			crash_child();
+		usleep(100000 + rand() % 400000);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+
+		/* Replays whatever the child left */
+		if (vfs_intent_log_init(&exp) != 0) {
+			printf("round %d: replay failed\n", round);
+			return failures + 1;
+		}
+
+		for (b = 0; b < NBLOCKS; b++) {
+			if (pread(data_fd, buf, BLOCK, (off_t)b * BLOCK) !=
+			    BLOCK)
+				die("read data");
+			seq = block_seq(buf, b);
+			if (seq < 0 || (uint64_t)seq < sh->durable[b] ||
+			    (uint64_t)seq > sh->latest[b]) {
+				printf("round %d block %d: holds %lld, acked %llu, latest %llu\n",
+				       round, b, (long long)seq,
+				       (unsigned long long)sh->durable[b],
+				       (unsigned long long)sh->latest[b]);
+				failures++;
+				continue;
+			}
+			if (sh->durable[b] != 0)
+				acked++;
+			sh->durable[b] = sh->latest[b] = seq;
+		}
+
+		vfs_intent_log_fini(&exp);
+	}
+
+	printf("%d rounds, %llu writes, %llu stable blocks checked, %d wrong\n",
+	       rounds, (unsigned long long)sh->next_seq,
+	       (unsigned long long)acked, failures);
+	return failures;
+}
+
+/**
+ * @brief Make the directory's file system known as VFS's would be
+ */
+
+static bool setup(const char *dir)
+{
+	struct stat st;
+	fsal_dev_t dev;
+
+	if (populate_posix_file_systems() != 0)
+		return false;
+
+	data_fd = open(data_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (data_fd < 0)
+		die(data_path);
+	if (ftruncate(data_fd, (off_t)NBLOCKS * BLOCK) != 0)
+		die("ftruncate");
+	if (fstat(data_fd, &st) != 0)
+		die("fstat");
+	data_ino = st.st_ino;
+
+	dev = posix2fsal_devt(st.st_dev);
+	vfs_fs.fs = lookup_dev(&dev);
+	if (vfs_fs.fs == NULL)
+		return false;
+	vfs_fs.fs->fsal = &fsal;
+	vfs_fs.fs->private = &vfs_fs;
+	vfs_fs.root_fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (vfs_fs.root_fd < 0)
+		die(dir);
+
+	fh.handle_len = VFS_HANDLE_LEN;
+	if (vfs_fd_to_handle(data_fd, vfs_fs.fs, &fh) != 0)
+		return false;
+	obj.obj_handle.fs = vfs_fs.fs;
+	obj.handle = &fh;
+
+	exp.export.fsal = &fsal;
+	exp.intent_log_path = log_path;
+	exp.intent_log_size = LOG_SIZE;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "/var/tmp";
+	int rounds = argc > 2 ? atoi(argv[2]) : 20;
+	int failures;
+
+	if (geteuid() != 0) {
+		printf("SKIP: open_by_handle_at needs root\n");
+		return 0;
+	}
+
+	snprintf(log_path, sizeof(log_path), "%s/test_intent_log.%d.log",
+		 dir, getpid());
+	snprintf(data_path, sizeof(data_path), "%s/test_intent_log.%d.data",
+		 dir, getpid());
+
+	if (!setup(dir)) {
+		printf("SKIP: no file handles for %s\n", dir);
+		unlink(data_path);
+		return 0;
+	}
+
+	failures = crash_test(rounds);
+
+	close(data_fd);
+	close(vfs_fs.root_fd);
+	unlink(data_path);
+	unlink(log_path);
+	release_posix_file_systems();
+
+	printf("%s\n", failures ? "FAIL" : "PASS");
+	return failures != 0;
+}
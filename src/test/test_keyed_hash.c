@@ -0,0 +1,253 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_keyed_hash.c
+ * @brief Distribution and speed of the SAL table hashes
+ *
+ * The SAL owner, client and cookie tables used to hash their keys by
+ * summing the bytes, which piles clustered keys such as sequential
+ * host names or owner strings differing in one counter into a few
+ * partitions and a few RBT values.  This generates such key sets,
+ * hashes them with the old sum and with keyed_hash, and reports how
+ * evenly they spread over the partitions, how many RBT values
+ * collide, and the cost per hash.
+ *
+ * Usage: test_keyed_hash [keys [partitions]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "keyed_hash.h"
+
+#define KEY_MAX 64
+
+struct key_set {
+	const char *name;
+	int (*make)(char *buf, int i);
+	uint64_t tweak;
+};
+
+static int failures;
+
+/* Clustered key generators */
+
+static int make_hostname(char *buf, int i)
+{
+	return snprintf(buf, KEY_MAX, "client%04d.example.com", i);
+}
+
+static int make_nfs4_owner(char *buf, int i)
+{
+	/* Linux style open owner: "open id:" followed by a counter */
+	memcpy(buf, "open id:", 8);
+	memset(buf + 8, 0, 16);
+	memcpy(buf + 8, &i, sizeof(i));
+	return 24;
+}
+
+static int make_nlm_owner(char *buf, int i)
+{
+	return snprintf(buf, KEY_MAX, "%d@nfsclient", 1000 + i);
+}
+
+static int make_cookie(char *buf, int i)
+{
+	uint64_t c = i;
+
+	memcpy(buf, &c, sizeof(c));
+	return sizeof(c);
+}
+
+static struct key_set sets[] = {
+	{"hostnames", make_hostname, 0},
+	{"nfs4 owners", make_nfs4_owner, 0x5a5a0001},
+	{"nlm owners", make_nlm_owner, 0},
+	{"lock cookies", make_cookie, 0},
+};
+
+static uint64_t sum_hash(const char *buf, int len, uint64_t tweak)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		sum += (unsigned char)buf[i];
+
+	return sum + len + tweak;
+}
+
+static uint64_t new_hash(const char *buf, int len, uint64_t tweak)
+{
+	return keyed_hash(buf, len, tweak);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Hash one key set and report the spread
+ *
+ * @return Coefficient of variation of the partition counts.
+ */
+
+static double spread(const char *label, struct key_set *set,
+		     uint64_t (*fn)(const char *, int, uint64_t),
+		     int nkeys, int parts)
+{
+	uint64_t *count = calloc(parts, sizeof(uint64_t));
+	uint64_t *rbt = calloc(nkeys, sizeof(uint64_t));
+	uint64_t min = UINT64_MAX, max = 0;
+	double mean = (double)nkeys / parts, var = 0;
+	int dups = 0;
+	char buf[KEY_MAX];
+	int i;
+
+	if (count == NULL || rbt == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		int len = set->make(buf, i);
+
+		rbt[i] = fn(buf, len, set->tweak);
+		count[rbt[i] % parts]++;
+	}
+
+	for (i = 0; i < parts; i++) {
+		if (count[i] < min)
+			min = count[i];
+		if (count[i] > max)
+			max = count[i];
+		var += (count[i] - mean) * (count[i] - mean);
+	}
+	var /= parts;
+
+	qsort(rbt, nkeys, sizeof(uint64_t), cmp_u64);
+	for (i = 1; i < nkeys; i++)
+		if (rbt[i] == rbt[i - 1])
+			dups++;
+
+	printf("  %-6s %-13s min %6llu max %6llu cv %.3f rbt dups %d\n",
+	       label, set->name, (unsigned long long)min,
+	       (unsigned long long)max, sqrt(var) / mean, dups);
+
+	free(count);
+	free(rbt);
+	return sqrt(var) / mean;
+}
+
+static double ns_per_hash(uint64_t (*fn)(const char *, int, uint64_t),
+			  int len)
+{
+	struct timespec start, end;
+	char buf[KEY_MAX];
+	uint64_t acc = 0;
+	int iters = 4000000;
+	int i;
+
+	memset(buf, 'x', sizeof(buf));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iters; i++) {
+		buf[0] = i;
+		acc += fn(buf, len, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* keep the loop alive */
+	if (acc == 42)
+		printf(" ");
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 +
+		(end.tv_nsec - start.tv_nsec)) / iters;
+}
+
+int main(int argc, char *argv[])
+{
+	int nkeys = 100000;
+	int parts = 17;	/* PRIME_STATE */
+	uint64_t seed0;
+	int lens[] = {8, 24, 64};
+	int i;
+
+	if (argc > 1)
+		nkeys = atoi(argv[1]);
+	if (argc > 2)
+		parts = atoi(argv[2]);
+
+	if (nkeys <= 0 || parts <= 0) {
+		fprintf(stderr, "usage: %s [keys [partitions]]\n", argv[0]);
+		return 1;
+	}
+
+	if (!keyed_hash_init())
+		printf("warning: seeds not from /dev/urandom\n");
+
+	printf("%d keys over %d partitions\n", nkeys, parts);
+	for (i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+		double cv;
+
+		spread("sum", &sets[i], sum_hash, nkeys, parts);
+		cv = spread("keyed", &sets[i], new_hash, nkeys, parts);
+
+		/* A uniform hash gives cv near sqrt(parts / nkeys) */
+		if (cv > 4 * sqrt((double)parts / nkeys) + 0.01) {
+			printf("FAIL: keyed hash skewed on %s\n", sets[i].name);
+			failures++;
+		}
+	}
+
+	/* Placement must depend on the seed */
+	seed0 = keyed_hash_seed[0];
+	{
+		uint64_t a = keyed_hash("client0001", 10, 0);
+
+		keyed_hash_seed[0] ^= 1;
+		if (keyed_hash("client0001", 10, 0) == a) {
+			printf("FAIL: hash ignores seed\n");
+			failures++;
+		}
+		keyed_hash_seed[0] = seed0;
+	}
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		printf("len %2d: sum %.1fns keyed %.1fns per hash\n", lens[i],
+		       ns_per_hash(sum_hash, lens[i]),
+		       ns_per_hash(new_hash, lens[i]));
+
+	if (failures != 0) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
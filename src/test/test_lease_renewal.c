@@ -0,0 +1,243 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_lease_renewal.c
+ * @brief Leases held by queued renewals, and their expiry
+ *
+ * With a two second Lease_Lifetime, confirmed clients are made and a
+ * lone RENEW (or SEQUENCE) for each is held as the dispatcher holds
+ * it when queueing, with hold_queued_renewal.  Each is left queued for
+ * longer than the lease:
+ *
+ * - One is then executed with nfs4_op_renew and released.  The lease
+ *   must have stayed valid while queued and run a whole lifetime
+ *   from the renewal.
+ * - One is released without being executed, as when its transport
+ *   goes away.  The lease must be valid while held, and expired, to
+ *   the reaper's valid_lease, once released.
+ * - A SEQUENCE for an NFSv4.1 session behaves the same.
+ *
+ * A renewal for a client already expired, or unknown, is not held.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "nfs_core.h"
+#include "nfs_proto_functions.h"
+#include "sal_fixture.h"
+
+#define LEASE 2
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static bool lease_ok(nfs_client_id_t *clientid)
+{
+	bool valid;
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	valid = valid_lease(clientid);
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	return valid;
+}
+
+/**
+ * @brief A lone RENEW, as decoded
+ */
+
+static void renew_args(COMPOUND4args *args, nfs_argop4 *op,
+		       nfs_client_id_t *clientid)
+{
+	memset(args, 0, sizeof(*args));
+	memset(op, 0, sizeof(*op));
+	op->argop = NFS4_OP_RENEW;
+	op->nfs_argop4_u.oprenew.clientid = clientid->cid_clientid;
+	args->argarray.argarray_len = 1;
+	args->argarray.argarray_val = op;
+}
+
+static void renewed(void)
+{
+	COMPOUND4args args;
+	nfs_argop4 op;
+	nfs_resop4 res;
+	compound_data_t data;
+	nfs_client_id_t *clientid, *held;
+	time_t before;
+
+	clientid = sal_fixture_client("renewed", 0);
+	CHECK(clientid != NULL, "no client");
+	if (clientid == NULL)
+		return;
+
+	renew_args(&args, &op, clientid);
+	held = hold_queued_renewal(&args);
+	CHECK(held == clientid, "RENEW not held");
+	if (held == NULL)
+		goto out;
+
+	sleep(LEASE + 1);
+	CHECK(lease_ok(clientid), "lease lost while the RENEW was queued");
+
+	memset(&data, 0, sizeof(data));
+	data.minorversion = 0;
+	before = time(NULL);
+	CHECK(nfs4_op_renew(&op, &data, &res) == NFS4_OK,
+	      "RENEW failed: %d", res.nfs_resop4_u.oprenew.status);
+	release_queued_renewal(held);
+
+	CHECK(clientid->cid_lease_reservations == 0,
+	      "%d reservations left", clientid->cid_lease_reservations);
+	CHECK(clientid->cid_last_renew >= before,
+	      "RENEW executed late did not renew");
+	CHECK(lease_ok(clientid), "lease expired after RENEW");
+	sleep(LEASE + 1);
+	CHECK(!lease_ok(clientid), "lease outlived its renewal");
+	printf("ok   RENEW queued past the lease renewed it\n");
+
+ out:
+	dec_client_id_ref(clientid);
+}
+
+static void dropped(void)
+{
+	COMPOUND4args args;
+	nfs_argop4 op;
+	nfs_client_id_t *clientid, *held;
+	time_t last_renew;
+
+	clientid = sal_fixture_client("dropped", 0);
+	CHECK(clientid != NULL, "no client");
+	if (clientid == NULL)
+		return;
+
+	renew_args(&args, &op, clientid);
+	last_renew = clientid->cid_last_renew;
+	held = hold_queued_renewal(&args);
+	CHECK(held == clientid, "RENEW not held");
+	if (held == NULL)
+		goto out;
+
+	sleep(LEASE + 1);
+	CHECK(lease_ok(clientid), "lease lost while the RENEW was queued");
+	release_queued_renewal(held);
+
+	CHECK(clientid->cid_lease_reservations == 0,
+	      "%d reservations left", clientid->cid_lease_reservations);
+	CHECK(clientid->cid_last_renew == last_renew,
+	      "RENEW never executed renewed the lease");
+	CHECK(!lease_ok(clientid), "lease valid after a dropped RENEW");
+	printf("ok   RENEW dropped while queued let the lease expire\n");
+
+	/* Too late now */
+	CHECK(hold_queued_renewal(&args) == NULL, "expired client held");
+	printf("ok   RENEW of an expired client not held\n");
+
+ out:
+	dec_client_id_ref(clientid);
+}
+
+static void sequence(void)
+{
+	COMPOUND4args args;
+	nfs_argop4 op;
+	nfs_client_id_t *clientid, *held;
+	nfs41_session_t *session;
+
+	clientid = sal_fixture_client("sequence", 1);
+	CHECK(clientid != NULL, "no client");
+	if (clientid == NULL)
+		return;
+	session = sal_fixture_session(clientid);
+	CHECK(session != NULL, "no session");
+	if (session == NULL)
+		goto out;
+
+	memset(&args, 0, sizeof(args));
+	memset(&op, 0, sizeof(op));
+	op.argop = NFS4_OP_SEQUENCE;
+	memcpy(op.nfs_argop4_u.opsequence.sa_sessionid, session->session_id,
+	       NFS4_SESSIONID_SIZE);
+	args.argarray.argarray_len = 1;
+	args.argarray.argarray_val = &op;
+
+	held = hold_queued_renewal(&args);
+	CHECK(held == clientid, "SEQUENCE not held");
+	if (held != NULL) {
+		sleep(LEASE + 1);
+		CHECK(lease_ok(clientid),
+		      "lease lost while the SEQUENCE was queued");
+		release_queued_renewal(held);
+		CHECK(!lease_ok(clientid),
+		      "lease valid after a dropped SEQUENCE");
+		printf("ok   SEQUENCE held while queued, expired once dropped\n");
+	}
+
+	dec_session_ref(session);
+ out:
+	dec_client_id_ref(clientid);
+}
+
+static void unknown(void)
+{
+	COMPOUND4args args;
+	nfs_argop4 op;
+
+	memset(&args, 0, sizeof(args));
+	memset(&op, 0, sizeof(op));
+	op.argop = NFS4_OP_RENEW;
+	op.nfs_argop4_u.oprenew.clientid = 0xdeadbeef;
+	args.argarray.argarray_len = 1;
+	args.argarray.argarray_val = &op;
+
+	CHECK(hold_queued_renewal(&args) == NULL, "unknown client held");
+	printf("ok   RENEW of an unknown client not held\n");
+}
+
+int main(void)
+{
+	if (sal_fixture_init("NFSv4 { Lease_Lifetime = 2; }") != 0) {
+		printf("FAIL: sal_fixture_init\n");
+		return 1;
+	}
+
+	renewed();
+	dropped();
+	sequence();
+	unknown();
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_lock_notify.c
+ * @brief CB_NOTIFY_LOCK to the NFSv4.1 owners waiting for a lock
+ *
+ * A directory is exported through FSAL_VFS behind the inode cache.
+ * One client write locks a range of a file in it, and two NFSv4.1
+ * clients are denied blocking locks on it in turn and wait, as
+ * nfs4_op_lock has them do with state_nfs4_lock_wait.  The callbacks
+ * the server makes are caught, by linking with
+ * --wrap=nfs_rpc_v41_single, instead of being sent:
+ *
+ * - Nobody is notified while the range is held.
+ * - On unlock the first waiter, and only it, is sent CB_NOTIFY_LOCK
+ *   naming its lock owner and the file handle it locked by.
+ * - While its reservation lasts the second waiter is denied, by the
+ *   first waiter's lock.
+ * - Once the reservation lapses unused, lock_reservation_expired
+ *   notifies the second waiter, which then gets its lock.
+ *
+ * Usage: test_lock_notify [directory]
+ * The export is made in a new directory in it, /tmp by default.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "nfs_core.h"
+#include "nfs_file_handle.h"
+#include "nfs_rpc_callback.h"
+#include "sal_fixture.h"
+#include "vfs_fixture.h"
+
+#define RESERVATION_MS 300
+#define WAIT_MS 2000
+#define MAX_NOTIFIES 16
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+struct notify {
+	clientid4 clientid;	/*< Client called */
+	nfs_opnum4 argop;
+	clientid4 owner_clientid;	/*< Lock owner named */
+	char owner[NFS4_OPAQUE_LIMIT];
+	unsigned int owner_len;
+	char fh[NFS4_FHSIZE];
+	unsigned int fh_len;
+};
+
+static pthread_mutex_t notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notify_cond = PTHREAD_COND_INITIALIZER;
+static struct notify notifies[MAX_NOTIFIES];
+static int nnotifies;
+
+static struct vfs_fixture fx;
+static nfs_fh4 fh4;
+
+int __wrap_nfs_rpc_v41_single(nfs_client_id_t *clientid, nfs_cb_argop4 *op,
+			      struct state_refer *refer,
+			      int32_t (*completion)(rpc_call_t *,
+						    rpc_call_hook, void *arg,
+						    uint32_t flags),
+			      void *completion_arg,
+			      void (*free_op)(nfs_cb_argop4 *op));
+
+/**
+ * @brief Record a callback rather than send it
+ *
+ * @return ENOTCONN, as for a client with no back channel, so that the
+ *         caller frees the call.
+ */
+
+int __wrap_nfs_rpc_v41_single(nfs_client_id_t *clientid, nfs_cb_argop4 *op,
+			      struct state_refer *refer,
+			      int32_t (*completion)(rpc_call_t *,
+						    rpc_call_hook, void *arg,
+						    uint32_t flags),
+			      void *completion_arg,
+			      void (*free_op)(nfs_cb_argop4 *op))
+{
+	CB_NOTIFY_LOCK4args *args = &op->nfs_cb_argop4_u.opcbnotify_lock;
+	struct notify *n;
+
+	PTHREAD_MUTEX_lock(&notify_mutex);
+	if (nnotifies < MAX_NOTIFIES) {
+		n = &notifies[nnotifies++];
+		memset(n, 0, sizeof(*n));
+		n->clientid = clientid->cid_clientid;
+		n->argop = op->argop;
+		if (op->argop == NFS4_OP_CB_NOTIFY_LOCK &&
+		    args->cnla_lock_owner.owner.owner_len <= sizeof(n->owner)
+		    && args->cnla_fh.nfs_fh4_len <= sizeof(n->fh)) {
+			n->owner_clientid = args->cnla_lock_owner.clientid;
+			n->owner_len = args->cnla_lock_owner.owner.owner_len;
+			memcpy(n->owner, args->cnla_lock_owner.owner.owner_val,
+			       n->owner_len);
+			n->fh_len = args->cnla_fh.nfs_fh4_len;
+			memcpy(n->fh, args->cnla_fh.nfs_fh4_val, n->fh_len);
+		}
+	}
+	pthread_cond_broadcast(&notify_cond);
+	PTHREAD_MUTEX_unlock(&notify_mutex);
+
+	return ENOTCONN;
+}
+
+static void forget_notifies(void)
+{
+	PTHREAD_MUTEX_lock(&notify_mutex);
+	nnotifies = 0;
+	PTHREAD_MUTEX_unlock(&notify_mutex);
+}
+
+/**
+ * @brief Wait for a callback to a client
+ *
+ * @param[in]  clientid Client
+ * @param[in]  ms       How long to wait
+ * @param[out] found    The callback, if one came
+ *
+ * @return true if one came.
+ */
+
+static bool wait_notify(nfs_client_id_t *clientid, int ms,
+			struct notify *found)
+{
+	struct timespec until;
+	bool got = false;
+	int i;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	timespec_add_nsecs(ms * NS_PER_MSEC, &until);
+
+	PTHREAD_MUTEX_lock(&notify_mutex);
+	while (!got) {
+		for (i = 0; i < nnotifies && !got; i++) {
+			if (notifies[i].clientid == clientid->cid_clientid) {
+				*found = notifies[i];
+				got = true;
+			}
+		}
+		if (!got && pthread_cond_timedwait(&notify_cond, &notify_mutex,
+						   &until) == ETIMEDOUT)
+			break;
+	}
+	PTHREAD_MUTEX_unlock(&notify_mutex);
+
+	return got;
+}
+
+/**
+ * @brief Check a callback is the CB_NOTIFY_LOCK an owner should get
+ */
+
+static bool notifies_owner(struct notify *n, state_owner_t *owner)
+{
+	return n->argop == NFS4_OP_CB_NOTIFY_LOCK &&
+	    n->owner_clientid == owner->so_owner.so_nfs4_owner.so_clientid &&
+	    n->owner_len == owner->so_owner_len &&
+	    memcmp(n->owner, owner->so_owner_val, n->owner_len) == 0 &&
+	    n->fh_len == fh4.nfs_fh4_len &&
+	    memcmp(n->fh, fh4.nfs_fh4_val, n->fh_len) == 0;
+}
+
+static void range(fsal_lock_param_t *lock)
+{
+	memset(lock, 0, sizeof(*lock));
+	lock->lock_type = FSAL_LOCK_W;
+	lock->lock_start = 0;
+	lock->lock_length = 100;
+}
+
+/**
+ * @brief Ask for the lock as a blocking LOCK would
+ *
+ * If denied, the owner waits for it as nfs4_op_lock has it do.
+ *
+ * @param[out] by Owner of the lock denying it, if any, referenced
+ */
+
+static state_status_t lock_or_wait(cache_entry_t *entry, state_t *state,
+				   state_owner_t **by)
+{
+	fsal_lock_param_t lock, conflict;
+	state_status_t status;
+
+	range(&lock);
+	*by = NULL;
+	status = state_lock(entry, state->state_owner, state,
+			    STATE_NFSV4_BLOCKING, NULL, &lock, by, &conflict);
+	if (status == STATE_LOCK_CONFLICT)
+		state_nfs4_lock_wait(entry, state->state_owner, &lock, &fh4);
+
+	return status;
+}
+
+static state_status_t unlock(cache_entry_t *entry, state_t *state)
+{
+	fsal_lock_param_t lock;
+
+	range(&lock);
+	return state_unlock(entry, state->state_owner, state, &lock);
+}
+
+static void run(cache_entry_t *entry, nfs_client_id_t *clients[3],
+		state_t *locks[3])
+{
+	state_t *holder = locks[0], *first = locks[1], *second = locks[2];
+	state_owner_t *by;
+	struct notify n;
+	int had = failures;
+
+	CHECK(lock_or_wait(entry, holder, &by) == STATE_SUCCESS,
+	      "holder could not lock");
+	CHECK(lock_or_wait(entry, first, &by) == STATE_LOCK_CONFLICT,
+	      "first waiter not denied");
+	if (by != NULL)
+		dec_state_owner_ref(by);
+	CHECK(lock_or_wait(entry, second, &by) == STATE_LOCK_CONFLICT,
+	      "second waiter not denied");
+	if (by != NULL)
+		dec_state_owner_ref(by);
+	CHECK(!wait_notify(clients[1], 200, &n) &&
+	      !wait_notify(clients[2], 0, &n),
+	      "waiter notified while the lock is held");
+	printf("%s  nobody notified while the lock is held\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(unlock(entry, holder) == STATE_SUCCESS, "could not unlock");
+	if (wait_notify(clients[1], WAIT_MS, &n))
+		CHECK(notifies_owner(&n, first->state_owner),
+		      "CB_NOTIFY_LOCK names the wrong owner or file");
+	else
+		CHECK(false, "first waiter not notified");
+	CHECK(!wait_notify(clients[2], 0, &n),
+	      "second waiter notified with the first");
+	printf("%s  unlock sends CB_NOTIFY_LOCK to the first waiter\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(lock_or_wait(entry, second, &by) == STATE_LOCK_CONFLICT,
+	      "second waiter not held back by the reservation");
+	CHECK(by == first->state_owner,
+	      "reservation not reported as the first waiter's lock");
+	if (by != NULL)
+		dec_state_owner_ref(by);
+	printf("%s  the reservation holds back the second waiter\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	forget_notifies();
+	if (wait_notify(clients[2], RESERVATION_MS + WAIT_MS, &n))
+		CHECK(notifies_owner(&n, second->state_owner),
+		      "CB_NOTIFY_LOCK names the wrong owner or file");
+	else
+		CHECK(false, "second waiter not notified on expiry");
+	CHECK(!wait_notify(clients[1], 0, &n),
+	      "first waiter notified again");
+	CHECK(lock_or_wait(entry, second, &by) == STATE_SUCCESS,
+	      "second waiter could not lock once notified");
+	if (by != NULL)
+		dec_state_owner_ref(by);
+	printf("%s  a lapsed reservation passes to the next waiter\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	forget_notifies();
+	CHECK(unlock(entry, second) == STATE_SUCCESS, "could not unlock");
+	CHECK(!wait_notify(clients[1], 200, &n),
+	      "lapsed waiter notified again");
+	printf("%s  waiters are forgotten once served or lapsed\n",
+	       failures != had ? "FAIL" : "ok  ");
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const names[3] = {
+		"notify holder", "notify first", "notify second"
+	};
+	const char *parent = argc > 1 ? argv[1] : "/tmp";
+	nfs_client_id_t *clients[3] = { NULL, NULL, NULL };
+	state_t *opens[3] = { NULL, NULL, NULL };
+	state_t *locks[3] = { NULL, NULL, NULL };
+	cache_entry_t *entry;
+	char dir[256], path[300], params[200];
+	int i, fd;
+
+	snprintf(dir, sizeof(dir), "%s/test_lock_notify.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	snprintf(params, sizeof(params),
+		 "NFSv4 { Lease_Lifetime = 60; Blocking_Lock_Notify = true; "
+		 "Blocking_Lock_Reservation = %d; }", RESERVATION_MS);
+
+	if (sal_fixture_init(params) != 0 ||
+	    state_async_init() != STATE_SUCCESS ||
+	    vfs_fixture_init(&fx, dir, NULL, NULL, NULL) != 0 ||
+	    vfs_fixture_cache(&fx) != 0 ||
+	    vfs_fixture_entry(&fx, "file", &entry) != CACHE_INODE_SUCCESS ||
+	    nfs4_AllocateFH(&fh4) != NFS4_OK ||
+	    !nfs4_FSALToFhandle(&fh4, entry->obj_handle, fx.export)) {
+		printf("FAIL: could not set up\n");
+		unlink(path);
+		rmdir(dir);
+		return 1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		clients[i] = sal_fixture_client(names[i], 1);
+		if (clients[i] != NULL)
+			opens[i] = sal_fixture_open(entry, clients[i], names[i],
+						    OPEN4_SHARE_ACCESS_BOTH,
+						    OPEN4_SHARE_DENY_NONE);
+		if (opens[i] != NULL)
+			locks[i] = sal_fixture_lock_state(entry, opens[i],
+							  names[i]);
+		CHECK(locks[i] != NULL, "could not set up %s", names[i]);
+	}
+
+	if (locks[0] != NULL && locks[1] != NULL && locks[2] != NULL)
+		run(entry, clients, locks);
+
+	for (i = 0; i < 3; i++) {
+		if (locks[i] != NULL)
+			dec_state_t_ref(locks[i]);
+		if (opens[i] != NULL)
+			dec_state_t_ref(opens[i]);
+		if (clients[i] != NULL)
+			dec_client_id_ref(clients[i]);
+	}
+
+	gsh_free(fh4.nfs_fh4_val);
+	cache_inode_put(entry);
+	vfs_fixture_fini(&fx);
+	unlink(path);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_mandatory_locks.c
+ * @brief READ and WRITE against the locks of other owners
+ *
+ * A directory is exported through FSAL_VFS behind the inode cache,
+ * with Mandatory_Locks set, and an NFSv4.0 client write locks bytes
+ * 0 to 99 of a file in it and read locks bytes 200 to 299.  READs
+ * and WRITEs are then run through nfs4_op_read, nfs4_op_write,
+ * nfs3_read and nfs3_write, as a compound or a request would:
+ *
+ * - The lock holder's own I/O, under its lock stateid or its open
+ *   stateid, passes everywhere.
+ * - Another client's NFSv4 I/O over the write lock, and its WRITEs
+ *   over the read lock, get NFS4ERR_LOCKED; its READs over the read
+ *   lock and its I/O beside the locks pass.
+ * - NFSv3 I/O, which has no owner, is refused the same ranges with
+ *   NFS3ERR_JUKEBOX.
+ * - With Mandatory_Locks off, nothing is refused.
+ *
+ * Usage: test_mandatory_locks [directory]
+ * The export is made in a new directory in it, /tmp by default.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "nfs_core.h"
+#include "nfs_exports.h"
+#include "nfs_file_handle.h"
+#include "nfs_proto_functions.h"
+#include "sal_fixture.h"
+#include "vfs_fixture.h"
+
+#define IO_SIZE 50
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static struct vfs_fixture fx;
+static nfs_fh3 fh3;
+static nfs_fh4 fh4;
+static char io_buf[IO_SIZE];
+
+static state_status_t lock_range(cache_entry_t *entry, state_t *state,
+				 fsal_lock_t type, uint64_t start,
+				 uint64_t length)
+{
+	fsal_lock_param_t lock, conflict;
+	state_owner_t *holder = NULL;
+	state_status_t status;
+
+	memset(&lock, 0, sizeof(lock));
+	lock.lock_type = type;
+	lock.lock_start = start;
+	lock.lock_length = length;
+
+	status = state_lock(entry, state->state_owner, state,
+			    STATE_NON_BLOCKING, NULL, &lock, &holder,
+			    &conflict);
+
+	if (holder != NULL)
+		dec_state_owner_ref(holder);
+
+	return status;
+}
+
+/**
+ * @brief Run a READ or WRITE as the only operation of a compound
+ */
+
+static nfsstat4 v4_io(cache_entry_t *entry, state_t *state, bool write,
+		      uint64_t offset)
+{
+	compound_data_t data;
+	nfs_argop4 op;
+	nfs_resop4 res;
+	nfsstat4 status;
+
+	memset(&data, 0, sizeof(data));
+	data.minorversion = 0;
+	data.currentFH = fh4;
+	data.current_entry = entry;
+	data.current_filetype = REGULAR_FILE;
+
+	memset(&op, 0, sizeof(op));
+	memset(&res, 0, sizeof(res));
+
+	if (write) {
+		op.argop = NFS4_OP_WRITE;
+		COPY_STATEID(&op.nfs_argop4_u.opwrite.stateid, state);
+		op.nfs_argop4_u.opwrite.offset = offset;
+		op.nfs_argop4_u.opwrite.stable = FILE_SYNC4;
+		op.nfs_argop4_u.opwrite.data.data_len = IO_SIZE;
+		op.nfs_argop4_u.opwrite.data.data_val = io_buf;
+		status = nfs4_op_write(&op, &data, &res);
+		nfs4_op_write_Free(&res);
+	} else {
+		op.argop = NFS4_OP_READ;
+		COPY_STATEID(&op.nfs_argop4_u.opread.stateid, state);
+		op.nfs_argop4_u.opread.offset = offset;
+		op.nfs_argop4_u.opread.count = IO_SIZE;
+		status = nfs4_op_read(&op, &data, &res);
+		nfs4_op_read_Free(&res);
+	}
+
+	/* Release the lease the stateid check reserved, as
+	 * nfs4_Compound does at the end.
+	 */
+	if (data.preserved_clientid != NULL) {
+		PTHREAD_MUTEX_lock(&data.preserved_clientid->cid_mutex);
+		update_lease(data.preserved_clientid);
+		PTHREAD_MUTEX_unlock(&data.preserved_clientid->cid_mutex);
+	}
+
+	return status;
+}
+
+/**
+ * @brief Run an NFSv3 READ or WRITE
+ */
+
+static nfsstat3 v3_io(bool write, uint64_t offset)
+{
+	struct svc_req req;
+	nfs_arg_t arg;
+	nfs_res_t res;
+	nfsstat3 status;
+
+	memset(&req, 0, sizeof(req));
+	req.rq_vers = NFS_V3;
+	memset(&arg, 0, sizeof(arg));
+	memset(&res, 0, sizeof(res));
+
+	if (write) {
+		arg.arg_write3.file = fh3;
+		arg.arg_write3.offset = offset;
+		arg.arg_write3.count = IO_SIZE;
+		arg.arg_write3.stable = FILE_SYNC;
+		arg.arg_write3.data.data_len = IO_SIZE;
+		arg.arg_write3.data.data_val = io_buf;
+		nfs3_write(&arg, &req, &res);
+		status = res.res_write3.status;
+		nfs3_write_free(&res);
+	} else {
+		arg.arg_read3.file = fh3;
+		arg.arg_read3.offset = offset;
+		arg.arg_read3.count = IO_SIZE;
+		nfs3_read(&arg, &req, &res);
+		status = res.res_read3.status;
+		nfs3_read_free(&res);
+	}
+
+	return status;
+}
+
+/**
+ * @brief The holder's own I/O is never refused
+ */
+
+static void own_io(cache_entry_t *entry, state_t *open_state,
+		   state_t *lock_state)
+{
+	uint64_t offset;
+
+	for (offset = 0; offset < 300; offset += 100) {
+		CHECK(v4_io(entry, lock_state, false, offset) == NFS4_OK,
+		      "holder's READ at %" PRIu64 " refused", offset);
+		CHECK(v4_io(entry, lock_state, true, offset) == NFS4_OK,
+		      "holder's WRITE at %" PRIu64 " refused", offset);
+		CHECK(v4_io(entry, open_state, false, offset) == NFS4_OK,
+		      "holder's open READ at %" PRIu64 " refused", offset);
+		CHECK(v4_io(entry, open_state, true, offset) == NFS4_OK,
+		      "holder's open WRITE at %" PRIu64 " refused", offset);
+	}
+	printf("ok   holder's own I/O passes\n");
+}
+
+/**
+ * @brief Another owner's I/O is refused where it conflicts
+ */
+
+static void foreign_io(cache_entry_t *entry, state_t *other)
+{
+	CHECK(v4_io(entry, other, false, 50) == NFS4ERR_LOCKED,
+	      "READ over a write lock not refused");
+	CHECK(v4_io(entry, other, true, 50) == NFS4ERR_LOCKED,
+	      "WRITE over a write lock not refused");
+	CHECK(v4_io(entry, other, false, 80) == NFS4ERR_LOCKED,
+	      "READ straddling a write lock not refused");
+	CHECK(v4_io(entry, other, true, 220) == NFS4ERR_LOCKED,
+	      "WRITE over a read lock not refused");
+	CHECK(v4_io(entry, other, false, 220) == NFS4_OK,
+	      "READ over a read lock refused");
+	CHECK(v4_io(entry, other, false, 100) == NFS4_OK,
+	      "READ beside the locks refused");
+	CHECK(v4_io(entry, other, true, 100) == NFS4_OK,
+	      "WRITE beside the locks refused");
+	printf("ok   other client's NFSv4 I/O refused with NFS4ERR_LOCKED\n");
+
+	CHECK(v3_io(false, 50) == NFS3ERR_JUKEBOX,
+	      "NFSv3 READ over a write lock not refused");
+	CHECK(v3_io(true, 50) == NFS3ERR_JUKEBOX,
+	      "NFSv3 WRITE over a write lock not refused");
+	CHECK(v3_io(true, 220) == NFS3ERR_JUKEBOX,
+	      "NFSv3 WRITE over a read lock not refused");
+	CHECK(v3_io(false, 220) == NFS3_OK,
+	      "NFSv3 READ over a read lock refused");
+	CHECK(v3_io(true, 100) == NFS3_OK,
+	      "NFSv3 WRITE beside the locks refused");
+	printf("ok   NFSv3 I/O refused with NFS3ERR_JUKEBOX\n");
+
+	fx.export->options &= ~EXPORT_OPTION_MANDATORY_LOCKS;
+	CHECK(v4_io(entry, other, true, 50) == NFS4_OK,
+	      "WRITE refused without Mandatory_Locks");
+	CHECK(v3_io(true, 50) == NFS3_OK,
+	      "NFSv3 WRITE refused without Mandatory_Locks");
+	fx.export->options |= EXPORT_OPTION_MANDATORY_LOCKS;
+	printf("ok   nothing refused without Mandatory_Locks\n");
+}
+
+static void run(cache_entry_t *entry)
+{
+	nfs_client_id_t *holder, *other;
+	state_t *open_state = NULL, *lock_state = NULL, *other_open = NULL;
+	fsal_lock_param_t all;
+
+	holder = sal_fixture_client("mandatory holder", 0);
+	other = sal_fixture_client("mandatory other", 0);
+	CHECK(holder != NULL && other != NULL, "no clients");
+	if (holder == NULL || other == NULL)
+		return;
+
+	open_state = sal_fixture_open(entry, holder, "holder",
+				      OPEN4_SHARE_ACCESS_BOTH,
+				      OPEN4_SHARE_DENY_NONE);
+	lock_state = open_state != NULL ?
+	    sal_fixture_lock_state(entry, open_state, "holder") : NULL;
+	other_open = sal_fixture_open(entry, other, "other",
+				      OPEN4_SHARE_ACCESS_BOTH,
+				      OPEN4_SHARE_DENY_NONE);
+	CHECK(lock_state != NULL && other_open != NULL, "could not open");
+	if (lock_state == NULL || other_open == NULL)
+		goto out;
+
+	/* As OPEN_CONFIRM would */
+	open_state->state_owner->so_owner.so_nfs4_owner.so_confirmed = true;
+	other_open->state_owner->so_owner.so_nfs4_owner.so_confirmed = true;
+
+	CHECK(lock_range(entry, lock_state, FSAL_LOCK_W, 0, 100) ==
+	      STATE_SUCCESS, "could not write lock");
+	CHECK(lock_range(entry, lock_state, FSAL_LOCK_R, 200, 100) ==
+	      STATE_SUCCESS, "could not read lock");
+
+	own_io(entry, open_state, lock_state);
+	foreign_io(entry, other_open);
+
+	memset(&all, 0, sizeof(all));
+	all.lock_type = FSAL_LOCK_W;
+	CHECK(state_unlock(entry, lock_state->state_owner, lock_state,
+			   &all) == STATE_SUCCESS, "could not unlock");
+
+	CHECK(v4_io(entry, other_open, true, 50) == NFS4_OK,
+	      "WRITE refused once unlocked");
+	CHECK(v3_io(true, 50) == NFS3_OK,
+	      "NFSv3 WRITE refused once unlocked");
+	printf("ok   nothing refused once unlocked\n");
+
+ out:
+	if (lock_state != NULL)
+		dec_state_t_ref(lock_state);
+	if (open_state != NULL)
+		dec_state_t_ref(open_state);
+	if (other_open != NULL)
+		dec_state_t_ref(other_open);
+	dec_client_id_ref(holder);
+	dec_client_id_ref(other);
+}
+
+int main(int argc, char **argv)
+{
+	const char *parent = argc > 1 ? argv[1] : "/tmp";
+	cache_entry_t *entry;
+	char dir[256], path[300];
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s/test_mandatory_locks.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, 400) != 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	memset(io_buf, 'm', sizeof(io_buf));
+
+	if (sal_fixture_init("NFSv4 { Lease_Lifetime = 60; }") != 0 ||
+	    vfs_fixture_init(&fx, dir, NULL, NULL, NULL) != 0 ||
+	    vfs_fixture_cache(&fx) != 0 ||
+	    vfs_fixture_entry(&fx, "file", &entry) != CACHE_INODE_SUCCESS ||
+	    nfs3_AllocateFH(&fh3) != NFS3_OK ||
+	    nfs4_AllocateFH(&fh4) != NFS4_OK ||
+	    !nfs3_FSALToFhandle(&fh3, entry->obj_handle, fx.export) ||
+	    !nfs4_FSALToFhandle(&fh4, entry->obj_handle, fx.export)) {
+		printf("FAIL: could not set up\n");
+		unlink(path);
+		rmdir(dir);
+		return 1;
+	}
+
+	/* As the export's configuration would set them */
+	fx.export->options |= EXPORT_OPTION_MANDATORY_LOCKS;
+	fx.export->MaxRead = fx.export->MaxWrite = 1024 * 1024;
+	fx.export->MaxOffsetRead = fx.export->MaxOffsetWrite = UINT64_MAX;
+
+	run(entry);
+
+	gsh_free(fh3.data.data_val);
+	gsh_free(fh4.nfs_fh4_val);
+	cache_inode_put(entry);
+	vfs_fixture_fini(&fx);
+	unlink(path);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
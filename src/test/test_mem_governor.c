@@ -0,0 +1,243 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_mem_governor.c
+ * @brief Spreading reclaim across fake caches
+ *
+ * Four fake consumers are registered: two that hold memory above their
+ * floor, with weights 100 and 300, one with weight 0 and one below its
+ * floor.  mem_governor_reclaim must ask the first two for shares of
+ * the bytes in proportion to weight times what they hold above their
+ * floor, never more than that, leave their budgets at what they hold
+ * less what they were asked, and ask the others for nothing.
+ *
+ * The first consumer registers another one from its reclaim callback,
+ * which deadlocks if the governor calls consumers with its mutex held.
+ *
+ * The governor is then started with a Memory_Limit of one byte, so its
+ * own pass, every second, must ask each consumer for all it holds
+ * above its floor.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "abstract_atomic.h"
+#include "mem_governor.h"
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+/* What each fake holds, and what it was last asked for */
+static uint64_t held_a = 1000000, asked_a;
+static uint64_t held_b = 600000, asked_b;
+static uint64_t held_c = 5000000, asked_c;
+static uint64_t held_d = 100000, asked_d;
+static uint64_t held_late, asked_late;
+
+static uint64_t usage_a(void) { return held_a; }
+static uint64_t usage_b(void) { return held_b; }
+static uint64_t usage_c(void) { return held_c; }
+static uint64_t usage_d(void) { return held_d; }
+static uint64_t usage_late(void) { return held_late; }
+
+static struct mem_gov_consumer late;
+
+static uint64_t reclaim_a(uint64_t bytes)
+{
+	static bool registered;
+
+	if (!registered) {
+		registered = true;
+		mem_governor_register(&late);
+	}
+	atomic_store_uint64_t(&asked_a, bytes);
+	return bytes;
+}
+
+static uint64_t reclaim_b(uint64_t bytes)
+{
+	atomic_store_uint64_t(&asked_b, bytes);
+	return bytes;
+}
+
+static uint64_t reclaim_c(uint64_t bytes)
+{
+	atomic_store_uint64_t(&asked_c, bytes);
+	return bytes;
+}
+
+static uint64_t reclaim_d(uint64_t bytes)
+{
+	atomic_store_uint64_t(&asked_d, bytes);
+	return bytes;
+}
+
+static uint64_t reclaim_late(uint64_t bytes)
+{
+	atomic_store_uint64_t(&asked_late, bytes);
+	return 0;
+}
+
+static struct mem_gov_consumer fake_a = {
+	.name = "fake A", .weight = 100, .floor = 0,
+	.usage = usage_a, .reclaim = reclaim_a
+};
+
+static struct mem_gov_consumer fake_b = {
+	.name = "fake B", .weight = 300, .floor = 200000,
+	.usage = usage_b, .reclaim = reclaim_b
+};
+
+static struct mem_gov_consumer fake_c = {
+	.name = "fake C", .weight = 0, .floor = 0,
+	.usage = usage_c, .reclaim = reclaim_c
+};
+
+static struct mem_gov_consumer fake_d = {
+	.name = "fake D", .weight = 100, .floor = 200000,
+	.usage = usage_d, .reclaim = reclaim_d
+};
+
+static struct mem_gov_consumer late = {
+	.name = "late", .weight = 100, .floor = 0,
+	.usage = usage_late, .reclaim = reclaim_late
+};
+
+/**
+ * @brief Whether a share is what was expected, give or take rounding
+ */
+
+static bool near(uint64_t got, uint64_t want)
+{
+	return got + 1 >= want && got <= want + 1;
+}
+
+static void reset(void)
+{
+	asked_a = asked_b = asked_c = asked_d = asked_late = 0;
+}
+
+static void shares(void)
+{
+	uint64_t freed;
+
+	/* A has 100 * 1000000 to give, B 300 * 400000: 100:120 */
+	reset();
+	freed = mem_governor_reclaim(220000);
+	printf("220000 wanted: A asked %" PRIu64 ", B %" PRIu64
+	       ", freed %" PRIu64 "\n", asked_a, asked_b, freed);
+	CHECK(near(asked_a, 100000), "A asked for %" PRIu64, asked_a);
+	CHECK(near(asked_b, 120000), "B asked for %" PRIu64, asked_b);
+	CHECK(asked_c == 0, "weight 0 asked for %" PRIu64, asked_c);
+	CHECK(asked_d == 0, "below floor asked for %" PRIu64, asked_d);
+	CHECK(freed == asked_a + asked_b, "freed %" PRIu64, freed);
+	CHECK(mem_gov_budget(&fake_a) == held_a - asked_a,
+	      "A budget %" PRIu64, mem_gov_budget(&fake_a));
+	CHECK(mem_gov_budget(&fake_b) == held_b - asked_b,
+	      "B budget %" PRIu64, mem_gov_budget(&fake_b));
+	CHECK(mem_gov_budget(&fake_c) == MEM_GOV_UNLIMITED,
+	      "weight 0 budget %" PRIu64, mem_gov_budget(&fake_c));
+
+	/* More than all of it: nobody goes below their floor */
+	reset();
+	freed = mem_governor_reclaim(100000000);
+	printf("100000000 wanted: A asked %" PRIu64 ", B %" PRIu64
+	       ", freed %" PRIu64 "\n", asked_a, asked_b, freed);
+	CHECK(asked_a == held_a, "A asked for %" PRIu64, asked_a);
+	CHECK(asked_b == held_b - fake_b.floor, "B asked for %" PRIu64,
+	      asked_b);
+	CHECK(mem_gov_budget(&fake_b) == fake_b.floor, "B budget %" PRIu64,
+	      mem_gov_budget(&fake_b));
+	CHECK(asked_c == 0 && asked_d == 0, "C or D asked");
+
+	/* Registered from A's callback, so only seen by later passes */
+	CHECK(asked_late == 0, "late consumer asked in the pass adding it");
+	held_late = 1000000;
+	reset();
+	(void) mem_governor_reclaim(300000);
+	printf("300000 wanted with late: A asked %" PRIu64 ", late %" PRIu64
+	       "\n", asked_a, asked_late);
+	CHECK(asked_late != 0, "late consumer never asked");
+
+	held_late = 0;
+}
+
+static void governor(void)
+{
+	int i;
+
+	reset();
+	mem_gov_param.enable = true;
+	mem_gov_param.interval = 1;
+	mem_gov_param.memory_limit = 1;
+	mem_gov_param.high_water_pct = 90;
+	mem_gov_param.low_water_pct = 80;
+	mem_gov_param.psi_threshold = 0;
+
+	CHECK(mem_governor_init() == 0, "mem_governor_init");
+	for (i = 0; i < 50 && atomic_fetch_uint64_t(&asked_b) == 0; i++)
+		usleep(100000);
+	CHECK(mem_governor_shutdown() == 0, "mem_governor_shutdown");
+
+	printf("Governor pass: A asked %" PRIu64 ", B %" PRIu64 "\n",
+	       asked_a, asked_b);
+	CHECK(asked_a == held_a, "governor asked A for %" PRIu64, asked_a);
+	CHECK(asked_b == held_b - fake_b.floor,
+	      "governor asked B for %" PRIu64, asked_b);
+	CHECK(asked_c == 0 && asked_d == 0, "governor asked C or D");
+}
+
+int main(void)
+{
+	/* A pass still holding the governor's mutex never returns */
+	alarm(60);
+
+	mem_governor_register(&fake_a);
+	mem_governor_register(&fake_b);
+	mem_governor_register(&fake_c);
+	mem_governor_register(&fake_d);
+
+	shares();
+	governor();
+
+	mem_governor_unregister(&late);
+	mem_governor_unregister(&fake_d);
+	mem_governor_unregister(&fake_c);
+	mem_governor_unregister(&fake_b);
+	mem_governor_unregister(&fake_a);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
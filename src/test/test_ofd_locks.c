@@ -0,0 +1,394 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_ofd_locks.c
+ * @brief Owner-aware locking through FSAL_VFS with ofd_locks
+ *
+ * Two lock owners lock a file on an FSAL_VFS export through
+ * vfs_lock_op, as SAL would: a conflict is reported with the holder's
+ * range, a blocking lock is queued and granted through the lock_grant
+ * upcall as soon as the holder unlocks, a cancelled one is never
+ * granted, and one blocked by a local process is granted by the
+ * periodic retry once that process unlocks.  An owner at the address
+ * of a finished owner is not given its locks, and every owner's
+ * description is closed once it holds nothing.
+ *
+ * Must run as root.  Usage: test_ofd_locks [directory]
+ * The directory defaults to /dev/shm, which is tmpfs.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "fsal.h"
+#include "fsal_up.h"
+#include "vfs_fixture.h"
+
+#define RETRY_MS 50
+
+static struct vfs_fixture fx;
+static int failures;
+
+/* Lock owners, as far as the FSAL can tell */
+static char owner_a, owner_b;
+#define ID_A 1
+#define ID_B 2
+#define ID_A2 3			/* A later owner at owner_a's address */
+
+static pthread_mutex_t grant_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t grant_cond = PTHREAD_COND_INITIALIZER;
+static int grants;
+static void *grant_owner;
+static fsal_lock_param_t grant_lock;
+
+static state_status_t test_lock_grant(struct fsal_module *fsal,
+				      struct gsh_buffdesc *file,
+				      void *owner,
+				      fsal_lock_param_t *lock_param)
+{
+	pthread_mutex_lock(&grant_mutex);
+	grants++;
+	grant_owner = owner;
+	grant_lock = *lock_param;
+	pthread_cond_broadcast(&grant_cond);
+	pthread_mutex_unlock(&grant_mutex);
+	return STATE_SUCCESS;
+}
+
+static state_status_t test_lock_avail(struct fsal_module *fsal,
+				      struct gsh_buffdesc *file,
+				      void *owner,
+				      fsal_lock_param_t *lock_param)
+{
+	printf("FAIL: lock_avail upcall, the retry failed\n");
+	failures++;
+	return STATE_SUCCESS;
+}
+
+static struct fsal_up_vector test_up_ops = {
+	.lock_grant = test_lock_grant,
+	.lock_avail = test_lock_avail,
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Wait for a grant
+ *
+ * @return Milliseconds it took, or -1 if none came within timeout_ms.
+ */
+
+static int wait_grant(int had, int timeout_ms)
+{
+	uint64_t start = now_ms();
+	struct timespec until;
+	int waited = -1;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += timeout_ms / 1000;
+	until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&grant_mutex);
+	while (grants == had &&
+	       pthread_cond_timedwait(&grant_cond, &grant_mutex, &until) == 0)
+		;
+	if (grants != had)
+		waited = now_ms() - start;
+	pthread_mutex_unlock(&grant_mutex);
+	return waited;
+}
+
+static fsal_status_t lock_op(struct fsal_obj_handle *obj, void *owner,
+			     uint64_t owner_id, fsal_lock_op_t op,
+			     fsal_lock_t type, uint64_t start, uint64_t len,
+			     fsal_lock_param_t *conflict)
+{
+	fsal_lock_param_t lock;
+
+	memset(&lock, 0, sizeof(lock));
+	lock.lock_sle_type = FSAL_POSIX_LOCK;
+	lock.lock_type = type;
+	lock.lock_start = start;
+	lock.lock_length = len;
+	lock.lock_owner_id = owner_id;
+	if (conflict != NULL)
+		memset(conflict, 0, sizeof(*conflict));
+
+	return obj->obj_ops.lock_op(obj, owner, op, &lock, conflict);
+}
+
+static void expect(const char *what, fsal_status_t status,
+		   fsal_errors_t want)
+{
+	if (status.major != want) {
+		printf("FAIL %s: %s, expected %s\n", what,
+		       msg_fsal_err(status.major), msg_fsal_err(want));
+		failures++;
+	} else {
+		printf("ok   %s\n", what);
+	}
+}
+
+static void expect_denied(const char *what, fsal_status_t status,
+			  fsal_lock_param_t *conflict, uint64_t start,
+			  uint64_t len)
+{
+	if (status.major == ERR_FSAL_NO_ERROR) {
+		printf("FAIL %s: granted\n", what);
+		failures++;
+	} else if (conflict->lock_type != FSAL_LOCK_W ||
+		   conflict->lock_start != start ||
+		   conflict->lock_length != len) {
+		printf("FAIL %s: conflict %d %" PRIu64 "+%" PRIu64
+		       ", expected W %" PRIu64 "+%" PRIu64 "\n", what,
+		       conflict->lock_type, conflict->lock_start,
+		       conflict->lock_length, start, len);
+		failures++;
+	} else {
+		printf("ok   %s\n", what);
+	}
+}
+
+static int count_fds(void)
+{
+	DIR *d = opendir("/proc/self/fd");
+	struct dirent *de;
+	int n = 0;
+
+	if (d == NULL)
+		return -1;
+	while ((de = readdir(d)) != NULL)
+		if (de->d_name[0] != '.')
+			n++;
+	closedir(d);
+	return n;
+}
+
+static void run(struct fsal_obj_handle *obj, const char *path)
+{
+	fsal_lock_param_t conflict;
+	struct flock local;
+	int had, waited, fds, local_fd;
+
+	fds = count_fds();
+
+	/* Conflicts between owners */
+	expect("A locks 0+100",
+	       lock_op(obj, &owner_a, ID_A, FSAL_OP_LOCK, FSAL_LOCK_W,
+		       0, 100, NULL), ERR_FSAL_NO_ERROR);
+	expect("A tests its own range",
+	       lock_op(obj, &owner_a, ID_A, FSAL_OP_LOCKT, FSAL_LOCK_W,
+		       0, 100, &conflict), ERR_FSAL_NO_ERROR);
+	if (conflict.lock_type != FSAL_NO_LOCK) {
+		printf("FAIL A conflicts with itself\n");
+		failures++;
+	}
+	lock_op(obj, &owner_b, ID_B, FSAL_OP_LOCKT, FSAL_LOCK_W, 50, 10,
+		&conflict);
+	if (conflict.lock_type != FSAL_LOCK_W || conflict.lock_start != 0 ||
+	    conflict.lock_length != 100) {
+		printf("FAIL B's test does not see A's lock\n");
+		failures++;
+	} else {
+		printf("ok   B's test sees A's lock\n");
+	}
+	expect_denied("B is denied 50+10",
+		      lock_op(obj, &owner_b, ID_B, FSAL_OP_LOCK,
+			      FSAL_LOCK_W, 50, 10, &conflict),
+		      &conflict, 0, 100);
+	expect_denied("A later owner at A's address is denied 50+10",
+		      lock_op(obj, &owner_a, ID_A2, FSAL_OP_LOCK,
+			      FSAL_LOCK_W, 50, 10, &conflict),
+		      &conflict, 0, 100);
+
+	/* Block, and grant on unlock */
+	had = grants;
+	expect("B blocks on 50+10",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_LOCKB, FSAL_LOCK_W,
+		       50, 10, NULL), ERR_FSAL_BLOCKED);
+	if (wait_grant(had, 2 * RETRY_MS) >= 0) {
+		printf("FAIL B granted while A holds the range\n");
+		failures++;
+	}
+	expect("A unlocks 0+100",
+	       lock_op(obj, &owner_a, ID_A, FSAL_OP_UNLOCK, FSAL_LOCK_W,
+		       0, 100, NULL), ERR_FSAL_NO_ERROR);
+	waited = wait_grant(had, 5000);
+	if (waited < 0 || grant_owner != &owner_b ||
+	    grant_lock.lock_start != 50 || grant_lock.lock_length != 10) {
+		printf("FAIL B not granted 50+10 on A's unlock\n");
+		failures++;
+	} else {
+		printf("ok   B granted %d ms after A's unlock\n", waited);
+	}
+	expect_denied("A is denied B's granted range",
+		      lock_op(obj, &owner_a, ID_A, FSAL_OP_LOCK,
+			      FSAL_LOCK_W, 55, 1, &conflict),
+		      &conflict, 50, 10);
+
+	/* Cancel */
+	had = grants;
+	expect("A blocks on 55+1",
+	       lock_op(obj, &owner_a, ID_A, FSAL_OP_LOCKB, FSAL_LOCK_W,
+		       55, 1, NULL), ERR_FSAL_BLOCKED);
+	expect("A cancels",
+	       lock_op(obj, &owner_a, ID_A, FSAL_OP_CANCEL, FSAL_LOCK_W,
+		       55, 1, NULL), ERR_FSAL_NO_ERROR);
+	expect("A cancels again",
+	       lock_op(obj, &owner_a, ID_A, FSAL_OP_CANCEL, FSAL_LOCK_W,
+		       55, 1, NULL), ERR_FSAL_NOENT);
+	expect("B unlocks 50+10",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_UNLOCK, FSAL_LOCK_W,
+		       50, 10, NULL), ERR_FSAL_NO_ERROR);
+	if (wait_grant(had, 4 * RETRY_MS) >= 0) {
+		printf("FAIL cancelled lock granted\n");
+		failures++;
+	} else {
+		printf("ok   cancelled lock not granted\n");
+	}
+
+	/* A conflict held by a local process is found gone by retrying */
+	local_fd = open(path, O_RDWR);
+	memset(&local, 0, sizeof(local));
+	local.l_type = F_WRLCK;
+	local.l_whence = SEEK_SET;
+	local.l_start = 200;
+	local.l_len = 10;
+	if (local_fd < 0 || fcntl(local_fd, F_OFD_SETLK, &local) != 0) {
+		printf("FAIL local lock: %s\n", strerror(errno));
+		failures++;
+		return;
+	}
+	had = grants;
+	expect("B blocks on a local lock",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_LOCKB, FSAL_LOCK_R,
+		       205, 1, NULL), ERR_FSAL_BLOCKED);
+	close(local_fd);
+	waited = wait_grant(had, 5000);
+	if (waited < 0) {
+		printf("FAIL B not granted once the local lock went\n");
+		failures++;
+	} else {
+		printf("ok   B granted %d ms after the local unlock (retry every %d ms)\n",
+		       waited, RETRY_MS);
+	}
+
+	/* Partial unlocks keep the description, the last one closes it */
+	expect("B locks 300+100",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_LOCK, FSAL_LOCK_R,
+		       300, 100, NULL), ERR_FSAL_NO_ERROR);
+	expect("B unlocks 205+1",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_UNLOCK, FSAL_LOCK_R,
+		       205, 1, NULL), ERR_FSAL_NO_ERROR);
+	expect("B unlocks 320+10",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_UNLOCK, FSAL_LOCK_R,
+		       320, 10, NULL), ERR_FSAL_NO_ERROR);
+	expect_denied("A is denied what B still holds",
+		      lock_op(obj, &owner_a, ID_A, FSAL_OP_LOCK,
+			      FSAL_LOCK_W, 390, 1, &conflict),
+		      &conflict, 330, 70);
+	if (count_fds() != fds + 1) {
+		printf("FAIL %d descriptions open while B holds a lock, expected 1\n",
+		       count_fds() - fds);
+		failures++;
+	}
+	expect("B unlocks 300+100",
+	       lock_op(obj, &owner_b, ID_B, FSAL_OP_UNLOCK, FSAL_LOCK_R,
+		       300, 100, NULL), ERR_FSAL_NO_ERROR);
+	if (count_fds() != fds) {
+		printf("FAIL %d descriptions left open once nothing is held\n",
+		       count_fds() - fds);
+		failures++;
+	} else {
+		printf("ok   descriptions closed once nothing is held\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "/dev/shm";
+	char name[64], path[4200];
+	struct fsal_obj_handle *obj;
+	fsal_status_t status;
+	int fd, rc;
+
+	if (geteuid() != 0) {
+		printf("SKIP: open_by_handle_at needs root\n");
+		return 0;
+	}
+
+	snprintf(name, sizeof(name), "test_ofd_locks.%d", getpid());
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror(path);
+		return 2;
+	}
+	close(fd);
+
+	rc = vfs_fixture_init(&fx, dir,
+			      "ofd_locks = true; ofd_retry_ms = 50;",
+			      NULL, &test_up_ops);
+	if (rc != 0) {
+		printf("SKIP: cannot export %s: %s\n", dir, strerror(rc));
+		unlink(path);
+		return 0;
+	}
+
+	status = vfs_fixture_lookup(&fx, name, &obj);
+	if (!FSAL_IS_ERROR(status))
+		status = obj->obj_ops.open(obj, FSAL_O_RDWR);
+	if (FSAL_IS_ERROR(status)) {
+		printf("FAIL open %s: %s\n", path,
+		       msg_fsal_err(status.major));
+		failures++;
+	} else {
+		run(obj, path);
+		obj->obj_ops.close(obj);
+		obj->obj_ops.release(obj);
+	}
+
+	vfs_fixture_fini(&fx);
+	unlink(path);
+
+	printf("%s\n", failures ? "FAIL" : "PASS");
+	return failures != 0;
+}
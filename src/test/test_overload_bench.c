@@ -0,0 +1,363 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_overload_bench.c
+ * @brief Goodput of a saturated server whose clients retransmit
+ *
+ * Mounts an export of a running ganesha over NFSv3 and has every one
+ * of many TCP connections keep a window of GETATTRs of its root
+ * outstanding, more than the server can keep up with.  Like a real
+ * client, a connection sends a call again, with the same xid, once
+ * it has waited longer than the retransmit timeout, and takes
+ * whichever reply comes first.
+ *
+ * Reported are the calls answered within the timeout per second (the
+ * goodput), those answered only after being retransmitted, the
+ * retransmissions, the replies to calls already answered (work the
+ * server did twice) and the server's CPU time per answered call.
+ *
+ * Run it once with Queue_Deadline_NFSv3 = 0 in NFS_Core_Param and
+ * once with the deadline at or below the timeout used here.  Without
+ * shedding the workers spend themselves on calls already given up
+ * on; with it, stale calls are dropped unexecuted and the goodput
+ * holds up.  Few worker threads (Nb_Worker) make saturation easy to
+ * reach.
+ *
+ * Usage: test_overload_bench server-pid path [connections [depth
+ *        [timeout-ms [seconds [port]]]]]
+ *
+ * The server is reached at 127.0.0.1, port 2049 by default, for both
+ * MOUNT and NFS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "rpc_bench.h"
+
+#define NFS_PROGRAM 100003
+#define NFS_V3 3
+#define MOUNT_PROGRAM 100005
+#define MOUNT_V3 3
+
+#define NFSPROC3_GETATTR 1
+#define MOUNTPROC3_MNT 1
+
+#define FH_MAX 64
+#define BUF_LEN (8 * 1024)
+#define MAX_DEPTH 256
+
+struct call {
+	uint32_t xid;
+	uint64_t first;		/*< When first sent */
+	uint64_t sent;		/*< When last sent */
+	bool busy;
+};
+
+struct conn {
+	pthread_t thr;
+	int fd;
+	uint32_t next_xid;
+	struct call calls[MAX_DEPTH];
+	uint64_t good;		/*< Answered within the timeout */
+	uint64_t late;		/*< Answered after a retransmission */
+	uint64_t retransmits;
+	uint64_t duplicates;	/*< Replies to calls already answered */
+	uint64_t latency_ns;
+	int failures;
+};
+
+static int nconns = 64;
+static int depth = 32;
+static uint64_t timeout_ns = 1000 * 1000000ULL;
+static int port = 2049;
+static pid_t server;
+static volatile bool running = true;
+
+static unsigned char root_fh[FH_MAX];
+static uint32_t root_fh_len;
+
+/**
+ * @brief Get the root handle of an export with MOUNT v3
+ */
+
+static bool mount_export(const char *path)
+{
+	unsigned char buf[BUF_LEN];
+	struct xdr x = { buf, buf + BUF_LEN };
+	uint32_t status;
+	int fd = connect_one(port);
+	bool ok;
+
+	if (fd < 0) {
+		fprintf(stderr, "connect: %s\n", strerror(errno));
+		return false;
+	}
+
+	rpc_header(&x, 1, MOUNT_PROGRAM, MOUNT_V3, MOUNTPROC3_MNT);
+	put_opaque(&x, path, strlen(path));
+
+	ok = rpc_call(fd, buf, BUF_LEN, &x) && get_u32(&x, &status);
+	if (!ok)
+		fprintf(stderr, "MNT %s: RPC failed\n", path);
+	else if (status != 0)
+		fprintf(stderr, "MNT %s: status %u\n", path, status);
+	ok = ok && status == 0 &&
+	    get_opaque(&x, root_fh, FH_MAX, &root_fh_len);
+	close(fd);
+
+	return ok;
+}
+
+static bool send_getattr(int fd, uint32_t xid)
+{
+	unsigned char buf[256];
+	struct xdr x = { buf, buf + sizeof(buf) };
+	uint32_t len, mark;
+
+	rpc_header(&x, xid, NFS_PROGRAM, NFS_V3, NFSPROC3_GETATTR);
+	put_opaque(&x, root_fh, root_fh_len);
+
+	len = x.p - buf - 4;
+	mark = htonl(0x80000000 | len);
+	memcpy(buf, &mark, 4);
+
+	return write(fd, buf, len + 4) == len + 4;
+}
+
+/**
+ * @brief Read one reply, returning its xid
+ */
+
+static bool read_reply(int fd, uint32_t *xid)
+{
+	unsigned char buf[BUF_LEN];
+	uint32_t mark, len, total = 0;
+	bool last = false;
+
+	while (!last) {
+		if (read_full(fd, &mark, 4) != 0)
+			return false;
+		mark = ntohl(mark);
+		last = (mark & 0x80000000) != 0;
+		len = mark & 0x7fffffff;
+		if (total + len > BUF_LEN ||
+		    read_full(fd, buf + total, len) != 0)
+			return false;
+		total += len;
+	}
+
+	if (total < 4)
+		return false;
+	memcpy(xid, buf, 4);
+	*xid = ntohl(*xid);
+	return true;
+}
+
+static void answered(struct conn *c, uint32_t xid)
+{
+	struct call *call;
+	uint64_t now = now_ns();
+	int i;
+
+	for (i = 0; i < depth; i++) {
+		call = &c->calls[i];
+		if (!call->busy || call->xid != xid)
+			continue;
+
+		if (now - call->first <= timeout_ns)
+			c->good++;
+		else
+			c->late++;
+		c->latency_ns += now - call->first;
+		call->busy = false;
+		return;
+	}
+
+	c->duplicates++;
+}
+
+/**
+ * @brief Keep a window of calls outstanding until told to stop
+ */
+
+static void *client(void *arg)
+{
+	struct conn *c = arg;
+	struct pollfd pfd = { c->fd, POLLIN, 0 };
+	struct call *call;
+	uint32_t xid;
+	uint64_t now;
+	int i;
+
+	while (running) {
+		now = now_ns();
+
+		for (i = 0; i < depth; i++) {
+			call = &c->calls[i];
+			if (!call->busy) {
+				call->xid = c->next_xid++;
+				call->first = now;
+			} else if (now - call->sent > timeout_ns) {
+				c->retransmits++;
+			} else {
+				continue;
+			}
+			call->busy = true;
+			call->sent = now;
+			if (!send_getattr(c->fd, call->xid)) {
+				c->failures++;
+				return NULL;
+			}
+		}
+
+		if (poll(&pfd, 1, 10) < 0) {
+			c->failures++;
+			return NULL;
+		}
+
+		while (pfd.revents & POLLIN) {
+			if (!read_reply(c->fd, &xid)) {
+				c->failures++;
+				return NULL;
+			}
+			answered(c, xid);
+			if (poll(&pfd, 1, 0) <= 0)
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct conn *conns;
+	struct server_usage before, after;
+	uint64_t start, good = 0, late = 0, retransmits = 0;
+	uint64_t duplicates = 0, latency_ns = 0, answers;
+	double elapsed;
+	long hz = sysconf(_SC_CLK_TCK);
+	int seconds = 20;
+	int failures = 0;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr,
+			"Usage: %s server-pid path [connections [depth"
+			" [timeout-ms [seconds [port]]]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	server = atoi(argv[1]);
+	if (argc > 3)
+		nconns = atoi(argv[3]);
+	if (argc > 4)
+		depth = atoi(argv[4]);
+	if (argc > 5)
+		timeout_ns = atoll(argv[5]) * 1000000ULL;
+	if (argc > 6)
+		seconds = atoi(argv[6]);
+	if (argc > 7)
+		port = atoi(argv[7]);
+
+	if (server <= 0 || nconns <= 0 || depth <= 0 || depth > MAX_DEPTH ||
+	    timeout_ns == 0 || seconds <= 0) {
+		fprintf(stderr, "bad arguments\n");
+		return 1;
+	}
+
+	if (!mount_export(argv[2]))
+		return 1;
+
+	conns = calloc(nconns, sizeof(*conns));
+	if (conns == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < nconns; i++) {
+		conns[i].fd = connect_one(port);
+		conns[i].next_xid = (i + 1) << 20;
+		if (conns[i].fd < 0) {
+			fprintf(stderr, "connect %d: %s\n", i, strerror(errno));
+			return 1;
+		}
+	}
+
+	server_usage(server, &before, false);
+	start = now_ns();
+
+	for (i = 0; i < nconns; i++)
+		pthread_create(&conns[i].thr, NULL, client, &conns[i]);
+
+	sleep(seconds);
+	running = false;
+
+	for (i = 0; i < nconns; i++) {
+		pthread_join(conns[i].thr, NULL);
+		good += conns[i].good;
+		late += conns[i].late;
+		retransmits += conns[i].retransmits;
+		duplicates += conns[i].duplicates;
+		latency_ns += conns[i].latency_ns;
+		failures += conns[i].failures;
+		close(conns[i].fd);
+	}
+
+	elapsed = (now_ns() - start) / 1e9;
+	server_usage(server, &after, false);
+	answers = good + late;
+
+	printf("%d connections, depth %d, timeout %llums, %ds\n\n",
+	       nconns, depth, (unsigned long long)(timeout_ns / 1000000),
+	       seconds);
+	printf("goodput      %10.0f calls/sec\n", good / elapsed);
+	printf("late         %10.0f calls/sec\n", late / elapsed);
+	printf("retransmits  %10.0f /sec\n", retransmits / elapsed);
+	printf("duplicates   %10.0f /sec\n", duplicates / elapsed);
+	if (answers != 0) {
+		printf("latency      %10.3f ms mean\n",
+		       latency_ns / 1e6 / answers);
+		printf("server cpu   %10.2f us/call\n",
+		       (after.ticks - before.ticks) * 1e6 / hz /
+		       (answers + duplicates));
+	}
+
+	free(conns);
+
+	if (failures != 0) {
+		printf("%d failures\nFAIL\n", failures);
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_postop_attrs.c
+ * @brief Post-operation attributes from FSAL_VFS against getattrs
+ *
+ * A directory is exported through FSAL_VFS behind the inode cache and
+ * changed through it: a file and a directory are created, the file is
+ * linked, the link renamed into the directory, then both names
+ * removed.  After each, the attributes the cache merged from what the
+ * FSAL returned for the entries the operation touched are checked
+ * against those a fresh lookup of the same objects gets, and must
+ * still be trusted:
+ *
+ * - create: the parent, and the new object.
+ * - link: the file and the directory it is linked in.
+ * - rename: both directories and the object renamed.
+ * - unlink: the directory, and the file while it has links left.
+ *
+ * Must run as root.  Usage: test_postop_attrs [directory]
+ * The export is made in a new directory in it, /tmp by default.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fsal.h"
+#include "cache_inode.h"
+#include "sal_fixture.h"
+#include "vfs_fixture.h"
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static struct vfs_fixture fx;
+
+static bool same_time(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/**
+ * @brief Look an object up afresh, bypassing the cache
+ *
+ * @param[in]  dir  Directory in the export, or NULL for its root
+ * @param[in]  name Name in it, or NULL for the directory itself
+ * @param[out] obj  A new handle, with attributes just fetched
+ */
+
+static fsal_status_t fresh(const char *dir, const char *name,
+			   struct fsal_obj_handle **obj)
+{
+	struct fsal_obj_handle *parent;
+	fsal_status_t status;
+
+	if (dir == NULL && name == NULL) {
+		*obj = fx.root;
+		return fx.root->obj_ops.getattrs(fx.root);
+	}
+	if (dir == NULL)
+		return vfs_fixture_lookup(&fx, name, obj);
+
+	status = vfs_fixture_lookup(&fx, dir, &parent);
+	if (FSAL_IS_ERROR(status) || name == NULL) {
+		*obj = parent;
+		return status;
+	}
+	status = parent->obj_ops.lookup(parent, name, obj);
+	parent->obj_ops.release(parent);
+	return status;
+}
+
+/**
+ * @brief Check an entry's cached attributes against a fresh lookup
+ *
+ * @param[in] what  What is checked, for messages
+ * @param[in] entry The entry
+ * @param[in] dir   Directory of the object, as for fresh()
+ * @param[in] name  Name of the object, as for fresh()
+ */
+
+static void check_attrs(const char *what, cache_entry_t *entry,
+			const char *dir, const char *name)
+{
+	struct fsal_obj_handle *obj = NULL;
+	const struct attrlist *cached, *got;
+	fsal_status_t status;
+
+	status = fresh(dir, name, &obj);
+	CHECK(!FSAL_IS_ERROR(status), "%s: lookup failed: %s", what,
+	      msg_fsal_err(status.major));
+	if (FSAL_IS_ERROR(status))
+		return;
+
+	CHECK(entry->flags & CACHE_INODE_TRUST_ATTRS,
+	      "%s: attributes not trusted", what);
+
+	PTHREAD_RWLOCK_rdlock(&entry->attr_lock);
+	cached = &entry->obj_handle->attributes;
+	got = &obj->attributes;
+	CHECK(cached->fileid == got->fileid, "%s: fileid", what);
+	CHECK(cached->filesize == got->filesize, "%s: size %"PRIu64
+	      " not %"PRIu64, what, cached->filesize, got->filesize);
+	CHECK(cached->spaceused == got->spaceused, "%s: space used", what);
+	CHECK(cached->mode == got->mode, "%s: mode %o not %o", what,
+	      cached->mode, got->mode);
+	CHECK(cached->numlinks == got->numlinks, "%s: %u links not %u",
+	      what, cached->numlinks, got->numlinks);
+	CHECK(cached->owner == got->owner && cached->group == got->group,
+	      "%s: owner", what);
+	CHECK(same_time(&cached->mtime, &got->mtime), "%s: mtime", what);
+	CHECK(same_time(&cached->ctime, &got->ctime), "%s: ctime", what);
+	CHECK(same_time(&cached->chgtime, &got->chgtime), "%s: chgtime",
+	      what);
+	CHECK(cached->change == got->change, "%s: change", what);
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	if (obj != fx.root)
+		obj->obj_ops.release(obj);
+}
+
+static void run(void)
+{
+	cache_entry_t *root = fx.root_entry;
+	cache_entry_t *file = NULL, *sub = NULL;
+	cache_inode_status_t status;
+	int had = failures;
+
+	status = cache_inode_create(root, "a", REGULAR_FILE, 0644, NULL,
+				    &file);
+	CHECK(status == CACHE_INODE_SUCCESS, "create a: %s",
+	      cache_inode_err_str(status));
+	status = cache_inode_create(root, "sub", DIRECTORY, 0755, NULL, &sub);
+	CHECK(status == CACHE_INODE_SUCCESS, "create sub: %s",
+	      cache_inode_err_str(status));
+	if (file == NULL || sub == NULL) {
+		printf("FAIL  create\n");
+		goto out;
+	}
+	check_attrs("create: root", root, NULL, NULL);
+	check_attrs("create: a", file, NULL, "a");
+	check_attrs("create: sub", sub, NULL, "sub");
+	printf("%s  create\n", failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	status = cache_inode_link(file, root, "b");
+	CHECK(status == CACHE_INODE_SUCCESS, "link: %s",
+	      cache_inode_err_str(status));
+	check_attrs("link: root", root, NULL, NULL);
+	check_attrs("link: a", file, NULL, "a");
+	printf("%s  link\n", failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	status = cache_inode_rename(root, "b", sub, "c");
+	CHECK(status == CACHE_INODE_SUCCESS, "rename: %s",
+	      cache_inode_err_str(status));
+	check_attrs("rename: root", root, NULL, NULL);
+	check_attrs("rename: sub", sub, NULL, "sub");
+	check_attrs("rename: c", file, "sub", "c");
+	printf("%s  rename\n", failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	status = cache_inode_remove(sub, "c");
+	CHECK(status == CACHE_INODE_SUCCESS, "unlink c: %s",
+	      cache_inode_err_str(status));
+	check_attrs("unlink c: sub", sub, NULL, "sub");
+	check_attrs("unlink c: a", file, NULL, "a");
+	status = cache_inode_remove(root, "a");
+	CHECK(status == CACHE_INODE_SUCCESS, "unlink a: %s",
+	      cache_inode_err_str(status));
+	check_attrs("unlink a: root", root, NULL, NULL);
+	printf("%s  unlink\n", failures != had ? "FAIL" : "ok  ");
+
+	status = cache_inode_remove(root, "sub");
+	CHECK(status == CACHE_INODE_SUCCESS, "rmdir sub: %s",
+	      cache_inode_err_str(status));
+
+ out:
+	if (sub != NULL)
+		cache_inode_put(sub);
+	if (file != NULL)
+		cache_inode_put(file);
+}
+
+int main(int argc, char **argv)
+{
+	const char *parent = argc > 1 ? argv[1] : "/tmp";
+	char dir[256];
+
+	if (geteuid() != 0) {
+		printf("SKIP: open_by_handle_at needs root\n");
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "%s/test_postop_attrs.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+
+	if (sal_fixture_init(NULL) != 0 ||
+	    vfs_fixture_init(&fx, dir, NULL, NULL, NULL) != 0 ||
+	    vfs_fixture_cache(&fx) != 0) {
+		printf("FAIL: could not set up\n");
+		rmdir(dir);
+		return 1;
+	}
+
+	run();
+
+	vfs_fixture_fini(&fx);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,456 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_proxy_deleg.c
+ * @brief FSAL_PROXY backend delegations against a real backend
+ *
+ * A directory of a running backend is exported through FSAL_PROXY
+ * with Enable_Delegations, and its files opened through the FSAL,
+ * which asks the backend for delegations.  Another client of the
+ * backend changes the files meanwhile, through a directory given on
+ * the command line:
+ *
+ * - While a file is delegated its attributes, and its data once read,
+ *   are served without calling the backend.
+ * - When the other client writes the file the backend recalls the
+ *   delegation; the callback service returns it and invalidates the
+ *   file, and reads through PROXY then see the other client's data.
+ * - Writes through PROXY to a delegated file keep its cached data
+ *   right (pxy_deleg_wrote), and the other client sees them; its own
+ *   write then gets the delegation recalled.
+ *
+ * Backend calls and callbacks are counted by wrapping xdr_callmsg,
+ * which encodes every call FSAL_PROXY makes and decodes every call
+ * the callback service gets.  A part of the test whose delegation the
+ * backend did not grant is skipped.
+ *
+ * Usage: test_proxy_deleg server path other
+ * The backend is an NFSv4.0 server exporting path, writable, that
+ * grants delegations and can connect back to this host; another
+ * ganesha exporting a local directory through FSAL_VFS, with
+ * Delegations enabled, does.  other is the same directory through
+ * another client, such as a kernel NFSv4 mount of server:path.
+ * Without arguments the test is skipped.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "gsh_rpc.h"
+#include "nfs4.h"
+#include "abstract_atomic.h"
+#include "fsal.h"
+#include "../FSAL/FSAL_PROXY/pxy_fsal_methods.h"
+#include "pxy_fixture.h"
+
+#define FILE_SIZE (3 * 4096 + 100)
+#define WAIT_MS 5000
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static uint32_t backend_calls;
+static uint32_t callbacks;
+
+bool __real_xdr_callmsg(XDR *xdrs, struct rpc_msg *msg);
+
+/* Linked with --wrap=xdr_callmsg */
+bool __wrap_xdr_callmsg(XDR *xdrs, struct rpc_msg *msg)
+{
+	if (xdrs->x_op == XDR_ENCODE)
+		atomic_inc_uint32_t(&backend_calls);
+	else if (xdrs->x_op == XDR_DECODE)
+		atomic_inc_uint32_t(&callbacks);
+	return __real_xdr_callmsg(xdrs, msg);
+}
+
+#define MAX_INVALIDATES 16
+
+static pthread_mutex_t inval_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inval_cond = PTHREAD_COND_INITIALIZER;
+static struct {
+	char key[NFS4_FHSIZE + 2];
+	size_t key_len;
+	uint32_t flags;
+} invalidates[MAX_INVALIDATES];
+static int ninvalidates;
+
+static cache_inode_status_t test_invalidate(struct fsal_module *fsal,
+					    struct gsh_buffdesc *obj,
+					    uint32_t flags)
+{
+	pthread_mutex_lock(&inval_mutex);
+	if (ninvalidates < MAX_INVALIDATES &&
+	    obj->len <= sizeof(invalidates[0].key)) {
+		memcpy(invalidates[ninvalidates].key, obj->addr, obj->len);
+		invalidates[ninvalidates].key_len = obj->len;
+		invalidates[ninvalidates].flags = flags;
+		ninvalidates++;
+	}
+	pthread_cond_broadcast(&inval_cond);
+	pthread_mutex_unlock(&inval_mutex);
+	return CACHE_INODE_SUCCESS;
+}
+
+static struct fsal_up_vector test_up_ops = {
+	.invalidate = test_invalidate,
+};
+
+/**
+ * @brief Wait for the attributes and content of an object to be
+ *        invalidated
+ *
+ * @return true if they were within WAIT_MS.
+ */
+
+static bool wait_invalidate(struct fsal_obj_handle *obj)
+{
+	const uint32_t flags = CACHE_INODE_INVALIDATE_ATTRS |
+	    CACHE_INODE_INVALIDATE_CONTENT;
+	struct gsh_buffdesc key;
+	struct timespec until;
+	bool got = false;
+	int i;
+
+	obj->obj_ops.handle_to_key(obj, &key);
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += WAIT_MS / 1000;
+
+	pthread_mutex_lock(&inval_mutex);
+	while (!got) {
+		for (i = 0; i < ninvalidates && !got; i++)
+			got = invalidates[i].key_len == key.len &&
+			    memcmp(invalidates[i].key, key.addr,
+				   key.len) == 0 &&
+			    (invalidates[i].flags & flags) == flags;
+		if (!got && pthread_cond_timedwait(&inval_cond, &inval_mutex,
+						   &until) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&inval_mutex);
+
+	return got;
+}
+
+static void forget_invalidates(void)
+{
+	pthread_mutex_lock(&inval_mutex);
+	ninvalidates = 0;
+	pthread_mutex_unlock(&inval_mutex);
+}
+
+static struct pxy_fixture fx;
+static const char *other;
+
+/* What each file should hold */
+static char model[FILE_SIZE + 4096];
+static char buf[FILE_SIZE + 4096];
+
+static void fill(char *p, size_t len, char base)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = base + i % 23;
+}
+
+/**
+ * @brief Write a file through the other client
+ */
+
+static bool other_write(const char *name, off_t offset, const char *data,
+			size_t len)
+{
+	char path[4200];
+	ssize_t wc;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", other, name);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+	wc = pwrite(fd, data, len, offset);
+	return close(fd) == 0 && wc == (ssize_t)len;
+}
+
+/**
+ * @brief Check a file, read through the other client, holds the model
+ */
+
+static bool other_matches(const char *name, size_t size)
+{
+	char path[4200];
+	ssize_t rc;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", other, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	rc = pread(fd, buf, sizeof(buf), 0);
+	close(fd);
+
+	return rc == (ssize_t)size && memcmp(buf, model, size) == 0;
+}
+
+/**
+ * @brief Read a whole file through PROXY and check it against the model
+ */
+
+static bool proxy_matches(struct fsal_obj_handle *obj, size_t size)
+{
+	size_t done = 0, nread;
+	bool eof = false;
+	fsal_status_t status;
+
+	while (!eof && done < sizeof(buf)) {
+		status = obj->obj_ops.read(obj, done, sizeof(buf) - done,
+					   buf + done, &nread, &eof);
+		if (FSAL_IS_ERROR(status))
+			return false;
+		if (nread == 0)
+			break;
+		done += nread;
+	}
+
+	return done == size && memcmp(buf, model, size) == 0;
+}
+
+/**
+ * @brief Open a file through PROXY and see if it got delegated
+ *
+ * A delegated file's attributes come without calling the backend.
+ *
+ * @return true if delegated.
+ */
+
+static bool open_delegated(const char *name, fsal_openflags_t flags,
+			   struct fsal_obj_handle **obj)
+{
+	fsal_status_t status;
+	uint32_t calls;
+
+	status = pxy_fixture_lookup(&fx, name, obj);
+	if (!FSAL_IS_ERROR(status))
+		status = (*obj)->obj_ops.open(*obj, flags);
+	CHECK(!FSAL_IS_ERROR(status), "open %s: %s", name,
+	      msg_fsal_err(status.major));
+	if (FSAL_IS_ERROR(status))
+		return false;
+
+	calls = atomic_fetch_uint32_t(&backend_calls);
+	status = (*obj)->obj_ops.getattrs(*obj);
+	return !FSAL_IS_ERROR(status) &&
+	    atomic_fetch_uint32_t(&backend_calls) == calls;
+}
+
+static void close_file(struct fsal_obj_handle *obj)
+{
+	if (obj == NULL)
+		return;
+	obj->obj_ops.close(obj);
+	obj->obj_ops.release(obj);
+}
+
+static void recall_on_write(void)
+{
+	struct fsal_obj_handle *obj = NULL;
+	uint32_t calls, cbs;
+	int had = failures;
+
+	fill(model, FILE_SIZE, 'A');
+	if (!other_write("r", 0, model, FILE_SIZE)) {
+		printf("FAIL: cannot write %s/r\n", other);
+		failures++;
+		return;
+	}
+
+	if (!open_delegated("r", FSAL_O_READ, &obj)) {
+		printf("SKIP  backend granted no delegation for reading\n");
+		goto out;
+	}
+
+	CHECK(proxy_matches(obj, FILE_SIZE), "first read wrong");
+	calls = atomic_fetch_uint32_t(&backend_calls);
+	CHECK(proxy_matches(obj, FILE_SIZE), "cached read wrong");
+	CHECK(!FSAL_IS_ERROR(obj->obj_ops.getattrs(obj)) &&
+	      obj->attributes.filesize == FILE_SIZE, "delegated size wrong");
+	CHECK(atomic_fetch_uint32_t(&backend_calls) == calls,
+	      "delegated read and getattrs called the backend");
+	printf("%s  delegated reads and getattrs served locally\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	forget_invalidates();
+	cbs = atomic_fetch_uint32_t(&callbacks);
+	fill(model + 100, 5000, 'a');
+	CHECK(other_write("r", 100, model + 100, 5000),
+	      "other client's write failed");
+	CHECK(atomic_fetch_uint32_t(&callbacks) != cbs, "no callback came");
+	CHECK(wait_invalidate(obj), "file not invalidated after recall");
+	printf("%s  CB_RECALL returns the delegation and invalidates\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	calls = atomic_fetch_uint32_t(&backend_calls);
+	CHECK(proxy_matches(obj, FILE_SIZE),
+	      "read after recall misses the other client's write");
+	CHECK(atomic_fetch_uint32_t(&backend_calls) != calls,
+	      "read after recall served locally");
+	printf("%s  reads after recall see the other client's write\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+ out:
+	close_file(obj);
+}
+
+static bool proxy_write(struct fsal_obj_handle *obj, uint64_t offset,
+			size_t len, char base)
+{
+	fsal_status_t status;
+	size_t written = 0;
+	bool stable;
+
+	fill(model + offset, len, base);
+	status = obj->obj_ops.write(obj, offset, len, model + offset,
+				    &written, &stable);
+	return !FSAL_IS_ERROR(status) && written == len;
+}
+
+static void write_delegated(void)
+{
+	struct fsal_obj_handle *obj = NULL;
+	uint32_t calls, cbs;
+	bool delegated;
+	int had = failures;
+
+	fill(model, FILE_SIZE, 'K');
+	if (!other_write("w", 0, model, FILE_SIZE)) {
+		printf("FAIL: cannot write %s/w\n", other);
+		failures++;
+		return;
+	}
+
+	if (!open_delegated("w", FSAL_O_RDWR, &obj)) {
+		printf("SKIP  backend granted no delegation for writing\n");
+		goto out;
+	}
+	CHECK(proxy_matches(obj, FILE_SIZE), "first read wrong");
+
+	forget_invalidates();
+	CHECK(proxy_write(obj, 10, 100, 'p'), "write in a block failed");
+	CHECK(proxy_write(obj, 4000, 200, 'q'),
+	      "write across blocks failed");
+	CHECK(proxy_write(obj, 8192, 4096, 'r'),
+	      "write of a whole block failed");
+
+	/* A backend may recall a read delegation on the writes */
+	calls = atomic_fetch_uint32_t(&backend_calls);
+	delegated = !FSAL_IS_ERROR(obj->obj_ops.getattrs(obj)) &&
+	    atomic_fetch_uint32_t(&backend_calls) == calls;
+	CHECK(obj->attributes.filesize == FILE_SIZE, "size after writes");
+	CHECK(proxy_matches(obj, FILE_SIZE), "read after writes wrong");
+	if (!delegated) {
+		printf("SKIP  delegation recalled by the writes\n");
+		goto out;
+	}
+	CHECK(atomic_fetch_uint32_t(&backend_calls) == calls,
+	      "read after writes called the backend");
+	printf("%s  writes to a delegated file keep its cache right\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(other_matches("w", FILE_SIZE),
+	      "other client does not see the writes");
+	cbs = atomic_fetch_uint32_t(&callbacks);
+	fill(model, 10, 'z');
+	CHECK(other_write("w", 0, model, 10), "other client's write failed");
+	CHECK(atomic_fetch_uint32_t(&callbacks) != cbs, "no callback came");
+	CHECK(wait_invalidate(obj), "file not invalidated after recall");
+	CHECK(proxy_matches(obj, FILE_SIZE),
+	      "read after recall misses the other client's write");
+	printf("%s  other client sees the writes, and its write recalls\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+ out:
+	close_file(obj);
+}
+
+int main(int argc, char **argv)
+{
+	char path[4200];
+	clientid4 cid = 0;
+	int rc, i;
+
+	if (argc < 4) {
+		printf("SKIP: usage: %s server path other\n", argv[0]);
+		return 0;
+	}
+	other = argv[3];
+
+	rc = pxy_fixture_init(&fx, argv[1], argv[2],
+			      "Enable_Delegations = true;", &test_up_ops);
+	if (rc != 0) {
+		printf("FAIL: could not set up: %s\n", strerror(rc));
+		return 1;
+	}
+
+	/* No delegation without a client id, set in the background */
+	for (i = 0; i < WAIT_MS / 100 && cid == 0; i++) {
+		pxy_get_clientid(&cid);
+		if (cid == 0)
+			usleep(100000);
+	}
+	if (cid == 0) {
+		printf("FAIL: no client id from the backend\n");
+		pxy_fixture_fini(&fx);
+		return 1;
+	}
+
+	recall_on_write();
+	write_delegated();
+
+	pxy_fixture_fini(&fx);
+	snprintf(path, sizeof(path), "%s/r", other);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/w", other);
+	unlink(path);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
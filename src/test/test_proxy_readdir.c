@@ -0,0 +1,258 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_proxy_readdir.c
+ * @brief FSAL_PROXY readdir against a real backend
+ *
+ * A directory of NENTRIES files is made on the backend through
+ * FSAL_PROXY and listed through pxy_readdir:
+ *
+ * - Every file is passed to the callback once, with a handle.
+ * - The handle and attributes each came with are those a lookup of
+ *   the name gets.
+ * - The listing takes few backend calls, not one per entry.
+ *
+ * Backend calls are counted by wrapping xdr_callmsg, which encodes
+ * every call FSAL_PROXY makes.
+ *
+ * Usage: test_proxy_readdir server path
+ * The backend is any NFSv4.0 server exporting path, writable; another
+ * ganesha exporting a local directory through FSAL_VFS does.  Without
+ * arguments the test is skipped.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gsh_rpc.h"
+#include "nfs4.h"
+#include "abstract_atomic.h"
+#include "fsal.h"
+#include "pxy_fixture.h"
+
+#define NENTRIES 1000
+/* Most a listing may take, about 130 entries fit in a 32k reply */
+#define MAX_CALLS (NENTRIES / 50)
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static uint32_t backend_calls;
+
+bool __real_xdr_callmsg(XDR *xdrs, struct rpc_msg *msg);
+
+/* Linked with --wrap=xdr_callmsg */
+bool __wrap_xdr_callmsg(XDR *xdrs, struct rpc_msg *msg)
+{
+	if (xdrs->x_op == XDR_ENCODE)
+		atomic_inc_uint32_t(&backend_calls);
+	return __real_xdr_callmsg(xdrs, msg);
+}
+
+struct listed {
+	int times;
+	bool handle;
+	struct attrlist attrs;
+	char key[NFS4_FHSIZE + 2];
+	size_t key_len;
+};
+
+static struct listed listed[NENTRIES];
+static int strays;
+
+static bool list_cb(const char *name, struct fsal_obj_handle *obj,
+		    void *dir_state, fsal_cookie_t cookie)
+{
+	struct gsh_buffdesc key;
+	struct listed *l;
+	int i;
+
+	if (sscanf(name, "f%d", &i) != 1 || i < 0 || i >= NENTRIES) {
+		strays++;
+		goto out;
+	}
+
+	l = &listed[i];
+	l->times++;
+	if (obj == NULL)
+		goto out;
+
+	obj->obj_ops.handle_to_key(obj, &key);
+	l->handle = key.len <= sizeof(l->key);
+	if (l->handle) {
+		memcpy(l->key, key.addr, key.len);
+		l->key_len = key.len;
+	}
+	l->attrs = obj->attributes;
+
+ out:
+	if (obj != NULL)
+		obj->obj_ops.release(obj);
+	return true;
+}
+
+static bool same_attrs(const struct attrlist *a, const struct attrlist *b)
+{
+	return a->type == b->type && a->fileid == b->fileid &&
+	    a->filesize == b->filesize && a->mode == b->mode &&
+	    a->numlinks == b->numlinks && a->owner == b->owner &&
+	    a->group == b->group && a->mtime.tv_sec == b->mtime.tv_sec &&
+	    a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+static void run(struct fsal_obj_handle *dir)
+{
+	struct fsal_obj_handle *obj;
+	struct gsh_buffdesc key;
+	fsal_status_t status;
+	uint32_t calls;
+	bool eof = false;
+	int i, missing = 0, twice = 0, bare = 0, differ = 0;
+	int had = failures;
+
+	calls = atomic_fetch_uint32_t(&backend_calls);
+	status = dir->obj_ops.readdir(dir, NULL, NULL, list_cb, &eof);
+	calls = atomic_fetch_uint32_t(&backend_calls) - calls;
+	CHECK(!FSAL_IS_ERROR(status), "readdir: %s",
+	      msg_fsal_err(status.major));
+	CHECK(eof, "readdir did not reach the end");
+
+	for (i = 0; i < NENTRIES; i++) {
+		if (listed[i].times == 0)
+			missing++;
+		else if (listed[i].times > 1)
+			twice++;
+		else if (!listed[i].handle)
+			bare++;
+	}
+	CHECK(missing == 0, "%d entries not listed", missing);
+	CHECK(twice == 0, "%d entries listed more than once", twice);
+	CHECK(strays == 0, "%d unknown entries listed", strays);
+	CHECK(bare == 0, "%d entries listed without a handle", bare);
+	printf("%s  every entry listed once, with a handle\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	for (i = 0; i < NENTRIES; i++) {
+		char name[16];
+
+		if (!listed[i].handle)
+			continue;
+		snprintf(name, sizeof(name), "f%04d", i);
+		status = dir->obj_ops.lookup(dir, name, &obj);
+		if (FSAL_IS_ERROR(status)) {
+			differ++;
+			continue;
+		}
+		obj->obj_ops.handle_to_key(obj, &key);
+		if (key.len != listed[i].key_len ||
+		    memcmp(key.addr, listed[i].key, key.len) != 0 ||
+		    !same_attrs(&obj->attributes, &listed[i].attrs))
+			differ++;
+		obj->obj_ops.release(obj);
+	}
+	CHECK(differ == 0, "%d entries differ from their lookup", differ);
+	printf("%s  handles and attributes are those lookup gets\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(calls <= MAX_CALLS, "%u backend calls for %d entries", calls,
+	      NENTRIES);
+	printf("%s  listing %d entries took %u backend calls\n",
+	       failures != had ? "FAIL" : "ok  ", NENTRIES, calls);
+}
+
+int main(int argc, char **argv)
+{
+	struct pxy_fixture fx;
+	struct fsal_obj_handle *dir = NULL, *obj;
+	struct fsal_postop_attrs postop;
+	struct attrlist attrs;
+	fsal_status_t status;
+	char dirname[64], name[16];
+	int created = 0, rc;
+
+	if (argc < 3) {
+		printf("SKIP: usage: %s server path\n", argv[0]);
+		return 0;
+	}
+
+	rc = pxy_fixture_init(&fx, argv[1], argv[2], NULL, NULL);
+	if (rc != 0) {
+		printf("FAIL: could not set up: %s\n", strerror(rc));
+		return 1;
+	}
+
+	snprintf(dirname, sizeof(dirname), "test_proxy_readdir.%d",
+		 (int)getpid());
+	memset(&attrs, 0, sizeof(attrs));
+	FSAL_SET_MASK(attrs.mask, ATTR_MODE);
+	attrs.mode = 0755;
+	status = fx.root->obj_ops.mkdir(fx.root, dirname, &attrs, &dir,
+					&postop);
+	if (FSAL_IS_ERROR(status)) {
+		printf("FAIL: mkdir %s: %s\n", dirname,
+		       msg_fsal_err(status.major));
+		pxy_fixture_fini(&fx);
+		return 1;
+	}
+
+	for (created = 0; created < NENTRIES; created++) {
+		snprintf(name, sizeof(name), "f%04d", created);
+		memset(&attrs, 0, sizeof(attrs));
+		FSAL_SET_MASK(attrs.mask, ATTR_MODE);
+		attrs.mode = 0644;
+		status = dir->obj_ops.create(dir, name, &attrs, &obj, &postop);
+		if (FSAL_IS_ERROR(status))
+			break;
+		obj->obj_ops.release(obj);
+	}
+	if (created == NENTRIES) {
+		run(dir);
+	} else {
+		printf("FAIL: create %s: %s\n", name,
+		       msg_fsal_err(status.major));
+		failures++;
+	}
+
+	while (created-- > 0) {
+		snprintf(name, sizeof(name), "f%04d", created);
+		(void) dir->obj_ops.unlink(dir, name, &postop);
+	}
+	dir->obj_ops.release(dir);
+	(void) fx.root->obj_ops.unlink(fx.root, dirname, &postop);
+	pxy_fixture_fini(&fx);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
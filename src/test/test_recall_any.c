@@ -0,0 +1,497 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_recall_any.c
+ * @brief Clients asked for delegations back when entries run short
+ *
+ * A directory is exported through FSAL_VFS behind the inode cache,
+ * and an NFSv4.1 client and an NFSv4.0 client are granted read
+ * delegations on files in it, as OPEN would grant them; a third
+ * client holds none.  state_recall_any_check is then called as the
+ * LRU calls it.  The test links with --wrap=nfs_rpc_v41_single and
+ * --wrap=delegrecall_client, so the CB_RECALL_ANYs and the
+ * delegation recalls are recorded instead of made:
+ *
+ * - Below Recall_Any_Pinned_Percent nobody is asked for anything.
+ * - Above it the NFSv4.1 client is sent CB_RECALL_ANY for its
+ *   delegations, keeping Recall_Any_Keep_Percent of them, and the
+ *   NFSv4.0 client has its oldest delegations recalled.  The client
+ *   holding nothing is left alone.
+ * - Within Recall_Any_Grace the NFSv4.1 client is not asked again.
+ * - Once the grace has passed, a client that gave nothing back is
+ *   counted as having ignored the request and has its oldest
+ *   delegations recalled instead, while one that gave back half of
+ *   what it was asked is asked again.
+ * - A client that ignored the request three times in a row is no
+ *   longer sent it, its delegations being recalled straight away.
+ *
+ * Usage: test_recall_any [directory]
+ * The export is made in a new directory in it, /tmp by default.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "abstract_atomic.h"
+#include "nfs_core.h"
+#include "nfs_rpc_callback.h"
+#include "sal_fixture.h"
+#include "vfs_fixture.h"
+
+#define NFILES 4
+#define WAIT_MS 5000
+#define MAX_CALLS 64
+
+/* Recall_Any_Grace, with a second's margin for time()'s resolution */
+#define GRACE 2
+#define GRACE_SLEEP (GRACE + 1)
+
+/* RECALL_ANY_IGNORED_MAX in state_recall_any.c */
+#define IGNORED_MAX 3
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+enum call_kind {
+	CALL_RECALL_ANY,
+	CALL_RECALL
+};
+
+struct call {
+	enum call_kind kind;
+	clientid4 clientid;
+	uint32_t keep;		/*< CB_RECALL_ANY's objects to keep */
+	uint32_t mask;		/*< and its type mask */
+	cache_entry_t *entry;	/*< File of a recall */
+};
+
+static pthread_mutex_t calls_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct call calls[MAX_CALLS];
+static int ncalls;
+
+static pthread_mutex_t settle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t settle_cond = PTHREAD_COND_INITIALIZER;
+static bool settled;
+
+static struct vfs_fixture fx;
+static cache_entry_t *files[NFILES];
+
+static void record(struct call *c)
+{
+	PTHREAD_MUTEX_lock(&calls_mutex);
+	if (ncalls < MAX_CALLS)
+		calls[ncalls++] = *c;
+	PTHREAD_MUTEX_unlock(&calls_mutex);
+}
+
+int __wrap_nfs_rpc_v41_single(nfs_client_id_t *clientid, nfs_cb_argop4 *op,
+			      struct state_refer *refer,
+			      int32_t (*completion)(rpc_call_t *,
+						    rpc_call_hook, void *arg,
+						    uint32_t flags),
+			      void *completion_arg,
+			      void (*free_op)(nfs_cb_argop4 *op));
+state_status_t __wrap_delegrecall_client(cache_entry_t *entry,
+					 nfs_client_id_t *clientid);
+
+/**
+ * @brief Record a CB_RECALL_ANY as sent
+ *
+ * Its completion would drop the reference recall_any_send took on the
+ * client, so that is dropped here.
+ */
+
+int __wrap_nfs_rpc_v41_single(nfs_client_id_t *clientid, nfs_cb_argop4 *op,
+			      struct state_refer *refer,
+			      int32_t (*completion)(rpc_call_t *,
+						    rpc_call_hook, void *arg,
+						    uint32_t flags),
+			      void *completion_arg,
+			      void (*free_op)(nfs_cb_argop4 *op))
+{
+	CB_RECALL_ANY4args *args = &op->nfs_cb_argop4_u.opcbrecall_any;
+	struct call c;
+
+	if (op->argop != NFS4_OP_CB_RECALL_ANY)
+		return ENOTCONN;
+
+	memset(&c, 0, sizeof(c));
+	c.kind = CALL_RECALL_ANY;
+	c.clientid = clientid->cid_clientid;
+	c.keep = args->craa_objects_to_keep;
+	c.mask = args->craa_type_mask.bitmap4_len != 0
+	    ? args->craa_type_mask.map[0] : 0;
+	record(&c);
+
+	dec_client_id_ref(completion_arg);
+	return 0;
+}
+
+/**
+ * @brief Record a delegation recall as made
+ */
+
+state_status_t __wrap_delegrecall_client(cache_entry_t *entry,
+					 nfs_client_id_t *clientid)
+{
+	struct call c;
+
+	memset(&c, 0, sizeof(c));
+	c.kind = CALL_RECALL;
+	c.clientid = clientid->cid_clientid;
+	c.entry = entry;
+	record(&c);
+
+	return STATE_SUCCESS;
+}
+
+static void settle_func(state_async_queue_t *arg)
+{
+	PTHREAD_MUTEX_lock(&settle_mutex);
+	settled = true;
+	pthread_cond_broadcast(&settle_cond);
+	PTHREAD_MUTEX_unlock(&settle_mutex);
+}
+
+/**
+ * @brief Check as the LRU does, and wait for any round to finish
+ *
+ * The round runs on the state async fridge, which has one thread, so
+ * it is over once a job queued after it has run.
+ *
+ * @param[in] limit Entries the cache may hold
+ *
+ * @return false if the round did not finish.
+ */
+
+static bool check_round(uint64_t limit)
+{
+	static state_async_queue_t marker;
+	struct timespec until;
+
+	PTHREAD_MUTEX_lock(&calls_mutex);
+	ncalls = 0;
+	PTHREAD_MUTEX_unlock(&calls_mutex);
+
+	state_recall_any_check(limit);
+
+	settled = false;
+	marker.state_async_func = settle_func;
+	if (state_async_schedule(&marker) != STATE_SUCCESS)
+		return false;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += WAIT_MS / 1000;
+
+	PTHREAD_MUTEX_lock(&settle_mutex);
+	while (!settled &&
+	       pthread_cond_timedwait(&settle_cond, &settle_mutex,
+				      &until) != ETIMEDOUT)
+		;
+	PTHREAD_MUTEX_unlock(&settle_mutex);
+
+	return settled;
+}
+
+/**
+ * @brief Count the calls to a client
+ *
+ * @param[in]  kind     Calls to count
+ * @param[in]  clientid Client
+ * @param[out] first    The first of them, if any and if not NULL
+ */
+
+static int count_calls(enum call_kind kind, nfs_client_id_t *clientid,
+		       struct call *first)
+{
+	int i, n = 0;
+
+	PTHREAD_MUTEX_lock(&calls_mutex);
+	for (i = 0; i < ncalls; i++) {
+		if (calls[i].kind != kind ||
+		    calls[i].clientid != clientid->cid_clientid)
+			continue;
+		if (n++ == 0 && first != NULL)
+			*first = calls[i];
+	}
+	PTHREAD_MUTEX_unlock(&calls_mutex);
+
+	return n;
+}
+
+static bool recalled(nfs_client_id_t *clientid, cache_entry_t *entry)
+{
+	bool found = false;
+	int i;
+
+	PTHREAD_MUTEX_lock(&calls_mutex);
+	for (i = 0; i < ncalls && !found; i++)
+		found = calls[i].kind == CALL_RECALL &&
+		    calls[i].clientid == clientid->cid_clientid &&
+		    calls[i].entry == entry;
+	PTHREAD_MUTEX_unlock(&calls_mutex);
+
+	return found;
+}
+
+static uint32_t ignored(nfs_client_id_t *clientid)
+{
+	uint32_t n;
+
+	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	n = clientid->cid_recall_any_ignored;
+	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
+
+	return n;
+}
+
+/**
+ * @brief The NFSv4.1 client holds delegations on files 0 to 2, the
+ *	  NFSv4.0 client on files 3 and 2, granted in that order.
+ */
+
+static void run(nfs_client_id_t *v41, nfs_client_id_t *v40,
+		nfs_client_id_t *idle, state_t *v41_deleg0)
+{
+	const uint32_t dlg = 1 << RCA4_TYPE_MASK_RDATA_DLG |
+	    1 << RCA4_TYPE_MASK_WDATA_DLG;
+	struct call c;
+	int had = failures;
+	int i;
+
+	CHECK(atomic_fetch_uint64_t(&recall_any_pinned) == NFILES,
+	      "%" PRIu64 " entries counted pinned, not %d",
+	      atomic_fetch_uint64_t(&recall_any_pinned), NFILES);
+	CHECK(check_round(1000), "round did not finish");
+	CHECK(ncalls == 0, "clients asked below the threshold");
+	printf("%s  nobody asked below Recall_Any_Pinned_Percent\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	/* 4 of 4 entries pinned */
+	had = failures;
+	CHECK(check_round(NFILES), "round did not finish");
+	if (count_calls(CALL_RECALL_ANY, v41, &c) == 1)
+		CHECK(c.keep == 1 && c.mask == dlg,
+		      "CB_RECALL_ANY keeps %" PRIu32 " of mask %" PRIx32,
+		      c.keep, c.mask);
+	else
+		CHECK(false, "NFSv4.1 client not sent one CB_RECALL_ANY");
+	CHECK(count_calls(CALL_RECALL, v41, NULL) == 0,
+	      "NFSv4.1 client's delegations recalled");
+	CHECK(count_calls(CALL_RECALL_ANY, v40, NULL) == 0,
+	      "NFSv4.0 client sent CB_RECALL_ANY");
+	CHECK(count_calls(CALL_RECALL, v40, NULL) == 1 &&
+	      recalled(v40, files[3]),
+	      "NFSv4.0 client's oldest delegation not recalled alone");
+	CHECK(count_calls(CALL_RECALL_ANY, idle, NULL) == 0 &&
+	      count_calls(CALL_RECALL, idle, NULL) == 0,
+	      "client holding nothing asked");
+	printf("%s  CB_RECALL_ANY to NFSv4.1, recalls for NFSv4.0\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	CHECK(check_round(NFILES), "round did not finish");
+	CHECK(count_calls(CALL_RECALL_ANY, v41, NULL) == 0 &&
+	      count_calls(CALL_RECALL, v41, NULL) == 0,
+	      "NFSv4.1 client asked again within the grace");
+	printf("%s  not asked again within Recall_Any_Grace\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	/* Gave nothing back of the 2 asked */
+	had = failures;
+	sleep(GRACE_SLEEP);
+	CHECK(check_round(NFILES), "round did not finish");
+	CHECK(ignored(v41) == 1, "ignored %" PRIu32 " times, not once",
+	      ignored(v41));
+	CHECK(count_calls(CALL_RECALL_ANY, v41, NULL) == 0,
+	      "CB_RECALL_ANY sent again when ignored");
+	CHECK(count_calls(CALL_RECALL, v41, NULL) == 2 &&
+	      recalled(v41, files[0]) && recalled(v41, files[1]),
+	      "ignoring client's two oldest delegations not recalled");
+	printf("%s  ignoring client has its delegations recalled\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	/* Asked again for 2 - 1, and gives back 1 */
+	had = failures;
+	CHECK(check_round(NFILES), "round did not finish");
+	CHECK(count_calls(CALL_RECALL_ANY, v41, NULL) == 1,
+	      "CB_RECALL_ANY not sent after recalls");
+	CHECK(sal_fixture_delegreturn(files[0], v41_deleg0) == STATE_SUCCESS,
+	      "could not return a delegation");
+	CHECK(atomic_fetch_uint64_t(&recall_any_pinned) == NFILES - 1,
+	      "returned delegation still counted pinned");
+	sleep(GRACE_SLEEP);
+	CHECK(check_round(NFILES - 1), "round did not finish");
+	CHECK(ignored(v41) == 0, "answering client counted as ignoring");
+	if (count_calls(CALL_RECALL_ANY, v41, &c) == 1)
+		CHECK(c.keep == 1, "CB_RECALL_ANY keeps %" PRIu32, c.keep);
+	else
+		CHECK(false, "answering client not asked again");
+	CHECK(count_calls(CALL_RECALL, v41, NULL) == 0,
+	      "answering client's delegations recalled");
+	printf("%s  answering client is asked again\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	/* Each ignored request is followed by another */
+	had = failures;
+	for (i = 1; i <= IGNORED_MAX; i++) {
+		sleep(GRACE_SLEEP);
+		CHECK(check_round(NFILES - 1), "round did not finish");
+		CHECK(ignored(v41) == i, "ignored %" PRIu32 " times, not %d",
+		      ignored(v41), i);
+		CHECK(check_round(NFILES - 1), "round did not finish");
+		if (i < IGNORED_MAX)
+			CHECK(count_calls(CALL_RECALL_ANY, v41, NULL) == 1,
+			      "CB_RECALL_ANY not sent after %d ignored", i);
+	}
+	CHECK(count_calls(CALL_RECALL_ANY, v41, NULL) == 0,
+	      "CB_RECALL_ANY sent after %d ignored", IGNORED_MAX);
+	CHECK(count_calls(CALL_RECALL, v41, NULL) == 1 &&
+	      recalled(v41, files[1]),
+	      "delegation not recalled after %d ignored", IGNORED_MAX);
+	printf("%s  no more CB_RECALL_ANY after %d ignored\n",
+	       failures != had ? "FAIL" : "ok  ", IGNORED_MAX);
+}
+
+int main(int argc, char **argv)
+{
+	static const int v41_files[] = { 0, 1, 2 };
+	static const int v40_files[] = { 3, 2 };
+	const char *parent = argc > 1 ? argv[1] : "/tmp";
+	nfs_client_id_t *v41, *v40, *idle;
+	state_t *opens[6], *delegs[5];
+	int nopens = 0, ndelegs = 0;
+	char dir[256], path[300], name[16];
+	int i, fd;
+
+	snprintf(dir, sizeof(dir), "%s/test_recall_any.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	for (i = 0; i < NFILES; i++) {
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		fd = open(path, O_CREAT | O_RDWR, 0644);
+		if (fd < 0) {
+			perror(path);
+			return 1;
+		}
+		close(fd);
+	}
+
+	if (sal_fixture_init("NFSv4 { Lease_Lifetime = 60;"
+			     " Recall_Any_Pinned_Percent = 50;"
+			     " Recall_Any_Keep_Percent = 50;"
+			     " Recall_Any_Grace = " STR(GRACE) ";"
+			     " Recall_Any_Clients = 2; }") != 0 ||
+	    state_async_init() != STATE_SUCCESS ||
+	    vfs_fixture_init(&fx, dir, NULL, NULL, NULL) != 0 ||
+	    vfs_fixture_cache(&fx) != 0) {
+		printf("FAIL: could not set up\n");
+		return 1;
+	}
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		if (vfs_fixture_entry(&fx, name, &files[i]) !=
+		    CACHE_INODE_SUCCESS) {
+			printf("FAIL: could not find %s\n", name);
+			return 1;
+		}
+	}
+
+	v41 = sal_fixture_client("recall any v41", 1);
+	v40 = sal_fixture_client("recall any v40", 0);
+	idle = sal_fixture_client("recall any idle", 1);
+	if (v41 == NULL || v40 == NULL || idle == NULL) {
+		printf("FAIL: no clients\n");
+		return 1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		opens[nopens] = sal_fixture_open(files[v41_files[i]], v41,
+						 "v41", OPEN4_SHARE_ACCESS_READ,
+						 OPEN4_SHARE_DENY_NONE);
+		if (opens[nopens] != NULL)
+			nopens++;
+		delegs[ndelegs] = sal_fixture_deleg(files[v41_files[i]], v41);
+		if (delegs[ndelegs] != NULL)
+			ndelegs++;
+	}
+	for (i = 0; i < 2; i++) {
+		opens[nopens] = sal_fixture_open(files[v40_files[i]], v40,
+						 "v40", OPEN4_SHARE_ACCESS_READ,
+						 OPEN4_SHARE_DENY_NONE);
+		if (opens[nopens] != NULL)
+			nopens++;
+		delegs[ndelegs] = sal_fixture_deleg(files[v40_files[i]], v40);
+		if (delegs[ndelegs] != NULL)
+			ndelegs++;
+	}
+	opens[nopens] = sal_fixture_open(files[0], idle, "idle",
+					 OPEN4_SHARE_ACCESS_READ,
+					 OPEN4_SHARE_DENY_NONE);
+	if (opens[nopens] != NULL)
+		nopens++;
+
+	if (nopens == 6 && ndelegs == 5)
+		run(v41, v40, idle, delegs[0]);
+	else
+		CHECK(false, "could not open and delegate");
+
+	for (i = 0; i < ndelegs; i++)
+		dec_state_t_ref(delegs[i]);
+	for (i = 0; i < nopens; i++)
+		dec_state_t_ref(opens[i]);
+	dec_client_id_ref(v41);
+	dec_client_id_ref(v40);
+	dec_client_id_ref(idle);
+
+	for (i = 0; i < NFILES; i++) {
+		cache_inode_put(files[i]);
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		unlink(path);
+	}
+	vfs_fixture_fini(&fx);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_reconfig.c
+ * @brief Applying reloaded tunables, as a SIGHUP reload does
+ *
+ * A looper fridge set up like the worker fridge runs threads that take
+ * jobs as long as fridgethr_you_should_break lets them.  Nb_Worker is
+ * changed from 4 to 16, 2 and 8 with fridgethr_resize, as worker_resize
+ * does, while the throughput is sampled every 50ms.  Each change must
+ * be reached within a few seconds, and no sample may see no job done.
+ * An invalid change must be refused and leave the fridge as it was.
+ *
+ * The LRU is started with cache_inode_lru_pkginit and an hour's
+ * LRU_Run_Interval.  New watermarks and a one second interval are
+ * applied with cache_inode_lru_reconfig: the limits must change at
+ * once, and the LRU thread must then run every second.
+ *
+ * The DRC package is started with dupreq2_pkginit, and new UDP DRC
+ * limits applied with dupreq2_reconfig must reach the shared DRC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "abstract_atomic.h"
+#include "fridgethr.h"
+#include "nfs_core.h"
+#include "nfs_dupreq.h"
+#include "cache_inode.h"
+#include "cache_inode_lru.h"
+
+#define SAMPLE_MS 50
+#define CONVERGE_MS 3000
+
+static struct fridgethr *wrk;
+static uint64_t jobs_done;
+static uint32_t running;
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+/* As nfs_rpc_queue_awaken, keeps idle workers from sleeping */
+static void wake_workers(void *arg)
+{
+}
+
+/* As worker_run */
+static void worker_run(struct fridgethr_context *ctx)
+{
+	volatile uint32_t spin;
+
+	atomic_inc_uint32_t(&running);
+	while (!fridgethr_you_should_break(ctx)) {
+		for (spin = 0; spin < 20000; spin++)
+			;
+		atomic_inc_uint64_t(&jobs_done);
+	}
+	atomic_dec_uint32_t(&running);
+}
+
+static uint32_t nthreads(struct fridgethr *fr)
+{
+	uint32_t n;
+
+	pthread_mutex_lock(&fr->mtx);
+	n = fr->nthreads;
+	pthread_mutex_unlock(&fr->mtx);
+	return n;
+}
+
+/**
+ * @brief Resize the workers and watch them settle
+ *
+ * @return Stalled samples, or -1 if the size was not reached.
+ */
+
+static int resize_under_load(uint32_t target)
+{
+	uint64_t before, last, now;
+	int stalls = 0;
+	int ms, rc;
+
+	last = before = atomic_fetch_uint64_t(&jobs_done);
+
+	rc = fridgethr_resize(wrk, target, target, worker_run, NULL);
+	if (rc != 0) {
+		printf("fridgethr_resize to %u: %d\n", target, rc);
+		return -1;
+	}
+
+	for (ms = 0; ms < CONVERGE_MS; ms += SAMPLE_MS) {
+		sleep_ms(SAMPLE_MS);
+		now = atomic_fetch_uint64_t(&jobs_done);
+		if (now == last)
+			stalls++;
+		last = now;
+
+		if (ms >= 500 && nthreads(wrk) == target &&
+		    atomic_fetch_uint32_t(&running) == target)
+			break;
+	}
+
+	printf("Nb_Worker %2u: %u threads, %u running after %4d ms, "
+	       "%llu jobs, %d stalled samples\n",
+	       target, nthreads(wrk), atomic_fetch_uint32_t(&running),
+	       ms + SAMPLE_MS, (unsigned long long)(last - before), stalls);
+
+	if (ms >= CONVERGE_MS)
+		return -1;
+
+	return stalls;
+}
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failed = 1;				\
+		}						\
+	} while (0)
+
+static int failed;
+
+/**
+ * @brief Check the LRU limits against the parameters
+ */
+
+static void check_lru_limits(const char *what)
+{
+	uint32_t fds = lru_state.fds_system_imposed;
+
+	printf("%s: Entries_HWMark %llu, FD high water %u of %u\n", what,
+	       (unsigned long long)lru_state.entries_hiwat,
+	       lru_state.fds_hiwat, fds);
+	CHECK(lru_state.entries_hiwat == cache_param.entries_hwmark,
+	      "%s: entries_hiwat", what);
+	CHECK(lru_state.fds_hard_limit ==
+	      cache_param.fd_limit_percent * fds / 100,
+	      "%s: fds_hard_limit", what);
+	CHECK(lru_state.fds_hiwat == cache_param.fd_hwmark_percent * fds / 100,
+	      "%s: fds_hiwat", what);
+	CHECK(lru_state.fds_lowat == cache_param.fd_lwmark_percent * fds / 100,
+	      "%s: fds_lowat", what);
+	CHECK(lru_state.per_lane_work ==
+	      cache_param.reaper_work / LRU_N_Q_LANES,
+	      "%s: per_lane_work", what);
+	CHECK(lru_state.caching_fds == cache_param.use_fd_cache,
+	      "%s: caching_fds", what);
+}
+
+/**
+ * @brief Reload the LRU parameters
+ */
+
+static void lru_test(void)
+{
+	time_t first, applied;
+
+	cache_param.entries_hwmark = 1000;
+	cache_param.lru_run_interval = 3600;
+	cache_param.use_fd_cache = true;
+	cache_param.fd_limit_percent = 99;
+	cache_param.fd_hwmark_percent = 90;
+	cache_param.fd_lwmark_percent = 50;
+	cache_param.reaper_work = 1000;
+	cache_param.biggest_window = 40;
+	cache_param.required_progress = 5;
+	cache_param.futility_count = 8;
+
+	CHECK(cache_inode_lru_pkginit() == 0, "cache_inode_lru_pkginit");
+	check_lru_limits("LRU started");
+
+	/* The first pass runs at once, the next in an hour */
+	sleep(1);
+	first = lru_state.prev_time;
+	CHECK(first != 0, "LRU thread did not run");
+	sleep(2);
+	CHECK(lru_state.prev_time == first,
+	      "LRU ran again before LRU_Run_Interval");
+
+	cache_param.entries_hwmark = 5000;
+	cache_param.lru_run_interval = 1;
+	cache_param.use_fd_cache = false;
+	cache_param.fd_hwmark_percent = 80;
+	cache_param.fd_lwmark_percent = 40;
+	cache_param.reaper_work = 2000;
+
+	applied = time(NULL);
+	cache_inode_lru_reconfig();
+	check_lru_limits("LRU reloaded");
+
+	sleep(4);
+	printf("LRU_Run_Interval 1: last pass %lds after the reload\n",
+	       (long)(lru_state.prev_time - applied));
+	CHECK(lru_state.prev_time >= applied + 2,
+	      "new LRU_Run_Interval not taken up");
+
+	cache_inode_lru_pkgshutdown();
+}
+
+/**
+ * @brief Reload the DRC limits
+ */
+
+static void drc_test(void)
+{
+	drc_t *drc;
+
+	nfs_param.core_param.drc.tcp.recycle_npart = 7;
+	nfs_param.core_param.drc.tcp.recycle_expire_s = 600;
+	nfs_param.core_param.drc.udp.npart = 1;
+	nfs_param.core_param.drc.udp.cachesz = 127;
+	nfs_param.core_param.drc.udp.size = 1024;
+	nfs_param.core_param.drc.udp.hiwat = 64;
+
+	dupreq2_pkginit();
+	drc = dupreq2_udp_drc();
+	CHECK(drc->maxsize == 1024 && drc->hiwat == 64,
+	      "UDP DRC started with %u/%u", drc->maxsize, drc->hiwat);
+
+	nfs_param.core_param.drc.udp.size = 4096;
+	nfs_param.core_param.drc.udp.hiwat = 512;
+	dupreq2_reconfig();
+	printf("UDP DRC reloaded: size %u, high water %u\n", drc->maxsize,
+	       drc->hiwat);
+	CHECK(drc->maxsize == 4096 && drc->hiwat == 512,
+	      "UDP DRC limits not applied");
+}
+
+int main(void)
+{
+	static const uint32_t sizes[] = { 16, 2, 8 };
+	struct fridgethr_params frp;
+	int rc, i;
+
+	memset(&frp, 0, sizeof(frp));
+	frp.thr_max = 4;
+	frp.thr_min = 4;
+	frp.flavor = fridgethr_flavor_looper;
+	frp.wake_threads = wake_workers;
+
+	rc = fridgethr_init(&wrk, "Wrk", &frp);
+	if (rc != 0) {
+		printf("fridgethr_init: %d\n", rc);
+		return 1;
+	}
+
+	rc = fridgethr_populate(wrk, worker_run, NULL);
+	if (rc != 0) {
+		printf("fridgethr_populate: %d\n", rc);
+		return 1;
+	}
+
+	sleep_ms(500);
+	printf("Nb_Worker  4: %u threads, %u running\n", nthreads(wrk),
+	       atomic_fetch_uint32_t(&running));
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		rc = resize_under_load(sizes[i]);
+		if (rc != 0) {
+			printf("FAIL: Nb_Worker %u %s\n", sizes[i],
+			       rc < 0 ? "not reached" : "stalled the workers");
+			failed = 1;
+		}
+	}
+
+	rc = fridgethr_resize(wrk, 9, 3, worker_run, NULL);
+	sleep_ms(200);
+	if (rc != EINVAL || nthreads(wrk) != 8) {
+		printf("FAIL: invalid resize gave %d and %u threads\n", rc,
+		       nthreads(wrk));
+		failed = 1;
+	} else
+		printf("Invalid resize refused, still %u threads\n",
+		       nthreads(wrk));
+
+	fridgethr_sync_command(wrk, fridgethr_comm_stop, 10);
+
+	lru_test();
+	drc_test();
+
+	printf(failed ? "FAIL\n" : "PASS\n");
+	return failed;
+}
@@ -0,0 +1,454 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_session_cache.c
+ * @brief Large NFSv4.1 READs with and without sa_cachethis
+ *
+ * Sets up a session with a running ganesha and has one thread per
+ * slot read a file in large chunks with the anonymous stateid, first
+ * with sa_cachethis set on every SEQUENCE, which is how the server
+ * used to treat all of them, then with it clear.  For each run the
+ * READ rate, the server's resident memory before, at peak and after,
+ * and its minor page faults per READ (fresh memory touched for reply
+ * buffers) are reported.
+ *
+ * Usage: test_session_cache server-pid path [size [slots [seconds
+ *        [port]]]]
+ *
+ * path is the file's path from the pseudo root, e.g. export/big.
+ * size is the READ size in KiB, 1024 by default; the file should be
+ * at least that big.  The server is reached at 127.0.0.1, port 2049
+ * by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rpc_bench.h"
+
+#define NFS_PROGRAM 100003
+#define NFS_V4 4
+#define NFSPROC4_COMPOUND 1
+
+#define OP_GETFH 10
+#define OP_LOOKUP 15
+#define OP_PUTFH 22
+#define OP_PUTROOTFH 24
+#define OP_READ 25
+#define OP_EXCHANGE_ID 42
+#define OP_CREATE_SESSION 43
+#define OP_SEQUENCE 53
+#define OP_RECLAIM_COMPLETE 58
+
+#define EXCHGID4_FLAG_USE_NON_PNFS 0x00010000
+#define SESSIONID_SIZE 16
+#define FH_MAX 128
+
+struct session {
+	unsigned char id[SESSIONID_SIZE];
+	unsigned char fh[FH_MAX];
+	uint32_t fhlen;
+	uint32_t nslots;
+};
+
+struct slot {
+	struct session *sess;
+	pthread_t thr;
+	uint32_t slotid;
+	uint32_t seq;
+	bool cachethis;
+	uint64_t reads;
+	uint64_t bytes;
+	int failures;
+};
+
+static int port = 2049;
+static pid_t server;
+static uint32_t read_size = 1024 * 1024;
+static volatile bool running;
+static long peak_rss_kb;
+
+static void *sampler(void *arg)
+{
+	struct server_usage u;
+
+	while (running) {
+		server_usage(server, &u, false);
+		if (u.rss_kb > peak_rss_kb)
+			peak_rss_kb = u.rss_kb;
+		usleep(20000);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Start a COMPOUND call with an AUTH_SYS root credential
+ *
+ * Leaves room for the record mark, filled in by compound_call.
+ */
+
+static void compound_header(struct xdr *x, uint32_t xid, uint32_t nops)
+{
+	rpc_header(x, xid, NFS_PROGRAM, NFS_V4, NFSPROC4_COMPOUND);
+	put_u32(x, 0);		/* tag */
+	put_u32(x, 1);		/* minor version */
+	put_u32(x, nops);
+}
+
+static void put_sequence(struct xdr *x, const struct session *sess,
+			 uint32_t slotid, uint32_t seq, bool cachethis)
+{
+	put_u32(x, OP_SEQUENCE);
+	put_fixed(x, sess->id, SESSIONID_SIZE);
+	put_u32(x, seq);
+	put_u32(x, slotid);
+	put_u32(x, sess->nslots - 1);
+	put_u32(x, cachethis);
+}
+
+/**
+ * @brief Send a COMPOUND and read its reply
+ *
+ * @return false on a transport or RPC error, otherwise x is set up to
+ *         decode the first operation result after the compound status
+ *         and tag, and *status holds the compound status.
+ */
+
+static bool compound_call(int fd, unsigned char *buf, size_t buflen,
+			  struct xdr *x, uint32_t *status)
+{
+	uint32_t v;
+
+	/* status, tag, result count */
+	return rpc_call(fd, buf, buflen, x) && get_u32(x, status) &&
+	    skip_opaque(x, &v) && get_u32(x, &v);
+}
+
+/**
+ * @brief Skip a successful SEQUENCE result
+ */
+
+static bool skip_sequence(struct xdr *x)
+{
+	uint32_t op, status;
+
+	return get_u32(x, &op) && op == OP_SEQUENCE &&
+	    get_u32(x, &status) && status == 0 &&
+	    skip(x, SESSIONID_SIZE + 5 * 4);
+}
+
+/**
+ * @brief EXCHANGE_ID, CREATE_SESSION, RECLAIM_COMPLETE and look up
+ *        the file
+ */
+
+static bool setup(int fd, struct session *sess, const char *path)
+{
+	static unsigned char buf[64 * 1024];
+	struct xdr x = { buf, buf + sizeof(buf) };
+	char owner[64];
+	uint64_t clientid;
+	uint32_t seq, status, op, v, nops;
+	const char *p;
+	uint32_t i;
+
+	snprintf(owner, sizeof(owner), "test_session_cache.%d.%llu",
+		 (int)getpid(), (unsigned long long)now_ns());
+
+	compound_header(&x, 1, 1);
+	put_u32(&x, OP_EXCHANGE_ID);
+	put_u64(&x, now_ns());	/* verifier */
+	put_opaque(&x, owner, strlen(owner));
+	put_u32(&x, EXCHGID4_FLAG_USE_NON_PNFS);
+	put_u32(&x, 0);		/* SP4_NONE */
+	put_u32(&x, 0);		/* no implementation id */
+
+	if (!compound_call(fd, buf, sizeof(buf), &x, &status) || status != 0 ||
+	    !get_u32(&x, &op) || !get_u32(&x, &status) || status != 0 ||
+	    !get_u64(&x, &clientid) || !get_u32(&x, &seq)) {
+		fprintf(stderr, "EXCHANGE_ID failed\n");
+		return false;
+	}
+
+	x.p = buf;
+	x.end = buf + sizeof(buf);
+	compound_header(&x, 2, 1);
+	put_u32(&x, OP_CREATE_SESSION);
+	put_u64(&x, clientid);
+	put_u32(&x, seq);
+	put_u32(&x, 0);		/* flags */
+	for (i = 0; i < 2; i++) {
+		put_u32(&x, 0);		/* header pad */
+		put_u32(&x, 1024 * 1024 + 4096);	/* max request */
+		put_u32(&x, read_size + 4096);		/* max response */
+		put_u32(&x, read_size + 4096);		/* max cached */
+		put_u32(&x, 16);	/* max operations */
+		put_u32(&x, i == 0 ? sess->nslots : 1);
+		put_u32(&x, 0);		/* no RDMA */
+	}
+	put_u32(&x, 0x40000000);	/* callback program */
+	put_u32(&x, 1);
+	put_u32(&x, 0);		/* AUTH_NONE */
+
+	if (!compound_call(fd, buf, sizeof(buf), &x, &status) || status != 0 ||
+	    !get_u32(&x, &op) || !get_u32(&x, &status) || status != 0 ||
+	    x.end - x.p < SESSIONID_SIZE + 8) {
+		fprintf(stderr, "CREATE_SESSION failed\n");
+		return false;
+	}
+	memcpy(sess->id, x.p, SESSIONID_SIZE);
+	x.p += SESSIONID_SIZE + 8;
+	/* fore channel attributes, the server's ca_maxrequests */
+	if (!get_u32(&x, &v) || !get_u32(&x, &v) || !get_u32(&x, &v) ||
+	    !get_u32(&x, &v) || !get_u32(&x, &v) || !get_u32(&x, &v))
+		return false;
+	if (v < sess->nslots)
+		sess->nslots = v;
+
+	/* Slot 0 sequence 1 for the setup, the readers start at 2 */
+	x.p = buf;
+	x.end = buf + sizeof(buf);
+	compound_header(&x, 3, 2);
+	put_sequence(&x, sess, 0, 1, false);
+	put_u32(&x, OP_RECLAIM_COMPLETE);
+	put_u32(&x, 0);
+	if (!compound_call(fd, buf, sizeof(buf), &x, &status)) {
+		fprintf(stderr, "RECLAIM_COMPLETE failed\n");
+		return false;
+	}
+
+	nops = 3;
+	for (p = path; *p != '\0'; p++)
+		if (*p == '/')
+			nops++;
+
+	x.p = buf;
+	x.end = buf + sizeof(buf);
+	compound_header(&x, 4, nops + 1);
+	put_sequence(&x, sess, 0, 2, false);
+	put_u32(&x, OP_PUTROOTFH);
+	for (p = path; *p != '\0';) {
+		const char *slash = strchr(p, '/');
+		size_t len = slash ? (size_t)(slash - p) : strlen(p);
+
+		put_u32(&x, OP_LOOKUP);
+		put_opaque(&x, p, len);
+		p += len;
+		if (*p == '/')
+			p++;
+	}
+	put_u32(&x, OP_GETFH);
+
+	if (!compound_call(fd, buf, sizeof(buf), &x, &status) || status != 0) {
+		fprintf(stderr, "Looking up %s failed: %u\n", path, status);
+		return false;
+	}
+	if (!skip_sequence(&x))
+		return false;
+	for (i = 0; i < nops - 1; i++)
+		if (!get_u32(&x, &op) || !get_u32(&x, &status))
+			return false;
+	if (!get_u32(&x, &op) || op != OP_GETFH || !get_u32(&x, &status) ||
+	    !get_u32(&x, &sess->fhlen) || sess->fhlen > FH_MAX ||
+	    x.end - x.p < sess->fhlen)
+		return false;
+	memcpy(sess->fh, x.p, sess->fhlen);
+
+	return true;
+}
+
+/**
+ * @brief Read the file over and over on one slot
+ */
+
+static void *reader(void *arg)
+{
+	struct slot *sl = arg;
+	size_t buflen = read_size + 64 * 1024;
+	unsigned char *buf = malloc(buflen);
+	uint64_t offset = 0;
+	uint32_t xid = sl->slotid << 20;
+	int fd = connect_one(port);
+
+	if (fd < 0 || buf == NULL) {
+		sl->failures++;
+		goto out;
+	}
+
+	while (running) {
+		struct xdr x = { buf, buf + buflen };
+		uint32_t status, op, eof, len;
+
+		compound_header(&x, ++xid, 3);
+		put_sequence(&x, sl->sess, sl->slotid, ++sl->seq,
+			     sl->cachethis);
+		put_u32(&x, OP_PUTFH);
+		put_opaque(&x, sl->sess->fh, sl->sess->fhlen);
+		put_u32(&x, OP_READ);
+		put_u32(&x, 0);		/* anonymous stateid */
+		memset(x.p, 0, 12);
+		x.p += 12;
+		put_u64(&x, offset);
+		put_u32(&x, read_size);
+
+		if (!compound_call(fd, buf, buflen, &x, &status) || status != 0 ||
+		    !skip_sequence(&x) || !get_u32(&x, &op) ||
+		    !get_u32(&x, &status) || !get_u32(&x, &op) ||
+		    !get_u32(&x, &status) || !get_u32(&x, &eof) ||
+		    !get_u32(&x, &len)) {
+			sl->failures++;
+			break;
+		}
+
+		sl->reads++;
+		sl->bytes += len;
+		offset = (eof || len == 0) ? 0 : offset + len;
+	}
+
+ out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int run(struct session *sess, bool cachethis, int seconds,
+	       uint32_t *seq)
+{
+	struct slot *slots = calloc(sess->nslots, sizeof(*slots));
+	struct server_usage before, after;
+	pthread_t sample_thr;
+	uint64_t reads = 0, bytes = 0, start, elapsed;
+	int failures = 0;
+	uint32_t i;
+
+	if (slots == NULL)
+		return 1;
+
+	server_usage(server, &before, false);
+	peak_rss_kb = before.rss_kb;
+	running = true;
+	pthread_create(&sample_thr, NULL, sampler, NULL);
+
+	start = now_ns();
+	for (i = 0; i < sess->nslots; i++) {
+		slots[i].sess = sess;
+		slots[i].slotid = i;
+		slots[i].seq = seq[i];
+		slots[i].cachethis = cachethis;
+		pthread_create(&slots[i].thr, NULL, reader, &slots[i]);
+	}
+
+	sleep(seconds);
+	running = false;
+
+	for (i = 0; i < sess->nslots; i++) {
+		pthread_join(slots[i].thr, NULL);
+		reads += slots[i].reads;
+		bytes += slots[i].bytes;
+		failures += slots[i].failures;
+		seq[i] = slots[i].seq;
+	}
+	elapsed = now_ns() - start;
+	pthread_join(sample_thr, NULL);
+
+	/* Let the server settle before sampling what stays resident */
+	sleep(1);
+	server_usage(server, &after, false);
+
+	printf("%-10s %8.0f %8.1f %10ld %10ld %10ld %10.2f %6d\n",
+	       cachethis ? "cached" : "uncached",
+	       reads / (elapsed / 1e9), bytes / (elapsed / 1e9) / 1048576,
+	       before.rss_kb, peak_rss_kb, after.rss_kb,
+	       reads ? (double)(after.minflt - before.minflt) / reads : 0.0,
+	       failures);
+
+	free(slots);
+	return failures;
+}
+
+int main(int argc, char *argv[])
+{
+	struct session sess;
+	uint32_t *seq;
+	int seconds = 10;
+	int failures = 0;
+	int fd;
+
+	if (argc < 3) {
+		fprintf(stderr,
+			"Usage: %s server-pid path [size [slots [seconds [port]]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	memset(&sess, 0, sizeof(sess));
+	server = atoi(argv[1]);
+	sess.nslots = 16;
+	if (argc > 3)
+		read_size = atoi(argv[3]) * 1024;
+	if (argc > 4)
+		sess.nslots = atoi(argv[4]);
+	if (argc > 5)
+		seconds = atoi(argv[5]);
+	if (argc > 6)
+		port = atoi(argv[6]);
+
+	fd = connect_one(port);
+	if (fd < 0) {
+		fprintf(stderr, "connect: %s\n", strerror(errno));
+		return 1;
+	}
+	if (!setup(fd, &sess, argv[2]))
+		return 1;
+	close(fd);
+
+	seq = calloc(sess.nslots, sizeof(*seq));
+	if (seq == NULL)
+		return 1;
+	seq[0] = 2;
+
+	printf("%u slots, %u KiB READs, %ds per run\n\n", sess.nslots,
+	       read_size / 1024, seconds);
+	printf("%-10s %8s %8s %10s %10s %10s %10s %6s\n", "replies",
+	       "reads/s", "MiB/s", "rss before", "rss peak", "rss after",
+	       "minflt/op", "errors");
+
+	failures += run(&sess, true, seconds, seq);
+	failures += run(&sess, false, seconds, seq);
+
+	free(seq);
+
+	if (failures != 0) {
+		printf("FAIL\n");
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
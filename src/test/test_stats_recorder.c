@@ -0,0 +1,201 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_stats_recorder.c
+ * @brief Run the statistics recorder and read back its ring
+ *
+ * stats_recorder_init starts the recorder's sampling thread on a ring
+ * with room for four records, sampling every second.  The cache entry
+ * gauge is set to a new value each second, so every record holds it.
+ * After seven seconds the ring must have wrapped: the records found
+ * are the newest, in sequence, with the gauge never going back.
+ *
+ * The newest record is then torn, as a crash would, and the recorder
+ * started again.  It must carry on after the newest whole record,
+ * rewriting the torn one's sequence number with new values.
+ *
+ * Usage: test_stats_recorder [directory]
+ * The directory defaults to /var/tmp.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cache_inode_lru.h"
+#include "stats_recorder.h"
+
+/* Four records of the one gauge, 56 bytes each */
+#define RING_SIZE 256
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+static char path[4200];
+static uint8_t ring[RING_SIZE];
+
+/**
+ * @brief Run the recorder, changing the gauge every second
+ */
+
+static void record(int seconds, uint64_t base)
+{
+	int i;
+
+	CHECK(stats_recorder_init() == 0, "stats_recorder_init");
+	for (i = 0; i < seconds; i++) {
+		lru_state.entries_used = base + i;
+		sleep(1);
+	}
+	CHECK(stats_recorder_shutdown() == 0, "stats_recorder_shutdown");
+}
+
+/**
+ * @brief The gauge a record holds, 0 if none
+ */
+
+static uint64_t gauge(uint64_t off)
+{
+	struct stats_recorder_record rec;
+	const uint8_t *p, *end;
+	uint64_t delta, value;
+	uint32_t key = 0, i;
+
+	memcpy(&rec, ring + off, sizeof(rec));
+	p = ring + off + sizeof(rec);
+	end = ring + off + rec.length;
+	for (i = 0; i < rec.nkeys && p != NULL; i++) {
+		p = stats_get_varint(p, end, &delta);
+		if (p != NULL)
+			p = stats_get_varint(p, end, &value);
+		key += delta;
+		if (p != NULL &&
+		    key == stats_key(STATS_KEY_GAUGE, STATS_GAUGE_ENTRIES))
+			return value;
+	}
+	return 0;
+}
+
+/**
+ * @brief Read the ring and check it is in order
+ *
+ * @param[out] newest Sequence number of the newest record
+ * @param[out] off    Where it is
+ *
+ * @return Records found.
+ */
+
+static size_t scan(const char *what, uint64_t *newest, uint64_t *off)
+{
+	struct stats_record_ref *refs;
+	uint64_t value, prev = 0;
+	size_t count, i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	CHECK(fd >= 0, "%s: open %s", what, path);
+	if (fd < 0)
+		return 0;
+	CHECK(pread(fd, ring, RING_SIZE, STATS_RECORDER_HEADER_SIZE) ==
+	      RING_SIZE, "%s: read", what);
+	close(fd);
+
+	refs = stats_ring_scan(ring, RING_SIZE, &count);
+	for (i = 0; i < count; i++) {
+		value = gauge(refs[i].off);
+		printf("%s: seq %llu at %llu, entries %llu\n", what,
+		       (unsigned long long)refs[i].seq,
+		       (unsigned long long)refs[i].off,
+		       (unsigned long long)value);
+		CHECK(i == 0 || refs[i].seq == refs[i - 1].seq + 1,
+		      "%s: records out of sequence", what);
+		CHECK(value != 0 && value >= prev,
+		      "%s: gauge %llu after %llu", what,
+		      (unsigned long long)value, (unsigned long long)prev);
+		prev = value;
+	}
+	if (count != 0) {
+		*newest = refs[count - 1].seq;
+		*off = refs[count - 1].off;
+	}
+	free(refs);
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "/var/tmp";
+	uint64_t newest = 0, off = 0, torn, after;
+	uint8_t byte;
+	size_t count;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/test_stats_recorder.%d", dir,
+		 getpid());
+	unlink(path);
+
+	stats_recorder_param.enable = true;
+	stats_recorder_param.path = path;
+	stats_recorder_param.interval = 1;
+	stats_recorder_param.max_size = STATS_RECORDER_HEADER_SIZE + RING_SIZE;
+	stats_recorder_param.per_export = false;
+
+	/* Rotation */
+	record(7, 1000);
+	count = scan("rotation", &newest, &off);
+	CHECK(count >= 3, "rotation: %zu records", count);
+	CHECK(newest >= count, "rotation: ring did not wrap");
+
+	/* Tear the newest record and restart */
+	torn = newest;
+	fd = open(path, O_RDWR);
+	CHECK(fd >= 0, "open %s", path);
+	if (fd >= 0) {
+		off += STATS_RECORDER_HEADER_SIZE + sizeof(struct
+							   stats_recorder_record);
+		CHECK(pread(fd, &byte, 1, off) == 1, "read");
+		byte ^= 0xff;
+		CHECK(pwrite(fd, &byte, 1, off) == 1, "tear");
+		close(fd);
+	}
+
+	record(3, 2000);
+	count = scan("restart", &after, &off);
+	CHECK(after > torn, "restart: newest %llu, torn %llu",
+	      (unsigned long long)after, (unsigned long long)torn);
+	CHECK(gauge(off) >= 2000, "restart: newest is not from the restart");
+
+	unlink(path);
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_upgrade_handoff.c
+ * @brief Hand the service from one process to another
+ *
+ * Two processes are forked, each with SAL tables of its own and the
+ * same NFS_Upgrade configuration.
+ *
+ * The old one makes an NFSv4.0 client and an NFSv4.1 client with a
+ * session, binds a UDP socket as its NFS socket, and listens with
+ * nfs_upgrade_init.  Once the new one has connected it runs
+ * nfs_upgrade_handoff, as do_shutdown would, and exits.
+ *
+ * The new one runs nfs_upgrade_connect, as at startup, takes the
+ * socket with nfs_upgrade_sockets and installs the state with
+ * nfs_upgrade_install_state, which returns once the old one is gone.
+ * It must have the old server's epoch and socket, both clients,
+ * confirmed, with their ids, verifiers and last renewal, and the
+ * session, with its slots' sequence numbers, so that no grace period
+ * is needed.
+ *
+ * Usage: test_upgrade_handoff [directory]
+ * The upgrade socket is made in the directory, /tmp by default.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "nfs_core.h"
+#include "nfs_upgrade.h"
+#include "sal_fixture.h"
+
+#define OLD_EPOCH 1234567
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+/**
+ * @brief What the old server had, for the new one to check
+ */
+
+struct expect {
+	clientid4 clientid40;
+	clientid4 clientid41;
+	time_t last_renew40;
+	time_t last_renew41;
+	char sessionid[NFS4_SESSIONID_SIZE];
+	uint16_t port;
+};
+
+static const char verifier40[NFS4_VERIFIER_SIZE] = "oldverf0";
+static const char verifier41[NFS4_VERIFIER_SIZE] = "oldverf1";
+
+static char config[512];
+
+static int write_full(int fd, const void *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, data, len);
+		if (n <= 0)
+			return -1;
+		data = (const char *)data + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, data, len);
+		if (n <= 0)
+			return -1;
+		data = (char *)data + n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief The server being upgraded
+ *
+ * @param[in] ready     Where to send the expectations once listening
+ * @param[in] connected Where the new server says it is connecting
+ */
+
+static int old_server(int ready, int connected)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	nfs_client_id_t *c40, *c41;
+	nfs41_session_t *session;
+	struct expect ex;
+	char c;
+	int p, i;
+
+	ServerEpoch = OLD_EPOCH;
+
+	if (sal_fixture_init(config) != 0) {
+		printf("FAIL: old sal_fixture_init\n");
+		return 1;
+	}
+
+	c40 = sal_fixture_client("upgrade v4.0", 0);
+	c41 = sal_fixture_client("upgrade v4.1", 1);
+	session = c41 != NULL ? sal_fixture_session(c41) : NULL;
+	if (c40 == NULL || c41 == NULL || session == NULL) {
+		printf("FAIL: old server could not make clients\n");
+		return 1;
+	}
+
+	memcpy(c40->cid_verifier, verifier40, NFS4_VERIFIER_SIZE);
+	memcpy(c41->cid_verifier, verifier41, NFS4_VERIFIER_SIZE);
+	c40->cid_last_renew -= 10;
+	for (i = 0; i < NFS41_NB_SLOTS; i++)
+		session->slots[i].sequence = 100 + i;
+
+	for (p = 0; p < P_COUNT; p++) {
+		udp_socket[p] = -1;
+		tcp_socket[p] = -1;
+	}
+	udp_socket[P_NFS] = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (udp_socket[P_NFS] < 0 ||
+	    bind(udp_socket[P_NFS], (struct sockaddr *)&sin,
+		 sizeof(sin)) != 0 ||
+	    getsockname(udp_socket[P_NFS], (struct sockaddr *)&sin,
+			&len) != 0) {
+		printf("FAIL: old server could not bind: %s\n",
+		       strerror(errno));
+		return 1;
+	}
+
+	CHECK(nfs_upgrade_init() == 0, "nfs_upgrade_init");
+
+	memset(&ex, 0, sizeof(ex));
+	ex.clientid40 = c40->cid_clientid;
+	ex.clientid41 = c41->cid_clientid;
+	ex.last_renew40 = c40->cid_last_renew;
+	ex.last_renew41 = c41->cid_last_renew;
+	memcpy(ex.sessionid, session->session_id, NFS4_SESSIONID_SIZE);
+	ex.port = ntohs(sin.sin_port);
+
+	dec_session_ref(session);
+	dec_client_id_ref(c40);
+	dec_client_id_ref(c41);
+
+	if (write_full(ready, &ex, sizeof(ex)) != 0)
+		return 1;
+
+	/* The new server is about to connect; give the listener time to
+	 * take its HELLO, as it would while the workers drain.
+	 */
+	if (read_full(connected, &c, 1) != 0)
+		return 1;
+	sleep(1);
+
+	CHECK(nfs_upgrade_handoff(true), "nfs_upgrade_handoff");
+	CHECK(nfs_upgrade_handed_off(), "sockets not handed off");
+	printf("%s  old server handed off\n", failures ? "FAIL" : "ok  ");
+
+	/* Exiting closes the connection, which the new server waits for */
+	return failures != 0;
+}
+
+/**
+ * @brief The upgraded server
+ *
+ * @param[in] ex        What the old server had
+ * @param[in] connected Where to say it is connecting
+ */
+
+static int new_server(const struct expect *ex, int connected)
+{
+	int udp[P_COUNT], tcp[P_COUNT];
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	nfs_client_id_t *clientid;
+	nfs41_session_t *session;
+	bool v6disabled;
+	int i;
+
+	ServerEpoch = 1;
+
+	if (sal_fixture_init(config) != 0) {
+		printf("FAIL: new sal_fixture_init\n");
+		return 1;
+	}
+
+	if (write_full(connected, "c", 1) != 0)
+		return 1;
+	nfs_upgrade_connect();
+
+	CHECK(ServerEpoch == OLD_EPOCH, "epoch %ld not carried",
+	      (long)ServerEpoch);
+
+	CHECK(nfs_upgrade_sockets(udp, tcp, P_COUNT, &v6disabled),
+	      "no sockets handed over");
+	CHECK(udp[P_NFS] >= 0 &&
+	      getsockname(udp[P_NFS], (struct sockaddr *)&sin, &len) == 0 &&
+	      ntohs(sin.sin_port) == ex->port,
+	      "NFS UDP socket not the old server's");
+	CHECK(tcp[P_NFS] == -1, "TCP socket from nowhere");
+
+	CHECK(nfs_upgrade_install_state(), "state not installed");
+	CHECK(!nfs_in_grace(), "grace period started");
+
+	if (nfs_client_id_get_confirmed(ex->clientid40, &clientid) !=
+	    CLIENT_ID_SUCCESS) {
+		CHECK(false, "v4.0 clientid %" PRIx64 " not carried",
+		      ex->clientid40);
+	} else {
+		CHECK(clientid->cid_minorversion == 0, "v4.0 minorversion");
+		CHECK(memcmp(clientid->cid_verifier, verifier40,
+			     NFS4_VERIFIER_SIZE) == 0, "v4.0 verifier");
+		CHECK(clientid->cid_last_renew == ex->last_renew40,
+		      "v4.0 last renewal");
+		dec_client_id_ref(clientid);
+	}
+
+	if (nfs_client_id_get_confirmed(ex->clientid41, &clientid) !=
+	    CLIENT_ID_SUCCESS) {
+		CHECK(false, "v4.1 clientid %" PRIx64 " not carried",
+		      ex->clientid41);
+	} else {
+		CHECK(clientid->cid_minorversion == 1, "v4.1 minorversion");
+		CHECK(memcmp(clientid->cid_verifier, verifier41,
+			     NFS4_VERIFIER_SIZE) == 0, "v4.1 verifier");
+		CHECK(clientid->cid_last_renew == ex->last_renew41,
+		      "v4.1 last renewal");
+
+		if (!nfs41_Session_Get_Pointer((char *)ex->sessionid,
+					       &session)) {
+			CHECK(false, "session not carried");
+		} else {
+			CHECK(session->clientid_record == clientid,
+			      "session of another client");
+			for (i = 0; i < NFS41_NB_SLOTS; i++)
+				CHECK(session->slots[i].sequence == 100 + i,
+				      "slot %d sequence %u", i,
+				      session->slots[i].sequence);
+			dec_session_ref(session);
+		}
+		dec_client_id_ref(clientid);
+	}
+
+	printf("%s  new server took over\n", failures ? "FAIL" : "ok  ");
+	return failures != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "/tmp";
+	char path[256];
+	struct expect ex;
+	int ready[2], connected[2];
+	pid_t old_pid, new_pid;
+	int status, rc = 0;
+
+	snprintf(path, sizeof(path), "%s/test_upgrade.%d", dir,
+		 (int)getpid());
+	snprintf(config, sizeof(config),
+		 "NFS_Upgrade { Enable = true; Socket = \"%s\"; Timeout = 30; }",
+		 path);
+
+	if (pipe(ready) != 0 || pipe(connected) != 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	old_pid = fork();
+	if (old_pid == 0) {
+		close(ready[0]);
+		close(connected[1]);
+		_exit(old_server(ready[1], connected[0]));
+	}
+	close(ready[1]);
+	close(connected[0]);
+
+	if (old_pid < 0 || read_full(ready[0], &ex, sizeof(ex)) != 0) {
+		printf("FAIL: old server did not start\n");
+		rc = 1;
+		goto out;
+	}
+
+	/* Forked before any SAL table of this process exists */
+	new_pid = fork();
+	if (new_pid == 0)
+		_exit(new_server(&ex, connected[1]));
+	close(connected[1]);
+
+	if (new_pid < 0 || waitpid(new_pid, &status, 0) != new_pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		rc = 1;
+
+ out:
+	if (old_pid > 0 && (waitpid(old_pid, &status, 0) != old_pid ||
+			    !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+		rc = 1;
+	unlink(path);
+
+	printf(rc ? "FAIL\n" : "PASS\n");
+	return rc;
+}
@@ -0,0 +1,353 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_vfs_notify.c
+ * @brief Local changes to an FSAL_VFS export turned into upcalls
+ *
+ * A directory is exported through FSAL_VFS with change_notify, and
+ * the upcalls the watcher makes are recorded.  A child process, whose
+ * changes are not the server's own, then works on the directory
+ * directly:
+ *
+ * - Writing to a file updates the file's attributes, with its new
+ *   size.
+ * - Creating a file invalidates the directory's attributes and
+ *   entries.
+ *
+ * Then a queue overflow, as fanotify reports it, is handed to the
+ * watcher's event handling, and every object the FSAL has a handle
+ * for on the file system is invalidated.
+ *
+ * Must run as root.  Usage: test_vfs_notify [directory]
+ * The directory defaults to /dev/shm, which is tmpfs.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef LINUX
+#include <sys/fanotify.h>
+#endif
+#include "fsal.h"
+#include "fsal_up.h"
+#include "FSAL/fsal_commonlib.h"
+#include "../FSAL/FSAL_VFS/vfs_methods.h"
+#include "vfs_fixture.h"
+
+#define MAX_CALLS 256
+#define WAIT_MS 5000
+
+static int failures;
+
+#define CHECK(cond, ...)					\
+	do {							\
+		if (!(cond)) {					\
+			printf("FAIL: " __VA_ARGS__);		\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+enum call_kind {
+	CALL_INVALIDATE,
+	CALL_UPDATE
+};
+
+struct call {
+	enum call_kind kind;
+	char key[VFS_HANDLE_LEN];
+	size_t key_len;
+	uint32_t flags;
+	uint64_t filesize;	/*< For updates carrying the size */
+	bool has_size;
+};
+
+static pthread_mutex_t calls_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t calls_cond = PTHREAD_COND_INITIALIZER;
+static struct call calls[MAX_CALLS];
+static int ncalls;
+
+static void record(enum call_kind kind, struct gsh_buffdesc *key,
+		   uint32_t flags, struct attrlist *attr)
+{
+	struct call *c;
+
+	pthread_mutex_lock(&calls_mutex);
+	if (ncalls < MAX_CALLS && key->len <= VFS_HANDLE_LEN) {
+		c = &calls[ncalls++];
+		c->kind = kind;
+		memcpy(c->key, key->addr, key->len);
+		c->key_len = key->len;
+		c->flags = flags;
+		c->has_size = attr != NULL &&
+		    FSAL_TEST_MASK(attr->mask, ATTR_SIZE);
+		c->filesize = c->has_size ? attr->filesize : 0;
+	}
+	pthread_cond_broadcast(&calls_cond);
+	pthread_mutex_unlock(&calls_mutex);
+}
+
+static cache_inode_status_t test_invalidate(struct fsal_module *fsal,
+					    struct gsh_buffdesc *obj,
+					    uint32_t flags)
+{
+	record(CALL_INVALIDATE, obj, flags, NULL);
+	return CACHE_INODE_SUCCESS;
+}
+
+static cache_inode_status_t test_update(struct fsal_module *fsal,
+					struct gsh_buffdesc *obj,
+					struct attrlist *attr,
+					uint32_t flags)
+{
+	record(CALL_UPDATE, obj, flags, attr);
+	return CACHE_INODE_SUCCESS;
+}
+
+static struct fsal_up_vector test_up_ops = {
+	.invalidate = test_invalidate,
+	.update = test_update,
+};
+
+static void forget_calls(void)
+{
+	pthread_mutex_lock(&calls_mutex);
+	ncalls = 0;
+	pthread_mutex_unlock(&calls_mutex);
+}
+
+static bool same_key(const struct call *c, const struct gsh_buffdesc *key)
+{
+	return c->key_len == key->len &&
+	    memcmp(c->key, key->addr, key->len) == 0;
+}
+
+/**
+ * @brief Wait for a call on an object
+ *
+ * @param[in]  kind    Invalidate or update
+ * @param[in]  key     Object's key
+ * @param[in]  flags   Flags the call must have, all of them
+ * @param[out] found   The call, if one came
+ *
+ * @return true if one came within WAIT_MS.
+ */
+
+static bool wait_call(enum call_kind kind, const struct gsh_buffdesc *key,
+		      uint32_t flags, struct call *found)
+{
+	struct timespec until;
+	bool got = false;
+	int i;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += WAIT_MS / 1000;
+
+	pthread_mutex_lock(&calls_mutex);
+	while (!got) {
+		for (i = 0; i < ncalls && !got; i++) {
+			if (calls[i].kind == kind && same_key(&calls[i], key)
+			    && (calls[i].flags & flags) == flags) {
+				*found = calls[i];
+				got = true;
+			}
+		}
+		if (!got && pthread_cond_timedwait(&calls_cond, &calls_mutex,
+						   &until) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&calls_mutex);
+
+	return got;
+}
+
+/**
+ * @brief Change the directory from another process
+ */
+
+static bool elsewhere(const char *dir, const char *name, bool create)
+{
+	char path[4200];
+	pid_t pid;
+	int status, fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	pid = fork();
+	if (pid == 0) {
+		fd = open(path, create ? O_WRONLY | O_CREAT | O_EXCL
+					: O_WRONLY | O_APPEND, 0644);
+		if (fd < 0 || write(fd, "0123456789", 10) != 10)
+			_exit(1);
+		close(fd);
+		_exit(0);
+	}
+
+	return pid > 0 && waitpid(pid, &status, 0) == pid &&
+	    WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void local_changes(const char *dir, struct gsh_buffdesc *dir_key,
+			  struct gsh_buffdesc *file_key)
+{
+	struct call c;
+	int had = failures;
+
+	forget_calls();
+	CHECK(elsewhere(dir, "file", false), "could not write the file");
+	if (wait_call(CALL_UPDATE, file_key, 0, &c))
+		CHECK(c.has_size && c.filesize == 10,
+		      "update without the new size");
+	else
+		CHECK(false, "no update for a write");
+	printf("%s  write elsewhere updates the file's attributes\n",
+	       failures != had ? "FAIL" : "ok  ");
+
+	had = failures;
+	forget_calls();
+	CHECK(elsewhere(dir, "new", true), "could not create a file");
+	CHECK(wait_call(CALL_INVALIDATE, dir_key,
+			CACHE_INODE_INVALIDATE_ATTRS |
+			CACHE_INODE_INVALIDATE_CONTENT, &c),
+	      "no invalidation of the directory for a create");
+	printf("%s  create elsewhere invalidates the directory\n",
+	       failures != had ? "FAIL" : "ok  ");
+}
+
+static void overflow(struct vfs_filesystem *vfs_fs,
+		     struct gsh_buffdesc *dir_key,
+		     struct gsh_buffdesc *file_key)
+{
+	struct fanotify_event_metadata md;
+	uint32_t all = CACHE_INODE_INVALIDATE_ATTRS |
+	    CACHE_INODE_INVALIDATE_CONTENT;
+	struct call c;
+	int had = failures;
+
+	/* Let the creation's events settle before looking */
+	usleep(200000);
+	forget_calls();
+
+	memset(&md, 0, sizeof(md));
+	md.event_len = sizeof(md);
+	md.vers = FANOTIFY_METADATA_VERSION;
+	md.metadata_len = sizeof(md);
+	md.mask = FAN_Q_OVERFLOW;
+	md.fd = FAN_NOFD;
+
+	CHECK(vfs_notify_events(vfs_fs, &md, sizeof(md)),
+	      "overflow not understood");
+	CHECK(wait_call(CALL_INVALIDATE, dir_key, all, &c),
+	      "directory not invalidated on overflow");
+	CHECK(wait_call(CALL_INVALIDATE, file_key, all, &c),
+	      "file not invalidated on overflow");
+	CHECK(!(c.flags & CACHE_INODE_INVALIDATE_EXPIRE),
+	      "overflow gave back timed expiry");
+	printf("%s  overflow invalidates the whole file system\n",
+	       failures != had ? "FAIL" : "ok  ");
+}
+
+int main(int argc, char **argv)
+{
+	const char *parent = argc > 1 ? argv[1] : "/dev/shm";
+	struct vfs_fixture fx;
+	struct vfs_filesystem *vfs_fs;
+	struct fsal_obj_handle *file;
+	struct gsh_buffdesc key, dir_key, file_key;
+	char dir_buf[VFS_HANDLE_LEN], file_buf[VFS_HANDLE_LEN];
+	char dir[256], path[300], new_path[300];
+	fsal_status_t status;
+	int fd, rc;
+
+	if (geteuid() != 0) {
+		printf("SKIP: fanotify and open_by_handle_at need root\n");
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "%s/test_vfs_notify.XXXXXX", parent);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 2;
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	snprintf(new_path, sizeof(new_path), "%s/new", dir);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		perror(path);
+		return 2;
+	}
+	close(fd);
+
+	rc = vfs_fixture_init(&fx, dir, NULL, "change_notify = true;",
+			      &test_up_ops);
+	if (rc != 0) {
+		printf("SKIP: cannot export %s: %s\n", dir, strerror(rc));
+		goto out;
+	}
+
+	vfs_fs = fx.root->fs->private;
+	if (vfs_fs->notify_fd < 0) {
+		printf("SKIP: %s cannot be watched\n", fx.root->fs->path);
+		vfs_fixture_fini(&fx);
+		goto out;
+	}
+
+	status = vfs_fixture_lookup(&fx, "file", &file);
+	if (FSAL_IS_ERROR(status)) {
+		printf("FAIL: lookup: %s\n", msg_fsal_err(status.major));
+		failures++;
+		vfs_fixture_fini(&fx);
+		goto out;
+	}
+
+	/* Keys as the cache knows the objects by */
+	fx.root->obj_ops.handle_to_key(fx.root, &key);
+	memcpy(dir_buf, key.addr, key.len);
+	dir_key.addr = dir_buf;
+	dir_key.len = key.len;
+	file->obj_ops.handle_to_key(file, &key);
+	memcpy(file_buf, key.addr, key.len);
+	file_key.addr = file_buf;
+	file_key.len = key.len;
+
+	local_changes(dir, &dir_key, &file_key);
+	overflow(vfs_fs, &dir_key, &file_key);
+
+	file->obj_ops.release(file);
+	vfs_fixture_fini(&fx);
+
+ out:
+	unlink(new_path);
+	unlink(path);
+	rmdir(dir);
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures != 0;
+}
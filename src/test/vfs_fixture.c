@@ -0,0 +1,238 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file vfs_fixture.c
+ * @brief An FSAL_VFS export of a directory, for tests
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "fsal.h"
+#include "nfs_core.h"
+#include "fridgethr.h"
+#include "delayed_exec.h"
+#include "FSAL/fsal_commonlib.h"
+#include "cache_inode.h"
+#include "cache_inode_lru.h"
+#include "sal_functions.h"
+#include "vfs_fixture.h"
+
+/**
+ * @brief Export a directory through FSAL_VFS
+ *
+ * The general fridge and the delayed executor, which FSAL_VFS queues
+ * upcalls and retries on, are started too.
+ *
+ * @param[out] fx            Fixture
+ * @param[in]  dir           Directory to export
+ * @param[in]  vfs_params    Body of the VFS {} block, or NULL
+ * @param[in]  export_params Body of the export's FSAL {} block, or NULL
+ * @param[in]  up_ops        Upcalls the export makes
+ *
+ * @return 0, or an errno.
+ */
+
+int vfs_fixture_init(struct vfs_fixture *fx, const char *dir,
+		     const char *vfs_params, const char *export_params,
+		     const struct fsal_up_vector *up_ops)
+{
+	static bool started;
+	char path[] = "/tmp/vfs_fixture.XXXXXX";
+	struct config_error_type err_type;
+	struct config_node_list *node = NULL;
+	fsal_status_t status;
+	FILE *f;
+	int fd;
+
+	memset(fx, 0, sizeof(*fx));
+	fx->export = &fx->export_st.export;
+
+	if (!started) {
+		if (general_fridge_init() != 0)
+			return ENOMEM;
+		delayed_start();
+		started = true;
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return errno;
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlink(path);
+		return EIO;
+	}
+	fprintf(f, "VFS {\n%s\n}\nFSAL {\nName = VFS;\n%s\n}\n",
+		vfs_params != NULL ? vfs_params : "",
+		export_params != NULL ? export_params : "");
+	fclose(f);
+
+	(void) init_error_type(&err_type);
+	fx->config = config_ParseFile(path, &err_type);
+	unlink(path);
+	if (fx->config == NULL || !config_error_is_harmless(&err_type))
+		return EINVAL;
+
+	fx->fsal = lookup_fsal("VFS");
+	if (fx->fsal == NULL)
+		return ENOENT;
+
+	status = fx->fsal->m_ops.init_config(fx->fsal, fx->config, &err_type);
+	if (FSAL_IS_ERROR(status))
+		return EINVAL;
+
+	if (find_config_nodes(fx->config, "FSAL", &node, &err_type) != 0)
+		return EINVAL;
+
+	fx->export->fullpath = (char *)dir;
+	fx->export->pseudopath = (char *)dir;
+	fx->export->export_id = 1;
+	PTHREAD_RWLOCK_init(&fx->export->lock, NULL);
+	glist_init(&fx->export->entry_list);
+	glist_init(&fx->export->exp_state_list);
+	glist_init(&fx->export->exp_lock_list);
+	glist_init(&fx->export->exp_nlm_share_list);
+	glist_init(&fx->export->exp_root_list);
+	init_root_op_context(&fx->root_op_context, fx->export, NULL,
+			     NFS_V4, 1, NFS_REQUEST);
+
+	status = fx->fsal->m_ops.create_export(fx->fsal, node->tree_node,
+					       &err_type, up_ops);
+	gsh_free(node);
+	if (FSAL_IS_ERROR(status))
+		return status.minor != 0 ? status.minor : EINVAL;
+
+	fx->exp = op_ctx->fsal_export;
+	fx->export->fsal_export = fx->exp;
+
+	status = fx->exp->exp_ops.lookup_path(fx->exp, dir, &fx->root);
+	if (FSAL_IS_ERROR(status))
+		return status.minor != 0 ? status.minor : EINVAL;
+
+	return 0;
+}
+
+/**
+ * @brief Put the export behind the inode cache
+ *
+ * The cache, its LRU and the lock layer are started as
+ * init_server_pkgs and nfs_Init start them, from the cache parameters
+ * already loaded, and the export's root is cached and pinned as
+ * init_export_root pins it.  Locks, shares and I/O then go through
+ * the cache and SAL as a request's would.
+ *
+ * @param[in,out] fx Fixture
+ *
+ * @return 0, or an errno.
+ */
+
+int vfs_fixture_cache(struct vfs_fixture *fx)
+{
+	static bool started;
+	struct fsal_obj_handle *root;
+	fsal_status_t status;
+
+	if (!started) {
+		if (cache_inode_init() != CACHE_INODE_SUCCESS ||
+		    cache_inode_lru_pkginit() != 0 ||
+		    state_lock_init() != STATE_SUCCESS)
+			return ENOMEM;
+		started = true;
+	}
+
+	status = fx->exp->exp_ops.lookup_path(fx->exp, fx->export->fullpath,
+					      &root);
+	if (FSAL_IS_ERROR(status))
+		return status.minor != 0 ? status.minor : EINVAL;
+
+	(void) cache_inode_new_entry(root, CACHE_INODE_FLAG_NONE,
+				     &fx->root_entry);
+	if (fx->root_entry == NULL)
+		return EFAULT;
+
+	/* Instead of an LRU reference, the root holds a pin reference */
+	if (cache_inode_inc_pin_ref(fx->root_entry) != CACHE_INODE_SUCCESS) {
+		cache_inode_put(fx->root_entry);
+		fx->root_entry = NULL;
+		return EFAULT;
+	}
+	cache_inode_put(fx->root_entry);
+
+	fx->export->exp_root_cache_inode = fx->root_entry;
+
+	return 0;
+}
+
+/**
+ * @brief Look a name up in the cached export
+ *
+ * @param[in]  fx    Fixture, after vfs_fixture_cache
+ * @param[in]  name  Name in the exported directory
+ * @param[out] entry The entry, with an LRU reference for the caller
+ */
+
+cache_inode_status_t vfs_fixture_entry(struct vfs_fixture *fx,
+				       const char *name,
+				       cache_entry_t **entry)
+{
+	return cache_inode_lookup(fx->root_entry, name, entry);
+}
+
+/**
+ * @brief Look a name up in the exported directory
+ */
+
+fsal_status_t vfs_fixture_lookup(struct vfs_fixture *fx, const char *name,
+				 struct fsal_obj_handle **obj)
+{
+	return fx->root->obj_ops.lookup(fx->root, name, obj);
+}
+
+/**
+ * @brief Take the export down
+ *
+ * Once cached, the export stays up until exit, its entries holding
+ * handles of it.
+ */
+
+void vfs_fixture_fini(struct vfs_fixture *fx)
+{
+	if (fx->root != NULL)
+		fx->root->obj_ops.release(fx->root);
+	if (fx->root_entry != NULL) {
+		op_ctx = NULL;
+		return;
+	}
+	if (fx->exp != NULL)
+		fx->exp->exp_ops.release(fx->exp);
+	if (fx->fsal != NULL)
+		fsal_put(fx->fsal);
+	if (fx->config != NULL)
+		config_Free(fx->config);
+	op_ctx = NULL;
+}
@@ -0,0 +1,70 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file vfs_fixture.h
+ * @brief An FSAL_VFS export of a directory, for tests
+ *
+ * The tests using this are built with FSAL_VFS itself, which then
+ * registers at startup as a static FSAL would.  vfs_fixture_init gives
+ * it its global configuration, creates an export of the directory and
+ * looks up its root, under a root op context that stays current until
+ * vfs_fixture_fini.  op_ctx is per thread, so other threads calling
+ * the FSAL need one of their own.
+ *
+ * vfs_fixture_cache puts the export behind the inode cache, for tests
+ * of the cache and SAL.  The server parameters must have been loaded
+ * first, as sal_fixture_init loads them.
+ */
+
+#ifndef VFS_FIXTURE_H
+#define VFS_FIXTURE_H
+
+#include "fsal.h"
+#include "fsal_up.h"
+#include "export_mgr.h"
+#include "cache_inode.h"
+#include "server_stats_private.h"
+
+struct vfs_fixture {
+	struct export_stats export_st;	/*< As alloc_export makes it */
+	struct gsh_export *export;
+	struct root_op_context root_op_context;
+	config_file_t config;
+	struct fsal_module *fsal;
+	struct fsal_export *exp;
+	struct fsal_obj_handle *root;
+	cache_entry_t *root_entry;
+};
+
+int vfs_fixture_init(struct vfs_fixture *fx, const char *dir,
+		     const char *vfs_params, const char *export_params,
+		     const struct fsal_up_vector *up_ops);
+void vfs_fixture_fini(struct vfs_fixture *fx);
+int vfs_fixture_cache(struct vfs_fixture *fx);
+
+fsal_status_t vfs_fixture_lookup(struct vfs_fixture *fx, const char *name,
+				 struct fsal_obj_handle **obj);
+cache_inode_status_t vfs_fixture_entry(struct vfs_fixture *fx,
+				       const char *name,
+				       cache_entry_t **entry);
+
+#endif				/* VFS_FIXTURE_H */
@@ -0,0 +1,1294 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file ganesha_replay.c
+ * @brief Replay a request capture against a server
+ *
+ * Reads a log written with NFS_Capture enabled and sends the
+ * requests again, each captured connection on its own connection,
+ * in the order they arrived and, unless asked to go faster, at the
+ * times they arrived.  Each connection waits for a reply before
+ * sending its next request.
+ *
+ * The replay server is expected to export a copy of what the captured
+ * server exported, e.g. the same tree copied to a tmpfs exported
+ * with FSAL_VFS.  File handles, NFSv4 client ids, session ids and
+ * stateids handed out by the replay server differ from the captured
+ * ones; they are learnt by comparing the captured results of MNT,
+ * NFSv3 LOOKUP, CREATE, MKDIR, SYMLINK, MKNOD and READDIRPLUS and of
+ * NFSv4 GETFH, OPEN, OPEN_CONFIRM, OPEN_DOWNGRADE, LOCK, SETCLIENTID,
+ * EXCHANGE_ID and CREATE_SESSION with the replay server's, and
+ * substituted in later arguments.  NLM and RQUOTA arguments are sent
+ * as captured.  Credentials are sent as AUTH_SYS with the captured
+ * uid and gids.
+ *
+ * Usage: ganesha_replay [-h host] [-n nfs_port] [-m mnt_port]
+ *                       [-l nlm_port] [-q rquota_port] [-9 9p_port]
+ *                       [-s speed] capture
+ *
+ * A speed of 1 replays at the captured rate, 2 twice as fast, and 0
+ * as fast as the server answers.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "nfs23.h"
+#include "mount.h"
+#include "nlm4.h"
+#include "rquota.h"
+#include "nfs4.h"
+#define NFS_CAPTURE_FORMAT_ONLY
+#include "nfs_capture.h"
+
+#define NBUCKETS 40
+#define MAP_BUCKETS 65536
+#define MAX_SOCKS 8
+#define REPLAY_MACHINE "ganesha-replay"
+
+enum map_kind {
+	MAP_FH3,
+	MAP_FH4,
+	MAP_CLIENTID,
+	MAP_VERIFIER,
+	MAP_SESSIONID,
+	MAP_STATEID
+};
+
+struct map_ent {
+	struct map_ent *next;
+	enum map_kind kind;
+	u_int klen;
+	u_int vlen;
+	char *key;
+	char *val;
+};
+
+struct buf {
+	char *p;
+	size_t len;
+	size_t cap;
+};
+
+struct sock {
+	uint32_t prog;		/*< RPC program, 0 for 9P */
+	int fd;
+};
+
+/**
+ * @brief A captured connection and its records, in arrival order
+ */
+
+struct stream {
+	uint64_t conn;
+	uint16_t kind;
+	uint8_t addr[16];
+	uint16_t port;
+	struct nfs_capture_record **recs;
+	size_t nrecs;
+	size_t cap;
+	struct sock socks[MAX_SOCKS];
+	int nsocks;
+	pthread_t thr;
+};
+
+static const char *host = "127.0.0.1";
+static int nfs_port = 2049;
+static int mnt_port;
+static int nlm_port;
+static int rquota_port;
+static int p9_port = 564;
+static double speed = 1.0;
+
+static struct stream **streams;
+static size_t nstreams;
+
+static struct map_ent *map[MAP_BUCKETS];
+static pthread_mutex_t map_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t next_xid = 1;
+static struct timespec start;
+
+/* Results */
+static uint64_t hist[NBUCKETS];
+static uint64_t total_ns;
+static uint64_t replayed;
+static uint64_t skipped;
+static uint64_t mismatches;
+static uint64_t failures;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Growable buffers */
+
+static void buf_reserve(struct buf *b, size_t more)
+{
+	if (b->len + more <= b->cap)
+		return;
+
+	while (b->len + more > b->cap)
+		b->cap = b->cap ? b->cap * 2 : 4096;
+
+	b->p = realloc(b->p, b->cap);
+	if (b->p == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+}
+
+static void buf_put(struct buf *b, const void *data, size_t len)
+{
+	static const char zero[4];
+	size_t pad = nfs_capture_pad(len) - len;
+
+	buf_reserve(b, len + pad);
+	memcpy(b->p + b->len, data, len);
+	memcpy(b->p + b->len + len, zero, pad);
+	b->len += len + pad;
+}
+
+static void buf_put_u32(struct buf *b, uint32_t val)
+{
+	val = htonl(val);
+	buf_put(b, &val, sizeof(val));
+}
+
+static void buf_put_opaque(struct buf *b, const void *data, u_int len)
+{
+	buf_put_u32(b, len);
+	buf_put(b, data, len);
+}
+
+static uint32_t get_u32(const char *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return ntohl(val);
+}
+
+/* Map from captured to replayed identifiers */
+
+static uint32_t map_hash(enum map_kind kind, const char *key, u_int klen)
+{
+	uint32_t h = 2166136261u ^ kind;
+	u_int i;
+
+	for (i = 0; i < klen; i++)
+		h = (h ^ (unsigned char)key[i]) * 16777619u;
+
+	return h % MAP_BUCKETS;
+}
+
+static void map_put(enum map_kind kind, const void *key, u_int klen,
+		    const void *val, u_int vlen)
+{
+	uint32_t h = map_hash(kind, key, klen);
+	struct map_ent *e;
+
+	pthread_mutex_lock(&map_mtx);
+	for (e = map[h]; e != NULL; e = e->next)
+		if (e->kind == kind && e->klen == klen
+		    && memcmp(e->key, key, klen) == 0)
+			break;
+
+	if (e == NULL) {
+		e = calloc(1, sizeof(*e));
+		e->kind = kind;
+		e->klen = klen;
+		e->key = malloc(klen);
+		memcpy(e->key, key, klen);
+		e->next = map[h];
+		map[h] = e;
+	} else {
+		free(e->val);
+	}
+
+	e->vlen = vlen;
+	e->val = malloc(vlen);
+	memcpy(e->val, val, vlen);
+	pthread_mutex_unlock(&map_mtx);
+}
+
+/**
+ * @brief Look up a mapping
+ *
+ * @return A malloc'd copy of the replay value, or NULL.
+ */
+
+static char *map_get(enum map_kind kind, const void *key, u_int klen,
+		     u_int *vlen)
+{
+	uint32_t h = map_hash(kind, key, klen);
+	struct map_ent *e;
+	char *val = NULL;
+
+	pthread_mutex_lock(&map_mtx);
+	for (e = map[h]; e != NULL; e = e->next)
+		if (e->kind == kind && e->klen == klen
+		    && memcmp(e->key, key, klen) == 0) {
+			val = malloc(e->vlen);
+			memcpy(val, e->val, e->vlen);
+			*vlen = e->vlen;
+			break;
+		}
+	pthread_mutex_unlock(&map_mtx);
+
+	return val;
+}
+
+/**
+ * @brief Overwrite a fixed size identifier with its mapping
+ */
+
+static void map_fixed(enum map_kind kind, void *id, u_int len)
+{
+	u_int vlen;
+	char *val = map_get(kind, id, len, &vlen);
+
+	if (val != NULL && vlen == len)
+		memcpy(id, val, len);
+	free(val);
+}
+
+/* NFSv3 and MOUNT, handled on the wire encoding */
+
+/**
+ * @brief Learn a handle pair from two encoded nfs_fh3
+ */
+
+static void learn_fh3(const char *cap, u_int caplen, u_int capoff,
+		      const char *rep, u_int replen, u_int repoff)
+{
+	u_int clen, rlen;
+
+	if (capoff + 4 > caplen || repoff + 4 > replen)
+		return;
+
+	clen = get_u32(cap + capoff);
+	rlen = get_u32(rep + repoff);
+	if (capoff + 4 + clen > caplen || repoff + 4 + rlen > replen)
+		return;
+
+	map_put(MAP_FH3, cap + capoff + 4, clen, rep + repoff + 4, rlen);
+}
+
+/**
+ * @brief Copy an encoded nfs_fh3 at *pos, mapped, advancing *pos
+ */
+
+static bool splice_fh3(struct buf *out, const char *in, u_int len,
+		       u_int *pos)
+{
+	u_int flen, vlen;
+	char *val;
+
+	if (*pos + 4 > len)
+		return false;
+
+	flen = get_u32(in + *pos);
+	if (*pos + 4 + nfs_capture_pad(flen) > len)
+		return false;
+
+	val = map_get(MAP_FH3, in + *pos + 4, flen, &vlen);
+	if (val != NULL) {
+		buf_put_opaque(out, val, vlen);
+		free(val);
+	} else {
+		buf_put(out, in + *pos, 4 + flen);
+	}
+	*pos += 4 + nfs_capture_pad(flen);
+
+	return true;
+}
+
+/**
+ * @brief Copy an encoded string at *pos, advancing *pos
+ */
+
+static bool splice_string(struct buf *out, const char *in, u_int len,
+			  u_int *pos)
+{
+	u_int slen;
+
+	if (*pos + 4 > len)
+		return false;
+
+	slen = get_u32(in + *pos);
+	if (*pos + 4 + nfs_capture_pad(slen) > len)
+		return false;
+
+	buf_put(out, in + *pos, 4 + nfs_capture_pad(slen));
+	*pos += 4 + nfs_capture_pad(slen);
+
+	return true;
+}
+
+static bool map_args_nfs3(struct buf *out, uint32_t proc, const char *in,
+			  u_int len)
+{
+	u_int pos = 0;
+
+	if (proc == NFSPROC3_NULL)
+		return true;
+
+	/* Every NFSv3 call starts with a handle */
+	if (!splice_fh3(out, in, len, &pos))
+		return false;
+
+	if (proc == NFSPROC3_LINK) {
+		if (!splice_fh3(out, in, len, &pos))
+			return false;
+	} else if (proc == NFSPROC3_RENAME) {
+		if (!splice_string(out, in, len, &pos)
+		    || !splice_fh3(out, in, len, &pos))
+			return false;
+	}
+
+	buf_put(out, in + pos, len - pos);
+	return true;
+}
+
+static bool decode(xdrproc_t proc, void *obj, const char *data, u_int len)
+{
+	XDR xdrs;
+	bool ok;
+
+	xdrmem_create(&xdrs, (char *)data, len, XDR_DECODE);
+	ok = (*proc)(&xdrs, obj);
+	xdr_destroy(&xdrs);
+
+	return ok;
+}
+
+static void learn_readdirplus(const char *cap, u_int caplen,
+			      const char *rep, u_int replen)
+{
+	READDIRPLUS3res cres, rres;
+	entryplus3 *ce, *re;
+
+	memset(&cres, 0, sizeof(cres));
+	memset(&rres, 0, sizeof(rres));
+
+	if (!decode((xdrproc_t) xdr_READDIRPLUS3res, &cres, cap, caplen)
+	    || !decode((xdrproc_t) xdr_READDIRPLUS3res, &rres, rep, replen))
+		goto out;
+
+	if (cres.status != NFS3_OK || rres.status != NFS3_OK)
+		goto out;
+
+	/* The two servers list a directory in their own order */
+	for (ce = cres.READDIRPLUS3res_u.resok.reply.entries; ce != NULL;
+	     ce = ce->nextentry) {
+		if (!ce->name_handle.handle_follows)
+			continue;
+
+		for (re = rres.READDIRPLUS3res_u.resok.reply.entries;
+		     re != NULL; re = re->nextentry)
+			if (re->name_handle.handle_follows
+			    && strcmp(ce->name, re->name) == 0)
+				break;
+
+		if (re != NULL) {
+			nfs_fh3 *cfh = &ce->name_handle.post_op_fh3_u.handle;
+			nfs_fh3 *rfh = &re->name_handle.post_op_fh3_u.handle;
+
+			/* Decoding converted the handles, key the map on
+			 * the wire form like the other NFSv3 handles. */
+			struct buf cb = { 0 }, rb = { 0 };
+			XDR xdrs;
+
+			buf_reserve(&cb, 4 + NFS3_FHSIZE + 4);
+			buf_reserve(&rb, 4 + NFS3_FHSIZE + 4);
+			xdrmem_create(&xdrs, cb.p, cb.cap, XDR_ENCODE);
+			xdr_nfs_fh3(&xdrs, cfh);
+			xdr_destroy(&xdrs);
+			xdrmem_create(&xdrs, rb.p, rb.cap, XDR_ENCODE);
+			xdr_nfs_fh3(&xdrs, rfh);
+			xdr_destroy(&xdrs);
+			learn_fh3(cb.p, cb.cap, 0, rb.p, rb.cap, 0);
+			free(cb.p);
+			free(rb.p);
+		}
+	}
+
+ out:
+	xdr_free((xdrproc_t) xdr_READDIRPLUS3res, &cres);
+	xdr_free((xdrproc_t) xdr_READDIRPLUS3res, &rres);
+}
+
+static void learn_nfs3(uint32_t proc, const char *cap, u_int caplen,
+		       const char *rep, u_int replen)
+{
+	if (caplen < 8 || replen < 8 || get_u32(cap) != NFS3_OK
+	    || get_u32(rep) != NFS3_OK)
+		return;
+
+	switch (proc) {
+	case NFSPROC3_LOOKUP:
+		learn_fh3(cap, caplen, 4, rep, replen, 4);
+		break;
+	case NFSPROC3_CREATE:
+	case NFSPROC3_MKDIR:
+	case NFSPROC3_SYMLINK:
+	case NFSPROC3_MKNOD:
+		/* post_op_fh3 */
+		if (get_u32(cap + 4) && get_u32(rep + 4))
+			learn_fh3(cap, caplen, 8, rep, replen, 8);
+		break;
+	case NFSPROC3_READDIRPLUS:
+		learn_readdirplus(cap, caplen, rep, replen);
+		break;
+	}
+}
+
+/* NFSv4, handled on the decoded compound */
+
+struct fh_swap {
+	nfs_fh4 *fh;
+	nfs_fh4 orig;
+};
+
+static void map_fh4(nfs_fh4 *fh, struct fh_swap *swaps, int *nswaps)
+{
+	u_int vlen;
+	char *val = map_get(MAP_FH4, fh->nfs_fh4_val, fh->nfs_fh4_len, &vlen);
+
+	if (val == NULL)
+		return;
+
+	/* Put back before freeing the args, the copy is ours */
+	swaps[*nswaps].fh = fh;
+	swaps[*nswaps].orig = *fh;
+	(*nswaps)++;
+	fh->nfs_fh4_val = val;
+	fh->nfs_fh4_len = vlen;
+}
+
+static void map_stateid(stateid4 *stateid)
+{
+	map_fixed(MAP_STATEID, stateid->other, sizeof(stateid->other));
+}
+
+static void map_clientid(clientid4 *clientid)
+{
+	map_fixed(MAP_CLIENTID, clientid, sizeof(*clientid));
+}
+
+static bool map_args_nfs4(struct buf *out, const char *in, u_int len)
+{
+	COMPOUND4args args;
+	struct fh_swap *swaps;
+	int nswaps = 0;
+	bool ok = false;
+	u_int i;
+	XDR xdrs;
+
+	memset(&args, 0, sizeof(args));
+	if (!decode((xdrproc_t) xdr_COMPOUND4args, &args, in, len))
+		goto out;
+
+	swaps = calloc(args.argarray.argarray_len + 1, sizeof(*swaps));
+
+	for (i = 0; i < args.argarray.argarray_len; i++) {
+		nfs_argop4 *op = &args.argarray.argarray_val[i];
+
+		switch (op->argop) {
+		case NFS4_OP_PUTFH:
+			map_fh4(&op->nfs_argop4_u.opputfh.object, swaps,
+				&nswaps);
+			break;
+		case NFS4_OP_SETCLIENTID_CONFIRM:
+			map_clientid(&op->nfs_argop4_u.opsetclientid_confirm.
+				     clientid);
+			map_fixed(MAP_VERIFIER,
+				  op->nfs_argop4_u.opsetclientid_confirm.
+				  setclientid_confirm, NFS4_VERIFIER_SIZE);
+			break;
+		case NFS4_OP_RENEW:
+			map_clientid(&op->nfs_argop4_u.oprenew.clientid);
+			break;
+		case NFS4_OP_OPEN:
+			map_clientid(&op->nfs_argop4_u.opopen.owner.clientid);
+			break;
+		case NFS4_OP_OPEN_CONFIRM:
+			map_stateid(&op->nfs_argop4_u.opopen_confirm.
+				    open_stateid);
+			break;
+		case NFS4_OP_OPEN_DOWNGRADE:
+			map_stateid(&op->nfs_argop4_u.opopen_downgrade.
+				    open_stateid);
+			break;
+		case NFS4_OP_CLOSE:
+			map_stateid(&op->nfs_argop4_u.opclose.open_stateid);
+			break;
+		case NFS4_OP_LOCK:
+		{
+			locker4 *l = &op->nfs_argop4_u.oplock.locker;
+
+			if (l->new_lock_owner) {
+				map_stateid(&l->locker4_u.open_owner.
+					    open_stateid);
+				map_clientid(&l->locker4_u.open_owner.
+					     lock_owner.clientid);
+			} else {
+				map_stateid(&l->locker4_u.lock_owner.
+					    lock_stateid);
+			}
+			break;
+		}
+		case NFS4_OP_LOCKT:
+			map_clientid(&op->nfs_argop4_u.oplockt.owner.clientid);
+			break;
+		case NFS4_OP_LOCKU:
+			map_stateid(&op->nfs_argop4_u.oplocku.lock_stateid);
+			break;
+		case NFS4_OP_READ:
+			map_stateid(&op->nfs_argop4_u.opread.stateid);
+			break;
+		case NFS4_OP_WRITE:
+			map_stateid(&op->nfs_argop4_u.opwrite.stateid);
+			break;
+		case NFS4_OP_SETATTR:
+			map_stateid(&op->nfs_argop4_u.opsetattr.stateid);
+			break;
+		case NFS4_OP_DELEGRETURN:
+			map_stateid(&op->nfs_argop4_u.opdelegreturn.
+				    deleg_stateid);
+			break;
+		case NFS4_OP_FREE_STATEID:
+			map_stateid(&op->nfs_argop4_u.opfree_stateid.
+				    fsa_stateid);
+			break;
+		case NFS4_OP_RELEASE_LOCKOWNER:
+			map_clientid(&op->nfs_argop4_u.oprelease_lockowner.
+				     lock_owner.clientid);
+			break;
+		case NFS4_OP_CREATE_SESSION:
+			map_clientid(&op->nfs_argop4_u.opcreate_session.
+				     csa_clientid);
+			break;
+		case NFS4_OP_DESTROY_CLIENTID:
+			map_clientid(&op->nfs_argop4_u.opdestroy_clientid.
+				     dca_clientid);
+			break;
+		case NFS4_OP_SEQUENCE:
+			map_fixed(MAP_SESSIONID,
+				  op->nfs_argop4_u.opsequence.sa_sessionid,
+				  NFS4_SESSIONID_SIZE);
+			break;
+		case NFS4_OP_DESTROY_SESSION:
+			map_fixed(MAP_SESSIONID,
+				  op->nfs_argop4_u.opdestroy_session.
+				  dsa_sessionid, NFS4_SESSIONID_SIZE);
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* Worst case the mapped handles are all NFS4_FHSIZE */
+	buf_reserve(out, len + args.argarray.argarray_len * NFS4_FHSIZE);
+	xdrmem_create(&xdrs, out->p + out->len, out->cap - out->len,
+		      XDR_ENCODE);
+	ok = xdr_COMPOUND4args(&xdrs, &args);
+	out->len += xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+
+	while (nswaps > 0) {
+		nswaps--;
+		free(swaps[nswaps].fh->nfs_fh4_val);
+		*swaps[nswaps].fh = swaps[nswaps].orig;
+	}
+	free(swaps);
+
+ out:
+	xdr_free((xdrproc_t) xdr_COMPOUND4args, &args);
+	return ok;
+}
+
+static void learn_nfs4(const char *cap, u_int caplen, const char *rep,
+		       u_int replen)
+{
+	COMPOUND4res cres, rres;
+	u_int i, n;
+
+	memset(&cres, 0, sizeof(cres));
+	memset(&rres, 0, sizeof(rres));
+
+	if (!decode((xdrproc_t) xdr_COMPOUND4res, &cres, cap, caplen)
+	    || !decode((xdrproc_t) xdr_COMPOUND4res, &rres, rep, replen))
+		goto out;
+
+	n = cres.resarray.resarray_len;
+	if (rres.resarray.resarray_len < n)
+		n = rres.resarray.resarray_len;
+
+	for (i = 0; i < n; i++) {
+		nfs_resop4 *c = &cres.resarray.resarray_val[i];
+		nfs_resop4 *r = &rres.resarray.resarray_val[i];
+
+		if (c->resop != r->resop)
+			break;
+
+		switch (c->resop) {
+		case NFS4_OP_GETFH:
+		{
+			GETFH4res *cg = &c->nfs_resop4_u.opgetfh;
+			GETFH4res *rg = &r->nfs_resop4_u.opgetfh;
+
+			if (cg->status == NFS4_OK && rg->status == NFS4_OK)
+				map_put(MAP_FH4,
+					cg->GETFH4res_u.resok4.object.
+					nfs_fh4_val,
+					cg->GETFH4res_u.resok4.object.
+					nfs_fh4_len,
+					rg->GETFH4res_u.resok4.object.
+					nfs_fh4_val,
+					rg->GETFH4res_u.resok4.object.
+					nfs_fh4_len);
+			break;
+		}
+		case NFS4_OP_OPEN:
+			if (c->nfs_resop4_u.opopen.status == NFS4_OK
+			    && r->nfs_resop4_u.opopen.status == NFS4_OK)
+				map_put(MAP_STATEID,
+					c->nfs_resop4_u.opopen.OPEN4res_u.
+					resok4.stateid.other, 12,
+					r->nfs_resop4_u.opopen.OPEN4res_u.
+					resok4.stateid.other, 12);
+			break;
+		case NFS4_OP_OPEN_CONFIRM:
+			if (c->nfs_resop4_u.opopen_confirm.status == NFS4_OK
+			    && r->nfs_resop4_u.opopen_confirm.status == NFS4_OK)
+				map_put(MAP_STATEID,
+					c->nfs_resop4_u.opopen_confirm.
+					OPEN_CONFIRM4res_u.resok4.open_stateid.
+					other, 12,
+					r->nfs_resop4_u.opopen_confirm.
+					OPEN_CONFIRM4res_u.resok4.open_stateid.
+					other, 12);
+			break;
+		case NFS4_OP_OPEN_DOWNGRADE:
+			if (c->nfs_resop4_u.opopen_downgrade.status == NFS4_OK
+			    && r->nfs_resop4_u.opopen_downgrade.status ==
+			    NFS4_OK)
+				map_put(MAP_STATEID,
+					c->nfs_resop4_u.opopen_downgrade.
+					OPEN_DOWNGRADE4res_u.resok4.
+					open_stateid.other, 12,
+					r->nfs_resop4_u.opopen_downgrade.
+					OPEN_DOWNGRADE4res_u.resok4.
+					open_stateid.other, 12);
+			break;
+		case NFS4_OP_LOCK:
+			if (c->nfs_resop4_u.oplock.status == NFS4_OK
+			    && r->nfs_resop4_u.oplock.status == NFS4_OK)
+				map_put(MAP_STATEID,
+					c->nfs_resop4_u.oplock.LOCK4res_u.
+					resok4.lock_stateid.other, 12,
+					r->nfs_resop4_u.oplock.LOCK4res_u.
+					resok4.lock_stateid.other, 12);
+			break;
+		case NFS4_OP_SETCLIENTID:
+		{
+			SETCLIENTID4resok *cs, *rs;
+
+			if (c->nfs_resop4_u.opsetclientid.status != NFS4_OK
+			    || r->nfs_resop4_u.opsetclientid.status != NFS4_OK)
+				break;
+
+			cs = &c->nfs_resop4_u.opsetclientid.
+				SETCLIENTID4res_u.resok4;
+			rs = &r->nfs_resop4_u.opsetclientid.
+				SETCLIENTID4res_u.resok4;
+			map_put(MAP_CLIENTID, &cs->clientid,
+				sizeof(clientid4), &rs->clientid,
+				sizeof(clientid4));
+			map_put(MAP_VERIFIER, cs->setclientid_confirm,
+				NFS4_VERIFIER_SIZE, rs->setclientid_confirm,
+				NFS4_VERIFIER_SIZE);
+			break;
+		}
+		case NFS4_OP_EXCHANGE_ID:
+			if (c->nfs_resop4_u.opexchange_id.eir_status == NFS4_OK
+			    && r->nfs_resop4_u.opexchange_id.eir_status ==
+			    NFS4_OK)
+				map_put(MAP_CLIENTID,
+					&c->nfs_resop4_u.opexchange_id.
+					EXCHANGE_ID4res_u.eir_resok4.
+					eir_clientid, sizeof(clientid4),
+					&r->nfs_resop4_u.opexchange_id.
+					EXCHANGE_ID4res_u.eir_resok4.
+					eir_clientid, sizeof(clientid4));
+			break;
+		case NFS4_OP_CREATE_SESSION:
+			if (c->nfs_resop4_u.opcreate_session.csr_status ==
+			    NFS4_OK
+			    && r->nfs_resop4_u.opcreate_session.csr_status ==
+			    NFS4_OK)
+				map_put(MAP_SESSIONID,
+					c->nfs_resop4_u.opcreate_session.
+					CREATE_SESSION4res_u.csr_resok4.
+					csr_sessionid, NFS4_SESSIONID_SIZE,
+					r->nfs_resop4_u.opcreate_session.
+					CREATE_SESSION4res_u.csr_resok4.
+					csr_sessionid, NFS4_SESSIONID_SIZE);
+			break;
+		default:
+			break;
+		}
+	}
+
+ out:
+	xdr_free((xdrproc_t) xdr_COMPOUND4res, &cres);
+	xdr_free((xdrproc_t) xdr_COMPOUND4res, &rres);
+}
+
+/* Transport */
+
+static int port_for(uint32_t prog)
+{
+	switch (prog) {
+	case 0:
+		return p9_port;
+	case NFS_PROGRAM:
+		return nfs_port;
+	case MOUNTPROG:
+		return mnt_port;
+	case NLMPROG:
+		return nlm_port;
+	case RQUOTAPROG:
+		return rquota_port;
+	default:
+		return 0;
+	}
+}
+
+static int stream_sock(struct stream *st, uint32_t prog)
+{
+	struct addrinfo hints, *ai;
+	char service[16];
+	int one = 1;
+	int fd, i;
+
+	for (i = 0; i < st->nsocks; i++)
+		if (st->socks[i].prog == prog)
+			return st->socks[i].fd;
+
+	if (st->nsocks == MAX_SOCKS || port_for(prog) == 0)
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port_for(prog));
+	if (getaddrinfo(host, service, &hints, &ai) != 0)
+		return -1;
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	st->socks[st->nsocks].prog = prog;
+	st->socks[st->nsocks].fd = fd;
+	st->nsocks++;
+
+	return fd;
+}
+
+static int write_full(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void *data, size_t len)
+{
+	char *p = data;
+
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Read one RPC record, all fragments
+ */
+
+static int read_record(int fd, struct buf *b)
+{
+	uint32_t mark;
+	u_int len;
+
+	b->len = 0;
+	do {
+		if (read_full(fd, &mark, sizeof(mark)) != 0)
+			return -1;
+		mark = ntohl(mark);
+		len = mark & 0x7fffffff;
+		buf_reserve(b, len);
+		if (read_full(fd, b->p + b->len, len) != 0)
+			return -1;
+		b->len += len;
+	} while (!(mark & 0x80000000));
+
+	return 0;
+}
+
+/**
+ * @brief Build, send and wait for one RPC
+ *
+ * @param[out] res    Offset of the results in reply
+ * @return 0 on success, -1 on transport or RPC failure.
+ */
+
+static int replay_rpc(struct stream *st, struct nfs_capture_record *rec,
+		      struct buf *call, struct buf *reply, u_int *res)
+{
+	const uint32_t *gids = (const uint32_t *)(rec + 1);
+	const char *args = (const char *)(gids + rec->ngroups);
+	uint32_t xid = __sync_fetch_and_add(&next_xid, 1);
+	struct buf cred = { 0 };
+	u_int pos, vlen;
+	uint32_t mark;
+	int fd, i;
+	bool ok;
+
+	fd = stream_sock(st, rec->prog);
+	if (fd < 0)
+		return -1;
+
+	buf_put_u32(&cred, (uint32_t) time(NULL));
+	buf_put_opaque(&cred, REPLAY_MACHINE, strlen(REPLAY_MACHINE));
+	buf_put_u32(&cred, rec->uid);
+	buf_put_u32(&cred, rec->gid);
+	buf_put_u32(&cred, rec->ngroups);
+	for (i = 0; i < rec->ngroups; i++)
+		buf_put_u32(&cred, gids[i]);
+
+	call->len = 0;
+	buf_put_u32(call, 0);		/* record mark, below */
+	buf_put_u32(call, xid);
+	buf_put_u32(call, 0);		/* CALL */
+	buf_put_u32(call, 2);		/* RPC version */
+	buf_put_u32(call, rec->prog);
+	buf_put_u32(call, rec->vers);
+	buf_put_u32(call, rec->proc);
+	buf_put_u32(call, 1);		/* AUTH_SYS */
+	buf_put_opaque(call, cred.p, cred.len);
+	buf_put_u32(call, 0);		/* AUTH_NONE verifier */
+	buf_put_u32(call, 0);
+	free(cred.p);
+
+	if (rec->prog == NFS_PROGRAM && rec->vers == NFS_V3)
+		ok = map_args_nfs3(call, rec->proc, args, rec->arg_len);
+	else if (rec->prog == NFS_PROGRAM && rec->vers == NFS_V4
+		 && rec->proc == NFSPROC4_COMPOUND)
+		ok = map_args_nfs4(call, args, rec->arg_len);
+	else {
+		buf_put(call, args, rec->arg_len);
+		ok = true;
+	}
+
+	if (!ok)
+		return -1;
+
+	mark = htonl(0x80000000 | (call->len - 4));
+	memcpy(call->p, &mark, sizeof(mark));
+
+	if (write_full(fd, call->p, call->len) != 0
+	    || read_record(fd, reply) != 0)
+		return -1;
+
+	/* xid, REPLY, MSG_ACCEPTED, verifier, SUCCESS */
+	if (reply->len < 24 || get_u32(reply->p) != xid
+	    || get_u32(reply->p + 4) != 1 || get_u32(reply->p + 8) != 0)
+		return -1;
+
+	vlen = get_u32(reply->p + 16);
+	pos = 20 + nfs_capture_pad(vlen);
+	if (pos + 4 > reply->len || get_u32(reply->p + pos) != 0)
+		return -1;
+
+	*res = pos + 4;
+	return 0;
+}
+
+static int replay_9p(struct stream *st, struct nfs_capture_record *rec,
+		     struct buf *reply)
+{
+	const char *msg = (const char *)(rec + 1);
+	uint32_t size;
+	int fd = stream_sock(st, 0);
+
+	if (fd < 0)
+		return -1;
+
+	if (write_full(fd, msg, rec->arg_len) != 0)
+		return -1;
+
+	if (read_full(fd, &size, sizeof(size)) != 0)
+		return -1;
+	size = le32toh(size);
+	if (size < 7)
+		return -1;
+
+	reply->len = 0;
+	buf_reserve(reply, size);
+	return read_full(fd, reply->p, size - 4);
+}
+
+static void record_latency(uint64_t ns)
+{
+	int bucket = 0;
+
+	while ((bucket < NBUCKETS - 1) && ((1ULL << (bucket + 1)) <= ns))
+		++bucket;
+	__sync_fetch_and_add(&hist[bucket], 1);
+	__sync_fetch_and_add(&total_ns, ns);
+	__sync_fetch_and_add(&replayed, 1);
+}
+
+static void wait_until(uint64_t arrival_ns)
+{
+	struct timespec when;
+	uint64_t at;
+
+	if (speed <= 0)
+		return;
+
+	at = start.tv_sec * 1000000000ULL + start.tv_nsec +
+	    (uint64_t) (arrival_ns / speed);
+	when.tv_sec = at / 1000000000ULL;
+	when.tv_nsec = at % 1000000000ULL;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &when, NULL)
+	       == EINTR)
+		;
+}
+
+static void *stream_thread(void *arg)
+{
+	struct stream *st = arg;
+	struct buf call = { 0 }, reply = { 0 };
+	size_t i;
+
+	for (i = 0; i < st->nrecs; i++) {
+		struct nfs_capture_record *rec = st->recs[i];
+		uint64_t sent;
+		u_int res = 0;
+		int rc;
+
+		if (rec->kind == NFS_CAPTURE_RPC
+		    && port_for(rec->prog) == 0) {
+			__sync_fetch_and_add(&skipped, 1);
+			continue;
+		}
+
+		wait_until(rec->arrival_ns);
+		sent = now_ns();
+
+		if (rec->kind == NFS_CAPTURE_9P)
+			rc = replay_9p(st, rec, &reply);
+		else
+			rc = replay_rpc(st, rec, &call, &reply, &res);
+
+		if (rc != 0) {
+			__sync_fetch_and_add(&failures, 1);
+			continue;
+		}
+		record_latency(now_ns() - sent);
+
+		if (rec->kind == NFS_CAPTURE_RPC
+		    && (rec->flags & NFS_CAPTURE_HAS_RES)) {
+			const uint32_t *gids = (const uint32_t *)(rec + 1);
+			const char *cap = (const char *)(gids + rec->ngroups)
+			    + nfs_capture_pad(rec->arg_len);
+			const char *rep = reply.p + res;
+			u_int replen = reply.len - res;
+
+			/* NFS and MOUNT results start with a status */
+			if (rec->res_len >= 4 && replen >= 4
+			    && get_u32(cap) != get_u32(rep))
+				__sync_fetch_and_add(&mismatches, 1);
+
+			if (rec->prog == MOUNTPROG && rec->vers == MOUNT_V3)
+				learn_fh3(cap, rec->res_len, 4, rep, replen, 4);
+			else if (rec->prog == NFS_PROGRAM
+				 && rec->vers == NFS_V3)
+				learn_nfs3(rec->proc, cap, rec->res_len, rep,
+					   replen);
+			else if (rec->prog == NFS_PROGRAM
+				 && rec->vers == NFS_V4)
+				learn_nfs4(cap, rec->res_len, rep, replen);
+		}
+	}
+
+	for (i = 0; i < st->nsocks; i++)
+		close(st->socks[i].fd);
+	free(call.p);
+	free(reply.p);
+
+	return NULL;
+}
+
+/* Loading */
+
+static struct stream *find_stream(struct nfs_capture_record *rec)
+{
+	struct stream *st;
+	size_t i;
+
+	for (i = nstreams; i > 0; i--) {
+		st = streams[i - 1];
+		if (st->conn == rec->conn && st->kind == rec->kind
+		    && st->port == rec->port
+		    && memcmp(st->addr, rec->addr, sizeof(st->addr)) == 0)
+			return st;
+	}
+
+	st = calloc(1, sizeof(*st));
+	st->conn = rec->conn;
+	st->kind = rec->kind;
+	st->port = rec->port;
+	memcpy(st->addr, rec->addr, sizeof(st->addr));
+
+	streams = realloc(streams, (nstreams + 1) * sizeof(*streams));
+	streams[nstreams++] = st;
+
+	return st;
+}
+
+static int cmp_arrival(const void *a, const void *b)
+{
+	const struct nfs_capture_record *x =
+	    *(struct nfs_capture_record * const *)a;
+	const struct nfs_capture_record *y =
+	    *(struct nfs_capture_record * const *)b;
+
+	if (x->arrival_ns != y->arrival_ns)
+		return x->arrival_ns < y->arrival_ns ? -1 : 1;
+
+	/* Records were written in completion order, keep it */
+	return x < y ? -1 : x > y;
+}
+
+static int load(const char *path)
+{
+	struct stat sb;
+	char *log;
+	size_t pos, nrecs = 0;
+	int fd;
+	size_t i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	log = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (log == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+
+	if (sb.st_size < NFS_CAPTURE_MAGIC_LEN
+	    || memcmp(log, NFS_CAPTURE_MAGIC, NFS_CAPTURE_MAGIC_LEN) != 0) {
+		fprintf(stderr, "%s: not a capture log\n", path);
+		return -1;
+	}
+
+	for (pos = NFS_CAPTURE_MAGIC_LEN;
+	     pos + sizeof(struct nfs_capture_record) <= (size_t)sb.st_size;) {
+		struct nfs_capture_record *rec = (void *)(log + pos);
+		struct stream *st;
+
+		if (rec->length < sizeof(*rec)
+		    || pos + rec->length > (size_t)sb.st_size) {
+			fprintf(stderr, "%s: truncated at %zu\n", path, pos);
+			break;
+		}
+
+		st = find_stream(rec);
+		if (st->nrecs == st->cap) {
+			st->cap = st->cap ? st->cap * 2 : 64;
+			st->recs = realloc(st->recs,
+					   st->cap * sizeof(*st->recs));
+		}
+		st->recs[st->nrecs++] = rec;
+		nrecs++;
+		pos += rec->length;
+	}
+
+	for (i = 0; i < nstreams; i++)
+		qsort(streams[i]->recs, streams[i]->nrecs,
+		      sizeof(*streams[i]->recs), cmp_arrival);
+
+	printf("%zu records on %zu connections\n", nrecs, nstreams);
+	return 0;
+}
+
+static uint64_t percentile(double p)
+{
+	uint64_t want = (uint64_t) (p * replayed);
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < NBUCKETS; ++i) {
+		seen += hist[i];
+		if (seen >= want)
+			return 1ULL << (i + 1);
+	}
+
+	return 1ULL << NBUCKETS;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-h host] [-n nfs_port] [-m mnt_port] [-l nlm_port]\n"
+		"       [-q rquota_port] [-9 9p_port] [-s speed] capture\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t begin, elapsed;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "h:n:m:l:q:9:s:")) != -1) {
+		switch (opt) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'n':
+			nfs_port = atoi(optarg);
+			break;
+		case 'm':
+			mnt_port = atoi(optarg);
+			break;
+		case 'l':
+			nlm_port = atoi(optarg);
+			break;
+		case 'q':
+			rquota_port = atoi(optarg);
+			break;
+		case '9':
+			p9_port = atoi(optarg);
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if (load(argv[optind]) != 0)
+		return 1;
+
+	if (mnt_port == 0)
+		fprintf(stderr,
+			"no MOUNT port given, NFSv3 handles will not be mapped\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	begin = now_ns();
+	for (i = 0; i < nstreams; i++)
+		pthread_create(&streams[i]->thr, NULL, stream_thread,
+			       streams[i]);
+	for (i = 0; i < nstreams; i++)
+		pthread_join(streams[i]->thr, NULL);
+	elapsed = now_ns() - begin;
+
+	printf("replayed %llu skipped %llu failed %llu status mismatches %llu\n",
+	       (unsigned long long)replayed, (unsigned long long)skipped,
+	       (unsigned long long)failures, (unsigned long long)mismatches);
+	if (replayed != 0) {
+		printf("elapsed %.3fs, %.0f requests/sec\n", elapsed / 1e9,
+		       replayed / (elapsed / 1e9));
+		printf("latency: mean %lluns p50 <%lluns p99 <%lluns "
+		       "p99.9 <%lluns\n",
+		       (unsigned long long)(total_ns / replayed),
+		       (unsigned long long)percentile(0.5),
+		       (unsigned long long)percentile(0.99),
+		       (unsigned long long)percentile(0.999));
+	}
+
+	return failures != 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file ganesha_stats.c
+ * @brief Print the samples in a statistics recorder file
+ *
+ * Reads a file written with Stats_Recorder enabled and prints one
+ * line per sample, oldest first: requests, errors and mean latency
+ * over all protocols, read and write throughput, the request queue
+ * depth and the cache hit rate.  A line of dashes marks a server
+ * restart.
+ *
+ * Usage: ganesha_stats [-p] [-o] [-e] [-r] [-s start] [-t end]
+ *                      [-n count] file
+ *
+ * -p adds a line per protocol, -o one per operation, -e one per export
+ * and protocol, and -r prints every key and value of the sample as
+ * recorded.  -s and -t keep the samples taken from and up to the
+ * given times, in seconds since the epoch; -n keeps the last count
+ * samples.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define STATS_RECORDER_FORMAT_ONLY
+#include "stats_recorder.h"
+
+static const char *proto_names[STATS_PROTO_COUNT] = {
+	[STATS_NFSV3] = "nfsv3",
+	[STATS_NFSV40] = "nfsv4.0",
+	[STATS_NFSV41] = "nfsv4.1",
+	[STATS_NFSV42] = "nfsv4.2",
+	[STATS_NLM4] = "nlm4",
+	[STATS_MNTV1] = "mntv1",
+	[STATS_MNTV3] = "mntv3",
+	[STATS_RQUOTA] = "rquota",
+	[STATS_9P] = "9p",
+};
+
+static const char *field_names[STATS_FIELD_COUNT] = {
+	[STATS_OPS] = "ops",
+	[STATS_ERRORS] = "errors",
+	[STATS_DUPS] = "dups",
+	[STATS_LATENCY_NS] = "latency_ns",
+	[STATS_QUEUE_NS] = "queue_ns",
+	[STATS_READ_OPS] = "read_ops",
+	[STATS_READ_BYTES] = "read_bytes",
+	[STATS_WRITE_OPS] = "write_ops",
+	[STATS_WRITE_BYTES] = "write_bytes",
+};
+
+static const char *cache_names[STATS_CACHE_COUNT] = {
+	[STATS_CACHE_REQ] = "requests",
+	[STATS_CACHE_HIT] = "hits",
+	[STATS_CACHE_MISS] = "misses",
+	[STATS_CACHE_CONFLICT] = "conflicts",
+	[STATS_CACHE_ADDED] = "added",
+};
+
+static const char *op_classes[] = {
+	[STATS_KEY_NFSV3_OP] = "nfsv3",
+	[STATS_KEY_NFSV4_OP] = "nfsv4",
+	[STATS_KEY_NLM_OP] = "nlm4",
+	[STATS_KEY_MNT_OP] = "mnt",
+	[STATS_KEY_RQUOTA_OP] = "rquota",
+};
+
+static bool per_proto, per_op, per_export, raw;
+
+/**
+ * @brief Decode a record's keys and values
+ *
+ * @return Number of pairs, -1 if the record is malformed.
+ */
+
+static long decode(const uint8_t *rec, struct stats_pair **pairs,
+		   size_t *max)
+{
+	const struct stats_recorder_record *hdr = (const void *)rec;
+	const uint8_t *p = rec + sizeof(*hdr), *end = rec + hdr->length;
+	uint64_t delta, value;
+	uint32_t key = 0, i;
+
+	if (hdr->nkeys > *max) {
+		*max = hdr->nkeys;
+		*pairs = realloc(*pairs, *max * sizeof(**pairs));
+		if (*pairs == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < hdr->nkeys; i++) {
+		p = stats_get_varint(p, end, &delta);
+		if (p == NULL)
+			return -1;
+		p = stats_get_varint(p, end, &value);
+		if (p == NULL)
+			return -1;
+		key += delta;
+		(*pairs)[i].key = key;
+		(*pairs)[i].value = value;
+	}
+
+	return hdr->nkeys;
+}
+
+static void print_key(uint32_t key, uint64_t value)
+{
+	uint32_t class = STATS_KEY_CLASS(key);
+	uint32_t proto = (key >> 4) & 0xf, field = key & 0xf;
+
+	switch (class) {
+	case STATS_KEY_PROTO:
+		printf("  %s %s", proto < STATS_PROTO_COUNT ?
+		       proto_names[proto] : "?",
+		       field < STATS_FIELD_COUNT ? field_names[field] : "?");
+		break;
+	case STATS_KEY_EXPORT:
+		printf("  export %u %s %s", (key >> 8) & 0xffff,
+		       proto < STATS_PROTO_COUNT ? proto_names[proto] : "?",
+		       field < STATS_FIELD_COUNT ? field_names[field] : "?");
+		break;
+	case STATS_KEY_NFSV3_OP:
+	case STATS_KEY_NFSV4_OP:
+	case STATS_KEY_NLM_OP:
+	case STATS_KEY_MNT_OP:
+	case STATS_KEY_RQUOTA_OP:
+		printf("  %s op %u", op_classes[class], key & 0xffffff);
+		break;
+	case STATS_KEY_CACHE:
+		printf("  cache %s", (key & 0xffffff) < STATS_CACHE_COUNT ?
+		       cache_names[key & 0xffffff] : "?");
+		break;
+	case STATS_KEY_GAUGE:
+		printf("  gauge %u", key & 0xffffff);
+		break;
+	default:
+		printf("  key %08x", key);
+	}
+	printf(" %llu\n", (unsigned long long)value);
+}
+
+static void print_sample(const struct stats_recorder_record *hdr,
+			 const struct stats_pair *pairs, long n)
+{
+	uint64_t proto_ops[STATS_PROTO_COUNT] = { 0 };
+	uint64_t proto_lat[STATS_PROTO_COUNT] = { 0 };
+	uint64_t ops = 0, errors = 0, latency = 0;
+	uint64_t rd = 0, wr = 0, queue = 0, stalled = 0;
+	uint64_t cache_req = 0, cache_hit = 0;
+	double secs = hdr->interval_ms ? hdr->interval_ms / 1e3 : 1;
+	time_t when = hdr->time_ns / 1000000000ULL;
+	char stamp[32];
+	long i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t key = pairs[i].key, item = key & 0xffffff;
+		uint32_t proto = (key >> 4) & 0xf;
+		uint64_t v = pairs[i].value;
+
+		switch (STATS_KEY_CLASS(key)) {
+		case STATS_KEY_PROTO:
+			if (proto >= STATS_PROTO_COUNT)
+				break;
+			switch (key & 0xf) {
+			case STATS_OPS:
+				ops += v;
+				proto_ops[proto] += v;
+				break;
+			case STATS_ERRORS:
+				errors += v;
+				break;
+			case STATS_LATENCY_NS:
+				latency += v;
+				proto_lat[proto] += v;
+				break;
+			case STATS_READ_BYTES:
+				rd += v;
+				break;
+			case STATS_WRITE_BYTES:
+				wr += v;
+				break;
+			}
+			break;
+		case STATS_KEY_CACHE:
+			if (item == STATS_CACHE_REQ)
+				cache_req = v;
+			else if (item == STATS_CACHE_HIT)
+				cache_hit = v;
+			break;
+		case STATS_KEY_GAUGE:
+			if (item == STATS_GAUGE_STALLED)
+				stalled = v;
+			else if (item < STATS_GAUGE_STALLED)
+				queue += v;
+			break;
+		}
+	}
+
+	strftime(stamp, sizeof(stamp), "%F %T", localtime(&when));
+	printf("%s %6.1fs %9.1f %7.1f %8.3f %8.2f %8.2f %6llu %4llu %5.1f\n",
+	       stamp, hdr->interval_ms / 1e3, ops / secs, errors / secs,
+	       ops ? latency / 1e6 / ops : 0.0, rd / secs / 1048576.0,
+	       wr / secs / 1048576.0, (unsigned long long)queue,
+	       (unsigned long long)stalled,
+	       cache_req ? 100.0 * cache_hit / cache_req : 0.0);
+
+	if (per_proto) {
+		for (i = 0; i < STATS_PROTO_COUNT; i++) {
+			if (proto_ops[i] == 0)
+				continue;
+			printf("  %-8s %9.1f ops/s %8.3f ms\n", proto_names[i],
+			       proto_ops[i] / secs,
+			       proto_lat[i] / 1e6 / proto_ops[i]);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		uint32_t class = STATS_KEY_CLASS(pairs[i].key);
+
+		if (raw ||
+		    (per_op && class >= STATS_KEY_NFSV3_OP &&
+		     class <= STATS_KEY_RQUOTA_OP) ||
+		    (per_export && class == STATS_KEY_EXPORT &&
+		     (pairs[i].key & 0xf) == STATS_OPS))
+			print_key(pairs[i].key, pairs[i].value);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-p] [-o] [-e] [-r] [-s start] [-t end] [-n count] file\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct stats_recorder_header hdr;
+	struct stats_record_ref *refs;
+	struct stats_pair *pairs = NULL;
+	struct stat sb;
+	const uint8_t *file, *ring;
+	uint64_t start = 0, end = UINT64_MAX, checksum, boot = 0;
+	size_t count, first = 0, max = 0, i;
+	long last = -1;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "poers:t:n:")) != -1) {
+		switch (opt) {
+		case 'p':
+			per_proto = true;
+			break;
+		case 'o':
+			per_op = true;
+			break;
+		case 'e':
+			per_export = true;
+			break;
+		case 'r':
+			raw = true;
+			break;
+		case 's':
+			start = strtoull(optarg, NULL, 10) * 1000000000ULL;
+			break;
+		case 't':
+			end = strtoull(optarg, NULL, 10) * 1000000000ULL;
+			break;
+		case 'n':
+			last = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) != 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (sb.st_size < STATS_RECORDER_HEADER_SIZE) {
+		fprintf(stderr, "%s: not a statistics file\n", argv[optind]);
+		return 1;
+	}
+
+	file = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	memcpy(&hdr, file, sizeof(hdr));
+	checksum = hdr.checksum;
+	hdr.checksum = 0;
+	if (memcmp(hdr.magic, STATS_RECORDER_MAGIC,
+		   STATS_RECORDER_MAGIC_LEN) != 0 ||
+	    stats_recorder_sum(STATS_RECORDER_SUM_INIT, &hdr,
+			       sizeof(hdr)) != checksum) {
+		fprintf(stderr, "%s: not a statistics file\n", argv[optind]);
+		return 1;
+	}
+
+	/* The server may not have written to the end of the ring yet */
+	ring = file + STATS_RECORDER_HEADER_SIZE;
+	if (hdr.ring_size > (uint64_t)sb.st_size - STATS_RECORDER_HEADER_SIZE)
+		hdr.ring_size = sb.st_size - STATS_RECORDER_HEADER_SIZE;
+
+	refs = stats_ring_scan(ring, hdr.ring_size, &count);
+	if (last >= 0 && (size_t)last < count)
+		first = count - last;
+
+	printf("%-19s %7s %9s %7s %8s %8s %8s %6s %4s %5s\n", "time",
+	       "period", "ops/s", "err/s", "lat_ms", "rd_MB/s", "wr_MB/s",
+	       "queue", "stl", "hit%");
+	for (i = first; i < count; i++) {
+		const uint8_t *rec = ring + refs[i].off;
+		const struct stats_recorder_record *rhdr = (const void *)rec;
+		long n;
+
+		if (rhdr->time_ns < start || rhdr->time_ns > end)
+			continue;
+
+		n = decode(rec, &pairs, &max);
+		if (n < 0) {
+			fprintf(stderr, "sample %llu is malformed\n",
+				(unsigned long long)rhdr->seq);
+			continue;
+		}
+
+		if (boot != 0 && rhdr->boot != boot)
+			printf("---------- server restarted ----------\n");
+		boot = rhdr->boot;
+
+		print_sample(rhdr, pairs, n);
+	}
+
+	free(pairs);
+	free(refs);
+	return 0;
+}